@@ -0,0 +1,58 @@
+#ifndef GIT_CHAT_ARENA_H
+#define GIT_CHAT_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * arena api
+ *
+ * The arena api is a simple bump allocator, used where many short-lived
+ * allocations share the same lifetime (for instance, everything allocated
+ * while processing a batch of commits). Allocations are carved out of large
+ * chunks, and are never freed individually; instead, the whole arena is reset
+ * at once.
+ *
+ * Data Structure:
+ * struct arena
+ * - struct arena_chunk *chunks: list of chunks, most recently allocated first.
+ * - size_t chunk_size: default size of new chunks.
+ * */
+
+#define ARENA_DEFAULT_CHUNK_SIZE (16 * 1024)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct arena {
+	struct arena_chunk *chunks;
+	size_t chunk_size;
+};
+
+/**
+ * Initialize an arena. Chunks are allocated lazily, in multiples of
+ * `chunk_size` bytes. If `chunk_size` is zero, ARENA_DEFAULT_CHUNK_SIZE is used.
+ * */
+void arena_init(struct arena *arena, size_t chunk_size);
+
+/**
+ * Allocate `size` bytes from the arena. The memory is suitably aligned for any
+ * type, is not zeroed, and remains valid until the arena is reset or released.
+ * */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Invalidate all allocations from the arena. The first chunk allocated is kept
+ * for reuse; all others are freed.
+ * */
+void arena_reset(struct arena *arena);
+
+/**
+ * Release all memory under the arena.
+ * */
+void arena_release(struct arena *arena);
+
+#endif //GIT_CHAT_ARENA_H
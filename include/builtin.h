@@ -23,10 +23,13 @@ struct cmd_builtin {
 extern int cmd_channel(int argc, char *argv[]);
 extern int cmd_config(int argc, char *argv[]);
 extern int cmd_get(int argc, char *argv[]);
+extern int cmd_get_attachment(int argc, char *argv[]);
+extern int cmd_grep(int argc, char *argv[]);
 extern int cmd_init(int argc, char *argv[]);
 extern int cmd_message(int argc, char *argv[]);
 extern int cmd_publish(int argc, char *argv[]);
 extern int cmd_read(int argc, char *argv[]);
+extern int cmd_search(int argc, char *argv[]);
 extern int cmd_import_key(int argc, char *argv[]);
 
 struct cmd_builtin registered_builtins[] = {
@@ -36,7 +39,10 @@ struct cmd_builtin registered_builtins[] = {
 		{ "message", cmd_message },
 		{ "publish", cmd_publish },
 		{ "get", cmd_get },
+		{ "get-attachment", cmd_get_attachment },
 		{ "read", cmd_read },
+		{ "search", cmd_search },
+		{ "grep", cmd_grep },
 		{ "import-key", cmd_import_key },
 		{ NULL, NULL }
 };
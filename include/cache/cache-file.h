@@ -0,0 +1,197 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_CACHE_FILE_H
+#define GIT_CHAT_INCLUDE_CACHE_CACHE_FILE_H
+
+#include "gnupg/gpg-common.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * cache-file api
+ *
+ * Caches under `.git/chat-cache/` hold sensitive data (plaintext messages,
+ * session keys), so they are encrypted at rest to the secret keys of the
+ * current user. The cache-file api reads and writes such files, so that each
+ * cache only needs to deal with its own plaintext format.
+ *
+ * Cache files are written atomically, by writing to `<name>.lock` (created
+ * with rw permission for the current user only) and renaming it into place.
+ *
+ * While a lock is held, the lock file holds the pid of the process holding
+ * it. Locks still held when the process exits (for instance, through FATAL())
+ * are removed. A lock left behind by a process that crashed is stale: it is
+ * reclaimed, with a warning, if its process no longer exists, or if it holds
+ * no pid and is older than CACHE_LOCK_STALE_SECONDS. Locks of live processes
+ * are never reclaimed, however long they are held.
+ * */
+
+#define CACHE_LOCK_STALE_SECONDS (10 * 60)
+
+/**
+ * Read and decrypt the cache file `name` into `plaintext`.
+ *
+ * Returns zero if successful, positive if the cache file does not exist, and
+ * negative if it could not be decrypted.
+ * */
+int cache_file_read(struct gc_gpgme_ctx *ctx, const char *name,
+		struct strbuf *plaintext);
+
+/**
+ * Encrypt `plaintext` to the usable secret keys of the current user and write
+ * it to the cache file `name`, creating the cache directory if necessary.
+ *
+ * Returns zero if successful, and non-zero if the cache file could not be
+ * written, for instance if the user has no usable secret keys.
+ * */
+int cache_file_write(struct gc_gpgme_ctx *ctx, const char *name,
+		const struct strbuf *plaintext);
+
+/**
+ * A lock on a cache file, held while the new content of the cache file is
+ * prepared. `path` is the path to the cache file itself.
+ * */
+struct cache_lock {
+	struct strbuf path;
+	struct strbuf lock_path;
+	int fd;
+
+	// next lock held by this process, removed at exit if still held
+	struct cache_lock *next;
+};
+
+/**
+ * Lock the cache file `name` by creating `<name>.lock`, creating the cache
+ * directory if necessary. Caches that are updated with read-modify-write
+ * should read the cache file only once the lock is held, so that concurrent
+ * updates are not lost.
+ *
+ * Returns zero if successful, and non-zero if the lock could not be taken (for
+ * instance, if it is held by another live process). On success, the lock must
+ * be released with cache_file_commit() or cache_file_rollback(), and `lock`
+ * must remain valid until then.
+ * */
+int cache_file_lock(struct cache_lock *lock, const char *name);
+
+/**
+ * Write `data` to the lock file and rename it into place, releasing the lock.
+ *
+ * Returns zero if successful, and non-zero if the cache file could not be
+ * written, in which case the cache file is left unchanged.
+ * */
+int cache_file_commit(struct cache_lock *lock, const char *data, size_t len);
+
+/**
+ * Release the lock, leaving the cache file unchanged.
+ * */
+void cache_file_rollback(struct cache_lock *lock);
+
+/**
+ * Encrypt `plaintext` to the usable secret keys of the current user and
+ * commit it to the cache file locked by `lock` (see cache_file_commit()). The
+ * lock is released in any case.
+ *
+ * Returns zero if successful, and non-zero if the cache file could not be
+ * written, for instance if the user has no usable secret keys.
+ * */
+int cache_file_commit_encrypted(struct gc_gpgme_ctx *ctx, struct cache_lock *lock,
+		const struct strbuf *plaintext);
+
+struct keyed_cache;
+
+/**
+ * Describes the entries of a keyed cache, and how they are stored in its cache
+ * file. Entries are hashmap entries, owned by the cache once put.
+ * */
+struct keyed_cache_type {
+	// name of the cache file, and the first line of its plaintext
+	const char *file;
+	const char *header;
+
+	// names of the cache and of its entries, for logging
+	const char *name;
+	const char *entries;
+
+	hashmap_cmp_fn cmp;
+
+	/**
+	 * Parse the record at the start of `data`, and put its entry into the
+	 * cache. Returns the length of the record, or zero if it is malformed.
+	 * */
+	size_t (*parse)(struct keyed_cache *cache, const char *data, size_t len);
+
+	// append the record for an entry to `out`
+	void (*serialize)(void *entry, struct strbuf *out);
+
+	// whether two entries for the same key hold the same value
+	int (*same_value)(const void *a, const void *b);
+
+	// optional; whether an entry is written to the cache file at all
+	int (*stored)(const void *entry);
+
+	// release an entry, clearing sensitive data from memory
+	void (*free)(void *entry);
+};
+
+/**
+ * A keyed cache is an encrypted cache file of records keyed by some id (such
+ * as a commit id), held in memory in a hashmap. The cache file is read once
+ * when loaded, and written again only if entries were put since.
+ * */
+struct keyed_cache {
+	struct hashmap entries;
+	const struct keyed_cache_type *type;
+	unsigned dirty: 1;
+
+	// whether the cache was loaded from disk (rather than being rebuilt), in
+	// which case entries cached since by other processes are kept on write
+	unsigned loaded: 1;
+};
+
+/**
+ * Initialize an empty keyed cache of the given type. Must be released with
+ * keyed_cache_release() after use.
+ * */
+void keyed_cache_init(struct keyed_cache *cache, const struct keyed_cache_type *type);
+
+/**
+ * Load the cache from its cache file, decrypting it with the given gpgme
+ * context.
+ *
+ * Returns zero if the cache was loaded successfully or if no cache exists yet,
+ * and non-zero if the cache exists but could not be decrypted or parsed. In
+ * the latter case, the cache is left empty.
+ * */
+int keyed_cache_load(struct keyed_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Look up an entry, with the same semantics as hashmap_get().
+ * */
+void *keyed_cache_get(struct keyed_cache *cache, const void *key, const void *keydata);
+
+/**
+ * Put an entry into the cache, replacing any entry for the same key. If the
+ * cache already holds the same value for the key, the new entry is released
+ * and the cache is left unchanged, and doesn't need to be written.
+ * */
+void keyed_cache_put(struct keyed_cache *cache, void *entry);
+
+/**
+ * Encrypt the cache to the secret keys of the current user and write it to
+ * its cache file. The cache is written atomically, and only if entries were
+ * put since it was loaded.
+ *
+ * If the cache was loaded with keyed_cache_load(), the cache file is read
+ * again while it is locked, and entries cached by other processes in the
+ * meantime are kept.
+ *
+ * Returns zero if the cache was written (or did not need to be written), and
+ * non-zero if the cache could not be written, for instance if the user has no
+ * usable secret keys.
+ * */
+int keyed_cache_write(struct keyed_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Release the cache and each of its entries.
+ * */
+void keyed_cache_release(struct keyed_cache *cache);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_CACHE_FILE_H
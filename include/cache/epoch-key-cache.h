@@ -0,0 +1,95 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_EPOCH_KEY_CACHE_H
+#define GIT_CHAT_INCLUDE_CACHE_EPOCH_KEY_CACHE_H
+
+#include "cache/cache-file.h"
+#include "git/git.h"
+#include "gnupg/gpg-common.h"
+#include "gnupg/group-key.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * epoch-key-cache api
+ *
+ * Messages on channels with a group key are encrypted with the key of their
+ * membership epoch (see gnupg/group-key.h). Unwrapping an epoch key is a
+ * public-key operation, so the epoch key cache keeps the keys that were
+ * unwrapped, keyed by epoch id. Epochs that could not be unwrapped (because we
+ * are not a member) are remembered for the lifetime of the cache, but are not
+ * written to disk.
+ *
+ * The cache is stored in `.git/chat-cache/epoch-keys`, encrypted at rest to
+ * the secret keys of the current user.
+ * */
+
+struct epoch_key_cache_entry {
+	struct hashmap_entry ent;
+	char id[GROUP_KEY_EPOCH_ID_LEN + 1];
+
+	// epoch key, or empty if the epoch key could not be unwrapped
+	struct strbuf key;
+};
+
+struct epoch_key_cache {
+	struct keyed_cache cache;
+};
+
+/**
+ * Initialize an empty epoch key cache. Must be released with
+ * epoch_key_cache_release() after use.
+ * */
+void epoch_key_cache_init(struct epoch_key_cache *cache);
+
+/**
+ * Load the epoch key cache from `.git/chat-cache/epoch-keys`, decrypting it
+ * with the given gpgme context.
+ *
+ * Returns zero if the cache was loaded successfully or if no cache exists yet,
+ * and non-zero if the cache exists but could not be decrypted or parsed. In
+ * the latter case, the cache is left empty.
+ * */
+int epoch_key_cache_load(struct epoch_key_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Look up an epoch in the cache.
+ *
+ * Returns the entry, or NULL if the epoch is not cached.
+ * */
+struct epoch_key_cache_entry *epoch_key_cache_get(struct epoch_key_cache *cache,
+		const char *id);
+
+/**
+ * Insert the key of an epoch into the cache. If `key` is NULL, the epoch is
+ * remembered as one that cannot be unwrapped.
+ * */
+void epoch_key_cache_put(struct epoch_key_cache *cache, const char *id, const char *key);
+
+/**
+ * Look up the key of an epoch, unwrapping it with the secret keys available to
+ * `ctx` if it is not cached. The epoch file is read from the tree of the given
+ * commit, which should be a commit of the epoch.
+ *
+ * Returns the epoch key, or NULL if it could not be unwrapped. The key is
+ * owned by the cache.
+ * */
+const char *epoch_key_cache_resolve(struct epoch_key_cache *cache,
+		struct gc_gpgme_ctx *ctx, const char *id, const struct git_oid *commit);
+
+/**
+ * Encrypt the epoch key cache to the secret keys of the current user and write
+ * it to `.git/chat-cache/epoch-keys`. The cache is written atomically, and
+ * only if keys were added since it was loaded. Epoch keys cached by other
+ * processes in the meantime are kept (see keyed_cache_write()).
+ *
+ * Returns zero if the cache was written (or did not need to be written), and
+ * non-zero if the cache could not be written.
+ * */
+int epoch_key_cache_write(struct epoch_key_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Release any resources under the epoch key cache. Epoch keys held by the
+ * cache are cleared from memory.
+ * */
+void epoch_key_cache_release(struct epoch_key_cache *cache);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_EPOCH_KEY_CACHE_H
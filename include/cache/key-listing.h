@@ -0,0 +1,176 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_KEY_LISTING_H
+#define GIT_CHAT_INCLUDE_CACHE_KEY_LISTING_H
+
+#include "arena.h"
+#include "cache/keyring-manifest.h"
+#include "gnupg/gpg-common.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * key-listing api
+ *
+ * Listing the keys in the git-chat keyring with gpg is slow for large
+ * keyrings, and the keyring rarely changes between messages. The key listing
+ * cache keeps a snapshot of the listing: for each key, its fingerprint, flags
+ * (including whether it is usable for encryption and whether it is secret),
+ * expiry and user ids.
+ *
+ * The snapshot is tagged with the size and modification time of the public
+ * keyring and of the secret key store, and is discarded if either has changed
+ * since (for instance, once new keys were imported by rebuild_gpg_keyring()).
+ *
+ * Keys in the snapshot are not gpgme keys. The recipient and trust filters
+ * run against the snapshot, and once the recipients of a message are selected,
+ * only those keys are read from the keyring with gpg_key_set_resolve().
+ *
+ * The snapshot is stored in `.git/chat-cache/key-listing`. It only describes
+ * public key material already committed under `.keys`, so it is not encrypted:
+ *
+ * git-chat key listing v1
+ * pubring <size> <mtime seconds> <mtime nanoseconds>
+ * secring <size> <mtime seconds> <mtime nanoseconds>
+ * key <fingerprint> <flags> <expires>
+ * uid <uid>\t<name>\t<email>\t<comment>\t<address>
+ *
+ * Each `key` line is followed by the `uid` lines of the key. Flags are a string
+ * of the characters `r` (revoked), `x` (expired), `d` (disabled), `i`
+ * (invalid), `e` (can encrypt) and `s` (secret), or `-`. User id fields are
+ * escaped, so that they cannot contain tabs or newlines.
+ * */
+
+struct key_listing_uid {
+	char *uid;
+	char *name;
+	char *email;
+	char *comment;
+	char *address;
+
+	struct key_listing_uid *next;
+};
+
+struct key_listing_entry {
+	char *fpr;
+	long expires;
+
+	unsigned revoked: 1;
+	unsigned expired: 1;
+	unsigned disabled: 1;
+	unsigned invalid: 1;
+	unsigned can_encrypt: 1;
+	unsigned secret: 1;
+
+	struct key_listing_uid *uids;
+};
+
+struct key_listing_match {
+	struct hashmap_entry ent;
+	const char *value;
+
+	// position of the matching key in the listing
+	size_t pos;
+};
+
+struct key_listing {
+	struct keyring_stamp pubring;
+	struct keyring_stamp secring;
+
+	struct key_listing_entry *keys;
+	size_t len;
+	size_t alloc;
+
+	// index over the fingerprint and user id fields of the keys
+	struct hashmap index;
+	unsigned indexed: 1;
+
+	// user ids and strings of the keys
+	struct arena arena;
+};
+
+/**
+ * Initialize an empty key listing. Must be released with
+ * key_listing_release() after use.
+ * */
+void key_listing_init(struct key_listing *listing);
+
+/**
+ * Fill the listing with the keys in the keyring of the gpgme context. The
+ * snapshot in the key listing cache is used if it is up to date; otherwise,
+ * the keys are listed with gpg and the cache is updated. If `refresh` is
+ * non-zero, the cache is ignored.
+ *
+ * Returns the number of keys in the listing.
+ * */
+size_t key_listing_fetch(struct gc_gpgme_ctx *ctx, struct key_listing *listing,
+		int refresh);
+
+/**
+ * Filter the listing according to the return value of a filter predicate
+ * function, which returns 0 if the key should be removed from the listing, or
+ * 1 if the key is kept. The order of the remaining keys is preserved.
+ *
+ * Returns the number of keys removed from the listing.
+ * */
+size_t key_listing_filter(struct key_listing *listing,
+		int (*predicate)(const struct key_listing_entry *key, void *data),
+		void *optional_data);
+
+/**
+ * Remove every key from the listing whose entry in `retain` is zero. `retain`
+ * must have one entry for each key in the listing.
+ *
+ * Returns the number of keys removed from the listing.
+ * */
+size_t key_listing_retain(struct key_listing *listing, const unsigned char *retain);
+
+/**
+ * Find a key whose fingerprint, or any uid, name, email, comment or address
+ * field of any of its user ids, is equal to `value`. Further matches can be
+ * enumerated with key_listing_lookup_next(). The index behind lookups is built
+ * on the first lookup, and matches are only valid until keys are removed.
+ *
+ * Returns the first match, or NULL if no key matches.
+ * */
+const struct key_listing_match *key_listing_lookup(struct key_listing *listing,
+		const char *value);
+
+/**
+ * Find the next key matching the same value as `match`.
+ *
+ * Returns the next match, or NULL if none remain.
+ * */
+const struct key_listing_match *key_listing_lookup_next(struct key_listing *listing,
+		const struct key_listing_match *match);
+
+/**
+ * Predefined filter function, with the same semantics as
+ * filter_gpg_unusable_keys(), which filters keys that are expired, disabled,
+ * invalid, revoked or cannot be used for encryption.
+ * */
+int key_listing_filter_unusable(const struct key_listing_entry *key, void *data);
+
+/**
+ * Predefined filter function, with the same semantics as
+ * filter_gpg_secret_keys(), which filters secret keys.
+ * */
+int key_listing_filter_secret(const struct key_listing_entry *key, void *data);
+
+/**
+ * Parse the content of a key listing cache file into `listing`, which must be
+ * empty.
+ *
+ * Returns zero if successful, and non-zero if the content is malformed.
+ * */
+int key_listing_parse(struct key_listing *listing, const char *data, size_t len);
+
+/**
+ * Serialize the listing into `out`.
+ * */
+void key_listing_serialize(struct key_listing *listing, struct strbuf *out);
+
+/**
+ * Release any resources under the listing.
+ * */
+void key_listing_release(struct key_listing *listing);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_KEY_LISTING_H
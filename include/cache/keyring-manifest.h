@@ -0,0 +1,137 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_KEYRING_MANIFEST_H
+#define GIT_CHAT_INCLUDE_CACHE_KEYRING_MANIFEST_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "hashmap.h"
+#include "str-array.h"
+#include "strbuf.h"
+
+/**
+ * keyring-manifest api
+ *
+ * Before a message is encrypted, the git-chat keyring is brought up to date
+ * with the key files under `.git-chat/keys`. Importing every key file with gpg
+ * on every message is slow for channels with many members, so the keyring
+ * manifest remembers what was last imported: for each key file, its size,
+ * modification time and the fingerprints of the keys it contained. Only key
+ * files that were added or changed since need to be imported, and the keys of
+ * removed key files can be deleted from the keyring.
+ *
+ * The manifest also records the size and modification time of the keyring
+ * itself, so that changes to the keyring made behind git-chat's back (or a
+ * keyring that was deleted) are detected, in which case the keyring is
+ * rebuilt from scratch.
+ *
+ * As with git's index, a key file modified in the same instant the manifest
+ * was written cannot be told apart from an unmodified one by its timestamp
+ * alone. Such "racily clean" key files are always imported again.
+ *
+ * The manifest is stored in `.git/chat-cache/keyring-manifest`. It only
+ * describes public key files, so it is not encrypted:
+ *
+ * git-chat keyring manifest v1
+ * keyring <size> <mtime seconds> <mtime nanoseconds>
+ * <size> <mtime seconds> <mtime nanoseconds> <fingerprint>[,<fingerprint>...] <file name>
+ * */
+
+struct keyring_stamp {
+	int64_t size;
+	int64_t mtime_sec;
+	long mtime_nsec;
+};
+
+struct keyring_manifest_entry {
+	struct hashmap_entry ent;
+	char *name;
+	struct keyring_stamp stamp;
+	struct str_array fingerprints;
+	unsigned seen: 1;
+};
+
+struct keyring_manifest {
+	struct hashmap entries;
+	struct keyring_stamp keyring;
+
+	// when the manifest was last written, for racy timestamps
+	struct keyring_stamp written;
+};
+
+/**
+ * Fill a stamp from the result of stat(2).
+ * */
+void keyring_stamp_from_stat(struct keyring_stamp *stamp, const struct stat *st);
+
+/**
+ * Compare two stamps. Returns zero if they are equal.
+ * */
+int keyring_stamp_cmp(const struct keyring_stamp *a, const struct keyring_stamp *b);
+
+/**
+ * Initialize an empty manifest. Must be released with
+ * keyring_manifest_release() after use.
+ * */
+void keyring_manifest_init(struct keyring_manifest *manifest);
+
+/**
+ * Load the manifest from `.git/chat-cache/keyring-manifest`.
+ *
+ * Returns zero if successful, positive if there is no manifest, and negative
+ * if the manifest is malformed. Unless successful, the manifest is left
+ * empty.
+ * */
+int keyring_manifest_load(struct keyring_manifest *manifest);
+
+/**
+ * Write the manifest to `.git/chat-cache/keyring-manifest`.
+ *
+ * Returns zero if successful, and non-zero otherwise.
+ * */
+int keyring_manifest_write(struct keyring_manifest *manifest);
+
+/**
+ * Parse the content of a manifest file into `manifest`, which must be empty.
+ *
+ * Returns zero if successful, and non-zero if the manifest is malformed.
+ * */
+int keyring_manifest_parse(struct keyring_manifest *manifest, const char *data, size_t len);
+
+/**
+ * Serialize the manifest into `out`.
+ * */
+void keyring_manifest_serialize(struct keyring_manifest *manifest, struct strbuf *out);
+
+/**
+ * Look up the entry for the key file `name`, or NULL if there is none.
+ * */
+struct keyring_manifest_entry *keyring_manifest_get(struct keyring_manifest *manifest,
+		const char *name);
+
+/**
+ * Record that the key file `name` with stamp `stamp` was imported, and
+ * contained the keys with the given fingerprints. Any existing entry for the
+ * key file is replaced. Returns the new entry.
+ * */
+struct keyring_manifest_entry *keyring_manifest_put(struct keyring_manifest *manifest,
+		const char *name, const struct keyring_stamp *stamp,
+		const struct str_array *fingerprints);
+
+/**
+ * Remove the entry for a key file, if any.
+ * */
+void keyring_manifest_remove(struct keyring_manifest *manifest, const char *name);
+
+/**
+ * Determine whether the key file described by `entry` is unchanged, given its
+ * current stamp. Racily clean key files are considered changed.
+ * */
+int keyring_manifest_entry_is_current(const struct keyring_manifest *manifest,
+		const struct keyring_manifest_entry *entry, const struct keyring_stamp *stamp);
+
+/**
+ * Release any resources under the manifest.
+ * */
+void keyring_manifest_release(struct keyring_manifest *manifest);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_KEYRING_MANIFEST_H
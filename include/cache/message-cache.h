@@ -0,0 +1,97 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_MESSAGE_CACHE_H
+#define GIT_CHAT_INCLUDE_CACHE_MESSAGE_CACHE_H
+
+#include "cache/cache-file.h"
+#include "git/git.h"
+#include "git/commit.h"
+#include "gnupg/gpg-common.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * message-cache api
+ *
+ * The message cache is a persistent store of already-decrypted messages, keyed
+ * by commit id. Decrypting a message costs a public-key operation in gpg, which
+ * is by far the most expensive part of reading a channel. With the cache, each
+ * message only needs to be decrypted once; subsequent reads are served from the
+ * cache.
+ *
+ * The cache is stored in `.git/chat-cache/messages`. Since the cache holds
+ * plaintext, it is encrypted at rest to the secret keys of the current user.
+ * The cache file is decrypted once when loaded, and re-encrypted when written,
+ * so the number of gpg operations per read no longer grows with the number of
+ * messages in the channel.
+ *
+ * Messages that could not be decrypted are never cached, so that they may be
+ * decrypted later if the appropriate key becomes available.
+ * */
+
+struct message_cache_entry {
+	struct hashmap_entry ent;
+	struct git_oid oid;
+	enum message_type type;
+	struct strbuf message;
+};
+
+struct message_cache {
+	struct keyed_cache cache;
+};
+
+/**
+ * Initialize an empty message cache. Must be released with
+ * message_cache_release() after use.
+ * */
+void message_cache_init(struct message_cache *cache);
+
+/**
+ * Load the message cache from `.git/chat-cache/messages`, decrypting it with
+ * the given gpgme context.
+ *
+ * Returns zero if the cache was loaded successfully or if no cache exists yet,
+ * and non-zero if the cache exists but could not be decrypted or parsed. In
+ * the latter case, the cache is left empty.
+ * */
+int message_cache_load(struct message_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Look up the cached message for a commit.
+ *
+ * Returns the entry, or NULL if the message is not cached.
+ * */
+struct message_cache_entry *message_cache_get(struct message_cache *cache,
+		const struct git_oid *oid);
+
+/**
+ * Insert a message into the cache. `type` must be DECRYPTED or PLAINTEXT. For
+ * PLAINTEXT messages, `message` may be NULL since the message body is already
+ * available from the commit itself.
+ *
+ * If the same message is already cached for the commit, the cache is left
+ * unchanged, and doesn't need to be written.
+ * */
+void message_cache_put(struct message_cache *cache, const struct git_oid *oid,
+		enum message_type type, const struct strbuf *message);
+
+/**
+ * Encrypt the message cache to the secret keys of the current user and write
+ * it to `.git/chat-cache/messages`. The cache is written atomically, and only
+ * if entries were added since it was loaded.
+ *
+ * If the cache was loaded with message_cache_load(), the cache file is read
+ * again while it is locked, and messages cached by other processes in the
+ * meantime are kept.
+ *
+ * Returns zero if the cache was written (or did not need to be written), and
+ * non-zero if the cache could not be written, for instance if the user has no
+ * usable secret keys.
+ * */
+int message_cache_write(struct message_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Release any resources under the message cache. Plaintext held by the cache
+ * is cleared from memory.
+ * */
+void message_cache_release(struct message_cache *cache);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_MESSAGE_CACHE_H
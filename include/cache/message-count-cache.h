@@ -0,0 +1,123 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_MESSAGE_COUNT_CACHE_H
+#define GIT_CHAT_INCLUDE_CACHE_MESSAGE_COUNT_CACHE_H
+
+#include "git/git.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * message-count-cache api
+ *
+ * `git chat channel list` shows the number of messages in each channel (like
+ * `git rev-list --count --first-parent --no-merges <tip>`) and the number of
+ * messages newer than the read watermark of the channel. Rather than counting
+ * the full history of every channel each time, counts are cached by the commit
+ * at the tip of the channel. Channels whose tips haven't moved are counted
+ * without reading any commits, and when a tip advances, only the new commits
+ * are walked, up to the previous tip.
+ *
+ * Along with the message count, each entry records the depth of the commit
+ * (the number of commits on its first-parent history, including merges and
+ * itself), which tells how far to walk from a tip to find out whether another
+ * commit (like a read watermark) is on its first-parent history. Entries may
+ * also record the number of unread messages, for a given watermark.
+ *
+ * The cache is stored in `.git/chat-cache/message-counts`. Since it only holds
+ * commit ids and counts, it is not encrypted:
+ *
+ * git-chat message counts v1
+ * <commit id> <count> <depth>
+ * <commit id> <count> <depth> <watermark commit id> <unread>
+ *
+ * The depth is -1 if unknown.
+ * */
+
+struct message_count {
+	struct hashmap_entry ent;
+	struct git_oid oid;
+	int count;
+	int depth;
+
+	// unread messages since `watermark`, if `has_unread`
+	struct git_oid watermark;
+	int unread;
+	unsigned has_unread: 1;
+
+	// whether to keep the entry when the cache is written
+	unsigned keep: 1;
+	unsigned loaded: 1;
+};
+
+struct message_count_cache {
+	struct hashmap counts;
+	unsigned dirty: 1;
+};
+
+/**
+ * Initialize an empty cache. Must be released with message_count_cache_release()
+ * after use.
+ * */
+void message_count_cache_init(struct message_count_cache *cache);
+
+/**
+ * Load the cache from `.git/chat-cache/message-counts`.
+ *
+ * Returns zero if successful, positive if there is no cache, and negative if
+ * the cache is malformed. Unless successful, the cache is left empty.
+ * */
+int message_count_cache_load(struct message_count_cache *cache);
+
+/**
+ * Write the entries of the cache that were kept with message_count_cache_keep()
+ * to `.git/chat-cache/message-counts`, dropping all others. Nothing is written
+ * if the kept entries are the ones that were loaded, unchanged.
+ *
+ * Returns zero if successful, and non-zero otherwise.
+ * */
+int message_count_cache_write(struct message_count_cache *cache);
+
+/**
+ * Parse the content of a cache file into `cache`, which must be empty. Parsed
+ * entries are marked as loaded.
+ *
+ * Returns zero if successful, and non-zero if the cache is malformed.
+ * */
+int message_count_cache_parse(struct message_count_cache *cache, const char *data, size_t len);
+
+/**
+ * Serialize the kept entries of the cache into `out`.
+ * */
+void message_count_cache_serialize(struct message_count_cache *cache, struct strbuf *out);
+
+/**
+ * Look up the entry for the commit `oid`, or NULL if there is none.
+ * */
+struct message_count *message_count_cache_get(struct message_count_cache *cache,
+		const struct git_oid *oid);
+
+/**
+ * Record the message count and depth of the commit `oid`. Any existing entry
+ * for the commit is replaced. The entry isn't kept unless given to
+ * message_count_cache_keep(). Returns the new entry.
+ * */
+struct message_count *message_count_cache_put(struct message_count_cache *cache,
+		const struct git_oid *oid, int count, int depth);
+
+/**
+ * Keep the entry when the cache is written.
+ * */
+void message_count_cache_keep(struct message_count_cache *cache,
+		struct message_count *entry);
+
+/**
+ * Record the number of unread messages of the entry since `watermark`.
+ * */
+void message_count_cache_set_unread(struct message_count_cache *cache,
+		struct message_count *entry, const struct git_oid *watermark, int unread);
+
+/**
+ * Release any resources under the cache.
+ * */
+void message_count_cache_release(struct message_count_cache *cache);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_MESSAGE_COUNT_CACHE_H
@@ -0,0 +1,160 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_MESSAGE_INDEX_H
+#define GIT_CHAT_INCLUDE_CACHE_MESSAGE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "git/git.h"
+#include "strbuf.h"
+
+/**
+ * message-index api
+ *
+ * The message index is a per-channel file under `.git/chat-cache` that lists
+ * every message in the channel as a fixed-size record, oldest first. Since
+ * records have a fixed size, the n-th most recent message can be found by
+ * direct array indexing, without walking the history. This makes it cheap to
+ * show an arbitrary page of a channel, or to resume reading from a cursor.
+ *
+ * The index is updated incrementally: when the tip of the channel advances,
+ * only the new commits are traversed and appended. If the history of the
+ * channel was rewritten, the index is rebuilt from scratch.
+ *
+ * Alongside the records, the index holds two secondary indexes, so that
+ * messages can be filtered by time or by author without reading (let alone
+ * decrypting) every commit: a column of author timestamps sorted for binary
+ * search, and a posting list of message positions for each author.
+ *
+ * The index file is mmap'd and has the following layout (all integers are
+ * big-endian):
+ *
+ * header:
+ *     4-byte signature 'GCMI'
+ *     4-byte version number (2)
+ *     4-byte number of records
+ *     4-byte length of the name table
+ *     4-byte number of authors
+ *     20-byte object id of the newest indexed commit
+ * records, oldest first:
+ *     20-byte commit id
+ *     8-byte author timestamp (seconds since epoch)
+ *     4-byte offset of the author name in the name table
+ *     4-byte size of the commit body (the encrypted message)
+ * timestamp column, one entry per record, sorted by timestamp:
+ *     8-byte author timestamp
+ *     4-byte record position
+ * authors:
+ *     4-byte offset of the author name in the name table
+ *     4-byte index of the author's first posting
+ *     4-byte number of postings
+ * postings, one per record, grouped by author:
+ *     4-byte record position (ascending within each author)
+ * name table:
+ *     null-terminated author names, each stored once
+ *
+ * The index holds only commit metadata that is already visible in the
+ * repository, so it is not encrypted.
+ * */
+
+struct message_index {
+	void *map;
+	size_t map_len;
+
+	size_t count;
+	struct git_oid tip;
+	const unsigned char *records;
+	const unsigned char *time_index;
+	const unsigned char *authors;
+	size_t authors_count;
+	const unsigned char *postings;
+	const char *names;
+	size_t names_len;
+};
+
+struct message_index_record {
+	struct git_oid oid;
+	int64_t timestamp;
+	const char *author;
+	uint32_t body_size;
+};
+
+/**
+ * Bring the message index of `channel` (a full ref name) up to date with the
+ * tip of the current channel, traversing only the commits that are not
+ * already indexed.
+ *
+ * Returns zero if successful, and non-zero if the index could not be updated.
+ * */
+int message_index_update(const char *channel);
+
+/**
+ * Open the message index of `channel`, mapping it into memory. The index must
+ * be closed with message_index_close().
+ *
+ * Returns zero if successful, positive if the channel has no index, and
+ * negative if the index is malformed.
+ * */
+int message_index_open(struct message_index *index, const char *channel);
+
+/**
+ * Unmap the message index.
+ * */
+void message_index_close(struct message_index *index);
+
+/**
+ * Read the record at position `pos`, where position zero is the oldest
+ * message in the channel. `pos` must be less than `index->count`.
+ *
+ * The author name points into the mapped index, and is only valid until the
+ * index is closed.
+ * */
+void message_index_get(const struct message_index *index, size_t pos,
+		struct message_index_record *record);
+
+/**
+ * Build an opaque cursor token that refers to the message at position `pos`.
+ * Cursors remain valid as new messages arrive, since positions are counted from
+ * the oldest message.
+ * */
+void message_index_cursor(const struct message_index *index, size_t pos,
+		struct strbuf *cursor);
+
+/**
+ * Resolve a cursor token built with message_index_cursor() to a position in
+ * the index.
+ *
+ * Returns zero if successful, and non-zero if the token is malformed or does
+ * not refer to a message in this index (for instance, if the history of the
+ * channel was rewritten since the cursor was issued).
+ * */
+int message_index_resolve_cursor(const struct message_index *index,
+		const char *cursor, size_t *pos);
+
+struct message_index_filter {
+	/**
+	 * Inclusive bounds on the author timestamp, if `has_since` and
+	 * `has_until` are set.
+	 * */
+	int64_t since;
+	int64_t until;
+	unsigned has_since: 1;
+	unsigned has_until: 1;
+
+	/**
+	 * Extended regular expression matched against author names, or NULL.
+	 * */
+	const char *author;
+};
+
+/**
+ * Find the messages matching `filter`, using the secondary indexes. The
+ * positions of matching messages are written to a newly allocated array
+ * `positions` in ascending order (oldest first), which must be freed by the
+ * caller.
+ *
+ * Returns zero if successful, and non-zero if the author pattern is invalid.
+ * */
+int message_index_filter(const struct message_index *index,
+		const struct message_index_filter *filter, size_t **positions, size_t *len);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_MESSAGE_INDEX_H
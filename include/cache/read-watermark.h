@@ -0,0 +1,42 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_READ_WATERMARK_H
+#define GIT_CHAT_INCLUDE_CACHE_READ_WATERMARK_H
+
+#include "git/git.h"
+
+/**
+ * read-watermark api
+ *
+ * A read watermark records, for each channel, the most recent commit that was
+ * shown by `git chat read --new`. The next `read --new` only needs to traverse
+ * the commits between the watermark and the tip of the channel, so the work
+ * done after a fetch scales with the number of new messages rather than with
+ * the size of the channel history.
+ *
+ * Watermarks are stored in `.git/chat-cache/read-watermarks`, one channel per
+ * line:
+ *
+ * <commit id> <channel ref name>
+ *
+ * Since the file only holds commit ids and ref names (which are already
+ * visible in the repository), it is not encrypted. Updates are made under a
+ * lock and renamed into place, so watermarks are advanced atomically and
+ * concurrent updates to different channels are not lost.
+ * */
+
+/**
+ * Look up the watermark for the channel `channel` (a full ref name, e.g.
+ * `refs/heads/general`).
+ *
+ * Returns zero if successful, and positive if the channel has no watermark.
+ * */
+int read_watermark_get(const char *channel, struct git_oid *oid);
+
+/**
+ * Set the watermark for the channel `channel` to `oid`.
+ *
+ * Returns zero if successful, and non-zero if the watermark could not be
+ * written.
+ * */
+int read_watermark_set(const char *channel, const struct git_oid *oid);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_READ_WATERMARK_H
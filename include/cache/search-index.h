@@ -0,0 +1,166 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_SEARCH_INDEX_H
+#define GIT_CHAT_INCLUDE_CACHE_SEARCH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "git/git.h"
+#include "gnupg/gpg-common.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * search-index api
+ *
+ * The search index is an inverted index over the plaintext of messages, so
+ * that the history of a channel can be searched without decrypting every
+ * message on every query. For each term, the index holds a posting list of the
+ * messages that contain the term, along with the positions of the term within
+ * each message (which are needed for phrase queries).
+ *
+ * The index is stored in `.git/chat-cache/search-index`. Since terms and their
+ * positions reveal the content of messages, the index is encrypted at rest to
+ * the secret keys of the current user, like the message cache. It is updated
+ * incrementally as messages are decrypted by `git chat read`.
+ *
+ * Messages are numbered in the order in which they are indexed, starting from
+ * one. Posting lists are kept in their encoded form, both in memory and on
+ * disk, as a sequence of varints (7 bits per byte, least significant group
+ * first, high bit set on all but the last byte). For each message containing
+ * the term, in ascending order:
+ *
+ *     message number, as a delta from the previous message in the list
+ *     number of occurrences of the term in the message
+ *     position of each occurrence, as a delta from the previous occurrence
+ *
+ * Positions count from one, so every encoded value is at least one, and an
+ * encoded posting list never contains a null byte.
+ *
+ * Terms are maximal runs of alphanumeric characters (or bytes outside of the
+ * ASCII range, so that UTF-8 text is indexed as is), lower-cased. Terms longer
+ * than SEARCH_TERM_MAX bytes are truncated.
+ * */
+
+#define SEARCH_TERM_MAX 64
+
+struct search_term {
+	struct hashmap_entry ent;
+	char *term;
+
+	uint32_t doc_count;
+	uint32_t last_doc;
+	unsigned char *postings;
+	size_t postings_len;
+	size_t postings_alloc;
+
+	// positions of the term in the message being indexed
+	uint32_t *pending;
+	size_t pending_len;
+	size_t pending_alloc;
+};
+
+struct search_document {
+	struct hashmap_entry ent;
+	struct git_oid oid;
+	uint32_t length;
+};
+
+struct search_index {
+	struct hashmap terms;
+	struct hashmap documents;
+
+	// documents, by message number - 1
+	struct search_document **docs;
+	size_t docs_len;
+	size_t docs_alloc;
+	uint64_t total_length;
+
+	unsigned dirty: 1;
+};
+
+struct search_result {
+	struct git_oid oid;
+	double score;
+};
+
+/**
+ * Initialize an empty search index. Must be released with
+ * search_index_release() after use.
+ * */
+void search_index_init(struct search_index *index);
+
+/**
+ * Load the search index from `.git/chat-cache/search-index`, decrypting it
+ * with the given gpgme context.
+ *
+ * Returns zero if the index was loaded successfully or if no index exists yet,
+ * and non-zero if the index exists but could not be decrypted or parsed. In
+ * the latter case, the index is left empty.
+ * */
+int search_index_load(struct search_index *index, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Encrypt the search index to the secret keys of the current user and write
+ * it to `.git/chat-cache/search-index`. The index is only written if messages
+ * were added since it was loaded.
+ *
+ * Returns zero if the index was written (or did not need to be written), and
+ * non-zero if the index could not be written.
+ * */
+int search_index_write(struct search_index *index, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Parse the plaintext of a search index file into `index`, which must be
+ * empty.
+ *
+ * Returns zero if successful, and non-zero if the index is malformed.
+ * */
+int search_index_parse(struct search_index *index, const char *data, size_t len);
+
+/**
+ * Serialize the search index into `out`, in the format read by
+ * search_index_parse().
+ * */
+void search_index_serialize(struct search_index *index, struct strbuf *out);
+
+/**
+ * Determine whether the message of commit `oid` is already indexed.
+ * */
+int search_index_contains(struct search_index *index, const struct git_oid *oid);
+
+/**
+ * Add the plaintext of the message of commit `oid` to the index. Messages that
+ * are already indexed are ignored, since the message of a given commit never
+ * changes.
+ * */
+void search_index_add(struct search_index *index, const struct git_oid *oid,
+		const char *text, size_t len);
+
+/**
+ * Search the index. The query is a list of whitespace-separated clauses, all of
+ * which must match:
+ *
+ * - `term` matches messages containing the term,
+ * - `term*` matches messages containing a term starting with `term`, and
+ * - `"some phrase"` matches messages containing the terms of the phrase, in
+ *   order and adjacent to one another.
+ *
+ * Clauses that consist of several terms (e.g. `git-chat`) are treated as
+ * phrases.
+ *
+ * Matching messages are ranked with BM25, and written to a newly allocated
+ * array `results` (best match first) which must be freed by the caller.
+ * Messages with equal scores are ordered most recently indexed first.
+ *
+ * Returns zero if successful, and non-zero if the query is malformed or has
+ * no terms.
+ * */
+int search_index_query(struct search_index *index, const char *query,
+		struct search_result **results, size_t *len);
+
+/**
+ * Release any resources under the search index.
+ * */
+void search_index_release(struct search_index *index);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_SEARCH_INDEX_H
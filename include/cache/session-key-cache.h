@@ -0,0 +1,90 @@
+#ifndef GIT_CHAT_INCLUDE_CACHE_SESSION_KEY_CACHE_H
+#define GIT_CHAT_INCLUDE_CACHE_SESSION_KEY_CACHE_H
+
+#include "cache/cache-file.h"
+#include "git/git.h"
+#include "gnupg/gpg-common.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * session-key-cache api
+ *
+ * Each message is encrypted with a random session key, which is in turn
+ * encrypted to each recipient's public key. When decrypting a message, almost
+ * all of the cost lies in recovering the session key with the user's secret
+ * key (a public-key operation in gpg-agent, and possibly a pinentry prompt),
+ * rather than in decrypting the message itself.
+ *
+ * The session key cache stores the session key of each decrypted message,
+ * keyed by commit id, so that messages can later be decrypted using the
+ * session key alone. Unlike the message cache, which stores plaintext for the
+ * messages shown by `git chat read`, session keys are captured wherever the
+ * decryption pool decrypts messages.
+ *
+ * The cache is stored in `.git/chat-cache/session-keys`, encrypted at rest to
+ * the secret keys of the current user.
+ * */
+
+struct session_key_cache_entry {
+	struct hashmap_entry ent;
+	struct git_oid oid;
+	struct strbuf session_key;
+};
+
+struct session_key_cache {
+	struct keyed_cache cache;
+};
+
+/**
+ * Initialize an empty session key cache. Must be released with
+ * session_key_cache_release() after use.
+ * */
+void session_key_cache_init(struct session_key_cache *cache);
+
+/**
+ * Load the session key cache from `.git/chat-cache/session-keys`, decrypting
+ * it with the given gpgme context.
+ *
+ * Returns zero if the cache was loaded successfully or if no cache exists yet,
+ * and non-zero if the cache exists but could not be decrypted or parsed. In
+ * the latter case, the cache is left empty.
+ * */
+int session_key_cache_load(struct session_key_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Look up the cached session key for a commit.
+ *
+ * Returns the entry, or NULL if the session key is not cached.
+ * */
+struct session_key_cache_entry *session_key_cache_get(struct session_key_cache *cache,
+		const struct git_oid *oid);
+
+/**
+ * Insert the session key for a commit into the cache. Session keys are strings
+ * of the form `<algo>:<hex key>`, as exported by gpg.
+ *
+ * If the same session key is already cached for the commit, the cache is left
+ * unchanged, and doesn't need to be written.
+ * */
+void session_key_cache_put(struct session_key_cache *cache, const struct git_oid *oid,
+		const char *session_key);
+
+/**
+ * Encrypt the session key cache to the secret keys of the current user and
+ * write it to `.git/chat-cache/session-keys`. The cache is written atomically,
+ * and only if entries were added since it was loaded. Session keys cached by
+ * other processes in the meantime are kept (see keyed_cache_write()).
+ *
+ * Returns zero if the cache was written (or did not need to be written), and
+ * non-zero if the cache could not be written.
+ * */
+int session_key_cache_write(struct session_key_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Release any resources under the session key cache. Session keys held by the
+ * cache are cleared from memory.
+ * */
+void session_key_cache_release(struct session_key_cache *cache);
+
+#endif //GIT_CHAT_INCLUDE_CACHE_SESSION_KEY_CACHE_H
@@ -167,6 +167,18 @@ int parse_config(struct config_data *conf, const char *conf_path);
  * */
 int parse_config_fd(struct config_data *conf, int fd);
 
+/**
+ * Attempt to parse a config file from the `len` bytes of `data`, such as a
+ * config file read from the object database.
+ *
+ * `conf` must be initialized.
+ *
+ * Returns:
+ * - 0 if the file was parsed successfully
+ * - >0 if the file could not be parsed due to a syntax error
+ * */
+int parse_config_buffer(struct config_data *conf, const char *data, size_t len);
+
 /**
  * Serialize config data to a file with the given path. The contents of the file
  * at the given path are overridden if the file exists.
@@ -200,5 +212,17 @@ int write_config_fd(struct config_data *conf, int fd);
  * */
 int is_config_invalid(const char *conf_path, int recognized_keys_only);
 
+/**
+ * Read the value of a single config property from the git-chat config file of
+ * the current space (`.git-chat/config`). If the property is not defined in the
+ * config file, the default value for the key is used instead.
+ *
+ * The value is attached to the `value` strbuf.
+ *
+ * Returns zero if a value (or default) was found, and non-zero if the key is
+ * not defined and has no default, or if the config file cannot be parsed.
+ * */
+int get_config_value(const char *key, struct strbuf *value);
+
 
 #endif //GIT_CHAT_INCLUDE_CONFIG_PARSE_CONFIG_H
@@ -0,0 +1,126 @@
+#ifndef GIT_CHAT_INCLUDE_GIT_ATTACHMENT_H
+#define GIT_CHAT_INCLUDE_GIT_ATTACHMENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "git/object-db.h"
+#include "str-array.h"
+#include "strbuf.h"
+
+/**
+ * attachment api
+ *
+ * Files attached to a message (`git chat message --attach`) are encrypted
+ * like the message itself, in binary, and the ciphertext is split into chunks
+ * of ATTACHMENT_CHUNK_SIZE bytes. Each chunk is stored as a blob in the tree
+ * of the message commit:
+ *
+ * .git-chat/attachments/<attachment index>/<chunk index>
+ *
+ * Keeping chunks small bounds the memory needed to read an attachment, and
+ * keeps large attachments from becoming huge single objects that git must
+ * inflate and delta in one piece.
+ *
+ * The manifest of the attachments is part of the header of the commit message,
+ * with one line for each attachment, in order:
+ *
+ * Git-Chat-Attachment: <chunks> <size> <name>
+ *
+ * where <size> is the size of the file in bytes. The manifest is not
+ * encrypted, so attachment names and sizes are visible to anyone with access to
+ * the repository.
+ * */
+
+#define ATTACHMENT_TRAILER "Git-Chat-Attachment: "
+#define ATTACHMENT_DIR "attachments"
+#define ATTACHMENT_CHUNK_SIZE (1024 * 1024)
+
+struct attachment {
+	struct strbuf name;
+	size_t size;
+	size_t chunks;
+};
+
+struct attachment_manifest {
+	struct attachment *entries;
+	size_t len;
+	size_t alloc;
+};
+
+/**
+ * Reads the chunks of an attachment in order, one chunk at a time.
+ * */
+struct attachment_reader {
+	struct object_db odb;
+	unsigned native: 1;
+
+	// object ids of the chunks, in order
+	struct str_array chunks;
+	size_t next;
+
+	// the chunk being read; chunks are binary, so not held in a strbuf
+	struct git_object chunk;
+	size_t pos;
+};
+
+/**
+ * Initialize an empty manifest. Must be released with
+ * attachment_manifest_release() after use.
+ * */
+void attachment_manifest_init(struct attachment_manifest *manifest);
+
+/**
+ * Release any resources under the manifest.
+ * */
+void attachment_manifest_release(struct attachment_manifest *manifest);
+
+/**
+ * Append an attachment to the manifest.
+ * */
+void attachment_manifest_add(struct attachment_manifest *manifest, const char *name,
+		size_t size, size_t chunks);
+
+/**
+ * Parse the attachment manifest from the header of a commit message body. The
+ * header ends at the first blank line.
+ *
+ * Returns zero if successful (even if the message has no attachments), and
+ * non-zero if an attachment line is malformed, in which case the manifest is
+ * left empty.
+ * */
+int attachment_manifest_parse(struct attachment_manifest *manifest,
+		const char *body, size_t len);
+
+/**
+ * Append the manifest lines of the attachments in the manifest to `header`.
+ * */
+void attachment_manifest_format(const struct attachment_manifest *manifest,
+		struct strbuf *header);
+
+/**
+ * Open the attachment with the given index in the tree of the commit `rev`.
+ * `chunks` is the number of chunks named by the manifest.
+ *
+ * Returns zero if successful, and non-zero if the chunks of the attachment
+ * cannot be found in the tree. In either case, the reader must be released with
+ * attachment_reader_release().
+ * */
+int attachment_reader_open(struct attachment_reader *reader, const char *rev,
+		size_t index, size_t chunks);
+
+/**
+ * Read up to `len` bytes of the attachment ciphertext into `buffer`. Has the
+ * signature of a gpgme data read callback, with `reader` as the handle.
+ *
+ * Returns the number of bytes read, zero once the attachment has been read in
+ * full, or -1 if a chunk could not be read.
+ * */
+ssize_t attachment_reader_read(void *reader, void *buffer, size_t len);
+
+/**
+ * Release any resources under the reader.
+ * */
+void attachment_reader_release(struct attachment_reader *reader);
+
+#endif //GIT_CHAT_INCLUDE_GIT_ATTACHMENT_H
@@ -0,0 +1,98 @@
+#ifndef GIT_CHAT_INCLUDE_GIT_CAT_FILE_STREAM_H
+#define GIT_CHAT_INCLUDE_GIT_CAT_FILE_STREAM_H
+
+#include <stddef.h>
+
+#include "git/git.h"
+
+#define CAT_FILE_DELIM_LEN 16
+#define CAT_FILE_DEFAULT_BUFFER_SIZE (256 * 1024)
+
+/**
+ * cat-file-stream api
+ *
+ * The cat-file-stream api reads the output of `git cat-file --batch` from a
+ * file descriptor and splits it into objects, without copying object content.
+ *
+ * Output is read in large chunks into a single growable buffer, and each
+ * object is parsed in place. Objects are handed out as views into the buffer;
+ * a view is only valid until the buffer is next refilled. Unparsed
+ * data is only moved when the buffer must be refilled, and then only the
+ * trailing partial object is moved, so the cost of reading the stream grows
+ * linearly with its size.
+ *
+ * The stream expects each object to be preceded by a summary line of the form:
+ * <delim> <object id> <object type> <object size>
+ *
+ * where <delim> is a random delimiter chosen by the caller and passed to
+ * git-cat-file through its `--batch=<format>` argument. Without it, specially
+ * crafted commit messages could be used to trick the parser.
+ * */
+
+struct cat_file_stream {
+	int fd;
+	char delim[CAT_FILE_DELIM_LEN];
+
+	char *buff;
+	size_t alloc;
+	size_t start;
+	size_t end;
+	size_t needed;
+	unsigned eof: 1;
+};
+
+struct cat_file_object {
+	char oid[GIT_HEX_OBJECT_ID];
+	const char *type;
+	size_t type_len;
+	const char *data;
+	size_t len;
+};
+
+/**
+ * Initialize a stream reading from `fd`. `buffer_size` is the initial size of
+ * the read buffer; the buffer grows as needed to hold large objects.
+ *
+ * If `fd` is a pipe, its capacity is enlarged where supported to reduce the
+ * number of context switches between git-cat-file and the reader.
+ * */
+void cat_file_stream_init(struct cat_file_stream *stream, int fd,
+		const char delim[CAT_FILE_DELIM_LEN], size_t buffer_size);
+
+/**
+ * Read the next object from the stream. On success, `obj` is updated with a
+ * view of the object, valid until the next call.
+ *
+ * Returns zero if an object was read, positive once the stream is exhausted,
+ * and negative if the stream could not be parsed.
+ * */
+int cat_file_stream_next(struct cat_file_stream *stream, struct cat_file_object *obj);
+
+/**
+ * Read the next object from the stream, but only if it has already been read
+ * into the buffer in full. Together with cat_file_stream_fill(), this allows
+ * objects to be processed in batches: views of objects returned by this
+ * function remain valid until the next call to cat_file_stream_fill() or
+ * cat_file_stream_next().
+ *
+ * Returns zero if an object was read, positive if more data must be read into
+ * the buffer, and negative if the stream could not be parsed.
+ * */
+int cat_file_stream_next_buffered(struct cat_file_stream *stream,
+		struct cat_file_object *obj);
+
+/**
+ * Read more data into the buffer, invalidating any object views previously
+ * handed out.
+ *
+ * Returns zero if successful, positive once the stream is exhausted, and
+ * negative if the read failed or the stream ended with a partial object.
+ * */
+int cat_file_stream_fill(struct cat_file_stream *stream);
+
+/**
+ * Release the buffer under the stream. The file descriptor is not closed.
+ * */
+void cat_file_stream_release(struct cat_file_stream *stream);
+
+#endif //GIT_CHAT_INCLUDE_GIT_CAT_FILE_STREAM_H
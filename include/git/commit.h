@@ -2,10 +2,22 @@
 #define GIT_CHAT_COMMIT_H
 
 #include <inttypes.h>
+#include <sys/types.h>
 
+#include "arena.h"
 #include "strbuf.h"
 #include "git/git.h"
 
+/**
+ * Messages stored as blobs (`message.storage = blob`) keep their binary
+ * ciphertext in a blob in the tree of the commit, and name the blob in a
+ * trailer on the last line of the commit message:
+ *
+ * Git-Chat-Ciphertext: <blob id>
+ * */
+#define COMMIT_CIPHERTEXT_TRAILER "Git-Chat-Ciphertext: "
+#define COMMIT_CIPHERTEXT_FILE "ciphertext"
+
 struct git_time {
 	/**
 	 * time in seconds from epoch
@@ -34,6 +46,51 @@ struct git_commit {
 	struct git_signature committer;
 
 	struct strbuf body;
+
+	/**
+	 * binary ciphertext of messages stored as blobs; empty otherwise. May
+	 * contain null bytes, so only `blob.len` gives its length.
+	 * */
+	struct strbuf blob;
+};
+
+/**
+ * A read-only view of a signature, where `name` and `email` point into the raw
+ * commit object. Neither is null-terminated.
+ * */
+struct git_signature_view {
+	const char *name;
+	size_t name_len;
+	const char *email;
+	size_t email_len;
+	struct git_time timestamp;
+};
+
+/**
+ * A read-only view of a commit, as parsed by `commit_parse_view()`. String
+ * fields are (pointer, length) slices into the raw commit object, and
+ * `parents_commit_ids` is allocated from an arena, so a view is only valid as
+ * long as both the raw object and the arena allocation are.
+ * */
+struct git_commit_view {
+	struct git_oid commit_id;
+	struct git_oid tree_id;
+	struct git_oid *parents_commit_ids;
+	size_t parents_commit_ids_len;
+
+	struct git_signature_view author;
+	struct git_signature_view committer;
+
+	const char *body;
+	size_t body_len;
+
+	/**
+	 * Content of the ciphertext blob named by the body, if any. Unlike the
+	 * other fields, it is not set by `commit_parse_view()`, but by the commit
+	 * graph traversal, which reads the blob along with the commit.
+	 * */
+	const char *blob;
+	size_t blob_len;
 };
 
 enum message_type {
@@ -52,6 +109,11 @@ void git_commit_object_init(struct git_commit *commit);
  * */
 void git_commit_object_release(struct git_commit *commit);
 
+/**
+ * Copy the commit object `src` into `dest`, which must be initialized.
+ * */
+void git_commit_object_copy(struct git_commit *dest, const struct git_commit *src);
+
 /**
  * Commit to the git tree any files currently tracked under the git index.
  * The commit will have the given commit message. This is equivalent to running
@@ -78,6 +140,35 @@ int git_commit_index_with_options(const char *commit_message, ...);
 int commit_parse(struct git_commit *commit, const char commit_id[GIT_HEX_OBJECT_ID],
 		const char *data, size_t len);
 
+/**
+ * Parse a buffer containing a raw commit object into a view, without copying
+ * any part of the object. Parent commit ids are allocated from `arena`.
+ *
+ * Signature names, emails and the commit body are trimmed of leading and
+ * trailing whitespace, as with `commit_parse()`.
+ *
+ * Returns zero if successful, non-zero otherwise.
+ * */
+int commit_parse_view(struct git_commit_view *view, struct arena *arena,
+		const char commit_id[GIT_HEX_OBJECT_ID], const char *data, size_t len);
+
+/**
+ * Read the id of the ciphertext blob from the trailer of a commit body, as
+ * parsed by `commit_parse_view()`.
+ *
+ * Returns zero if the last line of the body is a well-formed ciphertext
+ * trailer, in which case the blob id is written to `oid`, and non-zero
+ * otherwise.
+ * */
+int commit_body_ciphertext_blob(const char *body, size_t len, struct git_oid *oid);
+
+/**
+ * Copy the commit view `src` into the commit object `dest`, which must be
+ * initialized. Any existing content in `dest` is replaced, reusing its buffers
+ * where possible.
+ * */
+void git_commit_from_view(struct git_commit *dest, const struct git_commit_view *src);
+
 /**
  * Pretty-print a single message and write to the file descriptor `output_fd`.
  *
@@ -100,4 +191,54 @@ int commit_parse(struct git_commit *commit, const char commit_id[GIT_HEX_OBJECT_
 void pretty_print_message(struct git_commit *commit, struct strbuf *message,
 		enum message_type type, int no_color, int output_fd);
 
+#define PRETTY_PRINT_STREAM_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Pretty-prints a single message as the message is written to the stream, for
+ * messages too large to be held in memory in full (see
+ * decrypt_asymmetric_message_stream()). The output is the same as that of
+ * pretty_print_message().
+ * */
+struct pretty_print_stream {
+	struct git_commit *commit;
+	enum message_type type;
+	int no_color;
+	int output_fd;
+
+	// formatted output not yet written to `output_fd`
+	struct strbuf out;
+
+	// whitespace that is only written if more of the message follows
+	struct strbuf whitespace;
+
+	// set once anything (including the header) was written
+	unsigned written: 1;
+	unsigned started: 1;
+};
+
+/**
+ * Initialize a stream for the message of `commit`, of the given type. Nothing
+ * is written to `output_fd` until the first write to the stream.
+ * */
+void pretty_print_stream_init(struct pretty_print_stream *stream,
+		struct git_commit *commit, enum message_type type, int no_color, int output_fd);
+
+/**
+ * Write `len` bytes of the message to the stream. Has the signature of a
+ * decryption_write_fn, with the stream as `data`.
+ *
+ * Returns `len`.
+ * */
+ssize_t pretty_print_stream_write(void *data, const void *buffer, size_t len);
+
+/**
+ * Write the end of the message, and flush the stream.
+ * */
+void pretty_print_stream_finish(struct pretty_print_stream *stream);
+
+/**
+ * Release any resources under the stream.
+ * */
+void pretty_print_stream_release(struct pretty_print_stream *stream);
+
 #endif //GIT_CHAT_COMMIT_H
@@ -23,6 +23,13 @@ void git_str_to_oid(struct git_oid *oid, const char *str);
  * */
 void git_oid_to_str(struct git_oid *oid, char hex_buffer[GIT_HEX_OBJECT_ID]);
 
+/**
+ * Compute a hash code for a git_oid, suitable for use with the hashmap api.
+ * Since object ids are already uniformly distributed, the leading bytes of the
+ * raw object id are used directly.
+ * */
+unsigned int git_oid_hash(const struct git_oid *oid);
+
 /**
  * Attempt to fetch the user identify from their .gitconfig. The author's name
  * is chosen, in the following order:
@@ -36,4 +43,23 @@ void git_oid_to_str(struct git_oid *oid, char hex_buffer[GIT_HEX_OBJECT_ID]);
  * */
 int get_author_identity(struct strbuf *result);
 
+/**
+ * Read `key` from the git config of the current user and repository (with
+ * `git config --get`), rather than from the channel config under `.git-chat`,
+ * which is shared by every member of the channel. Suitable for per-machine
+ * settings.
+ *
+ * Returns zero and populates `value` if the key is set, and non-zero otherwise.
+ * */
+int get_git_config_value(const char *key, struct strbuf *value);
+
+/**
+ * Obtain the full ref name of the current channel (the branch HEAD points to,
+ * e.g. `refs/heads/general`). HEAD is read directly where possible, falling
+ * back to `git symbolic-ref`.
+ *
+ * Returns zero if successful, and non-zero if HEAD is detached.
+ * */
+int get_current_channel_ref(struct strbuf *ref);
+
 #endif //GIT_CHAT_GIT_H
@@ -4,6 +4,7 @@
 #include "git/commit.h"
 
 typedef int (*graph_traversal_cb)(struct git_commit *commit, void *data);
+typedef int (*graph_traversal_view_cb)(struct git_commit_view *commit, void *data);
 
 /**
  * Traverse the git commit graph in reverse chronological order, starting at
@@ -14,6 +15,9 @@ typedef int (*graph_traversal_cb)(struct git_commit *commit, void *data);
  * When `commit` is null, traversal starts from the current commit (HEAD).
  * If `limit` is negative, traverse all commits.
  *
+ * Commits whose message is stored as a blob are read together with the blob,
+ * so that callbacks receive the ciphertext along with the commit.
+ *
  * Returns zero if the traversal successful, return non-negative if the
  * graph traversal callback returned non-zero, and return negative if an error
  * occurred.
@@ -21,4 +25,43 @@ typedef int (*graph_traversal_cb)(struct git_commit *commit, void *data);
 int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
 		void *data);
 
+/**
+ * Like traverse_commit_graph(), but commits are passed to the callback as
+ * views into the underlying object buffers, avoiding any per-commit copies.
+ *
+ * A view (and anything it points to) is only valid for the duration of the
+ * callback; callbacks that need to retain a commit must copy it, for instance
+ * with git_commit_from_view().
+ * */
+int traverse_commit_graph_views(const char *commit, int limit,
+		graph_traversal_view_cb cb, void *data);
+
+/**
+ * Traverse the commits reachable from `commit` but not from `exclude`, in
+ * reverse chronological order, reading up to `limit` commits. Like
+ * traverse_commit_graph_views(), commits are passed to the callback as views.
+ *
+ * When `commit` is null, traversal starts from the current commit (HEAD). When
+ * `exclude` is null, the entire history is traversed. If `limit` is negative,
+ * traverse all commits in the range. Unlike traverse_commit_graph_views(),
+ * a non-null `commit` does not restrict the traversal to a single commit.
+ *
+ * Returns zero if the traversal successful, return non-negative if the
+ * graph traversal callback returned non-zero, and return negative if an error
+ * occurred.
+ * */
+int traverse_commit_graph_range(const char *exclude, const char *commit, int limit,
+		graph_traversal_view_cb cb, void *data);
+
+/**
+ * Read the commits `oids`, in the order given, passing each to the callback as
+ * a view. No history is walked, which makes this suitable for commits found
+ * through an index.
+ *
+ * Returns zero if successful, return non-negative if the callback returned
+ * non-zero, and return negative if an error occurred.
+ * */
+int read_commit_views(const struct git_oid *oids, size_t len,
+		graph_traversal_view_cb cb, void *data);
+
 #endif //GIT_CHAT_INCLUDE_GIT_GRAPH_TRAVERSAL_H
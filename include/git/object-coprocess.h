@@ -0,0 +1,88 @@
+#ifndef GIT_CHAT_INCLUDE_GIT_OBJECT_COPROCESS_H
+#define GIT_CHAT_INCLUDE_GIT_OBJECT_COPROCESS_H
+
+#include "git/git.h"
+#include "git/object-db.h"
+
+/**
+ * object-coprocess api
+ *
+ * The object-coprocess api reads objects through a single, long-lived
+ * `git cat-file --batch-command --buffer` process shared by the whole command,
+ * rather than running git once for every object. It is for repositories that
+ * the object-db api can't read, and for object names only git understands
+ * (like `<commit>:<path>` or `HEAD~2`).
+ *
+ * The coprocess is started the first time an object is requested, and stopped
+ * when the command exits.
+ *
+ * Requests are asynchronous and keyed by object name. object_coprocess_request()
+ * queues a request without waiting for it, and object_coprocess_response()
+ * waits for the response to the request with the same name and kind (queueing
+ * it, if there is none). Queued requests are sent to git in batches, each
+ * ending with a `flush`, the first time any of their responses is needed;
+ * responses that arrive ahead of the one being waited for are kept until they
+ * are asked for. This way, callers that know which objects they need ahead of
+ * time can request all of them, and read the responses as they go, in a few
+ * round trips.
+ *
+ * Each request gets a single response. Requesting an object again before its
+ * response was taken has no effect.
+ *
+ * Writing requests and reading responses alternate (a batch is only sent once
+ * the responses of the previous batch have been read), and each batch is small
+ * enough to fit in the pipe to git. Writing a batch therefore never waits for
+ * git, so git never blocks writing output while git-chat is blocked writing
+ * requests, however large the objects or the number of requests.
+ *
+ * `git cat-file --batch-command` requires git 2.36. If the coprocess fails for
+ * any reason, every request fails, and callers should fall back to running git
+ * themselves. None of this is thread-safe.
+ * */
+
+enum object_request_kind {
+	// the type, size and content of the object
+	OBJECT_REQUEST_CONTENTS,
+
+	// only the type and size of the object
+	OBJECT_REQUEST_INFO
+};
+
+/**
+ * Start the coprocess, if it isn't running already.
+ *
+ * Returns zero if the coprocess is running, and non-zero if it could not be
+ * started or has failed.
+ * */
+int object_coprocess_start(void);
+
+/**
+ * Queue a request for the object `name`, which is sent to git along with the
+ * other queued requests when a response is next waited for.
+ *
+ * Names must not contain line feeds.
+ * */
+void object_coprocess_request(const char *name, enum object_request_kind kind);
+
+/**
+ * Wait for the response to the request for the object `name`, queueing the
+ * request first if it wasn't requested already.
+ *
+ * If the object exists, `oid` (if not NULL) is set to the id of the object, and
+ * `obj` is populated with its type and size, and its content if requested.
+ * For OBJECT_REQUEST_INFO, `obj->data` is NULL. `obj` must be released with
+ * git_object_release().
+ *
+ * Returns zero if successful, positive if the object does not exist (or the
+ * name is ambiguous), and negative if the coprocess failed.
+ * */
+int object_coprocess_response(const char *name, enum object_request_kind kind,
+		struct git_oid *oid, struct git_object *obj);
+
+/**
+ * Stop the coprocess, discarding any requests that weren't answered. The next
+ * request starts a new coprocess.
+ * */
+void object_coprocess_stop(void);
+
+#endif //GIT_CHAT_INCLUDE_GIT_OBJECT_COPROCESS_H
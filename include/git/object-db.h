@@ -0,0 +1,143 @@
+#ifndef GIT_CHAT_INCLUDE_GIT_OBJECT_DB_H
+#define GIT_CHAT_INCLUDE_GIT_OBJECT_DB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "git/git.h"
+#include "hashmap.h"
+#include "strbuf.h"
+
+/**
+ * object-db api
+ *
+ * The object-db api is a minimal, read-only reader for the git object
+ * database. It allows objects to be read without spawning `git cat-file`,
+ * which avoids the cost of forking and exec'ing git for every traversal.
+ *
+ * The following are supported:
+ * - loose objects (zlib-deflated files under `objects/xx/`)
+ * - packed objects, located through version 2 pack indexes, with both the
+ *   index and the pack mmap'd into memory
+ * - OFS_DELTA and REF_DELTA deltified pack entries
+ * - resolution of full object ids, HEAD, and loose and packed refs
+ * - shallow repositories
+ *
+ * Repositories that use features this reader does not understand (alternates,
+ * grafts, loose or packed replace refs, SHA-256 object ids, the reftable ref
+ * backend, or environment overrides like GIT_DIR) are rejected by
+ * object_db_init(), so that callers can fall back to git itself.
+ * */
+
+enum git_object_type {
+	GIT_OBJ_NONE = 0,
+	GIT_OBJ_COMMIT = 1,
+	GIT_OBJ_TREE = 2,
+	GIT_OBJ_BLOB = 3,
+	GIT_OBJ_TAG = 4,
+	GIT_OBJ_OFS_DELTA = 6,
+	GIT_OBJ_REF_DELTA = 7
+};
+
+struct git_object {
+	enum git_object_type type;
+
+	/**
+	 * Object content, always followed by a terminating null byte (not
+	 * included in `len`).
+	 * */
+	unsigned char *data;
+	size_t len;
+};
+
+struct git_pack {
+	struct git_pack *next;
+	struct strbuf pack_path;
+
+	const unsigned char *idx_map;
+	size_t idx_len;
+	const unsigned char *pack_map;
+	size_t pack_len;
+
+	uint32_t objects_len;
+};
+
+struct object_db {
+	struct strbuf git_dir;
+	struct strbuf common_dir;
+	struct strbuf objects_dir;
+
+	struct git_pack *packs;
+	struct hashmap shallow;
+};
+
+/**
+ * Open the object database of the repository whose git directory is
+ * `git_dir`. If `git_dir` is NULL, `.git` in the current working directory is
+ * used. Worktrees (where `.git` is a file) are supported.
+ *
+ * Returns zero if successful, and non-zero if the repository cannot be read by
+ * this reader. In either case, the object_db must be released with
+ * object_db_release().
+ * */
+int object_db_init(struct object_db *odb, const char *git_dir);
+
+/**
+ * Release any resources under the object_db, unmapping any pack files.
+ * */
+void object_db_release(struct object_db *odb);
+
+/**
+ * Read an object from the object database, inflating and resolving deltas as
+ * necessary. The object must be released with git_object_release().
+ *
+ * Returns zero if successful, positive if the object does not exist, and
+ * negative if the object could not be read (i.e. corrupt).
+ * */
+int object_db_read(struct object_db *odb, const struct git_oid *oid,
+		struct git_object *obj);
+
+/**
+ * Read the object at `path` (e.g. `.git-chat/config`) in the tree of the
+ * commit `commit`, walking the trees along the path. The object must be
+ * released with git_object_release().
+ *
+ * Returns zero if successful, positive if the commit or path does not exist,
+ * and negative if an object along the way could not be read.
+ * */
+int object_db_read_path(struct object_db *odb, const struct git_oid *commit,
+		const char *path, struct git_object *obj);
+
+/**
+ * Resolve a revision to an object id. Only full 40-character object ids and
+ * ref names (e.g. `HEAD`, `master`, `refs/heads/master`, `v1.0`) are
+ * understood; annotated tags are peeled to the object they point to.
+ *
+ * Returns zero if successful, and non-zero if the revision cannot be resolved
+ * by this reader.
+ * */
+int object_db_resolve(struct object_db *odb, const char *rev, struct git_oid *oid);
+
+/**
+ * Read the target of the symbolic ref `name` (e.g. `HEAD`) into `target`, as a
+ * full ref name (e.g. `refs/heads/master`).
+ *
+ * Returns zero if successful, and non-zero if `name` is not a symbolic ref
+ * (for instance, if HEAD is detached) or cannot be read by this reader.
+ * */
+int object_db_read_symref(struct object_db *odb, const char *name, struct strbuf *target);
+
+/**
+ * Determine whether a commit is a shallow boundary, in which case its parents
+ * are not available in this repository.
+ *
+ * Returns one if shallow, and zero otherwise.
+ * */
+int object_db_is_shallow(struct object_db *odb, const struct git_oid *oid);
+
+/**
+ * Release the content of an object.
+ * */
+void git_object_release(struct git_object *obj);
+
+#endif //GIT_CHAT_INCLUDE_GIT_OBJECT_DB_H
@@ -0,0 +1,232 @@
+#ifndef GIT_CHAT_INCLUDE_GNUPG_DECRYPTION_POOL_H
+#define GIT_CHAT_INCLUDE_GNUPG_DECRYPTION_POOL_H
+
+#include <pthread.h>
+
+#include "git/commit.h"
+#include "cache/epoch-key-cache.h"
+#include "cache/session-key-cache.h"
+#include "gnupg/gpg-common.h"
+#include "gnupg/pgp-packet.h"
+#include "strbuf.h"
+
+/**
+ * decryption-pool api
+ *
+ * Decrypting a message is a public-key operation carried out by the gpg agent,
+ * and is by far the most expensive part of reading a channel. The decryption
+ * pool spreads this work over a number of worker threads, each with its own
+ * gpgme context.
+ *
+ * Commits are submitted to the pool in traversal order, as commit views. Each
+ * view is copied into a job, so the view need only remain valid until it has
+ * been submitted. As
+ * jobs complete, the results are emitted to a callback function strictly in
+ * the order in which they were submitted, on the thread that submitted them.
+ * This means that the callback can safely write to the pager or to a file
+ * without any additional synchronization.
+ *
+ * At most a small, fixed window of jobs is in flight at any time, so memory
+ * usage does not grow with the number of messages traversed. When the window
+ * is full, submitting a job blocks until the oldest job can be emitted.
+ *
+ * Commits whose message is already known (for instance, from the message
+ * cache) can be submitted with decryption_pool_add_resolved(). These jobs
+ * bypass the workers entirely, but are still emitted in order. The callback
+ * can tell them apart with decryption_pool_emitted_known(), so that messages
+ * that are already cached aren't cached again.
+ *
+ * Before a commit is handed to the workers, its message is scanned for the
+ * OpenPGP packets that name its recipients. Messages that aren't OpenPGP at all
+ * are emitted as PLAINTEXT, and messages not addressed to any of the user's
+ * secret keys are emitted as UNKNOWN_ERROR, without involving gpg. The gpgme
+ * contexts of the workers, and the listing of the user's secret keys, are only
+ * set up once a message actually needs them, so a pool that only sees cached
+ * or plaintext messages never starts gpg.
+ *
+ * Messages encrypted with a channel group key are decrypted with the key of
+ * their epoch, which is looked up (and if necessary, unwrapped) on the thread
+ * that submits jobs. See decryption_pool_use_epoch_keys().
+ *
+ * A matcher can be installed with decryption_pool_use_matcher() to inspect
+ * each message on the worker threads, once it is known (for instance, to match
+ * it against a regular expression). Jobs submitted with
+ * decryption_pool_add_resolved() are then also handed to the workers, so that
+ * matching runs in parallel regardless of whether a message had to be
+ * decrypted. The result of the matcher is available to the callback through
+ * decryption_pool_emitted_match().
+ * */
+
+/**
+ * Callback invoked for each job, in submission order.
+ *
+ * `type` is the outcome of decryption. For DECRYPTED messages, `message` holds
+ * the plaintext. For PLAINTEXT messages and UNKNOWN_ERROR, `message` is empty.
+ *
+ * If the callback returns non-zero, no further jobs are emitted.
+ * */
+typedef int (*decryption_pool_cb)(struct git_commit *commit, struct strbuf *message,
+		enum message_type type, void *data);
+
+/**
+ * Matcher invoked for each job on a worker thread, with the same arguments as
+ * the callback. The matcher must be thread-safe.
+ * */
+typedef int (*decryption_pool_match_fn)(const struct git_commit *commit,
+		const struct strbuf *message, enum message_type type, void *data);
+
+struct decryption_job {
+	struct git_commit commit;
+	struct strbuf message;
+	struct strbuf session_key;
+	struct strbuf epoch_key;
+	enum message_type type;
+	unsigned resolved: 1;
+	unsigned known: 1;
+	int match;
+	enum {
+		JOB_EMPTY,
+		JOB_PENDING,
+		JOB_RUNNING,
+		JOB_DONE
+	} state;
+};
+
+struct decryption_worker {
+	pthread_t thread;
+	struct decryption_pool *pool;
+	struct gc_gpgme_ctx gpg_ctx;
+	unsigned gpg_ready: 1;
+};
+
+struct decryption_pool {
+	struct decryption_worker *workers;
+	size_t workers_len;
+
+	struct decryption_job *jobs;
+	size_t window;
+	size_t next_submit;
+	size_t next_dispatch;
+	size_t next_emit;
+
+	pthread_mutex_t lock;
+	pthread_cond_t job_available;
+	pthread_cond_t job_done;
+	unsigned shutdown: 1;
+
+	decryption_pool_cb cb;
+	void *cb_data;
+	int cb_status;
+
+	decryption_pool_match_fn match_fn;
+	void *match_data;
+	int emitted_match;
+	int emitted_known;
+
+	struct session_key_cache *session_keys;
+	struct epoch_key_cache *epoch_keys;
+	struct gc_gpgme_ctx *epoch_ctx;
+	struct pgp_key_id_set secret_key_ids;
+	unsigned secret_keys_loaded: 1;
+};
+
+/**
+ * Start a decryption pool with `nr_workers` worker threads. If `nr_workers` is
+ * not positive, one worker is started for each online processor.
+ *
+ * Results are emitted to the callback `cb`, with the arbitrary pointer `data`.
+ * */
+void decryption_pool_init(struct decryption_pool *pool, int nr_workers,
+		decryption_pool_cb cb, void *data);
+
+/**
+ * Use the session key cache `cache` when decrypting. Known session keys are
+ * handed to the workers so that messages can be decrypted without a public-key
+ * operation, and the session keys of newly decrypted messages are added to the
+ * cache. The cache is only accessed from the thread that submits jobs.
+ *
+ * Must be called before any jobs are submitted.
+ * */
+void decryption_pool_use_session_keys(struct decryption_pool *pool,
+		struct session_key_cache *cache);
+
+/**
+ * Use the epoch key cache `cache` to decrypt messages encrypted with a channel
+ * group key. Epoch keys that aren't cached are unwrapped with the secret keys
+ * available to `ctx`, on the thread that submits jobs. Without an epoch key
+ * cache, such messages are emitted as UNKNOWN_ERROR.
+ *
+ * Must be called before any jobs are submitted.
+ * */
+void decryption_pool_use_epoch_keys(struct decryption_pool *pool,
+		struct epoch_key_cache *cache, struct gc_gpgme_ctx *ctx);
+
+/**
+ * Run the matcher `fn` with the arbitrary pointer `data` on the worker threads,
+ * for every job.
+ *
+ * Must be called before any jobs are submitted.
+ * */
+void decryption_pool_use_matcher(struct decryption_pool *pool,
+		decryption_pool_match_fn fn, void *data);
+
+/**
+ * Within the callback, get the value returned by the matcher for the job being
+ * emitted. Returns zero if no matcher is installed.
+ * */
+int decryption_pool_emitted_match(const struct decryption_pool *pool);
+
+/**
+ * Within the callback, determine whether the job being emitted was submitted
+ * with decryption_pool_add_resolved(), that is, whether its message was
+ * already known to the caller (for instance, from the message cache) rather
+ * than worked out by the pool.
+ *
+ * Returns non-zero if the message was known, and zero otherwise.
+ * */
+int decryption_pool_emitted_known(const struct decryption_pool *pool);
+
+/**
+ * Submit a commit to the pool for decryption.
+ *
+ * Returns zero if successful, or the non-zero value returned by the callback if
+ * the callback requested that emitting be stopped.
+ * */
+int decryption_pool_add(struct decryption_pool *pool, struct git_commit_view *commit);
+
+/**
+ * Submit a commit whose message is already known. The job is emitted in order
+ * with the given `type` and `message`, without being decrypted. `message` may
+ * be NULL if `type` is not DECRYPTED.
+ *
+ * Returns zero if successful, or the non-zero value returned by the callback if
+ * the callback requested that emitting be stopped.
+ * */
+int decryption_pool_add_resolved(struct decryption_pool *pool, struct git_commit_view *commit,
+		enum message_type type, const struct strbuf *message);
+
+/**
+ * Wait for all outstanding jobs to complete and emit their results, then stop
+ * the worker threads and release any resources under the pool.
+ *
+ * Returns zero if successful, or the non-zero value returned by the callback if
+ * the callback requested that emitting be stopped.
+ * */
+int decryption_pool_finish(struct decryption_pool *pool);
+
+#define DECRYPT_JOBS_ENV "GIT_CHAT_DECRYPT_JOBS"
+#define DECRYPT_JOBS_CONFIG "gitchat.decryptJobs"
+
+/**
+ * Resolve the number of decryption workers from a `--jobs` option. If `jobs`
+ * is negative, the value is read from the GIT_CHAT_DECRYPT_JOBS environment
+ * variable or, failing that, from the `gitchat.decryptJobs` git config. Since
+ * the right number depends on the machine, it is never read from the channel
+ * config, which is shared by every member of the channel. A value of zero
+ * selects the number of online processors.
+ *
+ * Returns the number of workers to start.
+ * */
+int decryption_pool_resolve_jobs(int jobs);
+
+#endif //GIT_CHAT_INCLUDE_GNUPG_DECRYPTION_POOL_H
@@ -4,6 +4,21 @@
 #include "gnupg/gpg-common.h"
 #include "strbuf.h"
 
+/**
+ * Receives plaintext from the stream decryption functions as gpg produces it,
+ * with `data` as given by the caller. Has the signature of a gpgme data write
+ * callback, and returns the number of bytes consumed, or -1 on error.
+ * */
+typedef ssize_t (*decryption_write_fn)(void *data, const void *buffer, size_t len);
+
+/**
+ * Supplies ciphertext to the reader stream decryption functions, with `data` as
+ * given by the caller. Has the signature of a gpgme data read callback, and
+ * returns the number of bytes read into `buffer`, zero once there is no more
+ * ciphertext, or -1 on error.
+ * */
+typedef ssize_t (*decryption_read_fn)(void *data, void *buffer, size_t len);
+
 /**
  * Decrypt ascii-armored ciphertext into a given output buffer.
  *
@@ -13,4 +28,92 @@
 int decrypt_asymmetric_message(struct gc_gpgme_ctx *ctx,
 		struct strbuf *ciphertext, struct strbuf *output);
 
+/**
+ * Decrypt ascii-armored ciphertext into a given output buffer, like
+ * decrypt_asymmetric_message(), but making use of the message's session key.
+ *
+ * If `session_key` is non-empty, the message is first decrypted with that
+ * session key, which skips the public-key operation (and any pinentry prompt)
+ * entirely. If that fails, or no session key is given, the message is
+ * decrypted with the user's secret keys and the session key used is exported
+ * into `session_key`, so that the caller may cache it. `session_key` is left
+ * empty if the session key could not be exported.
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_asymmetric_message_with_session_key(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output,
+		struct strbuf *session_key);
+
+/**
+ * Decrypt ascii-armored ciphertext that was encrypted symmetrically with
+ * `passphrase` into a given output buffer. The passphrase is given to gpg
+ * directly, so the user is never prompted for it.
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_symmetric_message(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output, const char *passphrase);
+
+/**
+ * Decrypt symmetrically encrypted ciphertext like decrypt_symmetric_message(),
+ * but making use of the message's session key, as for
+ * decrypt_asymmetric_message_with_session_key().
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_symmetric_message_with_session_key(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output, const char *passphrase,
+		struct strbuf *session_key);
+
+/**
+ * Decrypt ciphertext like decrypt_asymmetric_message(), but rather than
+ * collecting the plaintext in a buffer, pass it to `fn` as gpg produces it,
+ * so that memory use doesn't grow with the size of the message.
+ *
+ * Since gpg only verifies the integrity of a message once it has been read in
+ * full, `fn` may receive some plaintext even if decryption fails.
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_asymmetric_message_stream(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, decryption_write_fn fn, void *data);
+
+/**
+ * Decrypt symmetrically encrypted ciphertext like decrypt_symmetric_message(),
+ * but passing the plaintext to `fn`, as for decrypt_asymmetric_message_stream().
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_symmetric_message_stream(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, const char *passphrase,
+		decryption_write_fn fn, void *data);
+
+/**
+ * Decrypt ciphertext like decrypt_asymmetric_message_stream(), but rather than
+ * taking the ciphertext from a buffer, read it through `read` as gpg consumes
+ * it, so that neither the ciphertext nor the plaintext is held in memory.
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_asymmetric_reader_stream(struct gc_gpgme_ctx *ctx,
+		decryption_read_fn read, void *in, decryption_write_fn fn, void *data);
+
+/**
+ * Decrypt symmetrically encrypted ciphertext read through `read`, passing the
+ * plaintext to `fn`, as for decrypt_asymmetric_reader_stream().
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+int decrypt_symmetric_reader_stream(struct gc_gpgme_ctx *ctx,
+		decryption_read_fn read, void *in, const char *passphrase,
+		decryption_write_fn fn, void *data);
+
 #endif //GIT_CHAT_DECRYPTION_H
@@ -2,6 +2,7 @@
 #define GIT_CHAT_ENCRYPTION_H
 
 #include "gnupg/gpg-common.h"
+#include "gnupg/key-set.h"
 #include "strbuf.h"
 
 /**
@@ -9,7 +10,7 @@
  * The message is encrypted using asymmetric (public key) encryption.
  *
  * The message in the `message` strbuf is encrypted for all recipients in the
- * recipients key list. `recipients` must not be empty.
+ * recipients key set. `recipients` must not be empty.
  *
  * The message is encrypted with the following gpgme encrypt flags:
  * - GPGME_ENCRYPT_ALWAYS_TRUST
@@ -17,6 +18,38 @@
  * */
 void asymmetric_encrypt_plaintext_message(struct gc_gpgme_ctx *ctx,
 		const struct strbuf *message, struct strbuf *output,
-		struct gpg_key_list *recipients);
+		struct gpg_key_set *recipients);
+
+/**
+ * Encrypt a plaintext message in ASCII-armor format into a given string buffer.
+ * The message is encrypted symmetrically, with a key derived from `passphrase`.
+ *
+ * The passphrase is given to gpg directly (through loopback pinentry), so the
+ * user is never prompted for it. The gpg options of the context determine how
+ * the key is derived from the passphrase (`s2k-mode`, `s2k-count`).
+ * */
+void symmetric_encrypt_plaintext_message(struct gc_gpgme_ctx *ctx,
+		const struct strbuf *message, struct strbuf *output, const char *passphrase);
+
+/**
+ * Encrypt a plaintext message like asymmetric_encrypt_plaintext_message(), but
+ * read the plaintext from the file descriptor `in_fd` until end of file, and
+ * write the ciphertext to `out_fd` as gpg produces it. Neither is buffered in
+ * full, so memory use doesn't grow with the size of the message.
+ *
+ * Returns the number of bytes of plaintext read from `in_fd`.
+ * */
+size_t asymmetric_encrypt_plaintext_stream(struct gc_gpgme_ctx *ctx, int in_fd,
+		int out_fd, struct gpg_key_set *recipients);
+
+/**
+ * Encrypt a plaintext message stream like asymmetric_encrypt_plaintext_stream(),
+ * but symmetrically with a key derived from `passphrase`, as with
+ * symmetric_encrypt_plaintext_message().
+ *
+ * Returns the number of bytes of plaintext read from `in_fd`.
+ * */
+size_t symmetric_encrypt_plaintext_stream(struct gc_gpgme_ctx *ctx, int in_fd,
+		int out_fd, const char *passphrase);
 
 #endif //GIT_CHAT_ENCRYPTION_H
@@ -0,0 +1,174 @@
+#ifndef GIT_CHAT_INCLUDE_GNUPG_GROUP_KEY_H
+#define GIT_CHAT_INCLUDE_GNUPG_GROUP_KEY_H
+
+#include "git/git.h"
+#include "gnupg/gpg-common.h"
+#include "gnupg/key-set.h"
+#include "str-array.h"
+#include "strbuf.h"
+
+/**
+ * group-key api
+ *
+ * By default, each message is encrypted to the public key of every member of
+ * the channel, so the size of each message and the cost of encrypting it grow
+ * with the number of members. Channels may instead opt into a group key
+ * (`channel.<name>.groupkey`), with which messages are encrypted symmetrically.
+ *
+ * The group key of a channel changes with every membership epoch: whenever the
+ * set of member keys changes, a new random epoch key is generated and wrapped
+ * (encrypted) once to all members. The wrapped key is committed to the channel
+ * in `.git-chat/epochs/<epoch id>`, alongside the first message of the epoch:
+ *
+ * git-chat epoch v1
+ * member <fingerprint>
+ * ...
+ *
+ * -----BEGIN PGP MESSAGE-----
+ * ...
+ *
+ * Members are listed in sorted order. Messages encrypted with an epoch key are
+ * prefixed with a header that names the epoch:
+ *
+ * Git-Chat-Epoch: <epoch id>
+ *
+ * -----BEGIN PGP MESSAGE-----
+ * ...
+ *
+ * Messages stored as blobs keep the header in the commit message, followed by
+ * the ciphertext trailer (see git/commit.h).
+ *
+ * Readers unwrap each epoch key once with their secret key, and keep it in the
+ * epoch key cache (see cache/epoch-key-cache.h). Members that were removed from
+ * a channel can't read messages from later epochs.
+ * */
+
+#define GROUP_KEY_EPOCH_HEADER "Git-Chat-Epoch: "
+#define GROUP_KEY_EPOCH_DIR "epochs"
+
+// random bytes in an epoch id and an epoch key, hex encoded
+#define GROUP_KEY_EPOCH_ID_BYTES 16
+#define GROUP_KEY_EPOCH_KEY_BYTES 32
+
+#define GROUP_KEY_EPOCH_ID_LEN (GROUP_KEY_EPOCH_ID_BYTES * 2)
+
+struct group_epoch {
+	char id[GROUP_KEY_EPOCH_ID_LEN + 1];
+
+	// epoch key, hex encoded; empty unless unwrapped
+	struct strbuf key;
+
+	// sorted fingerprints of the members of the epoch
+	struct str_array members;
+
+	// epoch key, encrypted to the members
+	struct strbuf wrapped_key;
+};
+
+/**
+ * Initialize an empty epoch. Must be released with group_epoch_release() after
+ * use.
+ * */
+void group_epoch_init(struct group_epoch *epoch);
+
+/**
+ * Release any resources under the epoch. The epoch key is cleared from memory.
+ * */
+void group_epoch_release(struct group_epoch *epoch);
+
+/**
+ * Determine whether messages on the channel with the given name (e.g.
+ * `general`) are encrypted with a group key.
+ *
+ * Returns non-zero if the channel uses a group key, and zero otherwise.
+ * */
+int group_key_enabled(const char *channel);
+
+/**
+ * Determine whether `id` is a well-formed epoch id.
+ *
+ * Returns non-zero if well-formed, and zero otherwise.
+ * */
+int group_key_is_epoch_id(const char *id);
+
+/**
+ * Create a new epoch with a random id and key, for the members in the key set.
+ * The epoch key is wrapped to the members with the given gpgme context, which
+ * must hold the public keys of the members.
+ * */
+void group_epoch_create(struct gc_gpgme_ctx *ctx, struct gpg_key_set *members,
+		struct group_epoch *epoch);
+
+/**
+ * Determine whether the members of the epoch are exactly the keys in the key
+ * set.
+ *
+ * Returns non-zero if the members are the same, and zero otherwise.
+ * */
+int group_epoch_has_members(const struct group_epoch *epoch, struct gpg_key_set *members);
+
+/**
+ * Parse the content of an epoch file into `epoch`, which must be empty. `id`
+ * is the id of the epoch (the name of the epoch file).
+ *
+ * Returns zero if successful, and non-zero if the content is malformed.
+ * */
+int group_epoch_parse(struct group_epoch *epoch, const char *id,
+		const char *data, size_t len);
+
+/**
+ * Serialize the epoch into the content of its epoch file.
+ * */
+void group_epoch_serialize(const struct group_epoch *epoch, struct strbuf *out);
+
+/**
+ * Unwrap the epoch key with the secret keys available to the gpgme context.
+ *
+ * Returns zero if successful, and non-zero if the key could not be unwrapped
+ * (for instance, if we are not a member of the epoch).
+ * */
+int group_epoch_unwrap(struct gc_gpgme_ctx *ctx, struct group_epoch *epoch);
+
+/**
+ * Read the epoch file of the epoch `id` from the tree of the given commit, and
+ * parse it into `epoch`, which must be empty.
+ *
+ * Returns zero if successful, and non-zero if the epoch file does not exist in
+ * the tree or is malformed.
+ * */
+int group_epoch_read(struct group_epoch *epoch, const char *id,
+		const struct git_oid *commit);
+
+/**
+ * Append the epoch header line, which must precede messages encrypted with the
+ * epoch key, to `header`.
+ * */
+void group_key_message_header(const struct group_epoch *epoch, struct strbuf *header);
+
+/**
+ * Encrypt a plaintext message with the epoch key into `output`. The epoch key
+ * must be known.
+ * */
+void group_key_encrypt_message(struct gc_gpgme_ctx *ctx, const struct group_epoch *epoch,
+		const struct strbuf *message, struct strbuf *output);
+
+/**
+ * Encrypt the plaintext read from `in_fd` with the epoch key, writing the
+ * ciphertext to `out_fd`, as for symmetric_encrypt_plaintext_stream(). The
+ * epoch key must be known.
+ *
+ * Returns the number of bytes of plaintext read from `in_fd`.
+ * */
+size_t group_key_encrypt_stream(struct gc_gpgme_ctx *ctx, const struct group_epoch *epoch,
+		int in_fd, int out_fd);
+
+/**
+ * Read the epoch id from the header of a message body, if any.
+ *
+ * Returns zero if the message has a well-formed epoch header, in which case
+ * the id is copied into `id`, and non-zero otherwise.
+ * */
+int group_key_message_epoch(const char *body, size_t len,
+		char id[GROUP_KEY_EPOCH_ID_LEN + 1]);
+
+#endif //GIT_CHAT_INCLUDE_GNUPG_GROUP_KEY_H
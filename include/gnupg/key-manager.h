@@ -2,6 +2,8 @@
 #define GIT_CHAT_KEY_MANAGER_H
 
 #include "gnupg/gpg-common.h"
+#include "gnupg/key-set.h"
+#include "cache/keyring-manifest.h"
 #include "str-array.h"
 
 /**
@@ -15,6 +17,23 @@
 int import_gpg_key(struct gc_gpgme_ctx *ctx, const char *key_file_path,
 		struct str_array *imported_key_fingerprints);
 
+/**
+ * Import the gpg keys from a list of key files into the configured gpg keyring,
+ * with a single gpg import operation. Key files are streamed to gpg one at a
+ * time, so memory use is bounded by the largest key file rather than by the
+ * number of key files.
+ *
+ * imported_key_fingerprints, if non-null, is updated with the fingerprints of
+ * all imported keys, in the order of the key files. If `key_counts` is
+ * non-null, it must have room for one entry per key file, and is filled with
+ * the number of keys imported from each key file.
+ *
+ * Returns the number of keys successfully imported. If a key failed to be
+ * imported, the application will DIE().
+ * */
+int import_gpg_key_files(struct gc_gpgme_ctx *ctx, const struct str_array *key_file_paths,
+		struct str_array *imported_key_fingerprints, int *key_counts);
+
 /**
  * From the configured gpg keyring, export a key with a given fingerprint to
  * a given file.
@@ -26,11 +45,22 @@ int export_gpg_key(struct gc_gpgme_ctx *ctx, const char *fingerprint,
 		const char *file_path);
 
 /**
- * Reimport any gpg keys from the given keys directory into the gpg keyring.
+ * Stat the public keyring under the gpgme context home directory. gpg prefers
+ * a keybox over a legacy keyring, if both exist. If there is no keyring yet,
+ * the stamp is zeroed.
+ * */
+void get_gpg_keyring_stamp(struct gc_gpgme_ctx *ctx, struct keyring_stamp *stamp);
+
+/**
+ * Bring the gpg keyring up to date with the gpg keys in the given keys
+ * directory.
  *
- * gpg_homedir must be the full path to the gpg home directory, typically
- * found in `<repository>/.git/.gnupg`. The config directory will be created if
- * it does not exist.
+ * Only key files that were added or changed since the keyring was last
+ * rebuilt are imported, and keys that are no longer provided by any key file
+ * are deleted from the keyring (secret keys are never deleted). What was
+ * imported is tracked in the keyring manifest (see cache/keyring-manifest.h);
+ * if the manifest is missing, or the keyring was modified since, every key
+ * file is imported again.
  *
  * Returns the number of keys that were imported. If a key failed to be imported,
  * the application will DIE().
@@ -46,6 +76,31 @@ int rebuild_gpg_keyring(struct gc_gpgme_ctx *ctx, const char *keys_dir);
  * */
 int fetch_gpg_keys(struct gc_gpgme_ctx *ctx, struct gpg_key_list *keys);
 
+/**
+ * Build a linked list of all gpg keys from the keyring for which a secret key
+ * is available. These are the keys the user can decrypt messages with.
+ *
+ * The given gpg_key_list must be empty. Returns the number of keys inserted
+ * into the gpg_key_list.
+ * */
+int fetch_gpg_secret_keys(struct gc_gpgme_ctx *ctx, struct gpg_key_list *keys);
+
+/**
+ * Add all gpg keys from the (git-chat) keyring to a key set, including any
+ * private keys that might exist in the keyring.
+ *
+ * Returns the number of keys added to the key set.
+ * */
+int fetch_gpg_key_set(struct gc_gpgme_ctx *ctx, struct gpg_key_set *keys);
+
+/**
+ * Add all gpg keys from the keyring for which a secret key is available to a
+ * key set.
+ *
+ * Returns the number of keys added to the key set.
+ * */
+int fetch_gpg_secret_key_set(struct gc_gpgme_ctx *ctx, struct gpg_key_set *keys);
+
 /**
  * Release any resources under a gpg_key_list, including any gpg key data.
  *
@@ -0,0 +1,125 @@
+#ifndef GIT_CHAT_INCLUDE_GNUPG_KEY_SET_H
+#define GIT_CHAT_INCLUDE_GNUPG_KEY_SET_H
+
+#include <stddef.h>
+
+#include "gnupg/gpg-common.h"
+#include "arena.h"
+#include "hashmap.h"
+
+/**
+ * key-set api
+ *
+ * A gpg key set holds gpgme keys in a contiguous array, along with hash
+ * indexes over the fingerprint and user id fields of each key. It is used
+ * where keys must be looked up by fingerprint, name or email address, such as
+ * when mapping message recipients to keys, so that the work stays linear in
+ * the number of keys and recipients even for channels with thousands of
+ * members.
+ *
+ * The keys array is always NULL-terminated, so it can be handed to gpgme
+ * directly (for instance, to gpgme_op_encrypt()).
+ *
+ * Indexes are built lazily on the first lookup, and are invalidated whenever
+ * keys are added to or removed from the set. The matches returned by
+ * gpg_key_set_lookup() are only valid until then.
+ *
+ * A key set may also hold keys that are owned by someone else, in which case
+ * the set is `borrowed` and its keys are never released.
+ * */
+
+enum gpg_key_field {
+	GPG_KEY_FPR,
+	GPG_KEY_UID,
+	GPG_KEY_NAME,
+	GPG_KEY_EMAIL,
+	GPG_KEY_COMMENT,
+	GPG_KEY_ADDRESS,
+	GPG_KEY_FIELD_COUNT
+};
+
+struct gpg_key_set_match {
+	struct hashmap_entry ent;
+	const char *value;
+	enum gpg_key_field field;
+
+	// position of the matching key in the set
+	size_t pos;
+};
+
+struct gpg_key_set {
+	gpgme_key_t *keys;
+	size_t len;
+	size_t alloc;
+
+	struct hashmap indexes[GPG_KEY_FIELD_COUNT];
+	struct arena arena;
+	unsigned indexed: 1;
+	unsigned borrowed: 1;
+};
+
+/**
+ * Initialize an empty key set. Must be released with gpg_key_set_release()
+ * after use.
+ * */
+void gpg_key_set_init(struct gpg_key_set *set);
+
+/**
+ * Add a key to the set. The set takes ownership of the key reference.
+ * */
+void gpg_key_set_add(struct gpg_key_set *set, gpgme_key_t key);
+
+/**
+ * Filter the set according to the return value of a filter predicate function,
+ * with the same semantics as filter_gpg_keys_by_predicate(). The predefined
+ * filter functions of key-filter.h may be used. The order of the remaining
+ * keys is preserved.
+ *
+ * Returns the number of keys removed from the set.
+ * */
+size_t gpg_key_set_filter(struct gpg_key_set *set,
+		int (*predicate)(gpgme_key_t key, void *data), void *optional_data);
+
+/**
+ * Remove every key from the set whose entry in `retain` is zero. `retain` must
+ * have one entry for each key in the set.
+ *
+ * Returns the number of keys removed from the set.
+ * */
+size_t gpg_key_set_retain(struct gpg_key_set *set, const unsigned char *retain);
+
+/**
+ * Find a key whose `field` is equal to `value`. Since several keys may share
+ * the same name or email, further matches can be enumerated with
+ * gpg_key_set_lookup_next().
+ *
+ * Returns the first match, or NULL if no key matches.
+ * */
+const struct gpg_key_set_match *gpg_key_set_lookup(struct gpg_key_set *set,
+		enum gpg_key_field field, const char *value);
+
+/**
+ * Find the next key matching the same field and value as `match`.
+ *
+ * Returns the next match, or NULL if none remain.
+ * */
+const struct gpg_key_set_match *gpg_key_set_lookup_next(struct gpg_key_set *set,
+		const struct gpg_key_set_match *match);
+
+/**
+ * Add the keys with the given fingerprints to the set, in the same order, as
+ * listed by gpg. Only those keys are listed, with a single gpg invocation.
+ *
+ * Returns zero if successful, and non-zero if some key could not be found in
+ * the keyring, in which case the set is left unmodified.
+ * */
+int gpg_key_set_resolve(struct gc_gpgme_ctx *ctx, struct gpg_key_set *set,
+		const char **fingerprints, size_t len);
+
+/**
+ * Release any resources under the key set, including the keys (unless the set
+ * is borrowed).
+ * */
+void gpg_key_set_release(struct gpg_key_set *set);
+
+#endif //GIT_CHAT_INCLUDE_GNUPG_KEY_SET_H
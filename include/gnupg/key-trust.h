@@ -3,15 +3,43 @@
 
 #include <sys/types.h>
 
-#include "str-array.h"
+#include "hashmap.h"
 
 /**
- * Read the `.trusted-keys` file under `.git/` and append trusted fingerprints
- * to the given `trusted_keys` str_array.
+ * key-trust api
  *
- * Returns the number of fingerprints read from the trusted-keys file, or -1
- * if the file does not exist or could not be read for some reason.
+ * The trust list is the set of fingerprints of keys that messages may be
+ * encrypted to, read from `.git/.trusted-keys` (one fingerprint per line). It
+ * is loaded into a hash set, so that filtering the recipients of a message
+ * against it takes constant time per key.
  * */
-ssize_t read_trust_list(struct str_array *trusted_keys);
+
+struct trust_list {
+	struct hashmap fingerprints;
+};
+
+/**
+ * Initialize an empty trust list.
+ * */
+void trust_list_init(struct trust_list *trusted_keys);
+
+/**
+ * Read the `.trusted-keys` file under `.git/` and add trusted fingerprints
+ * to the given trust list.
+ *
+ * Returns the number of lines read from the trusted-keys file, or -1 if the
+ * file does not exist or could not be read for some reason.
+ * */
+ssize_t read_trust_list(struct trust_list *trusted_keys);
+
+/**
+ * Determine whether a fingerprint is in the trust list.
+ * */
+int trust_list_contains(const struct trust_list *trusted_keys, const char *fingerprint);
+
+/**
+ * Release any resources under the trust list.
+ * */
+void trust_list_release(struct trust_list *trusted_keys);
 
 #endif //GIT_CHAT_INCLUDE_GNUPG_KEY_TRUST_H
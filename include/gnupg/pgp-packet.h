@@ -0,0 +1,119 @@
+#ifndef GIT_CHAT_INCLUDE_GNUPG_PGP_PACKET_H
+#define GIT_CHAT_INCLUDE_GNUPG_PGP_PACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gnupg/gpg-common.h"
+
+/**
+ * pgp-packet api
+ *
+ * The pgp-packet api is a minimal, native scanner for ASCII-armored and binary
+ * OpenPGP messages (RFC 4880 and RFC 9580). It doesn't decrypt anything; it only
+ * classifies a message body and reads the key ids of its recipients from the
+ * public-key encrypted session key (PKESK) packets at the start of the message.
+ *
+ * This allows git-chat to decide, without a round trip through gpg, whether a
+ * message is plaintext, or whether it is addressed to one of our secret keys
+ * at all. Similarly, it can count the keys in armored key files, so that keys
+ * imported from many key files at once can be traced back to their key file.
+ * */
+
+enum pgp_scan_result {
+	/**
+	 * The body contains no OpenPGP message, so gpg would have nothing to
+	 * decrypt.
+	 * */
+	PGP_SCAN_PLAINTEXT,
+
+	/**
+	 * The body is an encrypted OpenPGP message, and its recipients were read.
+	 * */
+	PGP_SCAN_ENCRYPTED,
+
+	/**
+	 * The body looks like OpenPGP, but could not be understood by the scanner.
+	 * Callers should leave it to gpg.
+	 * */
+	PGP_SCAN_UNKNOWN
+};
+
+struct pgp_recipients {
+	uint64_t *key_ids;
+	size_t len;
+	size_t alloc;
+
+	/**
+	 * Set if the message has anonymous recipients (key id zero, i.e.
+	 * `gpg --throw-keyids`) or is (also) encrypted with a passphrase, in which
+	 * case any secret key or passphrase might be able to decrypt it.
+	 * */
+	unsigned wildcard: 1;
+};
+
+/**
+ * A set of key ids, used to hold the key ids of our secret (sub)keys.
+ * */
+struct pgp_key_id_set {
+	uint64_t *key_ids;
+	size_t len;
+	size_t alloc;
+};
+
+void pgp_recipients_init(struct pgp_recipients *recipients);
+void pgp_recipients_release(struct pgp_recipients *recipients);
+
+/**
+ * Scan a message body. If the body is an encrypted OpenPGP message, the key ids
+ * of its recipients are appended to `recipients`.
+ * */
+enum pgp_scan_result pgp_scan_message(const char *data, size_t len,
+		struct pgp_recipients *recipients);
+
+/**
+ * Like pgp_scan_message(), but scan a binary (unarmored) OpenPGP message, such
+ * as the ciphertext of a message stored as a blob. Binary messages are never
+ * classified as plaintext.
+ * */
+enum pgp_scan_result pgp_scan_binary_message(const char *data, size_t len,
+		struct pgp_recipients *recipients);
+
+/**
+ * Count the public keys in a key file holding one or more ASCII-armored public
+ * key blocks, as exported by `gpg --armor --export`. Each key counted yields
+ * one entry in the result of importing the key file with gpg.
+ *
+ * Returns the number of keys, or -1 if the key file is not armored, contains
+ * secret keys, or could not be understood by the scanner.
+ * */
+int pgp_count_public_keys(const char *data, size_t len);
+
+void pgp_key_id_set_init(struct pgp_key_id_set *set);
+void pgp_key_id_set_release(struct pgp_key_id_set *set);
+
+/**
+ * Load the key ids of all secret keys and subkeys available to the gpgme
+ * context into the set. This involves a single key listing in gpg.
+ *
+ * Returns the number of key ids loaded.
+ * */
+size_t pgp_key_id_set_load_secret_keys(struct pgp_key_id_set *set,
+		struct gc_gpgme_ctx *ctx);
+
+/**
+ * Add a key id to the set.
+ * */
+void pgp_key_id_set_add(struct pgp_key_id_set *set, uint64_t key_id);
+
+/**
+ * Determine whether a message with the given recipients might be decryptable
+ * with the keys in the set.
+ *
+ * Returns non-zero if the message may be decryptable, and zero if it is
+ * certainly not addressed to any key in the set.
+ * */
+int pgp_key_id_set_can_decrypt(struct pgp_key_id_set *set,
+		const struct pgp_recipients *recipients);
+
+#endif //GIT_CHAT_INCLUDE_GNUPG_PGP_PACKET_H
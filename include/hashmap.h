@@ -0,0 +1,149 @@
+#ifndef GIT_CHAT_HASHMAP_H
+#define GIT_CHAT_HASHMAP_H
+
+#include <stddef.h>
+
+/**
+ * hashmap api
+ *
+ * The hashmap api is a generic chained hash table with intrusive entries. It is
+ * used when lookups by key must remain fast as the number of entries grows, in
+ * cases where the str_array api would otherwise require a linear scan.
+ *
+ * Data Structure:
+ * struct hashmap_entry
+ * - next: next entry in the same bucket.
+ * - hash: hash code of the entry key.
+ *
+ * To store data in a hashmap, embed a `struct hashmap_entry` as the first
+ * member of your own structure:
+ *
+ *     struct oid_entry {
+ *         struct hashmap_entry ent;
+ *         struct git_oid oid;
+ *         char *value;
+ *     };
+ *
+ * Entries are compared using a caller-supplied comparison function, which
+ * receives the entry in the map, the entry (or key) being looked up, and
+ * optional key data. It must return zero if the entries are equal.
+ *
+ *     static int oid_entry_cmp(const void *entry, const void *entry_or_key,
+ *             const void *keydata)
+ *     {
+ *         const struct oid_entry *a = entry;
+ *         const struct oid_entry *b = entry_or_key;
+ *         return memcmp(a->oid.id, b->oid.id, GIT_RAW_OBJECT_ID);
+ *     }
+ *
+ * The hashmap never allocates or frees entries itself, unless explicitly asked
+ * to by hashmap_release().
+ * */
+
+struct hashmap_entry {
+	struct hashmap_entry *next;
+	unsigned int hash;
+};
+
+typedef int (*hashmap_cmp_fn)(const void *entry, const void *entry_or_key,
+		const void *keydata);
+
+struct hashmap {
+	struct hashmap_entry **table;
+	hashmap_cmp_fn cmpfn;
+	size_t size;
+	size_t tablesize;
+};
+
+struct hashmap_iter {
+	struct hashmap *map;
+	struct hashmap_entry *next;
+	size_t tablepos;
+};
+
+/**
+ * Compute the FNV-1 hash of a null-terminated string.
+ * */
+unsigned int strhash(const char *str);
+
+/**
+ * Compute the FNV-1 hash of a null-terminated string, ignoring case.
+ * */
+unsigned int strihash(const char *str);
+
+/**
+ * Compute the FNV-1 hash of a buffer of `len` bytes.
+ * */
+unsigned int memhash(const void *buf, size_t len);
+
+/**
+ * Initialize a hashmap. `initial_size` is the number of entries the map is
+ * expected to hold; the table is sized accordingly to avoid early rehashing.
+ * */
+void hashmap_init(struct hashmap *map, hashmap_cmp_fn cmpfn, size_t initial_size);
+
+/**
+ * Release the resources under a hashmap. If `free_entries` is non-zero, every
+ * entry in the map is free()d.
+ *
+ * The hashmap must be reinitialized for reuse.
+ * */
+void hashmap_release(struct hashmap *map, int free_entries);
+
+/**
+ * Initialize a hashmap entry with the given hash code. Must be invoked on
+ * an entry before it is inserted into the map, or used as a lookup key.
+ * */
+void hashmap_entry_init(void *entry, unsigned int hash);
+
+/**
+ * Find an entry in the map equal to the given entry or key. `keydata` is passed
+ * through to the comparison function.
+ *
+ * Returns the entry, or NULL if no such entry exists.
+ * */
+void *hashmap_get(const struct hashmap *map, const void *key, const void *keydata);
+
+/**
+ * Find the next entry in the map equal to the given entry. Used to enumerate
+ * duplicate entries inserted using hashmap_add().
+ *
+ * Returns the next equal entry, or NULL if none remain.
+ * */
+void *hashmap_get_next(const struct hashmap *map, const void *entry);
+
+/**
+ * Add an entry to the map, allowing duplicates.
+ * */
+void hashmap_add(struct hashmap *map, void *entry);
+
+/**
+ * Add or replace an entry in the map.
+ *
+ * Returns the entry that was replaced, or NULL if there was no equal entry.
+ * The caller assumes ownership of the replaced entry.
+ * */
+void *hashmap_put(struct hashmap *map, void *entry);
+
+/**
+ * Remove an entry equal to the given entry or key from the map.
+ *
+ * Returns the entry that was removed, or NULL if no such entry exists. The
+ * caller assumes ownership of the removed entry.
+ * */
+void *hashmap_remove(struct hashmap *map, const void *key, const void *keydata);
+
+/**
+ * Initialize an iterator over all entries in the map. Entries are returned
+ * in no particular order. The map must not be modified while iterating.
+ * */
+void hashmap_iter_init(struct hashmap *map, struct hashmap_iter *iter);
+
+/**
+ * Retrieve the next entry from the iterator.
+ *
+ * Returns the next entry, or NULL once all entries have been visited.
+ * */
+void *hashmap_iter_next(struct hashmap_iter *iter);
+
+#endif //GIT_CHAT_HASHMAP_H
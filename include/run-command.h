@@ -14,8 +14,18 @@
  * commands as child processes, manipulating their standard streams and capturing
  * their output for external processing.
  *
- * Internally, run-command fork()s the current process and execve()s the executable
- * as a child process.
+ * Internally, run-command creates child processes with posix_spawn(), which
+ * avoids copying the address space of the current process, configuring the
+ * standard streams of the child with spawn file actions. Platforms that can't
+ * change the working directory of a spawned process fall back to fork() and
+ * execve() for commands with a `dir`.
+ *
+ * Executables are searched for in PATH once per process (and again if PATH
+ * changes), and the environment of the current process is snapshotted once and
+ * shared by all child processes (and taken again if the environment changes).
+ * Child processes without `env` variables of their own inherit the environment
+ * as is. None of this is thread-safe; commands must only be run from one
+ * thread.
  *
  *
  * `child_process_def` Data Structure:
@@ -163,4 +173,54 @@ int finish_command(struct child_process_def *cmd);
  * */
 int capture_command(struct child_process_def *cmd, struct strbuf *buffer);
 
+/**
+ * Run a command like capture_command(), but capture its stdout in full,
+ * including any null bytes, for commands with binary output (like
+ * `git cat-file blob`).
+ *
+ * Returns the exit status of the command.
+ * */
+int capture_command_bytes(struct child_process_def *cmd, struct strbuf *buffer);
+
+/**
+ * Callback for run_processes_parallel(), invoked when a process slot is free.
+ * `cmd` is initialized; to start a task, the callback configures `cmd` (like
+ * for start_command()), optionally sets `*task_data` (which is given back in
+ * the completion callback), and returns non-zero. Returning zero indicates
+ * there are no tasks left.
+ * */
+typedef int (*parallel_next_task_fn)(struct child_process_def *cmd, void *data,
+		void **task_data);
+
+/**
+ * Callback for run_processes_parallel(), invoked once a task's process has
+ * exited and its output has been read in full. `status` is the exit status of
+ * the process (see finish_command()), and `out` and `err` hold everything the
+ * process wrote to stdout and stderr (empty if the stream wasn't captured).
+ *
+ * Returning non-zero stops run_processes_parallel() from starting new tasks;
+ * processes that are already running are still waited for.
+ * */
+typedef int (*parallel_task_finished_fn)(int status, struct strbuf *out,
+		struct strbuf *err, void *data, void *task_data);
+
+/**
+ * Run the tasks given by `next_task`, with at most `max_processes` processes
+ * running at once (or one per online processor, if zero).
+ *
+ * The stdout and stderr of each process are captured (unless configured as
+ * STDOUT_NULL or STDERR_NULL), and the output of all running processes is read
+ * from a single poll() loop, so that no process blocks on a full pipe while
+ * another one is being waited for. Processes must not have provisioned
+ * streams; stdin is inherited unless configured otherwise.
+ *
+ * `task_finished` is invoked for each task as it completes, in the order the
+ * processes exit, from the calling thread.
+ *
+ * Returns zero if every `task_finished` callback returned zero, and non-zero
+ * otherwise.
+ * */
+int run_processes_parallel(size_t max_processes, parallel_next_task_fn next_task,
+		parallel_task_finished_fn task_finished, void *data);
+
 #endif //GIT_CHAT_RUN_COMMAND_H
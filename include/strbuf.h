@@ -47,6 +47,13 @@ void strbuf_grow(struct strbuf *buff, size_t size);
  * */
 void strbuf_attach(struct strbuf *buff, const char *str, size_t buffer_len);
 
+/**
+ * Attach exactly `len` bytes to the strbuf, including any null bytes. Use this
+ * rather than strbuf_attach() for binary data, like raw ciphertext. The buffer
+ * is still null-terminated, but `len` is the only reliable length of its content.
+ * */
+void strbuf_attach_bytes(struct strbuf *buff, const void *data, size_t len);
+
 /**
  * Attach a null-terminated string to the strbuf. Similar to strbuf_attach(), except
  * uses strlen() to determine the buffer_len.
@@ -81,6 +88,12 @@ void strbuf_attach_vfmt(struct strbuf *buff, const char *fmt, va_list varargs);
  * */
 void strbuf_attach_fd(struct strbuf *buff, int fd);
 
+/**
+ * Read and attach all data from an open file descriptor to a strbuf, including
+ * any null bytes (see strbuf_attach_bytes()).
+ * */
+void strbuf_attach_fd_bytes(struct strbuf *buff, int fd);
+
 /**
  * Trim leading and trailing whitespace from an strbuf, returning the number of
  * characters removed from the buffer.
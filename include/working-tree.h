@@ -10,7 +10,9 @@
  * are met:
  * - `.git-chat` exists and is a directory
  * - `.git` exists and is a directory
- * - `git rev-parse --is-inside-work-tree` returns with a zero exit status
+ * - git can read objects from the repository (through the object coprocess,
+ *   which keeps running for other uses), or, failing that,
+ *   `git rev-parse --is-inside-work-tree` returns with a zero exit status
  * */
 int is_inside_git_chat_space();
 
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define ALIGN_UP(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+void arena_init(struct arena *arena, size_t chunk_size)
+{
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size = ALIGN_UP(size ? size : 1);
+
+	struct arena_chunk *chunk = arena->chunks;
+	if (!chunk || chunk->size - chunk->used < size) {
+		size_t chunk_size = arena->chunk_size;
+		if (chunk_size < size)
+			chunk_size = ALIGN_UP(size);
+
+		chunk = (struct arena_chunk *) malloc(sizeof(struct arena_chunk) + chunk_size);
+		if (!chunk)
+			FATAL(MEM_ALLOC_FAILED);
+
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	void *ptr = (char *) chunk->data + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+void arena_reset(struct arena *arena)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	if (!chunk)
+		return;
+
+	// keep the oldest chunk, so that allocations start at the same address
+	while (chunk->next) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	chunk->used = 0;
+	arena->chunks = chunk;
+}
+
+void arena_release(struct arena *arena)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	while (chunk) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->chunks = NULL;
+}
@@ -9,13 +9,14 @@
 #include "working-tree.h"
 
 static const struct usage_string channel_cmd_usage[] = {
-		USAGE("git chat channel create [(-n | --name) <alias>] [(-d | --description) <description>] <refname>"),
+		USAGE("git chat channel create [(-n | --name) <alias>] [(-d | --description) <description>] [--group-key] <refname>"),
 		USAGE_END()
 };
 
 int channel_create(int argc, char *argv[])
 {
 	int show_help = 0;
+	int group_key = 0;
 	char *alias = NULL;
 	char *description = NULL;
 
@@ -23,6 +24,7 @@ int channel_create(int argc, char *argv[])
 			OPT_STRING('n', "name", "alias", "specify channel name", &alias),
 			OPT_STRING('d', "description", "description",
 					"specify channel description", &description),
+			OPT_LONG_BOOL("group-key", "encrypt messages with a group key shared by channel members", &group_key),
 			OPT_BOOL('h', "help", "show usage and exit", &show_help),
 			OPT_END()
 	};
@@ -83,6 +85,9 @@ int channel_create(int argc, char *argv[])
 	if (description && config_data_insert_exp_key(conf, description, "channel", channel_name,
 			"description", NULL))
 		DIE(err_msg);
+	if (group_key && config_data_insert_exp_key(conf, "true", "channel", channel_name,
+			"groupkey", NULL))
+		DIE(err_msg);
 
 	struct child_process_def cmd;
 	child_process_def_init(&cmd);
@@ -2,18 +2,24 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
-#include <math.h>
 
 #include "parse-options.h"
 #include "run-command.h"
 #include "str-array.h"
 #include "strbuf.h"
+#include "cache/message-count-cache.h"
+#include "cache/read-watermark.h"
 #include "config/parse-config.h"
 #include "git/git.h"
+#include "git/object-coprocess.h"
+#include "git/object-db.h"
+#include "hashmap.h"
 #include "paging.h"
 #include "utils.h"
 #include "working-tree.h"
 
+#define CHANNEL_CONFIG_PATH ".git-chat/config"
+
 static const struct usage_string channel_cmd_usage[] = {
 		USAGE("git chat channel list [(-a | --all)]"),
 		USAGE_END()
@@ -23,6 +29,7 @@ static const struct usage_string channel_cmd_usage[] = {
 struct channel_details {
 	struct git_oid object_id;
 	int message_count;
+	int unread;
 	char *refname_full;
 	char *refname_short;
 	char *origin;
@@ -44,6 +51,7 @@ static void channel_details_init(struct channel_details *channel,
 	channel->current = is_current;
 
 	channel->message_count = -1;
+	channel->unread = -1;
 	channel->channel_name = NULL;
 	channel->channel_desc = NULL;
 	channel->refname_full = NULL;
@@ -60,6 +68,7 @@ static void channel_details_release(struct channel_details *channel)
 	channel->remote = 0;
 	channel->current = 0;
 	channel->message_count = -1;
+	channel->unread = -1;
 
 	free(channel->origin);
 	free(channel->refname_short);
@@ -69,39 +78,111 @@ static void channel_details_release(struct channel_details *channel)
 }
 
 /**
- * Calculate the message count for a given channel by git_oid and set
- * `*message_count` accordingly. `message_count` is only updated if the count
- * could be retrieved successfully.
+ * Reads the message count and config of each channel. Where possible, objects
+ * are read straight from the object database, so that listing channels doesn't
+ * spawn git for every channel. Otherwise, configs are read through the object
+ * coprocess (see git/object-coprocess.h), all requested in one batch.
  *
- * Returns zero of successful, and nonzero if an error occurred.
+ * Message counts are kept in the message count cache (see
+ * cache/message-count-cache.h), so that only channels whose tips have moved
+ * since they were last listed need to be counted.
  * */
-static int calculate_channel_message_count(struct git_oid *oid, int *message_count)
+struct channel_reader {
+	struct object_db odb;
+	unsigned native: 1;
+
+	// message counts of channel tips, and of commits walked so far
+	struct message_count_cache counts;
+};
+
+static void channel_reader_init(struct channel_reader *reader)
 {
-	struct child_process_def rev_list_cmd;
-	child_process_def_init(&rev_list_cmd);
-	rev_list_cmd.git_cmd = 1;
+	reader->native = !object_db_init(&reader->odb, NULL);
+	if (!reader->native)
+		LOG_INFO("repository can't be read natively; reading channels through git");
+
+	message_count_cache_init(&reader->counts);
+	message_count_cache_load(&reader->counts);
+}
+
+static void channel_reader_release(struct channel_reader *reader)
+{
+	if (message_count_cache_write(&reader->counts))
+		LOG_WARN("unable to update the message count cache");
+
+	message_count_cache_release(&reader->counts);
+	object_db_release(&reader->odb);
+}
+
+/**
+ * Configure `cmd` to count the messages reachable from `oid` with git rev-list,
+ * excluding the history of `exclude` (if not NULL).
+ * */
+static void rev_list_count_cmd(struct child_process_def *cmd,
+		const struct git_oid *oid, const struct git_oid *exclude)
+{
+	cmd->git_cmd = 1;
 
 	char ref_id[GIT_HEX_OBJECT_ID + 1];
-	git_oid_to_str(oid, ref_id);
+	git_oid_to_str((struct git_oid *) oid, ref_id);
 	ref_id[GIT_HEX_OBJECT_ID] = 0;
-	argv_array_push(&rev_list_cmd.args, "rev-list", "--count", "--first-parent",
+	argv_array_push(&cmd->args, "rev-list", "--count", "--first-parent",
 			"--no-merges", ref_id, NULL);
 
+	if (exclude) {
+		char exclude_id[GIT_HEX_OBJECT_ID + 2] = "^";
+		git_oid_to_str((struct git_oid *) exclude, exclude_id + 1);
+		exclude_id[GIT_HEX_OBJECT_ID + 1] = 0;
+		argv_array_push(&cmd->args, exclude_id, NULL);
+	}
+}
+
+/**
+ * Parse the output of git rev-list --count into `message_count`, which is
+ * only updated if the output is well formed.
+ *
+ * Returns zero if successful, and nonzero if the output is malformed.
+ * */
+static int parse_rev_list_count(const struct strbuf *out, int *message_count)
+{
+	char *tailptr = NULL;
+	unsigned long count = strtoul(out->buff, &tailptr, 0);
+
+	// verify that integer was parsed successfully
+	if (tailptr == out->buff || *tailptr != '\n')
+		return 1;
+
+	*message_count = (int) count;
+	return 0;
+}
+
+/**
+ * Count the messages reachable from `oid` with git rev-list, excluding the
+ * history of `exclude` (if not NULL), and set `*message_count` accordingly.
+ * `message_count` is only updated if the count could be retrieved successfully.
+ *
+ * Returns zero of successful, and nonzero if an error occurred.
+ * */
+static int count_messages_subprocess(const struct git_oid *oid,
+		const struct git_oid *exclude, int *message_count)
+{
+	struct child_process_def rev_list_cmd;
+	child_process_def_init(&rev_list_cmd);
+	rev_list_count_cmd(&rev_list_cmd, oid, exclude);
+
 	struct strbuf rev_list_out;
 	strbuf_init(&rev_list_out);
 
+	char ref_id[GIT_HEX_OBJECT_ID + 1];
+	git_oid_to_str((struct git_oid *) oid, ref_id);
+	ref_id[GIT_HEX_OBJECT_ID] = 0;
+
 	int status = capture_command(&rev_list_cmd, &rev_list_out);
 	if (!status) {
-		char *tailptr = NULL;
-		unsigned long count = strtoul(rev_list_out.buff, &tailptr, 0);
-
-		// verify that integer was parsed successfully
-		if (tailptr && *tailptr == '\n') {
-			*message_count = (int) count;
+		if (!parse_rev_list_count(&rev_list_out, message_count))
 			LOG_TRACE("message count for channel with ref '%s': %d", ref_id, *message_count);
-		} else {
+		else
 			LOG_WARN("failed to parse channel message count for ref '%s'", ref_id);
-		}
 	}
 
 	strbuf_release(&rev_list_out);
@@ -110,74 +191,310 @@ static int calculate_channel_message_count(struct git_oid *oid, int *message_cou
 }
 
 /**
- * Parse the git-chat config file for a given channel and update the appropriate
- * fields in `channel`.
+ * Read the parents of a commit from the object database: the number of
+ * parents, and the first parent (if any).
  *
- * Returns zero if successful, and nonzero if unable to read or parse the
- * config file for that channel.
+ * Returns zero if successful, and non-zero if the commit could not be read.
  * */
-static int parse_channel_config(struct git_oid *oid, const char *branch_name,
-		char **name, char **desc)
+static int read_commit_parents(struct object_db *odb, const struct git_oid *oid,
+		size_t *parents, struct git_oid *first_parent)
 {
-	if (!branch_name)
+	struct git_object obj;
+	const size_t tree_line_len = strlen("tree ") + GIT_HEX_OBJECT_ID + 1;
+	const size_t parent_line_len = strlen("parent ") + GIT_HEX_OBJECT_ID + 1;
+
+	if (object_db_read(odb, oid, &obj))
 		return 1;
+	if (obj.type != GIT_OBJ_COMMIT || obj.len < tree_line_len) {
+		git_object_release(&obj);
+		return 1;
+	}
+
+	const char *current = (const char *) obj.data + tree_line_len;
+	const char *end = (const char *) obj.data + obj.len;
+
+	*parents = 0;
+	while ((size_t) (end - current) >= parent_line_len && !memcmp(current, "parent ", 7)) {
+		if (!*parents)
+			git_str_to_oid(first_parent, current + 7);
+
+		(*parents)++;
+		current += parent_line_len;
+	}
+
+	git_object_release(&obj);
+
+	return 0;
+}
+
+/**
+ * Count the messages of a channel, like `git rev-list --count --first-parent
+ * --no-merges`, by walking the first-parent history from the object database.
+ *
+ * Channels usually share most of their history (at least the root commit of
+ * the space), so the count of every commit walked is remembered, and each walk
+ * stops as soon as it reaches a commit whose count is known, like the previous
+ * tip of the channel. Listing many channels therefore walks the shared history
+ * only once, and tips that advanced only walk their new commits.
+ *
+ * Returns the count of `tip`, or NULL if some commit could not be read.
+ * */
+static struct message_count *count_messages_native(struct channel_reader *reader,
+		const struct git_oid *tip)
+{
+	struct walked_commit {
+		struct git_oid oid;
+		unsigned merge: 1;
+	} *walked = NULL;
+	size_t walked_len = 0, walked_alloc = 0;
+	struct git_oid current = *tip;
+	struct message_count *known;
+	int count = 0, depth = 0;
+
+	while (1) {
+		known = message_count_cache_get(&reader->counts, &current);
+		if (known && known->depth >= 0) {
+			count = known->count;
+			depth = known->depth;
+			break;
+		}
+
+		size_t parents;
+		struct git_oid first_parent;
+		if (read_commit_parents(&reader->odb, &current, &parents, &first_parent)) {
+			free(walked);
+			return NULL;
+		}
+
+		if (walked_len >= walked_alloc) {
+			walked_alloc = walked_alloc ? walked_alloc * 2 : 64;
+			walked = realloc(walked, walked_alloc * sizeof(*walked));
+			if (!walked)
+				FATAL(MEM_ALLOC_FAILED);
+		}
+
+		walked[walked_len].oid = current;
+		walked[walked_len++].merge = parents > 1;
 
-	struct child_process_def show_config_cmd;
-	child_process_def_init(&show_config_cmd);
-	show_config_cmd.git_cmd = 1;
+		if (!parents || object_db_is_shallow(&reader->odb, &current))
+			break;
+
+		current = first_parent;
+	}
+
+	// unwind from the oldest commit walked, remembering the count of each
+	while (walked_len--) {
+		count += !walked[walked_len].merge;
+		depth++;
+		known = message_count_cache_put(&reader->counts, &walked[walked_len].oid, count, depth);
+	}
+
+	free(walked);
+
+	return known;
+}
 
+/**
+ * Calculate the message count of the commit `oid`, keeping it in the message
+ * count cache.
+ *
+ * Returns the count, or NULL if it could not be calculated.
+ * */
+static struct message_count *calculate_channel_message_count(struct channel_reader *reader,
+		const struct git_oid *oid)
+{
+	struct message_count *entry = message_count_cache_get(&reader->counts, oid);
+
+	// commits counted through git have an unknown depth, so count them again
+	if (reader->native && (!entry || entry->depth < 0))
+		entry = count_messages_native(reader, oid);
+
+	if (!entry) {
+		int count;
+		if (count_messages_subprocess(oid, NULL, &count))
+			return NULL;
+
+		entry = message_count_cache_put(&reader->counts, oid, count, -1);
+	}
+
+	message_count_cache_keep(&reader->counts, entry);
+
+	return entry;
+}
+
+/**
+ * Determine whether `ancestor` is on the first-parent history of `tip`, by
+ * walking back from `tip` as many commits as it is deeper than `ancestor`.
+ *
+ * Returns positive if `ancestor` is on the first-parent history of `tip` (or
+ * is `tip`), zero if not, and negative if some commit could not be read.
+ * */
+static int is_first_parent_ancestor(struct channel_reader *reader,
+		const struct message_count *tip, const struct message_count *ancestor)
+{
+	struct git_oid current = tip->oid;
+
+	for (int steps = tip->depth - ancestor->depth; steps > 0; steps--) {
+		size_t parents;
+		if (read_commit_parents(&reader->odb, &current, &parents, &current))
+			return -1;
+		if (!parents)
+			return 0;
+	}
+
+	return !memcmp(current.id, ancestor->oid.id, GIT_RAW_OBJECT_ID);
+}
+
+/**
+ * Calculate the number of messages of `tip` that are newer than the read
+ * watermark of `channel` (a full ref name), which is the number of messages
+ * `git chat read --new` would show. If the channel has no watermark, or the
+ * watermark is no longer on the history of `tip`, all messages are unread. If
+ * `tip` is on the history of the watermark, none are.
+ *
+ * Returns the number of unread messages, or -1 if it could not be calculated.
+ * */
+static int calculate_channel_unread(struct channel_reader *reader,
+		struct message_count *tip, const char *channel)
+{
+	struct git_oid watermark;
+	int unread = -1;
+
+	if (read_watermark_get(channel, &watermark))
+		return tip->count;
+
+	if (tip->has_unread && !memcmp(tip->watermark.id, watermark.id, GIT_RAW_OBJECT_ID))
+		return tip->unread;
+
+	if (reader->native && tip->depth >= 0) {
+		struct message_count *mark = calculate_channel_message_count(reader, &watermark);
+		if (mark && mark->depth >= 0) {
+			int ret;
+
+			// a tip behind the watermark (like a stale remote channel) was read in full
+			if (tip->depth < mark->depth && (ret = is_first_parent_ancestor(reader, mark, tip)))
+				unread = ret > 0 ? 0 : -1;
+			else if ((ret = is_first_parent_ancestor(reader, tip, mark)) > 0)
+				unread = tip->count - mark->count;
+			else if (!ret)
+				unread = tip->count;
+		}
+	}
+
+	if (unread < 0 && count_messages_subprocess(&tip->oid, &watermark, &unread))
+		return -1;
+
+	message_count_cache_set_unread(&reader->counts, tip, &watermark, unread);
+
+	return unread;
+}
+
+/**
+ * Read the git-chat config file of the channel whose tip is `oid`.
+ *
+ * Returns zero if successful, and non-zero if the channel has no config file
+ * or it could not be read.
+ * */
+static int read_channel_config(struct channel_reader *reader, const struct git_oid *oid,
+		struct strbuf *config)
+{
 	char ref_id[GIT_HEX_OBJECT_ID + 1];
-	git_oid_to_str(oid, ref_id);
+	git_oid_to_str((struct git_oid *) oid, ref_id);
 	ref_id[GIT_HEX_OBJECT_ID] = 0;
 
-	/*
-	 * lookup config file for the given channel and write to temporary file.
-	 * */
-	struct strbuf config_file;
-	strbuf_init(&config_file);
-	strbuf_attach_fmt(&config_file, "%s:%s", ref_id, ".git-chat/config");
+	if (reader->native) {
+		struct git_object obj;
+		int ret = object_db_read_path(&reader->odb, oid, CHANNEL_CONFIG_PATH, &obj);
+		if (!ret) {
+			if (obj.type == GIT_OBJ_BLOB)
+				strbuf_attach(config, (const char *) obj.data, obj.len);
+			else
+				ret = 1;
 
-	argv_array_push(&show_config_cmd.args, "--no-pager", "show", config_file.buff, NULL);
-	strbuf_release(&config_file);
+			git_object_release(&obj);
+		}
 
-	char tmp_file_name_template[] = "/tmp/gitchat_XXXXXX";
-	int tmp_fd = mkstemp(tmp_file_name_template);
-	if (tmp_fd < 0)
-		FATAL("unable to create temporary file");
-	if (unlink(tmp_file_name_template) < 0)
-		FATAL("failed to unlink temporary file from filesystem");
+		if (ret >= 0)
+			return ret;
 
-	child_process_def_stderr(&show_config_cmd, STDERR_NULL);
-	child_process_def_stdout(&show_config_cmd, STDOUT_PROVISIONED);
-	show_config_cmd.out_fd[0] = -1;
-	show_config_cmd.out_fd[1] = tmp_fd;
+		LOG_WARN("unable to read config file for channel with oid '%s' natively", ref_id);
+	}
 
-	start_command(&show_config_cmd);
-	int status = finish_command(&show_config_cmd);
-	if (status) {
-		LOG_ERROR("unable to read config file for channel with oid '%.*s'; "
-				  "child process exited with status %d", GIT_HEX_OBJECT_ID,
-				ref_id, status);
+	struct strbuf name;
+	strbuf_init(&name);
+	strbuf_attach_fmt(&name, "%s:%s", ref_id, CHANNEL_CONFIG_PATH);
+
+	struct git_object obj;
+	int ret = object_coprocess_response(name.buff, OBJECT_REQUEST_CONTENTS, NULL, &obj);
+	if (ret < 0)
+		FATAL("failed to read config files of channels from git cat-file");
+	if (!ret) {
+		if (obj.type == GIT_OBJ_BLOB)
+			strbuf_attach(config, (const char *) obj.data, obj.len);
+		else
+			ret = 1;
 
-		child_process_def_release(&show_config_cmd);
-		close(tmp_fd);
-		return 1;
+		git_object_release(&obj);
 	}
 
-	child_process_def_release(&show_config_cmd);
+	strbuf_release(&name);
 
-	off_t offset = lseek(tmp_fd, 0, SEEK_SET);
-	if (offset < 0)
-		FATAL("failed to seek temp file descriptor");
+	return ret;
+}
+
+/**
+ * Queue requests for the config files of every channel in `ref_lines` (the
+ * lines of the git for-each-ref output) with the object coprocess, so that
+ * they are read from git in a single batch once the first one is needed.
+ * */
+static void request_channel_configs(struct str_array *ref_lines)
+{
+	struct strbuf name;
+	strbuf_init(&name);
+
+	for (size_t i = 0; i < ref_lines->len; i++) {
+		char *line = str_array_get(ref_lines, i);
+		if (strlen(line) < (GIT_HEX_OBJECT_ID + 3))
+			continue;
+
+		strbuf_clear(&name);
+		strbuf_attach_fmt(&name, "%.*s:%s", GIT_HEX_OBJECT_ID, line, CHANNEL_CONFIG_PATH);
+		object_coprocess_request(name.buff, OBJECT_REQUEST_CONTENTS);
+	}
+
+	strbuf_release(&name);
+}
+
+/**
+ * Parse the git-chat config file for a given channel and update the appropriate
+ * fields in `channel`.
+ *
+ * Returns zero if successful, and nonzero if unable to read or parse the
+ * config file for that channel.
+ * */
+static int parse_channel_config(struct channel_reader *reader, struct git_oid *oid,
+		const char *branch_name, char **name, char **desc)
+{
+	if (!branch_name)
+		return 1;
+
+	struct strbuf config_file;
+	strbuf_init(&config_file);
+
+	if (read_channel_config(reader, oid, &config_file)) {
+		LOG_ERROR("unable to read config file for channel '%s'", branch_name);
+		strbuf_release(&config_file);
+		return 1;
+	}
 
 	struct config_data *config;
 	config_data_init(&config);
-	status = parse_config_fd(config, tmp_fd);
+	int status = parse_config_buffer(config, config_file.buff, config_file.len);
+	strbuf_release(&config_file);
 	if (status) {
-		LOG_ERROR("unable to parse config file for channel with oid '%.*s'",
-				GIT_HEX_OBJECT_ID, ref_id);
+		LOG_ERROR("unable to parse config file for channel '%s'", branch_name);
 
-		close(tmp_fd);
+		config_data_release(&config);
 		return 1;
 	}
 
@@ -187,8 +504,7 @@ static int parse_channel_config(struct git_oid *oid, const char *branch_name,
 		if (!*name)
 			FATAL(MEM_ALLOC_FAILED);
 	} else {
-		LOG_WARN("could not find channel name from config file for '%.*s'",
-				GIT_HEX_OBJECT_ID, ref_id);
+		LOG_WARN("could not find channel name from config file for '%s'", branch_name);
 	}
 
 	prop_value = config_data_find_exp_key(config, "channel", branch_name, "description", NULL);
@@ -197,14 +513,11 @@ static int parse_channel_config(struct git_oid *oid, const char *branch_name,
 		if (!*desc)
 			FATAL(MEM_ALLOC_FAILED);
 	} else {
-		LOG_WARN("could not find channel description from config file for '%.*s'",
-				GIT_HEX_OBJECT_ID, ref_id);
+		LOG_WARN("could not find channel description from config file for '%s'", branch_name);
 	}
 
 	config_data_release(&config);
 
-	close(tmp_fd);
-
 	return 0;
 }
 
@@ -263,6 +576,150 @@ end:
 	return status;
 }
 
+/**
+ * A message count to be calculated through git rev-list: the number of
+ * messages of `tip`, or if `since_watermark`, the number of messages of `tip`
+ * newer than `watermark`. `count` is -1 until calculated.
+ * */
+struct count_task {
+	struct git_oid tip;
+	struct git_oid watermark;
+	unsigned since_watermark: 1;
+	int count;
+};
+
+struct count_task_list {
+	struct count_task *tasks;
+	size_t len;
+	size_t alloc;
+	size_t next;
+};
+
+static void count_task_list_add(struct count_task_list *list, const struct git_oid *tip,
+		const struct git_oid *watermark)
+{
+	for (size_t i = 0; i < list->len; i++) {
+		struct count_task *task = &list->tasks[i];
+		if (memcmp(task->tip.id, tip->id, GIT_RAW_OBJECT_ID) != 0 || task->since_watermark != !!watermark)
+			continue;
+		if (!watermark || !memcmp(task->watermark.id, watermark->id, GIT_RAW_OBJECT_ID))
+			return;
+	}
+
+	if (list->len >= list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 16;
+		list->tasks = realloc(list->tasks, list->alloc * sizeof(struct count_task));
+		if (!list->tasks)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	struct count_task *task = &list->tasks[list->len++];
+	task->tip = *tip;
+	task->since_watermark = !!watermark;
+	if (watermark)
+		task->watermark = *watermark;
+	task->count = -1;
+}
+
+static int next_count_task(struct child_process_def *cmd, void *data, void **task_data)
+{
+	struct count_task_list *list = (struct count_task_list *) data;
+	if (list->next >= list->len)
+		return 0;
+
+	struct count_task *task = &list->tasks[list->next++];
+	rev_list_count_cmd(cmd, &task->tip, task->since_watermark ? &task->watermark : NULL);
+	child_process_def_stderr(cmd, STDERR_NULL);
+	*task_data = task;
+
+	return 1;
+}
+
+static int count_task_finished(int status, struct strbuf *out, struct strbuf *err,
+		void *data, void *task_data)
+{
+	struct count_task *task = (struct count_task *) task_data;
+	(void) err;
+	(void) data;
+
+	if (!status && parse_rev_list_count(out, &task->count))
+		LOG_WARN("failed to parse output of git rev-list: '%s'", out->buff);
+
+	return 0;
+}
+
+/**
+ * When the repository can't be read natively, every channel missing from the
+ * message count cache would otherwise be counted by running git rev-list one
+ * channel at a time, twice for channels with a read watermark. Instead, run
+ * all of them up front with run_processes_parallel() and put the results in
+ * the cache, where calculate_channel_message_count() and
+ * calculate_channel_unread() will find them.
+ *
+ * `ref_lines` are the lines of the git for-each-ref output. Malformed lines
+ * are skipped here; they are reported by the caller.
+ * */
+static void prefetch_message_counts(struct channel_reader *reader,
+		struct str_array *ref_lines)
+{
+	struct count_task_list list = { NULL, 0, 0, 0 };
+
+	for (size_t i = 0; i < ref_lines->len; i++) {
+		char *line = str_array_get(ref_lines, i);
+		if (strlen(line) < (GIT_HEX_OBJECT_ID + 3))
+			continue;
+
+		struct git_oid tip, watermark;
+		git_str_to_oid(&tip, line);
+
+		struct message_count *entry = message_count_cache_get(&reader->counts, &tip);
+		if (!entry)
+			count_task_list_add(&list, &tip, NULL);
+
+		char *refname = line + GIT_HEX_OBJECT_ID + 3;
+		unsigned remote = !strncmp(refname, "refs/remotes/", strlen("refs/remotes/"));
+		char *origin = NULL, *name = NULL;
+		if (!parse_ref(refname, &origin, &name, remote)) {
+			struct strbuf channel_ref;
+			strbuf_init(&channel_ref);
+			strbuf_attach_fmt(&channel_ref, "refs/heads/%s", name);
+
+			if (!read_watermark_get(channel_ref.buff, &watermark) && (!entry || !entry->has_unread ||
+					memcmp(entry->watermark.id, watermark.id, GIT_RAW_OBJECT_ID) != 0))
+				count_task_list_add(&list, &tip, &watermark);
+
+			strbuf_release(&channel_ref);
+		}
+
+		free(origin);
+		free(name);
+	}
+
+	if (list.len) {
+		LOG_DEBUG("counting messages of %zu channels in parallel", list.len);
+		run_processes_parallel(0, next_count_task, count_task_finished, &list);
+	}
+
+	// unread counts are recorded against the count of their tip, so put those first
+	for (size_t i = 0; i < list.len; i++) {
+		struct count_task *task = &list.tasks[i];
+		if (!task->since_watermark && task->count >= 0)
+			message_count_cache_put(&reader->counts, &task->tip, task->count, -1);
+	}
+
+	for (size_t i = 0; i < list.len; i++) {
+		struct count_task *task = &list.tasks[i];
+		if (!task->since_watermark || task->count < 0)
+			continue;
+
+		struct message_count *entry = message_count_cache_get(&reader->counts, &task->tip);
+		if (entry)
+			message_count_cache_set_unread(&reader->counts, entry, &task->watermark, task->count);
+	}
+
+	free(list.tasks);
+}
+
 /**
  * Fetch channel details and allocate `details`. `oid` must represent the tip
  * of a given channel. `refname` must be the full refname for the channel
@@ -273,8 +730,9 @@ end:
  * possible. If unable to fetch information, this function will still succeed,
  * with that data simply omitted. It's up to the caller to handle NULLs.
  * */
-static void fetch_channel_details(struct git_oid *oid, const char *refname,
-		struct channel_details **details, unsigned current, unsigned remote)
+static void fetch_channel_details(struct channel_reader *reader, struct git_oid *oid,
+		const char *refname, struct channel_details **details, unsigned current,
+		unsigned remote)
 {
 	struct channel_details *channel = (struct channel_details *)malloc(sizeof(struct channel_details));
 	if (!channel)
@@ -288,38 +746,51 @@ static void fetch_channel_details(struct git_oid *oid, const char *refname,
 
 	if (parse_ref(refname, &channel->origin, &channel->refname_short, remote))
 		LOG_WARN("failed to parse ref '%s'", refname);
-	if (calculate_channel_message_count(oid, &channel->message_count))
+
+	struct message_count *count = calculate_channel_message_count(reader, oid);
+	if (count) {
+		channel->message_count = count->count;
+
+		// remote channels are measured against the watermark of the local channel
+		if (channel->refname_short) {
+			struct strbuf channel_ref;
+			strbuf_init(&channel_ref);
+			strbuf_attach_fmt(&channel_ref, "refs/heads/%s", channel->refname_short);
+
+			channel->unread = calculate_channel_unread(reader, count, channel_ref.buff);
+			strbuf_release(&channel_ref);
+		}
+	} else {
 		LOG_WARN("failed to retrieve message count for channel with ref '%s'", refname);
-	if (parse_channel_config(oid, channel->refname_short, &channel->channel_name, &channel->channel_desc))
+	}
+
+	if (parse_channel_config(reader, oid, channel->refname_short, &channel->channel_name, &channel->channel_desc))
 		LOG_WARN("something went wrong when parsing config file for channel with ref '%s'", refname);
 
 	*details = channel;
 }
 
 /**
- * Construct a list of channel refs matching the given refname pattern.
+ * Construct a list of local and remote channel refs.
  *
  * The `channel_refs` argument is populated with the refname for each channel.
  * The `channel_refs` data fields are populated with more granular information
  * about each channel, like the channel name, description, number of messages, etc.
  *
- * `refname_pattern` represents a ref pattern acceptable by git-for-each-ref.
- * When `remote` is zero, the refname pattern "refs/heads" is expected. When
- * `remote` is non-zero, the refname pattern "refs/remotes" is expected.
+ * All refs are listed with a single git-for-each-ref, and the details of every
+ * channel are read through a shared channel_reader.
  *
- * Returns zero if successful, and non-zero if:
- * - git for-each-ref failed with non-zero exit status, or
- * - fetch_channel_details() was unable to assemble channel details
+ * Returns zero if successful, and non-zero if git for-each-ref failed with
+ * non-zero exit status.
  * */
-static int fetch_channels(struct str_array *channel_refs,
-		const char *refname_pattern, unsigned remote)
+static int fetch_channels(struct str_array *channel_refs)
 {
 	struct child_process_def show_ref_cmd;
 	child_process_def_init(&show_ref_cmd);
 	show_ref_cmd.git_cmd = 1;
 
 	argv_array_push(&show_ref_cmd.args, "for-each-ref", "--format=%(objectname) %(HEAD) %(refname)",
-			refname_pattern, NULL);
+			"refs/heads", "refs/remotes", NULL);
 
 	struct strbuf show_ref_output;
 	strbuf_init(&show_ref_output);
@@ -333,7 +804,15 @@ static int fetch_channels(struct str_array *channel_refs,
 	if (status)
 		goto fail;
 
+	struct channel_reader reader;
+	channel_reader_init(&reader);
+
 	size_t line_count = strbuf_split(&show_ref_output, "\n", &ref_out_lines);
+	if (!reader.native) {
+		request_channel_configs(&ref_out_lines);
+		prefetch_message_counts(&reader, &ref_out_lines);
+	}
+
 	for (size_t i = 0; i < line_count; i++) {
 		char *line = str_array_get(&ref_out_lines, i);
 		size_t line_len = strlen(line);
@@ -342,8 +821,6 @@ static int fetch_channels(struct str_array *channel_refs,
 		if (!line_len)
 			break;
 
-		LOG_DEBUG("processing %s ref '%s'", remote ? "remote" : "local", line);
-
 		// panic if line does not have format '<sha 1> <*> <refname>'
 		if (line_len < (GIT_HEX_OBJECT_ID + 3))
 			FATAL("unexpected output from git for-each-ref: '%s'", line);
@@ -353,14 +830,19 @@ static int fetch_channels(struct str_array *channel_refs,
 
 		unsigned is_current = line[GIT_HEX_OBJECT_ID + 1] == '*';
 		char *refname = line + GIT_HEX_OBJECT_ID + 3;
+		unsigned remote = !strncmp(refname, "refs/remotes/", strlen("refs/remotes/"));
 		struct str_array_entry *entry = str_array_insert(channel_refs, refname, 0);
 
+		LOG_DEBUG("processing %s ref '%s'", remote ? "remote" : "local", line);
+
 		// fetch information about channel
 		struct channel_details *details;
-		fetch_channel_details(&ref_oid, refname, &details, is_current, remote);
+		fetch_channel_details(&reader, &ref_oid, refname, &details, is_current, remote);
 		entry->data = details;
 	}
 
+	channel_reader_release(&reader);
+
 fail:
 	strbuf_release(&show_ref_output);
 	str_array_release(&ref_out_lines);
@@ -368,59 +850,71 @@ fail:
 	return status;
 }
 
-/**
- * Fetch all channels with the refname pattern `refs/heads`. Refer to
- * `fetch_channels` implementation for further details.
- * */
-static int fetch_local_channels(struct str_array *channel_refs)
+struct local_channel_entry {
+	struct hashmap_entry ent;
+	const struct channel_details *detail;
+};
+
+static int local_channel_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
 {
-	return fetch_channels(channel_refs, "refs/heads", 0);
+	const struct channel_details *a = ((const struct local_channel_entry *) entry)->detail;
+	const struct channel_details *b = ((const struct local_channel_entry *) entry_or_key)->detail;
+	(void) keydata;
+
+	if (memcmp(a->object_id.id, b->object_id.id, GIT_RAW_OBJECT_ID) != 0)
+		return 1;
+
+	return strcmp(a->refname_short, b->refname_short);
 }
 
-/**
- * Fetch all channels with the refname pattern `refs/remotes`. Refer to
- * `fetch_channels` implementation for further details.
- * */
-static int fetch_remote_channels(struct str_array *channel_refs)
+static unsigned int local_channel_hash(const struct channel_details *detail)
 {
-	return fetch_channels(channel_refs, "refs/remotes", 1);
+	return strhash(detail->refname_short) ^ git_oid_hash(&detail->object_id);
 }
 
 /**
  * Filter any remote channels that aren't particularly interesting. That is,
  * remote channels that shadow local ones, where both refs are identical
  * (reference same commit and have the same short refname).
+ *
+ * Local channels are first indexed by (short refname, oid), so that each
+ * remote channel is matched with a single lookup.
  * */
 static void filter_uninteresting_remote_channels(struct str_array *channels)
 {
+	struct hashmap local_channels;
+	hashmap_init(&local_channels, local_channel_entry_cmp, channels->len);
+
+	for (size_t i = 0; i < channels->len; i++) {
+		struct channel_details *detail = str_array_get_entry(channels, i)->data;
+		if (detail->remote || !detail->refname_short)
+			continue;
+
+		struct local_channel_entry *entry = malloc(sizeof(struct local_channel_entry));
+		if (!entry)
+			FATAL(MEM_ALLOC_FAILED);
+
+		hashmap_entry_init(entry, local_channel_hash(detail));
+		entry->detail = detail;
+		hashmap_add(&local_channels, entry);
+	}
+
 	for (size_t i = 0; i < channels->len;) {
 		struct str_array_entry *entry = str_array_get_entry(channels, i);
 		struct channel_details *detail = entry->data;
 
-		if (!detail->remote) {
+		if (!detail->remote || !detail->refname_short) {
 			i++;
 			continue;
 		}
 
 		// try to find a local channel with matching (short) name and oid
-		int remote_shadows_local = 0;
-		for (size_t j = 0; j < channels->len; j++) {
-			struct str_array_entry *local_entry = str_array_get_entry(channels, j);
-			struct channel_details *local_detail = local_entry->data;
-
-			if (local_detail->remote)
-				continue;
-
-			if (memcmp(local_detail->object_id.id, detail->object_id.id, GIT_RAW_OBJECT_ID) != 0)
-				continue;
-			if (strcmp(local_detail->refname_short, detail->refname_short) != 0)
-				continue;
-
-			remote_shadows_local = 1;
-			break;
-		}
+		struct local_channel_entry key;
+		hashmap_entry_init(&key, local_channel_hash(detail));
+		key.detail = detail;
 
-		if (remote_shadows_local) {
+		if (hashmap_get(&local_channels, &key, NULL)) {
 			LOG_DEBUG("remote ref '%s' shadows local copy, so skipping it from the channel listing",
 					detail->refname_full);
 
@@ -432,14 +926,31 @@ static void filter_uninteresting_remote_channels(struct str_array *channels)
 			i++;
 		}
 	}
+
+	hashmap_release(&local_channels, 1);
 }
 
 struct table_dimensions {
 	int refname;
 	int message_count;
+	int unread;
 	int channel_name;
 };
 
+/**
+ * Number of characters needed to print a non-negative integer.
+ * */
+static int count_width(int count)
+{
+	int width = 1;
+	while (count >= 10) {
+		count /= 10;
+		width++;
+	}
+
+	return width;
+}
+
 /**
  * Calculate the width (in characters) for each column. Needed when displaying
  * channels in a tablulated format.
@@ -449,6 +960,7 @@ static void calculate_table_dimensions(struct str_array *channels,
 {
 	dims->refname = 0;
 	dims->message_count = 0;
+	dims->unread = 0;
 	dims->channel_name = 0;
 
 	for (size_t i = 0; i < channels->len; i++) {
@@ -461,13 +973,16 @@ static void calculate_table_dimensions(struct str_array *channels,
 				dims->refname = refname_len;
 		}
 
-		if (detail->message_count > 0) {
-			int count_len = (int) floor(log10(detail->message_count));
+		if (detail->message_count >= 0) {
+			int count_len = count_width(detail->message_count);
 			if (count_len > dims->message_count)
 				dims->message_count = count_len;
-		} else if (!detail->message_count) {
-			if (dims->message_count < 1)
-				dims->message_count = 1;
+		}
+
+		if (detail->unread > 0) {
+			int unread_len = count_width(detail->unread);
+			if (unread_len > dims->unread)
+				dims->unread = unread_len;
 		}
 
 		if (detail->channel_name) {
@@ -526,7 +1041,15 @@ static void print_channels(struct str_array *channels, struct table_dimensions *
 		if (detail->message_count >= 0)
 			printf(" [%*d] ", dims->message_count, detail->message_count);
 		else
-			printf(" [%*s]", dims->message_count, "");
+			printf(" [%*s] ", dims->message_count, "");
+
+		// print unread message count, if any channel has unread messages
+		if (dims->unread) {
+			if (detail->unread > 0)
+				printf("(%*d new) ", dims->unread, detail->unread);
+			else
+				printf("%*s", dims->unread + 7, "");
+		}
 
 		// print channel name, truncated to 20 characters
 		if (detail->channel_name) {
@@ -584,12 +1107,9 @@ int channel_list(int argc, char *argv[])
 	struct str_array channel_refs;
 	str_array_init(&channel_refs);
 
-	int status = fetch_local_channels(&channel_refs);
-	if (status)
-		FATAL("something went wrong when fetching local channels");
-	status = fetch_remote_channels(&channel_refs);
+	int status = fetch_channels(&channel_refs);
 	if (status)
-		FATAL("something went wrong when fetching remote channels");
+		FATAL("something went wrong when fetching channels");
 
 	// filter duplicate remote channels (remote channels that are up to date with local)
 	if (!show_all)
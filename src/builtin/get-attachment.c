@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "cache/epoch-key-cache.h"
+#include "git/attachment.h"
+#include "gnupg/decryption.h"
+#include "gnupg/gpg-common.h"
+#include "gnupg/group-key.h"
+#include "run-command.h"
+#include "working-tree.h"
+#include "parse-options.h"
+#include "utils.h"
+
+static const struct usage_string get_attachment_cmd_usage[] = {
+		USAGE("git chat get-attachment [(-o | --output) <file>] <commit hash> <attachment>"),
+		USAGE("git chat get-attachment (-h | --help)"),
+		USAGE_END()
+};
+
+struct attachment_output {
+	int fd;
+	size_t bytes;
+};
+
+static ssize_t write_attachment_cb(void *data, const void *buffer, size_t len)
+{
+	struct attachment_output *output = (struct attachment_output *) data;
+
+	ssize_t bytes_written = xwrite(output->fd, buffer, len);
+	if (bytes_written > 0)
+		output->bytes += bytes_written;
+
+	return bytes_written;
+}
+
+/**
+ * Read the full object id and the message body of the commit `rev`.
+ *
+ * Returns zero if successful, and non-zero if `rev` does not name a commit.
+ * */
+static int read_message_commit(const char *rev, struct strbuf *commit_id,
+		struct strbuf *body)
+{
+	struct child_process_def cmd;
+	struct strbuf output;
+
+	strbuf_init(&output);
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "show", "-s", "--no-color", "--format=%H%n%B", rev, "--", NULL);
+	child_process_def_stderr(&cmd, STDERR_NULL);
+
+	int ret = capture_command(&cmd, &output);
+	child_process_def_release(&cmd);
+
+	const char *lf = memchr(output.buff, '\n', output.len);
+	if (!ret && lf && lf - output.buff == GIT_HEX_OBJECT_ID) {
+		strbuf_attach(commit_id, output.buff, GIT_HEX_OBJECT_ID);
+		strbuf_attach(body, lf + 1, output.len - GIT_HEX_OBJECT_ID - 1);
+	} else {
+		ret = 1;
+	}
+
+	strbuf_release(&output);
+
+	return ret;
+}
+
+/**
+ * Find the attachment named by `selector` in the manifest, either by its index
+ * or by its name.
+ *
+ * Returns the index of the attachment, or -1 if there is no such attachment.
+ * */
+static ssize_t find_attachment(const struct attachment_manifest *manifest,
+		const char *selector)
+{
+	char *end = NULL;
+
+	if (isdigit((unsigned char) *selector)) {
+		unsigned long index = strtoul(selector, &end, 10);
+		if (!*end && index < manifest->len)
+			return (ssize_t) index;
+	}
+
+	for (size_t i = 0; i < manifest->len; i++) {
+		if (!strcmp(manifest->entries[i].name.buff, selector))
+			return (ssize_t) i;
+	}
+
+	return -1;
+}
+
+/**
+ * Decrypt an attachment of the message `rev` into the file `output_path` (or
+ * standard output, if `-`), reading the chunks of the attachment one at a time
+ * and writing the plaintext as gpg produces it.
+ *
+ * If `output_path` is NULL, the attachment is written to a new file with the
+ * name of the attachment in the current working directory.
+ * */
+static int get_attachment(const char *rev, const char *selector, const char *output_path)
+{
+	struct gc_gpgme_ctx ctx;
+	struct epoch_key_cache epoch_keys;
+	struct attachment_manifest manifest;
+	struct attachment_reader reader;
+	struct strbuf commit_id, body;
+	char epoch_id[GROUP_KEY_EPOCH_ID_LEN + 1];
+	const char *epoch_key = NULL;
+
+	strbuf_init(&commit_id);
+	strbuf_init(&body);
+	if (read_message_commit(rev, &commit_id, &body))
+		DIE("'%s' does not name a message", rev);
+
+	attachment_manifest_init(&manifest);
+	if (attachment_manifest_parse(&manifest, body.buff, body.len))
+		DIE("message %s has a malformed attachment manifest", commit_id.buff);
+	if (!manifest.len)
+		DIE("message %s has no attachments", commit_id.buff);
+
+	ssize_t index = find_attachment(&manifest, selector);
+	if (index < 0)
+		DIE("message %s has no attachment '%s'", commit_id.buff, selector);
+
+	const struct attachment *attachment = &manifest.entries[index];
+	if (attachment_reader_open(&reader, commit_id.buff, index, attachment->chunks))
+		DIE("the chunks of attachment '%s' are missing from message %s",
+				attachment->name.buff, commit_id.buff);
+
+	gpgme_context_init(&ctx, 0);
+	epoch_key_cache_init(&epoch_keys);
+
+	// attachments of group key messages are encrypted with the epoch key
+	int group_key = !group_key_message_epoch(body.buff, body.len, epoch_id);
+	if (group_key) {
+		struct git_oid oid;
+		git_str_to_oid(&oid, commit_id.buff);
+
+		if (epoch_key_cache_load(&epoch_keys, &ctx))
+			LOG_WARN("epoch key cache could not be loaded and will be rebuilt");
+
+		epoch_key = epoch_key_cache_resolve(&epoch_keys, &ctx, epoch_id, &oid);
+		if (!epoch_key)
+			DIE("unable to obtain the key of epoch %s; attachment cannot be decrypted", epoch_id);
+	}
+
+	const char *path = output_path ? output_path : attachment->name.buff;
+	int to_stdout = !strcmp(path, "-");
+	struct attachment_output output = { STDOUT_FILENO, 0 };
+	if (!to_stdout) {
+		// never overwrite an existing file with the attachment name
+		int flags = O_WRONLY | O_CREAT | (output_path ? O_TRUNC : O_EXCL);
+		output.fd = open(path, flags, S_IRUSR | S_IWUSR);
+		if (output.fd < 0)
+			DIE(FILE_OPEN_FAILED, path);
+	}
+
+	int ret;
+	if (group_key)
+		ret = decrypt_symmetric_reader_stream(&ctx, attachment_reader_read, &reader,
+				epoch_key, write_attachment_cb, &output);
+	else
+		ret = decrypt_asymmetric_reader_stream(&ctx, attachment_reader_read, &reader,
+				write_attachment_cb, &output);
+
+	if (!to_stdout)
+		close(output.fd);
+
+	if (ret) {
+		// don't leave a truncated or unverified attachment behind
+		if (!to_stdout)
+			unlink(path);
+
+		DIE("attachment '%s' could not be decrypted", attachment->name.buff);
+	}
+
+	if (output.bytes != attachment->size)
+		WARN("attachment '%s' is %zu bytes, but the manifest claims %zu bytes",
+				attachment->name.buff, output.bytes, attachment->size);
+
+	if (!to_stdout)
+		INFO("wrote attachment '%s' to '%s'", attachment->name.buff, path);
+
+	if (group_key && epoch_key_cache_write(&epoch_keys, &ctx))
+		LOG_WARN("unable to update epoch key cache");
+
+	epoch_key_cache_release(&epoch_keys);
+	gpgme_context_release(&ctx);
+	attachment_reader_release(&reader);
+	attachment_manifest_release(&manifest);
+	strbuf_release(&body);
+	strbuf_release(&commit_id);
+
+	return 0;
+}
+
+int cmd_get_attachment(int argc, char *argv[])
+{
+	char *output = NULL;
+	int show_help = 0;
+
+	const struct command_option options[] = {
+			OPT_STRING('o', "output", "file", "write the attachment to the given file, or - for standard output", &output),
+			OPT_BOOL('h', "help", "show usage and exit", &show_help),
+			OPT_END()
+	};
+
+	argc = parse_options(argc, argv, options, 1, 1);
+	if (show_help) {
+		show_usage_with_options(get_attachment_cmd_usage, options, 0, NULL);
+		return 0;
+	}
+
+	if (argc != 2) {
+		show_usage_with_options(get_attachment_cmd_usage, options, 1,
+				"error: a commit hash and an attachment must be given.");
+		return 1;
+	}
+
+	if (!is_inside_git_chat_space())
+		DIE("Where are you? It doesn't look like you're in the right directory.");
+
+	return get_attachment(argv[0], argv[1], output);
+}
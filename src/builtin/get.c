@@ -1,15 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "parse-options.h"
+#include "run-command.h"
+#include "str-array.h"
+#include "strbuf.h"
+#include "working-tree.h"
+#include "utils.h"
 
 static const struct usage_string get_cmd_usage[] = {
-		USAGE("git chat get"),
+		USAGE("git chat get [(-j | --jobs) <n>] [<remote>...]"),
+		USAGE("git chat get (-h | --help)"),
 		USAGE_END()
 };
 
-int cmd_get(int argc, char *argv[])
+struct fetch_state {
+	struct str_array *remotes;
+	size_t next;
+	int failed;
+};
+
+/**
+ * Populate `remotes` with the name of every remote of the repository.
+ *
+ * Returns zero if successful, and non-zero if git remote failed.
+ * */
+static int list_remotes(struct str_array *remotes)
 {
-	(void) argc;
-	(void) argv;
+	struct child_process_def cmd;
+	struct strbuf output;
+	struct str_array lines;
+
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "remote", NULL);
+
+	strbuf_init(&output);
+	str_array_init(&lines);
+
+	int status = capture_command(&cmd, &output);
+	if (!status) {
+		strbuf_split(&output, "\n", &lines);
+		for (size_t i = 0; i < lines.len; i++) {
+			char *remote = str_array_get(&lines, i);
+			if (*remote)
+				str_array_push(remotes, remote, NULL);
+		}
+	}
+
+	str_array_release(&lines);
+	strbuf_release(&output);
+	child_process_def_release(&cmd);
+
+	return status;
+}
+
+static int next_fetch(struct child_process_def *cmd, void *data, void **task_data)
+{
+	struct fetch_state *state = (struct fetch_state *) data;
+	if (state->next >= state->remotes->len)
+		return 0;
+
+	char *remote = str_array_get(state->remotes, state->next++);
+
+	// fetches running at the same time would clobber each other's FETCH_HEAD
+	cmd->git_cmd = 1;
+	argv_array_push(&cmd->args, "fetch", "--no-write-fetch-head", remote, NULL);
+	*task_data = remote;
+
+	return 1;
+}
+
+static int fetch_finished(int status, struct strbuf *out, struct strbuf *err,
+		void *data, void *task_data)
+{
+	struct fetch_state *state = (struct fetch_state *) data;
+	const char *remote = (const char *) task_data;
+
+	// output is shown once a fetch completes, so fetches don't interleave
+	fputs(out->buff, stdout);
+	fputs(err->buff, stderr);
+
+	if (status) {
+		WARN("unable to get messages from remote '%s'", remote);
+		state->failed = 1;
+	}
 
-	show_usage(get_cmd_usage, 0, NULL);
 	return 0;
 }
+
+/**
+ * Fetch messages from each of the `remotes`, running up to `jobs` fetches at
+ * once.
+ * */
+static int get_messages(struct str_array *remotes, int jobs)
+{
+	struct fetch_state state = { remotes, 0, 0 };
+
+	LOG_DEBUG("getting messages from %zu remotes", remotes->len);
+	run_processes_parallel(jobs, next_fetch, fetch_finished, &state);
+
+	return state.failed;
+}
+
+int cmd_get(int argc, char *argv[])
+{
+	int jobs = 0;
+	int show_help = 0;
+
+	const struct command_option options[] = {
+			OPT_INT('j', "jobs", "number of remotes to get messages from at once", &jobs),
+			OPT_BOOL('h', "help", "show usage and exit", &show_help),
+			OPT_END()
+	};
+
+	argc = parse_options(argc, argv, options, 1, 1);
+	if (show_help) {
+		show_usage_with_options(get_cmd_usage, options, 0, NULL);
+		return 0;
+	}
+
+	if (jobs < 0) {
+		show_usage_with_options(get_cmd_usage, options, 1,
+				"error: the number of jobs must not be negative.");
+		return 1;
+	}
+
+	if (!is_inside_git_chat_space())
+		DIE("Where are you? It doesn't look like you're in the right directory.");
+
+	struct str_array remotes;
+	str_array_init(&remotes);
+
+	if (argc) {
+		for (int i = 0; i < argc; i++)
+			str_array_push(&remotes, argv[i], NULL);
+	} else if (list_remotes(&remotes)) {
+		DIE("unable to list the remotes of the repository");
+	}
+
+	if (!remotes.len)
+		DIE("there are no remotes to get messages from");
+
+	int ret = get_messages(&remotes, jobs);
+	str_array_release(&remotes);
+
+	return ret;
+}
@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <regex.h>
+
+#include "cache/epoch-key-cache.h"
+#include "cache/message-cache.h"
+#include "cache/session-key-cache.h"
+#include "git/graph-traversal.h"
+#include "gnupg/gpg-common.h"
+#include "gnupg/decryption-pool.h"
+#include "working-tree.h"
+#include "parse-options.h"
+#include "paging.h"
+#include "utils.h"
+
+static const struct usage_string grep_cmd_usage[] = {
+		USAGE("git chat grep [-i] [(-m | --max-count) <n>] [(-j | --jobs) <n>] [--no-color] [--no-cache] [-A <n>] [-B <n>] [-C <n>] <pattern>"),
+		USAGE("git chat grep [-i] [(-m | --max-count) <n>] [(-j | --jobs) <n>] [--no-cache] (-c | --count | -l | --list) <pattern>"),
+		USAGE("git chat grep (-h | --help)"),
+		USAGE_END()
+};
+
+enum grep_output {
+	GREP_SHOW_MESSAGES,
+	GREP_COUNT,
+	GREP_LIST
+};
+
+struct grep_options {
+	const char *pattern;
+	unsigned ignore_case: 1;
+	enum grep_output output;
+	int max_hits;
+	int before;
+	int after;
+	int no_color;
+	int use_cache;
+	int jobs;
+};
+
+/**
+ * A message held back as potential context for a later match.
+ * */
+struct context_message {
+	struct git_commit commit;
+	struct strbuf message;
+	enum message_type type;
+	size_t seq;
+};
+
+struct grep_context {
+	const struct grep_options *opts;
+	regex_t pattern;
+	struct decryption_pool *pool;
+	struct message_cache *cache;
+
+	size_t seq;
+	size_t hits;
+	size_t last_shown;
+	unsigned shown_any: 1;
+	int after_remaining;
+
+	// ring buffer of the last `opts->before` messages not shown
+	struct context_message *before;
+	size_t before_len;
+	size_t before_next;
+};
+
+/**
+ * Get the text of a message, for matching and display: the plaintext of
+ * decrypted messages, or the commit body of plaintext messages.
+ * */
+static const struct strbuf *message_text(const struct git_commit *commit,
+		const struct strbuf *message, enum message_type type)
+{
+	if (type == DECRYPTED)
+		return message;
+	if (type == PLAINTEXT)
+		return &commit->body;
+
+	return NULL;
+}
+
+/**
+ * Decryption pool matcher, run on the worker threads.
+ *
+ * Returns non-zero if the message matches the pattern.
+ * */
+static int match_message(const struct git_commit *commit, const struct strbuf *message,
+		enum message_type type, void *data)
+{
+	struct grep_context *ctx = (struct grep_context *) data;
+
+	const struct strbuf *text = message_text(commit, message, type);
+	if (!text)
+		return 0;
+
+	return !regexec(&ctx->pattern, text->buff, 0, NULL, 0);
+}
+
+static void show_message(struct grep_context *ctx, struct git_commit *commit,
+		struct strbuf *message, enum message_type type, size_t seq)
+{
+	// separate groups of messages that aren't adjacent in history
+	if (ctx->shown_any && seq != ctx->last_shown + 1 &&
+			(ctx->opts->before || ctx->opts->after)) {
+		printf("--\n");
+		fflush(stdout);
+	}
+
+	struct strbuf *text = (struct strbuf *) message_text(commit, message, type);
+	pretty_print_message(commit, text, type, ctx->opts->no_color, STDOUT_FILENO);
+	fflush(stdout);
+
+	ctx->last_shown = seq;
+	ctx->shown_any = 1;
+}
+
+/**
+ * Show the messages held back as context before a match, oldest first.
+ * */
+static void show_before_context(struct grep_context *ctx)
+{
+	size_t capacity = (size_t) ctx->opts->before;
+	size_t first = (ctx->before_next + capacity - ctx->before_len) % capacity;
+
+	for (size_t i = 0; i < ctx->before_len; i++) {
+		struct context_message *held = &ctx->before[(first + i) % capacity];
+		if (!ctx->shown_any || held->seq > ctx->last_shown)
+			show_message(ctx, &held->commit, &held->message, held->type, held->seq);
+	}
+
+	ctx->before_len = 0;
+}
+
+static void hold_before_context(struct grep_context *ctx, struct git_commit *commit,
+		const struct strbuf *message, enum message_type type)
+{
+	size_t capacity = (size_t) ctx->opts->before;
+	struct context_message *held = &ctx->before[ctx->before_next];
+
+	git_commit_object_copy(&held->commit, commit);
+	memset(held->message.buff, 0, held->message.alloc);
+	strbuf_clear(&held->message);
+	if (type == DECRYPTED)
+		strbuf_attach(&held->message, message->buff, message->len);
+	held->type = type;
+	held->seq = ctx->seq;
+
+	ctx->before_next = (ctx->before_next + 1) % capacity;
+	if (ctx->before_len < capacity)
+		ctx->before_len++;
+}
+
+/**
+ * Decryption pool callback, invoked for each message in traversal order. Hits
+ * are written out as soon as they are emitted.
+ *
+ * Returns non-zero once the maximum number of hits was reached (and any
+ * trailing context was shown), which stops the traversal.
+ * */
+static int grep_message_cb(struct git_commit *commit, struct strbuf *message,
+		enum message_type type, void *data)
+{
+	struct grep_context *ctx = (struct grep_context *) data;
+	const struct grep_options *opts = ctx->opts;
+	size_t max_hits = opts->max_hits > 0 ? (size_t) opts->max_hits : 0;
+
+	// messages served from the cache needn't be cached again
+	if (ctx->cache && type != UNKNOWN_ERROR && !decryption_pool_emitted_known(ctx->pool))
+		message_cache_put(ctx->cache, &commit->commit_id, type, message);
+
+	ctx->seq++;
+
+	// once the maximum is reached, further matches are only context
+	int match = decryption_pool_emitted_match(ctx->pool) &&
+			(!max_hits || ctx->hits < max_hits);
+
+	if (match) {
+		ctx->hits++;
+
+		if (opts->output == GREP_LIST) {
+			char hex[GIT_HEX_OBJECT_ID + 1];
+			git_oid_to_str(&commit->commit_id, hex);
+			hex[GIT_HEX_OBJECT_ID] = 0;
+			printf("%s\n", hex);
+			fflush(stdout);
+		} else if (opts->output == GREP_SHOW_MESSAGES) {
+			if (opts->before)
+				show_before_context(ctx);
+
+			show_message(ctx, commit, message, type, ctx->seq);
+			ctx->after_remaining = opts->after;
+		}
+	} else if (opts->output == GREP_SHOW_MESSAGES) {
+		if (ctx->after_remaining > 0 && type != UNKNOWN_ERROR) {
+			show_message(ctx, commit, message, type, ctx->seq);
+			ctx->after_remaining--;
+		} else if (ctx->after_remaining > 0) {
+			ctx->after_remaining--;
+		} else if (opts->before && type != UNKNOWN_ERROR) {
+			hold_before_context(ctx, commit, message, type);
+		}
+	}
+
+	return max_hits && ctx->hits >= max_hits && !ctx->after_remaining;
+}
+
+/**
+ * Commit traversal callback that hands the commit to the decryption pool,
+ * resolving it from the message cache if possible.
+ *
+ * Returns non-zero to stop the traversal once enough hits were found.
+ * */
+static int grep_traversal_cb(struct git_commit_view *commit, void *data)
+{
+	struct grep_context *ctx = (struct grep_context *) data;
+
+	if (ctx->cache) {
+		struct message_cache_entry *entry = message_cache_get(ctx->cache, &commit->commit_id);
+		if (entry)
+			return decryption_pool_add_resolved(ctx->pool, commit, entry->type,
+					&entry->message);
+	}
+
+	return decryption_pool_add(ctx->pool, commit);
+}
+
+/**
+ * Search the messages of the current channel for `opts->pattern`, from the
+ * most recent message. The history is traversed on the calling thread while
+ * messages are decrypted and matched on a decryption pool, and hits are shown
+ * in history order as soon as they are emitted by the pool.
+ *
+ * Returns zero if any message matched, and one otherwise.
+ * */
+static int grep_messages(const struct grep_options *opts)
+{
+	struct gc_gpgme_ctx gpg_ctx;
+	struct message_cache cache;
+	struct session_key_cache session_keys;
+	struct epoch_key_cache epoch_keys;
+	struct decryption_pool pool;
+	struct grep_context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.opts = opts;
+	ctx.pool = &pool;
+
+	int cflags = REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
+	if (opts->ignore_case)
+		cflags |= REG_ICASE;
+
+	int err = regcomp(&ctx.pattern, opts->pattern, cflags);
+	if (err) {
+		char errbuf[256];
+		regerror(err, &ctx.pattern, errbuf, sizeof(errbuf));
+		DIE("invalid pattern '%s': %s", opts->pattern, errbuf);
+	}
+
+	if (opts->output == GREP_SHOW_MESSAGES && opts->before > 0) {
+		ctx.before = (struct context_message *) calloc(opts->before, sizeof(struct context_message));
+		if (!ctx.before)
+			FATAL(MEM_ALLOC_FAILED);
+
+		for (int i = 0; i < opts->before; i++) {
+			git_commit_object_init(&ctx.before[i].commit);
+			strbuf_init(&ctx.before[i].message);
+		}
+	}
+
+	gpgme_context_init(&gpg_ctx, 0);
+	message_cache_init(&cache);
+	session_key_cache_init(&session_keys);
+	epoch_key_cache_init(&epoch_keys);
+	if (opts->use_cache) {
+		if (message_cache_load(&cache, &gpg_ctx))
+			LOG_WARN("message cache could not be loaded and will be rebuilt");
+		if (session_key_cache_load(&session_keys, &gpg_ctx))
+			LOG_WARN("session key cache could not be loaded and will be rebuilt");
+		if (epoch_key_cache_load(&epoch_keys, &gpg_ctx))
+			LOG_WARN("epoch key cache could not be loaded and will be rebuilt");
+
+		ctx.cache = &cache;
+	}
+
+	if (opts->output == GREP_SHOW_MESSAGES)
+		pager_start(GIT_CHAT_PAGER_RAW_CTRL_CHR | GIT_CHAT_PAGER_CLR_SCRN);
+
+	decryption_pool_init(&pool, opts->jobs, grep_message_cb, &ctx);
+	decryption_pool_use_matcher(&pool, match_message, &ctx);
+	if (opts->use_cache)
+		decryption_pool_use_session_keys(&pool, &session_keys);
+	decryption_pool_use_epoch_keys(&pool, &epoch_keys, &gpg_ctx);
+
+	// a positive return means the callback stopped the traversal early
+	if (traverse_commit_graph_views(NULL, -1, grep_traversal_cb, &ctx) < 0)
+		FATAL("commit graph traversal failed");
+
+	decryption_pool_finish(&pool);
+
+	if (opts->output == GREP_COUNT) {
+		printf("%zu\n", ctx.hits);
+		fflush(stdout);
+	}
+
+	if (opts->use_cache && message_cache_write(&cache, &gpg_ctx))
+		LOG_WARN("unable to update message cache");
+	if (opts->use_cache && session_key_cache_write(&session_keys, &gpg_ctx))
+		LOG_WARN("unable to update session key cache");
+	if (opts->use_cache && epoch_key_cache_write(&epoch_keys, &gpg_ctx))
+		LOG_WARN("unable to update epoch key cache");
+
+	for (int i = 0; ctx.before && i < opts->before; i++) {
+		git_commit_object_release(&ctx.before[i].commit);
+		memset(ctx.before[i].message.buff, 0, ctx.before[i].message.alloc);
+		strbuf_release(&ctx.before[i].message);
+	}
+
+	free(ctx.before);
+	epoch_key_cache_release(&epoch_keys);
+	session_key_cache_release(&session_keys);
+	message_cache_release(&cache);
+	gpgme_context_release(&gpg_ctx);
+	regfree(&ctx.pattern);
+
+	return ctx.hits ? 0 : 1;
+}
+
+int cmd_grep(int argc, char *argv[])
+{
+	int ignore_case = 0;
+	int count = 0;
+	int list = 0;
+	int max_hits = -1;
+	int after = -1;
+	int before = -1;
+	int context = -1;
+	int no_color = 0;
+	int no_cache = 0;
+	int jobs = -1;
+	int show_help = 0;
+
+	const struct command_option options[] = {
+			OPT_BOOL('i', "ignore-case", "ignore case distinctions in the pattern", &ignore_case),
+			OPT_BOOL('c', "count", "only show the number of matching messages", &count),
+			OPT_BOOL('l', "list", "only show the commit ids of matching messages", &list),
+			OPT_INT('m', "max-count", "stop after the given number of matching messages", &max_hits),
+			OPT_INT('A', "after-context", "show the given number of messages after each match", &after),
+			OPT_INT('B', "before-context", "show the given number of messages before each match", &before),
+			OPT_INT('C', "context", "show the given number of messages around each match", &context),
+			OPT_INT('j', "jobs", "number of messages to decrypt in parallel", &jobs),
+			OPT_LONG_BOOL("no-color", "turn off colored message headers", &no_color),
+			OPT_LONG_BOOL("no-cache", "bypass the decrypted message and session key caches", &no_cache),
+			OPT_BOOL('h', "help", "show usage and exit", &show_help),
+			OPT_END()
+	};
+
+	argc = parse_options(argc, argv, options, 1, 1);
+	if (show_help) {
+		show_usage_with_options(grep_cmd_usage, options, 0, NULL);
+		return 0;
+	}
+
+	if (argc != 1) {
+		show_usage_with_options(grep_cmd_usage, options, 1,
+				!argc ? "error: no pattern given." : "error: only one pattern may be given.");
+		return 1;
+	}
+
+	if (count && list) {
+		show_usage_with_options(grep_cmd_usage, options, 1,
+				"error: --count and --list are mutually exclusive.");
+		return 1;
+	}
+
+	if (max_hits == 0) {
+		show_usage_with_options(grep_cmd_usage, options, 1,
+				"error: --max-count must be positive.");
+		return 1;
+	}
+
+	if (context >= 0) {
+		if (after < 0)
+			after = context;
+		if (before < 0)
+			before = context;
+	}
+
+	if (!is_inside_git_chat_space())
+		DIE("Where are you? It doesn't look like you're in the right directory.");
+
+	if (!isatty(STDOUT_FILENO))
+		no_color = 1;
+
+	struct grep_options opts = {
+			.pattern = argv[0],
+			.ignore_case = ignore_case,
+			.output = count ? GREP_COUNT : list ? GREP_LIST : GREP_SHOW_MESSAGES,
+			.max_hits = max_hits,
+			.before = before > 0 ? before : 0,
+			.after = after > 0 ? after : 0,
+			.no_color = no_color,
+			.use_cache = !no_cache,
+			.jobs = decryption_pool_resolve_jobs(jobs)
+	};
+
+	return grep_messages(&opts);
+}
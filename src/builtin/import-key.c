@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <fcntl.h>
 
 #include "parse-options.h"
@@ -93,14 +94,9 @@ static int import_keys_from_files(struct str_array *key_paths,
 	str_array_init(&key_fprs);
 
 	// import the keys into into the git-chat keyring
-	for (size_t f_index = 0; f_index < key_paths->len; f_index++) {
-		char *file_path = str_array_get(key_paths, f_index);
-
-		// import key from file into git-chat keyring
-		int key_count = import_gpg_key(&gc_ctx, file_path, &key_fprs);
-		if (!key_count)
-			WARN("unable to import key from file '%s'", file_path);
-	}
+	int key_count = import_gpg_key_files(&gc_ctx, key_paths, &key_fprs, NULL);
+	if (!key_count)
+		WARN("unable to import keys from the given files");
 
 	// list and filter unusable keys
 	fetch_gpg_keys(&gc_ctx, &gpg_keys);
@@ -155,19 +151,28 @@ static int import_keys_from_keyring(char *fingerprints[], int len,
 	filter_gpg_keys_by_predicate(&gpg_keys, gpg_keylist_filter_predicate,
 			(void *) &key_fprs);
 
-	// import keys into git-chat keyring
-	struct gpg_key_list_node *key = gpg_keys.head;
-	while (key) {
-		gpgme_data_t key_data;
+	size_t keys_len = 0;
+	for (struct gpg_key_list_node *key = gpg_keys.head; key; key = key->next)
+		keys_len++;
+
+	if (keys_len) {
+		gpgme_key_t *keys = calloc(keys_len + 1, sizeof(gpgme_key_t));
+		if (!keys)
+			FATAL(MEM_ALLOC_FAILED);
 
+		size_t index = 0;
+		for (struct gpg_key_list_node *key = gpg_keys.head; key; key = key->next)
+			keys[index++] = key->key;
+
+		// export all keys at once, and import them into git-chat keyring
+		gpgme_data_t key_data;
 		gpgme_error_t ret = gpgme_data_new(&key_data);
 		if (ret)
 			GPG_FATAL("failed to allocate new gpg data buffer", ret);
 
-		ret = gpgme_op_export_keys(ctx.gpgme_ctx,
-				(gpgme_key_t[]) { key->key, NULL }, 0, key_data);
+		ret = gpgme_op_export_keys(ctx.gpgme_ctx, keys, 0, key_data);
 		if (ret)
-			GPG_FATAL("unable to export key from external keyring", ret);
+			GPG_FATAL("unable to export keys from external keyring", ret);
 
 		ret = gpgme_data_seek(key_data, 0, SEEK_SET);
 		if (ret)
@@ -175,13 +180,13 @@ static int import_keys_from_keyring(char *fingerprints[], int len,
 
 		ret = gpgme_op_import(gc_ctx.gpgme_ctx, key_data);
 		if (ret)
-			GPG_FATAL("failed to import public key into git chat keyring", ret);
+			GPG_FATAL("failed to import public keys into git chat keyring", ret);
 
 		gpgme_data_release(key_data);
+		free(keys);
 
-		str_array_push(imported_key_fprs, key->key->fpr, NULL);
-
-		key = key->next;
+		for (struct gpg_key_list_node *key = gpg_keys.head; key; key = key->next)
+			str_array_push(imported_key_fprs, key->key->fpr, NULL);
 	}
 
 	str_array_release(&key_fprs);
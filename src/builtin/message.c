@@ -1,15 +1,24 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 #include "str-array.h"
 #include "run-command.h"
+#include "cache/epoch-key-cache.h"
+#include "cache/key-listing.h"
+#include "cache/session-key-cache.h"
+#include "config/parse-config.h"
+#include "git/attachment.h"
 #include "git/graph-traversal.h"
+#include "git/git.h"
+#include "git/index.h"
 #include "gnupg/gpg-common.h"
+#include "gnupg/group-key.h"
 #include "gnupg/key-trust.h"
 #include "gnupg/encryption.h"
-#include "gnupg/decryption.h"
+#include "gnupg/decryption-pool.h"
 #include "gnupg/key-filter.h"
 #include "gnupg/key-manager.h"
 #include "working-tree.h"
@@ -20,16 +29,16 @@
 #define BUFF_LEN 1024
 
 static const struct usage_string message_cmd_usage[] = {
-		USAGE("git chat message [(--recipient <alias>)...] [(--reply | --compose <n>)]"),
-		USAGE("git chat message [(--recipient <alias>)...] (-m | --message) <message>"),
-		USAGE("git chat message [(--recipient <alias>)...] (-f | --file) <filename>"),
+		USAGE("git chat message [(--recipient <alias>)...] [(--attach <file>)...] [(--reply | --compose <n>)] [(-j | --jobs) <n>]"),
+		USAGE("git chat message [(--recipient <alias>)...] [(--attach <file>)...] (-m | --message) <message>"),
+		USAGE("git chat message [(--recipient <alias>)...] [(--attach <file>)...] (-f | --file) <filename>"),
 		USAGE("git chat message (-h | --help)"),
 		USAGE_END()
 };
 
 struct graph_traversal_context {
 	int message_fd;
-	struct gc_gpgme_ctx *gpg_ctx;
+	struct decryption_pool *pool;
 };
 
 /**
@@ -85,48 +94,53 @@ static void create_truncate_file(const char *file)
 }
 
 /**
- * Callback function invoked by the `graph-traversal` API. Attempts to decrypt
- * messages from the given `commit` and write a pretty-printed result to
- * a file descriptor supplied through `data`.
+ * Callback function invoked by the decryption pool. Writes a pretty-printed
+ * message for the given `commit` to a file descriptor supplied through `data`.
  *
  * The void pointer is assumed to be a pointer to a `graph_traversal_context`
  * structure.
  *
  * Returns zero to indicate success.
  * */
-static int commit_traversal_cb(struct git_commit *commit, void *data)
+static int write_message_cb(struct git_commit *commit, struct strbuf *message,
+		enum message_type type, void *data)
 {
 	struct graph_traversal_context *ctx = (struct graph_traversal_context *) data;
-	struct gc_gpgme_ctx *gpg_ctx = ctx->gpg_ctx;
 	int fd = ctx->message_fd;
 
-	struct strbuf decrypted_text;
-	strbuf_init(&decrypted_text);
-
-	int ret = decrypt_asymmetric_message(gpg_ctx, &commit->body, &decrypted_text);
-	if (!ret) {
-		// decryption successful
-		pretty_print_message(commit, &decrypted_text, DECRYPTED, 1, fd);
-	} else if (ret > 0) {
+	if (type == DECRYPTED) {
+		pretty_print_message(commit, message, DECRYPTED, 1, fd);
+	} else if (type == PLAINTEXT) {
 		// commit body is not gpg message; print commit message body
 		pretty_print_message(commit, &commit->body, PLAINTEXT, 1, fd);
 	} else {
-		strbuf_clear(&decrypted_text);
-		strbuf_attach_str(&decrypted_text, "message could not be decrypted.");
-		pretty_print_message(commit, &decrypted_text, UNKNOWN_ERROR, 1, fd);
+		strbuf_clear(message);
+		strbuf_attach_str(message, "message could not be decrypted.");
+		pretty_print_message(commit, message, UNKNOWN_ERROR, 1, fd);
 	}
 
-	strbuf_release(&decrypted_text);
-
 	return 0;
 }
 
+/**
+ * Callback function invoked by the `graph-traversal` API. Submits the `commit`
+ * to the decryption pool supplied through `data`.
+ *
+ * Returns zero to indicate success.
+ * */
+static int commit_traversal_cb(struct git_commit_view *commit, void *data)
+{
+	struct graph_traversal_context *ctx = (struct graph_traversal_context *) data;
+	return decryption_pool_add(ctx->pool, commit);
+}
+
 /**
  * Prompt the user with a vim editor to compose their message. Upon editing,
  * the message is attached to the given strbuf `buff`.
  *
  * When `compose` is non-zero, that number of messages on the current channel
- * will be decrypted and shown in the editor.
+ * will be decrypted (using a pool of `jobs` workers, or the number configured
+ * through decryption_pool_resolve_jobs() if negative) and shown in the editor.
  *
  * When vim is started, the editor will open `.git/GC_EDITMSG` with rw permission
  * for the current user only. The file is first truncated to zero bytes, then
@@ -136,7 +150,7 @@ static int commit_traversal_cb(struct git_commit *commit, void *data)
  * Decrypted messages are written to `.git/GC_REPLY_LAST` with rw permission for
  * the current user only. Once vim exits, this file is truncated.
  * */
-static void compose_message(struct strbuf *buff, int compose)
+static void compose_message(struct strbuf *buff, int compose, int jobs)
 {
 	struct strbuf cwd, compose_file;
 
@@ -155,8 +169,7 @@ static void compose_message(struct strbuf *buff, int compose)
 
 	int ret;
 	if (compose) {
-		struct gc_gpgme_ctx gpg_ctx;
-		gpgme_context_init(&gpg_ctx, 0);
+		struct decryption_pool pool;
 
 		struct strbuf reply_messages_file;
 		strbuf_init(&reply_messages_file);
@@ -168,19 +181,45 @@ static void compose_message(struct strbuf *buff, int compose)
 
 		INFO("decrypting messages, this may take a few seconds");
 
-		struct graph_traversal_context cb_ctx = { .gpg_ctx = &gpg_ctx, .message_fd = fd };
-		ret = traverse_commit_graph(NULL, compose, commit_traversal_cb, &cb_ctx);
+		// session keys make decrypting recent messages cheap
+		struct gc_gpgme_ctx gpg_ctx;
+		struct session_key_cache session_keys;
+		struct epoch_key_cache epoch_keys;
+		gpgme_context_init(&gpg_ctx, 0);
+		session_key_cache_init(&session_keys);
+		if (session_key_cache_load(&session_keys, &gpg_ctx))
+			LOG_WARN("session key cache could not be loaded and will be rebuilt");
+		epoch_key_cache_init(&epoch_keys);
+		if (epoch_key_cache_load(&epoch_keys, &gpg_ctx))
+			LOG_WARN("epoch key cache could not be loaded and will be rebuilt");
+
+		struct graph_traversal_context cb_ctx = { .pool = &pool, .message_fd = fd };
+		decryption_pool_init(&pool, decryption_pool_resolve_jobs(jobs),
+				write_message_cb, &cb_ctx);
+		decryption_pool_use_session_keys(&pool, &session_keys);
+		decryption_pool_use_epoch_keys(&pool, &epoch_keys, &gpg_ctx);
+
+		ret = traverse_commit_graph_views(NULL, compose, commit_traversal_cb, &cb_ctx);
 		if (ret)
 			FATAL("commit graph traversal failed");
 
+		decryption_pool_finish(&pool);
+
+		if (session_key_cache_write(&session_keys, &gpg_ctx))
+			LOG_WARN("unable to update session key cache");
+		if (epoch_key_cache_write(&epoch_keys, &gpg_ctx))
+			LOG_WARN("unable to update epoch key cache");
+
+		epoch_key_cache_release(&epoch_keys);
+		session_key_cache_release(&session_keys);
+		gpgme_context_release(&gpg_ctx);
+
 		close(fd);
 
 		ret = launch_editor(compose_file.buff, reply_messages_file.buff);
 
 		create_truncate_file(reply_messages_file.buff);
 		strbuf_release(&reply_messages_file);
-
-		gpgme_context_release(&gpg_ctx);
 	} else {
 		ret = launch_editor(compose_file.buff, NULL);
 	}
@@ -201,77 +240,103 @@ static void compose_message(struct strbuf *buff, int compose)
 }
 
 /**
- * Read the contents of a given file into the strbuf. If file_path is "-",
- * read from stdin instead.
+ * Open the given file to read a message from. If file_path is "-", the
+ * message is read from stdin instead.
+ *
+ * Returns the file descriptor of the file.
  * */
-static void read_message_from_file(const char *file_path, struct strbuf *buff)
+static int open_message_file(const char *file_path)
 {
-	int fd = STDIN_FILENO;
-
-	int read_stdin = !strcmp(file_path, "-");
-	if (!read_stdin) {
-		fd = open(file_path, O_RDONLY);
-		if (fd < 0)
-			DIE(FILE_OPEN_FAILED, file_path);
-	} else
+	if (!strcmp(file_path, "-")) {
 		fprintf(stderr, "[INFO] Type your message below. Once complete, press ⌃D to exit.\n");
+		return STDIN_FILENO;
+	}
 
-	strbuf_attach_fd(buff, fd);
+	int fd = open(file_path, O_RDONLY);
+	if (fd < 0)
+		DIE(FILE_OPEN_FAILED, file_path);
 
-	if (!read_stdin)
-		close(fd);
+	return fd;
 }
 
 /**
- * Filter function used by encrypt_message(...) to filter any keys that are not
- * specified in a recipients str_array (given as the data argument).
+ * The plaintext of a new message, and the destination of its ciphertext.
  *
- * Keys are filtered if:
- * - no recipients match the primary key fingerprint
- * - no recipients match any subkey uid field
- * - no recipients match any subkey name field
- * - no recipients match any subkey email field
- * - no recipients match any subkey comment field
- * - no recipients match any subkey address field
+ * Messages composed in the editor or given on the command line are held in
+ * `plaintext`. Messages read from a file are instead streamed from `in_fd`
+ * through gpg, so that large messages (pasted logs, for instance) are never
+ * held in memory. Either way, the ciphertext is written to `out_fd`.
  * */
-static int filter_gpg_keylist_by_recipients(gpgme_key_t key, void *data)
+struct message_io {
+	const struct strbuf *plaintext;
+	int in_fd;
+	int out_fd;
+
+	// number of bytes of plaintext encrypted
+	size_t len;
+
+	// header lines of the commit message, such as the epoch header
+	struct strbuf header;
+
+	// paths of files to attach to the message
+	struct str_array *attachments;
+};
+
+/**
+ * Write in-memory ciphertext to the ciphertext file of the message.
+ * */
+static void write_message_ciphertext(struct message_io *io, const struct strbuf *ciphertext)
+{
+	if (xwrite(io->out_fd, ciphertext->buff, ciphertext->len) != (ssize_t) ciphertext->len)
+		FATAL("failed to write ciphertext of message");
+
+	io->len = io->plaintext->len;
+}
+
+/**
+ * Retain only the keys in the key listing that are specified in the recipients
+ * str_array.
+ *
+ * Keys are retained if a recipient matches:
+ * - the primary key fingerprint, or
+ * - any uid, name, email, comment or address field of any of its user ids.
+ *
+ * Each recipient is looked up through the key listing index, so this is linear
+ * in the number of keys and recipients.
+ *
+ * Returns the number of keys removed from the key listing.
+ * */
+static size_t filter_key_listing_by_recipients(struct key_listing *listing,
+		struct str_array *recipients)
 {
-	struct str_array *recipients = (struct str_array *)data;
+	unsigned char *retain = calloc(listing->len ? listing->len : 1, 1);
+	if (!retain)
+		FATAL(MEM_ALLOC_FAILED);
 
 	for (size_t index = 0; index < recipients->len; index++) {
 		const char *recipient = str_array_get(recipients, index);
-		if (key->fpr && !strcmp(key->fpr, recipient))
-			return 1;
-
-		struct _gpgme_user_id *uid = key->uids;
-		while (uid) {
-			if (uid->uid && !strcmp(uid->uid, recipient))
-				return 1;
-			if (uid->name && !strcmp(uid->name, recipient))
-				return 1;
-			if (uid->email && !strcmp(uid->email, recipient))
-				return 1;
-			if (uid->comment && !strcmp(uid->comment, recipient))
-				return 1;
-			if (uid->address && !strcmp(uid->address, recipient))
-				return 1;
-
-			uid = uid->next;
-		}
+
+		const struct key_listing_match *match = key_listing_lookup(listing, recipient);
+		for (; match; match = key_listing_lookup_next(listing, match))
+			retain[match->pos] = 1;
 	}
 
-	return 0;
+	size_t removed = key_listing_retain(listing, retain);
+	free(retain);
+
+	return removed;
 }
 
 /**
- * Key list filter predicate that is identical to the
- * `filter_gpg_keys_by_fingerprint` but logs a message at INFO level indicating
+ * Key filter predicate that filters keys whose fingerprint isn't in the
+ * trust list given through `data`, logging a message at INFO level indicating
  * that the key was filtered because the fingerprint didn't exist in the trusted
  * keys list.
  * */
-static int filter_gpg_keys_by_fingerprint_verbose(gpgme_key_t key, void *data)
+static int filter_keys_by_trust_list_verbose(const struct key_listing_entry *key,
+		void *data)
 {
-	if (!filter_gpg_keys_by_fingerprint(key, data)) {
+	if (!trust_list_contains(data, key->fpr)) {
 		LOG_INFO("recipient with fingerprint '%s' filtered by the trust keys list",
 				key->fpr);
 		return 0;
@@ -281,71 +346,561 @@ static int filter_gpg_keys_by_fingerprint_verbose(gpgme_key_t key, void *data)
 }
 
 /**
- * Encrypt a plaintext message from a string buffer into destination buffer, in
- * ASCII-armor format.
+ * Select the keys of the message recipients from the key listing, and read
+ * the selected keys from the keyring into `gpg_keys`.
  *
- * If recipients is an empty list, then all gpg keys are used in encrypting the
- * message. Otherwise, recipients are mapped to gpg keys using the
- * filter_gpg_keylist_by_recipients() filter function. If one or more recipients
- * do not have associated GPG keys, returns 1 and the message output buffer is left
- * unmodified.
- *
- * Returns the number of recipients selected to decrypt the message, or -1 if
- * some recipients in the given str_array do not exist (no public key in keyring).
+ * Returns the number of keys selected, or -1 if some recipients cannot be
+ * mapped to gpg keys. If the keys selected from the listing cannot be found
+ * in the keyring, returns -2.
  * */
-static int encrypt_message_asym(struct gc_gpgme_ctx *ctx, struct str_array *recipients,
-		struct strbuf *message_in, struct strbuf *ciphertext_result)
+static int select_recipient_keys(struct gc_gpgme_ctx *ctx, struct key_listing *listing,
+		struct str_array *recipients, struct gpg_key_set *gpg_keys)
 {
-	struct gpg_key_list gpg_keys;
-	int key_count = fetch_gpg_keys(ctx, &gpg_keys);
-
 	// filter unusable and secret gpg keys
-	key_count -= filter_gpg_keys_by_predicate(&gpg_keys, filter_gpg_unusable_keys, NULL);
-	key_count -= filter_gpg_keys_by_predicate(&gpg_keys, filter_gpg_secret_keys, NULL);
+	key_listing_filter(listing, key_listing_filter_unusable, NULL);
+	key_listing_filter(listing, key_listing_filter_secret, NULL);
 
 	if (recipients->len) {
 		// if explicit recipients given, filter keys that are not to be recipients
-		key_count -= filter_gpg_keys_by_predicate(&gpg_keys,
-				filter_gpg_keylist_by_recipients, recipients);
+		filter_key_listing_by_recipients(listing, recipients);
 
 		// if there is not a 1-1 mapping of recipients to gpg keys, fail
-		if ((size_t)key_count != recipients->len) {
+		if (listing->len != recipients->len) {
 			LOG_ERROR("some recipients defined cannot be mapped to GPG keys");
-
-			release_gpg_key_list(&gpg_keys);
 			return -1;
 		}
 	}
 
 	// filter by trusted keys
-	struct str_array trust_list;
-	str_array_init(&trust_list);
+	struct trust_list trust_list;
+	trust_list_init(&trust_list);
 
 	if (read_trust_list(&trust_list) >= 0)
-		key_count -= filter_gpg_keys_by_predicate(&gpg_keys,
-				filter_gpg_keys_by_fingerprint_verbose, (void *) &trust_list);
+		key_listing_filter(listing, filter_keys_by_trust_list_verbose, &trust_list);
+
+	trust_list_release(&trust_list);
+
+	// only the selected keys are listed with gpg
+	const char **fingerprints = calloc(listing->len ? listing->len : 1, sizeof(char *));
+	if (!fingerprints)
+		FATAL(MEM_ALLOC_FAILED);
+
+	for (size_t i = 0; i < listing->len; i++)
+		fingerprints[i] = listing->keys[i].fpr;
+
+	int ret = gpg_key_set_resolve(ctx, gpg_keys, fingerprints, listing->len);
+	free(fingerprints);
+
+	return ret ? -2 : (int) gpg_keys->len;
+}
 
-	str_array_release(&trust_list);
+/**
+ * Read the epoch `id` from its epoch file in the working tree.
+ *
+ * Returns zero if successful, and non-zero if the epoch file does not exist or
+ * is malformed.
+ * */
+static int read_epoch_file(struct group_epoch *epoch, const char *id)
+{
+	struct strbuf path, contents;
+	int ret = 1;
+
+	strbuf_init(&path);
+	if (get_git_chat_dir(&path))
+		FATAL("unable to obtain the path to the .git-chat directory");
+	strbuf_attach_fmt(&path, "/%s/%s", GROUP_KEY_EPOCH_DIR, id);
+
+	int fd = open(path.buff, O_RDONLY);
+	if (fd >= 0) {
+		strbuf_init(&contents);
+		strbuf_attach_fd(&contents, fd);
+		close(fd);
 
-	if (key_count)
-		asymmetric_encrypt_plaintext_message(ctx, message_in, ciphertext_result, &gpg_keys);
+		ret = group_epoch_parse(epoch, id, contents.buff, contents.len);
+		if (ret)
+			LOG_WARN("epoch file '%s' is malformed", path.buff);
 
-	release_gpg_key_list(&gpg_keys);
+		strbuf_release(&contents);
+	}
+
+	strbuf_release(&path);
+
+	return ret;
+}
+
+/**
+ * Write the epoch file of a new epoch, make it the current epoch of the
+ * channel, and add both to the index so that they are committed along with the
+ * message.
+ * */
+static void write_epoch_file(struct group_epoch *epoch, const char *channel)
+{
+	struct strbuf epochs_dir, path, config_path, contents;
+	struct str_array paths;
+	struct config_data *conf;
+
+	strbuf_init(&epochs_dir);
+	if (get_git_chat_dir(&epochs_dir))
+		FATAL("unable to obtain the path to the .git-chat directory");
+
+	strbuf_init(&config_path);
+	strbuf_attach_fmt(&config_path, "%s/config", epochs_dir.buff);
+
+	safe_create_dir(epochs_dir.buff, GROUP_KEY_EPOCH_DIR, S_IRWXU | S_IRGRP | S_IROTH);
+	strbuf_attach_fmt(&epochs_dir, "/%s", GROUP_KEY_EPOCH_DIR);
+
+	strbuf_init(&path);
+	strbuf_attach_fmt(&path, "%s/%s", epochs_dir.buff, epoch->id);
+
+	strbuf_init(&contents);
+	group_epoch_serialize(epoch, &contents);
+
+	int fd = open(path.buff, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		FATAL(FILE_OPEN_FAILED, path.buff);
+	if (xwrite(fd, contents.buff, contents.len) != (ssize_t) contents.len)
+		FATAL("failed to write epoch file '%s'", path.buff);
+	close(fd);
+
+	config_data_init(&conf);
+	if (parse_config(conf, config_path.buff))
+		DIE("couldn't parse the git-chat config file; check the config file syntax.");
+	if (config_data_update_exp_key(conf, epoch->id, "channel", channel, "epoch", NULL) &&
+			config_data_insert_exp_key(conf, epoch->id, "channel", channel, "epoch", NULL))
+		DIE("failed to update the current epoch of channel '%s'", channel);
+	if (write_config(conf, config_path.buff))
+		DIE("failed to write the git-chat config file '%s'", config_path.buff);
+
+	str_array_init(&paths);
+	str_array_push(&paths, path.buff, config_path.buff, NULL);
+	if (git_add_files_to_index(&paths))
+		DIE("failed to update index with epoch file '%s'", path.buff);
+
+	LOG_INFO("started epoch %s on channel '%s'", epoch->id, channel);
+
+	str_array_release(&paths);
+	config_data_release(&conf);
+	strbuf_release(&contents);
+	strbuf_release(&path);
+	strbuf_release(&config_path);
+	strbuf_release(&epochs_dir);
+}
+
+/**
+ * Split the ciphertext of an attachment, from the file `ciphertext_path`, into
+ * chunk files of ATTACHMENT_CHUNK_SIZE bytes in the directory `dir`.
+ *
+ * Returns the number of chunks written.
+ * */
+static size_t write_attachment_chunks(const char *ciphertext_path, const char *dir)
+{
+	struct strbuf chunk_path;
+	char *buffer;
+	ssize_t bytes_read;
+	size_t chunks = 0;
+
+	buffer = (char *) malloc(ATTACHMENT_CHUNK_SIZE);
+	if (!buffer)
+		FATAL(MEM_ALLOC_FAILED);
+
+	int fd = open(ciphertext_path, O_RDONLY);
+	if (fd < 0)
+		FATAL(FILE_OPEN_FAILED, ciphertext_path);
+
+	strbuf_init(&chunk_path);
+	while ((bytes_read = xread(fd, buffer, ATTACHMENT_CHUNK_SIZE)) > 0) {
+		strbuf_clear(&chunk_path);
+		strbuf_attach_fmt(&chunk_path, "%s/%zu", dir, chunks++);
+
+		int chunk_fd = open(chunk_path.buff, O_WRONLY | O_TRUNC | O_CREAT,
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if (chunk_fd < 0)
+			FATAL(FILE_OPEN_FAILED, chunk_path.buff);
+		if (xwrite(chunk_fd, buffer, bytes_read) != bytes_read)
+			FATAL("failed to write attachment chunk '%s'", chunk_path.buff);
+		close(chunk_fd);
+
+		// chunks are only short at the end of the ciphertext
+		if (bytes_read < ATTACHMENT_CHUNK_SIZE)
+			break;
+	}
+
+	if (bytes_read < 0)
+		FATAL("failed to read attachment ciphertext from '%s'", ciphertext_path);
+
+	close(fd);
+	strbuf_release(&chunk_path);
+	free(buffer);
+
+	return chunks;
+}
+
+/**
+ * Remove the attachments of the previous message from the index and the
+ * working tree, so that the tree of the new message only holds its own.
+ * */
+static void remove_attachments(const char *dir)
+{
+	struct child_process_def cmd;
+
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "rm", "-r", "-q", "-f", "--ignore-unmatch", "--", dir, NULL);
+	child_process_def_stdout(&cmd, STDOUT_NULL);
+
+	if (run_command(&cmd))
+		DIE("failed to remove previous attachments in '%s' from the index", dir);
+
+	child_process_def_release(&cmd);
+}
+
+/**
+ * Encrypt the files attached to a message, with the epoch key of `epoch` if
+ * non-NULL, or to the `recipients` otherwise, as for the message itself.
+ *
+ * Each file is streamed through gpg, in binary, into a temporary file in the
+ * .git directory, which is then split into chunks in the attachments directory
+ * of the .git-chat directory. The chunks are added to the index, and the
+ * manifest of the attachments is appended to the header of the message.
+ * */
+static void encrypt_attachments(struct gc_gpgme_ctx *ctx, struct message_io *io,
+		const struct group_epoch *epoch, struct gpg_key_set *recipients)
+{
+	struct attachment_manifest manifest;
+	struct strbuf git_chat_dir, dir, path, ciphertext_path;
+	const mode_t dir_mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+
+	if (!io->attachments || !io->attachments->len)
+		return;
+
+	strbuf_init(&git_chat_dir);
+	if (get_git_chat_dir(&git_chat_dir))
+		FATAL("unable to obtain the path to the .git-chat directory");
+
+	strbuf_init(&ciphertext_path);
+	if (get_cwd(&ciphertext_path))
+		FATAL("unable to obtain the current working directory from getcwd()");
+	strbuf_attach_str(&ciphertext_path, "/.git/GC_ATTACHMENT");
+
+	strbuf_init(&dir);
+	strbuf_attach_fmt(&dir, "%s/%s", git_chat_dir.buff, ATTACHMENT_DIR);
+	remove_attachments(dir.buff);
+	safe_create_dir(git_chat_dir.buff, ATTACHMENT_DIR, dir_mode);
+
+	// attachments are always binary, even if the message is armored
+	int armor = gpgme_get_armor(ctx->gpgme_ctx);
+	gpgme_set_armor(ctx->gpgme_ctx, 0);
+
+	attachment_manifest_init(&manifest);
+	strbuf_init(&path);
+	for (size_t i = 0; i < io->attachments->len; i++) {
+		const char *file = str_array_get(io->attachments, i);
+		const char *name = strrchr(file, '/');
+		name = name ? name + 1 : file;
+
+		if (!*name || strchr(name, '\n'))
+			DIE("cannot attach '%s'; attachment names must be non-empty and a single line", file);
+
+		int in_fd = open(file, O_RDONLY);
+		if (in_fd < 0)
+			DIE(FILE_OPEN_FAILED, file);
+
+		int out_fd = open(ciphertext_path.buff, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+		if (out_fd < 0)
+			FATAL(FILE_OPEN_FAILED, ciphertext_path.buff);
+
+		LOG_INFO("encrypting attachment '%s'", file);
+
+		size_t size;
+		if (epoch)
+			size = group_key_encrypt_stream(ctx, epoch, in_fd, out_fd);
+		else
+			size = asymmetric_encrypt_plaintext_stream(ctx, in_fd, out_fd, recipients);
+
+		close(in_fd);
+		close(out_fd);
+
+		strbuf_clear(&path);
+		strbuf_attach_fmt(&path, "%zu", i);
+		safe_create_dir(dir.buff, path.buff, dir_mode);
+
+		strbuf_clear(&path);
+		strbuf_attach_fmt(&path, "%s/%zu", dir.buff, i);
+		size_t chunks = write_attachment_chunks(ciphertext_path.buff, path.buff);
+		if (!chunks)
+			FATAL("gpg produced no ciphertext for attachment '%s'", file);
+
+		attachment_manifest_add(&manifest, name, size, chunks);
+		LOG_INFO("attached '%s' (%zu bytes) in %zu chunks", file, size, chunks);
+	}
+
+	gpgme_set_armor(ctx->gpgme_ctx, armor);
+	create_truncate_file(ciphertext_path.buff);
+
+	if (git_add_file_to_index(dir.buff))
+		DIE("failed to update index with attachments in '%s'", dir.buff);
+
+	attachment_manifest_format(&manifest, &io->header);
+
+	attachment_manifest_release(&manifest);
+	strbuf_release(&path);
+	strbuf_release(&ciphertext_path);
+	strbuf_release(&dir);
+	strbuf_release(&git_chat_dir);
+}
+
+/**
+ * Encrypt a message with the group key of the channel. The key of the current
+ * epoch is used if the members of the channel are unchanged since the epoch
+ * began; otherwise, a new epoch is started for the current members.
+ *
+ * The epoch key is looked up in the epoch key cache, or unwrapped with the
+ * secret keys of the user.
+ * */
+static void encrypt_message_group(struct gc_gpgme_ctx *ctx, const char *channel,
+		struct gpg_key_set *members, struct message_io *io)
+{
+	struct gc_gpgme_ctx user_ctx;
+	struct epoch_key_cache epoch_keys;
+	struct group_epoch epoch;
+	struct strbuf config_key, current;
+
+	gpgme_context_init(&user_ctx, 0);
+	epoch_key_cache_init(&epoch_keys);
+	if (epoch_key_cache_load(&epoch_keys, &user_ctx))
+		LOG_WARN("epoch key cache could not be loaded and will be rebuilt");
+
+	group_epoch_init(&epoch);
+	strbuf_init(&config_key);
+	strbuf_init(&current);
+	strbuf_attach_fmt(&config_key, "channel.%s.epoch", channel);
+
+	if (!get_config_value(config_key.buff, &current) && group_key_is_epoch_id(current.buff) &&
+			!read_epoch_file(&epoch, current.buff) && group_epoch_has_members(&epoch, members)) {
+		struct epoch_key_cache_entry *entry = epoch_key_cache_get(&epoch_keys, epoch.id);
+		if (entry && entry->key.len)
+			strbuf_attach(&epoch.key, entry->key.buff, entry->key.len);
+		else if (!group_epoch_unwrap(&user_ctx, &epoch))
+			epoch_key_cache_put(&epoch_keys, epoch.id, epoch.key.buff);
+	}
+
+	if (!epoch.key.len) {
+		LOG_INFO("channel members have changed; starting a new epoch");
+
+		group_epoch_release(&epoch);
+		group_epoch_init(&epoch);
+		group_epoch_create(ctx, members, &epoch);
+		write_epoch_file(&epoch, channel);
+
+		epoch_key_cache_put(&epoch_keys, epoch.id, epoch.key.buff);
+	}
+
+	group_key_message_header(&epoch, &io->header);
+	if (io->plaintext) {
+		struct strbuf ciphertext;
+		strbuf_init(&ciphertext);
+		group_key_encrypt_message(ctx, &epoch, io->plaintext, &ciphertext);
+		write_message_ciphertext(io, &ciphertext);
+		strbuf_release(&ciphertext);
+	} else {
+		io->len = group_key_encrypt_stream(ctx, &epoch, io->in_fd, io->out_fd);
+	}
+
+	encrypt_attachments(ctx, io, &epoch, NULL);
+
+	if (epoch_key_cache_write(&epoch_keys, &user_ctx))
+		LOG_WARN("unable to update epoch key cache");
+
+	strbuf_release(&current);
+	strbuf_release(&config_key);
+	group_epoch_release(&epoch);
+	epoch_key_cache_release(&epoch_keys);
+	gpgme_context_release(&user_ctx);
+}
+
+/**
+ * Obtain the name of the current channel, if the current channel uses a group
+ * key.
+ *
+ * Returns zero if the current channel uses a group key, and non-zero otherwise.
+ * */
+static int get_group_key_channel(struct strbuf *channel)
+{
+	const char *prefix = "refs/heads/";
+
+	if (get_current_channel_ref(channel))
+		return 1;
+	if (strncmp(channel->buff, prefix, strlen(prefix)) != 0)
+		return 1;
+
+	strbuf_remove(channel, 0, strlen(prefix));
+
+	return !group_key_enabled(channel->buff);
+}
+
+/**
+ * Encrypt the message from `io`, and its attachments, to the gpg keys of its
+ * recipients. Messages to every member of a channel with a group key are
+ * encrypted with the group key instead.
+ *
+ * If recipients is an empty list, then all usable, trusted public keys are
+ * used in encrypting the message. Otherwise, recipients are mapped to keys
+ * using the filter_key_listing_by_recipients() function. Recipients are
+ * selected from the cached key listing (see key_listing_fetch()), and only the
+ * selected keys are then read from the keyring with gpg_key_set_resolve(). If
+ * a selected key cannot be found in the keyring, the listing is stale and the
+ * keys are listed again once.
+ *
+ * Returns the number of recipients selected to decrypt the message, or -1 if
+ * some recipients in the given str_array do not exist (no public key in keyring),
+ * in which case the message output is left unmodified.
+ * */
+static int encrypt_message_asym(struct gc_gpgme_ctx *ctx, struct str_array *recipients,
+		struct message_io *io)
+{
+	struct gpg_key_set gpg_keys;
+	int key_count = -2;
+
+	// if the cached key listing turns out to be stale, list the keys again
+	for (int refresh = 0; refresh < 2 && key_count == -2; refresh++) {
+		struct key_listing listing;
+
+		key_listing_init(&listing);
+		key_listing_fetch(ctx, &listing, refresh);
+
+		gpg_key_set_init(&gpg_keys);
+		key_count = select_recipient_keys(ctx, &listing, recipients, &gpg_keys);
+		if (key_count < 0)
+			gpg_key_set_release(&gpg_keys);
+
+		key_listing_release(&listing);
+
+		if (key_count == -2 && !refresh)
+			LOG_WARN("key listing cache is out of date with the keyring; listing keys again");
+	}
+
+	if (key_count == -2)
+		FATAL("keys listed from the keyring could not be found in the keyring");
+	if (key_count < 0)
+		return key_count;
+
+	// messages to explicit recipients are never encrypted with the group key
+	struct strbuf channel;
+	strbuf_init(&channel);
+
+	int encrypted_with_group_key = 0;
+	if (key_count && !recipients->len && !get_group_key_channel(&channel)) {
+		encrypt_message_group(ctx, channel.buff, &gpg_keys, io);
+		encrypted_with_group_key = 1;
+	} else if (key_count && io->plaintext) {
+		struct strbuf ciphertext;
+		strbuf_init(&ciphertext);
+		asymmetric_encrypt_plaintext_message(ctx, io->plaintext, &ciphertext, &gpg_keys);
+		write_message_ciphertext(io, &ciphertext);
+		strbuf_release(&ciphertext);
+	} else if (key_count) {
+		io->len = asymmetric_encrypt_plaintext_stream(ctx, io->in_fd, io->out_fd, &gpg_keys);
+	}
+
+	if (key_count && !encrypted_with_group_key)
+		encrypt_attachments(ctx, io, NULL, &gpg_keys);
+
+	strbuf_release(&channel);
+	gpg_key_set_release(&gpg_keys);
 
 	return key_count;
 }
 
+/**
+ * Determine whether new messages are stored as blobs, rather than as
+ * ASCII-armored commit messages (`message.storage`).
+ *
+ * Returns non-zero if messages are stored as blobs, and zero otherwise.
+ * */
+static int use_blob_storage(void)
+{
+	struct strbuf value;
+	int blob = 0;
+
+	strbuf_init(&value);
+	if (!get_config_value("message.storage", &value)) {
+		blob = !strcmp(value.buff, "blob");
+		if (!blob && strcmp(value.buff, "armor") != 0)
+			WARN("unknown message.storage '%s'; storing message as armored text", value.buff);
+	}
+
+	strbuf_release(&value);
+
+	return blob;
+}
+
+/**
+ * Move the binary ciphertext of a message, from the file `ciphertext_path`, to
+ * the ciphertext file in the .git-chat directory, and add it to the index so
+ * that the blob is committed along with the message. Since the blob is
+ * referenced from the tree of the message, it is fetched and pushed with the
+ * message like any other object.
+ *
+ * The trailer naming the blob is appended to `commit_message`.
+ * */
+static void write_ciphertext_blob(const char *ciphertext_path, struct strbuf *commit_message)
+{
+	struct child_process_def cmd;
+	struct strbuf path, blob_id;
+
+	strbuf_init(&path);
+	if (get_git_chat_dir(&path))
+		FATAL("unable to obtain the path to the .git-chat directory");
+	strbuf_attach_fmt(&path, "/%s", COMMIT_CIPHERTEXT_FILE);
+
+	if (chmod(ciphertext_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) ||
+			rename(ciphertext_path, path.buff))
+		FATAL("failed to move ciphertext to '%s'", path.buff);
+
+	strbuf_init(&blob_id);
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "hash-object", "-w", "--", path.buff, NULL);
+
+	if (capture_command(&cmd, &blob_id))
+		FATAL("failed to write ciphertext blob '%s' to the object database", path.buff);
+	if (blob_id.len < GIT_HEX_OBJECT_ID)
+		FATAL("unexpected output from git hash-object: '%s'", blob_id.buff);
+	child_process_def_release(&cmd);
+
+	if (git_add_file_to_index(path.buff))
+		DIE("failed to update index with ciphertext file '%s'", path.buff);
+
+	strbuf_attach_fmt(commit_message, "%s%.*s\n", COMMIT_CIPHERTEXT_TRAILER,
+			GIT_HEX_OBJECT_ID, blob_id.buff);
+
+	LOG_INFO("stored ciphertext in blob %.*s", GIT_HEX_OBJECT_ID, blob_id.buff);
+
+	strbuf_release(&blob_id);
+	strbuf_release(&path);
+}
+
 /**
  * Create a new commit on the tip of the current branch whose commit message body
- * is the encrypted message. Returns the exit status from the git command that
- * was run.
+ * is `header`, followed by the armored ciphertext in the file `ciphertext_path`
+ * (if not NULL). The ciphertext is copied to git in chunks, rather than read
+ * into memory. Returns the exit status from the git command that was run.
  *
  * Equivalent to running the following command:
  * $ echo $MESSAGE | git commit -q --allow-empty --file -
  * */
-static int write_commit(struct strbuf *encrypted_message)
+static int write_commit(const struct strbuf *header, const char *ciphertext_path)
 {
 	struct child_process_def cmd;
+	char buffer[BUFF_LEN * 64];
+	ssize_t bytes_read;
+	int fd = -1;
+
+	if (ciphertext_path) {
+		fd = open(ciphertext_path, O_RDONLY);
+		if (fd < 0)
+			FATAL(FILE_OPEN_FAILED, ciphertext_path);
+	}
 
 	child_process_def_init(&cmd);
 	cmd.git_cmd = 1;
@@ -360,8 +915,25 @@ static int write_commit(struct strbuf *encrypted_message)
 	start_command(&cmd);
 
 	close(cmd.in_fd[0]);
-	if (xwrite(cmd.in_fd[1], encrypted_message->buff, encrypted_message->len) != (ssize_t)encrypted_message->len)
+	if (xwrite(cmd.in_fd[1], header->buff, header->len) != (ssize_t) header->len)
 		FATAL("failed to write encrypted message to pipe");
+
+	if (fd >= 0) {
+		// a blank line separates the header from the armored ciphertext
+		if (header->len && xwrite(cmd.in_fd[1], "\n", 1) != 1)
+			FATAL("failed to write encrypted message to pipe");
+
+		while ((bytes_read = xread(fd, buffer, sizeof(buffer))) > 0) {
+			if (xwrite(cmd.in_fd[1], buffer, bytes_read) != bytes_read)
+				FATAL("failed to write encrypted message to pipe");
+		}
+
+		if (bytes_read < 0)
+			FATAL("failed to read ciphertext from '%s'", ciphertext_path);
+
+		close(fd);
+	}
+
 	close(cmd.in_fd[1]);
 
 	int status = finish_command(&cmd);
@@ -388,47 +960,75 @@ static int write_commit(struct strbuf *encrypted_message)
  *
  * If `file` is non-null, the message content is read from a file with the
  * given path, unless the path is `-` which will read the message from stdin.
+ * Such messages are streamed through gpg, rather than read into memory.
  *
  * When `compose` is non-zero, that number of messages on the current channel
  * will be decrypted and shown in the editor. This will only take effect if both
- * `file` and `message` arguments are NULL.
+ * `file` and `message` arguments are NULL. These messages are decrypted by a
+ * pool of `jobs` workers.
+ *
+ * Files in `attachments` are encrypted for the same recipients as the message,
+ * and committed in chunks along with it (see git/attachment.h).
+ *
+ * The ciphertext is written to `.git/GC_CIPHERTEXT` with rw permission for the
+ * current user only, from where it is committed. Once committed, the file is
+ * truncated (or moved into the tree of the message, if stored as a blob).
  *
  * Message cannot be empty.
  * */
-static int create_message(struct str_array *recipients, const char *message,
-		const char *file, int compose)
+static int create_message(struct str_array *recipients, struct str_array *attachments,
+		const char *message, const char *file, int compose, int jobs)
 {
 	struct gc_gpgme_ctx ctx;
-	struct strbuf message_buff, ciphertext, keys_dir_path;
+	struct strbuf message_buff, cwd, ciphertext_file, keys_dir_path;
+	struct message_io io = { NULL, -1, -1, 0, { 0 }, attachments };
 
 	if (!is_inside_git_chat_space())
 		DIE("Where are you? It doesn't look like you're in the right directory.");
 
 	strbuf_init(&message_buff);
+	strbuf_init(&io.header);
 
-	// build the message into the message_buff buffer
-	if (!message && !file)
-		compose_message(&message_buff, compose);
-	else if (file)
-		read_message_from_file(file, &message_buff);
-	else
-		strbuf_attach_str(&message_buff, message);
+	// build the message into the message_buff buffer, unless streamed from a file
+	if (file) {
+		io.in_fd = open_message_file(file);
+	} else {
+		if (!message)
+			compose_message(&message_buff, compose, jobs);
+		else
+			strbuf_attach_str(&message_buff, message);
 
-	if (!message_buff.len)
-		DIE("message aborted (message was not provided)");
+		if (!message_buff.len)
+			DIE("message aborted (message was not provided)");
+
+		io.plaintext = &message_buff;
+	}
 
 	strbuf_init(&keys_dir_path);
 	if (get_keys_dir(&keys_dir_path))
 		FATAL(".keys directory does not exist or cannot be used for some reason");
 
+	strbuf_init(&cwd);
+	strbuf_init(&ciphertext_file);
+	if (get_cwd(&cwd))
+		FATAL("unable to obtain the current working directory from getcwd()");
+	strbuf_attach_fmt(&ciphertext_file, "%s/.git/GC_CIPHERTEXT", cwd.buff);
+
+	io.out_fd = open(ciphertext_file.buff, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+	if (io.out_fd < 0)
+		FATAL(FILE_OPEN_FAILED, ciphertext_file.buff);
+
 	gpgme_context_init(&ctx, 1);
-	strbuf_init(&ciphertext);
+
+	int blob_storage = use_blob_storage();
+	if (blob_storage)
+		gpgme_set_armor(ctx.gpgme_ctx, 0);
 
 	// reimport the gpg keys into the keyring
 	rebuild_gpg_keyring(&ctx, keys_dir_path.buff);
 	strbuf_release(&keys_dir_path);
 
-	int ret = encrypt_message_asym(&ctx, recipients, &message_buff, &ciphertext);
+	int ret = encrypt_message_asym(&ctx, recipients, &io);
 	if (ret == 0)
 		DIE("no message recipients; no one will be able to read your message.");
 	if (ret < 0)
@@ -437,12 +1037,30 @@ static int create_message(struct str_array *recipients, const char *message,
 	gpgme_context_release(&ctx);
 
 	memset(message_buff.buff, 0, message_buff.alloc);
+	if (io.in_fd >= 0 && io.in_fd != STDIN_FILENO)
+		close(io.in_fd);
+	close(io.out_fd);
+
+	if (!io.len) {
+		create_truncate_file(ciphertext_file.buff);
+		DIE("message aborted (message was not provided)");
+	}
 
-	if (write_commit(&ciphertext))
+	// the commit message is the header, followed by the ciphertext or the
+	// trailer naming the ciphertext blob
+	if (blob_storage)
+		write_ciphertext_blob(ciphertext_file.buff, &io.header);
+
+	if (write_commit(&io.header, blob_storage ? NULL : ciphertext_file.buff))
 		FATAL("failed to write ciphertext as the commit message body");
 
+	if (!blob_storage)
+		create_truncate_file(ciphertext_file.buff);
+
 	strbuf_release(&message_buff);
-	strbuf_release(&ciphertext);
+	strbuf_release(&io.header);
+	strbuf_release(&ciphertext_file);
+	strbuf_release(&cwd);
 
 	return 0;
 }
@@ -451,31 +1069,37 @@ int cmd_message(int argc, char *argv[])
 {
 	int show_help = 0;
 	int reply = 0, compose = 0;
-	struct str_array recipients;
+	int jobs = -1;
+	struct str_array recipients, attachments;
 	char *message = NULL;
 	char *file = NULL;
 
 	const struct command_option message_cmd_options[] = {
 			OPT_LONG_STRING_LIST("recipient", "alias", "specify one or more recipients that may read the message", &recipients),
+			OPT_LONG_STRING_LIST("attach", "file", "attach a file to the message", &attachments),
 			OPT_STRING('m', "message", "message", "provide the message contents", &message),
 			OPT_STRING('f', "file", "filename", "read message contents from file", &file),
 			OPT_LONG_BOOL("reply", "show the last message when composing new messages", &reply),
 			OPT_LONG_INT("compose", "show last messages when composing new messages", &compose),
+			OPT_INT('j', "jobs", "number of messages to decrypt in parallel", &jobs),
 			OPT_BOOL('h', "help", "show usage and exit", &show_help),
 			OPT_END()
 	};
 
 	str_array_init(&recipients);
+	str_array_init(&attachments);
 	argc = parse_options(argc, argv, message_cmd_options, 1, 1);
 	if (argc > 0) {
 		show_usage_with_options(message_cmd_usage, message_cmd_options, 1,
 				"error: unknown option '%s'", argv[0]);
+		str_array_release(&attachments);
 		str_array_release(&recipients);
 		return 1;
 	}
 
 	if (show_help) {
 		show_usage_with_options(message_cmd_usage, message_cmd_options, 0, NULL);
+		str_array_release(&attachments);
 		str_array_release(&recipients);
 		return 0;
 	}
@@ -483,6 +1107,7 @@ int cmd_message(int argc, char *argv[])
 	if (message && file) {
 		show_usage_with_options(message_cmd_usage, message_cmd_options, 1,
 				"error: mixing --message and --file is not supported");
+		str_array_release(&attachments);
 		str_array_release(&recipients);
 		return 1;
 	}
@@ -490,6 +1115,7 @@ int cmd_message(int argc, char *argv[])
 	if (compose < 0) {
 		show_usage_with_options(message_cmd_usage, message_cmd_options, 1,
 				"error: --reply-last value must be non-negative");
+		str_array_release(&attachments);
 		str_array_release(&recipients);
 		return 1;
 	}
@@ -497,8 +1123,9 @@ int cmd_message(int argc, char *argv[])
 	// reply-last option takes precedence
 	compose = (compose > 0) ? compose : reply;
 
-	int ret = create_message(&recipients, message, file, compose);
+	int ret = create_message(&recipients, &attachments, message, file, compose, jobs);
 
+	str_array_release(&attachments);
 	str_array_release(&recipients);
 	return ret;
 }
@@ -1,91 +1,649 @@
+#include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
 
+#include "cache/epoch-key-cache.h"
+#include "cache/message-cache.h"
+#include "cache/message-index.h"
+#include "cache/read-watermark.h"
+#include "cache/search-index.h"
+#include "cache/session-key-cache.h"
 #include "git/graph-traversal.h"
 #include "gnupg/gpg-common.h"
 #include "gnupg/decryption.h"
+#include "gnupg/decryption-pool.h"
+#include "gnupg/group-key.h"
 #include "working-tree.h"
 #include "parse-options.h"
 #include "paging.h"
 #include "utils.h"
 
 static const struct usage_string read_cmd_usage[] = {
-		USAGE("git chat read [(-n | --max-count) <n>] [--no-color] [<commit hash>]"),
+		USAGE("git chat read [(-n | --max-count) <n>] [--no-color] [(-j | --jobs) <n>] [--no-cache | --rebuild-cache] [--since <date>] [--until <date>] [--author <pattern>] [--new | --skip <n> | --page <n> | --cursor <token> | <commit hash>]"),
 		USAGE("git chat read (-h | --help)"),
 		USAGE_END()
 };
 
+enum cache_mode {
+	CACHE_ENABLED,
+	CACHE_DISABLED,
+	CACHE_REBUILD
+};
+
+#define READ_DEFAULT_PAGE_SIZE 20
+
+/**
+ * Messages with more ciphertext than this (in bytes) are streamed from gpg
+ * straight to the output when shown on their own (`git chat read <commit>`),
+ * rather than decrypted into memory.
+ * */
+#define READ_STREAM_THRESHOLD (1024 * 1024)
+
+struct read_options {
+	const char *commit;
+	const char *channel;
+	unsigned new_only: 1;
+	unsigned indexed: 1;
+	int limit;
+	int skip;
+	int page;
+	const char *cursor;
+	unsigned filtered: 1;
+	struct message_index_filter filter;
+	int no_color;
+	enum cache_mode cache_mode;
+	int jobs;
+};
+
 struct graph_traversal_context {
 	int no_color;
+	struct decryption_pool *pool;
+	struct message_cache *cache;
+
 	struct gc_gpgme_ctx *gpg_ctx;
+	struct search_index *search;
+	unsigned search_loaded: 1;
+
+	struct epoch_key_cache *epoch_keys;
+	unsigned stream_large: 1;
+
+	struct git_oid tip;
+	unsigned tip_seen: 1;
+
+	// with --new and --max-count, whether newer messages were left unshown
+	unsigned new_truncated: 1;
 };
 
 /**
- * Commit traversal callback that attempts to decrypt the commit message body
- * and pretty-prints the message to standard output.
+ * Commits collected by a traversal, newest first.
+ * */
+struct commit_id_list {
+	struct git_oid *oids;
+	size_t len;
+	size_t alloc;
+};
+
+/**
+ * Add a message that was missing from the message cache to the search index.
+ * The search index is only loaded once the first such message is seen, so
+ * reading messages that are all cached doesn't cost an extra gpg operation.
+ * */
+static void index_message(struct graph_traversal_context *ctx, struct git_commit *commit,
+		const struct strbuf *message, enum message_type type)
+{
+	if (!ctx->search_loaded) {
+		if (search_index_load(ctx->search, ctx->gpg_ctx))
+			LOG_WARN("search index could not be loaded and will be rebuilt");
+		ctx->search_loaded = 1;
+	}
+
+	const struct strbuf *text = type == DECRYPTED ? message : &commit->body;
+	search_index_add(ctx->search, &commit->commit_id, text->buff, text->len);
+}
+
+/**
+ * Decryption pool callback that pretty-prints a message to standard output.
+ * Messages that were successfully decrypted (or are plaintext) and weren't
+ * served from the message cache are added to the message cache and the search
+ * index, if available.
  *
  * Returns zero.
  * */
-static int commit_traversal_cb(struct git_commit *commit, void *data)
+static int print_message_cb(struct git_commit *commit, struct strbuf *message,
+		enum message_type type, void *data)
 {
 	struct graph_traversal_context *ctx = (struct graph_traversal_context *) data;
-	struct gc_gpgme_ctx *gpg_ctx = ctx->gpg_ctx;
 	int no_color = ctx->no_color;
 
-	struct strbuf decrypted_text;
-	strbuf_init(&decrypted_text);
-
-	int ret = decrypt_asymmetric_message(gpg_ctx, &commit->body, &decrypted_text);
-	if (!ret) {
-		// decryption successful
-		pretty_print_message(commit, &decrypted_text, DECRYPTED, no_color, STDOUT_FILENO);
-	} else if (ret > 0) {
+	if (type == DECRYPTED) {
+		pretty_print_message(commit, message, DECRYPTED, no_color, STDOUT_FILENO);
+	} else if (type == PLAINTEXT) {
 		// commit body is not gpg message; print commit message body
 		pretty_print_message(commit, &commit->body, PLAINTEXT, no_color, STDOUT_FILENO);
 	} else {
-		strbuf_clear(&decrypted_text);
-		strbuf_attach_str(&decrypted_text, "message could not be decrypted.");
-		pretty_print_message(commit, &decrypted_text, UNKNOWN_ERROR, no_color, STDOUT_FILENO);
+		strbuf_clear(message);
+		strbuf_attach_str(message, "message could not be decrypted.");
+		pretty_print_message(commit, message, UNKNOWN_ERROR, no_color, STDOUT_FILENO);
 	}
 
 	fflush(stdout);
 
-	strbuf_release(&decrypted_text);
+	if (ctx->cache && type != UNKNOWN_ERROR && !decryption_pool_emitted_known(ctx->pool)) {
+		if (ctx->search)
+			index_message(ctx, commit, message, type);
+
+		message_cache_put(ctx->cache, &commit->commit_id, type, message);
+	}
+
+	return 0;
+}
+
+/**
+ * Decrypt a single message straight to standard output, without holding the
+ * plaintext in memory. Since the message cache and search index only hold
+ * whole messages, the message is not added to either.
+ *
+ * Messages that fail to decrypt before any plaintext was shown are printed as
+ * by print_message_cb().
+ *
+ * Returns zero.
+ * */
+static int stream_message(struct graph_traversal_context *ctx, struct git_commit_view *view)
+{
+	struct git_commit commit;
+	struct pretty_print_stream stream;
+	struct strbuf message;
+	char epoch_id[GROUP_KEY_EPOCH_ID_LEN + 1];
+	const char *epoch_key = NULL;
+	int ret = -1;
+
+	git_commit_object_init(&commit);
+	git_commit_from_view(&commit, view);
+	strbuf_init(&message);
+
+	// messages stored as blobs are decrypted from the binary ciphertext
+	struct strbuf *ciphertext = commit.blob.len ? &commit.blob : &commit.body;
+
+	LOG_INFO("streaming %zu bytes of ciphertext", ciphertext->len);
+
+	pretty_print_stream_init(&stream, &commit, DECRYPTED, ctx->no_color, STDOUT_FILENO);
+	if (group_key_message_epoch(commit.body.buff, commit.body.len, epoch_id)) {
+		ret = decrypt_asymmetric_message_stream(ctx->gpg_ctx, ciphertext,
+				pretty_print_stream_write, &stream);
+	} else if ((epoch_key = epoch_key_cache_resolve(ctx->epoch_keys, ctx->gpg_ctx,
+			epoch_id, &commit.commit_id))) {
+		ret = decrypt_symmetric_message_stream(ctx->gpg_ctx, ciphertext, epoch_key,
+				pretty_print_stream_write, &stream);
+	}
+
+	if (stream.written) {
+		pretty_print_stream_finish(&stream);
+		if (ret)
+			WARN("message could not be decrypted in full.");
+	} else {
+		enum message_type type = ret > 0 && !commit.blob.len ? PLAINTEXT : UNKNOWN_ERROR;
+		if (!ret)
+			type = DECRYPTED;
+
+		print_message_cb(&commit, &message, type, ctx);
+	}
+
+	fflush(stdout);
+
+	pretty_print_stream_release(&stream);
+	strbuf_release(&message);
+	git_commit_object_release(&commit);
 
 	return 0;
 }
 
 /**
- * Read messages in the configured pager, starting at the given `commit`. If
- * limit is a positive integer, at most `limit` messages are shown. If `no_color`
- * is non-zero, ANSI color escape sequences are not written to output.
+ * Commit traversal callback that hands the commit to the decryption pool.
+ *
+ * If a message cache is available, the message is first looked up in the
+ * cache, and the commit is only decrypted on a cache miss. Cached messages
+ * still pass through the pool so that messages are shown in order.
+ *
+ * Returns zero.
+ * */
+static int commit_traversal_cb(struct git_commit_view *commit, void *data)
+{
+	struct graph_traversal_context *ctx = (struct graph_traversal_context *) data;
+
+	// commits are traversed newest first
+	if (!ctx->tip_seen) {
+		ctx->tip = commit->commit_id;
+		ctx->tip_seen = 1;
+	}
+
+	if (ctx->cache) {
+		struct message_cache_entry *entry = message_cache_get(ctx->cache, &commit->commit_id);
+		if (entry)
+			return decryption_pool_add_resolved(ctx->pool, commit, entry->type,
+					&entry->message);
+	}
+
+	size_t ciphertext_len = commit->blob_len ? commit->blob_len : commit->body_len;
+	if (ctx->stream_large && ciphertext_len > READ_STREAM_THRESHOLD)
+		return stream_message(ctx, commit);
+
+	return decryption_pool_add(ctx->pool, commit);
+}
+
+/**
+ * Commit traversal callback that only records the id of each commit.
+ *
+ * Returns zero.
+ * */
+static int collect_commit_id_cb(struct git_commit_view *commit, void *data)
+{
+	struct commit_id_list *list = (struct commit_id_list *) data;
+
+	if (list->len == list->alloc) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 64;
+		struct git_oid *oids = (struct git_oid *) realloc(list->oids, alloc * sizeof(struct git_oid));
+		if (!oids)
+			FATAL(MEM_ALLOC_FAILED);
+
+		list->oids = oids;
+		list->alloc = alloc;
+	}
+
+	list->oids[list->len++] = commit->commit_id;
+	return 0;
+}
+
+struct watermark_traversal {
+	graph_traversal_view_cb cb;
+	void *data;
+	unsigned seen: 1;
+};
+
+static int watermark_traversal_cb(struct git_commit_view *commit, void *data)
+{
+	struct watermark_traversal *traversal = (struct watermark_traversal *) data;
+	traversal->seen = 1;
+
+	return traversal->cb(commit, traversal->data);
+}
+
+/**
+ * Traverse the commits newer than `watermark_hex` (or all commits, if null)
+ * with `cb`. If the watermark is no longer part of the history, all commits
+ * are traversed instead.
+ *
+ * Returns the result of the traversal.
+ * */
+static int traverse_since_watermark(const char *watermark_hex, const char *channel,
+		graph_traversal_view_cb cb, void *data)
+{
+	if (!watermark_hex)
+		return traverse_commit_graph_views(NULL, -1, cb, data);
+
+	struct watermark_traversal traversal = { cb, data, 0 };
+	int ret = traverse_commit_graph_range(watermark_hex, NULL, -1,
+			watermark_traversal_cb, &traversal);
+	if (ret < 0 && !traversal.seen) {
+		// history may have been rewritten since the watermark was recorded
+		LOG_WARN("read watermark %s for '%s' is no longer valid; showing all messages",
+				watermark_hex, channel);
+		ret = traverse_commit_graph_views(NULL, -1, cb, data);
+	}
+
+	return ret;
+}
+
+/**
+ * Traverse the messages newer than the read watermark of `channel`. If the
+ * channel has no watermark yet, all messages are traversed.
+ *
+ * If `limit` is not negative, only the `limit` oldest new messages are shown,
+ * so that repeated reads work through the backlog in order, and
+ * `ctx->new_truncated` is set if newer messages remain. Either way, `ctx->tip`
+ * is the newest message shown.
+ *
+ * Returns the result of the traversal.
+ * */
+static int traverse_new_messages(struct graph_traversal_context *ctx,
+		const char *channel, int limit)
+{
+	char watermark_hex[GIT_HEX_OBJECT_ID + 1];
+	struct git_oid watermark;
+	int has_watermark = !read_watermark_get(channel, &watermark);
+	if (has_watermark) {
+		git_oid_to_str(&watermark, watermark_hex);
+		watermark_hex[GIT_HEX_OBJECT_ID] = 0;
+	}
+
+	if (limit < 0)
+		return traverse_since_watermark(has_watermark ? watermark_hex : NULL,
+				channel, commit_traversal_cb, ctx);
+
+	// the oldest new messages are only known once all new messages are found
+	struct commit_id_list list = { NULL, 0, 0 };
+	int ret = traverse_since_watermark(has_watermark ? watermark_hex : NULL,
+			channel, collect_commit_id_cb, &list);
+
+	if (!ret) {
+		size_t first = 0;
+		if (list.len > (size_t) limit) {
+			first = list.len - limit;
+			ctx->new_truncated = 1;
+		}
+
+		ret = read_commit_views(list.oids + first, list.len - first,
+				commit_traversal_cb, ctx);
+	}
+
+	free(list.oids);
+
+	return ret;
+}
+
+/**
+ * Count the elements of the ascending array `positions` less than `pos`.
+ * */
+static size_t count_positions_before(const size_t *positions, size_t len, size_t pos)
+{
+	size_t lo = 0, hi = len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (positions[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Select a page of messages from the message index of `opts->channel`, and
+ * read those commits directly, without walking the history.
+ *
+ * If `opts->filter` is active, only messages matching the filter are
+ * considered, as found through the secondary indexes. The page starts at the
+ * message just older than `opts->cursor` (or at the most recent message),
+ * skipping `opts->skip` messages and `opts->page - 1` pages of `opts->limit`
+ * messages.
+ *
+ * If older messages remain, a cursor to the next page is written to `next`.
+ *
+ * Returns the result of reading the commits.
+ * */
+static int traverse_indexed_messages(struct graph_traversal_context *ctx,
+		const struct read_options *opts, struct strbuf *next)
+{
+	struct message_index index;
+
+	if (message_index_update(opts->channel))
+		LOG_WARN("unable to update the message index for '%s'", opts->channel);
+	if (message_index_open(&index, opts->channel))
+		DIE("unable to read the message index for '%s'", opts->channel);
+
+	// candidate positions, ascending; if NULL, every message is a candidate
+	size_t *matches = NULL;
+	size_t matches_len = index.count;
+	if (opts->filtered && message_index_filter(&index, &opts->filter, &matches, &matches_len))
+		DIE("invalid --author pattern '%s'", opts->filter.author);
+
+	// positions count from the oldest message
+	size_t start = matches_len;
+	if (opts->cursor) {
+		size_t cursor_pos;
+		if (message_index_resolve_cursor(&index, opts->cursor, &cursor_pos))
+			DIE("invalid cursor '%s'; the channel history may have been rewritten", opts->cursor);
+
+		start = matches ? count_positions_before(matches, matches_len, cursor_pos) : cursor_pos;
+	}
+
+	size_t skip = opts->skip > 0 ? (size_t) opts->skip : 0;
+	if (opts->page > 1)
+		skip += (size_t) (opts->page - 1) * opts->limit;
+
+	size_t end = start > skip ? start - skip : 0;
+	size_t first = 0;
+	if (opts->limit >= 0 && end > (size_t) opts->limit)
+		first = end - opts->limit;
+
+	struct git_oid *oids = NULL;
+	if (end > first) {
+		oids = (struct git_oid *) malloc((end - first) * sizeof(struct git_oid));
+		if (!oids)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	// most recent first, as with a history walk
+	for (size_t i = end; i > first; i--) {
+		struct message_index_record record;
+		message_index_get(&index, matches ? matches[i - 1] : i - 1, &record);
+		oids[end - i] = record.oid;
+	}
+
+	if (first > 0 && end > first)
+		message_index_cursor(&index, matches ? matches[first] : first, next);
+
+	message_index_close(&index);
+	free(matches);
+
+	int ret = read_commit_views(oids, end - first, commit_traversal_cb, ctx);
+	free(oids);
+
+	return ret;
+}
+
+/**
+ * Read messages in the configured pager, as selected by `opts`:
+ *
+ * - If `opts->commit` is set, only that message is shown.
+ * - If `opts->new_only` is set, only messages newer than the read watermark of
+ *   `opts->channel` are shown, and the watermark is advanced to the newest
+ *   message shown. With `opts->limit`, the oldest new messages are shown, so
+ *   that the remaining messages are still new on the next read.
+ * - If `opts->indexed` is set, a page of messages (optionally filtered by
+ *   time or author) is selected through the message index of `opts->channel`
+ *   (see traverse_indexed_messages()).
+ * - Otherwise, messages are shown starting from the most recent.
+ *
+ * If `opts->limit` is a positive integer, at most `limit` messages are shown.
+ * If `opts->no_color` is non-zero, ANSI color escape sequences are not written
+ * to output.
+ *
+ * Messages are decrypted by a pool of `opts->jobs` workers. If zero, one worker
+ * is started for each online processor.
+ *
+ * Decrypted messages are served from and written to the message cache, unless
+ * `opts->cache_mode` is CACHE_DISABLED. If CACHE_REBUILD, the existing cache is
+ * discarded and rebuilt from the messages shown. Unless CACHE_DISABLED, the
+ * session key cache is used to decrypt messages missing from the message cache
+ * (which makes rebuilding the message cache cheap), and messages missing from
+ * the message cache are added to the search index.
  *
  * Returns zero.
  * */
-static int read_messages(const char *commit, int limit, int no_color)
+static int read_messages(const struct read_options *opts)
 {
 	struct gc_gpgme_ctx gpg_ctx;
+	struct message_cache cache;
+	struct session_key_cache session_keys;
+	struct epoch_key_cache epoch_keys;
+	struct search_index search;
+	struct decryption_pool pool;
+	struct strbuf next_cursor;
 	gpgme_context_init(&gpg_ctx, 0);
+	strbuf_init(&next_cursor);
+
+	enum cache_mode cache_mode = opts->cache_mode;
+
+	message_cache_init(&cache);
+	if (cache_mode == CACHE_ENABLED && message_cache_load(&cache, &gpg_ctx))
+		LOG_WARN("message cache could not be loaded and will be rebuilt");
+
+	session_key_cache_init(&session_keys);
+	if (cache_mode != CACHE_DISABLED && session_key_cache_load(&session_keys, &gpg_ctx))
+		LOG_WARN("session key cache could not be loaded and will be rebuilt");
+
+	epoch_key_cache_init(&epoch_keys);
+	if (cache_mode != CACHE_DISABLED && epoch_key_cache_load(&epoch_keys, &gpg_ctx))
+		LOG_WARN("epoch key cache could not be loaded and will be rebuilt");
+
+	search_index_init(&search);
 
 	pager_start(GIT_CHAT_PAGER_RAW_CTRL_CHR | GIT_CHAT_PAGER_CLR_SCRN);
 
-	struct graph_traversal_context ctx = { .no_color = no_color, .gpg_ctx = &gpg_ctx };
-	int ret = traverse_commit_graph(commit, limit, commit_traversal_cb, &ctx);
+	struct graph_traversal_context ctx = {
+			.no_color = opts->no_color,
+			.pool = &pool,
+			.cache = cache_mode == CACHE_DISABLED ? NULL : &cache,
+			.gpg_ctx = &gpg_ctx,
+			.search = cache_mode == CACHE_DISABLED ? NULL : &search,
+			.search_loaded = 0,
+			.epoch_keys = &epoch_keys,
+			.stream_large = opts->commit != NULL,
+			.tip_seen = 0,
+			.new_truncated = 0
+	};
+	decryption_pool_init(&pool, opts->jobs, print_message_cb, &ctx);
+	if (cache_mode != CACHE_DISABLED)
+		decryption_pool_use_session_keys(&pool, &session_keys);
+	decryption_pool_use_epoch_keys(&pool, &epoch_keys, &gpg_ctx);
+
+	int ret;
+	if (opts->new_only)
+		ret = traverse_new_messages(&ctx, opts->channel, opts->limit);
+	else if (opts->indexed)
+		ret = traverse_indexed_messages(&ctx, opts, &next_cursor);
+	else
+		ret = traverse_commit_graph_views(opts->commit, opts->limit, commit_traversal_cb, &ctx);
+
 	if (ret)
 		FATAL("commit graph traversal failed");
 
+	decryption_pool_finish(&pool);
+
+	// up to the newest message shown, so that unshown messages remain new
+	if (opts->new_only && ctx.tip_seen && read_watermark_set(opts->channel, &ctx.tip))
+		LOG_WARN("unable to update read watermark for '%s'", opts->channel);
+	if (opts->new_only && ctx.new_truncated)
+		LOG_INFO("newer messages remain for '%s'", opts->channel);
+
+	if (next_cursor.len) {
+		printf("\nolder messages: git chat read --cursor %s\n", next_cursor.buff);
+		fflush(stdout);
+	}
+
+	if (cache_mode != CACHE_DISABLED && message_cache_write(&cache, &gpg_ctx))
+		LOG_WARN("unable to update message cache");
+	if (cache_mode != CACHE_DISABLED && session_key_cache_write(&session_keys, &gpg_ctx))
+		LOG_WARN("unable to update session key cache");
+	if (cache_mode != CACHE_DISABLED && epoch_key_cache_write(&epoch_keys, &gpg_ctx))
+		LOG_WARN("unable to update epoch key cache");
+	if (ctx.search_loaded && search_index_write(&search, &gpg_ctx))
+		LOG_WARN("unable to update search index");
+
+	strbuf_release(&next_cursor);
+	search_index_release(&search);
+	epoch_key_cache_release(&epoch_keys);
+	session_key_cache_release(&session_keys);
+	message_cache_release(&cache);
 	gpgme_context_release(&gpg_ctx);
 	return 0;
 }
 
+/**
+ * Parse a date given to --since or --until. Dates are either `@<seconds since
+ * epoch>`, or `YYYY-MM-DD` optionally followed by ` HH:MM[:SS]`, in local time.
+ * A date without a time refers to the start of the day or, if `end_of_day` is
+ * non-zero, to the last second of the day.
+ *
+ * Returns zero if successful, and non-zero if the date is malformed.
+ * */
+static int parse_date(const char *str, int end_of_day, int64_t *timestamp)
+{
+	int year, month, day, hour = 0, minute = 0, second = 0;
+	int consumed = 0, time_consumed = 0;
+
+	if (*str == '@') {
+		char *tailptr = NULL;
+		long long value = strtoll(str + 1, &tailptr, 10);
+		if (!str[1] || *tailptr)
+			return 1;
+
+		*timestamp = value;
+		return 0;
+	}
+
+	if (sscanf(str, "%4d-%2d-%2d%n", &year, &month, &day, &consumed) != 3)
+		return 1;
+
+	if (!str[consumed]) {
+		if (end_of_day) {
+			hour = 23;
+			minute = 59;
+			second = 59;
+		}
+	} else if (sscanf(str + consumed, " %2d:%2d%n", &hour, &minute, &time_consumed) == 2) {
+		consumed += time_consumed;
+		if (str[consumed] && (sscanf(str + consumed, ":%2d%n", &second, &time_consumed) != 1 ||
+				str[consumed + time_consumed]))
+			return 1;
+	} else {
+		return 1;
+	}
+
+	if (month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 ||
+			minute < 0 || minute > 59 || second < 0 || second > 60)
+		return 1;
+
+	struct tm tm = {
+			.tm_year = year - 1900,
+			.tm_mon = month - 1,
+			.tm_mday = day,
+			.tm_hour = hour,
+			.tm_min = minute,
+			.tm_sec = second,
+			.tm_isdst = -1
+	};
+
+	time_t value = mktime(&tm);
+	if (value == (time_t) -1)
+		return 1;
+
+	*timestamp = (int64_t) value;
+	return 0;
+}
+
 int cmd_read(int argc, char *argv[])
 {
 	int limit = -1;
 	int no_color = 0;
+	int no_cache = 0;
+	int rebuild_cache = 0;
+	int new_only = 0;
+	int skip = -1;
+	int page = -1;
+	char *cursor = NULL;
+	char *since = NULL;
+	char *until = NULL;
+	char *author = NULL;
+	int jobs = -1;
 	int show_help = 0;
 
 	const struct command_option options[] = {
 			OPT_INT('n', "max-count", "limit number of messages shown", &limit),
 			OPT_LONG_BOOL("no-color", "turn off colored message headers", &no_color),
+			OPT_INT('j', "jobs", "number of messages to decrypt in parallel", &jobs),
+			OPT_LONG_BOOL("no-cache", "bypass the decrypted message and session key caches", &no_cache),
+			OPT_LONG_BOOL("rebuild-cache", "discard and rebuild the decrypted message cache", &rebuild_cache),
+			OPT_LONG_BOOL("new", "only show messages received since the last read --new", &new_only),
+			OPT_LONG_INT("skip", "skip the given number of most recent messages", &skip),
+			OPT_LONG_INT("page", "show the given page of messages (see --max-count)", &page),
+			OPT_LONG_STRING("cursor", "token", "show messages older than the given cursor", &cursor),
+			OPT_LONG_STRING("since", "date", "show messages sent on or after the given date", &since),
+			OPT_LONG_STRING("until", "date", "show messages sent on or before the given date", &until),
+			OPT_LONG_STRING("author", "pattern", "show messages from authors matching the given pattern", &author),
 			OPT_BOOL('h', "help", "show usage and exit", &show_help),
 			OPT_END()
 	};
@@ -102,11 +660,87 @@ int cmd_read(int argc, char *argv[])
 		return 1;
 	}
 
+	if (no_cache && rebuild_cache) {
+		show_usage_with_options(read_cmd_usage, options, 1,
+				"error: --no-cache and --rebuild-cache are mutually exclusive.");
+		return 1;
+	}
+
+	struct message_index_filter filter = { .author = author };
+	if (since && parse_date(since, 0, &filter.since)) {
+		show_usage_with_options(read_cmd_usage, options, 1,
+				"error: invalid --since date '%s'.", since);
+		return 1;
+	}
+
+	if (until && parse_date(until, 1, &filter.until)) {
+		show_usage_with_options(read_cmd_usage, options, 1,
+				"error: invalid --until date '%s'.", until);
+		return 1;
+	}
+
+	filter.has_since = since != NULL;
+	filter.has_until = until != NULL;
+
+	int filtered = since || until || author;
+	int indexed = skip >= 0 || page >= 0 || cursor || filtered;
+	if ((new_only || indexed) && argc) {
+		show_usage_with_options(read_cmd_usage, options, 1,
+				"error: --new, --skip, --page, --cursor, --since, --until and --author "
+				"cannot be used with a commit hash.");
+		return 1;
+	}
+
+	if (new_only && indexed) {
+		show_usage_with_options(read_cmd_usage, options, 1,
+				"error: --new cannot be used with --skip, --page, --cursor, --since, --until or --author.");
+		return 1;
+	}
+
+	if (page == 0) {
+		show_usage_with_options(read_cmd_usage, options, 1,
+				"error: pages are numbered from 1.");
+		return 1;
+	}
+
 	if (!is_inside_git_chat_space())
 		DIE("Where are you? It doesn't look like you're in the right directory.");
 
+	struct strbuf channel;
+	strbuf_init(&channel);
+	if ((new_only || indexed) && get_current_channel_ref(&channel))
+		DIE("--new, --skip, --page, --cursor, --since, --until and --author require a channel to be checked out.");
+
 	if (!isatty(STDOUT_FILENO))
 		no_color = 1;
 
-	return read_messages(argc ? argv[0] : NULL, limit, no_color);
+	// pages are only meaningful with a page size
+	if (page > 0 && limit < 0)
+		limit = READ_DEFAULT_PAGE_SIZE;
+
+	struct read_options opts = {
+			.commit = argc ? argv[0] : NULL,
+			.channel = channel.buff,
+			.new_only = new_only,
+			.indexed = indexed,
+			.limit = limit,
+			.skip = skip,
+			.page = page,
+			.cursor = cursor,
+			.filtered = filtered,
+			.filter = filter,
+			.no_color = no_color,
+			.cache_mode = CACHE_ENABLED,
+			.jobs = decryption_pool_resolve_jobs(jobs)
+	};
+
+	if (no_cache)
+		opts.cache_mode = CACHE_DISABLED;
+	else if (rebuild_cache)
+		opts.cache_mode = CACHE_REBUILD;
+
+	int ret = read_messages(&opts);
+
+	strbuf_release(&channel);
+	return ret;
 }
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "cache/message-cache.h"
+#include "cache/message-index.h"
+#include "cache/search-index.h"
+#include "git/git.h"
+#include "git/graph-traversal.h"
+#include "gnupg/gpg-common.h"
+#include "working-tree.h"
+#include "parse-options.h"
+#include "paging.h"
+#include "utils.h"
+
+static const struct usage_string search_cmd_usage[] = {
+		USAGE("git chat search [(-n | --max-count) <n>] [--no-color] <query>..."),
+		USAGE("git chat search (-h | --help)"),
+		USAGE_END()
+};
+
+#define SEARCH_DEFAULT_LIMIT 10
+
+static int git_oid_cmp(const void *a, const void *b)
+{
+	return memcmp(((const struct git_oid *) a)->id, ((const struct git_oid *) b)->id,
+			GIT_RAW_OBJECT_ID);
+}
+
+static int index_plaintext_message_cb(struct git_commit_view *commit, void *data)
+{
+	struct search_index *search = (struct search_index *) data;
+	search_index_add(search, &commit->commit_id, commit->body, commit->body_len);
+
+	return 0;
+}
+
+/**
+ * Add the messages of the channel that are in the message cache but missing
+ * from the search index (for instance, messages that were read before the
+ * search index existed). Messages that were never decrypted are left out.
+ *
+ * The ids of the commits in the channel are written to `channel_oids`, sorted.
+ *
+ * Returns the result of reading plaintext commits.
+ * */
+static int update_search_index(struct search_index *search, struct message_cache *cache,
+		const struct message_index *index, struct git_oid *channel_oids)
+{
+	struct git_oid *plaintext = NULL;
+	size_t plaintext_len = 0;
+
+	for (size_t i = 0; i < index->count; i++) {
+		struct message_index_record record;
+		message_index_get(index, i, &record);
+		channel_oids[i] = record.oid;
+
+		if (search_index_contains(search, &record.oid))
+			continue;
+
+		struct message_cache_entry *entry = message_cache_get(cache, &record.oid);
+		if (!entry)
+			continue;
+
+		if (entry->type == DECRYPTED) {
+			search_index_add(search, &record.oid, entry->message.buff, entry->message.len);
+			continue;
+		}
+
+		// the text of plaintext messages is the commit body
+		if (!plaintext) {
+			plaintext = (struct git_oid *) malloc(index->count * sizeof(struct git_oid));
+			if (!plaintext)
+				FATAL(MEM_ALLOC_FAILED);
+		}
+
+		plaintext[plaintext_len++] = record.oid;
+	}
+
+	qsort(channel_oids, index->count, sizeof(struct git_oid), git_oid_cmp);
+
+	int ret = read_commit_views(plaintext, plaintext_len, index_plaintext_message_cb, search);
+	free(plaintext);
+
+	return ret;
+}
+
+struct print_result_context {
+	struct message_cache *cache;
+	struct git_commit commit;
+	int no_color;
+};
+
+static int print_result_cb(struct git_commit_view *view, void *data)
+{
+	struct print_result_context *ctx = (struct print_result_context *) data;
+	git_commit_from_view(&ctx->commit, view);
+
+	struct message_cache_entry *entry = message_cache_get(ctx->cache, &view->commit_id);
+	if (!entry) {
+		struct strbuf message;
+		strbuf_init(&message);
+		strbuf_attach_str(&message, "message is no longer cached; use git chat read to show it.");
+		pretty_print_message(&ctx->commit, &message, UNKNOWN_ERROR, ctx->no_color, STDOUT_FILENO);
+		strbuf_release(&message);
+	} else if (entry->type == DECRYPTED) {
+		pretty_print_message(&ctx->commit, &entry->message, DECRYPTED, ctx->no_color, STDOUT_FILENO);
+	} else {
+		pretty_print_message(&ctx->commit, &ctx->commit.body, PLAINTEXT, ctx->no_color, STDOUT_FILENO);
+	}
+
+	fflush(stdout);
+	return 0;
+}
+
+/**
+ * Search the messages of `channel` for `query`, showing at most `limit` of the
+ * best matches in the pager.
+ *
+ * Dies if the query is invalid. Returns zero.
+ * */
+static int search_messages(const char *channel, const char *query, int limit, int no_color)
+{
+	struct gc_gpgme_ctx gpg_ctx;
+	struct message_cache cache;
+	struct search_index search;
+	struct message_index index;
+	gpgme_context_init(&gpg_ctx, 0);
+
+	message_cache_init(&cache);
+	if (message_cache_load(&cache, &gpg_ctx))
+		LOG_WARN("message cache could not be loaded");
+
+	search_index_init(&search);
+	if (search_index_load(&search, &gpg_ctx))
+		LOG_WARN("search index could not be loaded and will be rebuilt");
+
+	if (message_index_update(channel))
+		LOG_WARN("unable to update the message index for '%s'", channel);
+	if (message_index_open(&index, channel))
+		DIE("unable to read the message index for '%s'", channel);
+
+	struct git_oid *channel_oids =
+			(struct git_oid *) malloc((index.count + 1) * sizeof(struct git_oid));
+	if (!channel_oids)
+		FATAL(MEM_ALLOC_FAILED);
+
+	if (update_search_index(&search, &cache, &index, channel_oids))
+		LOG_WARN("unable to index some plaintext messages");
+	if (search_index_write(&search, &gpg_ctx))
+		LOG_WARN("unable to update search index");
+
+	struct search_result *results = NULL;
+	size_t results_len = 0;
+	if (search_index_query(&search, query, &results, &results_len))
+		DIE("invalid query '%s'", query);
+
+	struct git_oid *shown =
+			(struct git_oid *) malloc((results_len + 1) * sizeof(struct git_oid));
+	if (!shown)
+		FATAL(MEM_ALLOC_FAILED);
+
+	// keep only the best matches within the current channel
+	size_t matches = 0;
+	for (size_t i = 0; i < results_len && (limit < 0 || matches < (size_t) limit); i++) {
+		if (bsearch(&results[i].oid, channel_oids, index.count, sizeof(struct git_oid), git_oid_cmp))
+			shown[matches++] = results[i].oid;
+	}
+
+	if (!matches) {
+		printf("no messages match '%s'\n", query);
+	} else {
+		struct print_result_context ctx = { .cache = &cache, .no_color = no_color };
+		git_commit_object_init(&ctx.commit);
+
+		pager_start(GIT_CHAT_PAGER_RAW_CTRL_CHR | GIT_CHAT_PAGER_CLR_SCRN);
+		if (read_commit_views(shown, matches, print_result_cb, &ctx))
+			FATAL("unable to read matching messages");
+
+		git_commit_object_release(&ctx.commit);
+	}
+
+	free(shown);
+	free(results);
+	free(channel_oids);
+	message_index_close(&index);
+	search_index_release(&search);
+	message_cache_release(&cache);
+	gpgme_context_release(&gpg_ctx);
+
+	return 0;
+}
+
+/**
+ * Join the query arguments into a single query. Arguments containing
+ * whitespace (e.g. `git chat search "some phrase"`) are quoted, so that they
+ * are searched as phrases.
+ * */
+static void build_query(int argc, char *argv[], struct strbuf *query)
+{
+	for (int i = 0; i < argc; i++) {
+		if (i)
+			strbuf_attach_chr(query, ' ');
+
+		if (strpbrk(argv[i], " \t\n") && !strchr(argv[i], '"'))
+			strbuf_attach_fmt(query, "\"%s\"", argv[i]);
+		else
+			strbuf_attach_str(query, argv[i]);
+	}
+}
+
+int cmd_search(int argc, char *argv[])
+{
+	int limit = SEARCH_DEFAULT_LIMIT;
+	int no_color = 0;
+	int show_help = 0;
+
+	const struct command_option options[] = {
+			OPT_INT('n', "max-count", "limit number of messages shown", &limit),
+			OPT_LONG_BOOL("no-color", "turn off colored message headers", &no_color),
+			OPT_BOOL('h', "help", "show usage and exit", &show_help),
+			OPT_END()
+	};
+
+	argc = parse_options(argc, argv, options, 1, 1);
+	if (show_help) {
+		show_usage_with_options(search_cmd_usage, options, 0, NULL);
+		return 0;
+	}
+
+	if (!argc) {
+		show_usage_with_options(search_cmd_usage, options, 1,
+				"error: no search query given.");
+		return 1;
+	}
+
+	if (!is_inside_git_chat_space())
+		DIE("Where are you? It doesn't look like you're in the right directory.");
+
+	struct strbuf channel;
+	strbuf_init(&channel);
+	if (get_current_channel_ref(&channel))
+		DIE("search requires a channel to be checked out.");
+
+	if (!isatty(STDOUT_FILENO))
+		no_color = 1;
+
+	struct strbuf query;
+	strbuf_init(&query);
+	build_query(argc, argv, &query);
+
+	int ret = search_messages(channel.buff, query.buff, limit, no_color);
+
+	strbuf_release(&query);
+	strbuf_release(&channel);
+	return ret;
+}
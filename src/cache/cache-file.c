@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "cache/cache-file.h"
+#include "gnupg/decryption.h"
+#include "gnupg/encryption.h"
+#include "gnupg/key-filter.h"
+#include "gnupg/key-manager.h"
+#include "working-tree.h"
+#include "fs-utils.h"
+#include "utils.h"
+
+/**
+ * Build the path to the cache file `name`.
+ * */
+static void get_cache_file_path(struct strbuf *path, const char *name)
+{
+	if (get_chat_cache_dir(path))
+		FATAL("unable to obtain the path to the chat cache");
+
+	strbuf_attach_fmt(path, "/%s", name);
+}
+
+int cache_file_read(struct gc_gpgme_ctx *ctx, const char *name,
+		struct strbuf *plaintext)
+{
+	struct strbuf path, ciphertext;
+	int ret = 0;
+
+	strbuf_init(&path);
+	get_cache_file_path(&path, name);
+
+	int fd = open(path.buff, O_RDONLY);
+	if (fd < 0) {
+		LOG_DEBUG("no cache exists at '%s'", path.buff);
+		strbuf_release(&path);
+		return 1;
+	}
+
+	strbuf_init(&ciphertext);
+	strbuf_attach_fd(&ciphertext, fd);
+	close(fd);
+
+	LOG_INFO("loading cache from '%s'", path.buff);
+
+	if (decrypt_asymmetric_message(ctx, &ciphertext, plaintext)) {
+		LOG_WARN("unable to decrypt cache '%s'", path.buff);
+		memset(plaintext->buff, 0, plaintext->alloc);
+		strbuf_clear(plaintext);
+		ret = -1;
+	}
+
+	strbuf_release(&ciphertext);
+	strbuf_release(&path);
+
+	return ret;
+}
+
+// locks held by this process, most recently taken first
+static struct cache_lock *held_locks;
+static int exit_registered;
+
+/**
+ * Remove the lock files of locks still held when the process exits, such as
+ * when FATAL() is called while a cache is being updated.
+ * */
+static void remove_held_locks(void)
+{
+	for (struct cache_lock *lock = held_locks; lock; lock = lock->next)
+		unlink(lock->lock_path.buff);
+
+	held_locks = NULL;
+}
+
+static void hold_lock(struct cache_lock *lock)
+{
+	if (!exit_registered) {
+		atexit(remove_held_locks);
+		exit_registered = 1;
+	}
+
+	lock->next = held_locks;
+	held_locks = lock;
+}
+
+static void release_lock(struct cache_lock *lock)
+{
+	for (struct cache_lock **it = &held_locks; *it; it = &(*it)->next) {
+		if (*it == lock) {
+			*it = lock->next;
+			break;
+		}
+	}
+
+	close(lock->fd);
+	strbuf_release(&lock->lock_path);
+	strbuf_release(&lock->path);
+}
+
+/**
+ * Read the pid recorded in the lock file `lock_path`.
+ *
+ * Returns the pid, or zero if the lock file does not hold one (for instance,
+ * if its holder crashed while writing the new cache file).
+ * */
+static pid_t read_lock_pid(const char *lock_path)
+{
+	char buffer[32];
+
+	int fd = open(lock_path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	ssize_t len = xread(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	buffer[len] = 0;
+
+	char *tailptr = NULL;
+	long pid = strtol(buffer, &tailptr, 10);
+	if (pid <= 0 || *tailptr != '\n')
+		return 0;
+
+	return (pid_t) pid;
+}
+
+/**
+ * Remove the lock file `lock_path` if it is stale: its holder no longer
+ * exists, or it holds no pid and is older than CACHE_LOCK_STALE_SECONDS.
+ *
+ * A lock held by a live process is never stale, however long it is held. A
+ * lock briefly holds no pid while it is created and while the new cache file
+ * is written to it, so a lock without a pid is only reclaimed once it is old
+ * enough that its holder can't still be writing to it.
+ *
+ * Returns zero if the stale lock was removed, and non-zero otherwise.
+ * */
+static int reclaim_stale_lock(const char *lock_path)
+{
+	struct stat st, current;
+
+	if (lstat(lock_path, &st))
+		return 1;
+
+	pid_t pid = read_lock_pid(lock_path);
+	int dead = pid && kill(pid, 0) < 0 && errno == ESRCH;
+	int expired = !pid && time(NULL) - st.st_mtime > CACHE_LOCK_STALE_SECONDS;
+	if (!dead && !expired)
+		return 1;
+
+	// don't remove a fresh lock taken by another process in the meantime
+	if (lstat(lock_path, &current) || current.st_ino != st.st_ino ||
+			current.st_mtime != st.st_mtime)
+		return 1;
+
+	if (dead)
+		WARN("removing stale lock '%s' left by process %d, which no longer exists",
+				lock_path, (int) pid);
+	else
+		WARN("removing stale lock '%s' without an owner, older than %d seconds",
+				lock_path, CACHE_LOCK_STALE_SECONDS);
+
+	return unlink(lock_path) < 0;
+}
+
+static int create_lock_file(const char *lock_path)
+{
+	return open(lock_path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+}
+
+int cache_file_lock(struct cache_lock *lock, const char *name)
+{
+	strbuf_init(&lock->path);
+	strbuf_init(&lock->lock_path);
+	get_cache_file_path(&lock->path, name);
+	strbuf_attach_fmt(&lock->lock_path, "%s.lock", lock->path.buff);
+
+	lock->fd = create_lock_file(lock->lock_path.buff);
+	if (lock->fd < 0 && errno == ENOENT) {
+		// cache directory may not exist in spaces that were cloned
+		struct strbuf cache_dir;
+		strbuf_init(&cache_dir);
+		if (get_chat_cache_dir(&cache_dir))
+			FATAL("failed to obtain chat cache dir");
+
+		safe_create_dir(cache_dir.buff, NULL, S_IRWXU);
+		strbuf_release(&cache_dir);
+
+		lock->fd = create_lock_file(lock->lock_path.buff);
+	}
+
+	if (lock->fd < 0 && errno == EEXIST && !reclaim_stale_lock(lock->lock_path.buff))
+		lock->fd = create_lock_file(lock->lock_path.buff);
+
+	if (lock->fd < 0) {
+		LOG_WARN("unable to lock cache '%s'; %s", lock->lock_path.buff, strerror(errno));
+		strbuf_release(&lock->lock_path);
+		strbuf_release(&lock->path);
+		return 1;
+	}
+
+	hold_lock(lock);
+
+	// the pid of the holder tells other processes whether the lock is stale
+	char pid[32];
+	int pid_len = snprintf(pid, sizeof(pid), "%d\n", (int) getpid());
+	if (xwrite(lock->fd, pid, pid_len) != pid_len) {
+		LOG_WARN(FILE_WRITE_FAILED, lock->lock_path.buff);
+		cache_file_rollback(lock);
+		return 1;
+	}
+
+	return 0;
+}
+
+int cache_file_commit(struct cache_lock *lock, const char *data, size_t len)
+{
+	int ret = 0;
+
+	// replace the pid with the new content of the cache file
+	if (lseek(lock->fd, 0, SEEK_SET) < 0 || ftruncate(lock->fd, 0) < 0) {
+		LOG_WARN(FILE_WRITE_FAILED, lock->lock_path.buff);
+		unlink(lock->lock_path.buff);
+		ret = 1;
+	} else if (xwrite(lock->fd, data, len) != (ssize_t) len) {
+		LOG_WARN(FILE_WRITE_FAILED, lock->lock_path.buff);
+		unlink(lock->lock_path.buff);
+		ret = 1;
+	} else if (rename(lock->lock_path.buff, lock->path.buff) < 0) {
+		LOG_WARN("unable to replace cache '%s'", lock->path.buff);
+		unlink(lock->lock_path.buff);
+		ret = 1;
+	}
+
+	release_lock(lock);
+
+	return ret;
+}
+
+void cache_file_rollback(struct cache_lock *lock)
+{
+	unlink(lock->lock_path.buff);
+	release_lock(lock);
+}
+
+int cache_file_commit_encrypted(struct gc_gpgme_ctx *ctx, struct cache_lock *lock,
+		const struct strbuf *plaintext)
+{
+	struct gpg_key_set keys;
+	struct strbuf ciphertext;
+
+	// caches are encrypted to the user's own (usable) secret keys
+	gpg_key_set_init(&keys);
+	fetch_gpg_secret_key_set(ctx, &keys);
+	gpg_key_set_filter(&keys, filter_gpg_unusable_keys, NULL);
+	if (!keys.len) {
+		LOG_WARN("no usable secret keys available to encrypt the cache '%s'",
+				lock->path.buff);
+		gpg_key_set_release(&keys);
+		cache_file_rollback(lock);
+		return 1;
+	}
+
+	strbuf_init(&ciphertext);
+	asymmetric_encrypt_plaintext_message(ctx, plaintext, &ciphertext, &keys);
+
+	int ret = cache_file_commit(lock, ciphertext.buff, ciphertext.len);
+
+	strbuf_release(&ciphertext);
+	gpg_key_set_release(&keys);
+
+	return ret;
+}
+
+int cache_file_write(struct gc_gpgme_ctx *ctx, const char *name,
+		const struct strbuf *plaintext)
+{
+	struct cache_lock lock;
+
+	if (cache_file_lock(&lock, name))
+		return 1;
+
+	return cache_file_commit_encrypted(ctx, &lock, plaintext);
+}
+
+void keyed_cache_init(struct keyed_cache *cache, const struct keyed_cache_type *type)
+{
+	hashmap_init(&cache->entries, type->cmp, 0);
+	cache->type = type;
+	cache->dirty = 0;
+	cache->loaded = 0;
+}
+
+/**
+ * Parse the plaintext of a keyed cache file: the header of the cache type,
+ * followed by one record per entry.
+ *
+ * Returns zero if successful, and non-zero if the cache is malformed.
+ * */
+static int parse_keyed_cache(struct keyed_cache *cache, const char *data, size_t len)
+{
+	const char *end = data + len;
+	size_t header_len = strlen(cache->type->header);
+
+	if (len < header_len || memcmp(data, cache->type->header, header_len) != 0) {
+		LOG_WARN("%s has unexpected header", cache->type->name);
+		return 1;
+	}
+
+	data += header_len;
+	while (data < end) {
+		size_t record_len = cache->type->parse(cache, data, end - data);
+		if (!record_len)
+			return 1;
+
+		data += record_len;
+	}
+
+	return 0;
+}
+
+int keyed_cache_load(struct keyed_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	struct strbuf plaintext;
+	strbuf_init(&plaintext);
+
+	int ret = cache_file_read(ctx, cache->type->file, &plaintext);
+	if (ret > 0) {
+		strbuf_release(&plaintext);
+		return 0;
+	}
+
+	if (!ret && parse_keyed_cache(cache, plaintext.buff, plaintext.len)) {
+		LOG_WARN("%s is malformed", cache->type->name);
+		ret = 1;
+	}
+
+	if (ret) {
+		// start from an empty cache; it will be rebuilt on write
+		const struct keyed_cache_type *type = cache->type;
+		keyed_cache_release(cache);
+		keyed_cache_init(cache, type);
+	}
+
+	// entries loaded from disk don't need to be written back
+	cache->dirty = 0;
+	cache->loaded = !ret;
+
+	LOG_INFO("loaded %zu %s from the %s", cache->entries.size, cache->type->entries,
+			cache->type->name);
+
+	memset(plaintext.buff, 0, plaintext.alloc);
+	strbuf_release(&plaintext);
+
+	return ret != 0;
+}
+
+void *keyed_cache_get(struct keyed_cache *cache, const void *key, const void *keydata)
+{
+	return hashmap_get(&cache->entries, key, keydata);
+}
+
+static int keyed_cache_stored(struct keyed_cache *cache, const void *entry)
+{
+	return !cache->type->stored || cache->type->stored(entry);
+}
+
+void keyed_cache_put(struct keyed_cache *cache, void *entry)
+{
+	// replacing an entry with the same value doesn't change the cache
+	void *existing = hashmap_get(&cache->entries, entry, NULL);
+	if (existing && cache->type->same_value(existing, entry)) {
+		cache->type->free(entry);
+		return;
+	}
+
+	void *old = hashmap_put(&cache->entries, entry);
+	if (old)
+		cache->type->free(old);
+
+	if (keyed_cache_stored(cache, entry))
+		cache->dirty = 1;
+}
+
+/**
+ * Move the entries of the cache file that are missing from `cache` into it,
+ * such as those cached by other processes since `cache` was loaded.
+ * */
+static void merge_keyed_cache_file(struct keyed_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	struct keyed_cache on_disk;
+	struct hashmap_iter iter;
+	void *entry;
+
+	keyed_cache_init(&on_disk, cache->type);
+	if (keyed_cache_load(&on_disk, ctx)) {
+		keyed_cache_release(&on_disk);
+		return;
+	}
+
+	// the iterator moves past an entry before returning it, so the entry can
+	// be moved to the other hashmap
+	hashmap_iter_init(&on_disk.entries, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		if (hashmap_get(&cache->entries, entry, NULL))
+			cache->type->free(entry);
+		else
+			hashmap_add(&cache->entries, entry);
+	}
+
+	hashmap_release(&on_disk.entries, 0);
+}
+
+int keyed_cache_write(struct keyed_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	struct hashmap_iter iter;
+	struct cache_lock lock;
+	struct strbuf plaintext;
+	void *entry;
+	size_t written = 0;
+
+	if (!cache->dirty)
+		return 0;
+
+	if (cache_file_lock(&lock, cache->type->file))
+		return 1;
+
+	// the cache file is re-read under the lock, so that entries cached by
+	// concurrent processes aren't dropped
+	if (cache->loaded)
+		merge_keyed_cache_file(cache, ctx);
+
+	strbuf_init(&plaintext);
+	strbuf_attach_str(&plaintext, cache->type->header);
+
+	hashmap_iter_init(&cache->entries, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		if (!keyed_cache_stored(cache, entry))
+			continue;
+
+		cache->type->serialize(entry, &plaintext);
+		written++;
+	}
+
+	int ret = cache_file_commit_encrypted(ctx, &lock, &plaintext);
+	if (!ret) {
+		LOG_INFO("wrote %zu %s to the %s", written, cache->type->entries,
+				cache->type->name);
+		cache->dirty = 0;
+	}
+
+	memset(plaintext.buff, 0, plaintext.alloc);
+	strbuf_release(&plaintext);
+
+	return ret;
+}
+
+void keyed_cache_release(struct keyed_cache *cache)
+{
+	struct hashmap_iter iter;
+	void *entry;
+
+	hashmap_iter_init(&cache->entries, &iter);
+	while ((entry = hashmap_iter_next(&iter)))
+		cache->type->free(entry);
+
+	hashmap_release(&cache->entries, 0);
+	cache->dirty = 0;
+	cache->loaded = 0;
+}
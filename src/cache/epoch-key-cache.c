@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/epoch-key-cache.h"
+#include "utils.h"
+
+static int epoch_key_cache_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct epoch_key_cache_entry *a = entry;
+	const struct epoch_key_cache_entry *b = entry_or_key;
+
+	return strcmp(a->id, keydata ? (const char *) keydata : b->id);
+}
+
+static void epoch_key_cache_entry_free(void *data)
+{
+	struct epoch_key_cache_entry *entry = data;
+
+	memset(entry->key.buff, 0, entry->key.alloc);
+	strbuf_release(&entry->key);
+	free(entry);
+}
+
+static int epoch_key_cache_entry_same(const void *a, const void *b)
+{
+	const struct epoch_key_cache_entry *x = a;
+	const struct epoch_key_cache_entry *y = b;
+
+	return !strcmp(x->key.buff, y->key.buff);
+}
+
+/**
+ * Epochs that could not be unwrapped are only remembered in memory.
+ * */
+static int epoch_key_cache_entry_stored(const void *data)
+{
+	const struct epoch_key_cache_entry *entry = data;
+
+	return entry->key.len != 0;
+}
+
+static void put_epoch_key(struct keyed_cache *cache, const char *id,
+		const char *key, size_t len)
+{
+	if (!group_key_is_epoch_id(id))
+		BUG("malformed epoch id '%s'", id);
+
+	struct epoch_key_cache_entry *entry =
+			(struct epoch_key_cache_entry *) malloc(sizeof(struct epoch_key_cache_entry));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, strhash(id));
+	memcpy(entry->id, id, GROUP_KEY_EPOCH_ID_LEN + 1);
+
+	strbuf_init(&entry->key);
+	if (key)
+		strbuf_attach(&entry->key, key, len);
+
+	keyed_cache_put(cache, entry);
+}
+
+/**
+ * Parse a record of an epoch key cache file. Each epoch key is stored on its
+ * own line:
+ *
+ * <epoch id> <epoch key>
+ * */
+static size_t parse_epoch_key(struct keyed_cache *cache, const char *data, size_t len)
+{
+	char id[GROUP_KEY_EPOCH_ID_LEN + 1];
+
+	const char *lf = memchr(data, '\n', len);
+	if (!lf || (lf - data) < (GROUP_KEY_EPOCH_ID_LEN + 2) || data[GROUP_KEY_EPOCH_ID_LEN] != ' ')
+		return 0;
+
+	memcpy(id, data, GROUP_KEY_EPOCH_ID_LEN);
+	id[GROUP_KEY_EPOCH_ID_LEN] = 0;
+	if (!group_key_is_epoch_id(id))
+		return 0;
+
+	const char *key = data + GROUP_KEY_EPOCH_ID_LEN + 1;
+	put_epoch_key(cache, id, key, lf - key);
+
+	return lf + 1 - data;
+}
+
+static void serialize_epoch_key(void *data, struct strbuf *out)
+{
+	struct epoch_key_cache_entry *entry = data;
+
+	strbuf_attach_fmt(out, "%s %s\n", entry->id, entry->key.buff);
+}
+
+static const struct keyed_cache_type epoch_key_cache_type = {
+	.file = "epoch-keys",
+	.header = "git-chat epoch key cache v1\n",
+	.name = "epoch key cache",
+	.entries = "epoch keys",
+	.cmp = epoch_key_cache_entry_cmp,
+	.parse = parse_epoch_key,
+	.serialize = serialize_epoch_key,
+	.same_value = epoch_key_cache_entry_same,
+	.stored = epoch_key_cache_entry_stored,
+	.free = epoch_key_cache_entry_free
+};
+
+void epoch_key_cache_init(struct epoch_key_cache *cache)
+{
+	keyed_cache_init(&cache->cache, &epoch_key_cache_type);
+}
+
+int epoch_key_cache_load(struct epoch_key_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	return keyed_cache_load(&cache->cache, ctx);
+}
+
+struct epoch_key_cache_entry *epoch_key_cache_get(struct epoch_key_cache *cache,
+		const char *id)
+{
+	struct epoch_key_cache_entry key;
+	hashmap_entry_init(&key, strhash(id));
+
+	return keyed_cache_get(&cache->cache, &key, id);
+}
+
+void epoch_key_cache_put(struct epoch_key_cache *cache, const char *id, const char *key)
+{
+	put_epoch_key(&cache->cache, id, key, key ? strlen(key) : 0);
+}
+
+const char *epoch_key_cache_resolve(struct epoch_key_cache *cache,
+		struct gc_gpgme_ctx *ctx, const char *id, const struct git_oid *commit)
+{
+	struct epoch_key_cache_entry *entry = epoch_key_cache_get(cache, id);
+	if (entry)
+		return entry->key.len ? entry->key.buff : NULL;
+
+	struct group_epoch epoch;
+	group_epoch_init(&epoch);
+
+	int ret = group_epoch_read(&epoch, id, commit);
+	if (!ret)
+		ret = group_epoch_unwrap(ctx, &epoch);
+
+	epoch_key_cache_put(cache, id, ret ? NULL : epoch.key.buff);
+	group_epoch_release(&epoch);
+
+	entry = epoch_key_cache_get(cache, id);
+	return entry->key.len ? entry->key.buff : NULL;
+}
+
+int epoch_key_cache_write(struct epoch_key_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	return keyed_cache_write(&cache->cache, ctx);
+}
+
+void epoch_key_cache_release(struct epoch_key_cache *cache)
+{
+	keyed_cache_release(&cache->cache);
+}
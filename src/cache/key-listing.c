@@ -0,0 +1,682 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache/key-listing.h"
+#include "cache/cache-file.h"
+#include "gnupg/key-manager.h"
+#include "working-tree.h"
+#include "utils.h"
+
+#define KEY_LISTING_FILE "key-listing"
+#define KEY_LISTING_HEADER "git-chat key listing v1\n"
+
+static int key_listing_match_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct key_listing_match *a = entry;
+	const struct key_listing_match *b = entry_or_key;
+
+	return strcmp(a->value, keydata ? (const char *) keydata : b->value);
+}
+
+void key_listing_init(struct key_listing *listing)
+{
+	memset(&listing->pubring, 0, sizeof(struct keyring_stamp));
+	memset(&listing->secring, 0, sizeof(struct keyring_stamp));
+	listing->keys = NULL;
+	listing->len = 0;
+	listing->alloc = 0;
+	hashmap_init(&listing->index, key_listing_match_cmp, 0);
+	listing->indexed = 0;
+	arena_init(&listing->arena, 0);
+}
+
+void key_listing_release(struct key_listing *listing)
+{
+	hashmap_release(&listing->index, 1);
+	arena_release(&listing->arena);
+	free(listing->keys);
+
+	listing->keys = NULL;
+	listing->len = 0;
+	listing->alloc = 0;
+	listing->indexed = 0;
+}
+
+static void key_listing_invalidate(struct key_listing *listing)
+{
+	if (!listing->indexed)
+		return;
+
+	hashmap_release(&listing->index, 1);
+	hashmap_init(&listing->index, key_listing_match_cmp, 0);
+	listing->indexed = 0;
+}
+
+static char *key_listing_strndup(struct key_listing *listing, const char *str, size_t len)
+{
+	char *copy = arena_alloc(&listing->arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = 0;
+
+	return copy;
+}
+
+/**
+ * Append a new key with the given fingerprint to the listing.
+ * */
+static struct key_listing_entry *key_listing_add(struct key_listing *listing,
+		const char *fpr, size_t fpr_len)
+{
+	if (listing->len >= listing->alloc) {
+		size_t alloc = listing->alloc ? listing->alloc * 2 : 16;
+		struct key_listing_entry *keys = realloc(listing->keys,
+				alloc * sizeof(struct key_listing_entry));
+		if (!keys)
+			FATAL(MEM_ALLOC_FAILED);
+
+		listing->keys = keys;
+		listing->alloc = alloc;
+	}
+
+	key_listing_invalidate(listing);
+
+	struct key_listing_entry *key = &listing->keys[listing->len++];
+	memset(key, 0, sizeof(struct key_listing_entry));
+	key->fpr = key_listing_strndup(listing, fpr, fpr_len);
+
+	return key;
+}
+
+/**
+ * Set the flags of a key from a flags string. Keys whose expiry has passed
+ * since the listing was taken are flagged as expired.
+ * */
+static void key_listing_set_flags(struct key_listing_entry *key, const char *flags,
+		size_t len, long expires)
+{
+	for (size_t i = 0; i < len; i++) {
+		switch (flags[i]) {
+			case 'r':
+				key->revoked = 1;
+				break;
+			case 'x':
+				key->expired = 1;
+				break;
+			case 'd':
+				key->disabled = 1;
+				break;
+			case 'i':
+				key->invalid = 1;
+				break;
+			case 'e':
+				key->can_encrypt = 1;
+				break;
+			case 's':
+				key->secret = 1;
+				break;
+		}
+	}
+
+	if (expires > 0 && expires <= (long) time(NULL))
+		key->expired = 1;
+
+	key->expires = expires;
+}
+
+/**
+ * Copy a user id field into the arena. NULL fields are kept as NULL.
+ * */
+static char *key_listing_copy_field(struct key_listing *listing, const char *field)
+{
+	return field ? key_listing_strndup(listing, field, strlen(field)) : NULL;
+}
+
+/**
+ * Append a snapshot of a key listed by gpgme.
+ * */
+static void key_listing_add_gpgme_key(struct key_listing *listing, gpgme_key_t key)
+{
+	if (!key->fpr)
+		return;
+
+	struct key_listing_entry *entry = key_listing_add(listing, key->fpr, strlen(key->fpr));
+	entry->revoked = key->revoked;
+	entry->expired = key->expired;
+	entry->disabled = key->disabled;
+	entry->invalid = key->invalid;
+	entry->can_encrypt = key->can_encrypt;
+	entry->secret = key->secret;
+	key_listing_set_flags(entry, NULL, 0, key->subkeys ? key->subkeys->expires : 0);
+
+	struct key_listing_uid **tail = &entry->uids;
+	for (gpgme_user_id_t uid = key->uids; uid; uid = uid->next) {
+		struct key_listing_uid *copy = arena_alloc(&listing->arena,
+				sizeof(struct key_listing_uid));
+
+		copy->uid = key_listing_copy_field(listing, uid->uid);
+		copy->name = key_listing_copy_field(listing, uid->name);
+		copy->email = key_listing_copy_field(listing, uid->email);
+		copy->comment = key_listing_copy_field(listing, uid->comment);
+		copy->address = key_listing_copy_field(listing, uid->address);
+		copy->next = NULL;
+
+		*tail = copy;
+		tail = &copy->next;
+	}
+}
+
+size_t key_listing_filter(struct key_listing *listing,
+		int (*predicate)(const struct key_listing_entry *key, void *data),
+		void *optional_data)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < listing->len; i++) {
+		if (predicate(&listing->keys[i], optional_data))
+			listing->keys[kept++] = listing->keys[i];
+	}
+
+	size_t removed = listing->len - kept;
+	if (removed) {
+		key_listing_invalidate(listing);
+		listing->len = kept;
+	}
+
+	return removed;
+}
+
+size_t key_listing_retain(struct key_listing *listing, const unsigned char *retain)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < listing->len; i++) {
+		if (retain[i])
+			listing->keys[kept++] = listing->keys[i];
+	}
+
+	size_t removed = listing->len - kept;
+	if (removed) {
+		key_listing_invalidate(listing);
+		listing->len = kept;
+	}
+
+	return removed;
+}
+
+static void key_listing_index_value(struct key_listing *listing, const char *value,
+		size_t pos)
+{
+	if (!value)
+		return;
+
+	struct key_listing_match *match = malloc(sizeof(struct key_listing_match));
+	if (!match)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(match, strhash(value));
+	match->value = value;
+	match->pos = pos;
+
+	hashmap_add(&listing->index, match);
+}
+
+/**
+ * Build the index over the keys in the listing.
+ * */
+static void key_listing_index(struct key_listing *listing)
+{
+	for (size_t pos = 0; pos < listing->len; pos++) {
+		struct key_listing_entry *key = &listing->keys[pos];
+		key_listing_index_value(listing, key->fpr, pos);
+
+		for (struct key_listing_uid *uid = key->uids; uid; uid = uid->next) {
+			key_listing_index_value(listing, uid->uid, pos);
+			key_listing_index_value(listing, uid->name, pos);
+			key_listing_index_value(listing, uid->email, pos);
+			key_listing_index_value(listing, uid->comment, pos);
+			key_listing_index_value(listing, uid->address, pos);
+		}
+	}
+
+	listing->indexed = 1;
+}
+
+const struct key_listing_match *key_listing_lookup(struct key_listing *listing,
+		const char *value)
+{
+	struct key_listing_match key;
+
+	if (!listing->indexed)
+		key_listing_index(listing);
+
+	hashmap_entry_init(&key, strhash(value));
+	return hashmap_get(&listing->index, &key, value);
+}
+
+const struct key_listing_match *key_listing_lookup_next(struct key_listing *listing,
+		const struct key_listing_match *match)
+{
+	return hashmap_get_next(&listing->index, match);
+}
+
+int key_listing_filter_unusable(const struct key_listing_entry *key, void *data)
+{
+	// Unused
+	(void) data;
+
+	if (key->expired)
+		return 0;
+	if (key->disabled)
+		return 0;
+	if (key->invalid)
+		return 0;
+	if (key->revoked)
+		return 0;
+
+	return key->can_encrypt;
+}
+
+int key_listing_filter_secret(const struct key_listing_entry *key, void *data)
+{
+	// Unused
+	(void) data;
+
+	return !key->secret;
+}
+
+static void escape_field(struct strbuf *out, const char *field)
+{
+	for (const char *c = field ? field : ""; *c; c++) {
+		switch (*c) {
+			case '\\':
+				strbuf_attach_str(out, "\\\\");
+				break;
+			case '\t':
+				strbuf_attach_str(out, "\\t");
+				break;
+			case '\n':
+				strbuf_attach_str(out, "\\n");
+				break;
+			default:
+				strbuf_attach(out, c, 1);
+		}
+	}
+}
+
+/**
+ * Unescape the user id field between `start` and `end` into the arena.
+ *
+ * Returns the field, or NULL if the escaping is malformed.
+ * */
+static char *unescape_field(struct key_listing *listing, const char *start, const char *end)
+{
+	char *field = arena_alloc(&listing->arena, end - start + 1);
+	size_t len = 0;
+
+	for (const char *c = start; c < end; c++) {
+		if (*c != '\\') {
+			field[len++] = *c;
+			continue;
+		}
+
+		if (++c >= end)
+			return NULL;
+
+		switch (*c) {
+			case '\\':
+				field[len++] = '\\';
+				break;
+			case 't':
+				field[len++] = '\t';
+				break;
+			case 'n':
+				field[len++] = '\n';
+				break;
+			default:
+				return NULL;
+		}
+	}
+
+	field[len] = 0;
+	return field;
+}
+
+static void serialize_stamp(struct strbuf *out, const char *name,
+		const struct keyring_stamp *stamp)
+{
+	strbuf_attach_fmt(out, "%s %lld %lld %ld\n", name, (long long) stamp->size,
+			(long long) stamp->mtime_sec, stamp->mtime_nsec);
+}
+
+void key_listing_serialize(struct key_listing *listing, struct strbuf *out)
+{
+	strbuf_attach_str(out, KEY_LISTING_HEADER);
+	serialize_stamp(out, "pubring", &listing->pubring);
+	serialize_stamp(out, "secring", &listing->secring);
+
+	for (size_t i = 0; i < listing->len; i++) {
+		struct key_listing_entry *key = &listing->keys[i];
+
+		strbuf_attach_fmt(out, "key %s ", key->fpr);
+		size_t flags_start = out->len;
+		if (key->revoked)
+			strbuf_attach_str(out, "r");
+		if (key->expired)
+			strbuf_attach_str(out, "x");
+		if (key->disabled)
+			strbuf_attach_str(out, "d");
+		if (key->invalid)
+			strbuf_attach_str(out, "i");
+		if (key->can_encrypt)
+			strbuf_attach_str(out, "e");
+		if (key->secret)
+			strbuf_attach_str(out, "s");
+		if (out->len == flags_start)
+			strbuf_attach_str(out, "-");
+		strbuf_attach_fmt(out, " %ld\n", key->expires);
+
+		for (struct key_listing_uid *uid = key->uids; uid; uid = uid->next) {
+			strbuf_attach_str(out, "uid ");
+			escape_field(out, uid->uid);
+			strbuf_attach_str(out, "\t");
+			escape_field(out, uid->name);
+			strbuf_attach_str(out, "\t");
+			escape_field(out, uid->email);
+			strbuf_attach_str(out, "\t");
+			escape_field(out, uid->comment);
+			strbuf_attach_str(out, "\t");
+			escape_field(out, uid->address);
+			strbuf_attach_str(out, "\n");
+		}
+	}
+}
+
+/**
+ * Parse a `<name> <size> <mtime seconds> <mtime nanoseconds>` stamp line.
+ *
+ * Returns zero if successful, and non-zero if the line is malformed.
+ * */
+static int parse_stamp(const char *line, size_t len, const char *name,
+		struct keyring_stamp *stamp)
+{
+	char buff[128];
+	long long size, sec;
+	long nsec;
+	char tail;
+
+	if (len >= sizeof(buff))
+		return 1;
+
+	memcpy(buff, line, len);
+	buff[len] = 0;
+
+	size_t name_len = strlen(name);
+	if (strncmp(buff, name, name_len) || buff[name_len] != ' ')
+		return 1;
+	if (sscanf(buff + name_len, " %lld %lld %ld%c", &size, &sec, &nsec, &tail) != 3)
+		return 1;
+
+	stamp->size = size;
+	stamp->mtime_sec = sec;
+	stamp->mtime_nsec = nsec;
+
+	return 0;
+}
+
+int key_listing_parse(struct key_listing *listing, const char *data, size_t len)
+{
+	const char *pos = data;
+	const char *end = data + len;
+	size_t header_len = strlen(KEY_LISTING_HEADER);
+	struct key_listing_entry *key = NULL;
+	struct key_listing_uid **uid_tail = NULL;
+	int line_number = 0;
+
+	if (len < header_len || memcmp(data, KEY_LISTING_HEADER, header_len) != 0)
+		return 1;
+	pos += header_len;
+
+	while (pos < end) {
+		const char *lf = memchr(pos, '\n', end - pos);
+		if (!lf)
+			return 1;
+
+		size_t line_len = lf - pos;
+		line_number++;
+
+		if (line_number == 1) {
+			if (parse_stamp(pos, line_len, "pubring", &listing->pubring))
+				return 1;
+		} else if (line_number == 2) {
+			if (parse_stamp(pos, line_len, "secring", &listing->secring))
+				return 1;
+		} else if (line_len > 4 && !memcmp(pos, "key ", 4)) {
+			const char *fpr = pos + 4;
+			const char *sp = memchr(fpr, ' ', lf - fpr);
+			if (!sp || sp == fpr)
+				return 1;
+
+			const char *flags = sp + 1;
+			const char *flags_end = memchr(flags, ' ', lf - flags);
+			if (!flags_end || flags_end == flags || flags_end + 1 == lf)
+				return 1;
+
+			char *expires_end;
+			errno = 0;
+			long expires = strtol(flags_end + 1, &expires_end, 10);
+			if (errno || expires_end != lf)
+				return 1;
+
+			key = key_listing_add(listing, fpr, sp - fpr);
+			key_listing_set_flags(key, flags, flags_end - flags, expires);
+			uid_tail = &key->uids;
+		} else if (line_len >= 4 && !memcmp(pos, "uid ", 4)) {
+			char *fields[5];
+			const char *field = pos + 4;
+
+			if (!key)
+				return 1;
+
+			for (int i = 0; i < 5; i++) {
+				const char *field_end = i < 4 ? memchr(field, '\t', lf - field) : lf;
+				if (!field_end)
+					return 1;
+
+				fields[i] = unescape_field(listing, field, field_end);
+				if (!fields[i])
+					return 1;
+
+				field = field_end + 1;
+			}
+
+			struct key_listing_uid *uid = arena_alloc(&listing->arena,
+					sizeof(struct key_listing_uid));
+			uid->uid = fields[0];
+			uid->name = fields[1];
+			uid->email = fields[2];
+			uid->comment = fields[3];
+			uid->address = fields[4];
+			uid->next = NULL;
+
+			*uid_tail = uid;
+			uid_tail = &uid->next;
+		} else {
+			return 1;
+		}
+
+		pos = lf + 1;
+	}
+
+	return line_number < 2;
+}
+
+/**
+ * Stat the secret key store under the gpgme context home directory. With gpg
+ * 2.1 and later, secret keys are held by the agent as one file per key in
+ * `private-keys-v1.d`, so the directory changes whenever secret keys are added
+ * or removed. If there is no secret key store yet, the stamp is zeroed.
+ * */
+static void get_secret_key_store_stamp(struct gc_gpgme_ctx *ctx, struct keyring_stamp *stamp)
+{
+	static const char *stores[] = { "private-keys-v1.d", "secring.gpg" };
+	struct strbuf path;
+	struct stat st;
+
+	memset(stamp, 0, sizeof(struct keyring_stamp));
+
+	strbuf_init(&path);
+	for (size_t i = 0; i < sizeof(stores) / sizeof(stores[0]); i++) {
+		strbuf_clear(&path);
+		strbuf_attach_fmt(&path, "%s/%s", ctx->gnupg_homedir.buff, stores[i]);
+
+		if (!stat(path.buff, &st)) {
+			keyring_stamp_from_stat(stamp, &st);
+			break;
+		}
+	}
+
+	strbuf_release(&path);
+}
+
+/**
+ * Determine whether a keyring stamp recorded in a cache written at `written`
+ * still describes the keyring. As for the keyring manifest, a keyring modified
+ * in the same instant the cache was written is considered changed.
+ * */
+static int stamp_is_current(const struct keyring_stamp *recorded,
+		const struct keyring_stamp *current, const struct keyring_stamp *written)
+{
+	if (keyring_stamp_cmp(recorded, current))
+		return 0;
+
+	if (current->mtime_sec > written->mtime_sec)
+		return 0;
+	if (current->mtime_sec == written->mtime_sec &&
+			current->mtime_nsec >= written->mtime_nsec)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Load the snapshot from the key listing cache, if it is up to date with the
+ * given keyring stamps.
+ *
+ * Returns zero if successful, and non-zero otherwise, in which case the
+ * listing is left empty.
+ * */
+static int key_listing_load(struct key_listing *listing,
+		const struct keyring_stamp *pubring, const struct keyring_stamp *secring)
+{
+	struct strbuf path, contents;
+	struct keyring_stamp written;
+	struct stat st;
+	int ret = 0;
+
+	strbuf_init(&path);
+	if (get_chat_cache_dir(&path))
+		FATAL("unable to obtain the path to the chat cache");
+	strbuf_attach_fmt(&path, "/%s", KEY_LISTING_FILE);
+
+	int fd = open(path.buff, O_RDONLY);
+	if (fd < 0) {
+		LOG_DEBUG("no key listing cache exists at '%s'", path.buff);
+		strbuf_release(&path);
+		return 1;
+	}
+
+	if (fstat(fd, &st))
+		FATAL("unable to stat '%s'", path.buff);
+	keyring_stamp_from_stat(&written, &st);
+
+	strbuf_init(&contents);
+	strbuf_attach_fd(&contents, fd);
+	close(fd);
+
+	if (key_listing_parse(listing, contents.buff, contents.len)) {
+		LOG_WARN("key listing cache '%s' is malformed; ignoring", path.buff);
+		ret = 1;
+	} else if (!stamp_is_current(&listing->pubring, pubring, &written) ||
+			!stamp_is_current(&listing->secring, secring, &written)) {
+		LOG_INFO("keyring was modified since keys were last listed");
+		ret = 1;
+	}
+
+	if (ret) {
+		key_listing_release(listing);
+		key_listing_init(listing);
+	}
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+
+	return ret;
+}
+
+/**
+ * Write the listing to the key listing cache.
+ *
+ * Returns zero if successful, and non-zero otherwise.
+ * */
+static int key_listing_write(struct key_listing *listing)
+{
+	struct cache_lock lock;
+	struct strbuf contents;
+
+	if (cache_file_lock(&lock, KEY_LISTING_FILE))
+		return 1;
+
+	strbuf_init(&contents);
+	key_listing_serialize(listing, &contents);
+
+	int ret = cache_file_commit(&lock, contents.buff, contents.len);
+	strbuf_release(&contents);
+
+	return ret;
+}
+
+size_t key_listing_fetch(struct gc_gpgme_ctx *ctx, struct key_listing *listing,
+		int refresh)
+{
+	struct keyring_stamp pubring, secring;
+	gpgme_error_t err;
+	gpgme_key_t key;
+
+	get_gpg_keyring_stamp(ctx, &pubring);
+	get_secret_key_store_stamp(ctx, &secring);
+
+	if (!refresh && !key_listing_load(listing, &pubring, &secring)) {
+		LOG_INFO("loaded %zu gpg keys from the key listing cache", listing->len);
+		return listing->len;
+	}
+
+	LOG_INFO("listing keys from keyring under gpgme context home directory");
+
+	listing->pubring = pubring;
+	listing->secring = secring;
+
+	err = gpgme_op_keylist_start(ctx->gpgme_ctx, NULL, 0);
+	if (err)
+		GPG_FATAL("failed to begin a gpg key listing operation", err);
+
+	while (!(err = gpgme_op_keylist_next(ctx->gpgme_ctx, &key))) {
+		key_listing_add_gpgme_key(listing, key);
+		gpgme_key_release(key);
+	}
+
+	if (gpg_err_code(err) != GPG_ERR_EOF)
+		GPG_FATAL("failed to retrieve gpg keys from keyring", err);
+
+	LOG_INFO("successfully listed %zu gpg keys", listing->len);
+
+	if (key_listing_write(listing))
+		LOG_WARN("failed to update the key listing cache");
+
+	return listing->len;
+}
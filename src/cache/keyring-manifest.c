@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache/keyring-manifest.h"
+#include "cache/cache-file.h"
+#include "working-tree.h"
+#include "utils.h"
+
+#define KEYRING_MANIFEST_FILE "keyring-manifest"
+#define KEYRING_MANIFEST_HEADER "git-chat keyring manifest v1\n"
+
+static int keyring_manifest_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct keyring_manifest_entry *a = entry;
+	const struct keyring_manifest_entry *b = entry_or_key;
+
+	return strcmp(a->name, keydata ? (const char *) keydata : b->name);
+}
+
+void keyring_stamp_from_stat(struct keyring_stamp *stamp, const struct stat *st)
+{
+	stamp->size = (int64_t) st->st_size;
+	stamp->mtime_sec = (int64_t) st->st_mtim.tv_sec;
+	stamp->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+int keyring_stamp_cmp(const struct keyring_stamp *a, const struct keyring_stamp *b)
+{
+	return a->size != b->size || a->mtime_sec != b->mtime_sec ||
+			a->mtime_nsec != b->mtime_nsec;
+}
+
+void keyring_manifest_init(struct keyring_manifest *manifest)
+{
+	hashmap_init(&manifest->entries, keyring_manifest_entry_cmp, 0);
+	memset(&manifest->keyring, 0, sizeof(struct keyring_stamp));
+	memset(&manifest->written, 0, sizeof(struct keyring_stamp));
+}
+
+static void keyring_manifest_entry_free(struct keyring_manifest_entry *entry)
+{
+	if (!entry)
+		return;
+
+	str_array_release(&entry->fingerprints);
+	free(entry->name);
+	free(entry);
+}
+
+struct keyring_manifest_entry *keyring_manifest_get(struct keyring_manifest *manifest,
+		const char *name)
+{
+	struct keyring_manifest_entry key;
+	hashmap_entry_init(&key, strhash(name));
+
+	return hashmap_get(&manifest->entries, &key, name);
+}
+
+struct keyring_manifest_entry *keyring_manifest_put(struct keyring_manifest *manifest,
+		const char *name, const struct keyring_stamp *stamp,
+		const struct str_array *fingerprints)
+{
+	struct keyring_manifest_entry *entry = malloc(sizeof(struct keyring_manifest_entry));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, strhash(name));
+	entry->name = strdup(name);
+	if (!entry->name)
+		FATAL(MEM_ALLOC_FAILED);
+
+	entry->stamp = *stamp;
+	entry->seen = 0;
+	str_array_init(&entry->fingerprints);
+	for (size_t i = 0; fingerprints && i < fingerprints->len; i++)
+		str_array_push(&entry->fingerprints, str_array_get((struct str_array *) fingerprints, i), NULL);
+
+	keyring_manifest_entry_free(hashmap_put(&manifest->entries, entry));
+
+	return entry;
+}
+
+void keyring_manifest_remove(struct keyring_manifest *manifest, const char *name)
+{
+	struct keyring_manifest_entry key;
+	hashmap_entry_init(&key, strhash(name));
+
+	keyring_manifest_entry_free(hashmap_remove(&manifest->entries, &key, name));
+}
+
+int keyring_manifest_entry_is_current(const struct keyring_manifest *manifest,
+		const struct keyring_manifest_entry *entry, const struct keyring_stamp *stamp)
+{
+	if (keyring_stamp_cmp(&entry->stamp, stamp))
+		return 0;
+
+	// the key file may have been modified again in the same instant
+	if (stamp->mtime_sec > manifest->written.mtime_sec)
+		return 0;
+	if (stamp->mtime_sec == manifest->written.mtime_sec &&
+			stamp->mtime_nsec >= manifest->written.mtime_nsec)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Parse a `<size> <mtime seconds> <mtime nanoseconds>` stamp followed by the
+ * character `terminator`, advancing `pos` past the terminator.
+ *
+ * Returns zero if successful, and non-zero if the stamp is malformed.
+ * */
+static int parse_stamp(const char **pos, const char *end, char terminator,
+		struct keyring_stamp *stamp)
+{
+	long long values[3];
+
+	for (int i = 0; i < 3; i++) {
+		const char *start = *pos;
+		long long value = 0;
+
+		while (*pos < end && **pos >= '0' && **pos <= '9') {
+			if (value > (INT64_MAX - 9) / 10)
+				return 1;
+
+			value = value * 10 + (**pos - '0');
+			(*pos)++;
+		}
+
+		if (*pos == start || *pos >= end || **pos != (i < 2 ? ' ' : terminator))
+			return 1;
+
+		values[i] = value;
+		(*pos)++;
+	}
+
+	if (values[2] >= 1000000000LL)
+		return 1;
+
+	stamp->size = values[0];
+	stamp->mtime_sec = values[1];
+	stamp->mtime_nsec = (long) values[2];
+
+	return 0;
+}
+
+int keyring_manifest_parse(struct keyring_manifest *manifest, const char *data, size_t len)
+{
+	const char *pos = data;
+	const char *end = data + len;
+	size_t header_len = strlen(KEYRING_MANIFEST_HEADER);
+	struct strbuf name;
+	struct str_array fingerprints;
+	int ret = 0;
+
+	if (len < header_len || memcmp(data, KEYRING_MANIFEST_HEADER, header_len) != 0)
+		return 1;
+	pos += header_len;
+
+	if ((size_t) (end - pos) < 8 || memcmp(pos, "keyring ", 8) != 0)
+		return 1;
+
+	pos += 8;
+	if (parse_stamp(&pos, end, '\n', &manifest->keyring))
+		return 1;
+
+	strbuf_init(&name);
+	str_array_init(&fingerprints);
+
+	while (pos < end) {
+		struct keyring_stamp stamp;
+
+		const char *lf = memchr(pos, '\n', end - pos);
+		if (!lf || parse_stamp(&pos, lf, ' ', &stamp)) {
+			ret = 1;
+			break;
+		}
+
+		const char *sp = memchr(pos, ' ', lf - pos);
+		if (!sp || sp == pos || sp + 1 == lf) {
+			ret = 1;
+			break;
+		}
+
+		str_array_clear(&fingerprints);
+		if (sp - pos != 1 || *pos != '-') {
+			while (pos < sp) {
+				const char *comma = memchr(pos, ',', sp - pos);
+				const char *fpr_end = comma ? comma : sp;
+				if (fpr_end == pos)
+					break;
+
+				strbuf_clear(&name);
+				strbuf_attach(&name, pos, fpr_end - pos);
+				str_array_push(&fingerprints, name.buff, NULL);
+
+				pos = comma ? comma + 1 : sp;
+			}
+
+			if (pos != sp) {
+				ret = 1;
+				break;
+			}
+		}
+
+		strbuf_clear(&name);
+		strbuf_attach(&name, sp + 1, lf - sp - 1);
+		keyring_manifest_put(manifest, name.buff, &stamp, &fingerprints);
+
+		pos = lf + 1;
+	}
+
+	str_array_release(&fingerprints);
+	strbuf_release(&name);
+
+	return ret;
+}
+
+void keyring_manifest_serialize(struct keyring_manifest *manifest, struct strbuf *out)
+{
+	struct hashmap_iter iter;
+	struct keyring_manifest_entry *entry;
+
+	strbuf_attach_str(out, KEYRING_MANIFEST_HEADER);
+	strbuf_attach_fmt(out, "keyring %lld %lld %ld\n",
+			(long long) manifest->keyring.size,
+			(long long) manifest->keyring.mtime_sec,
+			manifest->keyring.mtime_nsec);
+
+	hashmap_iter_init(&manifest->entries, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		if (strchr(entry->name, '\n'))
+			continue;
+
+		strbuf_attach_fmt(out, "%lld %lld %ld ",
+				(long long) entry->stamp.size,
+				(long long) entry->stamp.mtime_sec,
+				entry->stamp.mtime_nsec);
+
+		if (!entry->fingerprints.len)
+			strbuf_attach_str(out, "-");
+		for (size_t i = 0; i < entry->fingerprints.len; i++) {
+			if (i)
+				strbuf_attach_str(out, ",");
+			strbuf_attach_str(out, str_array_get(&entry->fingerprints, i));
+		}
+
+		strbuf_attach_fmt(out, " %s\n", entry->name);
+	}
+}
+
+int keyring_manifest_load(struct keyring_manifest *manifest)
+{
+	struct strbuf path, contents;
+	struct stat st;
+	int ret = 0;
+
+	strbuf_init(&path);
+	if (get_chat_cache_dir(&path))
+		FATAL("unable to obtain the path to the chat cache");
+	strbuf_attach_fmt(&path, "/%s", KEYRING_MANIFEST_FILE);
+
+	int fd = open(path.buff, O_RDONLY);
+	if (fd < 0) {
+		LOG_DEBUG("no keyring manifest exists at '%s'", path.buff);
+		strbuf_release(&path);
+		return 1;
+	}
+
+	if (fstat(fd, &st))
+		FATAL("unable to stat '%s'", path.buff);
+
+	strbuf_init(&contents);
+	strbuf_attach_fd(&contents, fd);
+	close(fd);
+
+	if (keyring_manifest_parse(manifest, contents.buff, contents.len)) {
+		LOG_WARN("keyring manifest '%s' is malformed; ignoring", path.buff);
+		keyring_manifest_release(manifest);
+		keyring_manifest_init(manifest);
+		ret = -1;
+	} else {
+		keyring_stamp_from_stat(&manifest->written, &st);
+	}
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+
+	return ret;
+}
+
+int keyring_manifest_write(struct keyring_manifest *manifest)
+{
+	struct cache_lock lock;
+	struct strbuf contents;
+
+	if (cache_file_lock(&lock, KEYRING_MANIFEST_FILE))
+		return 1;
+
+	strbuf_init(&contents);
+	keyring_manifest_serialize(manifest, &contents);
+
+	int ret = cache_file_commit(&lock, contents.buff, contents.len);
+	if (!ret)
+		LOG_INFO("updated keyring manifest with %zu key files", manifest->entries.size);
+
+	strbuf_release(&contents);
+
+	return ret;
+}
+
+void keyring_manifest_release(struct keyring_manifest *manifest)
+{
+	struct hashmap_iter iter;
+	struct keyring_manifest_entry *entry;
+
+	hashmap_iter_init(&manifest->entries, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		str_array_release(&entry->fingerprints);
+		free(entry->name);
+	}
+
+	hashmap_release(&manifest->entries, 1);
+}
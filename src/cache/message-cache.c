@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/message-cache.h"
+#include "utils.h"
+
+static int message_cache_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct message_cache_entry *a = entry;
+	const struct message_cache_entry *b = entry_or_key;
+	(void) keydata;
+
+	return memcmp(a->oid.id, b->oid.id, GIT_RAW_OBJECT_ID);
+}
+
+static void message_cache_entry_free(void *data)
+{
+	struct message_cache_entry *entry = data;
+
+	memset(entry->message.buff, 0, entry->message.alloc);
+	strbuf_release(&entry->message);
+	free(entry);
+}
+
+static int message_cache_entry_same(const void *a, const void *b)
+{
+	const struct message_cache_entry *x = a;
+	const struct message_cache_entry *y = b;
+
+	return x->type == y->type && x->message.len == y->message.len &&
+			!memcmp(x->message.buff, y->message.buff, x->message.len);
+}
+
+static void put_message(struct keyed_cache *cache, const struct git_oid *oid,
+		enum message_type type, const char *message, size_t len)
+{
+	struct message_cache_entry *entry =
+			(struct message_cache_entry *) malloc(sizeof(struct message_cache_entry));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, git_oid_hash(oid));
+	entry->oid = *oid;
+	entry->type = type;
+
+	strbuf_init(&entry->message);
+	if (type == DECRYPTED && message)
+		strbuf_attach(&entry->message, message, len);
+
+	keyed_cache_put(cache, entry);
+}
+
+/**
+ * Parse a record of a message cache file. Each cached message is stored as a
+ * length-prefixed record:
+ *
+ * <commit id> <DEC | PLN> <length>
+ * <message>
+ * */
+static size_t parse_message(struct keyed_cache *cache, const char *data, size_t len)
+{
+	const char *end = data + len;
+	struct git_oid oid;
+	enum message_type type;
+
+	const char *lf = memchr(data, '\n', len);
+	if (!lf || (lf - data) < (GIT_HEX_OBJECT_ID + 6))
+		return 0;
+
+	git_str_to_oid(&oid, data);
+
+	const char *type_str = data + GIT_HEX_OBJECT_ID + 1;
+	if (!memcmp(type_str, "DEC ", 4))
+		type = DECRYPTED;
+	else if (!memcmp(type_str, "PLN ", 4))
+		type = PLAINTEXT;
+	else
+		return 0;
+
+	char *tailptr = NULL;
+	unsigned long message_len = strtoul(type_str + 4, &tailptr, 10);
+	if (!tailptr || tailptr != lf)
+		return 0;
+
+	const char *message = lf + 1;
+	if ((size_t)(end - message) < message_len + 1 || message[message_len] != '\n')
+		return 0;
+
+	put_message(cache, &oid, type, message, message_len);
+
+	return message + message_len + 1 - data;
+}
+
+static void serialize_message(void *data, struct strbuf *out)
+{
+	struct message_cache_entry *entry = data;
+	char oid_str[GIT_HEX_OBJECT_ID];
+	git_oid_to_str(&entry->oid, oid_str);
+
+	strbuf_attach_fmt(out, "%.*s %s %zu\n", GIT_HEX_OBJECT_ID, oid_str,
+			entry->type == DECRYPTED ? "DEC" : "PLN", entry->message.len);
+	strbuf_attach(out, entry->message.buff, entry->message.len);
+	strbuf_attach_chr(out, '\n');
+}
+
+static const struct keyed_cache_type message_cache_type = {
+	.file = "messages",
+	.header = "git-chat message cache v1\n",
+	.name = "message cache",
+	.entries = "messages",
+	.cmp = message_cache_entry_cmp,
+	.parse = parse_message,
+	.serialize = serialize_message,
+	.same_value = message_cache_entry_same,
+	.free = message_cache_entry_free
+};
+
+void message_cache_init(struct message_cache *cache)
+{
+	keyed_cache_init(&cache->cache, &message_cache_type);
+}
+
+int message_cache_load(struct message_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	return keyed_cache_load(&cache->cache, ctx);
+}
+
+struct message_cache_entry *message_cache_get(struct message_cache *cache,
+		const struct git_oid *oid)
+{
+	struct message_cache_entry key;
+	hashmap_entry_init(&key, git_oid_hash(oid));
+	key.oid = *oid;
+
+	return keyed_cache_get(&cache->cache, &key, NULL);
+}
+
+void message_cache_put(struct message_cache *cache, const struct git_oid *oid,
+		enum message_type type, const struct strbuf *message)
+{
+	if (type != DECRYPTED && type != PLAINTEXT)
+		BUG("only decrypted or plaintext messages may be cached");
+
+	put_message(&cache->cache, oid, type, message ? message->buff : NULL,
+			message ? message->len : 0);
+}
+
+int message_cache_write(struct message_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	return keyed_cache_write(&cache->cache, ctx);
+}
+
+void message_cache_release(struct message_cache *cache)
+{
+	keyed_cache_release(&cache->cache);
+}
@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache/message-count-cache.h"
+#include "cache/cache-file.h"
+#include "working-tree.h"
+#include "utils.h"
+
+#define MESSAGE_COUNT_CACHE_FILE "message-counts"
+#define MESSAGE_COUNT_CACHE_HEADER "git-chat message counts v1\n"
+
+static int message_count_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct message_count *a = entry;
+	const struct message_count *b = entry_or_key;
+	(void) keydata;
+
+	return memcmp(a->oid.id, b->oid.id, GIT_RAW_OBJECT_ID);
+}
+
+void message_count_cache_init(struct message_count_cache *cache)
+{
+	hashmap_init(&cache->counts, message_count_cmp, 0);
+	cache->dirty = 0;
+}
+
+struct message_count *message_count_cache_get(struct message_count_cache *cache,
+		const struct git_oid *oid)
+{
+	struct message_count key;
+	hashmap_entry_init(&key, git_oid_hash(oid));
+	key.oid = *oid;
+
+	return hashmap_get(&cache->counts, &key, NULL);
+}
+
+struct message_count *message_count_cache_put(struct message_count_cache *cache,
+		const struct git_oid *oid, int count, int depth)
+{
+	struct message_count *entry = malloc(sizeof(struct message_count));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, git_oid_hash(oid));
+	entry->oid = *oid;
+	entry->count = count;
+	entry->depth = depth;
+	entry->unread = 0;
+	entry->has_unread = 0;
+	entry->keep = 0;
+	entry->loaded = 0;
+
+	struct message_count *replaced = hashmap_put(&cache->counts, entry);
+	if (replaced && replaced->loaded)
+		cache->dirty = 1;
+	free(replaced);
+
+	return entry;
+}
+
+void message_count_cache_keep(struct message_count_cache *cache,
+		struct message_count *entry)
+{
+	if (!entry->keep && !entry->loaded)
+		cache->dirty = 1;
+
+	entry->keep = 1;
+}
+
+void message_count_cache_set_unread(struct message_count_cache *cache,
+		struct message_count *entry, const struct git_oid *watermark, int unread)
+{
+	if (entry->has_unread && entry->unread == unread &&
+			!memcmp(entry->watermark.id, watermark->id, GIT_RAW_OBJECT_ID))
+		return;
+
+	entry->watermark = *watermark;
+	entry->unread = unread;
+	entry->has_unread = 1;
+	cache->dirty = 1;
+}
+
+/**
+ * Parse a lowercase hex object id followed by the character `terminator`,
+ * advancing `pos` past the terminator.
+ *
+ * Returns zero if successful, and non-zero if the object id is malformed.
+ * */
+static int parse_oid(const char **pos, const char *end, char terminator,
+		struct git_oid *oid)
+{
+	if (end - *pos < GIT_HEX_OBJECT_ID + 1 || (*pos)[GIT_HEX_OBJECT_ID] != terminator)
+		return 1;
+
+	for (size_t i = 0; i < GIT_HEX_OBJECT_ID; i++) {
+		char c = (*pos)[i];
+		if ((c < '0' || c > '9') && (c < 'a' || c > 'f'))
+			return 1;
+	}
+
+	git_str_to_oid(oid, *pos);
+	*pos += GIT_HEX_OBJECT_ID + 1;
+
+	return 0;
+}
+
+/**
+ * Parse a decimal number (which may be -1) followed by a space or a line
+ * feed, advancing `pos` past it. `terminator` is set to the character that
+ * followed the number.
+ *
+ * Returns zero if successful, and non-zero if the number is malformed.
+ * */
+static int parse_count(const char **pos, const char *end, int *value, char *terminator)
+{
+	if (end - *pos >= 2 && (*pos)[0] == '-' && (*pos)[1] == '1') {
+		*value = -1;
+		*pos += 2;
+	} else {
+		const char *start = *pos;
+
+		*value = 0;
+		while (*pos < end && **pos >= '0' && **pos <= '9') {
+			if (*value > (INT_MAX - 9) / 10)
+				return 1;
+
+			*value = *value * 10 + (**pos - '0');
+			(*pos)++;
+		}
+
+		if (*pos == start)
+			return 1;
+	}
+
+	if (*pos >= end || (**pos != ' ' && **pos != '\n'))
+		return 1;
+
+	*terminator = *(*pos)++;
+	return 0;
+}
+
+int message_count_cache_parse(struct message_count_cache *cache, const char *data, size_t len)
+{
+	const char *pos = data;
+	const char *end = data + len;
+	size_t header_len = strlen(MESSAGE_COUNT_CACHE_HEADER);
+
+	if (len < header_len || memcmp(data, MESSAGE_COUNT_CACHE_HEADER, header_len) != 0)
+		return 1;
+	pos += header_len;
+
+	while (pos < end) {
+		struct git_oid oid, watermark;
+		int count, depth, unread;
+		char terminator;
+
+		if (parse_oid(&pos, end, ' ', &oid))
+			return 1;
+		if (parse_count(&pos, end, &count, &terminator) || count < 0 || terminator != ' ')
+			return 1;
+		if (parse_count(&pos, end, &depth, &terminator))
+			return 1;
+
+		struct message_count *entry = message_count_cache_put(cache, &oid, count, depth);
+		entry->keep = 1;
+		entry->loaded = 1;
+
+		if (terminator == '\n')
+			continue;
+
+		if (parse_oid(&pos, end, ' ', &watermark))
+			return 1;
+		if (parse_count(&pos, end, &unread, &terminator) || unread < 0 || terminator != '\n')
+			return 1;
+
+		entry->watermark = watermark;
+		entry->unread = unread;
+		entry->has_unread = 1;
+	}
+
+	return 0;
+}
+
+void message_count_cache_serialize(struct message_count_cache *cache, struct strbuf *out)
+{
+	struct hashmap_iter iter;
+	struct message_count *entry;
+	char hex[GIT_HEX_OBJECT_ID];
+
+	strbuf_attach_str(out, MESSAGE_COUNT_CACHE_HEADER);
+
+	hashmap_iter_init(&cache->counts, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		if (!entry->keep)
+			continue;
+
+		git_oid_to_str(&entry->oid, hex);
+		strbuf_attach_fmt(out, "%.*s %d %d", GIT_HEX_OBJECT_ID, hex, entry->count, entry->depth);
+
+		if (entry->has_unread) {
+			git_oid_to_str(&entry->watermark, hex);
+			strbuf_attach_fmt(out, " %.*s %d", GIT_HEX_OBJECT_ID, hex, entry->unread);
+		}
+
+		strbuf_attach_str(out, "\n");
+	}
+}
+
+int message_count_cache_load(struct message_count_cache *cache)
+{
+	struct strbuf path, contents;
+	int ret = 0;
+
+	strbuf_init(&path);
+	if (get_chat_cache_dir(&path))
+		FATAL("unable to obtain the path to the chat cache");
+	strbuf_attach_fmt(&path, "/%s", MESSAGE_COUNT_CACHE_FILE);
+
+	int fd = open(path.buff, O_RDONLY);
+	if (fd < 0) {
+		LOG_DEBUG("no message count cache exists at '%s'", path.buff);
+		strbuf_release(&path);
+		return 1;
+	}
+
+	strbuf_init(&contents);
+	strbuf_attach_fd(&contents, fd);
+	close(fd);
+
+	if (message_count_cache_parse(cache, contents.buff, contents.len)) {
+		LOG_WARN("message count cache '%s' is malformed; ignoring", path.buff);
+		message_count_cache_release(cache);
+		message_count_cache_init(cache);
+		ret = -1;
+	}
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+
+	return ret;
+}
+
+int message_count_cache_write(struct message_count_cache *cache)
+{
+	struct hashmap_iter iter;
+	struct message_count *entry;
+	struct cache_lock lock;
+	struct strbuf contents;
+
+	// entries that were loaded but not kept are dropped
+	hashmap_iter_init(&cache->counts, &iter);
+	while (!cache->dirty && (entry = hashmap_iter_next(&iter))) {
+		if (entry->loaded && !entry->keep)
+			cache->dirty = 1;
+	}
+
+	if (!cache->dirty)
+		return 0;
+
+	if (cache_file_lock(&lock, MESSAGE_COUNT_CACHE_FILE))
+		return 1;
+
+	strbuf_init(&contents);
+	message_count_cache_serialize(cache, &contents);
+
+	int ret = cache_file_commit(&lock, contents.buff, contents.len);
+	if (!ret) {
+		LOG_INFO("updated message count cache");
+		cache->dirty = 0;
+	}
+
+	strbuf_release(&contents);
+
+	return ret;
+}
+
+void message_count_cache_release(struct message_count_cache *cache)
+{
+	hashmap_release(&cache->counts, 1);
+}
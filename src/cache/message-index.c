@@ -0,0 +1,897 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache/message-index.h"
+#include "cache/cache-file.h"
+#include "git/graph-traversal.h"
+#include "hashmap.h"
+#include "working-tree.h"
+#include "utils.h"
+
+#define MESSAGE_INDEX_FILE_PREFIX "message-index."
+#define MESSAGE_INDEX_SIGNATURE "GCMI"
+#define MESSAGE_INDEX_VERSION 2
+#define MESSAGE_INDEX_HEADER_SIZE (4 + 4 + 4 + 4 + 4 + GIT_RAW_OBJECT_ID)
+#define MESSAGE_INDEX_RECORD_SIZE (GIT_RAW_OBJECT_ID + 8 + 4 + 4)
+#define MESSAGE_INDEX_TIME_ENTRY_SIZE (8 + 4)
+#define MESSAGE_INDEX_AUTHOR_ENTRY_SIZE (4 + 4 + 4)
+#define MESSAGE_INDEX_POSTING_SIZE 4
+
+#define CURSOR_POS_LEN 8
+#define CURSOR_OID_LEN 12
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+			((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static inline uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t) get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static inline void put_be32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char) (value >> 24);
+	p[1] = (unsigned char) (value >> 16);
+	p[2] = (unsigned char) (value >> 8);
+	p[3] = (unsigned char) value;
+}
+
+static inline void put_be64(unsigned char *p, uint64_t value)
+{
+	put_be32(p, (uint32_t) (value >> 32));
+	put_be32(p + 4, (uint32_t) value);
+}
+
+/**
+ * Build the name of the index file for a channel. Channel ref names contain
+ * slashes, which are percent-encoded so that the index lives directly under
+ * the cache directory.
+ * */
+static void get_index_file_name(struct strbuf *name, const char *channel)
+{
+	strbuf_attach_str(name, MESSAGE_INDEX_FILE_PREFIX);
+	for (const char *c = channel; *c; c++) {
+		if (*c == '/' || *c == '%')
+			strbuf_attach_fmt(name, "%%%02X", (unsigned char) *c);
+		else
+			strbuf_attach_chr(name, *c);
+	}
+}
+
+/**
+ * An author in the name table, along with the positions of the author's
+ * messages (ascending).
+ * */
+struct index_name_entry {
+	struct hashmap_entry ent;
+	const char *name;
+	uint32_t offset;
+
+	uint32_t *postings;
+	size_t postings_len;
+	size_t postings_alloc;
+};
+
+/**
+ * Compare name table entries. Entries in the map only hold the offset of their
+ * name in the table (passed as `keydata`), since the table may be reallocated
+ * as it grows; lookup keys hold the name itself.
+ * */
+static int index_name_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct index_name_entry *a = entry;
+	const struct index_name_entry *b = entry_or_key;
+	const char *names = keydata;
+
+	return strcmp(names + a->offset, b->name ? b->name : names + b->offset);
+}
+
+/**
+ * New index records, collected newest first during traversal, along with the
+ * name table they refer to.
+ * */
+struct index_builder {
+	unsigned char *records;
+	struct index_name_entry **record_authors;
+	size_t records_len;
+	size_t records_alloc;
+
+	char *names;
+	size_t names_len;
+	size_t names_alloc;
+	struct hashmap name_offsets;
+
+	struct git_oid oldest_parent;
+	unsigned oldest_has_parent: 1;
+};
+
+static void index_builder_init(struct index_builder *builder)
+{
+	builder->records = NULL;
+	builder->record_authors = NULL;
+	builder->records_len = 0;
+	builder->records_alloc = 0;
+	builder->names = NULL;
+	builder->names_len = 0;
+	builder->names_alloc = 0;
+	builder->oldest_has_parent = 0;
+	hashmap_init(&builder->name_offsets, index_name_entry_cmp, 0);
+}
+
+static void index_builder_release(struct index_builder *builder)
+{
+	struct hashmap_iter iter;
+	struct index_name_entry *entry;
+
+	hashmap_iter_init(&builder->name_offsets, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		free(entry->postings);
+		free(entry);
+	}
+
+	hashmap_release(&builder->name_offsets, 0);
+	free(builder->records);
+	free(builder->record_authors);
+	free(builder->names);
+	index_builder_init(builder);
+}
+
+/**
+ * Remember the offset of a name already in the name table.
+ * */
+static struct index_name_entry *index_builder_track_name(struct index_builder *builder,
+		uint32_t offset)
+{
+	struct index_name_entry *entry = (struct index_name_entry *) malloc(sizeof(struct index_name_entry));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, strhash(builder->names + offset));
+	entry->name = NULL;
+	entry->offset = offset;
+	entry->postings = NULL;
+	entry->postings_len = 0;
+	entry->postings_alloc = 0;
+	hashmap_add(&builder->name_offsets, entry);
+
+	return entry;
+}
+
+static void index_name_entry_add_posting(struct index_name_entry *entry, uint32_t pos)
+{
+	if (entry->postings_len == entry->postings_alloc) {
+		entry->postings_alloc = entry->postings_alloc ? entry->postings_alloc * 2 : 16;
+		entry->postings = (uint32_t *) realloc(entry->postings,
+				entry->postings_alloc * sizeof(uint32_t));
+		if (!entry->postings)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	entry->postings[entry->postings_len++] = pos;
+}
+
+/**
+ * Look up or insert `name` (of length `len`) in the name table.
+ *
+ * Returns the name table entry.
+ * */
+static struct index_name_entry *index_builder_intern_name(struct index_builder *builder,
+		const char *name, size_t len)
+{
+	struct strbuf key;
+	strbuf_init(&key);
+	strbuf_attach(&key, name, len);
+
+	struct index_name_entry lookup;
+	hashmap_entry_init(&lookup, strhash(key.buff));
+	lookup.name = key.buff;
+
+	struct index_name_entry *found = hashmap_get(&builder->name_offsets, &lookup, builder->names);
+	if (found) {
+		strbuf_release(&key);
+		return found;
+	}
+
+	if (builder->names_len + key.len + 1 > UINT32_MAX)
+		FATAL("message index name table is too large");
+
+	while (builder->names_len + key.len + 1 > builder->names_alloc) {
+		builder->names_alloc = builder->names_alloc ? builder->names_alloc * 2 : 256;
+		builder->names = (char *) realloc(builder->names, builder->names_alloc);
+		if (!builder->names)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	uint32_t offset = (uint32_t) builder->names_len;
+	memcpy(builder->names + offset, key.buff, key.len + 1);
+	builder->names_len += key.len + 1;
+	found = index_builder_track_name(builder, offset);
+
+	strbuf_release(&key);
+	return found;
+}
+
+/**
+ * Seed the builder with the name table and author postings of an existing
+ * index.
+ * */
+static void index_builder_load(struct index_builder *builder,
+		const struct message_index *index)
+{
+	builder->names_alloc = index->names_len ? index->names_len : 256;
+	builder->names = (char *) malloc(builder->names_alloc);
+	if (!builder->names)
+		FATAL(MEM_ALLOC_FAILED);
+
+	memcpy(builder->names, index->names, index->names_len);
+	builder->names_len = index->names_len;
+
+	for (size_t i = 0; i < index->authors_count; i++) {
+		const unsigned char *author = index->authors + i * MESSAGE_INDEX_AUTHOR_ENTRY_SIZE;
+		uint32_t name_offset = get_be32(author);
+		uint32_t postings_offset = get_be32(author + 4);
+		uint32_t postings_len = get_be32(author + 8);
+
+		struct index_name_entry *entry = index_builder_track_name(builder, name_offset);
+		for (uint32_t j = 0; j < postings_len; j++)
+			index_name_entry_add_posting(entry, get_be32(index->postings +
+					(postings_offset + j) * MESSAGE_INDEX_POSTING_SIZE));
+	}
+}
+
+static int index_builder_add_cb(struct git_commit_view *commit, void *data)
+{
+	struct index_builder *builder = (struct index_builder *) data;
+
+	if (builder->records_len == builder->records_alloc) {
+		builder->records_alloc = builder->records_alloc ? builder->records_alloc * 2 : 64;
+		builder->records = (unsigned char *) realloc(builder->records,
+				builder->records_alloc * MESSAGE_INDEX_RECORD_SIZE);
+		builder->record_authors = (struct index_name_entry **) realloc(builder->record_authors,
+				builder->records_alloc * sizeof(struct index_name_entry *));
+		if (!builder->records || !builder->record_authors)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	if (commit->body_len > UINT32_MAX)
+		FATAL("commit body is too large to index");
+
+	struct index_name_entry *author = index_builder_intern_name(builder,
+			commit->author.name, commit->author.name_len);
+
+	unsigned char *record = builder->records + builder->records_len * MESSAGE_INDEX_RECORD_SIZE;
+	memcpy(record, commit->commit_id.id, GIT_RAW_OBJECT_ID);
+	put_be64(record + GIT_RAW_OBJECT_ID, (uint64_t) commit->author.timestamp.time);
+	put_be32(record + GIT_RAW_OBJECT_ID + 8, author->offset);
+	put_be32(record + GIT_RAW_OBJECT_ID + 12, (uint32_t) commit->body_len);
+	builder->record_authors[builder->records_len] = author;
+	builder->records_len++;
+
+	// commits are traversed newest first, so this ends up being the oldest
+	builder->oldest_has_parent = commit->parents_commit_ids_len > 0;
+	if (builder->oldest_has_parent)
+		builder->oldest_parent = commit->parents_commit_ids[0];
+
+	return 0;
+}
+
+struct time_entry {
+	int64_t timestamp;
+	uint32_t pos;
+};
+
+static int time_entry_cmp(const void *a, const void *b)
+{
+	const struct time_entry *x = a;
+	const struct time_entry *y = b;
+
+	if (x->timestamp != y->timestamp)
+		return x->timestamp < y->timestamp ? -1 : 1;
+
+	return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+static int index_name_entry_offset_cmp(const void *a, const void *b)
+{
+	const struct index_name_entry *x = *(const struct index_name_entry * const *) a;
+	const struct index_name_entry *y = *(const struct index_name_entry * const *) b;
+
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static unsigned char *write_time_entry(unsigned char *p, int64_t timestamp, uint32_t pos)
+{
+	put_be64(p, (uint64_t) timestamp);
+	put_be32(p + 8, pos);
+	return p + MESSAGE_INDEX_TIME_ENTRY_SIZE;
+}
+
+/**
+ * Write the timestamp column: the sorted column of the existing index merged
+ * with the (sorted) timestamps of the new records.
+ * */
+static unsigned char *write_time_column(unsigned char *p, const struct message_index *old,
+		struct index_builder *builder, size_t old_count)
+{
+	struct time_entry *entries = NULL;
+	if (builder->records_len) {
+		entries = (struct time_entry *) malloc(builder->records_len * sizeof(struct time_entry));
+		if (!entries)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	// builder records are newest first
+	for (size_t i = 0; i < builder->records_len; i++) {
+		const unsigned char *record = builder->records + i * MESSAGE_INDEX_RECORD_SIZE;
+		entries[i].timestamp = (int64_t) get_be64(record + GIT_RAW_OBJECT_ID);
+		entries[i].pos = (uint32_t) (old_count + builder->records_len - 1 - i);
+	}
+
+	if (builder->records_len)
+		qsort(entries, builder->records_len, sizeof(struct time_entry), time_entry_cmp);
+
+	size_t i = 0, j = 0;
+	while (i < old_count || j < builder->records_len) {
+		const unsigned char *old_entry = i < old_count ?
+				old->time_index + i * MESSAGE_INDEX_TIME_ENTRY_SIZE : NULL;
+
+		// existing positions are always lower, so ties go to the existing entry
+		if (old_entry && (j == builder->records_len ||
+				(int64_t) get_be64(old_entry) <= entries[j].timestamp)) {
+			memcpy(p, old_entry, MESSAGE_INDEX_TIME_ENTRY_SIZE);
+			p += MESSAGE_INDEX_TIME_ENTRY_SIZE;
+			i++;
+		} else {
+			p = write_time_entry(p, entries[j].timestamp, entries[j].pos);
+			j++;
+		}
+	}
+
+	free(entries);
+	return p;
+}
+
+/**
+ * Serialize the index: the records of the existing index `old` (if any),
+ * followed by the new records from the builder in chronological order, and
+ * the secondary indexes over all of them.
+ * */
+static void write_index(const struct message_index *old, const struct git_oid *tip,
+		struct index_builder *builder, unsigned char **data, size_t *len)
+{
+	size_t old_count = old ? old->count : 0;
+	size_t count = old_count + builder->records_len;
+	if (count > UINT32_MAX)
+		FATAL("too many messages to index");
+
+	// append new positions to the author postings, oldest first
+	for (size_t i = builder->records_len; i > 0; i--)
+		index_name_entry_add_posting(builder->record_authors[i - 1],
+				(uint32_t) (old_count + builder->records_len - i));
+
+	struct index_name_entry **authors = (struct index_name_entry **) malloc(
+			(builder->name_offsets.size + 1) * sizeof(struct index_name_entry *));
+	if (!authors)
+		FATAL(MEM_ALLOC_FAILED);
+
+	struct hashmap_iter iter;
+	struct index_name_entry *entry;
+	size_t authors_count = 0;
+	hashmap_iter_init(&builder->name_offsets, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		if (entry->postings_len)
+			authors[authors_count++] = entry;
+	}
+
+	qsort(authors, authors_count, sizeof(struct index_name_entry *), index_name_entry_offset_cmp);
+
+	*len = MESSAGE_INDEX_HEADER_SIZE +
+			count * (MESSAGE_INDEX_RECORD_SIZE + MESSAGE_INDEX_TIME_ENTRY_SIZE + MESSAGE_INDEX_POSTING_SIZE) +
+			authors_count * MESSAGE_INDEX_AUTHOR_ENTRY_SIZE + builder->names_len;
+	*data = (unsigned char *) malloc(*len);
+	if (!*data)
+		FATAL(MEM_ALLOC_FAILED);
+
+	unsigned char *p = *data;
+	memcpy(p, MESSAGE_INDEX_SIGNATURE, 4);
+	put_be32(p + 4, MESSAGE_INDEX_VERSION);
+	put_be32(p + 8, (uint32_t) count);
+	put_be32(p + 12, (uint32_t) builder->names_len);
+	put_be32(p + 16, (uint32_t) authors_count);
+	memcpy(p + 20, tip->id, GIT_RAW_OBJECT_ID);
+	p += MESSAGE_INDEX_HEADER_SIZE;
+
+	if (old_count) {
+		memcpy(p, old->records, old_count * MESSAGE_INDEX_RECORD_SIZE);
+		p += old_count * MESSAGE_INDEX_RECORD_SIZE;
+	}
+
+	for (size_t i = builder->records_len; i > 0; i--) {
+		memcpy(p, builder->records + (i - 1) * MESSAGE_INDEX_RECORD_SIZE, MESSAGE_INDEX_RECORD_SIZE);
+		p += MESSAGE_INDEX_RECORD_SIZE;
+	}
+
+	p = write_time_column(p, old, builder, old_count);
+
+	uint32_t postings_offset = 0;
+	for (size_t i = 0; i < authors_count; i++) {
+		put_be32(p, authors[i]->offset);
+		put_be32(p + 4, postings_offset);
+		put_be32(p + 8, (uint32_t) authors[i]->postings_len);
+		postings_offset += (uint32_t) authors[i]->postings_len;
+		p += MESSAGE_INDEX_AUTHOR_ENTRY_SIZE;
+	}
+
+	for (size_t i = 0; i < authors_count; i++) {
+		for (size_t j = 0; j < authors[i]->postings_len; j++) {
+			put_be32(p, authors[i]->postings[j]);
+			p += MESSAGE_INDEX_POSTING_SIZE;
+		}
+	}
+
+	if (builder->names_len)
+		memcpy(p, builder->names, builder->names_len);
+
+	free(authors);
+}
+
+/**
+ * Traverse the channel from its tip, stopping at `exclude` if not NULL.
+ *
+ * Returns zero if successful, and non-zero if the traversal failed.
+ * */
+static int collect_new_commits(struct index_builder *builder, const char *channel,
+		const struct git_oid *exclude)
+{
+	char hex[GIT_HEX_OBJECT_ID + 1];
+	struct git_oid oid;
+
+	if (exclude) {
+		oid = *exclude;
+		git_oid_to_str(&oid, hex);
+		hex[GIT_HEX_OBJECT_ID] = 0;
+	}
+
+	return traverse_commit_graph_range(exclude ? hex : NULL, channel, -1,
+			index_builder_add_cb, builder);
+}
+
+struct first_parent {
+	struct git_oid oid;
+	size_t parents_len;
+};
+
+static int read_first_parent_cb(struct git_commit_view *commit, void *data)
+{
+	struct first_parent *parent = (struct first_parent *) data;
+	parent->parents_len = commit->parents_commit_ids_len;
+	if (commit->parents_commit_ids_len)
+		parent->oid = commit->parents_commit_ids[0];
+
+	return 0;
+}
+
+/**
+ * Check whether `tip` is reached from `commit` by following first parents
+ * through merge commits only. Merges aren't indexed, so the oldest new commit
+ * may sit on top of merges rather than directly on top of the old tip.
+ *
+ * Returns non-zero if `tip` is reached.
+ * */
+static int first_parent_reaches(const struct git_oid *commit, const struct git_oid *tip)
+{
+	struct git_oid current = *commit;
+
+	while (memcmp(current.id, tip->id, GIT_RAW_OBJECT_ID)) {
+		struct first_parent parent = { .parents_len = 0 };
+		if (read_commit_views(&current, 1, read_first_parent_cb, &parent) ||
+				parent.parents_len < 2)
+			return 0;
+
+		current = parent.oid;
+	}
+
+	return 1;
+}
+
+int message_index_update(const char *channel)
+{
+	struct cache_lock lock;
+	struct message_index index;
+	struct index_builder builder;
+	struct strbuf name;
+	int has_index, ret = 0;
+
+	strbuf_init(&name);
+	get_index_file_name(&name, channel);
+
+	if (cache_file_lock(&lock, name.buff)) {
+		strbuf_release(&name);
+		return 1;
+	}
+
+	index_builder_init(&builder);
+
+	has_index = !message_index_open(&index, channel);
+	if (has_index) {
+		index_builder_load(&builder, &index);
+
+		// the first-parent history of new commits must lead back to the old
+		// tip, or history was rewritten
+		if (collect_new_commits(&builder, channel, &index.tip) ||
+				(builder.records_len && (!builder.oldest_has_parent ||
+				!first_parent_reaches(&builder.oldest_parent, &index.tip)))) {
+			LOG_INFO("message index for '%s' no longer matches the channel history; rebuilding", channel);
+			message_index_close(&index);
+			index_builder_release(&builder);
+			index_builder_init(&builder);
+			has_index = 0;
+		}
+	}
+
+	if (!has_index && collect_new_commits(&builder, channel, NULL)) {
+		LOG_WARN("unable to traverse channel '%s' to build the message index", channel);
+		ret = 1;
+	}
+
+	if (!ret && (builder.records_len || !has_index)) {
+		struct git_oid tip;
+		unsigned char *data;
+		size_t len;
+
+		// the newest commit was traversed first
+		memset(tip.id, 0, GIT_RAW_OBJECT_ID);
+		if (builder.records_len)
+			memcpy(tip.id, builder.records, GIT_RAW_OBJECT_ID);
+		else if (has_index)
+			tip = index.tip;
+
+		write_index(has_index ? &index : NULL, &tip, &builder, &data, &len);
+
+		ret = cache_file_commit(&lock, (const char *) data, len);
+		if (!ret)
+			LOG_INFO("indexed %zu new messages in '%s'", builder.records_len, channel);
+
+		free(data);
+	} else {
+		cache_file_rollback(&lock);
+	}
+
+	if (has_index)
+		message_index_close(&index);
+
+	index_builder_release(&builder);
+	strbuf_release(&name);
+
+	return ret;
+}
+
+/**
+ * Check that the `count` positions stored every `stride` bytes from `p` all
+ * refer to one of the `count` records of the index.
+ * */
+static int positions_in_bounds(const unsigned char *p, size_t stride, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (get_be32(p + i * stride) >= count)
+			return 0;
+	}
+
+	return 1;
+}
+
+int message_index_open(struct message_index *index, const char *channel)
+{
+	struct strbuf path;
+	struct stat st;
+
+	index->map = NULL;
+	index->map_len = 0;
+	index->count = 0;
+
+	strbuf_init(&path);
+	if (get_chat_cache_dir(&path))
+		FATAL("unable to obtain the path to the chat cache");
+	strbuf_attach_chr(&path, '/');
+	get_index_file_name(&path, channel);
+
+	int fd = open(path.buff, O_RDONLY);
+	if (fd < 0) {
+		strbuf_release(&path);
+		return 1;
+	}
+
+	if (fstat(fd, &st) || (size_t) st.st_size < MESSAGE_INDEX_HEADER_SIZE) {
+		LOG_WARN("message index '%s' is truncated", path.buff);
+		close(fd);
+		strbuf_release(&path);
+		return -1;
+	}
+
+	void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		LOG_WARN("unable to map message index '%s'", path.buff);
+		strbuf_release(&path);
+		return -1;
+	}
+
+	const unsigned char *header = map;
+	size_t count = get_be32(header + 8);
+	size_t names_len = get_be32(header + 12);
+	size_t authors_count = get_be32(header + 16);
+	if (memcmp(header, MESSAGE_INDEX_SIGNATURE, 4) != 0 ||
+			get_be32(header + 4) != MESSAGE_INDEX_VERSION) {
+		// most likely written by an older version; it will be rebuilt
+		LOG_INFO("message index '%s' has an unsupported format", path.buff);
+		munmap(map, (size_t) st.st_size);
+		strbuf_release(&path);
+		return -1;
+	}
+
+	size_t expected_len = MESSAGE_INDEX_HEADER_SIZE +
+			count * (MESSAGE_INDEX_RECORD_SIZE + MESSAGE_INDEX_TIME_ENTRY_SIZE + MESSAGE_INDEX_POSTING_SIZE) +
+			authors_count * MESSAGE_INDEX_AUTHOR_ENTRY_SIZE + names_len;
+	if ((size_t) st.st_size != expected_len || (names_len && header[st.st_size - 1] != 0)) {
+		LOG_WARN("message index '%s' is malformed", path.buff);
+		munmap(map, (size_t) st.st_size);
+		strbuf_release(&path);
+		return -1;
+	}
+
+	index->map = map;
+	index->map_len = (size_t) st.st_size;
+	index->count = count;
+	memcpy(index->tip.id, header + 20, GIT_RAW_OBJECT_ID);
+	index->records = header + MESSAGE_INDEX_HEADER_SIZE;
+	index->time_index = index->records + count * MESSAGE_INDEX_RECORD_SIZE;
+	index->authors = index->time_index + count * MESSAGE_INDEX_TIME_ENTRY_SIZE;
+	index->authors_count = authors_count;
+	index->postings = index->authors + authors_count * MESSAGE_INDEX_AUTHOR_ENTRY_SIZE;
+	index->names = (const char *) index->postings + count * MESSAGE_INDEX_POSTING_SIZE;
+	index->names_len = names_len;
+
+	// postings must cover exactly the records, or lookups could run out of bounds
+	size_t postings_total = 0;
+	for (size_t i = 0; i < authors_count; i++) {
+		const unsigned char *author = index->authors + i * MESSAGE_INDEX_AUTHOR_ENTRY_SIZE;
+		if (get_be32(author) >= names_len || get_be32(author + 4) != postings_total) {
+			LOG_WARN("message index '%s' is malformed", path.buff);
+			message_index_close(index);
+			strbuf_release(&path);
+			return -1;
+		}
+
+		postings_total += get_be32(author + 8);
+	}
+
+	// as must every position in the time index and postings
+	if (postings_total != count ||
+			!positions_in_bounds(index->time_index + 8, MESSAGE_INDEX_TIME_ENTRY_SIZE, count) ||
+			!positions_in_bounds(index->postings, MESSAGE_INDEX_POSTING_SIZE, count)) {
+		LOG_WARN("message index '%s' is malformed", path.buff);
+		message_index_close(index);
+		strbuf_release(&path);
+		return -1;
+	}
+
+	strbuf_release(&path);
+	return 0;
+}
+
+void message_index_close(struct message_index *index)
+{
+	if (index->map)
+		munmap(index->map, index->map_len);
+
+	index->map = NULL;
+	index->map_len = 0;
+	index->count = 0;
+}
+
+void message_index_get(const struct message_index *index, size_t pos,
+		struct message_index_record *record)
+{
+	if (pos >= index->count)
+		BUG("message index position %zu out of bounds", pos);
+
+	const unsigned char *p = index->records + pos * MESSAGE_INDEX_RECORD_SIZE;
+	memcpy(record->oid.id, p, GIT_RAW_OBJECT_ID);
+	record->timestamp = (int64_t) get_be64(p + GIT_RAW_OBJECT_ID);
+
+	uint32_t name_offset = get_be32(p + GIT_RAW_OBJECT_ID + 8);
+	record->author = name_offset < index->names_len ? index->names + name_offset : "";
+	record->body_size = get_be32(p + GIT_RAW_OBJECT_ID + 12);
+}
+
+void message_index_cursor(const struct message_index *index, size_t pos,
+		struct strbuf *cursor)
+{
+	struct message_index_record record;
+	char hex[GIT_HEX_OBJECT_ID];
+
+	message_index_get(index, pos, &record);
+	git_oid_to_str(&record.oid, hex);
+
+	strbuf_attach_fmt(cursor, "%0*zx%.*s", CURSOR_POS_LEN, pos, CURSOR_OID_LEN, hex);
+}
+
+int message_index_resolve_cursor(const struct message_index *index,
+		const char *cursor, size_t *pos)
+{
+	struct message_index_record record;
+	char hex[GIT_HEX_OBJECT_ID];
+	char pos_hex[CURSOR_POS_LEN + 1];
+
+	if (strlen(cursor) != CURSOR_POS_LEN + CURSOR_OID_LEN)
+		return 1;
+
+	for (size_t i = 0; i < CURSOR_POS_LEN + CURSOR_OID_LEN; i++) {
+		if (!isxdigit((unsigned char) cursor[i]))
+			return 1;
+	}
+
+	memcpy(pos_hex, cursor, CURSOR_POS_LEN);
+	pos_hex[CURSOR_POS_LEN] = 0;
+
+	unsigned long value = strtoul(pos_hex, NULL, 16);
+	if (value >= index->count)
+		return 1;
+
+	message_index_get(index, (size_t) value, &record);
+	git_oid_to_str(&record.oid, hex);
+	if (strncasecmp(hex, cursor + CURSOR_POS_LEN, CURSOR_OID_LEN) != 0)
+		return 1;
+
+	*pos = (size_t) value;
+	return 0;
+}
+
+static int size_t_cmp(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a;
+	size_t y = *(const size_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Find the first entry of the timestamp column with a timestamp not less than
+ * `timestamp` (or greater than, if `after` is non-zero).
+ * */
+static size_t time_column_bound(const struct message_index *index, int64_t timestamp,
+		int after)
+{
+	size_t lo = 0, hi = index->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int64_t value = (int64_t) get_be64(index->time_index + mid * MESSAGE_INDEX_TIME_ENTRY_SIZE);
+		if (value < timestamp || (after && value == timestamp))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Collect the positions of messages within the time window of `filter`.
+ * */
+static void filter_by_time(const struct message_index *index,
+		const struct message_index_filter *filter, size_t **positions, size_t *len)
+{
+	size_t first = filter->has_since ? time_column_bound(index, filter->since, 0) : 0;
+	size_t last = filter->has_until ? time_column_bound(index, filter->until, 1) : index->count;
+
+	*len = last > first ? last - first : 0;
+	*positions = (size_t *) malloc((*len + 1) * sizeof(size_t));
+	if (!*positions)
+		FATAL(MEM_ALLOC_FAILED);
+
+	for (size_t i = 0; i < *len; i++)
+		(*positions)[i] = get_be32(index->time_index +
+				(first + i) * MESSAGE_INDEX_TIME_ENTRY_SIZE + 8);
+
+	qsort(*positions, *len, sizeof(size_t), size_t_cmp);
+}
+
+/**
+ * Collect the positions of messages whose author matches `filter->author`.
+ *
+ * Returns zero if successful, and non-zero if the pattern is invalid.
+ * */
+static int filter_by_author(const struct message_index *index,
+		const struct message_index_filter *filter, size_t **positions, size_t *len)
+{
+	regex_t pattern;
+	if (regcomp(&pattern, filter->author, REG_EXTENDED | REG_NOSUB))
+		return 1;
+
+	size_t alloc = 16;
+	*len = 0;
+	*positions = (size_t *) malloc(alloc * sizeof(size_t));
+	if (!*positions)
+		FATAL(MEM_ALLOC_FAILED);
+
+	for (size_t i = 0; i < index->authors_count; i++) {
+		const unsigned char *author = index->authors + i * MESSAGE_INDEX_AUTHOR_ENTRY_SIZE;
+		if (regexec(&pattern, index->names + get_be32(author), 0, NULL, 0))
+			continue;
+
+		uint32_t postings_offset = get_be32(author + 4);
+		uint32_t postings_len = get_be32(author + 8);
+		for (uint32_t j = 0; j < postings_len; j++) {
+			if (*len == alloc) {
+				alloc *= 2;
+				*positions = (size_t *) realloc(*positions, alloc * sizeof(size_t));
+				if (!*positions)
+					FATAL(MEM_ALLOC_FAILED);
+			}
+
+			(*positions)[(*len)++] = get_be32(index->postings +
+					(postings_offset + j) * MESSAGE_INDEX_POSTING_SIZE);
+		}
+	}
+
+	regfree(&pattern);
+
+	// postings of different authors are interleaved
+	qsort(*positions, *len, sizeof(size_t), size_t_cmp);
+	return 0;
+}
+
+int message_index_filter(const struct message_index *index,
+		const struct message_index_filter *filter, size_t **positions, size_t *len)
+{
+	size_t *by_time = NULL, *by_author = NULL;
+	size_t by_time_len = 0, by_author_len = 0;
+
+	if (filter->author && filter_by_author(index, filter, &by_author, &by_author_len))
+		return 1;
+
+	if (filter->has_since || filter->has_until || !filter->author)
+		filter_by_time(index, filter, &by_time, &by_time_len);
+
+	if (!by_author) {
+		*positions = by_time;
+		*len = by_time_len;
+		return 0;
+	}
+
+	if (!by_time) {
+		*positions = by_author;
+		*len = by_author_len;
+		return 0;
+	}
+
+	// intersect, in place
+	size_t i = 0, j = 0, out = 0;
+	while (i < by_author_len && j < by_time_len) {
+		if (by_author[i] < by_time[j]) {
+			i++;
+		} else if (by_author[i] > by_time[j]) {
+			j++;
+		} else {
+			by_author[out++] = by_author[i];
+			i++;
+			j++;
+		}
+	}
+
+	free(by_time);
+	*positions = by_author;
+	*len = out;
+	return 0;
+}
@@ -0,0 +1,152 @@
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache/read-watermark.h"
+#include "cache/cache-file.h"
+#include "working-tree.h"
+#include "strbuf.h"
+#include "utils.h"
+
+#define READ_WATERMARK_FILE "read-watermarks"
+#define READ_WATERMARK_HEADER "git-chat read watermarks v1\n"
+
+/**
+ * Read the watermark file at `path` into `contents`.
+ *
+ * Returns zero if successful, positive if the file does not exist, and
+ * negative if the file is malformed.
+ * */
+static int read_watermark_file(const char *path, struct strbuf *contents)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	strbuf_attach_fd(contents, fd);
+	close(fd);
+
+	size_t header_len = strlen(READ_WATERMARK_HEADER);
+	if (contents->len < header_len || memcmp(contents->buff, READ_WATERMARK_HEADER, header_len) != 0) {
+		LOG_WARN("read watermarks file '%s' has unexpected header", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int is_hex_object_id(const char *str)
+{
+	for (size_t i = 0; i < GIT_HEX_OBJECT_ID; i++) {
+		if (!isxdigit((unsigned char) str[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Find the line for `channel` in the watermark file contents. Malformed lines
+ * are skipped, so that a damaged line doesn't hide a good one.
+ *
+ * Returns a pointer to the start of the line, or NULL if there is none. If
+ * found, `line_len` is set to the length of the line, including the newline.
+ * */
+static const char *find_watermark(const struct strbuf *contents, const char *channel,
+		size_t *line_len)
+{
+	const char *line = contents->buff + strlen(READ_WATERMARK_HEADER);
+	const char *end = contents->buff + contents->len;
+	size_t channel_len = strlen(channel);
+
+	while (line < end) {
+		const char *lf = memchr(line, '\n', end - line);
+		if (!lf)
+			break;
+
+		if ((size_t) (lf - line) == GIT_HEX_OBJECT_ID + 1 + channel_len &&
+				line[GIT_HEX_OBJECT_ID] == ' ' &&
+				!memcmp(line + GIT_HEX_OBJECT_ID + 1, channel, channel_len) &&
+				is_hex_object_id(line)) {
+			*line_len = lf - line + 1;
+			return line;
+		}
+
+		line = lf + 1;
+	}
+
+	return NULL;
+}
+
+int read_watermark_get(const char *channel, struct git_oid *oid)
+{
+	struct strbuf path, contents;
+	size_t line_len;
+	int ret = 1;
+
+	strbuf_init(&path);
+	strbuf_init(&contents);
+	if (get_chat_cache_dir(&path))
+		FATAL("unable to obtain the path to the chat cache");
+	strbuf_attach_fmt(&path, "/%s", READ_WATERMARK_FILE);
+
+	if (!read_watermark_file(path.buff, &contents)) {
+		const char *line = find_watermark(&contents, channel, &line_len);
+		if (line) {
+			git_str_to_oid(oid, line);
+			ret = 0;
+		}
+	}
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+
+	return ret;
+}
+
+int read_watermark_set(const char *channel, const struct git_oid *oid)
+{
+	struct cache_lock lock;
+	struct strbuf contents, updated;
+	struct git_oid watermark = *oid;
+	char hex[GIT_HEX_OBJECT_ID];
+	size_t line_len;
+
+	if (strchr(channel, '\n'))
+		BUG("channel name '%s' cannot be stored in the read watermarks file", channel);
+
+	if (cache_file_lock(&lock, READ_WATERMARK_FILE))
+		return 1;
+
+	strbuf_init(&contents);
+	strbuf_init(&updated);
+
+	// read under the lock, so that a concurrent update isn't lost
+	int ret = read_watermark_file(lock.path.buff, &contents);
+	if (ret) {
+		strbuf_clear(&contents);
+		strbuf_attach_str(&contents, READ_WATERMARK_HEADER);
+	}
+
+	git_oid_to_str(&watermark, hex);
+
+	const char *line = find_watermark(&contents, channel, &line_len);
+	if (line) {
+		strbuf_attach(&updated, contents.buff, line - contents.buff);
+		strbuf_attach(&updated, hex, GIT_HEX_OBJECT_ID);
+		strbuf_attach_fmt(&updated, "%s", line + GIT_HEX_OBJECT_ID);
+	} else {
+		strbuf_attach(&updated, contents.buff, contents.len);
+		strbuf_attach_fmt(&updated, "%.*s %s\n", GIT_HEX_OBJECT_ID, hex, channel);
+	}
+
+	ret = cache_file_commit(&lock, updated.buff, updated.len);
+	if (!ret)
+		LOG_INFO("advanced read watermark for '%s' to %.*s", channel, GIT_HEX_OBJECT_ID, hex);
+
+	strbuf_release(&updated);
+	strbuf_release(&contents);
+
+	return ret;
+}
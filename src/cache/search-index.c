@@ -0,0 +1,951 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "cache/search-index.h"
+#include "cache/cache-file.h"
+#include "str-array.h"
+#include "utils.h"
+
+#define SEARCH_INDEX_FILE "search-index"
+#define SEARCH_INDEX_HEADER "git-chat search index v1\n"
+
+// BM25 parameters
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+static int search_term_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct search_term *a = entry;
+	const struct search_term *b = entry_or_key;
+
+	return strcmp(a->term, keydata ? (const char *) keydata : b->term);
+}
+
+static int search_document_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct search_document *a = entry;
+	const struct search_document *b = entry_or_key;
+	(void) keydata;
+
+	return memcmp(a->oid.id, b->oid.id, GIT_RAW_OBJECT_ID);
+}
+
+static void search_term_free(struct search_term *term)
+{
+	free(term->term);
+	free(term->postings);
+	free(term->pending);
+	free(term);
+}
+
+static int is_term_char(unsigned char c)
+{
+	return isalnum(c) || c >= 0x80;
+}
+
+typedef void (*term_cb)(const char *term, uint32_t position, void *data);
+
+/**
+ * Split `text` into terms, invoking `cb` with each (null-terminated,
+ * lower-cased) term and its position. Positions count from one.
+ *
+ * Returns the number of terms in the text.
+ * */
+static uint32_t tokenize(const char *text, size_t len, term_cb cb, void *data)
+{
+	char term[SEARCH_TERM_MAX + 1];
+	uint32_t position = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		if (!is_term_char(text[i])) {
+			i++;
+			continue;
+		}
+
+		size_t term_len = 0;
+		for (; i < len && is_term_char(text[i]); i++) {
+			if (term_len < SEARCH_TERM_MAX)
+				term[term_len++] = (char) tolower((unsigned char) text[i]);
+		}
+
+		term[term_len] = 0;
+		cb(term, ++position, data);
+	}
+
+	return position;
+}
+
+static void postings_append_varint(struct search_term *term, uint32_t value)
+{
+	if (term->postings_len + 5 > term->postings_alloc) {
+		term->postings_alloc = term->postings_alloc ? term->postings_alloc * 2 : 16;
+		term->postings = (unsigned char *) realloc(term->postings, term->postings_alloc);
+		if (!term->postings)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	do {
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+
+		term->postings[term->postings_len++] = byte;
+	} while (value);
+}
+
+/**
+ * Decode a varint at `*data`, advancing `*data` past it.
+ *
+ * Returns zero if successful, and non-zero if the varint is truncated or too
+ * large.
+ * */
+static int read_varint(const unsigned char **data, const unsigned char *end, uint32_t *value)
+{
+	uint32_t result = 0;
+
+	for (int shift = 0; *data < end && shift < 32; shift += 7) {
+		unsigned char byte = *(*data)++;
+		result |= (uint32_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static struct search_term *find_term(struct search_index *index, const char *term)
+{
+	struct search_term key;
+	hashmap_entry_init(&key, strhash(term));
+
+	return hashmap_get(&index->terms, &key, term);
+}
+
+static struct search_term *find_or_add_term(struct search_index *index, const char *term)
+{
+	struct search_term *entry = find_term(index, term);
+	if (entry)
+		return entry;
+
+	entry = (struct search_term *) calloc(1, sizeof(struct search_term));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, strhash(term));
+	entry->term = strdup(term);
+	if (!entry->term)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_add(&index->terms, entry);
+	return entry;
+}
+
+static struct search_document *add_document(struct search_index *index,
+		const struct git_oid *oid, uint32_t length)
+{
+	struct search_document *doc =
+			(struct search_document *) malloc(sizeof(struct search_document));
+	if (!doc)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(doc, git_oid_hash(oid));
+	doc->oid = *oid;
+	doc->length = length;
+	hashmap_add(&index->documents, doc);
+
+	if (index->docs_len == index->docs_alloc) {
+		index->docs_alloc = index->docs_alloc ? index->docs_alloc * 2 : 64;
+		index->docs = (struct search_document **) realloc(index->docs,
+				index->docs_alloc * sizeof(struct search_document *));
+		if (!index->docs)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	index->docs[index->docs_len++] = doc;
+	index->total_length += length;
+
+	return doc;
+}
+
+void search_index_init(struct search_index *index)
+{
+	hashmap_init(&index->terms, search_term_cmp, 0);
+	hashmap_init(&index->documents, search_document_cmp, 0);
+	index->docs = NULL;
+	index->docs_len = 0;
+	index->docs_alloc = 0;
+	index->total_length = 0;
+	index->dirty = 0;
+}
+
+/**
+ * Parse an unsigned decimal integer at `*data` followed by `terminator`,
+ * advancing `*data` past the terminator.
+ *
+ * Returns zero if successful, and non-zero otherwise.
+ * */
+static int parse_uint(const char **data, const char *end, char terminator, uint32_t *value)
+{
+	const char *str = *data;
+	uint64_t result = 0;
+
+	while (str < end && isdigit((unsigned char) *str)) {
+		result = result * 10 + (*str++ - '0');
+		if (result > UINT32_MAX)
+			return 1;
+	}
+
+	if (str == *data || str >= end || *str != terminator)
+		return 1;
+
+	*value = (uint32_t) result;
+	*data = str + 1;
+	return 0;
+}
+
+/**
+ * The plaintext of a search index file has the following format:
+ *
+ * git-chat search index v1
+ * <number of messages>
+ * <commit id> <number of terms>          (for each message, in message order)
+ * <term> <messages> <last message> <length of posting list>
+ * <posting list>                         (for each term)
+ * */
+int search_index_parse(struct search_index *index, const char *data, size_t len)
+{
+	const char *end = data + len;
+	size_t header_len = strlen(SEARCH_INDEX_HEADER);
+	uint32_t docs_count;
+
+	if (len < header_len || memcmp(data, SEARCH_INDEX_HEADER, header_len) != 0) {
+		LOG_WARN("search index has unexpected header");
+		return 1;
+	}
+
+	data += header_len;
+	if (parse_uint(&data, end, '\n', &docs_count))
+		return 1;
+
+	for (uint32_t i = 0; i < docs_count; i++) {
+		struct git_oid oid;
+		uint32_t length;
+
+		if ((size_t) (end - data) < GIT_HEX_OBJECT_ID + 1 || data[GIT_HEX_OBJECT_ID] != ' ')
+			return 1;
+		for (size_t j = 0; j < GIT_HEX_OBJECT_ID; j++) {
+			if (!isxdigit((unsigned char) data[j]))
+				return 1;
+		}
+
+		git_str_to_oid(&oid, data);
+		data += GIT_HEX_OBJECT_ID + 1;
+		if (parse_uint(&data, end, '\n', &length))
+			return 1;
+
+		if (search_index_contains(index, &oid))
+			return 1;
+		add_document(index, &oid, length);
+	}
+
+	while (data < end) {
+		uint32_t doc_count, last_doc, postings_len;
+
+		const char *sp = memchr(data, ' ', end - data);
+		if (!sp || sp == data || (size_t) (sp - data) > SEARCH_TERM_MAX)
+			return 1;
+
+		char term[SEARCH_TERM_MAX + 1];
+		memcpy(term, data, sp - data);
+		term[sp - data] = 0;
+
+		data = sp + 1;
+		if (parse_uint(&data, end, ' ', &doc_count) ||
+				parse_uint(&data, end, ' ', &last_doc) ||
+				parse_uint(&data, end, '\n', &postings_len))
+			return 1;
+
+		if (!doc_count || last_doc > index->docs_len ||
+				(size_t) (end - data) < (size_t) postings_len + 1 || data[postings_len] != '\n')
+			return 1;
+
+		struct search_term *entry = find_or_add_term(index, term);
+		if (entry->doc_count)
+			return 1;
+
+		entry->doc_count = doc_count;
+		entry->last_doc = last_doc;
+		entry->postings_len = postings_len;
+		entry->postings_alloc = postings_len;
+		entry->postings = (unsigned char *) malloc(postings_len);
+		if (!entry->postings)
+			FATAL(MEM_ALLOC_FAILED);
+		memcpy(entry->postings, data, postings_len);
+
+		data += postings_len + 1;
+	}
+
+	return 0;
+}
+
+void search_index_serialize(struct search_index *index, struct strbuf *out)
+{
+	struct hashmap_iter iter;
+	struct search_term *term;
+
+	strbuf_attach_str(out, SEARCH_INDEX_HEADER);
+	strbuf_attach_fmt(out, "%zu\n", index->docs_len);
+
+	for (size_t i = 0; i < index->docs_len; i++) {
+		char oid_str[GIT_HEX_OBJECT_ID];
+		git_oid_to_str(&index->docs[i]->oid, oid_str);
+
+		strbuf_attach_fmt(out, "%.*s %" PRIu32 "\n", GIT_HEX_OBJECT_ID, oid_str,
+				index->docs[i]->length);
+	}
+
+	hashmap_iter_init(&index->terms, &iter);
+	while ((term = hashmap_iter_next(&iter))) {
+		if (!term->doc_count)
+			continue;
+
+		strbuf_attach_fmt(out, "%s %" PRIu32 " %" PRIu32 " %zu\n", term->term,
+				term->doc_count, term->last_doc, term->postings_len);
+		strbuf_attach(out, (const char *) term->postings, term->postings_len);
+		strbuf_attach_chr(out, '\n');
+	}
+}
+
+int search_index_load(struct search_index *index, struct gc_gpgme_ctx *ctx)
+{
+	struct strbuf plaintext;
+	strbuf_init(&plaintext);
+
+	int ret = cache_file_read(ctx, SEARCH_INDEX_FILE, &plaintext);
+	if (ret > 0) {
+		strbuf_release(&plaintext);
+		return 0;
+	}
+
+	if (!ret && search_index_parse(index, plaintext.buff, plaintext.len)) {
+		LOG_WARN("search index is malformed");
+		ret = 1;
+	}
+
+	if (ret) {
+		// start from an empty index; it will be rebuilt as messages are read
+		search_index_release(index);
+		search_index_init(index);
+	}
+
+	index->dirty = 0;
+
+	LOG_INFO("loaded %zu messages from the search index", index->docs_len);
+
+	memset(plaintext.buff, 0, plaintext.alloc);
+	strbuf_release(&plaintext);
+
+	return ret != 0;
+}
+
+int search_index_write(struct search_index *index, struct gc_gpgme_ctx *ctx)
+{
+	struct strbuf plaintext;
+
+	if (!index->dirty)
+		return 0;
+
+	strbuf_init(&plaintext);
+	search_index_serialize(index, &plaintext);
+
+	int ret = cache_file_write(ctx, SEARCH_INDEX_FILE, &plaintext);
+	if (!ret) {
+		LOG_INFO("wrote %zu messages to the search index", index->docs_len);
+		index->dirty = 0;
+	}
+
+	memset(plaintext.buff, 0, plaintext.alloc);
+	strbuf_release(&plaintext);
+
+	return ret;
+}
+
+int search_index_contains(struct search_index *index, const struct git_oid *oid)
+{
+	struct search_document key;
+	hashmap_entry_init(&key, git_oid_hash(oid));
+	key.oid = *oid;
+
+	return hashmap_get(&index->documents, &key, NULL) != NULL;
+}
+
+struct add_message_data {
+	struct search_index *index;
+	struct search_term **touched;
+	size_t touched_len;
+	size_t touched_alloc;
+};
+
+static void add_message_term_cb(const char *term, uint32_t position, void *data)
+{
+	struct add_message_data *add = (struct add_message_data *) data;
+	struct search_term *entry = find_or_add_term(add->index, term);
+
+	if (!entry->pending_len) {
+		if (add->touched_len == add->touched_alloc) {
+			add->touched_alloc = add->touched_alloc ? add->touched_alloc * 2 : 32;
+			add->touched = (struct search_term **) realloc(add->touched,
+					add->touched_alloc * sizeof(struct search_term *));
+			if (!add->touched)
+				FATAL(MEM_ALLOC_FAILED);
+		}
+
+		add->touched[add->touched_len++] = entry;
+	}
+
+	if (entry->pending_len == entry->pending_alloc) {
+		entry->pending_alloc = entry->pending_alloc ? entry->pending_alloc * 2 : 4;
+		entry->pending = (uint32_t *) realloc(entry->pending,
+				entry->pending_alloc * sizeof(uint32_t));
+		if (!entry->pending)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	entry->pending[entry->pending_len++] = position;
+}
+
+void search_index_add(struct search_index *index, const struct git_oid *oid,
+		const char *text, size_t len)
+{
+	if (search_index_contains(index, oid))
+		return;
+
+	struct add_message_data add = { .index = index };
+	uint32_t length = tokenize(text, len, add_message_term_cb, &add);
+
+	add_document(index, oid, length);
+	uint32_t doc = (uint32_t) index->docs_len;
+
+	// append a posting for each distinct term in the message
+	for (size_t i = 0; i < add.touched_len; i++) {
+		struct search_term *term = add.touched[i];
+
+		postings_append_varint(term, doc - term->last_doc);
+		postings_append_varint(term, (uint32_t) term->pending_len);
+
+		uint32_t previous = 0;
+		for (size_t j = 0; j < term->pending_len; j++) {
+			postings_append_varint(term, term->pending[j] - previous);
+			previous = term->pending[j];
+		}
+
+		term->last_doc = doc;
+		term->doc_count++;
+		term->pending_len = 0;
+	}
+
+	free(add.touched);
+	index->dirty = 1;
+}
+
+/**
+ * Sequential reader over an encoded posting list.
+ * */
+struct posting_reader {
+	const unsigned char *data;
+	const unsigned char *end;
+	uint32_t max_doc;
+	uint32_t doc;
+	uint32_t tf;
+};
+
+static void posting_reader_init(struct posting_reader *reader,
+		const struct search_index *index, const struct search_term *term)
+{
+	reader->max_doc = (uint32_t) index->docs_len;
+	reader->data = term->postings;
+	reader->end = term->postings + term->postings_len;
+	reader->doc = 0;
+	reader->tf = 0;
+}
+
+/**
+ * Advance to the next posting. If `positions` is not NULL, the positions of the
+ * term in the message are written to it, growing it as necessary.
+ *
+ * Returns non-zero if a posting was read, and zero at the end of the list or
+ * if the list is malformed.
+ * */
+static int posting_reader_next(struct posting_reader *reader, uint32_t **positions,
+		size_t *positions_alloc)
+{
+	uint32_t delta, tf;
+
+	if (reader->data >= reader->end)
+		return 0;
+	if (read_varint(&reader->data, reader->end, &delta) ||
+			read_varint(&reader->data, reader->end, &tf) || !delta || !tf ||
+			delta > reader->max_doc - reader->doc)
+		goto malformed;
+
+	if (positions && tf > *positions_alloc) {
+		*positions_alloc = tf;
+		*positions = (uint32_t *) realloc(*positions, tf * sizeof(uint32_t));
+		if (!*positions)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	uint32_t position = 0;
+	for (uint32_t i = 0; i < tf; i++) {
+		uint32_t position_delta;
+		if (read_varint(&reader->data, reader->end, &position_delta))
+			goto malformed;
+
+		position += position_delta;
+		if (positions)
+			(*positions)[i] = position;
+	}
+
+	reader->doc += delta;
+	reader->tf = tf;
+	return 1;
+
+malformed:
+	LOG_WARN("search index has a malformed posting list");
+	reader->data = reader->end;
+	return 0;
+}
+
+struct doc_match {
+	uint32_t doc;
+	uint32_t tf;
+};
+
+struct match_list {
+	struct doc_match *items;
+	size_t len;
+	size_t alloc;
+};
+
+static void match_list_push(struct match_list *list, uint32_t doc, uint32_t tf)
+{
+	if (list->len == list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 64;
+		list->items = (struct doc_match *) realloc(list->items,
+				list->alloc * sizeof(struct doc_match));
+		if (!list->items)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	list->items[list->len].doc = doc;
+	list->items[list->len].tf = tf;
+	list->len++;
+}
+
+static int doc_match_cmp(const void *a, const void *b)
+{
+	uint32_t x = ((const struct doc_match *) a)->doc;
+	uint32_t y = ((const struct doc_match *) b)->doc;
+
+	return (x > y) - (x < y);
+}
+
+static void match_term(const struct search_index *index, const struct search_term *term,
+		struct match_list *matches)
+{
+	struct posting_reader reader;
+	posting_reader_init(&reader, index, term);
+
+	while (posting_reader_next(&reader, NULL, NULL))
+		match_list_push(matches, reader.doc, reader.tf);
+}
+
+static int term_ptr_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct search_term * const *) a)->term,
+			(*(struct search_term * const *) b)->term);
+}
+
+/**
+ * Match the messages containing any term starting with `prefix`. The
+ * occurrences of all such terms in a message are counted together.
+ * */
+static void match_prefix(const struct search_index *index, struct search_term **sorted_terms, size_t terms_len,
+		const char *prefix, struct match_list *matches)
+{
+	size_t prefix_len = strlen(prefix);
+	size_t lo = 0, hi = terms_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (strcmp(sorted_terms[mid]->term, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	struct match_list all = { NULL, 0, 0 };
+	for (size_t i = lo; i < terms_len; i++) {
+		if (strncmp(sorted_terms[i]->term, prefix, prefix_len) != 0)
+			break;
+
+		match_term(index, sorted_terms[i], &all);
+	}
+
+	qsort(all.items, all.len, sizeof(struct doc_match), doc_match_cmp);
+	for (size_t i = 0; i < all.len; i++) {
+		if (matches->len && matches->items[matches->len - 1].doc == all.items[i].doc)
+			matches->items[matches->len - 1].tf += all.items[i].tf;
+		else
+			match_list_push(matches, all.items[i].doc, all.items[i].tf);
+	}
+
+	free(all.items);
+}
+
+/**
+ * Fully decoded posting list of a single term, for phrase matching.
+ * */
+struct decoded_postings {
+	struct doc_match *docs;
+	size_t *offsets;
+	size_t len;
+	uint32_t *positions;
+	size_t cursor;
+};
+
+static void decode_postings(const struct search_index *index, const struct search_term *term,
+		struct decoded_postings *out)
+{
+	struct posting_reader reader;
+	uint32_t *positions = NULL;
+	size_t positions_alloc = 0, total = 0, total_alloc = 0;
+
+	out->docs = (struct doc_match *) malloc((term->doc_count + 1) * sizeof(struct doc_match));
+	out->offsets = (size_t *) malloc((term->doc_count + 1) * sizeof(size_t));
+	if (!out->docs || !out->offsets)
+		FATAL(MEM_ALLOC_FAILED);
+
+	out->len = 0;
+	out->positions = NULL;
+	out->cursor = 0;
+
+	posting_reader_init(&reader, index, term);
+	while (out->len < term->doc_count &&
+			posting_reader_next(&reader, &positions, &positions_alloc)) {
+		if (total + reader.tf > total_alloc) {
+			total_alloc = (total + reader.tf) * 2;
+			out->positions = (uint32_t *) realloc(out->positions,
+					total_alloc * sizeof(uint32_t));
+			if (!out->positions)
+				FATAL(MEM_ALLOC_FAILED);
+		}
+
+		memcpy(out->positions + total, positions, reader.tf * sizeof(uint32_t));
+		out->docs[out->len].doc = reader.doc;
+		out->docs[out->len].tf = reader.tf;
+		out->offsets[out->len] = total;
+		out->len++;
+		total += reader.tf;
+	}
+
+	free(positions);
+}
+
+static int contains_position(const uint32_t *positions, uint32_t len, uint32_t position)
+{
+	uint32_t lo = 0, hi = len;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (positions[mid] == position)
+			return 1;
+		if (positions[mid] < position)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+/**
+ * Match the messages containing the terms of `phrase`, in order and adjacent
+ * to one another. The number of occurrences of the phrase is counted.
+ * */
+static void match_phrase(struct search_index *index, struct str_array *phrase,
+		struct match_list *matches)
+{
+	size_t n = phrase->len;
+	struct decoded_postings *terms =
+			(struct decoded_postings *) calloc(n, sizeof(struct decoded_postings));
+	if (!terms)
+		FATAL(MEM_ALLOC_FAILED);
+
+	for (size_t i = 0; i < n; i++) {
+		struct search_term *term = find_term(index, str_array_get(phrase, i));
+		if (!term)
+			goto cleanup;
+
+		decode_postings(index, term, &terms[i]);
+	}
+
+	while (1) {
+		// find the next message containing every term of the phrase
+		uint32_t doc = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (terms[i].cursor >= terms[i].len)
+				goto cleanup;
+			if (terms[i].docs[terms[i].cursor].doc > doc)
+				doc = terms[i].docs[terms[i].cursor].doc;
+		}
+
+		int aligned = 1;
+		for (size_t i = 0; i < n; i++) {
+			while (terms[i].cursor < terms[i].len && terms[i].docs[terms[i].cursor].doc < doc)
+				terms[i].cursor++;
+			if (terms[i].cursor >= terms[i].len)
+				goto cleanup;
+			if (terms[i].docs[terms[i].cursor].doc != doc)
+				aligned = 0;
+		}
+
+		if (!aligned)
+			continue;
+
+		const uint32_t *first = terms[0].positions + terms[0].offsets[terms[0].cursor];
+		uint32_t occurrences = 0;
+		for (uint32_t p = 0; p < terms[0].docs[terms[0].cursor].tf; p++) {
+			size_t i;
+			for (i = 1; i < n; i++) {
+				const struct decoded_postings *term = &terms[i];
+				if (!contains_position(term->positions + term->offsets[term->cursor],
+						term->docs[term->cursor].tf, first[p] + i))
+					break;
+			}
+
+			if (i == n)
+				occurrences++;
+		}
+
+		if (occurrences)
+			match_list_push(matches, doc, occurrences);
+
+		for (size_t i = 0; i < n; i++)
+			terms[i].cursor++;
+	}
+
+cleanup:
+	for (size_t i = 0; i < n; i++) {
+		free(terms[i].docs);
+		free(terms[i].offsets);
+		free(terms[i].positions);
+	}
+
+	free(terms);
+}
+
+static double bm25(const struct search_index *index, size_t df, uint32_t tf, uint32_t length)
+{
+	double n = (double) index->docs_len;
+	double average = index->total_length ? (double) index->total_length / n : 1.0;
+	double idf = log(1.0 + (n - (double) df + 0.5) / ((double) df + 0.5));
+
+	return idf * tf * (BM25_K1 + 1.0) /
+			(tf + BM25_K1 * (1.0 - BM25_B + BM25_B * length / average));
+}
+
+static void collect_term_cb(const char *term, uint32_t position, void *data)
+{
+	(void) position;
+	str_array_push((struct str_array *) data, term, NULL);
+}
+
+struct scored_doc {
+	uint32_t doc;
+	double score;
+};
+
+static int scored_doc_cmp(const void *a, const void *b)
+{
+	const struct scored_doc *x = a;
+	const struct scored_doc *y = b;
+
+	if (x->score != y->score)
+		return x->score < y->score ? 1 : -1;
+
+	// more recently indexed messages first
+	return (x->doc < y->doc) - (x->doc > y->doc);
+}
+
+/**
+ * Combine the matches of a clause with the matches of the previous clauses,
+ * keeping only the messages matched by both.
+ * */
+static void combine_clause(struct search_index *index, struct scored_doc **scored,
+		size_t *scored_len, int first_clause, const struct match_list *matches)
+{
+	if (first_clause) {
+		*scored = (struct scored_doc *) malloc((matches->len + 1) * sizeof(struct scored_doc));
+		if (!*scored)
+			FATAL(MEM_ALLOC_FAILED);
+
+		for (size_t i = 0; i < matches->len; i++) {
+			const struct doc_match *match = &matches->items[i];
+			(*scored)[i].doc = match->doc;
+			(*scored)[i].score = bm25(index, matches->len, match->tf,
+					index->docs[match->doc - 1]->length);
+		}
+
+		*scored_len = matches->len;
+		return;
+	}
+
+	size_t i = 0, j = 0, out = 0;
+	while (i < *scored_len && j < matches->len) {
+		const struct doc_match *match = &matches->items[j];
+		if ((*scored)[i].doc < match->doc) {
+			i++;
+		} else if ((*scored)[i].doc > match->doc) {
+			j++;
+		} else {
+			(*scored)[out].doc = match->doc;
+			(*scored)[out].score = (*scored)[i].score + bm25(index, matches->len,
+					match->tf, index->docs[match->doc - 1]->length);
+			out++;
+			i++;
+			j++;
+		}
+	}
+
+	*scored_len = out;
+}
+
+int search_index_query(struct search_index *index, const char *query,
+		struct search_result **results, size_t *len)
+{
+	struct search_term **sorted_terms = NULL;
+	size_t terms_len = 0;
+	struct scored_doc *scored = NULL;
+	size_t scored_len = 0;
+	int clauses = 0, ret = 0;
+
+	while (*query) {
+		if (isspace((unsigned char) *query)) {
+			query++;
+			continue;
+		}
+
+		const char *clause = query;
+		size_t clause_len;
+		int prefix = 0;
+
+		if (*query == '"') {
+			const char *closing = strchr(query + 1, '"');
+			if (!closing) {
+				ret = 1;
+				goto cleanup;
+			}
+
+			clause = query + 1;
+			clause_len = closing - clause;
+			query = closing + 1;
+		} else {
+			while (*query && !isspace((unsigned char) *query))
+				query++;
+
+			clause_len = query - clause;
+			prefix = clause[clause_len - 1] == '*';
+		}
+
+		struct str_array terms;
+		str_array_init(&terms);
+		tokenize(clause, clause_len, collect_term_cb, &terms);
+		if (!terms.len) {
+			str_array_release(&terms);
+			continue;
+		}
+
+		struct match_list matches = { NULL, 0, 0 };
+		if (terms.len > 1) {
+			match_phrase(index, &terms, &matches);
+		} else if (prefix) {
+			if (!sorted_terms) {
+				struct hashmap_iter iter;
+				struct search_term *term;
+
+				sorted_terms = (struct search_term **) malloc(
+						(index->terms.size + 1) * sizeof(struct search_term *));
+				if (!sorted_terms)
+					FATAL(MEM_ALLOC_FAILED);
+
+				hashmap_iter_init(&index->terms, &iter);
+				while ((term = hashmap_iter_next(&iter)))
+					sorted_terms[terms_len++] = term;
+				qsort(sorted_terms, terms_len, sizeof(struct search_term *), term_ptr_cmp);
+			}
+
+			match_prefix(index, sorted_terms, terms_len, str_array_get(&terms, 0), &matches);
+		} else {
+			struct search_term *term = find_term(index, str_array_get(&terms, 0));
+			if (term)
+				match_term(index, term, &matches);
+		}
+
+		combine_clause(index, &scored, &scored_len, !clauses, &matches);
+		clauses++;
+
+		free(matches.items);
+		str_array_release(&terms);
+	}
+
+	if (!clauses) {
+		ret = 1;
+		goto cleanup;
+	}
+
+	qsort(scored, scored_len, sizeof(struct scored_doc), scored_doc_cmp);
+
+	*results = (struct search_result *) malloc((scored_len + 1) * sizeof(struct search_result));
+	if (!*results)
+		FATAL(MEM_ALLOC_FAILED);
+
+	for (size_t i = 0; i < scored_len; i++) {
+		(*results)[i].oid = index->docs[scored[i].doc - 1]->oid;
+		(*results)[i].score = scored[i].score;
+	}
+
+	*len = scored_len;
+
+cleanup:
+	free(scored);
+	free(sorted_terms);
+	return ret;
+}
+
+void search_index_release(struct search_index *index)
+{
+	struct hashmap_iter iter;
+	struct search_term *term;
+
+	hashmap_iter_init(&index->terms, &iter);
+	while ((term = hashmap_iter_next(&iter)))
+		search_term_free(term);
+
+	hashmap_release(&index->terms, 0);
+	hashmap_release(&index->documents, 1);
+	free(index->docs);
+
+	index->docs = NULL;
+	index->docs_len = 0;
+	index->docs_alloc = 0;
+	index->total_length = 0;
+	index->dirty = 0;
+}
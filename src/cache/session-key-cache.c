@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cache/session-key-cache.h"
+#include "utils.h"
+
+static int session_key_cache_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct session_key_cache_entry *a = entry;
+	const struct session_key_cache_entry *b = entry_or_key;
+	(void) keydata;
+
+	return memcmp(a->oid.id, b->oid.id, GIT_RAW_OBJECT_ID);
+}
+
+static void session_key_cache_entry_free(void *data)
+{
+	struct session_key_cache_entry *entry = data;
+
+	memset(entry->session_key.buff, 0, entry->session_key.alloc);
+	strbuf_release(&entry->session_key);
+	free(entry);
+}
+
+static int session_key_cache_entry_same(const void *a, const void *b)
+{
+	const struct session_key_cache_entry *x = a;
+	const struct session_key_cache_entry *y = b;
+
+	return !strcmp(x->session_key.buff, y->session_key.buff);
+}
+
+/**
+ * Determine whether a session key can be safely stored on a single line of the
+ * cache file.
+ * */
+static int is_valid_session_key(const char *session_key, size_t len)
+{
+	if (!len)
+		return 0;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!isgraph((unsigned char) session_key[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void put_session_key(struct keyed_cache *cache, const struct git_oid *oid,
+		const char *session_key, size_t len)
+{
+	struct session_key_cache_entry *entry =
+			(struct session_key_cache_entry *) malloc(sizeof(struct session_key_cache_entry));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, git_oid_hash(oid));
+	entry->oid = *oid;
+
+	strbuf_init(&entry->session_key);
+	strbuf_attach(&entry->session_key, session_key, len);
+
+	keyed_cache_put(cache, entry);
+}
+
+/**
+ * Parse a record of a session key cache file. Each session key is stored on
+ * its own line:
+ *
+ * <commit id> <session key>
+ * */
+static size_t parse_session_key(struct keyed_cache *cache, const char *data, size_t len)
+{
+	struct git_oid oid;
+
+	const char *lf = memchr(data, '\n', len);
+	if (!lf || (lf - data) < (GIT_HEX_OBJECT_ID + 2) || data[GIT_HEX_OBJECT_ID] != ' ')
+		return 0;
+
+	const char *session_key = data + GIT_HEX_OBJECT_ID + 1;
+	size_t session_key_len = lf - session_key;
+	if (!is_valid_session_key(session_key, session_key_len))
+		return 0;
+
+	git_str_to_oid(&oid, data);
+	put_session_key(cache, &oid, session_key, session_key_len);
+
+	return lf + 1 - data;
+}
+
+static void serialize_session_key(void *data, struct strbuf *out)
+{
+	struct session_key_cache_entry *entry = data;
+	char oid_str[GIT_HEX_OBJECT_ID];
+	git_oid_to_str(&entry->oid, oid_str);
+
+	strbuf_attach_fmt(out, "%.*s %s\n", GIT_HEX_OBJECT_ID, oid_str,
+			entry->session_key.buff);
+}
+
+static const struct keyed_cache_type session_key_cache_type = {
+	.file = "session-keys",
+	.header = "git-chat session key cache v1\n",
+	.name = "session key cache",
+	.entries = "session keys",
+	.cmp = session_key_cache_entry_cmp,
+	.parse = parse_session_key,
+	.serialize = serialize_session_key,
+	.same_value = session_key_cache_entry_same,
+	.free = session_key_cache_entry_free
+};
+
+void session_key_cache_init(struct session_key_cache *cache)
+{
+	keyed_cache_init(&cache->cache, &session_key_cache_type);
+}
+
+int session_key_cache_load(struct session_key_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	return keyed_cache_load(&cache->cache, ctx);
+}
+
+struct session_key_cache_entry *session_key_cache_get(struct session_key_cache *cache,
+		const struct git_oid *oid)
+{
+	struct session_key_cache_entry key;
+	hashmap_entry_init(&key, git_oid_hash(oid));
+	key.oid = *oid;
+
+	return keyed_cache_get(&cache->cache, &key, NULL);
+}
+
+void session_key_cache_put(struct session_key_cache *cache, const struct git_oid *oid,
+		const char *session_key)
+{
+	size_t len = strlen(session_key);
+	if (!is_valid_session_key(session_key, len)) {
+		LOG_WARN("refusing to cache malformed session key");
+		return;
+	}
+
+	put_session_key(&cache->cache, oid, session_key, len);
+}
+
+int session_key_cache_write(struct session_key_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	return keyed_cache_write(&cache->cache, ctx);
+}
+
+void session_key_cache_release(struct session_key_cache *cache)
+{
+	keyed_cache_release(&cache->cache);
+}
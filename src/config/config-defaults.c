@@ -14,6 +14,9 @@ static const struct config_def config_defaults[] = {
 		{ "channel.*.name", "" },
 		{ "channel.*.createdby", "" },
 		{ "channel.*.description", "" },
+		{ "channel.*.groupkey", "false" },
+		{ "channel.*.epoch", "" },
+		{ "message.storage", "armor" },
 		{ NULL, NULL }
 };
 
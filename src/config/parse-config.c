@@ -11,6 +11,7 @@
 #include "config/config-key.h"
 #include "config/config-defaults.h"
 #include "config/node-visitor.h"
+#include "working-tree.h"
 #include "strbuf.h"
 #include "utils.h"
 
@@ -165,7 +166,8 @@ fail:
 /**
  * Read a single line from the given file descriptor `fd` into the string buffer
  * `line`. This function is stateful though `input_buffer`; unprocessed data
- * is left in the buffer for the next invocation of this function.
+ * is left in the buffer for the next invocation of this function. If `fd` is
+ * negative, lines are only read from `input_buffer`.
  *
  * Lines are trimmed of leading and trailing whitespace. Lines consisting of
  * only whitespace are filtered.
@@ -181,7 +183,7 @@ static int read_line_fd(struct strbuf *input_buffer, struct strbuf *line, int fd
 		// while there's data left to read from fd and we don't have a full
 		// line yet in the input_buffer, read from fd into input_buffer.
 		do {
-			bytes_read = xread(fd, tmp, BUFF_LEN);
+			bytes_read = fd < 0 ? 0 : xread(fd, tmp, BUFF_LEN);
 			if (bytes_read < 0)
 				FATAL("failed to read from file descriptor");
 			if (bytes_read > 0)
@@ -209,17 +211,20 @@ static int read_line_fd(struct strbuf *input_buffer, struct strbuf *line, int fd
 	return line->len == 0;
 }
 
-int parse_config_fd(struct config_data *conf, int fd)
+/**
+ * Parse config lines from `input_buffer`, followed by the file descriptor `fd`
+ * (if not negative). The input buffer is released.
+ * */
+static int parse_config_input(struct config_data *conf, struct strbuf *input_buffer, int fd)
 {
-	struct strbuf input_buffer, line, current_section, property, property_val;
-	strbuf_init(&input_buffer);
+	struct strbuf line, current_section, property, property_val;
 	strbuf_init(&line);
 	strbuf_init(&current_section);
 	strbuf_init(&property);
 	strbuf_init(&property_val);
 
 	int status = 0;
-	while (!status && !read_line_fd(&input_buffer, &line, fd)) {
+	while (!status && !read_line_fd(input_buffer, &line, fd)) {
 		// is this a section line?
 		if (!extract_section_key(&line, &current_section)) {
 			strbuf_clear(&line);
@@ -264,11 +269,28 @@ int parse_config_fd(struct config_data *conf, int fd)
 	strbuf_release(&property);
 	strbuf_release(&current_section);
 	strbuf_release(&line);
-	strbuf_release(&input_buffer);
+	strbuf_release(input_buffer);
 
 	return status;
 }
 
+int parse_config_fd(struct config_data *conf, int fd)
+{
+	struct strbuf input_buffer;
+	strbuf_init(&input_buffer);
+
+	return parse_config_input(conf, &input_buffer, fd);
+}
+
+int parse_config_buffer(struct config_data *conf, const char *data, size_t len)
+{
+	struct strbuf input_buffer;
+	strbuf_init(&input_buffer);
+	strbuf_attach(&input_buffer, data, len);
+
+	return parse_config_input(conf, &input_buffer, -1);
+}
+
 int write_config(struct config_data *conf, const char *conf_path)
 {
 	int conf_fd = open(conf_path, O_TRUNC | O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
@@ -448,3 +470,34 @@ int is_config_invalid(const char *conf_path, int recognized_keys_only)
 	config_data_release(&conf);
 	return status;
 }
+
+int get_config_value(const char *key, struct strbuf *value)
+{
+	struct strbuf config_path;
+	struct config_data *conf;
+
+	strbuf_init(&config_path);
+	if (get_git_chat_dir(&config_path))
+		FATAL("unable to obtain the path to the .git-chat directory");
+	strbuf_attach_str(&config_path, "/config");
+
+	config_data_init(&conf);
+	int status = parse_config(conf, config_path.buff);
+	if (status) {
+		LOG_WARN("unable to read config from '%s'", config_path.buff);
+		config_data_release(&conf);
+		strbuf_release(&config_path);
+		return 1;
+	}
+
+	const char *found = config_data_find(conf, key);
+	if (!found)
+		found = get_default_config_value(key);
+	if (found)
+		strbuf_attach_str(value, found);
+
+	config_data_release(&conf);
+	strbuf_release(&config_path);
+
+	return found == NULL;
+}
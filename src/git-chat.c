@@ -38,7 +38,10 @@ int main(int argc, char *argv[])
 			OPT_CMD("message", "create messages", NULL),
 			OPT_CMD("publish", "publish messages to the remote server", NULL),
 			OPT_CMD("get", "download messages", NULL),
+			OPT_CMD("get-attachment", "decrypt a file attached to a message", NULL),
 			OPT_CMD("read", "display, format and read messages", NULL),
+			OPT_CMD("search", "search messages", NULL),
+			OPT_CMD("grep", "match messages against a regular expression", NULL),
 			OPT_CMD("import-key", "import a GPG key into the current channel", NULL),
 			OPT_CMD("config", "configure a channel", NULL),
 
@@ -0,0 +1,321 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "git/attachment.h"
+#include "git/object-coprocess.h"
+#include "run-command.h"
+#include "utils.h"
+
+void attachment_manifest_init(struct attachment_manifest *manifest)
+{
+	manifest->entries = NULL;
+	manifest->len = 0;
+	manifest->alloc = 0;
+}
+
+void attachment_manifest_release(struct attachment_manifest *manifest)
+{
+	for (size_t i = 0; i < manifest->len; i++)
+		strbuf_release(&manifest->entries[i].name);
+
+	free(manifest->entries);
+	attachment_manifest_init(manifest);
+}
+
+void attachment_manifest_add(struct attachment_manifest *manifest, const char *name,
+		size_t size, size_t chunks)
+{
+	if (manifest->len >= manifest->alloc) {
+		size_t alloc = manifest->alloc ? manifest->alloc * 2 : 4;
+		struct attachment *entries = realloc(manifest->entries,
+				alloc * sizeof(struct attachment));
+		if (!entries)
+			FATAL(MEM_ALLOC_FAILED);
+
+		manifest->entries = entries;
+		manifest->alloc = alloc;
+	}
+
+	struct attachment *entry = &manifest->entries[manifest->len++];
+	strbuf_init(&entry->name);
+	strbuf_attach_str(&entry->name, name);
+	entry->size = size;
+	entry->chunks = chunks;
+}
+
+/**
+ * Parse a decimal number at `*str`, no further than `end`, advancing `*str`
+ * past it.
+ *
+ * Returns zero if successful, and non-zero if there is no number at `*str`.
+ * */
+static int parse_size(const char **str, const char *end, size_t *value)
+{
+	const char *current = *str;
+
+	*value = 0;
+	while (current < end && isdigit((unsigned char) *current)) {
+		size_t digit = *current - '0';
+		if (*value > (SIZE_MAX - digit) / 10)
+			return 1;
+
+		*value = *value * 10 + digit;
+		current++;
+	}
+
+	if (current == *str)
+		return 1;
+
+	*str = current;
+	return 0;
+}
+
+/**
+ * Parse a single manifest line (without the line feed), after the trailer.
+ *
+ * Returns zero if successful, and non-zero if the line is malformed.
+ * */
+static int parse_manifest_line(struct attachment_manifest *manifest,
+		const char *line, const char *end)
+{
+	size_t chunks, size;
+
+	if (parse_size(&line, end, &chunks) || !chunks || line >= end || *line++ != ' ')
+		return 1;
+	if (parse_size(&line, end, &size) || line >= end || *line++ != ' ')
+		return 1;
+	if (line >= end || memchr(line, '/', end - line) || memchr(line, 0, end - line))
+		return 1;
+
+	struct strbuf name;
+	strbuf_init(&name);
+	strbuf_attach(&name, line, end - line);
+	attachment_manifest_add(manifest, name.buff, size, chunks);
+	strbuf_release(&name);
+
+	return 0;
+}
+
+int attachment_manifest_parse(struct attachment_manifest *manifest,
+		const char *body, size_t len)
+{
+	const char *end = body + len;
+	size_t trailer_len = strlen(ATTACHMENT_TRAILER);
+
+	while (body < end) {
+		const char *lf = memchr(body, '\n', end - body);
+		if (!lf)
+			lf = end;
+
+		// the header ends at the first blank line
+		if (lf == body)
+			break;
+
+		if ((size_t) (lf - body) > trailer_len && !memcmp(body, ATTACHMENT_TRAILER, trailer_len)) {
+			if (parse_manifest_line(manifest, body + trailer_len, lf)) {
+				attachment_manifest_release(manifest);
+				return 1;
+			}
+		}
+
+		body = lf + 1;
+	}
+
+	return 0;
+}
+
+void attachment_manifest_format(const struct attachment_manifest *manifest,
+		struct strbuf *header)
+{
+	for (size_t i = 0; i < manifest->len; i++) {
+		const struct attachment *entry = &manifest->entries[i];
+		strbuf_attach_fmt(header, "%s%zu %zu %s\n", ATTACHMENT_TRAILER, entry->chunks,
+				entry->size, entry->name.buff);
+	}
+}
+
+/**
+ * Parse the output of git-ls-tree for the chunk directory of an attachment
+ * into the object ids of the chunks, in order. Each line is of the form:
+ *
+ * <mode> SP <type> SP <object id> TAB <chunk index>
+ *
+ * Returns zero if successful, and non-zero if the output is malformed or some
+ * chunks are missing.
+ * */
+static int parse_chunk_listing(struct str_array *chunks, const char *listing,
+		size_t len, size_t chunk_count)
+{
+	const char *end = listing + len;
+	size_t found = 0;
+
+	for (size_t i = 0; i < chunk_count; i++)
+		str_array_push(chunks, "", NULL);
+
+	while (listing < end) {
+		const char *lf = memchr(listing, '\n', end - listing);
+		if (!lf)
+			lf = end;
+
+		const char *type = memchr(listing, ' ', lf - listing);
+		const char *tab = memchr(listing, '\t', lf - listing);
+		if (!type || !tab || tab - type != (ptrdiff_t) strlen(" blob ") + GIT_HEX_OBJECT_ID)
+			return 1;
+		if (memcmp(type, " blob ", strlen(" blob ")) != 0)
+			return 1;
+
+		const char *name = tab + 1;
+		size_t index;
+		if (parse_size(&name, lf, &index) || name != lf || index >= chunk_count)
+			return 1;
+		if (*str_array_get(chunks, index))
+			return 1;
+
+		char oid[GIT_HEX_OBJECT_ID + 1];
+		memcpy(oid, tab - GIT_HEX_OBJECT_ID, GIT_HEX_OBJECT_ID);
+		oid[GIT_HEX_OBJECT_ID] = 0;
+		str_array_set(chunks, oid, index);
+		found++;
+
+		listing = lf + 1;
+	}
+
+	return found != chunk_count;
+}
+
+int attachment_reader_open(struct attachment_reader *reader, const char *rev,
+		size_t index, size_t chunks)
+{
+	struct child_process_def cmd;
+	struct strbuf tree, listing;
+
+	reader->native = !object_db_init(&reader->odb, NULL);
+	str_array_init(&reader->chunks);
+	reader->next = 0;
+	reader->chunk = (struct git_object) { GIT_OBJ_NONE, NULL, 0 };
+	reader->pos = 0;
+
+	strbuf_init(&tree);
+	strbuf_init(&listing);
+	strbuf_attach_fmt(&tree, "%s:.git-chat/%s/%zu", rev, ATTACHMENT_DIR, index);
+
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "ls-tree", tree.buff, NULL);
+	child_process_def_stderr(&cmd, STDERR_NULL);
+
+	int ret = capture_command(&cmd, &listing);
+	if (ret)
+		LOG_WARN("attachment directory '%s' does not exist", tree.buff);
+	else if ((ret = parse_chunk_listing(&reader->chunks, listing.buff, listing.len, chunks)))
+		LOG_WARN("attachment directory '%s' does not have the expected %zu chunks",
+				tree.buff, chunks);
+
+	child_process_def_release(&cmd);
+	strbuf_release(&listing);
+	strbuf_release(&tree);
+
+	return ret;
+}
+
+/**
+ * Read the blob `hex` with `git cat-file`, for when the object coprocess isn't
+ * available.
+ *
+ * Returns zero if successful, and non-zero if the blob could not be read.
+ * */
+static int read_chunk_subprocess(const char *hex, struct git_object *obj)
+{
+	struct child_process_def cmd;
+	struct strbuf contents;
+
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "cat-file", "blob", hex, NULL);
+	child_process_def_stderr(&cmd, STDERR_NULL);
+
+	strbuf_init(&contents);
+	int ret = capture_command_bytes(&cmd, &contents);
+	child_process_def_release(&cmd);
+
+	obj->type = GIT_OBJ_BLOB;
+	obj->len = contents.len;
+	obj->data = (unsigned char *) strbuf_detach(&contents);
+	if (ret)
+		git_object_release(obj);
+
+	return ret;
+}
+
+/**
+ * Read the next chunk of the attachment into the reader, from the object
+ * database if possible, or through the object coprocess otherwise. Through the
+ * coprocess, the chunk after it is requested at the same time. Chunks are
+ * binary, so they are kept as objects rather than strings.
+ *
+ * Returns zero if successful, and non-zero if the chunk could not be read.
+ * */
+static int read_next_chunk(struct attachment_reader *reader)
+{
+	const char *hex = str_array_get(&reader->chunks, reader->next++);
+	int ret;
+
+	git_object_release(&reader->chunk);
+	reader->pos = 0;
+
+	if (reader->native) {
+		struct git_oid oid;
+
+		git_str_to_oid(&oid, hex);
+		ret = object_db_read(&reader->odb, &oid, &reader->chunk);
+	} else {
+		if (reader->next < reader->chunks.len)
+			object_coprocess_request(str_array_get(&reader->chunks, reader->next),
+					OBJECT_REQUEST_CONTENTS);
+
+		ret = object_coprocess_response(hex, OBJECT_REQUEST_CONTENTS, NULL, &reader->chunk);
+		if (ret < 0)
+			ret = read_chunk_subprocess(hex, &reader->chunk);
+	}
+
+	if (!ret && reader->chunk.type != GIT_OBJ_BLOB) {
+		git_object_release(&reader->chunk);
+		ret = 1;
+	}
+
+	if (ret)
+		LOG_ERROR("unable to read attachment chunk %s", hex);
+
+	return ret;
+}
+
+ssize_t attachment_reader_read(void *handle, void *buffer, size_t len)
+{
+	struct attachment_reader *reader = handle;
+
+	while (reader->pos >= reader->chunk.len) {
+		if (reader->next >= reader->chunks.len)
+			return 0;
+		if (read_next_chunk(reader))
+			return -1;
+	}
+
+	size_t available = reader->chunk.len - reader->pos;
+	if (len > available)
+		len = available;
+
+	memcpy(buffer, reader->chunk.data + reader->pos, len);
+	reader->pos += len;
+
+	return (ssize_t) len;
+}
+
+void attachment_reader_release(struct attachment_reader *reader)
+{
+	object_db_release(&reader->odb);
+	str_array_release(&reader->chunks);
+	git_object_release(&reader->chunk);
+}
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "git/cat-file-stream.h"
+#include "utils.h"
+
+#define PIPE_CAPACITY (1024 * 1024)
+#define MAX_SUMMARY_LINE_LEN 256
+
+struct object_summary {
+	const char *oid;
+	const char *type;
+	size_t type_len;
+	size_t object_len;
+	size_t summary_line_len;
+};
+
+/**
+ * Parse the summary line of batched git-cat-file output for the object id,
+ * type and length. Verify that the summary line is prefixed with the correct
+ * delimiter.
+ *
+ * Returns zero if successful, negative if parsing failed, and positive if
+ * not enough data has been read into the buffer.
+ * */
+static int parse_summary_line(const char *output, size_t len,
+		struct object_summary *summary, const char delim[CAT_FILE_DELIM_LEN])
+{
+	const char *lf = memchr(output, '\n', len);
+	if (!lf) {
+		if (len > MAX_SUMMARY_LINE_LEN) {
+			LOG_ERROR("failed to parse git-cat-file output; summary line too long");
+			return -1;
+		}
+
+		return 1;
+	}
+
+	// verify delim
+	size_t line_len = lf - output;
+	if (line_len < CAT_FILE_DELIM_LEN) {
+		LOG_ERROR("failed to parse git-cat-file output; line not prefixed with delim");
+		return -1;
+	}
+
+	if (memcmp(delim, output, CAT_FILE_DELIM_LEN) != 0) {
+		LOG_ERROR("failed to parse git-cat-file output; "
+				  "invalid delim, expected '%.*s' but was '%.*s'",
+				CAT_FILE_DELIM_LEN, delim, CAT_FILE_DELIM_LEN, output);
+		return -1;
+	}
+
+	// parse object id
+	const char *oid = output + CAT_FILE_DELIM_LEN + 1;
+	if (oid >= lf || (lf - oid) < GIT_HEX_OBJECT_ID + 1 || oid[GIT_HEX_OBJECT_ID] != ' ') {
+		LOG_ERROR("failed to parse git-cat-file output; no object id present");
+		return -1;
+	}
+
+	// parse object type
+	const char *type = oid + GIT_HEX_OBJECT_ID + 1;
+	const char *sp = memchr(type, ' ', lf - type);
+	if (!sp || sp == type) {
+		LOG_ERROR("failed to parse git-cat-file output; unable to parse object type");
+		return -1;
+	}
+
+	// parse object length
+	const char *object_len_str = sp + 1;
+	if (object_len_str >= lf) {
+		LOG_ERROR("failed to parse git-cat-file output; unable to parse object length");
+		return -1;
+	}
+
+	size_t object_len = 0;
+	for (const char *c = object_len_str; c < lf; c++) {
+		if (*c < '0' || *c > '9' || object_len > (SIZE_MAX - 9) / 10) {
+			LOG_ERROR("failed to parse git-cat-file output; unable to parse object length");
+			return -1;
+		}
+
+		object_len = object_len * 10 + (*c - '0');
+	}
+
+	summary->oid = oid;
+	summary->type = type;
+	summary->type_len = sp - type;
+	summary->object_len = object_len;
+	summary->summary_line_len = line_len;
+	return 0;
+}
+
+/**
+ * Read more data into the buffer, such that at least `needed` bytes of unparsed
+ * data fit into the buffer.
+ *
+ * Returns zero if successful, and non-zero if the read failed.
+ * */
+static int fill_buffer(struct cat_file_stream *stream, size_t needed)
+{
+	// move the trailing partial object to the front of the buffer
+	if (stream->start) {
+		memmove(stream->buff, stream->buff + stream->start, stream->end - stream->start);
+		stream->end -= stream->start;
+		stream->start = 0;
+	}
+
+	if (needed > stream->alloc || stream->end == stream->alloc) {
+		size_t new_alloc = stream->alloc * 2;
+		if (new_alloc < needed)
+			new_alloc = needed;
+
+		stream->buff = (char *) realloc(stream->buff, new_alloc);
+		if (!stream->buff)
+			FATAL(MEM_ALLOC_FAILED);
+
+		stream->alloc = new_alloc;
+	}
+
+	ssize_t bytes_read = xread(stream->fd, stream->buff + stream->end,
+			stream->alloc - stream->end);
+	if (bytes_read < 0) {
+		LOG_ERROR("failed to read from git-cat-file process");
+		return 1;
+	}
+
+	if (!bytes_read)
+		stream->eof = 1;
+
+	stream->end += bytes_read;
+	return 0;
+}
+
+void cat_file_stream_init(struct cat_file_stream *stream, int fd,
+		const char delim[CAT_FILE_DELIM_LEN], size_t buffer_size)
+{
+	stream->fd = fd;
+	memcpy(stream->delim, delim, CAT_FILE_DELIM_LEN);
+
+	stream->alloc = buffer_size ? buffer_size : CAT_FILE_DEFAULT_BUFFER_SIZE;
+	stream->start = 0;
+	stream->end = 0;
+	stream->needed = 0;
+	stream->eof = 0;
+
+	stream->buff = (char *) malloc(stream->alloc);
+	if (!stream->buff)
+		FATAL(MEM_ALLOC_FAILED);
+
+#ifdef F_SETPIPE_SZ
+	// a larger pipe means fewer round trips between git-cat-file and us
+	int errsv = errno;
+	if (fcntl(fd, F_SETPIPE_SZ, PIPE_CAPACITY) < 0)
+		LOG_DEBUG("unable to enlarge pipe capacity; %s", strerror(errno));
+	errno = errsv;
+#endif
+}
+
+int cat_file_stream_next_buffered(struct cat_file_stream *stream,
+		struct cat_file_object *obj)
+{
+	const char *data = stream->buff + stream->start;
+	size_t available = stream->end - stream->start;
+
+	stream->needed = available + 1;
+	if (!available)
+		return 1;
+
+	struct object_summary summary;
+	int ret = parse_summary_line(data, available, &summary, stream->delim);
+	if (ret)
+		return ret;
+
+	// summary line, object, trailing newline
+	size_t object_total = summary.summary_line_len + 1 + summary.object_len + 1;
+	if (object_total > available) {
+		stream->needed = object_total;
+		return 1;
+	}
+
+	memcpy(obj->oid, summary.oid, GIT_HEX_OBJECT_ID);
+	obj->type = summary.type;
+	obj->type_len = summary.type_len;
+	obj->data = data + summary.summary_line_len + 1;
+	obj->len = summary.object_len;
+
+	stream->start += object_total;
+	return 0;
+}
+
+int cat_file_stream_fill(struct cat_file_stream *stream)
+{
+	if (stream->eof) {
+		if (stream->end - stream->start) {
+			LOG_ERROR("failed to parse git-cat-file output; stream ended unexpectedly");
+			return -1;
+		}
+
+		return 1;
+	}
+
+	if (fill_buffer(stream, stream->needed))
+		return -1;
+
+	return 0;
+}
+
+int cat_file_stream_next(struct cat_file_stream *stream, struct cat_file_object *obj)
+{
+	int ret;
+	while ((ret = cat_file_stream_next_buffered(stream, obj)) > 0) {
+		if ((ret = cat_file_stream_fill(stream)))
+			return ret;
+	}
+
+	return ret;
+}
+
+void cat_file_stream_release(struct cat_file_stream *stream)
+{
+	free(stream->buff);
+	stream->buff = NULL;
+	stream->alloc = 0;
+	stream->start = 0;
+	stream->end = 0;
+}
@@ -7,6 +7,7 @@
 #include <time.h>
 
 #include "git/commit.h"
+#include "git/attachment.h"
 #include "run-command.h"
 #include "utils.h"
 
@@ -29,6 +30,7 @@ void git_commit_object_init(struct git_commit *commit)
 	commit->author.timestamp.offset = 0;
 
 	strbuf_init(&commit->body);
+	strbuf_init(&commit->blob);
 }
 
 void git_commit_object_release(struct git_commit *commit)
@@ -53,6 +55,42 @@ void git_commit_object_release(struct git_commit *commit)
 	commit->author.timestamp.offset = 0;
 
 	strbuf_release(&commit->body);
+	strbuf_release(&commit->blob);
+}
+
+static void git_signature_copy(struct git_signature *dest, const struct git_signature *src)
+{
+	strbuf_clear(&dest->name);
+	strbuf_attach(&dest->name, src->name.buff, src->name.len);
+	strbuf_clear(&dest->email);
+	strbuf_attach(&dest->email, src->email.buff, src->email.len);
+	dest->timestamp = src->timestamp;
+}
+
+void git_commit_object_copy(struct git_commit *dest, const struct git_commit *src)
+{
+	dest->commit_id = src->commit_id;
+	dest->tree_id = src->tree_id;
+
+	free(dest->parents_commit_ids);
+	dest->parents_commit_ids = NULL;
+	dest->parents_commit_ids_len = src->parents_commit_ids_len;
+	if (src->parents_commit_ids_len) {
+		dest->parents_commit_ids = (struct git_oid *) malloc(sizeof(struct git_oid) * src->parents_commit_ids_len);
+		if (!dest->parents_commit_ids)
+			FATAL(MEM_ALLOC_FAILED);
+
+		memcpy(dest->parents_commit_ids, src->parents_commit_ids,
+				sizeof(struct git_oid) * src->parents_commit_ids_len);
+	}
+
+	git_signature_copy(&dest->author, &src->author);
+	git_signature_copy(&dest->committer, &src->committer);
+
+	strbuf_clear(&dest->body);
+	strbuf_attach(&dest->body, src->body.buff, src->body.len);
+	strbuf_clear(&dest->blob);
+	strbuf_attach_bytes(&dest->blob, src->blob.buff, src->blob.len);
 }
 
 int git_commit_index(const char *commit_message)
@@ -83,6 +121,22 @@ int git_commit_index_with_options(const char *commit_message, ...)
 	return ret;
 }
 
+/**
+ * Trim leading and trailing whitespace from the slice `str` of length `len`.
+ * */
+static const char *trim_slice(const char *str, size_t *len)
+{
+	while (*len && isspace((unsigned char) *str)) {
+		str++;
+		(*len)--;
+	}
+
+	while (*len && isspace((unsigned char) str[*len - 1]))
+		(*len)--;
+
+	return str;
+}
+
 /**
  * Attempt to parse a git object id from the given data buffer. The data is
  * assumed to be prefixed with the given header prefix.
@@ -127,13 +181,13 @@ static int has_commit_header_oid(const char *data, size_t len,
 }
 
 /**
- * Parse a signature from a commit object header into the strbuf.
+ * Parse a signature from a commit object header into the signature view.
  *
  * Returns NULL if the signature couldn't be parsed. Otherwise, returns a pointer
  * to the next character in the buffer after the line feed at the end of the
  * header line.
  * */
-static const char *parse_commit_header_signature(struct git_signature *sig,
+static const char *parse_commit_header_signature(struct git_signature_view *sig,
 		const char *data, size_t len, const char *header_prefix)
 {
 	const char *current = data;
@@ -184,13 +238,14 @@ static const char *parse_commit_header_signature(struct git_signature *sig,
 	}
 
 	if (sig) {
-		strbuf_attach(&sig->name, current, email_start - current);
-		strbuf_trim(&sig->name);
+		sig->name_len = email_start - current;
+		sig->name = trim_slice(current, &sig->name_len);
 
+		sig->email = email_start + 1;
+		sig->email_len = 0;
 		if ((email_start + 1) < email_end) {
-			size_t email_len = email_end - (email_start + 1);
-			strbuf_attach(&sig->email, email_start + 1, email_len);
-			strbuf_trim(&sig->email);
+			sig->email_len = email_end - (email_start + 1);
+			sig->email = trim_slice(sig->email, &sig->email_len);
 		}
 
 		sig->timestamp.time = unix_epoch;
@@ -217,16 +272,17 @@ static int has_commit_header_signature(const char *data, size_t len,
 			!= NULL;
 }
 
-int commit_parse(struct git_commit *commit,
+int commit_parse_view(struct git_commit_view *view, struct arena *arena,
 		const char commit_id[GIT_HEX_OBJECT_ID], const char *data, size_t len)
 {
 	const char *current = data;
 	size_t current_len = len;
 
-	git_str_to_oid(&commit->commit_id, commit_id);
+	memset(view, 0, sizeof(struct git_commit_view));
+	git_str_to_oid(&view->commit_id, commit_id);
 
 	// parse tree id (there should only ever be a single tree)
-	current = parse_commit_header_oid(&commit->tree_id, current, current_len,
+	current = parse_commit_header_oid(&view->tree_id, current, current_len,
 			"tree ");
 	if (!current)
 		return 1;
@@ -234,31 +290,31 @@ int commit_parse(struct git_commit *commit,
 	current_len = data + len - current;
 
 	// parse parent commit ids
-	// one or more parents on separate lines
+	// one or more parents on separate lines, which are counted up front so
+	// that the parents can be allocated from the arena in one go
+	const char *parents = current;
+	const size_t parent_line_len = strlen("parent ") + GIT_HEX_OBJECT_ID + 1;
 	while (has_commit_header_oid(current, current_len, "parent ")) {
-		struct git_oid parent_id;
-		current = parse_commit_header_oid(&parent_id, current, len, "parent ");
-		if (!current)
-			return 1;
+		view->parents_commit_ids_len++;
+		current += parent_line_len;
+		current_len = current < data + len ? (size_t) (data + len - current) : 0;
+	}
 
-		current_len = data + len - current;
+	if (current > data + len)
+		return 1;
 
-		// 90% of the time, only one parent commit exists, so growing the
-		// array by one is sufficient
-		commit->parents_commit_ids_len += 1;
-		commit->parents_commit_ids = (struct git_oid *) realloc(
-				commit->parents_commit_ids,
-				commit->parents_commit_ids_len * sizeof(struct git_oid));
-		if (!commit->parents_commit_ids)
-			FATAL(MEM_ALLOC_FAILED);
+	if (view->parents_commit_ids_len) {
+		view->parents_commit_ids = (struct git_oid *) arena_alloc(arena,
+				view->parents_commit_ids_len * sizeof(struct git_oid));
 
-		commit->parents_commit_ids[commit->parents_commit_ids_len
-				- 1] = parent_id;
+		for (size_t i = 0; i < view->parents_commit_ids_len; i++)
+			parse_commit_header_oid(&view->parents_commit_ids[i],
+					parents + i * parent_line_len, parent_line_len, "parent ");
 	}
 
 	// parse author
 	// might appear more than once, we'll just skip the extras
-	current = parse_commit_header_signature(&commit->author, current,
+	current = parse_commit_header_signature(&view->author, current,
 			current_len, "author ");
 	if (!current)
 		return 1;
@@ -275,30 +331,109 @@ int commit_parse(struct git_commit *commit,
 	}
 
 	// parse committer
-	current = parse_commit_header_signature(&commit->committer, current,
+	current = parse_commit_header_signature(&view->committer, current,
 			current_len, "committer ");
 	if (!current)
 		return 1;
 
 	current_len = data + len - current;
 
-	// skim additional header entries
+	// skim additional header entries (e.g. gpgsig) up to the blank line
 	while (current_len > 0) {
-		const char *lf = current;
 		if (current[-1] == '\n' && current[0] == '\n')
 			break;
 
-		while (lf < (data + len) && *lf != '\n')
-			++lf;
-		if (lf < (data + len) && *lf == '\n')
-			++lf;
-		current = lf;
+		const char *lf = memchr(current, '\n', current_len);
+		current = lf ? lf + 1 : data + len;
 		current_len = data + len - current;
 	}
 
 	// finally, include commit message body
-	strbuf_attach(&commit->body, current, current_len);
-	strbuf_trim(&commit->body);
+	view->body_len = current_len;
+	view->body = trim_slice(current, &view->body_len);
+	view->blob = NULL;
+	view->blob_len = 0;
+	return 0;
+}
+
+int commit_parse(struct git_commit *commit,
+		const char commit_id[GIT_HEX_OBJECT_ID], const char *data, size_t len)
+{
+	struct git_commit_view view;
+	struct arena arena;
+
+	arena_init(&arena, 4 * sizeof(struct git_oid));
+
+	int ret = commit_parse_view(&view, &arena, commit_id, data, len);
+	if (!ret)
+		git_commit_from_view(commit, &view);
+
+	arena_release(&arena);
+	return ret;
+}
+
+static void git_signature_from_view(struct git_signature *dest,
+		const struct git_signature_view *src)
+{
+	strbuf_clear(&dest->name);
+	strbuf_attach(&dest->name, src->name, src->name_len);
+	strbuf_clear(&dest->email);
+	strbuf_attach(&dest->email, src->email, src->email_len);
+	dest->timestamp = src->timestamp;
+}
+
+void git_commit_from_view(struct git_commit *dest, const struct git_commit_view *src)
+{
+	dest->commit_id = src->commit_id;
+	dest->tree_id = src->tree_id;
+
+	if (dest->parents_commit_ids_len != src->parents_commit_ids_len) {
+		free(dest->parents_commit_ids);
+		dest->parents_commit_ids = NULL;
+
+		if (src->parents_commit_ids_len) {
+			dest->parents_commit_ids = (struct git_oid *) malloc(sizeof(struct git_oid) * src->parents_commit_ids_len);
+			if (!dest->parents_commit_ids)
+				FATAL(MEM_ALLOC_FAILED);
+		}
+
+		dest->parents_commit_ids_len = src->parents_commit_ids_len;
+	}
+
+	if (src->parents_commit_ids_len)
+		memcpy(dest->parents_commit_ids, src->parents_commit_ids,
+				sizeof(struct git_oid) * src->parents_commit_ids_len);
+
+	git_signature_from_view(&dest->author, &src->author);
+	git_signature_from_view(&dest->committer, &src->committer);
+
+	strbuf_clear(&dest->body);
+	strbuf_attach(&dest->body, src->body, src->body_len);
+	strbuf_clear(&dest->blob);
+	if (src->blob_len)
+		strbuf_attach_bytes(&dest->blob, src->blob, src->blob_len);
+}
+
+int commit_body_ciphertext_blob(const char *body, size_t len, struct git_oid *oid)
+{
+	size_t trailer_len = strlen(COMMIT_CIPHERTEXT_TRAILER) + GIT_HEX_OBJECT_ID;
+	if (len < trailer_len)
+		return 1;
+
+	// the trailer must be the whole of the last line
+	const char *line = body + len - trailer_len;
+	if (line != body && line[-1] != '\n')
+		return 1;
+	if (memcmp(line, COMMIT_CIPHERTEXT_TRAILER, strlen(COMMIT_CIPHERTEXT_TRAILER)) != 0)
+		return 1;
+
+	const char *hex = line + strlen(COMMIT_CIPHERTEXT_TRAILER);
+	for (size_t i = 0; i < GIT_HEX_OBJECT_ID; i++) {
+		if (!isdigit((unsigned char) hex[i]) && (hex[i] < 'a' || hex[i] > 'f'))
+			return 1;
+	}
+
+	git_str_to_oid(oid, hex);
 	return 0;
 }
 
@@ -352,58 +487,125 @@ static void format_pretty_message_header(struct strbuf *header_buff,
 }
 
 /**
- * Format `message` and write the formatted message to `body_buff`.
+ * Write out the formatted output of the stream collected so far.
  * */
-static void format_pretty_message_body(struct strbuf *body_buff,
-		struct strbuf *message)
+static void pretty_print_stream_flush(struct pretty_print_stream *stream)
+{
+	if (xwrite(stream->output_fd, stream->out.buff, stream->out.len) != (ssize_t) stream->out.len)
+		FATAL("failed to write to file descriptor");
+
+	strbuf_clear(&stream->out);
+}
+
+void pretty_print_stream_init(struct pretty_print_stream *stream,
+		struct git_commit *commit, enum message_type type, int no_color, int output_fd)
 {
-	struct strbuf tmp_message_buff;
-	struct str_array lines;
+	stream->commit = commit;
+	stream->type = type;
+	stream->no_color = no_color;
+	stream->output_fd = output_fd;
+	strbuf_init(&stream->out);
+	strbuf_init(&stream->whitespace);
+	stream->written = 0;
+	stream->started = 0;
+}
+
+ssize_t pretty_print_stream_write(void *data, const void *buffer, size_t len)
+{
+	struct pretty_print_stream *stream = (struct pretty_print_stream *) data;
+	const char *message = (const char *) buffer;
+
+	if (!stream->written) {
+		format_pretty_message_header(&stream->out, stream->commit, stream->type,
+				stream->no_color);
+		stream->written = 1;
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		char c = message[i];
 
-	strbuf_init(&tmp_message_buff);
-	str_array_init(&lines);
+		// leading whitespace is skipped, and trailing whitespace is held back
+		// until it turns out not to be trailing
+		if (isspace((unsigned char) c) || isblank((unsigned char) c)) {
+			if (stream->started)
+				strbuf_attach(&stream->whitespace, &c, 1);
+			continue;
+		}
 
-	// copy `message` to temporary buffer and trim whitespace
-	strbuf_attach(&tmp_message_buff, message->buff, message->len);
-	strbuf_trim(&tmp_message_buff);
+		if (!stream->started) {
+			strbuf_attach_str(&stream->out, "\n\t");
+			stream->started = 1;
+		}
 
-	// split message into lines
-	int line_count = strbuf_split(&tmp_message_buff, "\n", &lines);
-	strbuf_clear(&tmp_message_buff);
+		// each line is indented
+		for (size_t j = 0; j < stream->whitespace.len; j++) {
+			if (stream->whitespace.buff[j] == '\n')
+				strbuf_attach_str(&stream->out, "\n\t");
+			else
+				strbuf_attach(&stream->out, &stream->whitespace.buff[j], 1);
+		}
 
-	// indent lines
-	for (int i = 0; i < line_count; i++) {
-		char *line = str_array_get(&lines, i);
-		strbuf_attach_fmt(&tmp_message_buff, "\n\t%s", line);
+		strbuf_clear(&stream->whitespace);
+		strbuf_attach(&stream->out, &c, 1);
 	}
 
-	str_array_release(&lines);
+	if (stream->out.len >= PRETTY_PRINT_STREAM_BUFFER_SIZE)
+		pretty_print_stream_flush(stream);
+
+	return (ssize_t) len;
+}
+
+/**
+ * Format the manifest of the files attached to the commit, if any, as lines of
+ * the pretty-printed message body.
+ * */
+static void format_attachment_manifest(struct strbuf *out, const struct git_commit *commit)
+{
+	struct attachment_manifest manifest;
 
-	// finally attach to result buffer
-	strbuf_attach_fmt(body_buff, "%s\n\n", tmp_message_buff.buff);
+	attachment_manifest_init(&manifest);
+	if (attachment_manifest_parse(&manifest, commit->body.buff, commit->body.len))
+		LOG_WARN("commit has a malformed attachment manifest");
 
-	strbuf_release(&tmp_message_buff);
+	if (manifest.len)
+		strbuf_attach_str(out, "\n\t");
+
+	for (size_t i = 0; i < manifest.len; i++)
+		strbuf_attach_fmt(out, "\n\tattachment %zu: %s (%zu bytes)", i,
+				manifest.entries[i].name.buff, manifest.entries[i].size);
+
+	attachment_manifest_release(&manifest);
 }
 
-void pretty_print_message(struct git_commit *commit, struct strbuf *message,
-		enum message_type type, int no_color, int output_fd)
+void pretty_print_stream_finish(struct pretty_print_stream *stream)
 {
-	struct strbuf header, body;
-	strbuf_init(&header);
-	strbuf_init(&body);
+	// make sure the header is written, even for empty messages
+	pretty_print_stream_write(stream, "", 0);
 
-	// format header
-	format_pretty_message_header(&header, commit, type, no_color);
+	if (!stream->started)
+		strbuf_attach_str(&stream->out, "\n\t");
 
-	// format body
-	format_pretty_message_body(&body, message);
+	format_attachment_manifest(&stream->out, stream->commit);
 
-	// write to file descriptor
-	if (xwrite(output_fd, header.buff, header.len) != header.len)
-		FATAL("failed to write to file descriptor");
-	if (xwrite(output_fd, body.buff, body.len) != body.len)
-		FATAL("failed to write to file descriptor");
+	strbuf_attach_str(&stream->out, "\n\n");
+	pretty_print_stream_flush(stream);
+}
+
+void pretty_print_stream_release(struct pretty_print_stream *stream)
+{
+	strbuf_release(&stream->out);
+	strbuf_release(&stream->whitespace);
+}
+
+void pretty_print_message(struct git_commit *commit, struct strbuf *message,
+		enum message_type type, int no_color, int output_fd)
+{
+	struct pretty_print_stream stream;
+	pretty_print_stream_init(&stream, commit, type, no_color, output_fd);
+
+	// messages end at the first null byte, if any
+	pretty_print_stream_write(&stream, message->buff, strlen(message->buff));
+	pretty_print_stream_finish(&stream);
 
-	strbuf_release(&header);
-	strbuf_release(&body);
+	pretty_print_stream_release(&stream);
 }
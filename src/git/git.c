@@ -1,7 +1,9 @@
 #include <stddef.h>
+#include <string.h>
 #include <ctype.h>
 
 #include "git/git.h"
+#include "git/object-db.h"
 #include "run-command.h"
 #include "utils.h"
 
@@ -45,6 +47,14 @@ void git_oid_to_str(struct git_oid *oid, char hex_buffer[GIT_HEX_OBJECT_ID])
 	}
 }
 
+unsigned int git_oid_hash(const struct git_oid *oid)
+{
+	unsigned int hash;
+	memcpy(&hash, oid->id, sizeof(hash));
+
+	return hash;
+}
+
 int get_author_identity(struct strbuf *result)
 {
 	struct child_process_def cmd;
@@ -87,3 +97,52 @@ int get_author_identity(struct strbuf *result)
 
 	return 1;
 }
+
+int get_git_config_value(const char *key, struct strbuf *value)
+{
+	struct child_process_def cmd;
+	struct strbuf cmd_out;
+
+	strbuf_init(&cmd_out);
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "config", "--get", key, NULL);
+
+	int ret = capture_command(&cmd, &cmd_out);
+	if (!ret) {
+		strbuf_trim(&cmd_out);
+		strbuf_attach_str(value, cmd_out.buff);
+	}
+
+	child_process_def_release(&cmd);
+	strbuf_release(&cmd_out);
+
+	return ret;
+}
+
+int get_current_channel_ref(struct strbuf *ref)
+{
+	struct object_db odb;
+	int ret = object_db_init(&odb, NULL) || object_db_read_symref(&odb, "HEAD", ref);
+	object_db_release(&odb);
+	if (!ret)
+		return 0;
+
+	struct child_process_def cmd;
+	struct strbuf cmd_out;
+	strbuf_init(&cmd_out);
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+
+	argv_array_push(&cmd.args, "symbolic-ref", "--quiet", "HEAD", NULL);
+	ret = capture_command(&cmd, &cmd_out);
+	if (!ret) {
+		strbuf_trim(&cmd_out);
+		strbuf_attach_str(ref, cmd_out.buff);
+	}
+
+	child_process_def_release(&cmd);
+	strbuf_release(&cmd_out);
+
+	return ret;
+}
@@ -5,21 +5,19 @@
 
 #include "git/graph-traversal.h"
 #include "git/commit.h"
+#include "git/object-db.h"
+#include "git/cat-file-stream.h"
+#include "git/object-coprocess.h"
+#include "arena.h"
 #include "run-command.h"
-#include "str-array.h"
 #include "strbuf.h"
 #include "utils.h"
 
 #define READ 0
 #define WRITE 1
-#define BUFF_LEN 1024
-#define DELIM_LEN 16
 
-struct object_summary {
-	char oid[GIT_HEX_OBJECT_ID];
-	long object_len;
-	size_t summary_line_len;
-};
+#define OBJECT_BACKEND_ENV "GIT_CHAT_OBJECT_BACKEND"
+#define COPROCESS_BATCH_LEN 64
 
 /**
  * Replace 'X' characters in a null-terminated template string with randomly
@@ -48,89 +46,122 @@ static void str_template_generate_delimiter(char *str, char *delim, size_t len)
 }
 
 /**
- * Parse the summary line of batched git-cat-file output for commit id,
- * object length. Verify that the summary line is prefixed with the correct
- * delimiter.
+ * Read the ciphertext blob named by the trailer of a commit with
+ * `git cat-file`, for commits read through the subprocess backend. The blob
+ * content is read into `blob`, which the commit view points into.
  *
- * Returns zero if successful, negative if parsing failed, and positive if
- * not enough data has been read into the buffer.
+ * Commits without a ciphertext trailer, or whose blob can't be read, are left
+ * without a blob.
  * */
-static int parse_git_cat_file_output_summary_line(char *output, size_t len,
-		struct object_summary *summary, char delim[DELIM_LEN])
+static void read_ciphertext_blob_subprocess(struct git_commit_view *commit,
+		struct strbuf *blob)
 {
-	const char *expected_object_type = "commit";
-
-	char *lf = NULL;
-	char *commit_id = NULL;
-	char *object_type = NULL;
-	char *object_len_str = NULL;
-	char *tailptr = NULL;
-	size_t line_len;
-	size_t object_type_str_len;
-
-	// isolate object information line
-	lf = memchr(output, '\n', len);
-	if (!lf)
-		return 1;
-
-	// verify delim
-	line_len = lf - output;
-	if (line_len < DELIM_LEN) {
-		LOG_ERROR("failed to parse git-cat-file output; line not prefixed with delim");
-		return -1;
+	struct child_process_def cmd;
+	struct git_oid oid;
+	char hex[GIT_HEX_OBJECT_ID + 1];
+
+	strbuf_clear(blob);
+	if (commit_body_ciphertext_blob(commit->body, commit->body_len, &oid))
+		return;
+
+	git_oid_to_str(&oid, hex);
+	hex[GIT_HEX_OBJECT_ID] = 0;
+
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "cat-file", "blob", hex, NULL);
+	child_process_def_stderr(&cmd, STDERR_NULL);
+
+	if (capture_command_bytes(&cmd, blob)) {
+		LOG_WARN("unable to read ciphertext blob %s", hex);
+		strbuf_clear(blob);
+	} else {
+		commit->blob = blob->buff;
+		commit->blob_len = blob->len;
 	}
 
-	if (memcmp(delim, output, DELIM_LEN) != 0) {
-		LOG_ERROR("failed to parse git-cat-file output; "
-				  "invalid delim, expected '%.*s' but was '%.*s'",
-				DELIM_LEN, delim, DELIM_LEN, output);
-		return -1;
-	}
+	child_process_def_release(&cmd);
+}
 
-	// parse commit id
-	commit_id = output + DELIM_LEN + 1;
-	if (commit_id >= lf || (lf - commit_id) < GIT_HEX_OBJECT_ID) {
-		LOG_ERROR("failed to parse git-cat-file output; no commit id present");
-		return -1;
-	}
+/**
+ * Queue a request for the ciphertext blob of a commit with the object
+ * coprocess, so that the blobs of many commits are read in one batch. The
+ * response must be taken with read_ciphertext_blob_coprocess() or
+ * discard_ciphertext_blob().
+ * */
+static void request_ciphertext_blob(struct git_commit_view *commit)
+{
+	struct git_oid oid;
+	char hex[GIT_HEX_OBJECT_ID + 1];
 
-	// parse object type
-	object_type = commit_id + GIT_HEX_OBJECT_ID + 1;
-	object_type_str_len = strlen(expected_object_type);
-	if (object_type >= lf || (size_t)(lf - object_type) < object_type_str_len) {
-		LOG_ERROR("failed to parse git-cat-file output; expected object of "
-				  "type %s, but was unexpected type", expected_object_type);
-		return -1;
-	}
+	if (commit_body_ciphertext_blob(commit->body, commit->body_len, &oid))
+		return;
 
-	if (memcmp(object_type, expected_object_type, object_type_str_len) != 0) {
-		LOG_ERROR("failed to parse git-cat-file output; expected object of "
-				  "type %s, but was unexpected type", expected_object_type);
-		return -1;
-	}
+	git_oid_to_str(&oid, hex);
+	hex[GIT_HEX_OBJECT_ID] = 0;
+	object_coprocess_request(hex, OBJECT_REQUEST_CONTENTS);
+}
 
-	// parse object length
-	object_len_str = object_type + object_type_str_len + 1;
-	if (object_len_str >= lf || !(lf - object_len_str)) {
-		LOG_ERROR("failed to parse git-cat-file output; unable to parse object length");
-		return -1;
+/**
+ * Read the ciphertext blob named by the trailer of a commit through the object
+ * coprocess. The commit view points into `blob`, which must be released with
+ * git_object_release() once the callback returns. If the coprocess isn't
+ * available, the blob is read into `fallback` with `git cat-file` instead.
+ *
+ * Commits without a ciphertext trailer, or whose blob can't be read, are left
+ * without a blob.
+ * */
+static void read_ciphertext_blob_coprocess(struct git_commit_view *commit,
+		struct git_object *blob, struct strbuf *fallback)
+{
+	struct git_oid oid;
+	char hex[GIT_HEX_OBJECT_ID + 1];
+
+	*blob = (struct git_object) { GIT_OBJ_NONE, NULL, 0 };
+	if (commit_body_ciphertext_blob(commit->body, commit->body_len, &oid))
+		return;
+
+	git_oid_to_str(&oid, hex);
+	hex[GIT_HEX_OBJECT_ID] = 0;
+
+	int ret = object_coprocess_response(hex, OBJECT_REQUEST_CONTENTS, NULL, blob);
+	if (ret < 0) {
+		read_ciphertext_blob_subprocess(commit, fallback);
+		return;
 	}
 
-	tailptr = NULL;
-	long object_len = strtol(object_len_str, &tailptr, 0);
-	if (!tailptr || tailptr != lf) {
-		LOG_ERROR("failed to parse git-cat-file output; unable to parse object length");
-		return -1;
+	if (ret || blob->type != GIT_OBJ_BLOB) {
+		LOG_WARN("unable to read ciphertext blob %s", hex);
+		git_object_release(blob);
+		return;
 	}
 
-	memcpy(summary->oid, commit_id, GIT_HEX_OBJECT_ID);
-	summary->object_len = object_len;
-	summary->summary_line_len = lf - output;
-	return 0;
+	commit->blob = (const char *) blob->data;
+	commit->blob_len = blob->len;
+}
+
+/**
+ * Take and discard the response to request_ciphertext_blob(), for commits that
+ * won't be passed to the callback after all.
+ * */
+static void discard_ciphertext_blob(struct git_commit_view *commit)
+{
+	struct git_object blob;
+	struct git_oid oid;
+	char hex[GIT_HEX_OBJECT_ID + 1];
+
+	if (commit_body_ciphertext_blob(commit->body, commit->body_len, &oid))
+		return;
+
+	git_oid_to_str(&oid, hex);
+	hex[GIT_HEX_OBJECT_ID] = 0;
+	object_coprocess_response(hex, OBJECT_REQUEST_CONTENTS, NULL, &blob);
+	git_object_release(&blob);
 }
 
 /**
- * From batched git-cat-file output, attempt to parse a single commit object.
+ * Read commit objects from batched git-cat-file output, invoking the callback
+ * for each commit as soon as it has been read.
  *
  * Batched git-cat-file output has the format:
  * <commit id> <object type> <object size>
@@ -138,103 +169,109 @@ static int parse_git_cat_file_output_summary_line(char *output, size_t len,
  *
  * The expected format is quite similar, but introduces a random delimiter to
  * ensure that specially crafted commit messages cannot be used to mislead the
- * parser. The new git-cat-file output has the format:
- * <delim> <commit id> <object type> <object size>
- * <object content>
+ * parser. See cat-file-stream.h.
  *
- * This function attempts to parse commit objects from batched git-cat-file output,
- * stopping if an object is only partially read, or the parser failed to interpret
- * the output.
+ * Commits are processed in batches, one batch for each time the stream buffer
+ * is filled. Commit views point into the stream buffer and are allocated from
+ * an arena, which is reset once the batch has been passed to the callback.
  *
- * As commit objects are read from the output buffer, the parsed data is removed
- * and any remaining data is left in the buffer.
+ * Commits that name a ciphertext blob are passed to the callback along with the
+ * content of the blob. The blobs of a batch are all requested from the object
+ * coprocess before the first commit of the batch is passed to the callback.
  *
- * Returns zero if successful, and non-zero if the parser was unable to interpret
- * the data, or critical information couldn't be read from the object summary line.
+ * If the callback returns non-zero, the remainder of the stream is drained so
+ * that the git child processes can exit cleanly.
+ *
+ * Returns zero if successful, positive if the callback returned non-zero, and
+ * negative if the output could not be parsed.
  * */
-static int parse_git_cat_file_output(struct str_array *commits,
-		struct strbuf *cat_file_out_buf, char delim[DELIM_LEN])
+static int read_commits_from_stream(int object_stream, char delim[CAT_FILE_DELIM_LEN],
+		graph_traversal_view_cb cb, void *data)
 {
-	do {
-		struct object_summary summary;
-		int ret = parse_git_cat_file_output_summary_line(cat_file_out_buf->buff,
-				cat_file_out_buf->len, &summary, delim);
-		if (ret < 0)
-			return 1;
-		if (ret > 0)
-			break;
-
-		// verify full object exists in buffer
-		char *object = cat_file_out_buf->buff + summary.summary_line_len + 1;
-		if ((object + summary.object_len + 1) > (cat_file_out_buf->buff + cat_file_out_buf->len))
-			break;
-
-		struct git_commit *commit = (struct git_commit *) malloc(sizeof(struct git_commit));
-		git_commit_object_init(commit);
-		if (commit_parse(commit, summary.oid, object, summary.object_len)) {
-			LOG_ERROR("failed to parse commit object from git-cat-file output");
-			git_commit_object_release(commit);
-			free(commit);
-			return 1;
+	struct cat_file_stream stream;
+	struct cat_file_object obj;
+	struct arena arena;
+	struct git_object blob;
+	struct strbuf fallback_blob;
+	struct git_commit_view **batch = NULL;
+	size_t batch_alloc = 0;
+	int ret, stop = 0;
+
+	cat_file_stream_init(&stream, object_stream, delim, CAT_FILE_DEFAULT_BUFFER_SIZE);
+	arena_init(&arena, 0);
+	strbuf_init(&fallback_blob);
+
+	while (!stop && !(ret = cat_file_stream_fill(&stream))) {
+		size_t batch_len = 0;
+
+		while (!(ret = cat_file_stream_next_buffered(&stream, &obj))) {
+			if (obj.type_len != strlen("commit") || memcmp(obj.type, "commit", obj.type_len)) {
+				LOG_ERROR("failed to parse git-cat-file output; expected object of "
+						  "type commit, but was '%.*s'", (int) obj.type_len, obj.type);
+				ret = -1;
+				break;
+			}
+
+			struct git_commit_view *commit = (struct git_commit_view *)
+					arena_alloc(&arena, sizeof(struct git_commit_view));
+			if (commit_parse_view(commit, &arena, obj.oid, obj.data, obj.len)) {
+				LOG_ERROR("failed to parse commit object from git-cat-file output");
+				ret = -1;
+				break;
+			}
+
+			if (batch_len >= batch_alloc) {
+				batch_alloc = batch_alloc ? batch_alloc * 2 : 64;
+				batch = realloc(batch, batch_alloc * sizeof(struct git_commit_view *));
+				if (!batch)
+					FATAL(MEM_ALLOC_FAILED);
+			}
+
+			batch[batch_len++] = commit;
+			request_ciphertext_blob(commit);
 		}
 
-		// shift buffer
-		strbuf_remove(cat_file_out_buf, 0, object + summary.object_len - cat_file_out_buf->buff + 1);
-
-		struct str_array_entry *entry = str_array_insert_nodup(commits, NULL, commits->len);
-		entry->data = commit;
-	} while (1);
+		for (size_t i = 0; i < batch_len; i++) {
+			if (stop) {
+				discard_ciphertext_blob(batch[i]);
+				continue;
+			}
 
-	return 0;
-}
-
-/**
- *
- *
- * Return zero if successful, 1 if no data is remaining, and -1
- * if the callback returned non-zero.
- */
-static int read_messages_single_pass(int object_stream,
-		struct strbuf *buffer, char delim[DELIM_LEN], graph_traversal_cb cb,
-		void *data)
-{
-	struct str_array parsed_commits;
-	str_array_init(&parsed_commits);
-	char tmp[BUFF_LEN];
-
-	ssize_t bytes_read = xread(object_stream, tmp, BUFF_LEN);
-	if (bytes_read < 0)
-		FATAL("failed to read from git-cat-file process");
-	if (bytes_read > 0)
-		strbuf_attach(buffer, tmp, bytes_read);
-
-	if (parse_git_cat_file_output(&parsed_commits, buffer, delim))
-		FATAL("failed to parse batched git-cat-file output");
-
-	int ret = 0;
-	for (size_t i = 0; i < parsed_commits.len; i++) {
-		struct str_array_entry *entry = str_array_get_entry(&parsed_commits, i);
-		struct git_commit *commit = (struct git_commit *) entry->data;
+			read_ciphertext_blob_coprocess(batch[i], &blob, &fallback_blob);
+			stop = cb(batch[i], data);
+			git_object_release(&blob);
+		}
 
-		// invoke callback
-		ret = cb(commit, data);
-		if (ret)
+		arena_reset(&arena);
+		if (ret < 0)
 			break;
-
-		git_commit_object_release(commit);
-		free(entry->data);
 	}
 
-	str_array_release(&parsed_commits);
+	if (stop)
+		while (!cat_file_stream_next(&stream, &obj));
 
-	if (ret)
+	free(batch);
+	strbuf_release(&fallback_blob);
+	arena_release(&arena);
+	cat_file_stream_release(&stream);
+
+	if (ret < 0)
 		return -1;
 
-	return bytes_read == 0;
+	return stop != 0;
 }
 
-int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
-		void *data)
+/**
+ * Traverse the commit graph by spawning `git rev-list` piped into
+ * `git cat-file --batch`, starting at `rev` and stopping at `exclude` (if not
+ * NULL).
+ *
+ * Returns zero if the traversal successful, return non-negative if the
+ * graph traversal callback returned non-zero, and return negative if an error
+ * occurred.
+ * */
+static int traverse_commit_graph_subprocess(const char *rev, const char *exclude,
+		int limit, graph_traversal_view_cb cb, void *data)
 {
 	struct child_process_def rev_list_proc, cat_file_proc;
 	int rev_list_exit, cat_file_exit;
@@ -253,12 +290,17 @@ int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
 	if (pipe(rev_list_proc.out_fd) < 0)
 		FATAL("invocation of pipe() system call failed.");
 
-	struct strbuf count;
+	struct strbuf count, negated;
 	strbuf_init(&count);
 	strbuf_attach_fmt(&count, "%d", limit);
+	strbuf_init(&negated);
 
 	argv_array_push(&rev_list_proc.args, "rev-list", "--first-parent", "--no-merges",
-			"--max-count", commit ? "1" : count.buff, commit ? commit : "HEAD", NULL);
+			"--max-count", count.buff, rev, NULL);
+	if (exclude) {
+		strbuf_attach_fmt(&negated, "^%s", exclude);
+		argv_array_push(&rev_list_proc.args, negated.buff, NULL);
+	}
 
 	/*
 	 * git-cat-file in batch mode to print commit object for commit ids read from git-rev-list.
@@ -283,9 +325,9 @@ int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
 	 * Without it, specially crafted commit messages could be used to trick
 	 * the parser into doing something it's not supposed to.
 	 * */
-	char delim[DELIM_LEN];
+	char delim[CAT_FILE_DELIM_LEN];
 	char format_arg[] = "--batch=XXXXXXXXXXXXXXXX %(objectname) %(objecttype) %(objectsize)";
-	str_template_generate_delimiter(format_arg, delim, DELIM_LEN);
+	str_template_generate_delimiter(format_arg, delim, CAT_FILE_DELIM_LEN);
 	argv_array_push(&cat_file_proc.args, "cat-file", format_arg, NULL);
 
 	start_command(&rev_list_proc);
@@ -294,21 +336,15 @@ int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
 	close(cat_file_proc.in_fd[WRITE]);
 	close(cat_file_proc.out_fd[WRITE]);
 
-	struct strbuf cat_file_out_buf;
-	strbuf_init(&cat_file_out_buf);
-
-	int result;
-	do {
-		result = read_messages_single_pass(cat_file_proc.out_fd[READ],
-				&cat_file_out_buf, delim, cb, data);
-	} while (!result || cat_file_out_buf.len > 0);
-
-	strbuf_release(&cat_file_out_buf);
+	int result = read_commits_from_stream(cat_file_proc.out_fd[READ], delim, cb, data);
+	if (result < 0)
+		FATAL("failed to parse batched git-cat-file output");
 
 	close(rev_list_proc.out_fd[WRITE]);
 	rev_list_exit = finish_command(&rev_list_proc);
 	child_process_def_release(&rev_list_proc);
 
+	strbuf_release(&negated);
 	strbuf_release(&count);
 
 	close(cat_file_proc.out_fd[READ]);
@@ -317,8 +353,432 @@ int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
 
 	if (rev_list_exit || cat_file_exit)
 		return -1;
-	if (result < 0)
+	if (result)
 		return 1;
 
 	return 0;
 }
+
+/**
+ * Read the ciphertext blob named by the trailer of a commit from the object
+ * database, so that it is passed to the callback along with the commit. The
+ * commit view points into `blob`, which must be released with
+ * git_object_release() once the callback returns.
+ *
+ * Commits without a ciphertext trailer, or whose blob can't be read, are left
+ * without a blob.
+ * */
+static void read_ciphertext_blob_native(struct object_db *odb,
+		struct git_commit_view *commit, struct git_object *blob)
+{
+	struct git_oid oid;
+
+	if (commit_body_ciphertext_blob(commit->body, commit->body_len, &oid))
+		return;
+
+	if (object_db_read(odb, &oid, blob) || blob->type != GIT_OBJ_BLOB) {
+		char hex[GIT_HEX_OBJECT_ID];
+		git_oid_to_str(&oid, hex);
+		LOG_WARN("unable to read ciphertext blob %.*s", GIT_HEX_OBJECT_ID, hex);
+
+		git_object_release(blob);
+		return;
+	}
+
+	commit->blob = (const char *) blob->data;
+	commit->blob_len = blob->len;
+}
+
+/**
+ * Traverse the commit graph by reading objects directly from the object
+ * database, starting at `start`. If `exclude` is not NULL, traversal stops
+ * when that commit is reached.
+ *
+ * This mirrors `git rev-list --first-parent --no-merges`: only the first parent
+ * of each commit is followed, and merge commits are walked through but not
+ * passed to the callback (nor counted against `limit`). Since only the first
+ * parent is followed, `exclude` is only honoured if it lies on the first-parent
+ * history of `start`; otherwise, the entire history is traversed.
+ *
+ * Returns zero if the traversal successful, return non-negative if the
+ * graph traversal callback returned non-zero, and return negative if an error
+ * occurred.
+ * */
+static int traverse_commit_graph_native(struct object_db *odb, struct git_oid *start,
+		const struct git_oid *exclude, int limit, graph_traversal_view_cb cb, void *data)
+{
+	struct git_oid current = *start;
+	struct arena arena;
+	int count = 0;
+	int ret = 0;
+
+	arena_init(&arena, 0);
+
+	while (limit < 0 || count < limit) {
+		struct git_object obj;
+		struct git_commit_view commit;
+		char hex[GIT_HEX_OBJECT_ID];
+
+		if (exclude && !memcmp(current.id, exclude->id, GIT_RAW_OBJECT_ID))
+			break;
+
+		git_oid_to_str(&current, hex);
+		if (object_db_read(odb, &current, &obj)) {
+			LOG_ERROR("unable to read commit %.*s", GIT_HEX_OBJECT_ID, hex);
+			ret = -1;
+			break;
+		}
+
+		if (obj.type != GIT_OBJ_COMMIT) {
+			LOG_ERROR("object %.*s is not a commit", GIT_HEX_OBJECT_ID, hex);
+			git_object_release(&obj);
+			ret = -1;
+			break;
+		}
+
+		arena_reset(&arena);
+		if (commit_parse_view(&commit, &arena, hex, (const char *) obj.data, obj.len)) {
+			LOG_ERROR("failed to parse commit object %.*s", GIT_HEX_OBJECT_ID, hex);
+			git_object_release(&obj);
+			ret = -1;
+			break;
+		}
+
+		if (commit.parents_commit_ids_len <= 1) {
+			struct git_object blob = { GIT_OBJ_NONE, NULL, 0 };
+			count++;
+
+			read_ciphertext_blob_native(odb, &commit, &blob);
+			int stop = cb(&commit, data);
+			git_object_release(&blob);
+
+			if (stop) {
+				git_object_release(&obj);
+				ret = 1;
+				break;
+			}
+		}
+
+		int has_parent = commit.parents_commit_ids_len && !object_db_is_shallow(odb, &current);
+		if (has_parent)
+			current = commit.parents_commit_ids[0];
+
+		git_object_release(&obj);
+		if (!has_parent)
+			break;
+	}
+
+	arena_release(&arena);
+	return ret;
+}
+
+/**
+ * Determine whether the native object database reader should be used. The
+ * reader is used by default, but can be disabled by setting the environment
+ * variable GIT_CHAT_OBJECT_BACKEND to `subprocess`.
+ * */
+static int use_native_object_backend(void)
+{
+	const char *backend = getenv(OBJECT_BACKEND_ENV);
+	if (!backend || !strcmp(backend, "native"))
+		return 1;
+	if (!strcmp(backend, "subprocess"))
+		return 0;
+
+	LOG_WARN("unknown %s '%s'; using native backend", OBJECT_BACKEND_ENV, backend);
+	return 1;
+}
+
+/**
+ * Name the commit `rev` peels to, for the object coprocess.
+ * */
+static void commit_object_name(struct strbuf *name, const char *rev)
+{
+	strbuf_clear(name);
+	strbuf_attach_fmt(name, "%s^{commit}", rev);
+}
+
+struct coprocess_commit {
+	struct git_object obj;
+	struct git_commit_view view;
+};
+
+/**
+ * Take the response to the request for the commit `name` from the object
+ * coprocess, and parse it into `commit`. If `skip_merges`, merge commits are
+ * skipped by following their first parent (like `git rev-list --first-parent
+ * --no-merges --max-count 1`).
+ *
+ * Returns zero if successful, and negative if the commit could not be read.
+ * */
+static int read_commit_coprocess(struct arena *arena, struct strbuf *name,
+		int skip_merges, struct coprocess_commit *commit)
+{
+	struct git_oid oid;
+	char hex[GIT_HEX_OBJECT_ID + 1];
+
+	while (1) {
+		if (object_coprocess_response(name->buff, OBJECT_REQUEST_CONTENTS, &oid, &commit->obj))
+			return -1;
+
+		git_oid_to_str(&oid, hex);
+		hex[GIT_HEX_OBJECT_ID] = 0;
+		if (commit->obj.type != GIT_OBJ_COMMIT || commit_parse_view(&commit->view,
+				arena, hex, (const char *) commit->obj.data, commit->obj.len)) {
+			LOG_ERROR("failed to parse commit object %s", hex);
+			git_object_release(&commit->obj);
+			return -1;
+		}
+
+		if (!skip_merges || commit->view.parents_commit_ids_len < 2)
+			return 0;
+
+		git_oid_to_str(&commit->view.parents_commit_ids[0], hex);
+		commit_object_name(name, hex);
+		git_object_release(&commit->obj);
+	}
+}
+
+/**
+ * Read the commits `revs` through the object coprocess, passing each to the
+ * callback along with its ciphertext blob, without spawning git for each
+ * commit.
+ *
+ * Commits are read in batches: all commits of a batch are requested at once,
+ * and then all of their ciphertext blobs, so that each batch takes two round
+ * trips to git, however many commits it has. `*done` is set to the number of
+ * commits passed to the callback, so that callers can fall back to another
+ * backend for the rest.
+ *
+ * Returns zero if successful, positive if the callback returned non-zero, and
+ * negative if a commit could not be read.
+ * */
+static int read_commit_views_coprocess(struct str_array *revs, int skip_merges,
+		size_t *done, graph_traversal_view_cb cb, void *data)
+{
+	struct coprocess_commit batch[COPROCESS_BATCH_LEN];
+	struct git_object blob;
+	struct strbuf name, fallback_blob;
+	struct arena arena;
+	int ret = 0;
+
+	arena_init(&arena, 0);
+	strbuf_init(&name);
+	strbuf_init(&fallback_blob);
+
+	*done = 0;
+	while (!ret && *done < revs->len) {
+		size_t batch_len = revs->len - *done;
+		if (batch_len > COPROCESS_BATCH_LEN)
+			batch_len = COPROCESS_BATCH_LEN;
+
+		for (size_t i = 0; i < batch_len; i++) {
+			commit_object_name(&name, str_array_get(revs, *done + i));
+			object_coprocess_request(name.buff, OBJECT_REQUEST_CONTENTS);
+		}
+
+		size_t read = 0;
+		for (; read < batch_len; read++) {
+			commit_object_name(&name, str_array_get(revs, *done + read));
+			if (read_commit_coprocess(&arena, &name, skip_merges, &batch[read]))
+				break;
+
+			request_ciphertext_blob(&batch[read].view);
+		}
+
+		// commits that weren't read are left to the caller
+		for (size_t i = read + 1; i < batch_len; i++) {
+			struct git_object unused;
+			commit_object_name(&name, str_array_get(revs, *done + i));
+			object_coprocess_response(name.buff, OBJECT_REQUEST_CONTENTS, NULL, &unused);
+			git_object_release(&unused);
+		}
+
+		for (size_t i = 0; i < read; i++) {
+			if (ret) {
+				discard_ciphertext_blob(&batch[i].view);
+			} else {
+				read_ciphertext_blob_coprocess(&batch[i].view, &blob, &fallback_blob);
+				ret = cb(&batch[i].view, data) ? 1 : 0;
+				git_object_release(&blob);
+
+				if (!ret)
+					(*done)++;
+			}
+
+			git_object_release(&batch[i].obj);
+		}
+
+		arena_reset(&arena);
+		if (!ret && read < batch_len)
+			ret = -1;
+	}
+
+	strbuf_release(&fallback_blob);
+	strbuf_release(&name);
+	arena_release(&arena);
+
+	return ret;
+}
+
+int traverse_commit_graph_range(const char *exclude, const char *commit, int limit,
+		graph_traversal_view_cb cb, void *data)
+{
+	const char *rev = commit ? commit : "HEAD";
+
+	if (use_native_object_backend()) {
+		struct object_db odb;
+		struct git_oid start, boundary;
+
+		if (!object_db_init(&odb, NULL) && !object_db_resolve(&odb, rev, &start) &&
+				(!exclude || !object_db_resolve(&odb, exclude, &boundary))) {
+			int ret = traverse_commit_graph_native(&odb, &start, exclude ? &boundary : NULL,
+					limit, cb, data);
+			object_db_release(&odb);
+			return ret;
+		}
+
+		object_db_release(&odb);
+		LOG_DEBUG("unable to traverse '%s' natively; falling back to git rev-list", rev);
+	}
+
+	// a single commit (like `git chat read <commit>`) needs no rev-list
+	if (limit == 1 && !exclude) {
+		struct str_array revs;
+		size_t done;
+
+		str_array_init(&revs);
+		str_array_push(&revs, rev, NULL);
+		int ret = read_commit_views_coprocess(&revs, 1, &done, cb, data);
+		str_array_release(&revs);
+
+		if (ret >= 0)
+			return ret;
+	}
+
+	return traverse_commit_graph_subprocess(rev, exclude, limit, cb, data);
+}
+
+/**
+ * Read and parse a single commit from the object database.
+ *
+ * Returns zero if successful, positive if the callback returned non-zero, and
+ * negative if the commit could not be read.
+ * */
+static int read_commit_view_native(struct object_db *odb, struct arena *arena,
+		struct git_oid *oid, graph_traversal_view_cb cb, void *data)
+{
+	struct git_object obj, blob = { GIT_OBJ_NONE, NULL, 0 };
+	struct git_commit_view commit;
+	char hex[GIT_HEX_OBJECT_ID];
+	int ret = 0;
+
+	git_oid_to_str(oid, hex);
+	if (object_db_read(odb, oid, &obj) || obj.type != GIT_OBJ_COMMIT) {
+		LOG_DEBUG("unable to read commit %.*s natively", GIT_HEX_OBJECT_ID, hex);
+		return -1;
+	}
+
+	arena_reset(arena);
+	if (commit_parse_view(&commit, arena, hex, (const char *) obj.data, obj.len)) {
+		LOG_ERROR("failed to parse commit object %.*s", GIT_HEX_OBJECT_ID, hex);
+		ret = -1;
+	} else {
+		read_ciphertext_blob_native(odb, &commit, &blob);
+		if (cb(&commit, data))
+			ret = 1;
+	}
+
+	git_object_release(&blob);
+	git_object_release(&obj);
+	return ret;
+}
+
+int read_commit_views(const struct git_oid *oids, size_t len,
+		graph_traversal_view_cb cb, void *data)
+{
+	struct object_db odb;
+	struct arena arena;
+	int use_native = use_native_object_backend();
+	int native = use_native && !object_db_init(&odb, NULL);
+	int ret = 0;
+
+	arena_init(&arena, 0);
+
+	size_t i = 0;
+	if (!native) {
+		struct str_array revs;
+		str_array_init(&revs);
+
+		for (size_t j = 0; j < len; j++) {
+			char hex[GIT_HEX_OBJECT_ID + 1];
+			git_oid_to_str((struct git_oid *) &oids[j], hex);
+			hex[GIT_HEX_OBJECT_ID] = 0;
+			str_array_push(&revs, hex, NULL);
+		}
+
+		// commits the coprocess couldn't read are read with git rev-list below
+		ret = read_commit_views_coprocess(&revs, 0, &i, cb, data);
+		if (ret < 0)
+			ret = 0;
+
+		str_array_release(&revs);
+	}
+
+	for (; i < len && !ret; i++) {
+		struct git_oid oid = oids[i];
+
+		ret = native ? read_commit_view_native(&odb, &arena, &oid, cb, data) : -1;
+		if (ret < 0) {
+			char hex[GIT_HEX_OBJECT_ID + 1];
+			git_oid_to_str(&oid, hex);
+			hex[GIT_HEX_OBJECT_ID] = 0;
+
+			ret = traverse_commit_graph_subprocess(hex, NULL, 1, cb, data);
+		}
+	}
+
+	arena_release(&arena);
+	if (use_native)
+		object_db_release(&odb);
+
+	return ret;
+}
+
+int traverse_commit_graph_views(const char *commit, int limit,
+		graph_traversal_view_cb cb, void *data)
+{
+	return traverse_commit_graph_range(NULL, commit, commit ? 1 : limit, cb, data);
+}
+
+struct commit_view_adapter {
+	struct git_commit commit;
+	graph_traversal_cb cb;
+	void *data;
+};
+
+/**
+ * Copy each commit view into a reusable commit object before handing it to a
+ * graph_traversal_cb, so that buffers are reused between commits.
+ * */
+static int commit_view_adapter_cb(struct git_commit_view *view, void *data)
+{
+	struct commit_view_adapter *adapter = (struct commit_view_adapter *) data;
+	git_commit_from_view(&adapter->commit, view);
+
+	return adapter->cb(&adapter->commit, adapter->data);
+}
+
+int traverse_commit_graph(const char *commit, int limit, graph_traversal_cb cb,
+		void *data)
+{
+	struct commit_view_adapter adapter;
+	git_commit_object_init(&adapter.commit);
+	adapter.cb = cb;
+	adapter.data = data;
+
+	int ret = traverse_commit_graph_views(commit, limit, commit_view_adapter_cb, &adapter);
+
+	git_commit_object_release(&adapter.commit);
+	return ret;
+}
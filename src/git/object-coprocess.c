@@ -0,0 +1,481 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "git/object-coprocess.h"
+#include "run-command.h"
+#include "hashmap.h"
+#include "strbuf.h"
+#include "utils.h"
+
+#define READ 0
+#define WRITE 1
+#define COPROCESS_READ_LEN (64 * 1024)
+
+/*
+ * Upper bound on the commands sent in one batch. A batch must fit in the pipe
+ * to the coprocess (a single page, at the least), so that writing it never
+ * waits on git, which may itself be waiting for its output to be read.
+ * */
+#define COPROCESS_BATCH_BYTES 4096
+
+enum request_state {
+	REQUEST_QUEUED,
+	REQUEST_SENT,
+	REQUEST_ANSWERED
+};
+
+struct object_request {
+	struct hashmap_entry ent;
+	enum object_request_kind kind;
+	char *name;
+	enum request_state state;
+
+	// next unanswered request, in the order the requests were queued
+	struct object_request *next;
+
+	int result;
+	struct git_oid oid;
+	struct git_object obj;
+};
+
+static struct object_coprocess {
+	struct child_process_def cmd;
+	unsigned started: 1;
+	unsigned failed: 1;
+	unsigned exit_registered: 1;
+
+	struct hashmap requests;
+	struct object_request *head;
+	struct object_request *tail;
+
+	// commands of the next batch of requests
+	struct strbuf commands;
+
+	// output of the coprocess that hasn't been parsed yet, from `pos` to `len`
+	char *out;
+	size_t pos;
+	size_t len;
+	size_t alloc;
+} coprocess;
+
+static int object_request_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct object_request *a = entry;
+	const struct object_request *b = entry_or_key;
+	(void) keydata;
+
+	return a->kind != b->kind || strcmp(a->name, b->name);
+}
+
+static unsigned int object_request_hash(const char *name, enum object_request_kind kind)
+{
+	return strhash(name) ^ (unsigned int) kind;
+}
+
+static void object_coprocess_exit(void)
+{
+	object_coprocess_stop();
+}
+
+int object_coprocess_start(void)
+{
+	if (coprocess.started)
+		return 0;
+	if (coprocess.failed)
+		return 1;
+
+	struct child_process_def *cmd = &coprocess.cmd;
+	child_process_def_init(cmd);
+	cmd->git_cmd = 1;
+	argv_array_push(&cmd->args, "cat-file", "--batch-command", "--buffer", NULL);
+
+	// git prints to stderr when run outside of a repository, which callers check for
+	child_process_def_stdin(cmd, STDIN_PROVISIONED);
+	child_process_def_stdout(cmd, STDOUT_PROVISIONED);
+	child_process_def_stderr(cmd, STDERR_NULL);
+
+	// close-on-exec, so that commands run later don't keep the coprocess alive
+	if (pipe2(cmd->in_fd, O_CLOEXEC) < 0 || pipe2(cmd->out_fd, O_CLOEXEC) < 0)
+		FATAL("invocation of pipe() system call failed.");
+
+	start_command(cmd);
+	close(cmd->in_fd[READ]);
+	close(cmd->out_fd[WRITE]);
+
+	hashmap_init(&coprocess.requests, object_request_cmp, 0);
+	coprocess.head = coprocess.tail = NULL;
+	strbuf_init(&coprocess.commands);
+	coprocess.out = NULL;
+	coprocess.pos = coprocess.len = coprocess.alloc = 0;
+	coprocess.started = 1;
+
+	if (!coprocess.exit_registered) {
+		atexit(object_coprocess_exit);
+		coprocess.exit_registered = 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Stop the coprocess after it failed, so that no more requests are made.
+ * */
+static int object_coprocess_fail(const char *reason)
+{
+	LOG_DEBUG("git cat-file coprocess failed: %s", reason);
+
+	object_coprocess_stop();
+	coprocess.failed = 1;
+
+	return -1;
+}
+
+static struct object_request *find_request(const char *name, enum object_request_kind kind)
+{
+	struct object_request key;
+	hashmap_entry_init(&key, object_request_hash(name, kind));
+	key.kind = kind;
+	key.name = (char *) name;
+
+	return hashmap_get(&coprocess.requests, &key, NULL);
+}
+
+void object_coprocess_request(const char *name, enum object_request_kind kind)
+{
+	if (strchr(name, '\n'))
+		BUG("object names given to the object coprocess must not contain line feeds");
+	if (object_coprocess_start() || find_request(name, kind))
+		return;
+
+	struct object_request *req = malloc(sizeof(struct object_request));
+	if (!req)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(req, object_request_hash(name, kind));
+	req->kind = kind;
+	req->name = strdup(name);
+	if (!req->name)
+		FATAL(MEM_ALLOC_FAILED);
+	req->state = REQUEST_QUEUED;
+	req->next = NULL;
+	req->result = -1;
+	req->obj = (struct git_object) { GIT_OBJ_NONE, NULL, 0 };
+
+	hashmap_add(&coprocess.requests, req);
+	if (coprocess.tail)
+		coprocess.tail->next = req;
+	else
+		coprocess.head = req;
+	coprocess.tail = req;
+}
+
+/**
+ * Write all of `buffer` to the coprocess. SIGPIPE is ignored while writing,
+ * so that a coprocess that exited (for instance, outside of a repository) is
+ * reported as a failed write.
+ * */
+static int write_commands(const char *buffer, size_t len)
+{
+	struct sigaction ignore, old;
+	int ret = 0;
+
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&ignore.sa_mask);
+	if (sigaction(SIGPIPE, &ignore, &old))
+		FATAL("failed to ignore SIGPIPE");
+
+	while (len) {
+		ssize_t bytes_written = xwrite(coprocess.cmd.in_fd[WRITE], buffer, len);
+		if (bytes_written <= 0) {
+			ret = -1;
+			break;
+		}
+
+		buffer += bytes_written;
+		len -= bytes_written;
+	}
+
+	if (sigaction(SIGPIPE, &old, NULL))
+		FATAL("failed to restore SIGPIPE handler");
+
+	return ret;
+}
+
+static const char *request_command(enum object_request_kind kind)
+{
+	return kind == OBJECT_REQUEST_INFO ? "info" : "contents";
+}
+
+/**
+ * Send the next batch of queued requests, followed by a flush. Requests are
+ * sent in the order they were queued, up to COPROCESS_BATCH_BYTES of commands
+ * (but at least one request); the rest stay queued for the next batch.
+ *
+ * Must only be called once the responses to all requests sent previously have
+ * been read. Since git has then read everything sent before, the pipe is empty
+ * and the batch is written in full without git reading any of it.
+ * */
+static int send_requests(void)
+{
+	struct object_request *req = coprocess.head;
+
+	strbuf_clear(&coprocess.commands);
+	for (; req; req = req->next) {
+		size_t len = strlen(request_command(req->kind)) + strlen(req->name) + 2;
+		if (coprocess.commands.len && coprocess.commands.len + len +
+				strlen("flush\n") > COPROCESS_BATCH_BYTES)
+			break;
+
+		strbuf_attach_fmt(&coprocess.commands, "%s %s\n",
+				request_command(req->kind), req->name);
+		req->state = REQUEST_SENT;
+	}
+
+	strbuf_attach_str(&coprocess.commands, "flush\n");
+
+	return write_commands(coprocess.commands.buff, coprocess.commands.len);
+}
+
+/**
+ * Read more output from the coprocess, moving unparsed output to the start of
+ * the buffer first.
+ * */
+static int read_output(void)
+{
+	if (coprocess.pos) {
+		memmove(coprocess.out, coprocess.out + coprocess.pos, coprocess.len - coprocess.pos);
+		coprocess.len -= coprocess.pos;
+		coprocess.pos = 0;
+	}
+
+	if (coprocess.alloc - coprocess.len < COPROCESS_READ_LEN) {
+		coprocess.alloc = coprocess.len + COPROCESS_READ_LEN;
+		coprocess.out = realloc(coprocess.out, coprocess.alloc);
+		if (!coprocess.out)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	ssize_t bytes_read = xread(coprocess.cmd.out_fd[READ], coprocess.out + coprocess.len,
+			coprocess.alloc - coprocess.len);
+	if (bytes_read <= 0)
+		return -1;
+
+	coprocess.len += bytes_read;
+	return 0;
+}
+
+static int ends_with(const char *str, size_t len, const char *suffix)
+{
+	size_t suffix_len = strlen(suffix);
+	return len >= suffix_len && !memcmp(str + len - suffix_len, suffix, suffix_len);
+}
+
+static enum git_object_type parse_object_type(const char *type, size_t len)
+{
+	static const struct {
+		const char *name;
+		enum git_object_type type;
+	} types[] = {
+			{ "commit", GIT_OBJ_COMMIT },
+			{ "tree", GIT_OBJ_TREE },
+			{ "blob", GIT_OBJ_BLOB },
+			{ "tag", GIT_OBJ_TAG }
+	};
+
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (strlen(types[i].name) == len && !memcmp(types[i].name, type, len))
+			return types[i].type;
+	}
+
+	return GIT_OBJ_NONE;
+}
+
+/**
+ * Parse the summary line of a response, which is either
+ * `<object id> <type> <size>` or `<name> (missing | ambiguous)`.
+ *
+ * Returns zero if the object exists, positive if it doesn't, and negative if
+ * the line is malformed.
+ * */
+static int parse_summary(struct object_request *req, const char *line, size_t len)
+{
+	if (ends_with(line, len, " missing"))
+		return 1;
+	if (ends_with(line, len, " ambiguous")) {
+		LOG_WARN("object name '%s' is ambiguous", req->name);
+		return 1;
+	}
+
+	if (len < GIT_HEX_OBJECT_ID + 1 || line[GIT_HEX_OBJECT_ID] != ' ')
+		return -1;
+	for (size_t i = 0; i < GIT_HEX_OBJECT_ID; i++) {
+		char c = line[i];
+		if ((c < '0' || c > '9') && (c < 'a' || c > 'f'))
+			return -1;
+	}
+
+	const char *type = line + GIT_HEX_OBJECT_ID + 1;
+	const char *size = memchr(type, ' ', len - GIT_HEX_OBJECT_ID - 1);
+	if (!size)
+		return -1;
+
+	// the summary line is followed by a line feed, which ends the size
+	char *tailptr = NULL;
+	unsigned long object_size = strtoul(size + 1, &tailptr, 10);
+	if (tailptr != line + len || tailptr == size + 1)
+		return -1;
+
+	git_str_to_oid(&req->oid, line);
+	req->obj.type = parse_object_type(type, size - type);
+	req->obj.len = object_size;
+	if (req->obj.type == GIT_OBJ_NONE)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Read the content of an object of `req->obj.len` bytes, and the line feed
+ * that follows it. Content that was already read is copied from the output
+ * buffer, and the rest is read straight into the object.
+ * */
+static int read_contents(struct object_request *req)
+{
+	size_t size = req->obj.len;
+	req->obj.data = malloc(size + 1);
+	if (!req->obj.data)
+		FATAL(MEM_ALLOC_FAILED);
+
+	size_t copied = coprocess.len - coprocess.pos;
+	if (copied > size)
+		copied = size;
+	memcpy(req->obj.data, coprocess.out + coprocess.pos, copied);
+	coprocess.pos += copied;
+
+	while (copied < size) {
+		ssize_t bytes_read = xread(coprocess.cmd.out_fd[READ], req->obj.data + copied, size - copied);
+		if (bytes_read <= 0)
+			return -1;
+		copied += bytes_read;
+	}
+
+	req->obj.data[size] = 0;
+
+	while (coprocess.pos >= coprocess.len) {
+		if (read_output())
+			return -1;
+	}
+
+	if (coprocess.out[coprocess.pos++] != '\n')
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Read the response to the oldest request that hasn't been answered.
+ * */
+static int answer_next_request(void)
+{
+	struct object_request *req = coprocess.head;
+	char *lf;
+
+	while (!(lf = memchr(coprocess.out + coprocess.pos, '\n', coprocess.len - coprocess.pos))) {
+		if (read_output())
+			return -1;
+	}
+
+	const char *line = coprocess.out + coprocess.pos;
+	size_t line_len = lf - line;
+	coprocess.pos += line_len + 1;
+
+	req->result = parse_summary(req, line, line_len);
+	if (req->result < 0)
+		return -1;
+	if (!req->result && req->kind == OBJECT_REQUEST_CONTENTS && read_contents(req))
+		return -1;
+
+	coprocess.head = req->next;
+	if (!coprocess.head)
+		coprocess.tail = NULL;
+	req->next = NULL;
+	req->state = REQUEST_ANSWERED;
+
+	return 0;
+}
+
+int object_coprocess_response(const char *name, enum object_request_kind kind,
+		struct git_oid *oid, struct git_object *obj)
+{
+	*obj = (struct git_object) { GIT_OBJ_NONE, NULL, 0 };
+
+	object_coprocess_request(name, kind);
+
+	struct object_request *req = coprocess.started ? find_request(name, kind) : NULL;
+	if (!req)
+		return -1;
+
+	while (req->state != REQUEST_ANSWERED) {
+		if (req->state == REQUEST_QUEUED) {
+			// responses to earlier batches must be read before more requests are sent
+			while (coprocess.head && coprocess.head->state == REQUEST_SENT) {
+				if (answer_next_request())
+					return object_coprocess_fail("malformed or missing response");
+			}
+
+			if (send_requests())
+				return object_coprocess_fail("unable to send requests");
+		} else if (answer_next_request()) {
+			return object_coprocess_fail("malformed or missing response");
+		}
+	}
+
+	hashmap_remove(&coprocess.requests, req, NULL);
+
+	int ret = req->result;
+	if (!ret) {
+		if (oid)
+			*oid = req->oid;
+		*obj = req->obj;
+	}
+
+	free(req->name);
+	free(req);
+
+	return ret;
+}
+
+void object_coprocess_stop(void)
+{
+	struct hashmap_iter iter;
+	struct object_request *req;
+
+	coprocess.failed = 0;
+	if (!coprocess.started)
+		return;
+
+	close(coprocess.cmd.in_fd[WRITE]);
+	close(coprocess.cmd.out_fd[READ]);
+	if (finish_command(&coprocess.cmd))
+		LOG_DEBUG("git cat-file --batch-command exited with a non-zero status");
+	child_process_def_release(&coprocess.cmd);
+
+	hashmap_iter_init(&coprocess.requests, &iter);
+	while ((req = hashmap_iter_next(&iter))) {
+		git_object_release(&req->obj);
+		free(req->name);
+	}
+
+	hashmap_release(&coprocess.requests, 1);
+	strbuf_release(&coprocess.commands);
+	free(coprocess.out);
+	coprocess.out = NULL;
+	coprocess.started = 0;
+}
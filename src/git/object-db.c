@@ -0,0 +1,1218 @@
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "git/object-db.h"
+#include "fs-utils.h"
+#include "utils.h"
+
+#define PACK_IDX_SIGNATURE "\377tOc"
+#define PACK_IDX_VERSION 2
+#define PACK_IDX_HEADER_LEN 8
+#define PACK_IDX_FANOUT_LEN (256 * 4)
+#define PACK_SIGNATURE "PACK"
+#define PACK_HEADER_LEN 12
+#define PACK_TRAILER_LEN GIT_RAW_OBJECT_ID
+
+#define LOOSE_HEADER_MAX 64
+#define MAX_DELTA_DEPTH 1024
+#define MAX_SYMREF_DEPTH 5
+#define MAX_PEEL_DEPTH 8
+
+struct oid_entry {
+	struct hashmap_entry ent;
+	struct git_oid oid;
+};
+
+static int oid_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct oid_entry *a = entry;
+	const struct oid_entry *b = entry_or_key;
+	(void) keydata;
+
+	return memcmp(a->oid.id, b->oid.id, GIT_RAW_OBJECT_ID);
+}
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+			((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static inline uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t) get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static int is_hex_oid(const char *str, size_t len)
+{
+	if (len != GIT_HEX_OBJECT_ID)
+		return 0;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!isxdigit((unsigned char) str[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int path_exists(const char *path)
+{
+	struct stat st;
+	return !stat(path, &st);
+}
+
+/**
+ * Map a file into memory, read-only.
+ *
+ * Returns a pointer to the mapped file, or NULL if the file could not be mapped
+ * (including empty files). On failure, errno is preserved from the failing call.
+ * */
+static void *map_file(const char *path, size_t *len)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	*len = st.st_size;
+	return map;
+}
+
+/**
+ * Read a small text file (ref, gitdir link, etc.) into `out`, trimming any
+ * surrounding whitespace.
+ *
+ * Returns zero if successful, and non-zero if the file is not a regular file or
+ * could not be read.
+ * */
+static int read_text_file(const char *path, struct strbuf *out)
+{
+	struct stat st;
+	if (stat(path, &st) || !S_ISREG(st.st_mode))
+		return 1;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	strbuf_attach_fd(out, fd);
+	close(fd);
+
+	strbuf_trim(out);
+	return 0;
+}
+
+/**
+ * Inflate a zlib stream into a newly allocated buffer of exactly `size` bytes,
+ * followed by a null terminator.
+ *
+ * Returns the buffer, or NULL if the stream is corrupt or does not inflate to
+ * exactly `size` bytes.
+ * */
+static unsigned char *inflate_exact(const unsigned char *in, size_t in_len, size_t size)
+{
+	if (size >= UINT_MAX)
+		return NULL;
+
+	unsigned char *out = (unsigned char *) malloc(size + 1);
+	if (!out)
+		FATAL(MEM_ALLOC_FAILED);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) != Z_OK)
+		FATAL("unable to initialize zlib stream");
+
+	stream.next_in = (Bytef *) in;
+	stream.avail_in = in_len > UINT_MAX ? UINT_MAX : (uInt) in_len;
+
+	// leave room for one extra byte so that oversized streams are detected
+	stream.next_out = out;
+	stream.avail_out = (uInt) size + 1;
+
+	int ret = inflate(&stream, Z_FINISH);
+	size_t total_out = stream.total_out;
+	inflateEnd(&stream);
+
+	if (ret != Z_STREAM_END || total_out != size) {
+		free(out);
+		return NULL;
+	}
+
+	out[size] = 0;
+	return out;
+}
+
+static enum git_object_type parse_object_type(const char *str, size_t len)
+{
+	if (len == 6 && !memcmp(str, "commit", 6))
+		return GIT_OBJ_COMMIT;
+	if (len == 4 && !memcmp(str, "tree", 4))
+		return GIT_OBJ_TREE;
+	if (len == 4 && !memcmp(str, "blob", 4))
+		return GIT_OBJ_BLOB;
+	if (len == 3 && !memcmp(str, "tag", 3))
+		return GIT_OBJ_TAG;
+
+	return GIT_OBJ_NONE;
+}
+
+/**
+ * Read a loose object from `objects/xx/yyyy..`.
+ *
+ * Loose objects are zlib-deflated, and have the format:
+ * <type> <size>\0<content>
+ * */
+static int read_loose_object(struct object_db *odb, const struct git_oid *oid,
+		struct git_object *obj)
+{
+	char hex[GIT_HEX_OBJECT_ID];
+	git_oid_to_str((struct git_oid *) oid, hex);
+
+	struct strbuf path;
+	strbuf_init(&path);
+	strbuf_attach_fmt(&path, "%s/%.2s/%.38s", odb->objects_dir.buff, hex, hex + 2);
+
+	size_t map_len;
+	unsigned char *map = map_file(path.buff, &map_len);
+	int errsv = errno;
+	strbuf_release(&path);
+	if (!map)
+		return errsv == ENOENT ? 1 : -1;
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) != Z_OK)
+		FATAL("unable to initialize zlib stream");
+
+	unsigned char header[LOOSE_HEADER_MAX];
+	stream.next_in = map;
+	stream.avail_in = map_len > UINT_MAX ? UINT_MAX : (uInt) map_len;
+	stream.next_out = header;
+	stream.avail_out = sizeof(header);
+
+	unsigned char *data = NULL;
+	int ret = inflate(&stream, Z_NO_FLUSH);
+	if (ret != Z_OK && ret != Z_STREAM_END)
+		goto corrupt;
+
+	// parse "<type> <size>\0"
+	size_t header_out = stream.total_out;
+	unsigned char *nul = memchr(header, 0, header_out);
+	unsigned char *sp = memchr(header, ' ', header_out);
+	if (!nul || !sp || sp > nul)
+		goto corrupt;
+
+	enum git_object_type type = parse_object_type((char *) header, sp - header);
+	if (type == GIT_OBJ_NONE)
+		goto corrupt;
+
+	size_t size = 0;
+	for (unsigned char *c = sp + 1; c < nul; c++) {
+		if (!isdigit(*c) || size > (SIZE_MAX - 9) / 10)
+			goto corrupt;
+		size = size * 10 + (*c - '0');
+	}
+
+	if (size >= UINT_MAX)
+		goto corrupt;
+
+	size_t header_len = nul - header + 1;
+	size_t body_read = header_out - header_len;
+	if (body_read > size)
+		goto corrupt;
+
+	data = (unsigned char *) malloc(size + 1);
+	if (!data)
+		FATAL(MEM_ALLOC_FAILED);
+	memcpy(data, nul + 1, body_read);
+
+	if (ret != Z_STREAM_END) {
+		stream.next_out = data + body_read;
+		stream.avail_out = (uInt) (size - body_read) + 1;
+		ret = inflate(&stream, Z_FINISH);
+	}
+
+	if (ret != Z_STREAM_END || stream.total_out - header_len != size)
+		goto corrupt;
+
+	inflateEnd(&stream);
+	munmap(map, map_len);
+
+	data[size] = 0;
+	obj->type = type;
+	obj->data = data;
+	obj->len = size;
+	return 0;
+
+corrupt:
+	LOG_ERROR("loose object %.*s is corrupt", GIT_HEX_OBJECT_ID, hex);
+	free(data);
+	inflateEnd(&stream);
+	munmap(map, map_len);
+	return -1;
+}
+
+/**
+ * Read a base-128 little-endian size from a delta header.
+ * */
+static int read_delta_size(const unsigned char **p, const unsigned char *end, size_t *size)
+{
+	size_t result = 0;
+	unsigned shift = 0;
+	unsigned char c;
+
+	do {
+		if (*p >= end || shift > 56)
+			return -1;
+
+		c = *(*p)++;
+		result |= (size_t) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*size = result;
+	return 0;
+}
+
+/**
+ * Apply a (inflated) delta to a base object, constructing `result`.
+ *
+ * A delta has the form:
+ * <base size> <result size> <instruction>...
+ *
+ * where each instruction either copies a range from the base object, or
+ * inserts literal data from the delta itself.
+ * */
+static int apply_delta(const struct git_object *base, const unsigned char *delta,
+		size_t delta_len, struct git_object *result)
+{
+	const unsigned char *p = delta;
+	const unsigned char *end = delta + delta_len;
+	size_t base_size, result_size;
+
+	if (read_delta_size(&p, end, &base_size) || read_delta_size(&p, end, &result_size))
+		return -1;
+	if (base_size != base->len || result_size >= UINT_MAX)
+		return -1;
+
+	unsigned char *out = (unsigned char *) malloc(result_size + 1);
+	if (!out)
+		FATAL(MEM_ALLOC_FAILED);
+
+	unsigned char *o = out;
+	unsigned char *out_end = out + result_size;
+	while (p < end) {
+		unsigned char c = *p++;
+		if (c & 0x80) {
+			size_t offset = 0, len = 0;
+			for (int i = 0; i < 4; i++) {
+				if (!(c & (1 << i)))
+					continue;
+				if (p >= end)
+					goto corrupt;
+				offset |= (size_t) *p++ << (i * 8);
+			}
+
+			for (int i = 0; i < 3; i++) {
+				if (!(c & (0x10 << i)))
+					continue;
+				if (p >= end)
+					goto corrupt;
+				len |= (size_t) *p++ << (i * 8);
+			}
+
+			if (!len)
+				len = 0x10000;
+			if (offset + len > base->len || len > (size_t) (out_end - o))
+				goto corrupt;
+
+			memcpy(o, base->data + offset, len);
+			o += len;
+		} else if (c) {
+			if (c > end - p || c > out_end - o)
+				goto corrupt;
+
+			memcpy(o, p, c);
+			o += c;
+			p += c;
+		} else {
+			goto corrupt;
+		}
+	}
+
+	if (o != out_end)
+		goto corrupt;
+
+	out[result_size] = 0;
+	result->type = base->type;
+	result->data = out;
+	result->len = result_size;
+	return 0;
+
+corrupt:
+	free(out);
+	return -1;
+}
+
+static int read_object(struct object_db *odb, const struct git_oid *oid,
+		struct git_object *obj, int depth);
+
+/**
+ * Read the pack entry at `offset`, resolving any deltas.
+ *
+ * Each pack entry begins with a variable-length header encoding the type and
+ * inflated size of the entry. Delta entries are followed by a reference to their
+ * base object: a negative relative offset for OFS_DELTA, or an object id for
+ * REF_DELTA. The remainder of the entry is a zlib stream.
+ * */
+static int read_pack_entry(struct object_db *odb, struct git_pack *pack,
+		uint64_t offset, struct git_object *obj, int depth)
+{
+	if (depth > MAX_DELTA_DEPTH) {
+		LOG_ERROR("delta chain too deep in pack '%s'", pack->pack_path.buff);
+		return -1;
+	}
+
+	const unsigned char *end = pack->pack_map + pack->pack_len - PACK_TRAILER_LEN;
+	if (offset < PACK_HEADER_LEN || offset >= (uint64_t) (end - pack->pack_map))
+		goto corrupt;
+
+	const unsigned char *p = pack->pack_map + offset;
+	unsigned char c = *p++;
+	enum git_object_type type = (c >> 4) & 0x07;
+	size_t size = c & 0x0f;
+	unsigned shift = 4;
+	while (c & 0x80) {
+		if (p >= end || shift > 56)
+			goto corrupt;
+
+		c = *p++;
+		size += (size_t) (c & 0x7f) << shift;
+		shift += 7;
+	}
+
+	struct git_object base;
+	int ret;
+	switch (type) {
+		case GIT_OBJ_COMMIT:
+		case GIT_OBJ_TREE:
+		case GIT_OBJ_BLOB:
+		case GIT_OBJ_TAG:
+			obj->data = inflate_exact(p, end - p, size);
+			if (!obj->data)
+				goto corrupt;
+
+			obj->type = type;
+			obj->len = size;
+			return 0;
+		case GIT_OBJ_OFS_DELTA: {
+			if (p >= end)
+				goto corrupt;
+
+			c = *p++;
+			uint64_t base_offset = c & 0x7f;
+			while (c & 0x80) {
+				if (p >= end || base_offset >> 56)
+					goto corrupt;
+
+				c = *p++;
+				base_offset = ((base_offset + 1) << 7) | (c & 0x7f);
+			}
+
+			if (!base_offset || base_offset > offset)
+				goto corrupt;
+
+			ret = read_pack_entry(odb, pack, offset - base_offset, &base, depth + 1);
+			break;
+		}
+		case GIT_OBJ_REF_DELTA: {
+			if (end - p < GIT_RAW_OBJECT_ID)
+				goto corrupt;
+
+			struct git_oid base_oid;
+			memcpy(base_oid.id, p, GIT_RAW_OBJECT_ID);
+			p += GIT_RAW_OBJECT_ID;
+
+			ret = read_object(odb, &base_oid, &base, depth + 1);
+			break;
+		}
+		default:
+			goto corrupt;
+	}
+
+	if (ret)
+		return ret < 0 ? ret : -1;
+
+	unsigned char *delta = inflate_exact(p, end - p, size);
+	if (!delta) {
+		git_object_release(&base);
+		goto corrupt;
+	}
+
+	ret = apply_delta(&base, delta, size, obj);
+	free(delta);
+	git_object_release(&base);
+	if (ret)
+		goto corrupt;
+
+	return 0;
+
+corrupt:
+	LOG_ERROR("corrupt pack entry at offset %" PRIu64 " in pack '%s'",
+			offset, pack->pack_path.buff);
+	return -1;
+}
+
+/**
+ * Look up an object in a version 2 pack index.
+ *
+ * The index consists of a 256-entry fanout table, followed by the sorted object
+ * ids, their CRC32s, their 32-bit offsets and finally a table of 64-bit offsets
+ * for large packs. The fanout table narrows the binary search to objects
+ * sharing the first byte of the object id.
+ *
+ * Returns zero and updates `offset` if found, and non-zero otherwise.
+ * */
+static int find_pack_entry(struct git_pack *pack, const struct git_oid *oid,
+		uint64_t *offset)
+{
+	const unsigned char *fanout = pack->idx_map + PACK_IDX_HEADER_LEN;
+	const unsigned char *oids = fanout + PACK_IDX_FANOUT_LEN;
+	uint32_t lo = oid->id[0] ? get_be32(fanout + (oid->id[0] - 1) * 4) : 0;
+	uint32_t hi = get_be32(fanout + oid->id[0] * 4);
+
+	if (hi > pack->objects_len || lo > hi)
+		return 1;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = memcmp(oids + (size_t) mid * GIT_RAW_OBJECT_ID, oid->id, GIT_RAW_OBJECT_ID);
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid;
+		} else {
+			size_t n = pack->objects_len;
+			const unsigned char *offsets = oids + n * GIT_RAW_OBJECT_ID + n * 4;
+			const unsigned char *large_offsets = offsets + n * 4;
+
+			uint32_t off32 = get_be32(offsets + (size_t) mid * 4);
+			if (!(off32 & 0x80000000)) {
+				*offset = off32;
+				return 0;
+			}
+
+			size_t large_index = off32 & 0x7fffffff;
+			const unsigned char *entry = large_offsets + large_index * 8;
+			if (entry + 8 > pack->idx_map + pack->idx_len - 2 * GIT_RAW_OBJECT_ID)
+				return 1;
+
+			*offset = get_be64(entry);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int read_object(struct object_db *odb, const struct git_oid *oid,
+		struct git_object *obj, int depth)
+{
+	for (struct git_pack *pack = odb->packs; pack; pack = pack->next) {
+		uint64_t offset;
+		if (!find_pack_entry(pack, oid, &offset))
+			return read_pack_entry(odb, pack, offset, obj, depth);
+	}
+
+	return read_loose_object(odb, oid, obj);
+}
+
+static void release_pack(struct git_pack *pack)
+{
+	if (pack->idx_map)
+		munmap((void *) pack->idx_map, pack->idx_len);
+	if (pack->pack_map)
+		munmap((void *) pack->pack_map, pack->pack_len);
+
+	strbuf_release(&pack->pack_path);
+	free(pack);
+}
+
+/**
+ * Map a pack index and its pack into memory, validating the headers of each.
+ *
+ * Returns zero if successful, and non-zero if the pack cannot be used.
+ * */
+static int load_pack(struct object_db *odb, const char *idx_path)
+{
+	struct git_pack *pack = (struct git_pack *) calloc(1, sizeof(struct git_pack));
+	if (!pack)
+		FATAL(MEM_ALLOC_FAILED);
+
+	strbuf_init(&pack->pack_path);
+	strbuf_attach(&pack->pack_path, idx_path, strlen(idx_path) - strlen(".idx"));
+	strbuf_attach_str(&pack->pack_path, ".pack");
+
+	pack->idx_map = map_file(idx_path, &pack->idx_len);
+	if (!pack->idx_map) {
+		LOG_WARN("unable to map pack index '%s'", idx_path);
+		goto invalid;
+	}
+
+	size_t min_idx_len = PACK_IDX_HEADER_LEN + PACK_IDX_FANOUT_LEN + 2 * GIT_RAW_OBJECT_ID;
+	if (pack->idx_len < min_idx_len || memcmp(pack->idx_map, PACK_IDX_SIGNATURE, 4) ||
+			get_be32(pack->idx_map + 4) != PACK_IDX_VERSION) {
+		LOG_WARN("unsupported pack index '%s'", idx_path);
+		goto invalid;
+	}
+
+	pack->objects_len = get_be32(pack->idx_map + PACK_IDX_HEADER_LEN + 255 * 4);
+	if (pack->idx_len < min_idx_len + (size_t) pack->objects_len * (GIT_RAW_OBJECT_ID + 8)) {
+		LOG_WARN("pack index '%s' is truncated", idx_path);
+		goto invalid;
+	}
+
+	pack->pack_map = map_file(pack->pack_path.buff, &pack->pack_len);
+	if (!pack->pack_map) {
+		LOG_WARN("unable to map pack '%s'", pack->pack_path.buff);
+		goto invalid;
+	}
+
+	if (pack->pack_len < PACK_HEADER_LEN + PACK_TRAILER_LEN ||
+			memcmp(pack->pack_map, PACK_SIGNATURE, 4) ||
+			(get_be32(pack->pack_map + 4) != 2 && get_be32(pack->pack_map + 4) != 3) ||
+			get_be32(pack->pack_map + 8) != pack->objects_len) {
+		LOG_WARN("pack '%s' does not match its index", pack->pack_path.buff);
+		goto invalid;
+	}
+
+	LOG_TRACE("loaded pack '%s' with %u objects", pack->pack_path.buff, pack->objects_len);
+
+	pack->next = odb->packs;
+	odb->packs = pack;
+	return 0;
+
+invalid:
+	release_pack(pack);
+	return 1;
+}
+
+static int load_packs(struct object_db *odb)
+{
+	struct strbuf pack_dir;
+	strbuf_init(&pack_dir);
+	strbuf_attach_fmt(&pack_dir, "%s/pack", odb->objects_dir.buff);
+
+	DIR *dir = opendir(pack_dir.buff);
+	if (!dir) {
+		strbuf_release(&pack_dir);
+		return 0;
+	}
+
+	int ret = 0;
+	struct dirent *ent;
+	while (!ret && (ent = readdir(dir)) != NULL) {
+		size_t len = strlen(ent->d_name);
+
+		// objects may be missing from promisor packs; let git fetch them
+		if (len > 9 && !strcmp(ent->d_name + len - 9, ".promisor")) {
+			LOG_DEBUG("repository has promisor packs");
+			ret = 1;
+			break;
+		}
+
+		if (len <= 4 || strcmp(ent->d_name + len - 4, ".idx") != 0)
+			continue;
+
+		struct strbuf idx_path;
+		strbuf_init(&idx_path);
+		strbuf_attach_fmt(&idx_path, "%s/%s", pack_dir.buff, ent->d_name);
+		ret = load_pack(odb, idx_path.buff);
+		strbuf_release(&idx_path);
+	}
+
+	closedir(dir);
+	strbuf_release(&pack_dir);
+
+	return ret;
+}
+
+static void load_shallow(struct object_db *odb)
+{
+	struct strbuf path, contents;
+	strbuf_init(&path);
+	strbuf_init(&contents);
+	strbuf_attach_fmt(&path, "%s/shallow", odb->common_dir.buff);
+
+	if (!read_text_file(path.buff, &contents)) {
+		const char *line = contents.buff;
+		while (*line) {
+			const char *lf = strchr(line, '\n');
+			size_t len = lf ? (size_t) (lf - line) : strlen(line);
+
+			if (is_hex_oid(line, len)) {
+				struct oid_entry *entry = (struct oid_entry *) malloc(sizeof(struct oid_entry));
+				if (!entry)
+					FATAL(MEM_ALLOC_FAILED);
+
+				git_str_to_oid(&entry->oid, line);
+				hashmap_entry_init(entry, git_oid_hash(&entry->oid));
+				hashmap_put(&odb->shallow, entry);
+			}
+
+			line += len + (lf ? 1 : 0);
+		}
+	}
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+}
+
+/**
+ * Locate the git directory and common directory. If `.git` is a file, it is
+ * a link to the real git directory (for instance, in a worktree).
+ * */
+static int locate_git_dir(struct object_db *odb, const char *git_dir)
+{
+	struct strbuf base;
+	strbuf_init(&base);
+
+	if (git_dir) {
+		strbuf_attach_str(&odb->git_dir, git_dir);
+	} else {
+		if (get_cwd(&base)) {
+			strbuf_release(&base);
+			return 1;
+		}
+
+		strbuf_attach_fmt(&odb->git_dir, "%s/.git", base.buff);
+	}
+
+	struct stat st;
+	if (stat(odb->git_dir.buff, &st)) {
+		strbuf_release(&base);
+		return 1;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		struct strbuf link;
+		strbuf_init(&link);
+
+		if (read_text_file(odb->git_dir.buff, &link) || strncmp(link.buff, "gitdir: ", 8) != 0) {
+			strbuf_release(&link);
+			strbuf_release(&base);
+			return 1;
+		}
+
+		// relative links are relative to the directory containing the .git file
+		char *slash = strrchr(odb->git_dir.buff, '/');
+		strbuf_clear(&base);
+		if (link.buff[8] != '/' && slash)
+			strbuf_attach(&base, odb->git_dir.buff, slash - odb->git_dir.buff + 1);
+		strbuf_attach_str(&base, link.buff + 8);
+
+		strbuf_clear(&odb->git_dir);
+		strbuf_attach_str(&odb->git_dir, base.buff);
+		strbuf_release(&link);
+	}
+
+	strbuf_release(&base);
+
+	if (stat(odb->git_dir.buff, &st) || !S_ISDIR(st.st_mode))
+		return 1;
+
+	struct strbuf commondir_path, commondir;
+	strbuf_init(&commondir_path);
+	strbuf_init(&commondir);
+	strbuf_attach_fmt(&commondir_path, "%s/commondir", odb->git_dir.buff);
+
+	if (!read_text_file(commondir_path.buff, &commondir) && commondir.len) {
+		if (commondir.buff[0] != '/')
+			strbuf_attach_fmt(&odb->common_dir, "%s/", odb->git_dir.buff);
+		strbuf_attach_str(&odb->common_dir, commondir.buff);
+	} else {
+		strbuf_attach_str(&odb->common_dir, odb->git_dir.buff);
+	}
+
+	strbuf_release(&commondir);
+	strbuf_release(&commondir_path);
+
+	strbuf_attach_fmt(&odb->objects_dir, "%s/objects", odb->common_dir.buff);
+	return 0;
+}
+
+static int config_key_is(const char *key, size_t key_len, const char *name)
+{
+	return strlen(name) == key_len && !strncasecmp(key, name, key_len);
+}
+
+/**
+ * Scan the repository config for a repository format or extensions that this
+ * reader doesn't understand, such as SHA-256 object ids or the reftable ref
+ * backend. Only the handful of keys that matter here are looked at, so the
+ * parsing is deliberately loose: section and key names are compared without
+ * regard to case, and subsections are ignored.
+ *
+ * Returns non-zero if the repository can't be read natively.
+ * */
+static int uses_unsupported_format(struct object_db *odb)
+{
+	struct strbuf path, contents;
+	strbuf_init(&path);
+	strbuf_init(&contents);
+	strbuf_attach_fmt(&path, "%s/config", odb->common_dir.buff);
+
+	int unsupported = 0;
+	if (read_text_file(path.buff, &contents))
+		goto out;
+
+	char section[32] = "";
+	char *line = contents.buff;
+	while (*line && !unsupported) {
+		char *lf = strchr(line, '\n');
+		if (lf)
+			*lf = 0;
+
+		while (isspace((unsigned char) *line))
+			line++;
+
+		if (*line == '[') {
+			size_t len = strcspn(line + 1, " \t\"]");
+			if (len >= sizeof(section))
+				len = sizeof(section) - 1;
+			memcpy(section, line + 1, len);
+			section[len] = 0;
+		} else if (*line && *line != '#' && *line != ';') {
+			size_t key_len = strcspn(line, " \t=");
+			char *value = line + key_len + strspn(line + key_len, " \t=");
+			size_t value_len = strcspn(value, " \t#;");
+			value[value_len] = 0;
+
+			if (!strcasecmp(section, "core") &&
+					config_key_is(line, key_len, "repositoryformatversion"))
+				unsupported = atoi(value) > 1;
+			else if (!strcasecmp(section, "extensions") &&
+					config_key_is(line, key_len, "objectformat"))
+				unsupported = strcasecmp(value, "sha1") != 0;
+			else if (!strcasecmp(section, "extensions") &&
+					config_key_is(line, key_len, "refstorage"))
+				unsupported = strcasecmp(value, "files") != 0;
+
+			if (unsupported)
+				LOG_DEBUG("repository config sets '%s.%.*s = %s'; native object database reader unavailable",
+						section, (int) key_len, line, value);
+		}
+
+		line = lf ? lf + 1 : line + strlen(line);
+	}
+
+out:
+	strbuf_release(&contents);
+	strbuf_release(&path);
+
+	return unsupported;
+}
+
+/**
+ * Check whether any replace refs are packed. Loose replace refs are caught by
+ * the existence of the refs/replace directory.
+ * */
+static int has_packed_replace_refs(struct object_db *odb)
+{
+	struct strbuf path, contents;
+	strbuf_init(&path);
+	strbuf_init(&contents);
+	strbuf_attach_fmt(&path, "%s/packed-refs", odb->common_dir.buff);
+
+	int found = 0;
+	if (!read_text_file(path.buff, &contents))
+		found = strstr(contents.buff, " refs/replace/") != NULL;
+
+	if (found)
+		LOG_DEBUG("repository has packed replace refs; native object database reader unavailable");
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+
+	return found;
+}
+
+/**
+ * Check for repository features that would make the object database (or the
+ * history) look different to git than to this reader.
+ *
+ * Returns non-zero if any such feature is in use.
+ * */
+static int uses_unsupported_features(struct object_db *odb)
+{
+	const char *env_overrides[] = {
+			"GIT_DIR", "GIT_COMMON_DIR", "GIT_OBJECT_DIRECTORY",
+			"GIT_ALTERNATE_OBJECT_DIRECTORIES", "GIT_REPLACE_REF_BASE", NULL
+	};
+
+	for (const char **env = env_overrides; *env; env++) {
+		if (getenv(*env)) {
+			LOG_DEBUG("%s is set; native object database reader unavailable", *env);
+			return 1;
+		}
+	}
+
+	const char *files[] = { "objects/info/alternates", "info/grafts", "refs/replace", NULL };
+	int unsupported = 0;
+	for (const char **file = files; *file && !unsupported; file++) {
+		struct strbuf path;
+		strbuf_init(&path);
+		strbuf_attach_fmt(&path, "%s/%s", odb->common_dir.buff, *file);
+
+		if (path_exists(path.buff)) {
+			LOG_DEBUG("repository uses '%s'; native object database reader unavailable", *file);
+			unsupported = 1;
+		}
+
+		strbuf_release(&path);
+	}
+
+	if (!unsupported)
+		unsupported = uses_unsupported_format(odb) || has_packed_replace_refs(odb);
+
+	return unsupported;
+}
+
+int object_db_init(struct object_db *odb, const char *git_dir)
+{
+	strbuf_init(&odb->git_dir);
+	strbuf_init(&odb->common_dir);
+	strbuf_init(&odb->objects_dir);
+	odb->packs = NULL;
+	hashmap_init(&odb->shallow, oid_entry_cmp, 0);
+
+	if (locate_git_dir(odb, git_dir)) {
+		LOG_DEBUG("unable to locate git directory");
+		return 1;
+	}
+
+	if (uses_unsupported_features(odb))
+		return 1;
+
+	if (load_packs(odb))
+		return 1;
+
+	load_shallow(odb);
+	return 0;
+}
+
+void object_db_release(struct object_db *odb)
+{
+	struct git_pack *pack = odb->packs;
+	while (pack) {
+		struct git_pack *next = pack->next;
+		release_pack(pack);
+		pack = next;
+	}
+
+	odb->packs = NULL;
+	hashmap_release(&odb->shallow, 1);
+	strbuf_release(&odb->objects_dir);
+	strbuf_release(&odb->common_dir);
+	strbuf_release(&odb->git_dir);
+}
+
+int object_db_read(struct object_db *odb, const struct git_oid *oid,
+		struct git_object *obj)
+{
+	obj->type = GIT_OBJ_NONE;
+	obj->data = NULL;
+	obj->len = 0;
+
+	return read_object(odb, oid, obj, 0);
+}
+
+/**
+ * Find the entry `name` (of length `name_len`) in the tree object `tree`,
+ * whose entries are of the form:
+ *
+ * <mode> SP <name> NUL <raw object id>
+ *
+ * Returns zero if found, in which case `oid` is set to the id of the entry,
+ * positive if there is no such entry, and negative if the tree is malformed.
+ * */
+static int find_tree_entry(const struct git_object *tree, const char *name,
+		size_t name_len, struct git_oid *oid)
+{
+	const unsigned char *current = tree->data;
+	const unsigned char *end = tree->data + tree->len;
+
+	while (current < end) {
+		const unsigned char *sp = memchr(current, ' ', end - current);
+		if (!sp)
+			return -1;
+
+		const unsigned char *entry_name = sp + 1;
+		const unsigned char *nul = memchr(entry_name, 0, end - entry_name);
+		if (!nul || (size_t) (end - nul - 1) < GIT_RAW_OBJECT_ID)
+			return -1;
+
+		if ((size_t) (nul - entry_name) == name_len && !memcmp(entry_name, name, name_len)) {
+			memcpy(oid->id, nul + 1, GIT_RAW_OBJECT_ID);
+			return 0;
+		}
+
+		current = nul + 1 + GIT_RAW_OBJECT_ID;
+	}
+
+	return 1;
+}
+
+int object_db_read_path(struct object_db *odb, const struct git_oid *commit,
+		const char *path, struct git_object *obj)
+{
+	struct git_oid oid;
+	int ret;
+
+	if ((ret = object_db_read(odb, commit, obj)))
+		return ret;
+
+	// the tree is always named on the first line of a commit
+	if (obj->type != GIT_OBJ_COMMIT || obj->len < 5 + GIT_HEX_OBJECT_ID ||
+			memcmp(obj->data, "tree ", 5) != 0 ||
+			!is_hex_oid((const char *) obj->data + 5, GIT_HEX_OBJECT_ID)) {
+		git_object_release(obj);
+		return -1;
+	}
+
+	git_str_to_oid(&oid, (const char *) obj->data + 5);
+	git_object_release(obj);
+
+	while (1) {
+		if ((ret = object_db_read(odb, &oid, obj)))
+			return ret;
+		if (!*path)
+			return 0;
+
+		if (obj->type != GIT_OBJ_TREE) {
+			git_object_release(obj);
+			return 1;
+		}
+
+		const char *slash = strchr(path, '/');
+		size_t name_len = slash ? (size_t) (slash - path) : strlen(path);
+
+		ret = find_tree_entry(obj, path, name_len, &oid);
+		git_object_release(obj);
+		if (ret)
+			return ret;
+
+		path += name_len;
+		if (*path)
+			path++;
+	}
+}
+
+int object_db_is_shallow(struct object_db *odb, const struct git_oid *oid)
+{
+	struct oid_entry key;
+	hashmap_entry_init(&key, git_oid_hash(oid));
+	key.oid = *oid;
+
+	return hashmap_get(&odb->shallow, &key, NULL) != NULL;
+}
+
+/**
+ * Conservative check that a ref name is safe to use as a path under the git
+ * directory. Anything with revision syntax (`~`, `^`, `@{`, `:`, etc.) is
+ * rejected, and must be resolved by git.
+ * */
+static int is_simple_ref_name(const char *name)
+{
+	if (!*name || *name == '/' || strstr(name, "..") || strstr(name, "//"))
+		return 0;
+
+	for (const char *c = name; *c; c++) {
+		if (!isalnum((unsigned char) *c) && !strchr("/-_.", *c))
+			return 0;
+	}
+
+	size_t len = strlen(name);
+	return name[len - 1] != '/' && name[len - 1] != '.';
+}
+
+static int read_packed_ref(struct object_db *odb, const char *name, struct git_oid *oid)
+{
+	struct strbuf path, contents;
+	strbuf_init(&path);
+	strbuf_init(&contents);
+	strbuf_attach_fmt(&path, "%s/packed-refs", odb->common_dir.buff);
+
+	int ret = 1;
+	if (!read_text_file(path.buff, &contents)) {
+		size_t name_len = strlen(name);
+		const char *line = contents.buff;
+		while (*line) {
+			const char *lf = strchr(line, '\n');
+			size_t len = lf ? (size_t) (lf - line) : strlen(line);
+
+			// <oid> SP <refname>
+			if (len == GIT_HEX_OBJECT_ID + 1 + name_len && is_hex_oid(line, GIT_HEX_OBJECT_ID) &&
+					line[GIT_HEX_OBJECT_ID] == ' ' &&
+					!memcmp(line + GIT_HEX_OBJECT_ID + 1, name, name_len)) {
+				git_str_to_oid(oid, line);
+				ret = 0;
+				break;
+			}
+
+			line += len + (lf ? 1 : 0);
+		}
+	}
+
+	strbuf_release(&contents);
+	strbuf_release(&path);
+	return ret;
+}
+
+static int read_loose_ref(const char *dir, const char *name, struct strbuf *value)
+{
+	struct strbuf path;
+	strbuf_init(&path);
+	strbuf_attach_fmt(&path, "%s/%s", dir, name);
+
+	int ret = read_text_file(path.buff, value);
+	strbuf_release(&path);
+
+	return ret;
+}
+
+static int resolve_ref(struct object_db *odb, const char *name, struct git_oid *oid,
+		int depth)
+{
+	if (depth > MAX_SYMREF_DEPTH || !is_simple_ref_name(name))
+		return 1;
+
+	struct strbuf value;
+	strbuf_init(&value);
+
+	int ret = read_loose_ref(odb->git_dir.buff, name, &value);
+	if (ret && strcmp(odb->git_dir.buff, odb->common_dir.buff) != 0)
+		ret = read_loose_ref(odb->common_dir.buff, name, &value);
+
+	if (ret) {
+		strbuf_release(&value);
+		return read_packed_ref(odb, name, oid);
+	}
+
+	if (!strncmp(value.buff, "ref: ", 5)) {
+		ret = resolve_ref(odb, value.buff + 5, oid, depth + 1);
+	} else if (is_hex_oid(value.buff, value.len)) {
+		git_str_to_oid(oid, value.buff);
+		ret = 0;
+	} else {
+		ret = 1;
+	}
+
+	strbuf_release(&value);
+	return ret;
+}
+
+int object_db_read_symref(struct object_db *odb, const char *name, struct strbuf *target)
+{
+	if (!is_simple_ref_name(name))
+		return 1;
+
+	struct strbuf value;
+	strbuf_init(&value);
+
+	int ret = read_loose_ref(odb->git_dir.buff, name, &value);
+	if (ret && strcmp(odb->git_dir.buff, odb->common_dir.buff) != 0)
+		ret = read_loose_ref(odb->common_dir.buff, name, &value);
+
+	if (!ret && !strncmp(value.buff, "ref: ", 5) && is_simple_ref_name(value.buff + 5))
+		strbuf_attach_str(target, value.buff + 5);
+	else
+		ret = 1;
+
+	strbuf_release(&value);
+	return ret;
+}
+
+int object_db_resolve(struct object_db *odb, const char *rev, struct git_oid *oid)
+{
+	if (is_hex_oid(rev, strlen(rev))) {
+		git_str_to_oid(oid, rev);
+	} else {
+		const char *rules[] = {
+				"%s", "refs/%s", "refs/tags/%s", "refs/heads/%s",
+				"refs/remotes/%s", "refs/remotes/%s/HEAD", NULL
+		};
+
+		int found = 0;
+		for (const char **rule = rules; *rule && !found; rule++) {
+			struct strbuf ref;
+			strbuf_init(&ref);
+			strbuf_attach_fmt(&ref, *rule, rev);
+
+			found = !resolve_ref(odb, ref.buff, oid, 0);
+			strbuf_release(&ref);
+		}
+
+		if (!found)
+			return 1;
+	}
+
+	// peel annotated tags
+	for (int i = 0; i < MAX_PEEL_DEPTH; i++) {
+		struct git_object obj;
+		if (object_db_read(odb, oid, &obj))
+			return 1;
+
+		if (obj.type != GIT_OBJ_TAG) {
+			git_object_release(&obj);
+			return 0;
+		}
+
+		const char *target = (const char *) obj.data + strlen("object ");
+		if (obj.len < strlen("object ") + GIT_HEX_OBJECT_ID ||
+				memcmp(obj.data, "object ", strlen("object ")) ||
+				!is_hex_oid(target, GIT_HEX_OBJECT_ID)) {
+			git_object_release(&obj);
+			return 1;
+		}
+
+		git_str_to_oid(oid, target);
+		git_object_release(&obj);
+	}
+
+	return 1;
+}
+
+void git_object_release(struct git_object *obj)
+{
+	free(obj->data);
+	obj->data = NULL;
+	obj->len = 0;
+	obj->type = GIT_OBJ_NONE;
+}
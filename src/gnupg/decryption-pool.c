@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gnupg/decryption-pool.h"
+#include "gnupg/decryption.h"
+#include "gnupg/group-key.h"
+#include "git/git.h"
+#include "utils.h"
+
+#define JOBS_PER_WORKER 4
+
+static void job_init(struct decryption_job *job)
+{
+	git_commit_object_init(&job->commit);
+	strbuf_init(&job->message);
+	strbuf_init(&job->session_key);
+	strbuf_init(&job->epoch_key);
+	job->type = UNKNOWN_ERROR;
+	job->resolved = 0;
+	job->known = 0;
+	job->match = 0;
+	job->state = JOB_EMPTY;
+}
+
+static void job_release(struct decryption_job *job)
+{
+	// don't leave plaintext lying around in freed memory
+	memset(job->message.buff, 0, job->message.alloc);
+	strbuf_release(&job->message);
+	memset(job->session_key.buff, 0, job->session_key.alloc);
+	strbuf_release(&job->session_key);
+	memset(job->epoch_key.buff, 0, job->epoch_key.alloc);
+	strbuf_release(&job->epoch_key);
+	git_commit_object_release(&job->commit);
+}
+
+/**
+ * Reset a job after it has been emitted, so that the slot can be reused.
+ * */
+static void job_clear(struct decryption_job *job)
+{
+	job_release(job);
+	job_init(job);
+}
+
+static void decrypt_job(struct decryption_pool *pool, struct gc_gpgme_ctx *ctx,
+		struct decryption_job *job)
+{
+	// messages stored as blobs are decrypted from the binary ciphertext
+	struct strbuf *ciphertext = job->commit.blob.len ? &job->commit.blob : &job->commit.body;
+
+	int ret;
+	if (job->epoch_key.len && pool->session_keys)
+		ret = decrypt_symmetric_message_with_session_key(ctx, ciphertext,
+				&job->message, job->epoch_key.buff, &job->session_key);
+	else if (job->epoch_key.len)
+		ret = decrypt_symmetric_message(ctx, ciphertext, &job->message,
+				job->epoch_key.buff);
+	else if (pool->session_keys)
+		ret = decrypt_asymmetric_message_with_session_key(ctx, ciphertext,
+				&job->message, &job->session_key);
+	else
+		ret = decrypt_asymmetric_message(ctx, ciphertext, &job->message);
+
+	if (!ret) {
+		job->type = DECRYPTED;
+	} else {
+		memset(job->message.buff, 0, job->message.alloc);
+		strbuf_clear(&job->message);
+		job->type = ret > 0 && !job->commit.blob.len ? PLAINTEXT : UNKNOWN_ERROR;
+	}
+}
+
+static void *worker_routine(void *data)
+{
+	struct decryption_worker *worker = (struct decryption_worker *) data;
+	struct decryption_pool *pool = worker->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		// skip over jobs that need no work from the workers
+		while (pool->next_dispatch < pool->next_submit &&
+				pool->jobs[pool->next_dispatch % pool->window].state != JOB_PENDING)
+			pool->next_dispatch++;
+
+		if (pool->next_dispatch < pool->next_submit) {
+			struct decryption_job *job = &pool->jobs[pool->next_dispatch++ % pool->window];
+			job->state = JOB_RUNNING;
+
+			pthread_mutex_unlock(&pool->lock);
+			if (!job->resolved) {
+				// contexts are set up on demand, so reading cached messages needn't start gpg
+				if (!worker->gpg_ready) {
+					gpgme_context_init(&worker->gpg_ctx, 0);
+					worker->gpg_ready = 1;
+				}
+
+				decrypt_job(pool, &worker->gpg_ctx, job);
+			}
+			if (pool->match_fn)
+				job->match = pool->match_fn(&job->commit, &job->message, job->type,
+						pool->match_data);
+			pthread_mutex_lock(&pool->lock);
+
+			job->state = JOB_DONE;
+			pthread_cond_broadcast(&pool->job_done);
+			continue;
+		}
+
+		if (pool->shutdown)
+			break;
+
+		pthread_cond_wait(&pool->job_available, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * Emit the oldest job, waiting for it to complete if necessary. The pool lock
+ * must be held by the caller. The lock is dropped while the callback runs,
+ * since completed jobs are never touched by the workers.
+ * */
+static void emit_next_job(struct decryption_pool *pool)
+{
+	struct decryption_job *job = &pool->jobs[pool->next_emit % pool->window];
+	while (job->state != JOB_DONE)
+		pthread_cond_wait(&pool->job_done, &pool->lock);
+
+	pthread_mutex_unlock(&pool->lock);
+	// session keys already cached leave the cache unchanged
+	if (pool->session_keys && job->type == DECRYPTED && job->session_key.len)
+		session_key_cache_put(pool->session_keys, &job->commit.commit_id,
+				job->session_key.buff);
+
+	pool->emitted_match = job->match;
+	pool->emitted_known = job->known;
+	if (!pool->cb_status)
+		pool->cb_status = pool->cb(&job->commit, &job->message, job->type, pool->cb_data);
+	job_clear(job);
+	pthread_mutex_lock(&pool->lock);
+
+	pool->next_emit++;
+}
+
+/**
+ * Emit completed jobs at the head of the queue, without blocking. The pool
+ * lock must be held by the caller.
+ * */
+static void emit_completed_jobs(struct decryption_pool *pool)
+{
+	while (pool->next_emit < pool->next_submit &&
+			pool->jobs[pool->next_emit % pool->window].state == JOB_DONE)
+		emit_next_job(pool);
+}
+
+/**
+ * Reserve a slot for a new job, emitting the oldest job if the window is full.
+ * The pool lock must be held by the caller.
+ * */
+static struct decryption_job *reserve_job(struct decryption_pool *pool)
+{
+	while (pool->next_submit - pool->next_emit >= pool->window)
+		emit_next_job(pool);
+
+	return &pool->jobs[pool->next_submit % pool->window];
+}
+
+void decryption_pool_init(struct decryption_pool *pool, int nr_workers,
+		decryption_pool_cb cb, void *data)
+{
+	if (nr_workers <= 0) {
+		long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		nr_workers = nproc > 0 ? (int) nproc : 1;
+	}
+
+	pool->workers_len = nr_workers;
+	pool->window = nr_workers * JOBS_PER_WORKER;
+	pool->next_submit = 0;
+	pool->next_dispatch = 0;
+	pool->next_emit = 0;
+	pool->shutdown = 0;
+	pool->cb = cb;
+	pool->cb_data = data;
+	pool->cb_status = 0;
+	pool->match_fn = NULL;
+	pool->match_data = NULL;
+	pool->emitted_match = 0;
+	pool->emitted_known = 0;
+	pool->session_keys = NULL;
+	pool->epoch_keys = NULL;
+	pool->epoch_ctx = NULL;
+	pool->secret_keys_loaded = 0;
+	pgp_key_id_set_init(&pool->secret_key_ids);
+
+	pool->jobs = (struct decryption_job *) calloc(pool->window, sizeof(struct decryption_job));
+	pool->workers = (struct decryption_worker *) calloc(pool->workers_len, sizeof(struct decryption_worker));
+	if (!pool->jobs || !pool->workers)
+		FATAL(MEM_ALLOC_FAILED);
+
+	for (size_t i = 0; i < pool->window; i++)
+		job_init(&pool->jobs[i]);
+
+	if (pthread_mutex_init(&pool->lock, NULL) ||
+			pthread_cond_init(&pool->job_available, NULL) ||
+			pthread_cond_init(&pool->job_done, NULL))
+		FATAL("failed to initialize decryption pool synchronization primitives");
+
+	LOG_INFO("starting decryption pool with %zu workers", pool->workers_len);
+
+	for (size_t i = 0; i < pool->workers_len; i++) {
+		struct decryption_worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->gpg_ready = 0;
+		if (pthread_create(&worker->thread, NULL, worker_routine, worker))
+			FATAL("failed to start decryption worker thread");
+	}
+}
+
+void decryption_pool_use_session_keys(struct decryption_pool *pool,
+		struct session_key_cache *cache)
+{
+	pool->session_keys = cache;
+}
+
+void decryption_pool_use_epoch_keys(struct decryption_pool *pool,
+		struct epoch_key_cache *cache, struct gc_gpgme_ctx *ctx)
+{
+	pool->epoch_keys = cache;
+	pool->epoch_ctx = ctx;
+}
+
+void decryption_pool_use_matcher(struct decryption_pool *pool,
+		decryption_pool_match_fn fn, void *data)
+{
+	pool->match_fn = fn;
+	pool->match_data = data;
+}
+
+int decryption_pool_emitted_match(const struct decryption_pool *pool)
+{
+	return pool->emitted_match;
+}
+
+int decryption_pool_emitted_known(const struct decryption_pool *pool)
+{
+	return pool->emitted_known;
+}
+
+/**
+ * List the user's secret keys, the first time an encrypted message is seen.
+ * Only ever called from the thread submitting jobs.
+ * */
+static void load_secret_key_ids(struct decryption_pool *pool)
+{
+	if (pool->secret_keys_loaded)
+		return;
+
+	struct gc_gpgme_ctx ctx;
+	gpgme_context_init(&ctx, 0);
+	pgp_key_id_set_load_secret_keys(&pool->secret_key_ids, &ctx);
+	gpgme_context_release(&ctx);
+
+	pool->secret_keys_loaded = 1;
+}
+
+/**
+ * Scan the message of a commit to determine whether it needs to be decrypted
+ * at all.
+ *
+ * Returns zero if the message should be decrypted by a worker. Otherwise,
+ * returns non-zero and sets `type` to the outcome of decryption.
+ * */
+static int prescan_message(struct decryption_pool *pool,
+		const struct git_commit_view *commit, enum message_type *type)
+{
+	struct pgp_recipients recipients;
+	struct git_oid blob_id;
+	enum pgp_scan_result result;
+	int resolved = 0;
+
+	// the ciphertext blob of a message stored as a blob could not be read
+	if (!commit->blob_len && !commit_body_ciphertext_blob(commit->body,
+			commit->body_len, &blob_id)) {
+		*type = UNKNOWN_ERROR;
+		return 1;
+	}
+
+	pgp_recipients_init(&recipients);
+
+	if (commit->blob_len)
+		result = pgp_scan_binary_message(commit->blob, commit->blob_len, &recipients);
+	else
+		result = pgp_scan_message(commit->body, commit->body_len, &recipients);
+
+	switch (result) {
+		case PGP_SCAN_PLAINTEXT:
+			*type = PLAINTEXT;
+			resolved = 1;
+			break;
+		case PGP_SCAN_ENCRYPTED:
+			load_secret_key_ids(pool);
+			if (!pgp_key_id_set_can_decrypt(&pool->secret_key_ids, &recipients)) {
+				*type = UNKNOWN_ERROR;
+				resolved = 1;
+			}
+			break;
+		case PGP_SCAN_UNKNOWN:
+			break;
+	}
+
+	pgp_recipients_release(&recipients);
+
+	return resolved;
+}
+
+/**
+ * Submit a job whose outcome is already known, either to the caller (`known`)
+ * or from scanning the message.
+ * */
+static int add_resolved_job(struct decryption_pool *pool, struct git_commit_view *commit,
+		enum message_type type, const struct strbuf *message, int known)
+{
+	pthread_mutex_lock(&pool->lock);
+
+	struct decryption_job *job = reserve_job(pool);
+	git_commit_from_view(&job->commit, commit);
+	if (type == DECRYPTED && message)
+		strbuf_attach(&job->message, message->buff, message->len);
+	job->type = type;
+	job->resolved = 1;
+	job->known = known ? 1 : 0;
+	pool->next_submit++;
+
+	// with a matcher, the workers still have to look at the message
+	if (pool->match_fn) {
+		job->state = JOB_PENDING;
+		pthread_cond_signal(&pool->job_available);
+	} else {
+		job->state = JOB_DONE;
+	}
+
+	emit_completed_jobs(pool);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return pool->cb_status;
+}
+
+int decryption_pool_add(struct decryption_pool *pool, struct git_commit_view *commit)
+{
+	enum message_type type;
+	if (prescan_message(pool, commit, &type))
+		return add_resolved_job(pool, commit, type, NULL, 0);
+
+	// messages encrypted with a group key need the key of their epoch
+	const char *epoch_key = NULL;
+	char epoch_id[GROUP_KEY_EPOCH_ID_LEN + 1];
+	if (!group_key_message_epoch(commit->body, commit->body_len, epoch_id)) {
+		if (pool->epoch_keys)
+			epoch_key = epoch_key_cache_resolve(pool->epoch_keys, pool->epoch_ctx,
+					epoch_id, &commit->commit_id);
+		if (!epoch_key)
+			return add_resolved_job(pool, commit, UNKNOWN_ERROR, NULL, 0);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	struct decryption_job *job = reserve_job(pool);
+	git_commit_from_view(&job->commit, commit);
+	if (pool->session_keys) {
+		struct session_key_cache_entry *entry =
+				session_key_cache_get(pool->session_keys, &commit->commit_id);
+		if (entry)
+			strbuf_attach(&job->session_key, entry->session_key.buff, entry->session_key.len);
+	}
+	if (epoch_key)
+		strbuf_attach_str(&job->epoch_key, epoch_key);
+	job->state = JOB_PENDING;
+	pool->next_submit++;
+
+	pthread_cond_signal(&pool->job_available);
+	emit_completed_jobs(pool);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return pool->cb_status;
+}
+
+int decryption_pool_add_resolved(struct decryption_pool *pool, struct git_commit_view *commit,
+		enum message_type type, const struct strbuf *message)
+{
+	return add_resolved_job(pool, commit, type, message, 1);
+}
+
+int decryption_pool_finish(struct decryption_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->next_emit < pool->next_submit)
+		emit_next_job(pool);
+
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->job_available);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->workers_len; i++) {
+		if (pthread_join(pool->workers[i].thread, NULL))
+			FATAL("failed to join decryption worker thread");
+
+		if (pool->workers[i].gpg_ready)
+			gpgme_context_release(&pool->workers[i].gpg_ctx);
+	}
+
+	pgp_key_id_set_release(&pool->secret_key_ids);
+
+	for (size_t i = 0; i < pool->window; i++)
+		job_release(&pool->jobs[i]);
+
+	pthread_cond_destroy(&pool->job_done);
+	pthread_cond_destroy(&pool->job_available);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->jobs);
+	free(pool->workers);
+	pool->jobs = NULL;
+	pool->workers = NULL;
+
+	return pool->cb_status;
+}
+
+int decryption_pool_resolve_jobs(int jobs)
+{
+	if (jobs >= 0)
+		return jobs;
+
+	struct strbuf value;
+	strbuf_init(&value);
+
+	// the number of workers depends on the machine, not on the channel
+	const char *source = DECRYPT_JOBS_ENV;
+	const char *env = getenv(DECRYPT_JOBS_ENV);
+	int found = 0;
+	if (env) {
+		strbuf_attach_str(&value, env);
+		found = 1;
+	} else if (!get_git_config_value(DECRYPT_JOBS_CONFIG, &value)) {
+		source = DECRYPT_JOBS_CONFIG;
+		found = 1;
+	}
+
+	jobs = 0;
+	if (found) {
+		char *tailptr = NULL;
+		long parsed = strtol(value.buff, &tailptr, 10);
+		if (!value.len || *tailptr || parsed < 0 || parsed > 1024)
+			WARN("invalid value '%s' for '%s'; ignoring", value.buff, source);
+		else
+			jobs = (int) parsed;
+	}
+
+	strbuf_release(&value);
+
+	return jobs;
+}
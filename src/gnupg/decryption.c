@@ -1,64 +1,253 @@
 #include <errno.h>
+#include <string.h>
 
 #include "gnupg/decryption.h"
 
-int decrypt_asymmetric_message(struct gc_gpgme_ctx *ctx,
-		struct strbuf *ciphertext, struct strbuf *output)
+static ssize_t strbuf_stream_write(void *handle, const void *buffer, size_t size)
 {
-	gpgme_error_t err;
-	int errsv = errno;
-	int ret = 0;
+	strbuf_attach_bytes((struct strbuf *) handle, buffer, size);
+
+	return (ssize_t) size;
+}
 
+/**
+ * Create a gpgme data buffer over in-memory ciphertext.
+ * */
+static struct gpgme_data *ciphertext_data(struct strbuf *ciphertext)
+{
 	struct gpgme_data *message_in;
-	struct gpgme_data *message_out;
-	err = gpgme_data_new_from_mem(&message_in, ciphertext->buff, ciphertext->len, 0);
+	gpgme_error_t err = gpgme_data_new_from_mem(&message_in, ciphertext->buff,
+			ciphertext->len, 0);
 	if (err)
 		GPG_FATAL("unable to create GPGME memory data buffer from ciphertext", err);
 
-	err = gpgme_data_new(&message_out);
-	if (err)
-		GPG_FATAL("unable to create GPGME data buffer for encrypted ciphertext", err);
+	return message_in;
+}
+
+/**
+ * Decrypt the data `message_in` into the data `message_out`, as gpg produces the
+ * plaintext. If `passphrase` is non-NULL, it is given to gpg through loopback
+ * pinentry so that the user is never prompted; the pinentry mode and
+ * passphrase callback of the context are restored afterwards.
+ *
+ * If `warn` is zero, failures are only logged at debug level, which is useful
+ * when a failure is expected and recovered from by the caller.
+ *
+ * Returns zero if message decrypted successfully, > 0 if no data to decrypt
+ * or < 0 if decryption failed for any other reason.
+ * */
+static int decrypt_data(struct gc_gpgme_ctx *ctx, struct gpgme_data *message_in,
+		struct gpgme_data *message_out, const char *passphrase, int warn)
+{
+	gpgme_error_t err;
+	gpgme_pinentry_mode_t mode = GPGME_PINENTRY_MODE_DEFAULT;
+	gpgme_passphrase_cb_t cb = NULL;
+	void *cb_data = NULL;
+	int errsv = errno;
+	int ret = 0;
+
+	if (passphrase) {
+		mode = gpgme_get_pinentry_mode(ctx->gpgme_ctx);
+		gpgme_get_passphrase_cb(ctx->gpgme_ctx, &cb, &cb_data);
+
+		gpgme_set_pinentry_mode(ctx->gpgme_ctx, GPGME_PINENTRY_MODE_LOOPBACK);
+		gpgme_set_passphrase_cb(ctx->gpgme_ctx, gpgme_pass_cb, (void *) passphrase);
+	}
 
 	// if decryption failed, we won't die FATAL, we will just notify the caller
 	err = gpgme_op_decrypt(ctx->gpgme_ctx, message_in, message_out);
 	if (err) {
-		LOG_WARN("gpg decryption failed unexpectedly: %d %s\n",
-				gpgme_err_code(err), gpgme_strerror(err));
+		if (warn)
+			LOG_WARN("gpg decryption failed unexpectedly: %d %s\n",
+					gpgme_err_code(err), gpgme_strerror(err));
+		else
+			LOG_DEBUG("gpg decryption failed: %d %s\n",
+					gpgme_err_code(err), gpgme_strerror(err));
 
 		ret = gpgme_err_code(err) == GPG_ERR_NO_DATA ? 1 : -1;
+	} else {
+		errno = errsv;
+	}
 
-		goto decrypt_failed;
+	if (passphrase) {
+		gpgme_set_pinentry_mode(ctx->gpgme_ctx, mode);
+		gpgme_set_passphrase_cb(ctx->gpgme_ctx, cb, cb_data);
 	}
 
-	// read plaintext into message_out strbuf
-	if (gpgme_data_seek(message_out, 0, SEEK_SET) != 0) {
-		LOG_ERROR("failed to seek to beginning of gpgme data buffer");
-		ret = -1;
+	return ret;
+}
 
-		goto decrypt_failed;
-	}
+/**
+ * Decrypt ciphertext into `output`, like decrypt_data(). The plaintext is
+ * appended to `output` directly by gpgme. If decryption fails, any partial
+ * plaintext is wiped from `output`.
+ * */
+static int decrypt_message(struct gc_gpgme_ctx *ctx, struct strbuf *ciphertext,
+		struct strbuf *output, const char *passphrase, int warn)
+{
+	gpgme_error_t err;
+	struct gpgme_data *message_out;
+	struct gpgme_data_cbs cbs = { NULL, strbuf_stream_write, NULL, NULL };
+	size_t original_len = output->len;
 
-	char temporary_buffer[1024];
-	ssize_t bytes_read;
-	while ((bytes_read = gpgme_data_read(message_out, temporary_buffer, 1024)) > 0)
-		strbuf_attach(output, temporary_buffer, bytes_read);
+	err = gpgme_data_new_from_cbs(&message_out, &cbs, output);
+	if (err)
+		GPG_FATAL("unable to create GPGME data buffer for decrypted plaintext", err);
 
-	if (bytes_read < 0) {
-		LOG_ERROR("failed to read from gpgme data buffer");
+	struct gpgme_data *message_in = ciphertext_data(ciphertext);
+	int ret = decrypt_data(ctx, message_in, message_out, passphrase, warn);
+	gpgme_data_release(message_in);
+	gpgme_data_release(message_out);
 
-		ret = -1;
-		goto decrypt_failed;
+	if (ret) {
+		memset(output->buff + original_len, 0, output->len - original_len);
+		output->len = original_len;
 	}
 
-	gpgme_data_release(message_in);
+	return ret;
+}
+
+int decrypt_asymmetric_message(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output)
+{
+	return decrypt_message(ctx, ciphertext, output, NULL, 1);
+}
+
+/**
+ * Decrypt the data `message_in`, passing the plaintext to `fn` as gpg produces
+ * it.
+ * */
+static int decrypt_stream(struct gc_gpgme_ctx *ctx, struct gpgme_data *message_in,
+		const char *passphrase, decryption_write_fn fn, void *data)
+{
+	gpgme_error_t err;
+	struct gpgme_data *message_out;
+	struct gpgme_data_cbs cbs = { NULL, fn, NULL, NULL };
+
+	err = gpgme_data_new_from_cbs(&message_out, &cbs, data);
+	if (err)
+		GPG_FATAL("unable to create GPGME data stream for decrypted plaintext", err);
+
+	int ret = decrypt_data(ctx, message_in, message_out, passphrase, 1);
 	gpgme_data_release(message_out);
 
-	errno = errsv;
 	return ret;
+}
 
-decrypt_failed:
+/**
+ * Decrypt ciphertext read through `read`, passing the plaintext to `fn`.
+ * */
+static int decrypt_reader_stream(struct gc_gpgme_ctx *ctx, decryption_read_fn read,
+		void *in, const char *passphrase, decryption_write_fn fn, void *data)
+{
+	gpgme_error_t err;
+	struct gpgme_data *message_in;
+	struct gpgme_data_cbs cbs = { read, NULL, NULL, NULL };
+
+	err = gpgme_data_new_from_cbs(&message_in, &cbs, in);
+	if (err)
+		GPG_FATAL("unable to create GPGME data stream for ciphertext", err);
+
+	int ret = decrypt_stream(ctx, message_in, passphrase, fn, data);
 	gpgme_data_release(message_in);
-	gpgme_data_release(message_out);
 
 	return ret;
 }
+
+int decrypt_asymmetric_message_stream(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, decryption_write_fn fn, void *data)
+{
+	struct gpgme_data *message_in = ciphertext_data(ciphertext);
+	int ret = decrypt_stream(ctx, message_in, NULL, fn, data);
+	gpgme_data_release(message_in);
+
+	return ret;
+}
+
+int decrypt_symmetric_message_stream(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, const char *passphrase,
+		decryption_write_fn fn, void *data)
+{
+	struct gpgme_data *message_in = ciphertext_data(ciphertext);
+	int ret = decrypt_stream(ctx, message_in, passphrase, fn, data);
+	gpgme_data_release(message_in);
+
+	return ret;
+}
+
+int decrypt_asymmetric_reader_stream(struct gc_gpgme_ctx *ctx,
+		decryption_read_fn read, void *in, decryption_write_fn fn, void *data)
+{
+	return decrypt_reader_stream(ctx, read, in, NULL, fn, data);
+}
+
+int decrypt_symmetric_reader_stream(struct gc_gpgme_ctx *ctx,
+		decryption_read_fn read, void *in, const char *passphrase,
+		decryption_write_fn fn, void *data)
+{
+	return decrypt_reader_stream(ctx, read, in, passphrase, fn, data);
+}
+
+/**
+ * Decrypt ciphertext with its cached session key, falling back to the secret
+ * keys of the user (or to `passphrase`, if non-NULL) and exporting the session
+ * key.
+ * */
+static int decrypt_message_with_session_key(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output, const char *passphrase,
+		struct strbuf *session_key)
+{
+	int ret;
+
+	if (session_key->len && !gpgme_set_ctx_flag(ctx->gpgme_ctx,
+			"override-session-key", session_key->buff)) {
+		ret = decrypt_message(ctx, ciphertext, output, NULL, 0);
+		gpgme_set_ctx_flag(ctx->gpgme_ctx, "override-session-key", "");
+
+		if (ret >= 0)
+			return ret;
+
+		// the session key is stale or wrong; fall back to the secret keys
+		LOG_DEBUG("decryption with cached session key failed; retrying");
+		memset(output->buff, 0, output->alloc);
+		strbuf_clear(output);
+	}
+
+	memset(session_key->buff, 0, session_key->alloc);
+	strbuf_clear(session_key);
+
+	// older versions of gpgme can't export session keys, which is fine
+	int export = !gpgme_set_ctx_flag(ctx->gpgme_ctx, "export-session-key", "1");
+	ret = decrypt_message(ctx, ciphertext, output, passphrase, 1);
+
+	if (export) {
+		gpgme_decrypt_result_t result = gpgme_op_decrypt_result(ctx->gpgme_ctx);
+		if (!ret && result && result->session_key)
+			strbuf_attach_str(session_key, result->session_key);
+
+		gpgme_set_ctx_flag(ctx->gpgme_ctx, "export-session-key", "0");
+	}
+
+	return ret;
+}
+
+int decrypt_asymmetric_message_with_session_key(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output,
+		struct strbuf *session_key)
+{
+	return decrypt_message_with_session_key(ctx, ciphertext, output, NULL, session_key);
+}
+
+int decrypt_symmetric_message(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output, const char *passphrase)
+{
+	return decrypt_message(ctx, ciphertext, output, passphrase, 1);
+}
+
+int decrypt_symmetric_message_with_session_key(struct gc_gpgme_ctx *ctx,
+		struct strbuf *ciphertext, struct strbuf *output, const char *passphrase,
+		struct strbuf *session_key)
+{
+	return decrypt_message_with_session_key(ctx, ciphertext, output, passphrase,
+			session_key);
+}
@@ -4,47 +4,55 @@
 
 #include "gnupg/encryption.h"
 
-void asymmetric_encrypt_plaintext_message(struct gc_gpgme_ctx *ctx,
-		const struct strbuf *message, struct strbuf *output,
-		struct gpg_key_list *recipients)
+/**
+ * State of a gpgme data stream over a file descriptor. The number of bytes
+ * that passed through the stream is counted, so that callers can tell whether
+ * there was any plaintext at all.
+ * */
+struct fd_stream {
+	int fd;
+	size_t bytes;
+};
+
+static ssize_t fd_stream_read(void *handle, void *buffer, size_t size)
 {
-	gpgme_error_t err;
-	int errsv = errno;
+	struct fd_stream *stream = handle;
 
-	LOG_INFO("encrypting plaintext message");
-
-	struct str_array keys;
-	str_array_init(&keys);
+	ssize_t bytes_read = xread(stream->fd, buffer, size);
+	if (bytes_read > 0)
+		stream->bytes += bytes_read;
 
-	// use str_array to build fixed-length array from linked list of gpg keys
-	struct gpg_key_list_node *node = recipients->head;
-	while (node) {
-		struct str_array_entry *entry = str_array_insert_nodup(&keys, NULL, keys.len);
-		entry->data = node->key;
+	return bytes_read;
+}
 
-		LOG_TRACE("recipient gpg key fingerprint: %s", node->key->fpr);
+static ssize_t fd_stream_write(void *handle, const void *buffer, size_t size)
+{
+	struct fd_stream *stream = handle;
 
-		node = node->next;
-	}
+	ssize_t bytes_written = xwrite(stream->fd, buffer, size);
+	if (bytes_written > 0)
+		stream->bytes += bytes_written;
 
-	size_t keys_len = 0;
-	gpgme_key_t *keys_array = (gpgme_key_t *)str_array_detach_data(&keys, &keys_len);
-	if (!keys_len)
-		BUG("no gpg keys given to asymmetric_encrypt_plaintext_message()");
+	return bytes_written;
+}
 
-	// build gpg data buffers for the plaintext input and ciphertext output
-	struct gpgme_data *message_in;
-	struct gpgme_data *message_out;
-	err = gpgme_data_new_from_mem(&message_in, message->buff, message->len, 0);
-	if (err)
-		GPG_FATAL("unable to create GPGME memory data buffer from plaintext message", err);
+static ssize_t strbuf_stream_write(void *handle, const void *buffer, size_t size)
+{
+	strbuf_attach_bytes((struct strbuf *) handle, buffer, size);
 
-	err = gpgme_data_new(&message_out);
-	if (err)
-		GPG_FATAL("unable to create GPGME data buffer for encrypted ciphertext", err);
+	return (ssize_t) size;
+}
 
-	// encrypt plaintext, always trusting gpg keys, and do not use default recipient
-	err = gpgme_op_encrypt(ctx->gpgme_ctx, keys_array, GPGME_ENCRYPT_ALWAYS_TRUST | GPGME_ENCRYPT_NO_ENCRYPT_TO,
+/**
+ * Encrypt the data `message_in` into `message_out`, for the given recipients
+ * and flags. If `recipients` is NULL, the message is encrypted symmetrically
+ * with the passphrase supplied by the passphrase callback of the context.
+ * */
+static void encrypt_data(struct gc_gpgme_ctx *ctx, gpgme_key_t recipients[],
+		gpgme_encrypt_flags_t flags, struct gpgme_data *message_in,
+		struct gpgme_data *message_out)
+{
+	gpgme_error_t err = gpgme_op_encrypt(ctx->gpgme_ctx, recipients, flags,
 			message_in, message_out);
 	if (err) {
 		if (gpgme_err_code(err) == GPG_ERR_INV_VALUE)
@@ -65,25 +73,174 @@ void asymmetric_encrypt_plaintext_message(struct gc_gpgme_ctx *ctx,
 
 		GPG_FATAL("GPGME unable to encrypt message", err);
 	}
+}
+
+/**
+ * Encrypt `message` into `output`. The ciphertext is appended to `output` as
+ * gpg produces it.
+ * */
+static void encrypt_message(struct gc_gpgme_ctx *ctx, gpgme_key_t recipients[],
+		gpgme_encrypt_flags_t flags, const struct strbuf *message, struct strbuf *output)
+{
+	gpgme_error_t err;
+	struct gpgme_data *message_in;
+	struct gpgme_data *message_out;
+	struct gpgme_data_cbs out_cbs = { NULL, strbuf_stream_write, NULL, NULL };
 
-	// read ciphertext into message_out strbuf
-	int ret = gpgme_data_seek(message_out, 0, SEEK_SET);
-	if (ret)
-		GPG_FATAL("failed to seek to beginning of gpgme data buffer", err);
+	// build gpg data buffers for the plaintext input and ciphertext output
+	err = gpgme_data_new_from_mem(&message_in, message->buff, message->len, 0);
+	if (err)
+		GPG_FATAL("unable to create GPGME memory data buffer from plaintext message", err);
 
-	char temporary_buffer[1024];
-	while ((ret = gpgme_data_read(message_out, temporary_buffer, 1024)) > 0)
-		strbuf_attach(output, temporary_buffer, ret);
+	err = gpgme_data_new_from_cbs(&message_out, &out_cbs, output);
+	if (err)
+		GPG_FATAL("unable to create GPGME data buffer for encrypted ciphertext", err);
 
-	if (ret < 0)
-		GPG_FATAL("failed to read from gpgme data buffer", err);
+	encrypt_data(ctx, recipients, flags, message_in, message_out);
 
-	// free the array but leave the gpg keys intact; they are owned by the caller
-	free(keys_array);
+	gpgme_data_release(message_in);
+	gpgme_data_release(message_out);
+}
+
+/**
+ * Encrypt the plaintext read from `in_fd` into `out_fd`. Neither is buffered
+ * in full; gpg reads and writes through the data callbacks as it goes.
+ *
+ * Returns the number of bytes of plaintext read.
+ * */
+static size_t encrypt_stream(struct gc_gpgme_ctx *ctx, gpgme_key_t recipients[],
+		gpgme_encrypt_flags_t flags, int in_fd, int out_fd)
+{
+	gpgme_error_t err;
+	struct gpgme_data *message_in;
+	struct gpgme_data *message_out;
+	struct gpgme_data_cbs in_cbs = { fd_stream_read, NULL, NULL, NULL };
+	struct gpgme_data_cbs out_cbs = { NULL, fd_stream_write, NULL, NULL };
+	struct fd_stream in = { in_fd, 0 };
+	struct fd_stream out = { out_fd, 0 };
+
+	err = gpgme_data_new_from_cbs(&message_in, &in_cbs, &in);
+	if (err)
+		GPG_FATAL("unable to create GPGME data stream for plaintext message", err);
+
+	err = gpgme_data_new_from_cbs(&message_out, &out_cbs, &out);
+	if (err)
+		GPG_FATAL("unable to create GPGME data stream for encrypted ciphertext", err);
+
+	encrypt_data(ctx, recipients, flags, message_in, message_out);
 
 	gpgme_data_release(message_in);
 	gpgme_data_release(message_out);
 
+	LOG_DEBUG("streamed %zu bytes of plaintext into %zu bytes of ciphertext",
+			in.bytes, out.bytes);
+
+	return in.bytes;
+}
+
+/**
+ * Log the recipients of a message about to be encrypted.
+ * */
+static void trace_recipients(struct gpg_key_set *recipients)
+{
+	if (!recipients->len)
+		BUG("no gpg keys given to asymmetric encryption");
+
+	for (size_t i = 0; i < recipients->len; i++)
+		LOG_TRACE("recipient gpg key fingerprint: %s", recipients->keys[i]->fpr);
+}
+
+struct passphrase_state {
+	gpgme_pinentry_mode_t mode;
+	gpgme_passphrase_cb_t cb;
+	void *cb_data;
+};
+
+/**
+ * Supply `passphrase` to gpg directly, rather than through pinentry, saving
+ * the pinentry mode and passphrase callback of the context into `saved` so
+ * that they can be restored with restore_passphrase().
+ * */
+static void use_passphrase(struct gc_gpgme_ctx *ctx, const char *passphrase,
+		struct passphrase_state *saved)
+{
+	saved->mode = gpgme_get_pinentry_mode(ctx->gpgme_ctx);
+	gpgme_get_passphrase_cb(ctx->gpgme_ctx, &saved->cb, &saved->cb_data);
+
+	gpgme_set_pinentry_mode(ctx->gpgme_ctx, GPGME_PINENTRY_MODE_LOOPBACK);
+	gpgme_set_passphrase_cb(ctx->gpgme_ctx, gpgme_pass_cb, (void *) passphrase);
+}
+
+static void restore_passphrase(struct gc_gpgme_ctx *ctx, const struct passphrase_state *saved)
+{
+	gpgme_set_pinentry_mode(ctx->gpgme_ctx, saved->mode);
+	gpgme_set_passphrase_cb(ctx->gpgme_ctx, saved->cb, saved->cb_data);
+}
+
+void asymmetric_encrypt_plaintext_message(struct gc_gpgme_ctx *ctx,
+		const struct strbuf *message, struct strbuf *output,
+		struct gpg_key_set *recipients)
+{
+	int errsv = errno;
+
+	LOG_INFO("encrypting plaintext message");
+	trace_recipients(recipients);
+
+	// encrypt plaintext, always trusting gpg keys, and do not use default recipient
+	encrypt_message(ctx, recipients->keys,
+			GPGME_ENCRYPT_ALWAYS_TRUST | GPGME_ENCRYPT_NO_ENCRYPT_TO, message, output);
+
 	LOG_INFO("successfully encrypted message");
 	errno = errsv;
 }
+
+size_t asymmetric_encrypt_plaintext_stream(struct gc_gpgme_ctx *ctx, int in_fd,
+		int out_fd, struct gpg_key_set *recipients)
+{
+	int errsv = errno;
+
+	LOG_INFO("encrypting plaintext message stream");
+	trace_recipients(recipients);
+
+	size_t len = encrypt_stream(ctx, recipients->keys,
+			GPGME_ENCRYPT_ALWAYS_TRUST | GPGME_ENCRYPT_NO_ENCRYPT_TO, in_fd, out_fd);
+
+	LOG_INFO("successfully encrypted message");
+	errno = errsv;
+
+	return len;
+}
+
+void symmetric_encrypt_plaintext_message(struct gc_gpgme_ctx *ctx,
+		const struct strbuf *message, struct strbuf *output, const char *passphrase)
+{
+	struct passphrase_state saved;
+	int errsv = errno;
+
+	LOG_INFO("encrypting plaintext message with passphrase");
+
+	use_passphrase(ctx, passphrase, &saved);
+	encrypt_message(ctx, NULL, GPGME_ENCRYPT_SYMMETRIC, message, output);
+	restore_passphrase(ctx, &saved);
+
+	LOG_INFO("successfully encrypted message");
+	errno = errsv;
+}
+
+size_t symmetric_encrypt_plaintext_stream(struct gc_gpgme_ctx *ctx, int in_fd,
+		int out_fd, const char *passphrase)
+{
+	struct passphrase_state saved;
+	int errsv = errno;
+
+	LOG_INFO("encrypting plaintext message stream with passphrase");
+
+	use_passphrase(ctx, passphrase, &saved);
+	size_t len = encrypt_stream(ctx, NULL, GPGME_ENCRYPT_SYMMETRIC, in_fd, out_fd);
+	restore_passphrase(ctx, &saved);
+
+	LOG_INFO("successfully encrypted message");
+	errno = errsv;
+
+	return len;
+}
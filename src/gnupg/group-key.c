@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gnupg/group-key.h"
+#include "gnupg/decryption.h"
+#include "gnupg/encryption.h"
+#include "config/parse-config.h"
+#include "git/object-coprocess.h"
+#include "run-command.h"
+#include "utils.h"
+
+#define GROUP_EPOCH_FILE_HEADER "git-chat epoch v1\n"
+#define GROUP_KEY_EPOCH_KEY_LEN (GROUP_KEY_EPOCH_KEY_BYTES * 2)
+
+void group_epoch_init(struct group_epoch *epoch)
+{
+	epoch->id[0] = 0;
+	strbuf_init(&epoch->key);
+	str_array_init(&epoch->members);
+	strbuf_init(&epoch->wrapped_key);
+}
+
+void group_epoch_release(struct group_epoch *epoch)
+{
+	memset(epoch->key.buff, 0, epoch->key.alloc);
+	strbuf_release(&epoch->key);
+	str_array_release(&epoch->members);
+	strbuf_release(&epoch->wrapped_key);
+	epoch->id[0] = 0;
+}
+
+int group_key_enabled(const char *channel)
+{
+	struct strbuf key, value;
+	int enabled = 0;
+
+	strbuf_init(&key);
+	strbuf_init(&value);
+	strbuf_attach_fmt(&key, "channel.%s.groupkey", channel);
+
+	if (!get_config_value(key.buff, &value))
+		enabled = !strcmp(value.buff, "true");
+
+	strbuf_release(&value);
+	strbuf_release(&key);
+
+	return enabled;
+}
+
+/**
+ * Determine whether the first `len` characters of `str` are lowercase hex
+ * digits.
+ * */
+static int is_hex(const char *str, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (!isdigit((unsigned char) str[i]) && (str[i] < 'a' || str[i] > 'f'))
+			return 0;
+	}
+
+	return 1;
+}
+
+int group_key_is_epoch_id(const char *id)
+{
+	return strlen(id) == GROUP_KEY_EPOCH_ID_LEN && is_hex(id, GROUP_KEY_EPOCH_ID_LEN);
+}
+
+/**
+ * Append `len` random bytes, hex encoded, to `out`.
+ * */
+static void attach_random_hex(struct strbuf *out, size_t len)
+{
+	unsigned char bytes[64];
+
+	if (len > sizeof(bytes))
+		BUG("too many random bytes requested");
+
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		FATAL(FILE_OPEN_FAILED, "/dev/urandom");
+	if (xread(fd, bytes, len) != (ssize_t) len)
+		FATAL("failed to read random bytes from /dev/urandom");
+	close(fd);
+
+	for (size_t i = 0; i < len; i++)
+		strbuf_attach_fmt(out, "%02x", bytes[i]);
+
+	memset(bytes, 0, sizeof(bytes));
+}
+
+/**
+ * Collect the sorted fingerprints of the keys in the set.
+ * */
+static void collect_fingerprints(struct gpg_key_set *keys, struct str_array *fingerprints)
+{
+	for (size_t i = 0; i < keys->len; i++)
+		str_array_push(fingerprints, keys->keys[i]->fpr, NULL);
+
+	str_array_sort(fingerprints);
+}
+
+void group_epoch_create(struct gc_gpgme_ctx *ctx, struct gpg_key_set *members,
+		struct group_epoch *epoch)
+{
+	struct strbuf id;
+
+	if (!members->len)
+		BUG("no members given to group_epoch_create()");
+
+	strbuf_init(&id);
+	attach_random_hex(&id, GROUP_KEY_EPOCH_ID_BYTES);
+	memcpy(epoch->id, id.buff, GROUP_KEY_EPOCH_ID_LEN + 1);
+	strbuf_release(&id);
+
+	attach_random_hex(&epoch->key, GROUP_KEY_EPOCH_KEY_BYTES);
+	collect_fingerprints(members, &epoch->members);
+
+	LOG_INFO("created epoch %s with %zu members", epoch->id, epoch->members.len);
+
+	// epoch files are text, even if messages are stored in binary
+	int armor = gpgme_get_armor(ctx->gpgme_ctx);
+	gpgme_set_armor(ctx->gpgme_ctx, 1);
+	asymmetric_encrypt_plaintext_message(ctx, &epoch->key, &epoch->wrapped_key, members);
+	gpgme_set_armor(ctx->gpgme_ctx, armor);
+}
+
+int group_epoch_has_members(const struct group_epoch *epoch, struct gpg_key_set *members)
+{
+	struct str_array fingerprints;
+	int equal = 1;
+
+	if (epoch->members.len != members->len)
+		return 0;
+
+	str_array_init(&fingerprints);
+	collect_fingerprints(members, &fingerprints);
+
+	for (size_t i = 0; equal && i < fingerprints.len; i++)
+		equal = !strcmp(fingerprints.entries[i].string, epoch->members.entries[i].string);
+
+	str_array_release(&fingerprints);
+
+	return equal;
+}
+
+int group_epoch_parse(struct group_epoch *epoch, const char *id,
+		const char *data, size_t len)
+{
+	const char *end = data + len;
+	size_t header_len = strlen(GROUP_EPOCH_FILE_HEADER);
+
+	if (!group_key_is_epoch_id(id))
+		return 1;
+	if (len < header_len || memcmp(data, GROUP_EPOCH_FILE_HEADER, header_len) != 0)
+		return 1;
+
+	memcpy(epoch->id, id, GROUP_KEY_EPOCH_ID_LEN + 1);
+
+	data += header_len;
+	while (data < end) {
+		const char *lf = memchr(data, '\n', end - data);
+		if (!lf)
+			return 1;
+
+		// a blank line separates the members from the wrapped key
+		if (lf == data) {
+			data = lf + 1;
+			break;
+		}
+
+		if ((size_t) (lf - data) <= strlen("member ") || memcmp(data, "member ", 7) != 0)
+			return 1;
+
+		struct strbuf fpr;
+		strbuf_init(&fpr);
+		strbuf_attach(&fpr, data + 7, lf - data - 7);
+		str_array_push(&epoch->members, fpr.buff, NULL);
+		strbuf_release(&fpr);
+
+		data = lf + 1;
+	}
+
+	if (!epoch->members.len || data >= end)
+		return 1;
+
+	// members must be sorted and unique
+	for (size_t i = 1; i < epoch->members.len; i++) {
+		if (strcmp(epoch->members.entries[i - 1].string, epoch->members.entries[i].string) >= 0)
+			return 1;
+	}
+
+	strbuf_attach(&epoch->wrapped_key, data, end - data);
+
+	return 0;
+}
+
+void group_epoch_serialize(const struct group_epoch *epoch, struct strbuf *out)
+{
+	strbuf_attach_str(out, GROUP_EPOCH_FILE_HEADER);
+
+	for (size_t i = 0; i < epoch->members.len; i++)
+		strbuf_attach_fmt(out, "member %s\n", epoch->members.entries[i].string);
+
+	strbuf_attach_str(out, "\n");
+	strbuf_attach(out, epoch->wrapped_key.buff, epoch->wrapped_key.len);
+}
+
+int group_epoch_unwrap(struct gc_gpgme_ctx *ctx, struct group_epoch *epoch)
+{
+	memset(epoch->key.buff, 0, epoch->key.alloc);
+	strbuf_clear(&epoch->key);
+
+	if (decrypt_asymmetric_message(ctx, &epoch->wrapped_key, &epoch->key)) {
+		LOG_WARN("unable to unwrap the key of epoch %s", epoch->id);
+		return 1;
+	}
+
+	if (epoch->key.len != GROUP_KEY_EPOCH_KEY_LEN || !is_hex(epoch->key.buff, epoch->key.len)) {
+		LOG_WARN("epoch %s has a malformed key", epoch->id);
+
+		memset(epoch->key.buff, 0, epoch->key.alloc);
+		strbuf_clear(&epoch->key);
+		return 1;
+	}
+
+	LOG_INFO("unwrapped the key of epoch %s", epoch->id);
+
+	return 0;
+}
+
+/**
+ * Read the blob `object` with `git cat-file`, for when the object coprocess
+ * isn't available.
+ *
+ * Returns zero if successful, and non-zero if the blob could not be read.
+ * */
+static int read_epoch_file_subprocess(const char *object, struct strbuf *contents)
+{
+	struct child_process_def cmd;
+
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "cat-file", "blob", object, NULL);
+	child_process_def_stderr(&cmd, STDERR_NULL);
+
+	int ret = capture_command(&cmd, contents);
+	child_process_def_release(&cmd);
+
+	return ret;
+}
+
+int group_epoch_read(struct group_epoch *epoch, const char *id,
+		const struct git_oid *commit)
+{
+	struct strbuf object;
+	struct git_object obj;
+	char commit_id[GIT_HEX_OBJECT_ID];
+	int ret;
+
+	if (!group_key_is_epoch_id(id))
+		return 1;
+
+	git_oid_to_str((struct git_oid *) commit, commit_id);
+
+	strbuf_init(&object);
+	strbuf_attach_fmt(&object, "%.*s:.git-chat/%s/%s", GIT_HEX_OBJECT_ID, commit_id,
+			GROUP_KEY_EPOCH_DIR, id);
+
+	ret = object_coprocess_response(object.buff, OBJECT_REQUEST_CONTENTS, NULL, &obj);
+	if (ret < 0) {
+		struct strbuf contents;
+
+		strbuf_init(&contents);
+		ret = read_epoch_file_subprocess(object.buff, &contents);
+		obj.type = GIT_OBJ_BLOB;
+		obj.len = contents.len;
+		obj.data = (unsigned char *) strbuf_detach(&contents);
+	} else if (!ret && obj.type != GIT_OBJ_BLOB) {
+		git_object_release(&obj);
+		ret = 1;
+	}
+
+	if (ret) {
+		LOG_WARN("epoch file for epoch %s does not exist in '%s'", id, object.buff);
+	} else if ((ret = group_epoch_parse(epoch, id, (const char *) obj.data, obj.len))) {
+		LOG_WARN("epoch file for epoch %s is malformed", id);
+	}
+
+	git_object_release(&obj);
+	strbuf_release(&object);
+
+	return ret;
+}
+
+/**
+ * Derive message keys from epoch keys without key stretching. Since epoch keys
+ * are random, rather than chosen by users, stretching them protects nothing,
+ * but would cost every reader hundreds of milliseconds per message.
+ *
+ * gpg has no option for this on the command line that gpgme exposes, so the
+ * option is added to `gpg.conf` in the git-chat gpg home directory.
+ * */
+static void configure_s2k(struct gc_gpgme_ctx *ctx)
+{
+	static const char *option = "s2k-mode 1\n";
+	struct strbuf path, conf;
+
+	strbuf_init(&path);
+	strbuf_init(&conf);
+	strbuf_attach_fmt(&path, "%s/gpg.conf", ctx->gnupg_homedir.buff);
+
+	int fd = open(path.buff, O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		FATAL(FILE_OPEN_FAILED, path.buff);
+
+	strbuf_attach_fd(&conf, fd);
+	if (!strstr(conf.buff, option)) {
+		LOG_DEBUG("configuring s2k mode in '%s'", path.buff);
+
+		if (conf.len && conf.buff[conf.len - 1] != '\n' && xwrite(fd, "\n", 1) != 1)
+			FATAL("failed to write to '%s'", path.buff);
+		if (xwrite(fd, option, strlen(option)) != (ssize_t) strlen(option))
+			FATAL("failed to write to '%s'", path.buff);
+	}
+
+	close(fd);
+	strbuf_release(&conf);
+	strbuf_release(&path);
+}
+
+void group_key_message_header(const struct group_epoch *epoch, struct strbuf *header)
+{
+	strbuf_attach_fmt(header, "%s%s\n", GROUP_KEY_EPOCH_HEADER, epoch->id);
+}
+
+void group_key_encrypt_message(struct gc_gpgme_ctx *ctx, const struct group_epoch *epoch,
+		const struct strbuf *message, struct strbuf *output)
+{
+	if (!epoch->key.len)
+		BUG("epoch key must be known to encrypt a message");
+
+	configure_s2k(ctx);
+	symmetric_encrypt_plaintext_message(ctx, message, output, epoch->key.buff);
+}
+
+size_t group_key_encrypt_stream(struct gc_gpgme_ctx *ctx, const struct group_epoch *epoch,
+		int in_fd, int out_fd)
+{
+	if (!epoch->key.len)
+		BUG("epoch key must be known to encrypt a message");
+
+	configure_s2k(ctx);
+	return symmetric_encrypt_plaintext_stream(ctx, in_fd, out_fd, epoch->key.buff);
+}
+
+int group_key_message_epoch(const char *body, size_t len,
+		char id[GROUP_KEY_EPOCH_ID_LEN + 1])
+{
+	size_t header_len = strlen(GROUP_KEY_EPOCH_HEADER);
+
+	if (len < header_len + GROUP_KEY_EPOCH_ID_LEN)
+		return 1;
+	if (memcmp(body, GROUP_KEY_EPOCH_HEADER, header_len) != 0)
+		return 1;
+
+	const char *value = body + header_len;
+	if (!is_hex(value, GROUP_KEY_EPOCH_ID_LEN))
+		return 1;
+
+	// the id must be followed by the end of the line
+	size_t value_end = header_len + GROUP_KEY_EPOCH_ID_LEN;
+	if (value_end < len && body[value_end] != '\n')
+		return 1;
+
+	memcpy(id, value, GROUP_KEY_EPOCH_ID_LEN);
+	id[GROUP_KEY_EPOCH_ID_LEN] = 0;
+
+	return 0;
+}
@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include "gnupg/key-manager.h"
+#include "gnupg/pgp-packet.h"
 #include "working-tree.h"
 #include "utils.h"
 
@@ -55,6 +56,151 @@ int import_gpg_key(struct gc_gpgme_ctx *ctx, const char *key_file_path,
 	return keys_imported;
 }
 
+/**
+ * State of the gpgme data stream over a list of key files. Key files are read
+ * one at a time, as gpg consumes the stream.
+ * */
+struct key_file_stream {
+	const struct str_array *paths;
+	size_t next;
+
+	struct strbuf current;
+	size_t pos;
+
+	// number of keys in each key file, or -1 if unknown
+	int *key_counts;
+};
+
+static ssize_t key_file_stream_read(void *handle, void *buffer, size_t size)
+{
+	struct key_file_stream *stream = handle;
+
+	while (stream->pos >= stream->current.len) {
+		if (stream->next >= stream->paths->len)
+			return 0;
+
+		const char *path = str_array_get((struct str_array *) stream->paths, stream->next);
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			FATAL("failed to read key file '%s'", path);
+
+		strbuf_clear(&stream->current);
+		strbuf_attach_fd(&stream->current, fd);
+		close(fd);
+
+		LOG_TRACE("streaming key file '%s' to gpg", path);
+
+		stream->key_counts[stream->next] = pgp_count_public_keys(stream->current.buff,
+				stream->current.len);
+
+		// keep the armor of consecutive key files on separate lines
+		if (stream->current.len && stream->current.buff[stream->current.len - 1] != '\n')
+			strbuf_attach_str(&stream->current, "\n");
+
+		stream->pos = 0;
+		stream->next++;
+	}
+
+	size_t len = stream->current.len - stream->pos;
+	if (len > size)
+		len = size;
+
+	memcpy(buffer, stream->current.buff + stream->pos, len);
+	stream->pos += len;
+
+	return (ssize_t) len;
+}
+
+int import_gpg_key_files(struct gc_gpgme_ctx *ctx, const struct str_array *key_file_paths,
+		struct str_array *imported_key_fingerprints, int *key_counts)
+{
+	gpgme_error_t err;
+	struct gpgme_data *key_data;
+	struct gpgme_data_cbs cbs = { key_file_stream_read, NULL, NULL, NULL };
+	struct key_file_stream stream = { key_file_paths, 0, { 0 }, 0, NULL };
+	int keys_imported = 0;
+
+	if (!key_file_paths->len)
+		return 0;
+
+	LOG_DEBUG("importing keys from %zu key files", key_file_paths->len);
+
+	stream.key_counts = calloc(key_file_paths->len, sizeof(int));
+	if (!stream.key_counts)
+		FATAL(MEM_ALLOC_FAILED);
+	strbuf_init(&stream.current);
+
+	err = gpgme_data_new_from_cbs(&key_data, &cbs, &stream);
+	if (err)
+		GPG_FATAL("failed to allocate new gpg data buffer", err);
+
+	err = gpgme_op_import(ctx->gpgme_ctx, key_data);
+	if (err)
+		GPG_FATAL("failed to import keys into the keyring", err);
+
+	gpgme_data_release(key_data);
+	strbuf_release(&stream.current);
+
+	// gpg may stop reading early, leaving key files that were never imported
+	if (stream.next < key_file_paths->len)
+		DIE("failed to import keys; gpg stopped reading after %zu of %zu key files",
+				stream.next, key_file_paths->len);
+
+	size_t batch_start = imported_key_fingerprints ? imported_key_fingerprints->len : 0;
+	gpgme_import_result_t import_result = gpgme_op_import_result(ctx->gpgme_ctx);
+	gpgme_import_status_t result = import_result->imports;
+	while (result) {
+		if (result->result != GPG_ERR_NO_ERROR)
+			DIE("failed to import GPG key");
+
+		LOG_TRACE("imported key with fingerprint %s", result->fpr);
+		if (imported_key_fingerprints)
+			str_array_push(imported_key_fingerprints, result->fpr, NULL);
+
+		result = result->next;
+		keys_imported++;
+	}
+
+	if (!key_counts) {
+		free(stream.key_counts);
+		return keys_imported;
+	}
+
+	/*
+	 * gpg reports imported keys in the order they were read, so the keys of
+	 * each key file can be told apart if the number of keys in each key file
+	 * is known. Otherwise, fall back to importing key files individually.
+	 * */
+	int expected = 0;
+	for (size_t i = 0; i < key_file_paths->len && expected >= 0; i++)
+		expected = stream.key_counts[i] < 0 ? -1 : expected + stream.key_counts[i];
+
+	if (expected == keys_imported) {
+		memcpy(key_counts, stream.key_counts, key_file_paths->len * sizeof(int));
+	} else {
+		LOG_DEBUG("unable to attribute imported keys to key files; "
+				"importing key files individually");
+
+		if (imported_key_fingerprints)
+			str_array_delete(imported_key_fingerprints, batch_start,
+					imported_key_fingerprints->len - batch_start);
+
+		keys_imported = 0;
+		for (size_t i = 0; i < key_file_paths->len; i++) {
+			const char *path = str_array_get((struct str_array *) key_file_paths, i);
+			key_counts[i] = import_gpg_key(ctx, path, imported_key_fingerprints);
+			keys_imported += key_counts[i];
+		}
+	}
+
+	free(stream.key_counts);
+
+	LOG_DEBUG("successfully imported %d keys from %zu key files", keys_imported,
+			key_file_paths->len);
+
+	return keys_imported;
+}
+
 int export_gpg_key(struct gc_gpgme_ctx *ctx, const char *fingerprint,
 		const char *file_path)
 {
@@ -115,103 +261,280 @@ int export_gpg_key(struct gc_gpgme_ctx *ctx, const char *fingerprint,
 static struct gpg_key_list_node *gpg_key_list_push(struct gpg_key_list *,
 		gpgme_key_t);
 
+void get_gpg_keyring_stamp(struct gc_gpgme_ctx *ctx, struct keyring_stamp *stamp)
+{
+	static const char *keyrings[] = { "pubring.kbx", "pubring.gpg" };
+	struct strbuf path;
+	struct stat st;
+
+	memset(stamp, 0, sizeof(struct keyring_stamp));
+
+	strbuf_init(&path);
+	for (size_t i = 0; i < sizeof(keyrings) / sizeof(keyrings[0]); i++) {
+		strbuf_clear(&path);
+		strbuf_attach_fmt(&path, "%s/%s", ctx->gnupg_homedir.buff, keyrings[i]);
+
+		if (!stat(path.buff, &st)) {
+			keyring_stamp_from_stat(stamp, &st);
+			break;
+		}
+	}
+
+	strbuf_release(&path);
+}
+
+static int fingerprint_cmp(const void *key, const void *entry)
+{
+	return strcmp(key, ((const struct str_array_entry *) entry)->string);
+}
+
+/**
+ * Delete from the keyring any of the `stale` keys that are no longer provided
+ * by a key file in the manifest. Secret keys are never deleted.
+ *
+ * Returns the number of keys deleted.
+ * */
+static int delete_stale_keys(struct gc_gpgme_ctx *ctx,
+		struct keyring_manifest *manifest, struct str_array *stale)
+{
+	struct str_array provided;
+	struct hashmap_iter iter;
+	struct keyring_manifest_entry *entry;
+	int keys_deleted = 0;
+
+	// a key may be provided by more than one key file
+	str_array_init(&provided);
+	hashmap_iter_init(&manifest->entries, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		for (size_t i = 0; i < entry->fingerprints.len; i++)
+			str_array_push(&provided, str_array_get(&entry->fingerprints, i), NULL);
+	}
+	str_array_sort(&provided);
+
+	for (size_t i = 0; i < stale->len; i++) {
+		const char *fpr = str_array_get(stale, i);
+		gpgme_key_t key;
+		gpgme_error_t err;
+
+		if (bsearch(fpr, provided.entries, provided.len,
+				sizeof(struct str_array_entry), fingerprint_cmp))
+			continue;
+
+		err = gpgme_get_key(ctx->gpgme_ctx, fpr, &key, 0);
+		if (err) {
+			LOG_DEBUG("key with fingerprint %s is no longer in the keyring", fpr);
+			continue;
+		}
+
+		err = gpgme_op_delete_ext(ctx->gpgme_ctx, key, GPGME_DELETE_FORCE);
+		if (err) {
+			LOG_WARN("failed to delete key with fingerprint %s from the keyring: %s",
+					fpr, gpgme_strerror(err));
+		} else {
+			LOG_DEBUG("deleted key with fingerprint %s from the keyring", fpr);
+			keys_deleted++;
+		}
+
+		gpgme_key_release(key);
+	}
+
+	str_array_release(&provided);
+
+	return keys_deleted;
+}
+
 int rebuild_gpg_keyring(struct gc_gpgme_ctx *ctx, const char *keys_dir)
 {
-	gpgme_error_t err;
+	struct keyring_manifest manifest;
+	struct keyring_stamp keyring;
+	struct str_array stale;
 	int errsv = errno;
 
-	LOG_INFO("rebuilding gpg keyring from keys in directory '%s'", keys_dir);
+	keyring_manifest_init(&manifest);
+	str_array_init(&stale);
+
+	get_gpg_keyring_stamp(ctx, &keyring);
+	if (keyring_manifest_load(&manifest)) {
+		LOG_INFO("rebuilding gpg keyring from keys in directory '%s'", keys_dir);
+	} else if (keyring_stamp_cmp(&keyring, &manifest.keyring)) {
+		LOG_INFO("gpg keyring was modified since it was last rebuilt; "
+				"rebuilding from keys in directory '%s'", keys_dir);
+		keyring_manifest_release(&manifest);
+		keyring_manifest_init(&manifest);
+	} else {
+		LOG_INFO("updating gpg keyring from keys in directory '%s'", keys_dir);
+	}
 
 	DIR *dir;
 	dir = opendir(keys_dir);
 	if (!dir)
 		FATAL("unable to open directory '%s'", keys_dir);
 
-	// construct a list of paths to all keys in the keys dir
-	struct str_array key_files;
-	str_array_init(&key_files);
+	struct str_array changed_paths, changed_names;
+	str_array_init(&changed_paths);
+	str_array_init(&changed_names);
+	changed_names.free_data = 1;
+
+	struct strbuf file_path;
+	strbuf_init(&file_path);
 
 	struct dirent *ent;
 	while ((ent = readdir(dir)) != NULL) {
 		struct stat st_key;
+		struct keyring_stamp stamp;
+
 		if (!strcmp(".", ent->d_name) || !strcmp("..", ent->d_name))
 			continue;
 
-		struct strbuf file_path;
-		strbuf_init(&file_path);
+		strbuf_clear(&file_path);
 		strbuf_attach_fmt(&file_path, "%s/%s", keys_dir, ent->d_name);
 
-		LOG_TRACE("reading gpg key file '%s' into gpg data buffer",
-				file_path.buff);
-
-		if (lstat(file_path.buff, &st_key) && errno == ENOENT)
+		if (lstat(file_path.buff, &st_key))
 			FATAL("unable to stat '%s'", file_path.buff);
 
 		if (!S_ISREG(st_key.st_mode))
 			DIE("cannot import key from '%s'; not a regular file",
 					file_path.buff);
 
-		char *key_path = strbuf_detach(&file_path);
-		struct str_array_entry *entry = str_array_insert_nodup(&key_files,
-				key_path, key_files.len);
+		keyring_stamp_from_stat(&stamp, &st_key);
 
-		struct gpgme_data *key;
-		err = gpgme_data_new_from_file(&key, key_path, 1);
-		if (err) {
-			LOG_ERROR("failed to read key file '%s'", key_path);
-			GPG_FATAL("GPGME failed to read key file", err);
+		struct keyring_manifest_entry *entry = keyring_manifest_get(&manifest,
+				ent->d_name);
+		if (entry && keyring_manifest_entry_is_current(&manifest, entry, &stamp)) {
+			LOG_TRACE("gpg key file '%s' is unchanged", file_path.buff);
+			entry->seen = 1;
+			continue;
 		}
 
-		LOG_TRACE("successfully read file '%s' into gpg data buffer", key_path);
+		// keys dropped from a changed key file are stale
+		if (entry) {
+			for (size_t i = 0; i < entry->fingerprints.len; i++)
+				str_array_push(&stale, str_array_get(&entry->fingerprints, i), NULL);
+		}
+
+		struct keyring_stamp *changed_stamp = malloc(sizeof(struct keyring_stamp));
+		if (!changed_stamp)
+			FATAL(MEM_ALLOC_FAILED);
+		*changed_stamp = stamp;
 
-		entry->data = key;
+		str_array_push(&changed_paths, file_path.buff, NULL);
+		str_array_insert(&changed_names, ent->d_name, changed_names.len)->data = changed_stamp;
 	}
 
 	closedir(dir);
+	strbuf_release(&file_path);
 
-	LOG_INFO("importing %d gpg keys from %s", key_files.len, keys_dir);
+	// import every changed key file at once
+	struct str_array fingerprints;
+	str_array_init(&fingerprints);
 
-	int keys_imported = 0;
-	for (size_t index = 0; index < key_files.len; index++) {
-		struct str_array_entry *entry = str_array_get_entry(&key_files, index);
-		err = gpgme_op_import(ctx->gpgme_ctx, entry->data);
-		if (err) {
-			LOG_ERROR("failed to import key '%s'", entry->string);
-			GPG_FATAL("GPGME failed to import key", err);
-		}
+	int *key_counts = calloc(changed_paths.len ? changed_paths.len : 1, sizeof(int));
+	if (!key_counts)
+		FATAL(MEM_ALLOC_FAILED);
+
+	int keys_imported = import_gpg_key_files(ctx, &changed_paths, &fingerprints,
+			key_counts);
+
+	struct str_array file_fingerprints;
+	str_array_init(&file_fingerprints);
 
-		LOG_TRACE("successfully imported gpg key '%s'", entry->string);
+	size_t fpr_index = 0;
+	for (size_t i = 0; i < changed_names.len; i++) {
+		struct str_array_entry *changed = str_array_get_entry(&changed_names, i);
 
-		gpgme_data_release(entry->data);
+		str_array_clear(&file_fingerprints);
+		for (int k = 0; k < key_counts[i]; k++)
+			str_array_push(&file_fingerprints, str_array_get(&fingerprints, fpr_index++), NULL);
+
+		struct keyring_manifest_entry *entry = keyring_manifest_put(&manifest,
+				changed->string, changed->data, &file_fingerprints);
+		entry->seen = 1;
 	}
 
-	str_array_release(&key_files);
+	size_t files_imported = changed_names.len;
+
+	str_array_release(&file_fingerprints);
+	str_array_release(&fingerprints);
+	free(key_counts);
+	str_array_release(&changed_names);
+	str_array_release(&changed_paths);
 
-	LOG_INFO("successfully imported %d gpg keys from %s", key_files.len,
-			keys_dir);
+	// keys from key files that were removed are stale
+	struct str_array removed;
+	struct hashmap_iter iter;
+	struct keyring_manifest_entry *entry;
+
+	str_array_init(&removed);
+	hashmap_iter_init(&manifest.entries, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		if (entry->seen)
+			continue;
+
+		LOG_DEBUG("gpg key file '%s' was removed", entry->name);
+		str_array_push(&removed, entry->name, NULL);
+		for (size_t i = 0; i < entry->fingerprints.len; i++)
+			str_array_push(&stale, str_array_get(&entry->fingerprints, i), NULL);
+	}
+
+	for (size_t i = 0; i < removed.len; i++)
+		keyring_manifest_remove(&manifest, str_array_get(&removed, i));
+
+	if (!files_imported && !removed.len) {
+		LOG_INFO("gpg keyring is up to date with keys in directory '%s'", keys_dir);
+	} else {
+		int keys_deleted = delete_stale_keys(ctx, &manifest, &stale);
+
+		LOG_INFO("imported %d gpg keys from %zu key files and deleted %d stale keys",
+				keys_imported, files_imported, keys_deleted);
+
+		get_gpg_keyring_stamp(ctx, &manifest.keyring);
+		if (keyring_manifest_write(&manifest))
+			LOG_WARN("failed to update the keyring manifest; "
+					"the keyring will be rebuilt next time");
+	}
+
+	str_array_release(&removed);
+	str_array_release(&stale);
+	keyring_manifest_release(&manifest);
 
 	errno = errsv;
 	return keys_imported;
 }
 
-int fetch_gpg_keys(struct gc_gpgme_ctx *ctx, struct gpg_key_list *keys)
+static void push_key_to_list(gpgme_key_t key, void *data)
+{
+	gpg_key_list_push(data, key);
+}
+
+static void push_key_to_set(gpgme_key_t key, void *data)
+{
+	gpg_key_set_add(data, key);
+}
+
+/**
+ * List keys from the keyring under the gpgme context home directory, passing
+ * each key to the `push` function along with `data`. If `secret_only` is
+ * non-zero, only keys for which a secret key is available are listed.
+ *
+ * Returns the number of keys listed.
+ * */
+static int fetch_keys(struct gc_gpgme_ctx *ctx, void (*push)(gpgme_key_t, void *),
+		void *data, int secret_only)
 {
 	gpgme_error_t err;
 	int errsv = errno;
 
-	LOG_INFO("fetching keys from keyring under gpgme context home directory");
+	LOG_INFO("fetching %skeys from keyring under gpgme context home directory",
+			secret_only ? "secret " : "");
 
 	gpgme_key_t key;
-	err = gpgme_op_keylist_start(ctx->gpgme_ctx, NULL, 0);
+	err = gpgme_op_keylist_start(ctx->gpgme_ctx, NULL, secret_only);
 	if (err)
 		GPG_FATAL("failed to begin a gpg key listing operation", err);
 
-	keys->head = NULL;
-	keys->tail = NULL;
-
 	int keys_fetched = 0;
 	while (!(err = gpgme_op_keylist_next(ctx->gpgme_ctx, &key))) {
-		gpg_key_list_push(keys, key);
+		push(key, data);
 		keys_fetched++;
 
 		LOG_TRACE("found GPG key with fingerprint '%s'", key->fpr);
@@ -226,6 +549,32 @@ int fetch_gpg_keys(struct gc_gpgme_ctx *ctx, struct gpg_key_list *keys)
 	return keys_fetched;
 }
 
+int fetch_gpg_keys(struct gc_gpgme_ctx *ctx, struct gpg_key_list *keys)
+{
+	keys->head = NULL;
+	keys->tail = NULL;
+
+	return fetch_keys(ctx, push_key_to_list, keys, 0);
+}
+
+int fetch_gpg_secret_keys(struct gc_gpgme_ctx *ctx, struct gpg_key_list *keys)
+{
+	keys->head = NULL;
+	keys->tail = NULL;
+
+	return fetch_keys(ctx, push_key_to_list, keys, 1);
+}
+
+int fetch_gpg_key_set(struct gc_gpgme_ctx *ctx, struct gpg_key_set *keys)
+{
+	return fetch_keys(ctx, push_key_to_set, keys, 0);
+}
+
+int fetch_gpg_secret_key_set(struct gc_gpgme_ctx *ctx, struct gpg_key_set *keys)
+{
+	return fetch_keys(ctx, push_key_to_set, keys, 1);
+}
+
 void release_gpg_key_list(struct gpg_key_list *keys)
 {
 	struct gpg_key_list_node *node = keys->head;
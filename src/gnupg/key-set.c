@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gnupg/key-set.h"
+#include "utils.h"
+
+static int gpg_key_set_match_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct gpg_key_set_match *a = entry;
+	const struct gpg_key_set_match *b = entry_or_key;
+
+	return strcmp(a->value, keydata ? (const char *) keydata : b->value);
+}
+
+void gpg_key_set_init(struct gpg_key_set *set)
+{
+	set->keys = NULL;
+	set->len = 0;
+	set->alloc = 0;
+	set->indexed = 0;
+	set->borrowed = 0;
+
+	for (size_t i = 0; i < GPG_KEY_FIELD_COUNT; i++)
+		hashmap_init(&set->indexes[i], gpg_key_set_match_cmp, 0);
+
+	arena_init(&set->arena, 0);
+}
+
+static void gpg_key_set_invalidate(struct gpg_key_set *set)
+{
+	if (!set->indexed)
+		return;
+
+	for (size_t i = 0; i < GPG_KEY_FIELD_COUNT; i++) {
+		hashmap_release(&set->indexes[i], 0);
+		hashmap_init(&set->indexes[i], gpg_key_set_match_cmp, 0);
+	}
+
+	arena_reset(&set->arena);
+	set->indexed = 0;
+}
+
+void gpg_key_set_add(struct gpg_key_set *set, gpgme_key_t key)
+{
+	// keep room for the NULL terminator
+	if (set->len + 1 >= set->alloc) {
+		size_t alloc = set->alloc ? set->alloc * 2 : 16;
+		gpgme_key_t *keys = realloc(set->keys, alloc * sizeof(gpgme_key_t));
+		if (!keys)
+			FATAL(MEM_ALLOC_FAILED);
+
+		set->keys = keys;
+		set->alloc = alloc;
+	}
+
+	gpg_key_set_invalidate(set);
+
+	set->keys[set->len++] = key;
+	set->keys[set->len] = NULL;
+}
+
+size_t gpg_key_set_filter(struct gpg_key_set *set,
+		int (*predicate)(gpgme_key_t key, void *data), void *optional_data)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < set->len; i++) {
+		if (predicate(set->keys[i], optional_data))
+			set->keys[kept++] = set->keys[i];
+		else if (!set->borrowed)
+			gpgme_key_release(set->keys[i]);
+	}
+
+	size_t removed = set->len - kept;
+	if (removed) {
+		gpg_key_set_invalidate(set);
+		set->len = kept;
+		set->keys[set->len] = NULL;
+	}
+
+	return removed;
+}
+
+size_t gpg_key_set_retain(struct gpg_key_set *set, const unsigned char *retain)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < set->len; i++) {
+		if (retain[i])
+			set->keys[kept++] = set->keys[i];
+		else if (!set->borrowed)
+			gpgme_key_release(set->keys[i]);
+	}
+
+	size_t removed = set->len - kept;
+	if (removed) {
+		gpg_key_set_invalidate(set);
+		set->len = kept;
+		set->keys[set->len] = NULL;
+	}
+
+	return removed;
+}
+
+static void gpg_key_set_index_value(struct gpg_key_set *set, enum gpg_key_field field,
+		const char *value, size_t pos)
+{
+	if (!value)
+		return;
+
+	struct gpg_key_set_match *match = arena_alloc(&set->arena,
+			sizeof(struct gpg_key_set_match));
+	hashmap_entry_init(match, strhash(value));
+	match->value = value;
+	match->field = field;
+	match->pos = pos;
+
+	hashmap_add(&set->indexes[field], match);
+}
+
+/**
+ * Build the indexes over the keys in the set.
+ * */
+static void gpg_key_set_index(struct gpg_key_set *set)
+{
+	for (size_t i = 0; i < GPG_KEY_FIELD_COUNT; i++) {
+		hashmap_release(&set->indexes[i], 0);
+		hashmap_init(&set->indexes[i], gpg_key_set_match_cmp, i == GPG_KEY_FPR ? set->len : 0);
+	}
+
+	for (size_t pos = 0; pos < set->len; pos++) {
+		gpgme_key_t key = set->keys[pos];
+		gpg_key_set_index_value(set, GPG_KEY_FPR, key->fpr, pos);
+
+		for (gpgme_user_id_t uid = key->uids; uid; uid = uid->next) {
+			gpg_key_set_index_value(set, GPG_KEY_UID, uid->uid, pos);
+			gpg_key_set_index_value(set, GPG_KEY_NAME, uid->name, pos);
+			gpg_key_set_index_value(set, GPG_KEY_EMAIL, uid->email, pos);
+			gpg_key_set_index_value(set, GPG_KEY_COMMENT, uid->comment, pos);
+			gpg_key_set_index_value(set, GPG_KEY_ADDRESS, uid->address, pos);
+		}
+	}
+
+	set->indexed = 1;
+}
+
+const struct gpg_key_set_match *gpg_key_set_lookup(struct gpg_key_set *set,
+		enum gpg_key_field field, const char *value)
+{
+	struct gpg_key_set_match key;
+
+	if (field >= GPG_KEY_FIELD_COUNT)
+		BUG("invalid gpg key field %d", field);
+
+	if (!set->indexed)
+		gpg_key_set_index(set);
+
+	hashmap_entry_init(&key, strhash(value));
+	return hashmap_get(&set->indexes[field], &key, value);
+}
+
+const struct gpg_key_set_match *gpg_key_set_lookup_next(struct gpg_key_set *set,
+		const struct gpg_key_set_match *match)
+{
+	return hashmap_get_next(&set->indexes[match->field], match);
+}
+
+int gpg_key_set_resolve(struct gc_gpgme_ctx *ctx, struct gpg_key_set *set,
+		const char **fingerprints, size_t len)
+{
+	struct hashmap requested;
+	gpgme_error_t err;
+	gpgme_key_t key;
+	int ret = 0;
+
+	if (set->borrowed)
+		BUG("keys cannot be resolved into a borrowed key set");
+	if (!len)
+		return 0;
+
+	gpgme_key_t *keys = calloc(len, sizeof(gpgme_key_t));
+	const char **patterns = calloc(len + 1, sizeof(char *));
+	struct gpg_key_set_match *positions = calloc(len, sizeof(struct gpg_key_set_match));
+	if (!keys || !patterns || !positions)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_init(&requested, gpg_key_set_match_cmp, len);
+	for (size_t i = 0; i < len; i++) {
+		patterns[i] = fingerprints[i];
+
+		hashmap_entry_init(&positions[i], strhash(fingerprints[i]));
+		positions[i].value = fingerprints[i];
+		positions[i].field = GPG_KEY_FPR;
+		positions[i].pos = i;
+		hashmap_add(&requested, &positions[i]);
+	}
+
+	// list only the requested keys, with a single gpg invocation
+	err = gpgme_op_keylist_ext_start(ctx->gpgme_ctx, patterns, 0, 0);
+	if (err)
+		GPG_FATAL("failed to begin a gpg key listing operation", err);
+
+	while (!(err = gpgme_op_keylist_next(ctx->gpgme_ctx, &key))) {
+		struct gpg_key_set_match lookup;
+		hashmap_entry_init(&lookup, strhash(key->fpr));
+
+		const struct gpg_key_set_match *match = hashmap_get(&requested, &lookup, key->fpr);
+		if (!match || keys[match->pos]) {
+			gpgme_key_release(key);
+			continue;
+		}
+
+		keys[match->pos] = key;
+	}
+
+	if (gpg_err_code(err) != GPG_ERR_EOF)
+		GPG_FATAL("failed to retrieve gpg keys from keyring", err);
+
+	for (size_t i = 0; i < len; i++) {
+		if (!keys[i]) {
+			LOG_WARN("unable to find key with fingerprint %s in the keyring",
+					fingerprints[i]);
+			ret = 1;
+		}
+	}
+
+	if (ret) {
+		for (size_t i = 0; i < len; i++) {
+			if (keys[i])
+				gpgme_key_release(keys[i]);
+		}
+	} else {
+		for (size_t i = 0; i < len; i++)
+			gpg_key_set_add(set, keys[i]);
+
+		LOG_DEBUG("resolved %zu keys from gpg", len);
+	}
+
+	hashmap_release(&requested, 0);
+	free(positions);
+	free(patterns);
+	free(keys);
+
+	return ret;
+}
+
+void gpg_key_set_release(struct gpg_key_set *set)
+{
+	for (size_t i = 0; !set->borrowed && i < set->len; i++)
+		gpgme_key_release(set->keys[i]);
+
+	for (size_t i = 0; i < GPG_KEY_FIELD_COUNT; i++)
+		hashmap_release(&set->indexes[i], 0);
+
+	arena_release(&set->arena);
+	free(set->keys);
+
+	set->keys = NULL;
+	set->len = 0;
+	set->alloc = 0;
+	set->indexed = 0;
+	set->borrowed = 0;
+}
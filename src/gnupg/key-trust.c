@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "gnupg/key-trust.h"
@@ -7,7 +8,39 @@
 #include "fs-utils.h"
 #include "utils.h"
 
-ssize_t read_trust_list(struct str_array *trusted_keys)
+struct trust_list_entry {
+	struct hashmap_entry ent;
+	char fingerprint[];
+};
+
+static int trust_list_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct trust_list_entry *a = entry;
+	const struct trust_list_entry *b = entry_or_key;
+
+	return strcmp(a->fingerprint, keydata ? (const char *) keydata : b->fingerprint);
+}
+
+void trust_list_init(struct trust_list *trusted_keys)
+{
+	hashmap_init(&trusted_keys->fingerprints, trust_list_entry_cmp, 0);
+}
+
+static void trust_list_add(struct trust_list *trusted_keys, const char *fpr, size_t len)
+{
+	struct trust_list_entry *entry = malloc(sizeof(struct trust_list_entry) + len + 1);
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	memcpy(entry->fingerprint, fpr, len);
+	entry->fingerprint[len] = 0;
+	hashmap_entry_init(entry, strhash(entry->fingerprint));
+
+	free(hashmap_put(&trusted_keys->fingerprints, entry));
+}
+
+ssize_t read_trust_list(struct trust_list *trusted_keys)
 {
 	struct strbuf trusted_keys_file_path;
 	strbuf_init(&trusted_keys_file_path);
@@ -24,24 +57,40 @@ ssize_t read_trust_list(struct str_array *trusted_keys)
 		return -1;
 
 	struct strbuf file_contents;
-	struct str_array fingerprints;
-
 	strbuf_init(&file_contents);
-	str_array_init(&fingerprints);
 
 	strbuf_attach_fd(&file_contents, fd);
 	close(fd);
 
-	size_t line_count = strbuf_split(&file_contents, "\n", &fingerprints);
-	strbuf_release(&file_contents);
+	ssize_t line_count = 0;
+	const char *line = file_contents.buff;
+	const char *end = file_contents.buff + file_contents.len;
+	while (line < end) {
+		const char *lf = memchr(line, '\n', end - line);
+		if (!lf)
+			lf = end;
 
-	for (size_t i = 0; i < fingerprints.len; i++) {
-		const char *fpr = str_array_get(&fingerprints, i);
-		if (strlen(fpr))
-			str_array_push(trusted_keys, fpr, NULL);
+		if (lf > line)
+			trust_list_add(trusted_keys, line, lf - line);
+
+		line_count++;
+		line = lf + 1;
 	}
 
-	str_array_release(&fingerprints);
+	strbuf_release(&file_contents);
+
+	return line_count;
+}
+
+int trust_list_contains(const struct trust_list *trusted_keys, const char *fingerprint)
+{
+	struct trust_list_entry key;
+	hashmap_entry_init(&key, strhash(fingerprint));
 
-	return (ssize_t) line_count;
+	return hashmap_get(&trusted_keys->fingerprints, &key, fingerprint) != NULL;
+}
+
+void trust_list_release(struct trust_list *trusted_keys)
+{
+	hashmap_release(&trusted_keys->fingerprints, 1);
 }
@@ -0,0 +1,531 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gnupg/pgp-packet.h"
+#include "gnupg/key-manager.h"
+#include "utils.h"
+
+#define ARMOR_BEGIN_PREFIX "-----BEGIN PGP "
+#define ARMOR_BEGIN_MESSAGE "-----BEGIN PGP MESSAGE-----"
+#define ARMOR_BEGIN_PUBLIC_KEY "-----BEGIN PGP PUBLIC KEY BLOCK-----"
+#define ARMOR_END_PREFIX "-----END PGP "
+
+#define PGP_TAG_PKESK 1
+#define PGP_TAG_SKESK 3
+#define PGP_TAG_SECRET_KEY 5
+#define PGP_TAG_PUBLIC_KEY 6
+#define PGP_TAG_SED 9
+#define PGP_TAG_MARKER 10
+#define PGP_TAG_SEIPD 18
+#define PGP_TAG_AEAD 20
+
+/**
+ * Incremental base64 decoder over the body of an armored message. Bytes are
+ * only decoded as they are read, since only the first few packets of a message
+ * are of interest. Binary messages are read through the same reader, with
+ * `binary` set, in which case bytes are read as they are.
+ * */
+struct armor_reader {
+	const char *current;
+	const char *end;
+	uint32_t bits;
+	int bits_len;
+	int binary;
+};
+
+static int base64_value(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+
+	return -1;
+}
+
+/**
+ * Read a single byte from the armored message.
+ *
+ * Returns zero if successful, and non-zero if the end of the armored data was
+ * reached or the data is malformed.
+ * */
+static int armor_read_byte(struct armor_reader *reader, uint8_t *byte)
+{
+	if (reader->binary) {
+		if (reader->current >= reader->end)
+			return 1;
+
+		*byte = (uint8_t) *reader->current++;
+		return 0;
+	}
+
+	while (reader->bits_len < 8) {
+		if (reader->current >= reader->end)
+			return 1;
+
+		char c = *reader->current++;
+		if (c == '\n' || c == '\r' || c == ' ' || c == '\t')
+			continue;
+
+		int value = base64_value(c);
+		if (value < 0)
+			return 1;
+
+		reader->bits = (reader->bits << 6) | (uint32_t) value;
+		reader->bits_len += 6;
+	}
+
+	reader->bits_len -= 8;
+	*byte = (uint8_t) (reader->bits >> reader->bits_len);
+	reader->bits &= (1u << reader->bits_len) - 1;
+	return 0;
+}
+
+static int armor_read_bytes(struct armor_reader *reader, uint8_t *bytes, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (armor_read_byte(reader, bytes ? &bytes[i] : &(uint8_t){ 0 }))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int armor_read_be(struct armor_reader *reader, size_t bytes, uint64_t *value)
+{
+	uint8_t byte;
+	*value = 0;
+	for (size_t i = 0; i < bytes; i++) {
+		if (armor_read_byte(reader, &byte))
+			return 1;
+
+		*value = (*value << 8) | byte;
+	}
+
+	return 0;
+}
+
+/**
+ * Locate the start of a line beginning with `prefix`.
+ * */
+static const char *find_line(const char *data, const char *end, const char *prefix)
+{
+	size_t prefix_len = strlen(prefix);
+	const char *line = data;
+
+	while (line && (size_t) (end - line) >= prefix_len) {
+		if (!memcmp(line, prefix, prefix_len))
+			return line;
+
+		line = memchr(line, '\n', end - line);
+		if (line)
+			line++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Position the reader at the start of the base64 data of the armored message
+ * beginning at `begin`, skipping the armor header lines.
+ *
+ * Returns zero if successful, and non-zero if the armor is malformed.
+ * */
+static int armor_reader_init(struct armor_reader *reader, const char *begin,
+		const char *end)
+{
+	const char *line = memchr(begin, '\n', end - begin);
+	if (!line)
+		return 1;
+
+	line++;
+
+	// skip armor headers (e.g. 'Version: ...'), up to the blank line
+	const char *lf = memchr(line, '\n', end - line);
+	if (lf && memchr(line, ':', lf - line)) {
+		while (lf) {
+			const char *c = line;
+			while (c < lf && (*c == ' ' || *c == '\t' || *c == '\r'))
+				c++;
+
+			line = lf + 1;
+			if (c == lf)
+				break;
+
+			lf = memchr(line, '\n', end - line);
+		}
+
+		if (!lf)
+			return 1;
+	}
+
+	reader->current = line;
+	reader->end = end;
+	reader->bits = 0;
+	reader->bits_len = 0;
+	reader->binary = 0;
+	return 0;
+}
+
+/**
+ * Read an OpenPGP packet header. Packets with a partial or indeterminate body
+ * length are flagged with `indeterminate`, and their `packet_len` is zero.
+ *
+ * Returns zero if successful, and non-zero if the end of the armored data was
+ * reached or the header is malformed.
+ * */
+static int read_packet_header(struct armor_reader *reader, uint64_t *tag,
+		uint64_t *packet_len, int *indeterminate)
+{
+	uint64_t ctb;
+
+	if (armor_read_be(reader, 1, &ctb) || !(ctb & 0x80))
+		return 1;
+
+	*indeterminate = 0;
+	if (ctb & 0x40) {
+		// new format packet header
+		uint64_t octet;
+		*tag = ctb & 0x3f;
+		if (armor_read_be(reader, 1, &octet))
+			return 1;
+
+		if (octet < 192) {
+			*packet_len = octet;
+		} else if (octet < 224) {
+			uint64_t second;
+			if (armor_read_be(reader, 1, &second))
+				return 1;
+			*packet_len = ((octet - 192) << 8) + second + 192;
+		} else if (octet == 255) {
+			if (armor_read_be(reader, 4, packet_len))
+				return 1;
+		} else {
+			// partial body length, only valid for data packets
+			*indeterminate = 1;
+			*packet_len = 0;
+		}
+	} else {
+		// old format packet header
+		*tag = (ctb >> 2) & 0x0f;
+		switch (ctb & 0x03) {
+			case 0:
+			case 1:
+			case 2:
+				if (armor_read_be(reader, (size_t) 1 << (ctb & 0x03), packet_len))
+					return 1;
+				break;
+			default:
+				*indeterminate = 1;
+				*packet_len = 0;
+		}
+	}
+
+	return 0;
+}
+
+static void pgp_recipients_add(struct pgp_recipients *recipients, uint64_t key_id)
+{
+	if (!key_id) {
+		recipients->wildcard = 1;
+		return;
+	}
+
+	if (recipients->len == recipients->alloc) {
+		recipients->alloc = recipients->alloc ? recipients->alloc * 2 : 4;
+		recipients->key_ids = (uint64_t *) realloc(recipients->key_ids,
+				recipients->alloc * sizeof(uint64_t));
+		if (!recipients->key_ids)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	recipients->key_ids[recipients->len++] = key_id;
+}
+
+/**
+ * Read the recipient from the body of a PKESK packet of length `len`.
+ *
+ * Returns the number of bytes of the packet body consumed, or a negative value
+ * if the packet could not be read.
+ * */
+static long read_pkesk_recipient(struct armor_reader *reader, uint64_t len,
+		struct pgp_recipients *recipients)
+{
+	uint64_t version, key_id;
+
+	if (len < 1 || armor_read_be(reader, 1, &version))
+		return -1;
+
+	if (version == 3) {
+		if (len < 9 || armor_read_be(reader, 8, &key_id))
+			return -1;
+
+		pgp_recipients_add(recipients, key_id);
+		return 9;
+	}
+
+	if (version == 6) {
+		uint64_t fpr_len, key_version;
+		uint8_t fpr[32];
+
+		if (len < 2 || armor_read_be(reader, 1, &fpr_len))
+			return -1;
+
+		// anonymous recipient
+		if (!fpr_len) {
+			recipients->wildcard = 1;
+			return 2;
+		}
+
+		if (fpr_len < 2 || len < 2 + fpr_len || armor_read_be(reader, 1, &key_version))
+			return -1;
+
+		size_t fpr_bytes = fpr_len - 1;
+		if (fpr_bytes > sizeof(fpr) || armor_read_bytes(reader, fpr, fpr_bytes))
+			return -1;
+
+		// v4 key ids are the low 64 bits of the fingerprint, v6 the high 64 bits
+		const uint8_t *id_bytes = NULL;
+		if (key_version == 4 && fpr_bytes == 20)
+			id_bytes = fpr + 12;
+		else if (key_version == 6 && fpr_bytes == 32)
+			id_bytes = fpr;
+
+		if (!id_bytes) {
+			recipients->wildcard = 1;
+		} else {
+			key_id = 0;
+			for (int i = 0; i < 8; i++)
+				key_id = (key_id << 8) | id_bytes[i];
+			pgp_recipients_add(recipients, key_id);
+		}
+
+		return (long) (2 + fpr_len);
+	}
+
+	// unknown version; we can't tell who the recipient is
+	recipients->wildcard = 1;
+	return 1;
+}
+
+void pgp_recipients_init(struct pgp_recipients *recipients)
+{
+	recipients->key_ids = NULL;
+	recipients->len = 0;
+	recipients->alloc = 0;
+	recipients->wildcard = 0;
+}
+
+void pgp_recipients_release(struct pgp_recipients *recipients)
+{
+	free(recipients->key_ids);
+	pgp_recipients_init(recipients);
+}
+
+/**
+ * Read the session key packets at the start of a message, appending the key ids
+ * of its recipients to `recipients`.
+ * */
+static enum pgp_scan_result scan_message_packets(struct armor_reader *reader,
+		struct pgp_recipients *recipients)
+{
+	int session_key_packets = 0;
+	while (1) {
+		uint64_t tag, packet_len;
+		int indeterminate;
+
+		if (read_packet_header(reader, &tag, &packet_len, &indeterminate))
+			return PGP_SCAN_UNKNOWN;
+
+		switch (tag) {
+			case PGP_TAG_SED:
+			case PGP_TAG_SEIPD:
+			case PGP_TAG_AEAD:
+				// reached the encrypted data; no more recipients follow
+				return session_key_packets ? PGP_SCAN_ENCRYPTED : PGP_SCAN_UNKNOWN;
+			case PGP_TAG_PKESK: {
+				if (indeterminate)
+					return PGP_SCAN_UNKNOWN;
+
+				long consumed = read_pkesk_recipient(reader, packet_len, recipients);
+				if (consumed < 0 || armor_read_bytes(reader, NULL, packet_len - consumed))
+					return PGP_SCAN_UNKNOWN;
+
+				session_key_packets++;
+				break;
+			}
+			case PGP_TAG_SKESK:
+				// encrypted with a passphrase, which we can't know in advance
+				recipients->wildcard = 1;
+				session_key_packets++;
+				/* fall through */
+			case PGP_TAG_MARKER:
+				if (indeterminate || armor_read_bytes(reader, NULL, packet_len))
+					return PGP_SCAN_UNKNOWN;
+				break;
+			default:
+				// signed or compressed data, for instance; leave it to gpg
+				return PGP_SCAN_UNKNOWN;
+		}
+	}
+}
+
+enum pgp_scan_result pgp_scan_message(const char *data, size_t len,
+		struct pgp_recipients *recipients)
+{
+	const char *end = data + len;
+	struct armor_reader reader;
+
+	// gpg ignores anything that isn't armored
+	const char *begin = find_line(data, end, ARMOR_BEGIN_PREFIX);
+	if (!begin)
+		return PGP_SCAN_PLAINTEXT;
+
+	if (begin != find_line(data, end, ARMOR_BEGIN_MESSAGE))
+		return PGP_SCAN_UNKNOWN;
+
+	if (armor_reader_init(&reader, begin, end))
+		return PGP_SCAN_UNKNOWN;
+
+	return scan_message_packets(&reader, recipients);
+}
+
+enum pgp_scan_result pgp_scan_binary_message(const char *data, size_t len,
+		struct pgp_recipients *recipients)
+{
+	struct armor_reader reader = { data, data + len, 0, 0, 1 };
+
+	return scan_message_packets(&reader, recipients);
+}
+
+int pgp_count_public_keys(const char *data, size_t len)
+{
+	const char *end = data + len;
+	const char *begin = data;
+	int keys = 0;
+
+	if (!find_line(data, end, ARMOR_BEGIN_PREFIX))
+		return -1;
+
+	while ((begin = find_line(begin, end, ARMOR_BEGIN_PREFIX))) {
+		struct armor_reader reader;
+
+		if (begin != find_line(begin, end, ARMOR_BEGIN_PUBLIC_KEY))
+			return -1;
+
+		const char *block_end = find_line(begin, end, ARMOR_END_PREFIX);
+		if (!block_end || armor_reader_init(&reader, begin, block_end))
+			return -1;
+
+		// the block ends where the base64 data (and its padding) ends
+		uint64_t tag, packet_len;
+		int indeterminate;
+		while (!read_packet_header(&reader, &tag, &packet_len, &indeterminate)) {
+			if (indeterminate || tag == PGP_TAG_SECRET_KEY)
+				return -1;
+			if (tag == PGP_TAG_PUBLIC_KEY)
+				keys++;
+
+			if (armor_read_bytes(&reader, NULL, packet_len))
+				return -1;
+		}
+
+		begin = block_end + strlen(ARMOR_END_PREFIX);
+	}
+
+	return keys;
+}
+
+void pgp_key_id_set_init(struct pgp_key_id_set *set)
+{
+	set->key_ids = NULL;
+	set->len = 0;
+	set->alloc = 0;
+}
+
+void pgp_key_id_set_release(struct pgp_key_id_set *set)
+{
+	free(set->key_ids);
+	pgp_key_id_set_init(set);
+}
+
+static int key_id_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+void pgp_key_id_set_add(struct pgp_key_id_set *set, uint64_t key_id)
+{
+	if (bsearch(&key_id, set->key_ids, set->len, sizeof(uint64_t), key_id_cmp))
+		return;
+
+	if (set->len == set->alloc) {
+		set->alloc = set->alloc ? set->alloc * 2 : 8;
+		set->key_ids = (uint64_t *) realloc(set->key_ids, set->alloc * sizeof(uint64_t));
+		if (!set->key_ids)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	// keep the set sorted; there are only ever a handful of secret keys
+	size_t i = set->len;
+	while (i > 0 && set->key_ids[i - 1] > key_id) {
+		set->key_ids[i] = set->key_ids[i - 1];
+		i--;
+	}
+
+	set->key_ids[i] = key_id;
+	set->len++;
+}
+
+size_t pgp_key_id_set_load_secret_keys(struct pgp_key_id_set *set,
+		struct gc_gpgme_ctx *ctx)
+{
+	struct gpg_key_list keys;
+	size_t loaded = 0;
+
+	fetch_gpg_secret_keys(ctx, &keys);
+
+	for (struct gpg_key_list_node *node = keys.head; node; node = node->next) {
+		for (gpgme_subkey_t subkey = node->key->subkeys; subkey; subkey = subkey->next) {
+			if (!subkey->keyid)
+				continue;
+
+			char *tailptr = NULL;
+			uint64_t key_id = strtoull(subkey->keyid, &tailptr, 16);
+			if (!tailptr || *tailptr || !key_id)
+				continue;
+
+			pgp_key_id_set_add(set, key_id);
+			loaded++;
+		}
+	}
+
+	release_gpg_key_list(&keys);
+
+	LOG_DEBUG("loaded %zu secret key ids", loaded);
+	return loaded;
+}
+
+int pgp_key_id_set_can_decrypt(struct pgp_key_id_set *set,
+		const struct pgp_recipients *recipients)
+{
+	if (recipients->wildcard)
+		return 1;
+
+	for (size_t i = 0; i < recipients->len; i++) {
+		if (bsearch(&recipients->key_ids[i], set->key_ids, set->len,
+				sizeof(uint64_t), key_id_cmp))
+			return 1;
+	}
+
+	return 0;
+}
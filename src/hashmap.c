@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "hashmap.h"
+#include "utils.h"
+
+#define FNV32_BASE ((unsigned int) 0x811c9dc5)
+#define FNV32_PRIME ((unsigned int) 0x01000193)
+
+#define HASHMAP_INITIAL_SIZE 64
+#define HASHMAP_LOAD_FACTOR 80
+
+unsigned int strhash(const char *str)
+{
+	unsigned int c, hash = FNV32_BASE;
+	while ((c = (unsigned char) *str++))
+		hash = (hash * FNV32_PRIME) ^ c;
+
+	return hash;
+}
+
+unsigned int strihash(const char *str)
+{
+	unsigned int c, hash = FNV32_BASE;
+	while ((c = (unsigned char) *str++))
+		hash = (hash * FNV32_PRIME) ^ (unsigned int) tolower(c);
+
+	return hash;
+}
+
+unsigned int memhash(const void *buf, size_t len)
+{
+	unsigned int hash = FNV32_BASE;
+	const unsigned char *ucbuf = (const unsigned char *) buf;
+	while (len--)
+		hash = (hash * FNV32_PRIME) ^ *ucbuf++;
+
+	return hash;
+}
+
+/**
+ * Allocate a new (empty) bucket table of the given size.
+ * */
+static void alloc_table(struct hashmap *map, size_t size)
+{
+	map->tablesize = size;
+	map->table = (struct hashmap_entry **) calloc(size, sizeof(struct hashmap_entry *));
+	if (!map->table)
+		FATAL(MEM_ALLOC_FAILED);
+}
+
+static inline size_t bucket(const struct hashmap *map, unsigned int hash)
+{
+	return hash & (map->tablesize - 1);
+}
+
+/**
+ * Grow the bucket table to `newsize` (a power of two), redistributing all
+ * existing entries.
+ * */
+static void rehash(struct hashmap *map, size_t newsize)
+{
+	struct hashmap_entry **oldtable = map->table;
+	size_t oldsize = map->tablesize;
+
+	alloc_table(map, newsize);
+	for (size_t i = 0; i < oldsize; i++) {
+		struct hashmap_entry *e = oldtable[i];
+		while (e) {
+			struct hashmap_entry *next = e->next;
+			size_t b = bucket(map, e->hash);
+			e->next = map->table[b];
+			map->table[b] = e;
+			e = next;
+		}
+	}
+
+	free(oldtable);
+}
+
+static inline int entry_equals(const struct hashmap *map,
+		const struct hashmap_entry *e1, const struct hashmap_entry *e2,
+		const void *keydata)
+{
+	return (e1 == e2) || (e1->hash == e2->hash && !map->cmpfn(e1, e2, keydata));
+}
+
+/**
+ * Find the pointer to the bucket slot (or `next` field) referencing an entry
+ * equal to `key`. If no such entry exists, points to the terminating NULL.
+ * */
+static struct hashmap_entry **find_entry_ptr(const struct hashmap *map,
+		const struct hashmap_entry *key, const void *keydata)
+{
+	struct hashmap_entry **e = &map->table[bucket(map, key->hash)];
+	while (*e && !entry_equals(map, *e, key, keydata))
+		e = &(*e)->next;
+
+	return e;
+}
+
+void hashmap_init(struct hashmap *map, hashmap_cmp_fn cmpfn, size_t initial_size)
+{
+	size_t size = HASHMAP_INITIAL_SIZE;
+
+	map->cmpfn = cmpfn;
+	map->size = 0;
+
+	// size the table such that initial_size entries fit under the load factor
+	initial_size = initial_size * 100 / HASHMAP_LOAD_FACTOR;
+	while (initial_size > size)
+		size <<= 1;
+
+	alloc_table(map, size);
+}
+
+void hashmap_release(struct hashmap *map, int free_entries)
+{
+	if (!map || !map->table)
+		return;
+
+	if (free_entries) {
+		struct hashmap_iter iter;
+		struct hashmap_entry *e;
+
+		hashmap_iter_init(map, &iter);
+		while ((e = hashmap_iter_next(&iter)))
+			free(e);
+	}
+
+	free(map->table);
+	map->table = NULL;
+	map->tablesize = 0;
+	map->size = 0;
+}
+
+void hashmap_entry_init(void *entry, unsigned int hash)
+{
+	struct hashmap_entry *e = (struct hashmap_entry *) entry;
+	e->hash = hash;
+	e->next = NULL;
+}
+
+void *hashmap_get(const struct hashmap *map, const void *key, const void *keydata)
+{
+	return *find_entry_ptr(map, key, keydata);
+}
+
+void *hashmap_get_next(const struct hashmap *map, const void *entry)
+{
+	struct hashmap_entry *e = ((struct hashmap_entry *) entry)->next;
+	for (; e; e = e->next) {
+		if (entry_equals(map, entry, e, NULL))
+			return e;
+	}
+
+	return NULL;
+}
+
+void hashmap_add(struct hashmap *map, void *entry)
+{
+	size_t b = bucket(map, ((struct hashmap_entry *) entry)->hash);
+
+	((struct hashmap_entry *) entry)->next = map->table[b];
+	map->table[b] = entry;
+
+	map->size++;
+	if (map->size * 100 > map->tablesize * HASHMAP_LOAD_FACTOR)
+		rehash(map, map->tablesize << 1);
+}
+
+void *hashmap_put(struct hashmap *map, void *entry)
+{
+	struct hashmap_entry *old = hashmap_remove(map, entry, NULL);
+	hashmap_add(map, entry);
+
+	return old;
+}
+
+void *hashmap_remove(struct hashmap *map, const void *key, const void *keydata)
+{
+	struct hashmap_entry *old;
+	struct hashmap_entry **e = find_entry_ptr(map, key, keydata);
+	if (!*e)
+		return NULL;
+
+	old = *e;
+	*e = old->next;
+	old->next = NULL;
+
+	map->size--;
+	return old;
+}
+
+void hashmap_iter_init(struct hashmap *map, struct hashmap_iter *iter)
+{
+	iter->map = map;
+	iter->tablepos = 0;
+	iter->next = NULL;
+}
+
+void *hashmap_iter_next(struct hashmap_iter *iter)
+{
+	struct hashmap_entry *current = iter->next;
+	while (1) {
+		if (current) {
+			iter->next = current->next;
+			return current;
+		}
+
+		if (iter->tablepos >= iter->map->tablesize)
+			return NULL;
+
+		current = iter->map->table[iter->tablepos++];
+	}
+}
@@ -1,22 +1,37 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <assert.h>
 
 #include "run-command.h"
 #include "fs-utils.h"
+#include "hashmap.h"
 #include "utils.h"
 
 #define READ 0
 #define WRITE 1
 #define BUFF_LEN 1024
+#define PARALLEL_READ_LEN 16384
+
+// posix_spawn() can only change the working directory of the child with
+// posix_spawn_file_actions_addchdir_np(); without it, such commands are forked
+#if (defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))) || defined(__APPLE__)
+#define HAVE_SPAWN_CHDIR 1
+#else
+#define HAVE_SPAWN_CHDIR 0
+#endif
 
 extern char **environ;
 
-static void merge_env(struct str_array *deltaenv, struct str_array *result);
+static const char *resolve_executable(const char *name);
+static char **merge_env(struct str_array *deltaenv);
 static NORETURN void child_exit_routine(int status);
 
 static int child_failure_fd = -1;
@@ -66,7 +81,12 @@ int run_command(struct child_process_def *cmd)
 	return finish_command(cmd);
 }
 
-int capture_command(struct child_process_def *cmd, struct strbuf *buffer)
+/**
+ * Run a command and capture its stdout to `buffer` with the given read
+ * function.
+ * */
+static int capture_command_with(struct child_process_def *cmd, struct strbuf *buffer,
+		void (*attach_fd)(struct strbuf *, int))
 {
 	if (cmd->pid != -1)
 		BUG("child_process_def must have a pid of -1; either the pid was modified "
@@ -86,54 +106,161 @@ int capture_command(struct child_process_def *cmd, struct strbuf *buffer)
 	start_command(cmd);
 	close(cmd->out_fd[WRITE]);
 
-	strbuf_attach_fd(buffer, cmd->out_fd[READ]);
+	attach_fd(buffer, cmd->out_fd[READ]);
 	close(cmd->out_fd[READ]);
 
 	return finish_command(cmd);
 }
 
-int start_command(struct child_process_def *cmd)
+int capture_command(struct child_process_def *cmd, struct strbuf *buffer)
 {
-	if (cmd->pid != -1)
-		BUG("child_process_def must have a pid of -1; either the pid was modified "
-				"or the run-command api was not used correctly");
-	if (cmd->git_cmd && cmd->executable)
-		BUG("ambiguous child_process_def; git_cmd is true but executable is not NULL");
-	if (!cmd->git_cmd && !cmd->executable)
-		BUG("unexpected child_process_def without executable specified.");
+	return capture_command_with(cmd, buffer, strbuf_attach_fd);
+}
 
-	char *executable_path = NULL;
-	if (cmd->git_cmd || !strchr(cmd->executable, '/')) {
-		executable_path = find_in_path(cmd->git_cmd ? "git" : cmd->executable);
-		if (!executable_path)
-			FATAL("executable '%s' could not be found in PATH, or is not executable.", cmd->executable);
-	} else {
-		executable_path = strdup(cmd->executable);
-		if (!executable_path)
-			FATAL(MEM_ALLOC_FAILED);
+int capture_command_bytes(struct child_process_def *cmd, struct strbuf *buffer)
+{
+	return capture_command_with(cmd, buffer, strbuf_attach_fd_bytes);
+}
+
+/**
+ * Configure the standard streams of the child process as file actions for
+ * posix_spawn(), as described by `cmd->std_fd_info`.
+ * */
+static void std_fd_file_actions(struct child_process_def *cmd,
+		posix_spawn_file_actions_t *actions)
+{
+	int err = 0;
+
+	if (cmd->dir && (err = posix_spawn_file_actions_addchdir_np(actions, cmd->dir)))
+		FATAL("unable to prepare to chdir to '%s'", cmd->dir);
+
+	/* Configure stdin */
+	switch (cmd->std_fd_info & 0x00f) {
+		case STDIN_INHERITED:
+			break;
+		case STDIN_PROVISIONED:
+			err = posix_spawn_file_actions_addclose(actions, cmd->in_fd[WRITE]);
+			if (!err)
+				err = posix_spawn_file_actions_adddup2(actions, cmd->in_fd[READ], STDIN_FILENO);
+			if (!err && cmd->in_fd[READ] != STDIN_FILENO)
+				err = posix_spawn_file_actions_addclose(actions, cmd->in_fd[READ]);
+			break;
+		case STDIN_NULL:
+			err = posix_spawn_file_actions_addopen(actions, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+			break;
+		default:
+			BUG("unexpected stream configuration for stdin (%#x).", cmd->std_fd_info & 0x00f);
 	}
 
-	if (cmd->args.arr.len) {
-		char *args_literal = argv_array_collapse(&cmd->args);
-		LOG_TRACE("executing process '%s %s'", executable_path, args_literal);
-		free(args_literal);
-	} else {
-		LOG_TRACE("executing process '%s'", executable_path);
+	/* Configure stdout */
+	switch (cmd->std_fd_info & 0x0f0) {
+		case STDOUT_INHERITED:
+			break;
+		case STDOUT_PROVISIONED:
+			err = err ? err : posix_spawn_file_actions_addclose(actions, cmd->out_fd[READ]);
+			if (!err)
+				err = posix_spawn_file_actions_adddup2(actions, cmd->out_fd[WRITE], STDOUT_FILENO);
+			if (!err && cmd->out_fd[WRITE] != STDOUT_FILENO)
+				err = posix_spawn_file_actions_addclose(actions, cmd->out_fd[WRITE]);
+			break;
+		case STDOUT_NULL:
+			err = err ? err : posix_spawn_file_actions_addopen(actions, STDOUT_FILENO, "/dev/null", O_RDWR, 0);
+			break;
+		default:
+			BUG("unexpected stream configuration for stdout (%#x).", cmd->std_fd_info & 0x0f0);
 	}
 
-	//args and env are duplicated so child_process_def is not modified.
-	struct argv_array args;
-	argv_array_init(&args);
-	for (size_t i = 0; i < cmd->args.arr.len; i++) {
-		char *string_to_copy = str_array_get((struct str_array *)&cmd->args, i);
-		argv_array_push(&args, string_to_copy, NULL);
+	/* Configure stderr */
+	switch (cmd->std_fd_info & 0xf00) {
+		case STDERR_INHERITED:
+			break;
+		case STDERR_PROVISIONED:
+			err = err ? err : posix_spawn_file_actions_addclose(actions, cmd->err_fd[READ]);
+			if (!err)
+				err = posix_spawn_file_actions_adddup2(actions, cmd->err_fd[WRITE], STDERR_FILENO);
+			if (!err && cmd->err_fd[WRITE] != STDERR_FILENO)
+				err = posix_spawn_file_actions_addclose(actions, cmd->err_fd[WRITE]);
+			break;
+		case STDERR_NULL:
+			err = err ? err : posix_spawn_file_actions_addopen(actions, STDERR_FILENO, "/dev/null", O_RDWR, 0);
+			break;
+		default:
+			BUG("unexpected stream configuration for stderr (%#x).", cmd->std_fd_info & 0xf00);
+	}
+
+	if (err)
+		FATAL("failed to configure the standard streams of the child process.");
+}
+
+/**
+ * Create the child process with posix_spawn(). Unlike fork(), posix_spawn()
+ * doesn't copy the address space of the current process (glibc uses vfork
+ * semantics), and reports failures to execute the command directly.
+ *
+ * `args` must begin with the path of the executable.
+ * */
+static void spawn_command(struct child_process_def *cmd, struct argv_array *args,
+		char **envp)
+{
+	posix_spawn_file_actions_t actions;
+	if (posix_spawn_file_actions_init(&actions))
+		FATAL(MEM_ALLOC_FAILED);
+
+	std_fd_file_actions(cmd, &actions);
+
+	// the arguments are borrowed from `args`, which remains intact
+	char **argv = malloc((args->arr.len + 1) * sizeof(char *));
+	if (!argv)
+		FATAL(MEM_ALLOC_FAILED);
+	for (size_t i = 0; i < args->arr.len; i++)
+		argv[i] = args->arr.entries[i].string;
+	argv[args->arr.len] = NULL;
+
+	int err = ENOEXEC;
+	if (!cmd->use_shell)
+		err = posix_spawn(&cmd->pid, argv[0], &actions, NULL, argv, envp);
+	free(argv);
+
+	/*
+	 * In the event the executable could not be executed directly (ENOEXEC),
+	 * try to interpret the command using 'sh -c'.
+	 */
+	if (err == ENOEXEC) {
+		if (!cmd->use_shell)
+			LOG_WARN("posix_spawn() failed to execute '%s'; attempting to run through 'sh -c'", cmd->executable);
+
+		char *collapsed_args = argv_array_collapse(args);
+
+		struct argv_array shell_args;
+		argv_array_init(&shell_args);
+		argv_array_push(&shell_args, "/bin/sh", "-c", collapsed_args, NULL);
+		argv = argv_array_detach(&shell_args, NULL);
+
+		err = posix_spawn(&cmd->pid, argv[0], &actions, NULL, argv, envp);
+
+		for (char **arg = argv; *arg; arg++)
+			free(*arg);
+		free(argv);
+		free(collapsed_args);
 	}
 
-	struct str_array env;
-	str_array_init(&env);
+	posix_spawn_file_actions_destroy(&actions);
 
-	merge_env(&cmd->env, &env);
+	if (err) {
+		errno = err;
+		FATAL("failed to execute '%s'.", str_array_get(&args->arr, 0));
+	}
+}
 
+/**
+ * Create the child process with fork(), and configure it before execve(). Used
+ * when the child process must change directories but posix_spawn() can't.
+ *
+ * `args` must begin with the path of the executable.
+ * */
+static void fork_command(struct child_process_def *cmd, struct argv_array *args,
+		char **envp)
+{
 	/*
 	 * Setup pipe used to notify the parent event if the child process
 	 * failed before execve() was called.
@@ -211,38 +338,27 @@ int start_command(struct child_process_def *cmd)
 				BUG("unexpected stream configuration for stderr (%#x).", cmd->std_fd_info & 0xf00);
 		}
 
-		/*
-		 * Prepare arguments. argv[0] must be the path of the executable,
-		 * and argv must be NULL terminated.
-		 */
-		argv_array_prepend(&args, executable_path, NULL);
-
-		/*
-		 * Prepare execve() environment. argp must be NULL terminated.
-		 */
-		char **argp = str_array_detach(&env, NULL);
-
 		/*
 		 * Attempt to exec using the command and arguments. In the event execve()
 		 * failed with ENOEXEC, try to interpret the command using 'sh -c'.
 		 */
 		if (!cmd->use_shell) {
-			char **argv = argv_array_detach(&args, NULL);
-			execve(argv[0], argv, argp);
+			char **argv = argv_array_detach(args, NULL);
+			execve(argv[0], argv, envp);
 		}
 
 		if (cmd->use_shell || errno == ENOEXEC) {
 			if (errno == ENOEXEC)
 				LOG_WARN("execve() failed to execute '%s'; attempting to run through 'sh -c'", cmd->executable);
 
-			char *collapsed_args = argv_array_collapse(&args);
-			argv_array_release(&args);
+			char *collapsed_args = argv_array_collapse(args);
+			argv_array_release(args);
 
-			argv_array_init(&args);
-			argv_array_push(&args, "/bin/sh", "-c", collapsed_args, NULL);
-			char **argv = argv_array_detach(&args, NULL);
+			argv_array_init(args);
+			argv_array_push(args, "/bin/sh", "-c", collapsed_args, NULL);
+			char **argv = argv_array_detach(args, NULL);
 
-			execve(argv[0], argv, argp);
+			execve(argv[0], argv, envp);
 		}
 
 		FATAL("execve() returned unexpectedly.");
@@ -251,10 +367,58 @@ int start_command(struct child_process_def *cmd)
 	}
 
 	close(cmd->internals.notify_pipe[WRITE]);
+}
+
+int start_command(struct child_process_def *cmd)
+{
+	if (cmd->pid != -1)
+		BUG("child_process_def must have a pid of -1; either the pid was modified "
+				"or the run-command api was not used correctly");
+	if (cmd->git_cmd && cmd->executable)
+		BUG("ambiguous child_process_def; git_cmd is true but executable is not NULL");
+	if (!cmd->git_cmd && !cmd->executable)
+		BUG("unexpected child_process_def without executable specified.");
+
+	const char *executable_path = cmd->executable;
+	if (cmd->git_cmd || !strchr(cmd->executable, '/')) {
+		executable_path = resolve_executable(cmd->git_cmd ? "git" : cmd->executable);
+		if (!executable_path)
+			FATAL("executable '%s' could not be found in PATH, or is not executable.", cmd->executable);
+	}
+
+	if (cmd->args.arr.len) {
+		char *args_literal = argv_array_collapse(&cmd->args);
+		LOG_TRACE("executing process '%s %s'", executable_path, args_literal);
+		free(args_literal);
+	} else {
+		LOG_TRACE("executing process '%s'", executable_path);
+	}
+
+	/*
+	 * Prepare arguments. argv[0] must be the path of the executable, and
+	 * argv must be NULL terminated. args and env are duplicated so
+	 * child_process_def is not modified.
+	 */
+	struct argv_array args;
+	argv_array_init(&args);
+	argv_array_push(&args, executable_path, NULL);
+	for (size_t i = 0; i < cmd->args.arr.len; i++) {
+		char *string_to_copy = str_array_get((struct str_array *)&cmd->args, i);
+		argv_array_push(&args, string_to_copy, NULL);
+	}
+
+	char **envp = merge_env(&cmd->env);
+
+	cmd->internals.notify_pipe[READ] = -1;
+	cmd->internals.notify_pipe[WRITE] = -1;
+	if (cmd->dir && !HAVE_SPAWN_CHDIR)
+		fork_command(cmd, &args, envp);
+	else
+		spawn_command(cmd, &args, envp);
 
-	free(executable_path);
 	argv_array_release(&args);
-	str_array_release(&env);
+	if (envp != environ)
+		free(envp);
 
 	LOG_TRACE("child process successfully created with pid %d", cmd->pid);
 
@@ -279,10 +443,14 @@ int finish_command(struct child_process_def *cmd)
 	if (WIFSIGNALED(child_ret_status))
 		LOG_WARN("child process with pid %d terminated with signal %d", cmd->pid, WTERMSIG(child_ret_status));
 
-	if (xread(cmd->internals.notify_pipe[READ], &status, sizeof(status)) > 0)
-		FATAL("child process encountered a fatal error and exited with status %d.", status);
+	if (cmd->internals.notify_pipe[READ] >= 0) {
+		if (xread(cmd->internals.notify_pipe[READ], &status, sizeof(status)) > 0)
+			FATAL("child process encountered a fatal error and exited with status %d.", status);
+
+		close(cmd->internals.notify_pipe[READ]);
+		cmd->internals.notify_pipe[READ] = -1;
+	}
 
-	close(cmd->internals.notify_pipe[READ]);
 	child_failure_fd = -1;
 	cmd->pid = -1;
 
@@ -290,15 +458,336 @@ int finish_command(struct child_process_def *cmd)
 }
 
 /**
- * Extract the environment variable key into the given string buffer.
+ * A process slot of run_processes_parallel(), and the output captured from the
+ * task running in it.
+ * */
+struct parallel_slot {
+	struct child_process_def cmd;
+	void *task_data;
+	struct strbuf out;
+	struct strbuf err;
+	unsigned running: 1;
+};
+
+/**
+ * Start the command of a slot, with a pipe for each stream that is captured.
+ * The pipes are close-on-exec, so that processes started later don't hold the
+ * output pipes of the processes running next to them.
+ * */
+static void parallel_slot_start(struct parallel_slot *slot)
+{
+	struct child_process_def *cmd = &slot->cmd;
+	if ((cmd->std_fd_info & 0x00f) == STDIN_PROVISIONED ||
+		(cmd->std_fd_info & 0x0f0) == STDOUT_PROVISIONED ||
+		(cmd->std_fd_info & 0xf00) == STDERR_PROVISIONED)
+		BUG("cannot invoke run_processes_parallel() on a child_process_def that has provisioned streams");
+
+	int capture_out = (cmd->std_fd_info & 0x0f0) != STDOUT_NULL;
+	int capture_err = (cmd->std_fd_info & 0xf00) != STDERR_NULL;
+
+	cmd->out_fd[READ] = cmd->out_fd[WRITE] = -1;
+	cmd->err_fd[READ] = cmd->err_fd[WRITE] = -1;
+	if (capture_out) {
+		if (pipe2(cmd->out_fd, O_CLOEXEC) < 0)
+			FATAL("invocation of pipe() system call failed.");
+		child_process_def_stdout(cmd, STDOUT_PROVISIONED);
+	}
+	if (capture_err) {
+		if (pipe2(cmd->err_fd, O_CLOEXEC) < 0)
+			FATAL("invocation of pipe() system call failed.");
+		child_process_def_stderr(cmd, STDERR_PROVISIONED);
+	}
+
+	start_command(cmd);
+
+	if (capture_out)
+		close(cmd->out_fd[WRITE]);
+	if (capture_err)
+		close(cmd->err_fd[WRITE]);
+}
+
+/**
+ * Read whatever is available from the pipe `fd` into `buffer`. At the end of
+ * the stream, the pipe is closed and `fd` is set to -1.
+ * */
+static void parallel_slot_read(int *fd, struct strbuf *buffer)
+{
+	char chunk[PARALLEL_READ_LEN];
+
+	ssize_t bytes_read = xread(*fd, chunk, PARALLEL_READ_LEN);
+	if (bytes_read < 0)
+		FATAL("pipe read failure");
+
+	if (bytes_read > 0) {
+		strbuf_attach(buffer, chunk, bytes_read);
+		return;
+	}
+
+	close(*fd);
+	*fd = -1;
+}
+
+int run_processes_parallel(size_t max_processes, parallel_next_task_fn next_task,
+		parallel_task_finished_fn task_finished, void *data)
+{
+	if (!max_processes) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		max_processes = online > 0 ? (size_t) online : 1;
+	}
+
+	struct parallel_slot *slots = calloc(max_processes, sizeof(struct parallel_slot));
+	struct pollfd *fds = calloc(max_processes * 2, sizeof(struct pollfd));
+	if (!slots || !fds)
+		FATAL(MEM_ALLOC_FAILED);
+
+	size_t running = 0;
+	int tasks_left = 1;
+	int ret = 0;
+	while (1) {
+		// Start tasks in free slots, unless a callback asked to stop
+		for (size_t i = 0; i < max_processes && tasks_left && !ret; i++) {
+			struct parallel_slot *slot = &slots[i];
+			if (slot->running)
+				continue;
+
+			child_process_def_init(&slot->cmd);
+			slot->task_data = NULL;
+			if (!next_task(&slot->cmd, data, &slot->task_data)) {
+				child_process_def_release(&slot->cmd);
+				tasks_left = 0;
+				break;
+			}
+
+			strbuf_init(&slot->out);
+			strbuf_init(&slot->err);
+			parallel_slot_start(slot);
+			slot->running = 1;
+			running++;
+		}
+
+		if (!running)
+			break;
+
+		// Wait for output from any of the running processes
+		nfds_t nfds = 0;
+		for (size_t i = 0; i < max_processes; i++) {
+			struct parallel_slot *slot = &slots[i];
+			if (!slot->running)
+				continue;
+
+			if (slot->cmd.out_fd[READ] >= 0)
+				fds[nfds++] = (struct pollfd) { .fd = slot->cmd.out_fd[READ], .events = POLLIN };
+			if (slot->cmd.err_fd[READ] >= 0)
+				fds[nfds++] = (struct pollfd) { .fd = slot->cmd.err_fd[READ], .events = POLLIN };
+		}
+
+		if (nfds && poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			FATAL("invocation of poll() system call failed.");
+		}
+
+		// Read what's ready, in the same order the descriptors were polled
+		nfds_t polled = 0;
+		for (size_t i = 0; i < max_processes && polled < nfds; i++) {
+			struct parallel_slot *slot = &slots[i];
+			if (!slot->running)
+				continue;
+
+			if (slot->cmd.out_fd[READ] >= 0 && fds[polled++].revents)
+				parallel_slot_read(&slot->cmd.out_fd[READ], &slot->out);
+			if (slot->cmd.err_fd[READ] >= 0 && fds[polled++].revents)
+				parallel_slot_read(&slot->cmd.err_fd[READ], &slot->err);
+		}
+
+		// Reap the processes whose output has been read in full
+		for (size_t i = 0; i < max_processes; i++) {
+			struct parallel_slot *slot = &slots[i];
+			if (!slot->running || slot->cmd.out_fd[READ] >= 0 || slot->cmd.err_fd[READ] >= 0)
+				continue;
+
+			int status = finish_command(&slot->cmd);
+			if (task_finished(status, &slot->out, &slot->err, data, slot->task_data))
+				ret = 1;
+
+			child_process_def_release(&slot->cmd);
+			strbuf_release(&slot->out);
+			strbuf_release(&slot->err);
+			slot->running = 0;
+			running--;
+		}
+	}
+
+	free(fds);
+	free(slots);
+
+	return ret;
+}
+
+/**
+ * Executables found in PATH, by name. Most commands run git, so rather than
+ * searching PATH for every command, each executable is searched for once per
+ * process (or again, if PATH changes).
+ * */
+struct resolved_executable {
+	struct hashmap_entry ent;
+	char *name;
+	char *path;
+};
+
+static struct hashmap resolved_executables;
+static char *resolved_path_env;
+
+static int resolved_executable_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct resolved_executable *a = entry;
+	const struct resolved_executable *b = entry_or_key;
+
+	return strcmp(a->name, keydata ? (const char *) keydata : b->name);
+}
+
+static void release_resolved_executables(void)
+{
+	struct hashmap_iter iter;
+	struct resolved_executable *entry;
+
+	hashmap_iter_init(&resolved_executables, &iter);
+	while ((entry = hashmap_iter_next(&iter))) {
+		free(entry->name);
+		free(entry->path);
+	}
+
+	hashmap_release(&resolved_executables, 1);
+	free(resolved_path_env);
+	resolved_path_env = NULL;
+}
+
+/**
+ * Find the executable `name` in PATH, like find_in_path(), remembering the
+ * result.
  *
- * env_var must be NULL terminated.
+ * Returns the path to the executable, which must not be freed, or NULL if it
+ * could not be found.
  * */
-static void env_variable_key(char *env_var, struct strbuf *buff)
+static const char *resolve_executable(const char *name)
 {
-	char *eq = strchr(env_var, '=');
+	const char *path_env = getenv("PATH");
+	if (!path_env)
+		path_env = "";
+
+	if (!resolved_path_env || strcmp(resolved_path_env, path_env) != 0) {
+		if (resolved_path_env)
+			release_resolved_executables();
+
+		hashmap_init(&resolved_executables, resolved_executable_cmp, 0);
+		resolved_path_env = strdup(path_env);
+		if (!resolved_path_env)
+			FATAL(MEM_ALLOC_FAILED);
+	}
+
+	struct resolved_executable key, *entry;
+	hashmap_entry_init(&key, strhash(name));
+	if ((entry = hashmap_get(&resolved_executables, &key, name)))
+		return entry->path;
+
+	char *path = find_in_path(name);
+	if (!path)
+		return NULL;
+
+	entry = malloc(sizeof(struct resolved_executable));
+	if (!entry)
+		FATAL(MEM_ALLOC_FAILED);
+
+	hashmap_entry_init(entry, strhash(name));
+	entry->name = strdup(name);
+	if (!entry->name)
+		FATAL(MEM_ALLOC_FAILED);
+	entry->path = path;
+	hashmap_add(&resolved_executables, entry);
 
-	strbuf_attach(buff, env_var, eq ? eq - env_var : strlen(env_var));
+	return path;
+}
+
+/**
+ * Compare the names of two environment variables, of the form `key=value`.
+ * */
+static int env_key_cmp(const char *a, const char *b)
+{
+	size_t a_len = strcspn(a, "=");
+	size_t b_len = strcspn(b, "=");
+
+	int cmp = strncmp(a, b, a_len < b_len ? a_len : b_len);
+	if (cmp)
+		return cmp;
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+static int env_var_cmp(const void *a, const void *b)
+{
+	return env_key_cmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * A snapshot of the environment of the current process, sorted by name. The
+ * environment of each child process is merged from the snapshot, rather than
+ * copying and sorting the environment for every command.
+ *
+ * The snapshot only holds pointers to the variables in `environ`, so it is
+ * taken again whenever `environ` changes (for instance, with setenv()).
+ * */
+static struct {
+	// `environ` when the snapshot was taken, and the variables it held
+	char **environ;
+	char **vars;
+
+	char **sorted;
+	size_t len;
+} parent_env;
+
+static void release_parent_env(void)
+{
+	free(parent_env.vars);
+	free(parent_env.sorted);
+	memset(&parent_env, 0, sizeof(parent_env));
+}
+
+/**
+ * Take a snapshot of the environment, unless it's unchanged since the last
+ * snapshot was taken.
+ * */
+static void snapshot_parent_env(void)
+{
+	size_t len = 0;
+
+	if (parent_env.vars && parent_env.environ == environ) {
+		while (len < parent_env.len && environ[len] == parent_env.vars[len])
+			len++;
+
+		if (len == parent_env.len && !environ[len])
+			return;
+	}
+
+	release_parent_env();
+
+	for (len = 0; environ && environ[len]; len++);
+
+	parent_env.environ = environ;
+	parent_env.len = len;
+	parent_env.vars = malloc((len + 1) * sizeof(char *));
+	parent_env.sorted = malloc((len + 1) * sizeof(char *));
+	if (!parent_env.vars || !parent_env.sorted)
+		FATAL(MEM_ALLOC_FAILED);
+
+	if (len) {
+		memcpy(parent_env.vars, environ, len * sizeof(char *));
+		memcpy(parent_env.sorted, environ, len * sizeof(char *));
+	}
+	parent_env.vars[len] = NULL;
+	parent_env.sorted[len] = NULL;
+
+	qsort(parent_env.sorted, len, sizeof(char *), env_var_cmp);
 }
 
 /**
@@ -308,55 +797,55 @@ static void env_variable_key(char *env_var, struct strbuf *buff)
  * Variables in the desired child process that also exist in the current process
  * will take precedence.
  *
- * 'deltaenv' remains untouched. 'result' must be an empty str_array.
+ * 'deltaenv' remains untouched. Returns a NULL terminated array of variables
+ * for execve(). The variables themselves are not copied. If the child process
+ * has no variables of its own, the environment is returned as is; otherwise,
+ * the array must be free()d.
  * */
-static void merge_env(struct str_array *deltaenv, struct str_array *result)
+static char **merge_env(struct str_array *deltaenv)
 {
-	char **parent_env = environ;
-	struct str_array current_env;
-	str_array_init(&current_env);
+	if (!deltaenv->len)
+		return environ;
 
-	if (result->len)
-		BUG("merge_env() accepts an empty str_array as an argument, but given str_array was not empty.");
+	snapshot_parent_env();
 
-	while (*parent_env)
-		str_array_push(&current_env, *(parent_env++), NULL);
+	char **delta = malloc(deltaenv->len * sizeof(char *));
+	char **result = malloc((parent_env.len + deltaenv->len + 1) * sizeof(char *));
+	if (!delta || !result)
+		FATAL(MEM_ALLOC_FAILED);
 
 	for (size_t i = 0; i < deltaenv->len; i++)
-		str_array_insert(result, deltaenv->entries[i].string, i);
-
-	str_array_sort(&current_env);
-	str_array_sort(result);
-
-	size_t p = 0, c = 0;
-	while (p < current_env.len && c < result->len) {
-		struct strbuf p_key;
-		strbuf_init(&p_key);
-		env_variable_key(current_env.entries[p].string, &p_key);
-
-		struct strbuf c_key;
-		strbuf_init(&c_key);
-		env_variable_key(result->entries[c].string, &c_key);
-
-		/* If keys are equal, child variable will take precedence */
-		int cmp = strcmp(c_key.buff, p_key.buff);
-		if (cmp > 0) {
-			str_array_insert(result, current_env.entries[p].string, 0);
-			c++, p++;
-		} else if (!cmp)
-			p++, c++;
+		delta[i] = deltaenv->entries[i].string;
+	qsort(delta, deltaenv->len, sizeof(char *), env_var_cmp);
+
+	size_t p = 0, c = 0, len = 0;
+	while (p < parent_env.len || c < deltaenv->len) {
+		int cmp;
+		if (p >= parent_env.len)
+			cmp = 1;
+		else if (c >= deltaenv->len)
+			cmp = -1;
 		else
-			c++;
+			cmp = env_key_cmp(parent_env.sorted[p], delta[c]);
 
-		strbuf_release(&p_key);
-		strbuf_release(&c_key);
+		/* If keys are equal, child variable will take precedence */
+		if (cmp < 0) {
+			result[len++] = parent_env.sorted[p++];
+		} else {
+			if (!cmp)
+				p++;
+
+			// with duplicate keys in the child environment, the last one wins
+			while (c + 1 < deltaenv->len && !env_key_cmp(delta[c], delta[c + 1]))
+				c++;
+			result[len++] = delta[c++];
+		}
 	}
 
-	/* Add any remaining variables from parent */
-	while (p < current_env.len)
-		str_array_push(result, current_env.entries[p++].string, NULL);
+	result[len] = NULL;
+	free(delta);
 
-	str_array_release(&current_env);
+	return result;
 }
 
 static NORETURN void child_exit_routine(int status)
@@ -51,6 +51,16 @@ void strbuf_attach(struct strbuf *buff, const char *str, size_t buffer_len)
 	buff->len += str_len;
 }
 
+void strbuf_attach_bytes(struct strbuf *buff, const void *data, size_t len)
+{
+	if ((buff->len + len + 1) >= buff->alloc)
+		strbuf_grow(buff, buff->alloc + len + BUFF_SLOP);
+
+	memcpy(buff->buff + buff->len, data, len);
+	buff->len += len;
+	buff->buff[buff->len] = 0;
+}
+
 void strbuf_attach_str(struct strbuf *buff, const char *str)
 {
 	strbuf_attach(buff, str, strlen(str));
@@ -103,6 +113,17 @@ void strbuf_attach_fd(struct strbuf *buff, int fd)
 		FATAL("pipe read failure");
 }
 
+void strbuf_attach_fd_bytes(struct strbuf *buff, int fd)
+{
+	char temp_buffer[1024];
+	ssize_t bytes_read;
+	while ((bytes_read = xread(fd, temp_buffer, 1024)) > 0)
+		strbuf_attach_bytes(buff, temp_buffer, bytes_read);
+
+	if (bytes_read < 0)
+		FATAL("pipe read failure");
+}
+
 int strbuf_trim(struct strbuf *buff)
 {
 	int chars_trimmed = 0;
@@ -3,6 +3,7 @@
 #include <sys/stat.h>
 
 #include "working-tree.h"
+#include "git/object-coprocess.h"
 #include "run-command.h"
 #include "fs-utils.h"
 #include "utils.h"
@@ -29,14 +30,24 @@ int is_inside_git_chat_space()
 		return 0;
 	}
 
+	// the object coprocess only runs inside a repository, and once started,
+	// it's shared with whatever objects the command reads later
+	struct git_object head;
+	int ret = object_coprocess_response("HEAD", OBJECT_REQUEST_INFO, NULL, &head);
+	git_object_release(&head);
+	if (ret >= 0) {
+		errno = errsv;
+		return 1;
+	}
+
 	struct child_process_def cmd;
 	child_process_def_init(&cmd);
 	cmd.git_cmd = 1;
 	cmd.std_fd_info = STDIN_NULL | STDOUT_NULL | STDERR_NULL;
 	argv_array_push(&cmd.args, "rev-parse", "--is-inside-work-tree", NULL);
 
-	//if 'git rev-parse --is-inside-work-tree' return with a zero exit status,
-	//its safe enough to assume we are in a git-chat space.
+	//otherwise (like with git older than 2.36), if 'git rev-parse --is-inside-work-tree'
+	//return with a zero exit status, its safe enough to assume we are in a git-chat space.
 	int status = run_command(&cmd);
 	child_process_def_release(&cmd);
 
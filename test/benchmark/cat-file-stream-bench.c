@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "git/cat-file-stream.h"
+#include "strbuf.h"
+#include "utils.h"
+
+/*
+ * Measure the throughput of the cat-file-stream parser for various read buffer
+ * sizes. Synthetic batched git-cat-file output, resembling small commits, is
+ * written to a pipe by a child process and parsed by the parent.
+ *
+ * Usage: cat-file-stream-bench [<number of objects>]
+ * */
+
+#define DELIM "0123456789abcdef"
+#define DEFAULT_OBJECTS 200000
+
+static void generate_output(struct strbuf *out, size_t objects)
+{
+	const char *body =
+			"tree 4b825dc642cb6eb9a060e54bf8d69288fbce4904\n"
+			"parent 0123456789012345678901234567890123456789\n"
+			"author Example Author <author@example.com> 1600000000 +0000\n"
+			"committer Example Author <author@example.com> 1600000000 +0000\n"
+			"\n"
+			"-----BEGIN PGP MESSAGE-----\n"
+			"\n"
+			"hQGMA9Nc+y5bT2bBAQv/d7QBmFIrkHO2ZZtQq6Q3qM2lXoQ+Y6mYdS7Yf8m3fRrK\n"
+			"q1x4dF3b1v9w2yQmM5o2dP6m1jYv8x0aN3oZz4pYw3i0pXbqW9y5QmY6d1rE0bTa\n"
+			"=abcd\n"
+			"-----END PGP MESSAGE-----\n";
+	size_t body_len = strlen(body);
+
+	for (size_t i = 0; i < objects; i++)
+		strbuf_attach_fmt(out, "%s %040zx commit %zu\n%s\n", DELIM, i, body_len, body);
+}
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+	return (double) (end->tv_sec - start->tv_sec) +
+			(double) (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run_benchmark(struct strbuf *output, size_t objects, size_t buffer_size)
+{
+	int fds[2];
+	if (pipe(fds) < 0)
+		FATAL("invocation of pipe() system call failed.");
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		FATAL("invocation of fork() system call failed.");
+
+	if (!pid) {
+		close(fds[0]);
+		if (xwrite(fds[1], output->buff, output->len) < 0)
+			_exit(1);
+
+		_exit(0);
+	}
+
+	close(fds[1]);
+
+	struct cat_file_stream stream;
+	struct cat_file_object obj;
+	size_t count = 0;
+	cat_file_stream_init(&stream, fds[0], DELIM, buffer_size);
+	while (!cat_file_stream_next(&stream, &obj))
+		count++;
+
+	cat_file_stream_release(&stream);
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (count != objects) {
+		fprintf(stderr, "expected %zu objects but read %zu\n", objects, count);
+		return 1;
+	}
+
+	double seconds = elapsed_seconds(&start, &end);
+	printf("%12zu %12zu %10.3f %12.1f\n", buffer_size, count, seconds,
+			(double) output->len / (1024 * 1024) / seconds);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t objects = DEFAULT_OBJECTS;
+	if (argc > 1)
+		objects = strtoul(argv[1], NULL, 10);
+
+	struct strbuf output;
+	strbuf_init(&output);
+	generate_output(&output, objects);
+
+	size_t buffer_sizes[] = { 1024, 4096, 16384, 65536, 262144, 1048576, 0 };
+
+	printf("%12s %12s %10s %12s\n", "buffer", "objects", "seconds", "MB/s");
+	int ret = 0;
+	for (size_t *size = buffer_sizes; *size && !ret; size++)
+		ret = run_benchmark(&output, objects, *size);
+
+	strbuf_release(&output);
+	return ret;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#include "gnupg/gpg-common.h"
+#include "gnupg/key-manager.h"
+#include "run-command.h"
+#include "str-array.h"
+#include "strbuf.h"
+#include "utils.h"
+
+/*
+ * Compare importing a directory of key files into an empty keyring one key
+ * file at a time (one gpg import per key file) with importing all key files
+ * through a single streamed gpg import.
+ *
+ * The key files are generated with gpg in a scratch directory beforehand,
+ * which takes a while for large numbers of keys.
+ *
+ * Usage: key-import-bench [<number of keys>]
+ * */
+
+#define DEFAULT_KEYS 5000
+
+static const char *setup_script =
+		"set -e\n"
+		"git init -q .\n"
+		"mkdir -m 700 source keys per-file batch\n"
+		"for i in $(seq 1 \"$1\"); do\n"
+		"  printf '%%no-protection\\nKey-Type: eddsa\\nKey-Curve: ed25519\\n"
+		"Name-Real: user %s\\nName-Email: user%s@example.com\\nExpire-Date: 0\\n%%commit\\n' \"$i\" \"$i\"\n"
+		"done > keys.params\n"
+		"gpg --homedir source --batch --quiet --gen-key keys.params 2>/dev/null\n"
+		"gpg --homedir source --with-colons --list-keys 2>/dev/null | awk -F: '$1 == \"fpr\" { print $10 }' |\n"
+		"while read fpr; do\n"
+		"  gpg --homedir source --armor --export \"$fpr\" > \"keys/$fpr\"\n"
+		"done\n";
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+	return (double) (end->tv_sec - start->tv_sec) +
+			(double) (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int run_script(const char *script, const char *dir, size_t keys)
+{
+	struct child_process_def cmd;
+	char keys_arg[32];
+	snprintf(keys_arg, sizeof(keys_arg), "%zu", keys);
+
+	child_process_def_init(&cmd);
+	cmd.executable = "sh";
+	cmd.dir = dir;
+	argv_array_push(&cmd.args, "-c", script, "sh", keys_arg, NULL);
+
+	int ret = run_command(&cmd);
+	child_process_def_release(&cmd);
+
+	return ret;
+}
+
+static void list_key_files(const char *keys_dir, struct str_array *paths)
+{
+	DIR *dir = opendir(keys_dir);
+	if (!dir)
+		FATAL("unable to open directory '%s'", keys_dir);
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		struct strbuf path;
+		strbuf_init(&path);
+		strbuf_attach_fmt(&path, "%s/%s", keys_dir, ent->d_name);
+		str_array_insert_nodup(paths, strbuf_detach(&path), paths->len);
+	}
+
+	closedir(dir);
+}
+
+static void report(const char *name, size_t keys, struct timespec *start,
+		struct timespec *end)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	double seconds = elapsed_seconds(start, end);
+	printf("%10s %10zu %10.3f %12.1f %14ld\n", name, keys, seconds,
+			(double) keys / seconds, usage.ru_maxrss);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t keys = DEFAULT_KEYS;
+	if (argc > 1)
+		keys = strtoul(argv[1], NULL, 10);
+
+	char dir[] = "/tmp/key-import-bench-XXXXXX";
+	if (!mkdtemp(dir))
+		FATAL("unable to create a temporary directory");
+
+	fprintf(stderr, "generating %zu keys under '%s'...\n", keys, dir);
+	if (run_script(setup_script, dir, keys))
+		FATAL("failed to generate keys");
+
+	if (chdir(dir))
+		FATAL("unable to change directory to '%s'", dir);
+
+	struct str_array paths;
+	str_array_init(&paths);
+	list_key_files("keys", &paths);
+
+	init_gpgme_openpgp_engine();
+
+	struct gc_gpgme_ctx ctx;
+	struct timespec start, end;
+	int imported;
+
+	printf("%10s %10s %10s %12s %14s\n", "import", "keys", "seconds", "keys/s", "max rss (kB)");
+
+	// the batch runs first, so that its peak memory use isn't masked
+	gpgme_context_init(&ctx, 0);
+	gpgme_context_set_homedir(&ctx, "batch");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	imported = import_gpg_key_files(&ctx, &paths, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	gpgme_context_release(&ctx);
+	report("batch", (size_t) imported, &start, &end);
+
+	gpgme_context_init(&ctx, 0);
+	gpgme_context_set_homedir(&ctx, "per-file");
+	imported = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < paths.len; i++)
+		imported += import_gpg_key(&ctx, str_array_get(&paths, i), NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	gpgme_context_release(&ctx);
+	report("per-file", (size_t) imported, &start, &end);
+
+	str_array_release(&paths);
+
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.executable = "rm";
+	argv_array_push(&cmd.args, "-rf", dir, NULL);
+	run_command(&cmd);
+	child_process_def_release(&cmd);
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "fs-utils.h"
+#include "run-command.h"
+#include "str-array.h"
+#include "strbuf.h"
+#include "utils.h"
+
+/*
+ * Measure the number of child processes that can be spawned per second with
+ * the run-command api, compared with the way commands used to be started: a
+ * PATH search, a copied and sorted environment, and fork() for every command.
+ *
+ * fork() copies the page tables of the parent, so its cost grows with the
+ * memory of the parent process; the second argument allocates (and touches)
+ * that many MiB beforehand, to resemble a process with large caches loaded.
+ *
+ * Usage: spawn-bench [<number of spawns>] [<MiB of parent memory>]
+ * */
+
+#define DEFAULT_SPAWNS 2000
+
+extern char **environ;
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end)
+{
+	return (double) (end->tv_sec - start->tv_sec) +
+			(double) (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Start `true` like start_command() used to: search PATH, copy and sort the
+ * environment, and fork().
+ * */
+static int spawn_legacy(void)
+{
+	char *path = find_in_path("true");
+	if (!path)
+		FATAL("executable 'true' could not be found in PATH");
+
+	struct str_array env;
+	str_array_init(&env);
+	for (char **var = environ; *var; var++)
+		str_array_push(&env, *var, NULL);
+	str_array_sort(&env);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		FATAL("failed to fork process.");
+
+	if (!pid) {
+		int null_fd = open("/dev/null", O_RDWR);
+		if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0)
+			_exit(127);
+
+		char *argv[] = { path, NULL };
+		execve(path, argv, str_array_detach(&env, NULL));
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0);
+
+	str_array_release(&env);
+	free(path);
+
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+/**
+ * Start `true` through the run-command api, optionally with a variable of its
+ * own (so that the environment must be merged).
+ * */
+static int spawn_run_command(int with_env)
+{
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.executable = "true";
+	child_process_def_stdout(&cmd, STDOUT_NULL);
+	if (with_env)
+		str_array_push(&cmd.env, "GIT_CHAT_BENCH=1", NULL);
+
+	int ret = run_command(&cmd);
+	child_process_def_release(&cmd);
+
+	return ret;
+}
+
+static int run_benchmark(const char *name, int mode, size_t spawns)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (size_t i = 0; i < spawns; i++) {
+		int ret = mode ? spawn_run_command(mode > 1) : spawn_legacy();
+		if (ret) {
+			fprintf(stderr, "%s: child process failed\n", name);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = elapsed_seconds(&start, &end);
+	printf("%-24s %10zu %10.3f %12.1f\n", name, spawns, seconds, (double) spawns / seconds);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t spawns = DEFAULT_SPAWNS;
+	size_t parent_mib = 0;
+	if (argc > 1)
+		spawns = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		parent_mib = strtoul(argv[2], NULL, 10);
+
+	char *ballast = NULL;
+	if (parent_mib) {
+		ballast = malloc(parent_mib * 1024 * 1024);
+		if (!ballast)
+			FATAL(MEM_ALLOC_FAILED);
+		memset(ballast, 1, parent_mib * 1024 * 1024);
+	}
+
+	printf("parent memory: %zu MiB\n", parent_mib);
+	printf("%-24s %10s %10s %12s\n", "backend", "spawns", "seconds", "spawns/s");
+
+	int ret = run_benchmark("fork (legacy)", 0, spawns);
+	if (!ret)
+		ret = run_benchmark("run-command", 1, spawns);
+	if (!ret)
+		ret = run_benchmark("run-command (with env)", 2, spawns);
+
+	free(ballast);
+	return ret;
+}
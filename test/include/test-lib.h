@@ -337,4 +337,12 @@ int execute_tests(struct test_runner_instance *instance, struct unit_test *tests
 void print_assertion_failure_message(const char *file_path, int line_number,
 		const char *func_name, const char *fmt, ...);
 
+/**
+ * Run a shell script with `sh -c`, such as a script that sets up the fixture
+ * repository of a test. Standard output of the script is discarded.
+ *
+ * Returns the exit status of the script.
+ * */
+int test_run_fixture_script(const char *script);
+
 #endif //GIT_CHAT_TEST_LIB_H
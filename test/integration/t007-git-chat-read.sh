@@ -51,6 +51,19 @@ assert_success 'git chat read with message hash should print only that message'
 	grep "joined the channel" out
 '
 
+assert_success 'git chat read must decrypt binary ciphertext stored as a blob' '
+	setup_test_gpg &&
+	git chat config --set message.storage blob
+' '
+	git chat message -m "hello blob" &&
+	git cat-file blob HEAD:.git-chat/ciphertext >ciphertext &&
+	test "$(tr -d "\000" <ciphertext | wc -c)" -lt "$(wc -c <ciphertext)" &&
+	PAGER=/usr/bin/cat git chat --passphrase password read HEAD >out &&
+	grep "hello blob" out &&
+	PAGER=/usr/bin/cat GIT_CHAT_OBJECT_BACKEND=subprocess git chat --passphrase password read HEAD >out &&
+	grep "hello blob" out
+'
+
 assert_success 'git chat read should print ciphertext when cannot be decrypted' '
 	reset_trash_dir &&
 	setup_test_gpg &&
@@ -98,3 +111,37 @@ assert_success 'git chat read should print colored headers when output is a tty'
 	GIT_CHAT_PAGER=/usr/bin/cat git chat --passphrase password read --max-count 1 >out &&
 	grep -v -P "\033\[32m\[.*DEC.*\]\033\[0m" out
 '
+
+assert_success 'git chat read --new with message limit should show the oldest new messages first' '
+	reset_trash_dir &&
+	setup_test_gpg &&
+	git chat init &&
+	git chat import-key -f "$TEST_RESOURCES_DIR/gpgkeys/test_user.pub.gpg" &&
+	PAGER=/usr/bin/cat git chat --passphrase password read --new >/dev/null
+' '
+	git chat message -m "first unread" &&
+	git chat message -m "second unread" &&
+	git chat message -m "third unread" &&
+	PAGER=/usr/bin/cat git chat --passphrase password read --new -n 2 >out &&
+	grep "first unread" out &&
+	grep "second unread" out &&
+	! grep "third unread" out &&
+	PAGER=/usr/bin/cat git chat --passphrase password read --new -n 2 >out &&
+	! grep "first unread" out &&
+	! grep "second unread" out &&
+	grep "third unread" out &&
+	PAGER=/usr/bin/cat git chat --passphrase password read --new >out &&
+	! grep "unread" out
+'
+
+assert_success 'git chat read --new should ignore malformed read watermarks' '
+	setup_test_gpg &&
+	channel=$(git rev-parse --abbrev-ref HEAD) &&
+	malformed=$(printf "%040d" 0 | tr 0 z) &&
+	sed -i "1a $malformed $channel" .git/chat-cache/read-watermarks
+' '
+	git chat message -m "after malformed" &&
+	PAGER=/usr/bin/cat git chat --passphrase password read --new >out &&
+	grep "after malformed" out &&
+	! grep "third unread" out
+'
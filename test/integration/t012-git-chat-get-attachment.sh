@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+
+source ./test-lib.sh
+
+assert_success 'git chat get-attachment -h should display usage info' '
+	git chat get-attachment -h &&
+	git chat get-attachment --help >out &&
+	grep '\''^usage: git chat get-attachment'\'' out
+'
+
+assert_success 'git chat get-attachment must fail if not in git-chat space' '
+	reset_trash_dir
+' '
+	! git chat get-attachment HEAD 0 2>err &&
+	grep "Where are you? It doesn'\''t look like you'\''re in the right directory." err
+'
+
+assert_success 'git chat message --attach should store the attachment in chunks' '
+	reset_trash_dir &&
+	setup_test_gpg &&
+	git chat init &&
+	git chat import-key -f "$TEST_RESOURCES_DIR/gpgkeys/test_user.pub.gpg"
+' '
+	head -c 3000000 /dev/urandom >build.log &&
+	git chat message -m "see attached" --attach build.log &&
+	git show -s --format="%B" HEAD >commit_msg &&
+	grep "^Git-Chat-Attachment: 3 3000000 build.log$" commit_msg &&
+	git ls-tree --name-only HEAD:.git-chat/attachments/0 >chunks &&
+	test "$(wc -l <chunks)" -eq 3
+'
+
+assert_success 'git chat read should list the attachments of a message' '
+	setup_test_gpg
+' '
+	PAGER=/usr/bin/cat git chat --passphrase password read HEAD >out &&
+	grep "see attached" out &&
+	grep "attachment 0: build.log (3000000 bytes)" out
+'
+
+assert_success 'git chat get-attachment should decrypt the attachment by name or index' '
+	setup_test_gpg
+' '
+	mkdir out_dir &&
+	(cd out_dir && git chat --passphrase password get-attachment HEAD build.log) &&
+	cmp build.log out_dir/build.log &&
+	git chat --passphrase password get-attachment -o - HEAD 0 >out &&
+	cmp build.log out
+'
+
+assert_success 'git chat get-attachment should not overwrite existing files' '
+	setup_test_gpg
+' '
+	! git chat --passphrase password get-attachment HEAD build.log 2>err &&
+	grep "build.log" err
+'
+
+assert_success 'git chat get-attachment with unknown attachment should fail' '
+	setup_test_gpg
+' '
+	! git chat --passphrase password get-attachment HEAD unknown.log 2>err &&
+	grep "has no attachment '\''unknown.log'\''" err &&
+	! git chat --passphrase password get-attachment HEAD^ 0 2>err &&
+	grep "has no attachments" err
+'
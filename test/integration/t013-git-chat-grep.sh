@@ -0,0 +1,135 @@
+#!/usr/bin/env bash
+
+source ./test-lib.sh
+
+# line number of the first line of `out` matching the given pattern
+line_of () {
+	grep -n "$1" out | head -n 1 | cut -d: -f1
+}
+
+assert_success 'git chat grep -h should display usage info' '
+	git chat grep -h &&
+	git chat grep --help >out &&
+	grep '\''^usage: git chat grep'\'' out
+'
+
+assert_success 'git chat grep must fail if not in git-chat space' '
+	reset_trash_dir
+' '
+	! git chat grep pattern 2>err &&
+	grep "Where are you? It doesn'\''t look like you'\''re in the right directory." err
+'
+
+assert_success 'git chat grep should reject --count with --list' '
+	reset_trash_dir &&
+	git chat init
+' '
+	! git chat grep -c -l pattern 2>err &&
+	grep "error: --count and --list are mutually exclusive." err
+'
+
+assert_success 'git chat grep should show matching messages in history order' '
+	reset_trash_dir &&
+	setup_test_gpg &&
+	git chat init &&
+	git chat import-key -f "$TEST_RESOURCES_DIR/gpgkeys/test_user.pub.gpg" &&
+	git chat message -m "alpha one" &&
+	git chat message -m "beta two" &&
+	git chat message -m "Alpha three" &&
+	git chat message -m "gamma four" &&
+	git chat message -m "delta five" &&
+	git chat message -m "alpha six"
+' '
+	git chat --passphrase password grep alpha >out &&
+	grep "alpha six" out &&
+	grep "alpha one" out &&
+	! grep "Alpha three" out &&
+	! grep "beta two" out &&
+	test "$(line_of "alpha six")" -lt "$(line_of "alpha one")"
+'
+
+assert_success 'git chat grep -i should ignore case' '
+	setup_test_gpg
+' '
+	git chat --passphrase password grep -i alpha >out &&
+	test "$(line_of "alpha six")" -lt "$(line_of "Alpha three")" &&
+	test "$(line_of "Alpha three")" -lt "$(line_of "alpha one")"
+'
+
+assert_success 'git chat grep -c should count matching messages' '
+	setup_test_gpg
+' '
+	test "$(git chat --passphrase password grep -c alpha)" = 2 &&
+	test "$(git chat --passphrase password grep -i -c alpha)" = 3 &&
+	test "$(git chat --passphrase password grep --count "^(beta|gamma)")" = 2
+'
+
+assert_success 'git chat grep -l should list matching commits most recent first' '
+	setup_test_gpg
+' '
+	git rev-parse HEAD HEAD~5 >expected &&
+	git chat --passphrase password grep -l alpha >out &&
+	diff expected out
+'
+
+assert_success 'git chat grep -A should show older messages after each match' '
+	setup_test_gpg
+' '
+	git chat --passphrase password grep -A 1 gamma >out &&
+	grep "gamma four" out &&
+	grep "Alpha three" out &&
+	! grep "delta five" out &&
+	! grep "beta two" out &&
+	test "$(line_of "gamma four")" -lt "$(line_of "Alpha three")"
+'
+
+assert_success 'git chat grep -B should show newer messages before each match' '
+	setup_test_gpg
+' '
+	git chat --passphrase password grep -B 1 gamma >out &&
+	grep "delta five" out &&
+	grep "gamma four" out &&
+	! grep "Alpha three" out &&
+	! grep "alpha six" out &&
+	test "$(line_of "delta five")" -lt "$(line_of "gamma four")"
+'
+
+assert_success 'git chat grep -C should separate groups of messages that are not adjacent' '
+	setup_test_gpg
+' '
+	git chat --passphrase password grep -C 1 alpha >out &&
+	test "$(line_of "alpha six")" -lt "$(line_of "delta five")" &&
+	test "$(line_of "delta five")" -lt "$(line_of "^--$")" &&
+	test "$(line_of "^--$")" -lt "$(line_of "beta two")" &&
+	test "$(line_of "beta two")" -lt "$(line_of "alpha one")" &&
+	! grep "gamma four" out &&
+	! grep "Alpha three" out
+'
+
+assert_success 'git chat grep -m should stop after the given number of matches' '
+	setup_test_gpg
+' '
+	git chat --passphrase password grep -m 1 alpha >out &&
+	grep "alpha six" out &&
+	! grep "alpha one" out &&
+	test "$(git chat --passphrase password grep -i -m 2 -c alpha)" = 2 &&
+	git rev-parse HEAD >expected &&
+	git chat --passphrase password grep -m 1 -l alpha >out &&
+	diff expected out
+'
+
+assert_success 'git chat grep should exit with status 1 if no message matches' '
+	setup_test_gpg
+' '
+	{ git chat --passphrase password grep epsilon >out; test $? = 1; } &&
+	test ! -s out &&
+	test "$(git chat --passphrase password grep -c epsilon)" = 0
+'
+
+assert_success 'git chat grep should give the same results when served from the message cache' '
+	setup_test_gpg
+' '
+	git chat --passphrase password grep --no-cache -i -C 1 alpha >expected &&
+	git chat --passphrase password grep -i -C 1 alpha >out &&
+	diff expected out
+'
@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+
+source ./test-lib.sh
+
+# create a repository at the given path with a single commit
+setup_remote () {
+	git init -q "$1" &&
+	git -C "$1" commit -q --allow-empty -m "$2"
+}
+
+assert_success 'git chat get -h should display usage info' '
+	git chat get -h &&
+	git chat get --help >out &&
+	grep '\''^usage: git chat get'\'' out
+'
+
+assert_success 'git chat get must fail if not in git-chat space' '
+	reset_trash_dir
+' '
+	! git chat get 2>err &&
+	grep "Where are you? It doesn'\''t look like you'\''re in the right directory." err
+'
+
+assert_success 'git chat get should reject a negative number of jobs' '
+	reset_trash_dir &&
+	git chat init
+' '
+	! git chat get -j -1 2>err &&
+	grep "error: the number of jobs must not be negative." err
+'
+
+assert_success 'git chat get should fail if there are no remotes' '
+	reset_trash_dir &&
+	git chat init
+' '
+	! git chat get 2>err &&
+	grep "there are no remotes to get messages from" err
+'
+
+assert_success 'git chat get should get messages from every remote' '
+	reset_trash_dir &&
+	setup_remote remote-a "message from a" &&
+	setup_remote remote-b "message from b" &&
+	mkdir space &&
+	cd space &&
+	git chat init &&
+	git remote add a ../remote-a &&
+	git remote add b ../remote-b
+' '
+	git chat get -j 2 &&
+	test "$(git for-each-ref --format="%(objectname)" refs/remotes/a)" = "$(git -C ../remote-a rev-parse HEAD)" &&
+	test "$(git for-each-ref --format="%(objectname)" refs/remotes/b)" = "$(git -C ../remote-b rev-parse HEAD)"
+'
+
+assert_success 'git chat get should only get messages from the given remotes' '
+	cd space &&
+	git -C ../remote-a commit -q --allow-empty -m "new message from a" &&
+	git -C ../remote-b commit -q --allow-empty -m "new message from b"
+' '
+	git chat get b &&
+	test "$(git for-each-ref --format="%(objectname)" refs/remotes/a)" = "$(git -C ../remote-a rev-parse HEAD~1)" &&
+	test "$(git for-each-ref --format="%(objectname)" refs/remotes/b)" = "$(git -C ../remote-b rev-parse HEAD)"
+'
+
+assert_success 'git chat get should report each remote that could not be reached' '
+	cd space &&
+	git remote add c ../does-not-exist &&
+	git remote add d ../does-not-exist-either
+' '
+	! git chat get -j 2 2>err &&
+	grep "unable to get messages from remote '\''c'\''" err &&
+	grep "unable to get messages from remote '\''d'\''" err &&
+	! grep "unable to get messages from remote '\''a'\''" err &&
+	! grep "unable to get messages from remote '\''b'\''" err &&
+	test "$(git for-each-ref --format="%(objectname)" refs/remotes/a)" = "$(git -C ../remote-a rev-parse HEAD)"
+'
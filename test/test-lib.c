@@ -3,6 +3,7 @@
 #include <time.h>
 
 #include "test-lib.h"
+#include "run-command.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
@@ -120,3 +121,17 @@ void print_assertion_failure_message(const char *file_path, int line_number,
 	if (errno > 0)
 		fprintf(stderr, "\nerror: %s\n\n" ANSI_COLOR_RESET, strerror(err));
 }
+
+int test_run_fixture_script(const char *script)
+{
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.executable = "sh";
+	argv_array_push(&cmd.args, "-c", script, NULL);
+	child_process_def_stdout(&cmd, STDOUT_NULL);
+
+	int ret = run_command(&cmd);
+	child_process_def_release(&cmd);
+
+	return ret;
+}
@@ -0,0 +1,85 @@
+#include <stdint.h>
+
+#include "test-lib.h"
+#include "arena.h"
+
+TEST_DEFINE(arena_alloc_alignment_test)
+{
+	struct arena arena;
+	arena_init(&arena, 64);
+
+	TEST_START() {
+		for (size_t i = 1; i < 100; i++) {
+			char *ptr = arena_alloc(&arena, i);
+			assert_nonnull(ptr);
+			assert_zero_msg((uintptr_t) ptr % _Alignof(max_align_t), "allocation %zu is misaligned", i);
+			memset(ptr, 0xff, i);
+		}
+	}
+
+	arena_release(&arena);
+
+	TEST_END();
+}
+
+TEST_DEFINE(arena_alloc_large_test)
+{
+	struct arena arena;
+	arena_init(&arena, 64);
+
+	TEST_START() {
+		char *small = arena_alloc(&arena, 16);
+		char *large = arena_alloc(&arena, 4096);
+		assert_nonnull(small);
+		assert_nonnull(large);
+
+		memset(small, 'a', 16);
+		memset(large, 'b', 4096);
+		assert_eq('a', small[15]);
+		assert_eq('b', large[4095]);
+	}
+
+	arena_release(&arena);
+
+	TEST_END();
+}
+
+TEST_DEFINE(arena_reset_test)
+{
+	struct arena arena;
+	arena_init(&arena, 0);
+
+	TEST_START() {
+		char *first = arena_alloc(&arena, 32);
+		for (int i = 0; i < 16; i++)
+			arena_alloc(&arena, ARENA_DEFAULT_CHUNK_SIZE / 4);
+
+		assert_nonnull(arena.chunks->next);
+		arena_reset(&arena);
+		assert_null_msg(arena.chunks->next, "only a single chunk should be kept on reset");
+		assert_zero(arena.chunks->used);
+
+		char *second = arena_alloc(&arena, 32);
+		assert_true_msg(first == second, "arena should allocate from the retained chunk");
+
+		arena_release(&arena);
+		assert_null(arena.chunks);
+	}
+
+	arena_release(&arena);
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "arena_alloc should return suitably aligned memory", arena_alloc_alignment_test },
+			{ "arena_alloc should allocate objects larger than the chunk size", arena_alloc_large_test },
+			{ "arena_reset should keep a single chunk for reuse", arena_reset_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
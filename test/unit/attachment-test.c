@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "git/attachment.h"
+#include "git/object-coprocess.h"
+#include "fs-utils.h"
+
+#define FIXTURE_REPO "attachment-test-repo"
+
+/*
+ * Build a repository with an attachment in two binary chunks, each with null
+ * bytes.
+ * */
+static const char *fixture_script =
+		"set -e\n"
+		"rm -rf " FIXTURE_REPO "\n"
+		"git init -q -b master " FIXTURE_REPO "\n"
+		"cd " FIXTURE_REPO "\n"
+		"git config user.name test\n"
+		"git config user.email test@example.com\n"
+		"git config commit.gpgsign false\n"
+		"mkdir -p .git-chat/attachments/0\n"
+		"printf '\\205\\000first\\000' > .git-chat/attachments/0/0\n"
+		"printf 'second\\000\\001' > .git-chat/attachments/0/1\n"
+		"git add .git-chat\n"
+		"git commit -q -m attachment\n";
+
+#define FIXTURE_CIPHERTEXT "\205\000first\000second\000\001"
+
+/**
+ * Read the whole attachment with small reads, so that reads span chunks.
+ * */
+static ssize_t read_attachment(struct attachment_reader *reader, struct strbuf *out)
+{
+	char buffer[3];
+	ssize_t bytes_read;
+
+	while ((bytes_read = attachment_reader_read(reader, buffer, sizeof(buffer))) > 0)
+		strbuf_attach_bytes(out, buffer, bytes_read);
+
+	return bytes_read;
+}
+
+TEST_DEFINE(attachment_manifest_format_parse_test)
+{
+	struct attachment_manifest manifest, parsed;
+	struct strbuf header;
+
+	attachment_manifest_init(&manifest);
+	attachment_manifest_init(&parsed);
+	strbuf_init(&header);
+
+	TEST_START() {
+		attachment_manifest_add(&manifest, "build.log", 3145728, 4);
+		attachment_manifest_add(&manifest, "core summary.txt", 0, 1);
+		attachment_manifest_format(&manifest, &header);
+
+		assert_string_eq("Git-Chat-Attachment: 4 3145728 build.log\n"
+				"Git-Chat-Attachment: 1 0 core summary.txt\n", header.buff);
+
+		assert_zero(attachment_manifest_parse(&parsed, header.buff, header.len));
+		assert_eq(2, parsed.len);
+		assert_string_eq("build.log", parsed.entries[0].name.buff);
+		assert_eq(3145728, parsed.entries[0].size);
+		assert_eq(4, parsed.entries[0].chunks);
+		assert_string_eq("core summary.txt", parsed.entries[1].name.buff);
+		assert_eq(0, parsed.entries[1].size);
+		assert_eq(1, parsed.entries[1].chunks);
+	}
+
+	strbuf_release(&header);
+	attachment_manifest_release(&parsed);
+	attachment_manifest_release(&manifest);
+
+	TEST_END();
+}
+
+TEST_DEFINE(attachment_manifest_parse_header_test)
+{
+	struct attachment_manifest manifest;
+
+	const char *body = "Git-Chat-Epoch: 0123456789abcdef0123456789abcdef\n"
+			"Git-Chat-Attachment: 2 1048577 trace.txt\n"
+			"\n"
+			"-----BEGIN PGP MESSAGE-----\n"
+			"Git-Chat-Attachment: 1 10 not-in-header.txt\n";
+
+	attachment_manifest_init(&manifest);
+
+	TEST_START() {
+		assert_zero(attachment_manifest_parse(&manifest, body, strlen(body)));
+		assert_eq(1, manifest.len);
+		assert_string_eq("trace.txt", manifest.entries[0].name.buff);
+
+		attachment_manifest_release(&manifest);
+		assert_zero(attachment_manifest_parse(&manifest, "-----BEGIN PGP MESSAGE-----\n", 28));
+		assert_zero(manifest.len);
+	}
+
+	attachment_manifest_release(&manifest);
+
+	TEST_END();
+}
+
+TEST_DEFINE(attachment_manifest_parse_malformed_test)
+{
+	struct attachment_manifest manifest;
+
+	const char *malformed[] = {
+			"Git-Chat-Attachment: 0 10 empty.txt\n",
+			"Git-Chat-Attachment: 1 10\n",
+			"Git-Chat-Attachment: 1 10 \n",
+			"Git-Chat-Attachment: x 10 name.txt\n",
+			"Git-Chat-Attachment: 1 10 ../escape.txt\n",
+			"Git-Chat-Attachment: 1 99999999999999999999999 huge.txt\n",
+			NULL
+	};
+
+	attachment_manifest_init(&manifest);
+
+	TEST_START() {
+		for (const char **body = malformed; *body; body++) {
+			assert_nonzero(attachment_manifest_parse(&manifest, *body, strlen(*body)));
+			assert_zero(manifest.len);
+		}
+	}
+
+	attachment_manifest_release(&manifest);
+
+	TEST_END();
+}
+
+TEST_DEFINE(attachment_reader_binary_chunks_test)
+{
+	struct attachment_reader native, subprocess;
+	struct strbuf cwd, native_out, subprocess_out;
+	int changed_dir = 0, opened = 0;
+
+	strbuf_init(&cwd);
+	strbuf_init(&native_out);
+	strbuf_init(&subprocess_out);
+
+	TEST_START() {
+		const char expected[] = FIXTURE_CIPHERTEXT;
+		size_t expected_len = sizeof(expected) - 1;
+
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		int native_ret = attachment_reader_open(&native, "HEAD", 0, 2);
+		int subprocess_ret = attachment_reader_open(&subprocess, "HEAD", 0, 2);
+		opened = 1;
+		assert_zero(native_ret);
+		assert_zero(subprocess_ret);
+
+		// read the chunks with git-cat-file rather than the object database
+		subprocess.native = 0;
+
+		assert_zero(read_attachment(&native, &native_out));
+		assert_zero(read_attachment(&subprocess, &subprocess_out));
+
+		assert_eq(expected_len, native_out.len);
+		assert_zero(memcmp(expected, native_out.buff, expected_len));
+		assert_eq(expected_len, subprocess_out.len);
+		assert_zero(memcmp(expected, subprocess_out.buff, expected_len));
+	}
+
+	if (opened) {
+		attachment_reader_release(&subprocess);
+		attachment_reader_release(&native);
+	}
+	object_coprocess_stop();
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&subprocess_out);
+	strbuf_release(&native_out);
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "attachment manifests should survive a format and parse round trip", attachment_manifest_format_parse_test },
+			{ "attachment manifests should only be parsed from the message header", attachment_manifest_parse_header_test },
+			{ "malformed attachment manifests should be rejected", attachment_manifest_parse_malformed_test },
+			{ "attachment readers should read binary chunks in full", attachment_reader_binary_chunks_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
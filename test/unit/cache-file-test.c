@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "test-lib.h"
+#include "cache/cache-file.h"
+#include "fs-utils.h"
+
+#define FIXTURE_SPACE "cache-file-test-space"
+#define CACHE_NAME "test-cache"
+#define CACHE_PATH ".git/chat-cache/" CACHE_NAME
+#define LOCK_PATH CACHE_PATH ".lock"
+
+// larger than any pid_max, so no process can have it
+#define DEAD_PID "2147483646"
+
+static const char *fixture_script =
+		"rm -rf " FIXTURE_SPACE " && "
+		"mkdir -p " FIXTURE_SPACE "/.git/chat-cache";
+
+static int write_file(const char *path, const char *content)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return 1;
+
+	ssize_t len = (ssize_t) strlen(content);
+	int ret = xwrite(fd, content, len) != len;
+	close(fd);
+
+	return ret;
+}
+
+static int read_file(const char *path, struct strbuf *content)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	strbuf_clear(content);
+	strbuf_attach_fd(content, fd);
+	close(fd);
+
+	return 0;
+}
+
+TEST_DEFINE(cache_file_lock_held_test)
+{
+	struct strbuf cwd, content, expected;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	strbuf_init(&content);
+	strbuf_init(&expected);
+
+	TEST_START() {
+		struct cache_lock lock, other;
+
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_SPACE));
+		changed_dir = 1;
+
+		// the lock file names its holder while the lock is held
+		assert_zero(cache_file_lock(&lock, CACHE_NAME));
+		assert_zero(read_file(LOCK_PATH, &content));
+		strbuf_attach_fmt(&expected, "%d\n", (int) getpid());
+		assert_string_eq(expected.buff, content.buff);
+
+		// a lock held by a live process is not stale
+		assert_nonzero(cache_file_lock(&other, CACHE_NAME));
+
+		cache_file_rollback(&lock);
+		assert_true(access(LOCK_PATH, F_OK) < 0);
+
+		assert_zero(cache_file_lock(&lock, CACHE_NAME));
+		assert_zero(cache_file_commit(&lock, "content", strlen("content")));
+		assert_true(access(LOCK_PATH, F_OK) < 0);
+		assert_zero(read_file(CACHE_PATH, &content));
+		assert_string_eq("content", content.buff);
+	}
+
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&expected);
+	strbuf_release(&content);
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+TEST_DEFINE(cache_file_lock_stale_test)
+{
+	struct strbuf cwd, content, pid;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	strbuf_init(&content);
+	strbuf_init(&pid);
+
+	TEST_START() {
+		struct cache_lock lock;
+
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_SPACE));
+		changed_dir = 1;
+
+		// locks left by processes that no longer exist are reclaimed
+		assert_zero(write_file(LOCK_PATH, DEAD_PID "\n"));
+		assert_zero(cache_file_lock(&lock, CACHE_NAME));
+		assert_zero(cache_file_commit(&lock, "reclaimed", strlen("reclaimed")));
+		assert_zero(read_file(CACHE_PATH, &content));
+		assert_string_eq("reclaimed", content.buff);
+
+		struct timeval times[2] = { 0 };
+		times[0].tv_sec = times[1].tv_sec = time(NULL) - CACHE_LOCK_STALE_SECONDS - 60;
+
+		// locks of live processes are never stale, however old
+		strbuf_attach_fmt(&pid, "%d\n", (int) getpid());
+		assert_zero(write_file(LOCK_PATH, pid.buff));
+		assert_zero(utimes(LOCK_PATH, times));
+		assert_nonzero(cache_file_lock(&lock, CACHE_NAME));
+
+		// fresh locks without a pid may still be written by their holder
+		assert_zero(write_file(LOCK_PATH, ""));
+		assert_nonzero(cache_file_lock(&lock, CACHE_NAME));
+
+		// but not once they are old enough
+		assert_zero(utimes(LOCK_PATH, times));
+		assert_zero(cache_file_lock(&lock, CACHE_NAME));
+		cache_file_rollback(&lock);
+		assert_true(access(LOCK_PATH, F_OK) < 0);
+	}
+
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&pid);
+	strbuf_release(&content);
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+struct test_entry {
+	struct hashmap_entry ent;
+	int key;
+	int value;
+};
+
+static int test_entry_cmp(const void *entry, const void *entry_or_key, const void *keydata)
+{
+	const struct test_entry *a = entry;
+	const struct test_entry *b = entry_or_key;
+	(void) keydata;
+
+	return a->key != b->key;
+}
+
+static int test_entry_same(const void *a, const void *b)
+{
+	return ((const struct test_entry *) a)->value == ((const struct test_entry *) b)->value;
+}
+
+// negative values are only kept in memory
+static int test_entry_stored(const void *entry)
+{
+	return ((const struct test_entry *) entry)->value >= 0;
+}
+
+static const struct keyed_cache_type test_cache_type = {
+	.file = CACHE_NAME,
+	.header = "test cache\n",
+	.name = "test cache",
+	.entries = "entries",
+	.cmp = test_entry_cmp,
+	.same_value = test_entry_same,
+	.stored = test_entry_stored,
+	.free = free
+};
+
+static void put_test_entry(struct keyed_cache *cache, int key, int value)
+{
+	struct test_entry *entry = malloc(sizeof(struct test_entry));
+	hashmap_entry_init(entry, key);
+	entry->key = key;
+	entry->value = value;
+
+	keyed_cache_put(cache, entry);
+}
+
+static int get_test_entry(struct keyed_cache *cache, int key)
+{
+	struct test_entry lookup;
+	hashmap_entry_init(&lookup, key);
+	lookup.key = key;
+
+	struct test_entry *entry = keyed_cache_get(cache, &lookup, NULL);
+	return entry ? entry->value : -100;
+}
+
+TEST_DEFINE(keyed_cache_put_test)
+{
+	struct keyed_cache cache;
+	keyed_cache_init(&cache, &test_cache_type);
+
+	TEST_START() {
+		put_test_entry(&cache, 1, 10);
+		assert_true(cache.dirty);
+		assert_eq(10, get_test_entry(&cache, 1));
+
+		// putting the same value again leaves the cache clean
+		cache.dirty = 0;
+		put_test_entry(&cache, 1, 10);
+		assert_false(cache.dirty);
+		assert_eq(1, cache.entries.size);
+
+		put_test_entry(&cache, 1, 11);
+		assert_true(cache.dirty);
+		assert_eq(11, get_test_entry(&cache, 1));
+		assert_eq(1, cache.entries.size);
+
+		// entries that aren't stored don't need the cache to be written
+		cache.dirty = 0;
+		put_test_entry(&cache, 2, -1);
+		assert_false(cache.dirty);
+		assert_eq(-1, get_test_entry(&cache, 2));
+		assert_eq(-100, get_test_entry(&cache, 3));
+	}
+
+	keyed_cache_release(&cache);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "cache locks should not be taken while held by a live process", cache_file_lock_held_test },
+			{ "stale cache locks should be reclaimed", cache_file_lock_stale_test },
+			{ "keyed caches should only become dirty when entries change", keyed_cache_put_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "test-lib.h"
+#include "git/cat-file-stream.h"
+#include "strbuf.h"
+#include "utils.h"
+
+#define DELIM "0123456789abcdef"
+#define OID_A "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+#define OID_B "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"
+
+/*
+ * Fork a child that writes `len` bytes from `data` to a pipe in chunks of
+ * `chunk_len` bytes, returning the read end of the pipe.
+ * */
+static int feed_pipe(const char *data, size_t len, size_t chunk_len, pid_t *pid)
+{
+	int fds[2];
+	if (pipe(fds) < 0)
+		return -1;
+
+	*pid = fork();
+	if (*pid < 0)
+		return -1;
+
+	if (!*pid) {
+		close(fds[0]);
+		for (size_t written = 0; written < len; written += chunk_len) {
+			size_t remaining = len - written;
+			if (xwrite(fds[1], data + written, remaining < chunk_len ? remaining : chunk_len) < 0)
+				_exit(1);
+		}
+
+		_exit(0);
+	}
+
+	close(fds[1]);
+	return fds[0];
+}
+
+static int wait_for_feeder(pid_t pid)
+{
+	int status;
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+static void append_object(struct strbuf *out, const char *oid, const char *type,
+		const char *data, size_t len)
+{
+	strbuf_attach_fmt(out, "%s %s %s %zu\n", DELIM, oid, type, len);
+	strbuf_attach(out, data, len);
+	strbuf_attach_chr(out, '\n');
+}
+
+TEST_DEFINE(cat_file_stream_read_objects_test)
+{
+	struct strbuf output;
+	struct cat_file_stream stream;
+	struct cat_file_object obj;
+	int fd = -1;
+	pid_t pid = -1;
+
+	strbuf_init(&output);
+	append_object(&output, OID_A, "commit", "tree abc\n\nfirst message\n", 24);
+	append_object(&output, OID_B, "blob", "", 0);
+	append_object(&output, OID_A, "commit", "tree def\n\nsecond\n", 17);
+
+	TEST_START() {
+		// feed one byte at a time to exercise partial summary lines and objects
+		fd = feed_pipe(output.buff, output.len, 1, &pid);
+		assert_true(fd >= 0);
+
+		cat_file_stream_init(&stream, fd, DELIM, 8);
+
+		assert_zero(cat_file_stream_next(&stream, &obj));
+		assert_zero(memcmp(OID_A, obj.oid, GIT_HEX_OBJECT_ID));
+		assert_eq(6, obj.type_len);
+		assert_zero(memcmp("commit", obj.type, obj.type_len));
+		assert_eq(24, obj.len);
+		assert_zero(memcmp("tree abc\n\nfirst message\n", obj.data, obj.len));
+
+		assert_zero(cat_file_stream_next(&stream, &obj));
+		assert_zero(memcmp(OID_B, obj.oid, GIT_HEX_OBJECT_ID));
+		assert_zero(memcmp("blob", obj.type, obj.type_len));
+		assert_eq(0, obj.len);
+
+		assert_zero(cat_file_stream_next(&stream, &obj));
+		assert_eq(17, obj.len);
+		assert_zero(memcmp("tree def\n\nsecond\n", obj.data, obj.len));
+
+		assert_true(cat_file_stream_next(&stream, &obj) > 0);
+		assert_true(cat_file_stream_next(&stream, &obj) > 0);
+
+		cat_file_stream_release(&stream);
+		assert_zero(wait_for_feeder(pid));
+		pid = -1;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	if (pid > 0)
+		wait_for_feeder(pid);
+
+	strbuf_release(&output);
+	TEST_END();
+}
+
+TEST_DEFINE(cat_file_stream_large_objects_test)
+{
+	struct strbuf output;
+	struct cat_file_stream stream;
+	struct cat_file_object obj;
+	size_t large_len = 3 * CAT_FILE_DEFAULT_BUFFER_SIZE + 7;
+	char *large = NULL;
+	int fd = -1;
+	pid_t pid = -1;
+
+	strbuf_init(&output);
+
+	TEST_START() {
+		large = malloc(large_len);
+		assert_nonnull(large);
+		for (size_t i = 0; i < large_len; i++)
+			large[i] = (char) ('a' + (i % 26));
+
+		for (int i = 0; i < 16; i++)
+			append_object(&output, OID_A, "commit", large, i % 2 ? large_len : 13);
+
+		fd = feed_pipe(output.buff, output.len, 4096, &pid);
+		assert_true(fd >= 0);
+
+		cat_file_stream_init(&stream, fd, DELIM, 0);
+		for (int i = 0; i < 16; i++) {
+			assert_zero_msg(cat_file_stream_next(&stream, &obj), "failed to read object %d", i);
+			assert_eq(i % 2 ? large_len : 13, obj.len);
+			assert_zero(memcmp(large, obj.data, obj.len));
+		}
+
+		assert_true(cat_file_stream_next(&stream, &obj) > 0);
+
+		cat_file_stream_release(&stream);
+		assert_zero(wait_for_feeder(pid));
+		pid = -1;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	if (pid > 0)
+		wait_for_feeder(pid);
+
+	free(large);
+	strbuf_release(&output);
+	TEST_END();
+}
+
+TEST_DEFINE(cat_file_stream_malformed_test)
+{
+	const char *inputs[] = {
+			"fedcba9876543210 " OID_A " commit 3\nabc\n",
+			DELIM " " OID_A " commit 3x\nabc\n",
+			DELIM " " OID_A " commit 10\nabc\n",
+			DELIM " short commit 3\nabc\n",
+			NULL
+	};
+
+	struct cat_file_stream stream;
+	struct cat_file_object obj;
+	int fd = -1;
+	pid_t pid = -1;
+
+	TEST_START() {
+		for (const char **input = inputs; *input; input++) {
+			fd = feed_pipe(*input, strlen(*input), 64, &pid);
+			assert_true(fd >= 0);
+
+			cat_file_stream_init(&stream, fd, DELIM, 0);
+			int ret = cat_file_stream_next(&stream, &obj);
+			cat_file_stream_release(&stream);
+
+			close(fd);
+			fd = -1;
+			wait_for_feeder(pid);
+			pid = -1;
+
+			assert_true_msg(ret < 0, "expected '%s' to fail to parse", *input);
+		}
+	}
+
+	if (fd >= 0)
+		close(fd);
+	if (pid > 0)
+		wait_for_feeder(pid);
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "cat_file_stream_next should read objects split across reads", cat_file_stream_read_objects_test },
+			{ "cat_file_stream_next should grow the buffer for large objects", cat_file_stream_large_objects_test },
+			{ "cat_file_stream_next should reject malformed output", cat_file_stream_malformed_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -26,6 +26,10 @@ TEST_DEFINE(config_default_get_default_value_matching)
 		assert_string_eq("", value);
 		value = get_default_config_value("channel.a.name");
 		assert_string_eq("", value);
+		value = get_default_config_value("channel.master.groupkey");
+		assert_string_eq("false", value);
+		value = get_default_config_value("message.storage");
+		assert_string_eq("armor", value);
 	}
 
 	TEST_END();
@@ -38,6 +42,8 @@ TEST_DEFINE(is_recognized_key_test)
 		assert_nonzero(is_recognized_config_key("channel.testme.name"));
 		assert_nonzero(is_recognized_config_key("channel.\"testme\".name"));
 		assert_nonzero(is_recognized_config_key("channel.\"test.me\".name"));
+		assert_zero(is_recognized_config_key("decrypt.jobs"));
+		assert_nonzero(is_recognized_config_key("channel.test.epoch"));
 		assert_zero(is_recognized_config_key("unknown"));
 		assert_zero(is_recognized_config_key("channel.test.test.name"));
 		assert_zero(is_recognized_config_key("channel. invalid .createdby"));
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "gnupg/decryption-pool.h"
+
+#define POOL_TEST_WORKERS 2
+#define POOL_TEST_JOBS 20
+
+struct emitted_jobs {
+	int ids[POOL_TEST_JOBS];
+	int known[POOL_TEST_JOBS];
+	int match[POOL_TEST_JOBS];
+	enum message_type types[POOL_TEST_JOBS];
+	struct strbuf messages[POOL_TEST_JOBS];
+	int len;
+	int stop_after;
+	struct decryption_pool *pool;
+};
+
+/*
+ * Matcher that holds on to earlier jobs longer than later ones, so that the
+ * workers finish the jobs of each window in reverse order.
+ * */
+static int slow_matcher(const struct git_commit *commit, const struct strbuf *message,
+		enum message_type type, void *data)
+{
+	int id = commit->commit_id.id[0];
+	usleep((POOL_TEST_JOBS - id) * 2000);
+
+	return id % 3 == 0;
+}
+
+static int record_job(struct git_commit *commit, struct strbuf *message,
+		enum message_type type, void *data)
+{
+	struct emitted_jobs *emitted = (struct emitted_jobs *) data;
+
+	int i = emitted->len++;
+	emitted->ids[i] = commit->commit_id.id[0];
+	emitted->known[i] = decryption_pool_emitted_known(emitted->pool);
+	emitted->match[i] = decryption_pool_emitted_match(emitted->pool);
+	emitted->types[i] = type;
+	strbuf_attach(&emitted->messages[i], message->buff, message->len);
+
+	return emitted->stop_after && emitted->len >= emitted->stop_after;
+}
+
+/*
+ * Submit jobs alternating between messages already known to the caller and
+ * plaintext messages that the pool resolves itself. Neither needs gpg.
+ * */
+static int submit_jobs(struct decryption_pool *pool)
+{
+	char body[32];
+	struct strbuf known;
+	strbuf_init(&known);
+
+	int ret = 0;
+	for (int i = 0; i < POOL_TEST_JOBS && !ret; i++) {
+		struct git_commit_view view;
+		memset(&view, 0, sizeof(view));
+		view.commit_id.id[0] = (unsigned char) i;
+
+		if (i % 2) {
+			snprintf(body, sizeof(body), "plaintext message %d\n", i);
+			view.body = body;
+			view.body_len = strlen(body);
+			ret = decryption_pool_add(pool, &view);
+		} else {
+			strbuf_clear(&known);
+			strbuf_attach_fmt(&known, "known message %d", i);
+			ret = decryption_pool_add_resolved(pool, &view, DECRYPTED, &known);
+		}
+	}
+
+	strbuf_release(&known);
+
+	return ret;
+}
+
+static void emitted_jobs_init(struct emitted_jobs *emitted, struct decryption_pool *pool)
+{
+	memset(emitted, 0, sizeof(*emitted));
+	for (int i = 0; i < POOL_TEST_JOBS; i++)
+		strbuf_init(&emitted->messages[i]);
+	emitted->pool = pool;
+}
+
+static void emitted_jobs_release(struct emitted_jobs *emitted)
+{
+	for (int i = 0; i < POOL_TEST_JOBS; i++)
+		strbuf_release(&emitted->messages[i]);
+}
+
+TEST_DEFINE(decryption_pool_submission_order_test)
+{
+	struct decryption_pool pool;
+	struct emitted_jobs emitted;
+	struct strbuf expected;
+
+	emitted_jobs_init(&emitted, &pool);
+	strbuf_init(&expected);
+
+	TEST_START() {
+		decryption_pool_init(&pool, POOL_TEST_WORKERS, record_job, &emitted);
+		decryption_pool_use_matcher(&pool, slow_matcher, NULL);
+
+		assert_zero(submit_jobs(&pool));
+		assert_zero(decryption_pool_finish(&pool));
+
+		assert_eq(POOL_TEST_JOBS, emitted.len);
+		for (int i = 0; i < POOL_TEST_JOBS; i++) {
+			assert_eq_msg(i, emitted.ids[i], "job %d was emitted out of order", i);
+			assert_eq(i % 3 == 0, emitted.match[i]);
+
+			if (i % 2) {
+				assert_false_msg(emitted.known[i], "job %d should not be known", i);
+				assert_eq(PLAINTEXT, emitted.types[i]);
+				assert_zero(emitted.messages[i].len);
+			} else {
+				assert_true_msg(emitted.known[i], "job %d should be known", i);
+				assert_eq(DECRYPTED, emitted.types[i]);
+
+				strbuf_clear(&expected);
+				strbuf_attach_fmt(&expected, "known message %d", i);
+				assert_string_eq(expected.buff, emitted.messages[i].buff);
+			}
+		}
+	}
+
+	strbuf_release(&expected);
+	emitted_jobs_release(&emitted);
+
+	TEST_END();
+}
+
+TEST_DEFINE(decryption_pool_stop_test)
+{
+	struct decryption_pool pool;
+	struct emitted_jobs emitted;
+
+	emitted_jobs_init(&emitted, &pool);
+	emitted.stop_after = 5;
+
+	TEST_START() {
+		decryption_pool_init(&pool, POOL_TEST_WORKERS, record_job, &emitted);
+		decryption_pool_use_matcher(&pool, slow_matcher, NULL);
+
+		assert_nonzero(submit_jobs(&pool));
+		assert_nonzero(decryption_pool_finish(&pool));
+
+		assert_eq(5, emitted.len);
+		for (int i = 0; i < emitted.len; i++)
+			assert_eq_msg(i, emitted.ids[i], "job %d was emitted out of order", i);
+	}
+
+	emitted_jobs_release(&emitted);
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "decryption pool should emit jobs in submission order", decryption_pool_submission_order_test },
+			{ "decryption pool should stop emitting when the callback fails", decryption_pool_stop_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
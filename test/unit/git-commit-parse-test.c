@@ -8,6 +8,8 @@
 #define HEADER_PREFIX_COMMITTER "committer "
 
 #define OID_VALID "e4854A7f9bca6ac1bcaee3f1e8587f6953d542c0"
+#define OID_OTHER "0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c"
+#define BLOB_ID "3f9a0c52be0d1f0b8d3b6c8d8a8e0b7e4f3c2a10"
 #define SIGNATURE_NAME "Brandon Richardson"
 #define SIGNATURE_EMAIL "brandon.richardson@example.com"
 #define SIGNATURE_TIMESTAMP "1602873674 -0300"
@@ -497,6 +499,193 @@ TEST_DEFINE(commit_parse_skip_unknown_headers_test)
 	TEST_END();
 }
 
+static int points_into(const char *ptr, const char *buffer, size_t len)
+{
+	return ptr >= buffer && ptr < buffer + len;
+}
+
+TEST_DEFINE(commit_parse_view_slices_test)
+{
+	struct git_commit_view view;
+	struct arena arena;
+	const char *commit_raw =
+			HEADER_PREFIX_TREE OID_VALID "\n"
+			HEADER_PREFIX_PARENT OID_VALID "\n"
+			HEADER_PREFIX_AUTHOR " " SIGNATURE_NAME "  <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			"  this is a test message\n\n";
+	size_t len = strlen(commit_raw);
+
+	arena_init(&arena, 0);
+
+	TEST_START() {
+		int ret = commit_parse_view(&view, &arena, OID_VALID, commit_raw, len);
+		assert_zero_msg(ret, "failed to parse commit");
+
+		// string fields should be trimmed slices of the raw commit object
+		assert_true(points_into(view.author.name, commit_raw, len));
+		assert_eq(strlen(SIGNATURE_NAME), view.author.name_len);
+		assert_zero(memcmp(SIGNATURE_NAME, view.author.name, view.author.name_len));
+		assert_true(points_into(view.committer.email, commit_raw, len));
+		assert_eq(strlen(SIGNATURE_EMAIL), view.committer.email_len);
+		assert_zero(memcmp(SIGNATURE_EMAIL, view.committer.email, view.committer.email_len));
+		assert_eq((int64_t) 1602873674, view.committer.timestamp.time);
+
+		assert_true(points_into(view.body, commit_raw, len));
+		assert_eq(strlen("this is a test message"), view.body_len);
+		assert_zero(memcmp("this is a test message", view.body, view.body_len));
+
+		// the blob is left to the traversal
+		assert_null(view.blob);
+		assert_zero(view.blob_len);
+	}
+
+	arena_release(&arena);
+
+	TEST_END();
+}
+
+TEST_DEFINE(commit_parse_view_arena_test)
+{
+	struct git_commit_view first, second;
+	struct git_commit commit;
+	struct arena arena;
+	const char *merge_raw =
+			HEADER_PREFIX_TREE OID_VALID "\n"
+			HEADER_PREFIX_PARENT OID_VALID "\n"
+			HEADER_PREFIX_PARENT OID_OTHER "\n"
+			HEADER_PREFIX_AUTHOR SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			"merge\n";
+	const char *root_raw =
+			HEADER_PREFIX_TREE OID_OTHER "\n"
+			HEADER_PREFIX_AUTHOR SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			"root\n";
+
+	struct git_oid valid, other;
+	git_str_to_oid(&valid, OID_VALID);
+	git_str_to_oid(&other, OID_OTHER);
+
+	arena_init(&arena, 0);
+	git_commit_object_init(&commit);
+
+	TEST_START() {
+		assert_zero(commit_parse_view(&first, &arena, OID_VALID, merge_raw, strlen(merge_raw)));
+		assert_eq(2, first.parents_commit_ids_len);
+		assert_true(points_into((char *) first.parents_commit_ids,
+				(char *) arena.chunks->data, arena.chunks->used));
+
+		// views parsed into the same arena don't disturb one another
+		assert_zero(commit_parse_view(&second, &arena, OID_OTHER, root_raw, strlen(root_raw)));
+		assert_zero(second.parents_commit_ids_len);
+		assert_true(oid_eq(&first.parents_commit_ids[0], &valid));
+		assert_true(oid_eq(&first.parents_commit_ids[1], &other));
+
+		// a copy outlives the arena
+		git_commit_from_view(&commit, &first);
+		struct git_oid *parents = first.parents_commit_ids;
+		arena_reset(&arena);
+
+		assert_eq(2, commit.parents_commit_ids_len);
+		assert_true(commit.parents_commit_ids != parents);
+		assert_true(oid_eq(&commit.parents_commit_ids[0], &valid));
+		assert_true(oid_eq(&commit.parents_commit_ids[1], &other));
+		assert_string_eq(SIGNATURE_NAME, commit.author.name.buff);
+		assert_string_eq("merge", commit.body.buff);
+
+		// once reset, the arena hands out the same memory again
+		assert_zero(commit_parse_view(&first, &arena, OID_VALID, merge_raw, strlen(merge_raw)));
+		assert_true(first.parents_commit_ids == parents);
+	}
+
+	git_commit_object_release(&commit);
+	arena_release(&arena);
+
+	TEST_END();
+}
+
+TEST_DEFINE(commit_parse_view_invalid_test)
+{
+	struct git_commit_view view;
+	struct arena arena;
+	const char *commits[] = {
+			HEADER_PREFIX_PARENT OID_VALID "\n"
+			HEADER_PREFIX_AUTHOR SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			"missing tree\n",
+			HEADER_PREFIX_TREE OID_VALID "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			"missing author\n",
+			HEADER_PREFIX_TREE OID_VALID "\n"
+			HEADER_PREFIX_AUTHOR SIGNATURE_NAME " " SIGNATURE_EMAIL " " SIGNATURE_TIMESTAMP "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			"missing email delimiters\n",
+			NULL
+	};
+
+	arena_init(&arena, 0);
+
+	TEST_START() {
+		for (const char **raw = commits; *raw; raw++) {
+			int ret = commit_parse_view(&view, &arena, OID_VALID, *raw, strlen(*raw));
+			assert_nonzero_msg(ret, "expected commit_parse_view to fail for commit:\n%s", *raw);
+		}
+	}
+
+	arena_release(&arena);
+
+	TEST_END();
+}
+
+TEST_DEFINE(commit_body_ciphertext_blob_test)
+{
+	struct git_commit_view view;
+	struct arena arena;
+	struct git_oid oid, expected;
+	const char *commit_raw =
+			HEADER_PREFIX_TREE OID_VALID "\n"
+			HEADER_PREFIX_AUTHOR SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			HEADER_PREFIX_COMMITTER SIGNATURE_NAME " <" SIGNATURE_EMAIL "> " SIGNATURE_TIMESTAMP "\n"
+			"\n"
+			COMMIT_CIPHERTEXT_TRAILER BLOB_ID "\n";
+
+	arena_init(&arena, 0);
+	git_str_to_oid(&expected, BLOB_ID);
+
+	TEST_START() {
+		// the trailer is found in the body of a parsed view
+		assert_zero(commit_parse_view(&view, &arena, OID_VALID, commit_raw, strlen(commit_raw)));
+		assert_zero(commit_body_ciphertext_blob(view.body, view.body_len, &oid));
+		assert_true(oid_eq(&expected, &oid));
+
+		const char *body = "Git-Chat-Epoch: 0123456789abcdef0123456789abcdef\n"
+				COMMIT_CIPHERTEXT_TRAILER BLOB_ID;
+		assert_zero(commit_body_ciphertext_blob(body, strlen(body), &oid));
+
+		// the trailer must be the last line, and start at the beginning of the line
+		body = COMMIT_CIPHERTEXT_TRAILER BLOB_ID "\nmore text";
+		assert_nonzero(commit_body_ciphertext_blob(body, strlen(body), &oid));
+		body = "text " COMMIT_CIPHERTEXT_TRAILER BLOB_ID;
+		assert_nonzero(commit_body_ciphertext_blob(body, strlen(body), &oid));
+
+		body = COMMIT_CIPHERTEXT_TRAILER "not an object id";
+		assert_nonzero(commit_body_ciphertext_blob(body, strlen(body), &oid));
+		body = "this is a test message";
+		assert_nonzero(commit_body_ciphertext_blob(body, strlen(body), &oid));
+	}
+
+	arena_release(&arena);
+
+	TEST_END();
+}
+
 const char *suite_name = SUITE_NAME;
 int test_suite(struct test_runner_instance *instance)
 {
@@ -511,6 +700,10 @@ int test_suite(struct test_runner_instance *instance)
 			{ "commit_parse should pass when supplied valid signature", commit_parse_valid_signature_test },
 			{ "commit_parse should pass when supplied signature without timestamp", commit_parse_signature_missing_timestamp_test },
 			{ "commit_parse should ignore unrecognized headers", commit_parse_skip_unknown_headers_test },
+			{ "commit_parse_view should reference the raw commit object", commit_parse_view_slices_test },
+			{ "commit_parse_view should allocate parents from the arena", commit_parse_view_arena_test },
+			{ "commit_parse_view should fail for malformed commits", commit_parse_view_invalid_test },
+			{ "commit_body_ciphertext_blob should read the ciphertext trailer", commit_body_ciphertext_blob_test },
 			{NULL, NULL}
 	};
 
@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include "test-lib.h"
+#include "gnupg/group-key.h"
+
+#define EPOCH_ID "0123456789abcdef0123456789abcdef"
+#define ALICE_FPR "A1B2C3D4E5F60718293A4B5C6D7E8F9012345678"
+#define BOB_FPR "0123456789ABCDEF0123456789ABCDEF01234567"
+
+#define WRAPPED_KEY "-----BEGIN PGP MESSAGE-----\n" \
+		"\n" \
+		"hF4DAAAAAAAAAAASAQdAAAAA\n" \
+		"-----END PGP MESSAGE-----\n"
+
+static const char *epoch_data =
+		"git-chat epoch v1\n"
+		"member " BOB_FPR "\n"
+		"member " ALICE_FPR "\n"
+		"\n"
+		WRAPPED_KEY;
+
+static struct _gpgme_key alice = { ._refs = 1, .fpr = ALICE_FPR };
+static struct _gpgme_key bob = { ._refs = 1, .fpr = BOB_FPR };
+
+TEST_DEFINE(group_key_message_epoch_test)
+{
+	TEST_START() {
+		char id[GROUP_KEY_EPOCH_ID_LEN + 1];
+		const char *parsed = id;
+		const char *message = GROUP_KEY_EPOCH_HEADER EPOCH_ID "\n\n" WRAPPED_KEY;
+
+		assert_zero(group_key_message_epoch(message, strlen(message), id));
+		assert_string_eq(EPOCH_ID, parsed);
+
+		message = GROUP_KEY_EPOCH_HEADER EPOCH_ID;
+		assert_zero(group_key_message_epoch(message, strlen(message), id));
+
+		message = WRAPPED_KEY;
+		assert_nonzero(group_key_message_epoch(message, strlen(message), id));
+
+		message = GROUP_KEY_EPOCH_HEADER "0123456789abcdef\n";
+		assert_nonzero(group_key_message_epoch(message, strlen(message), id));
+
+		message = GROUP_KEY_EPOCH_HEADER EPOCH_ID "00\n";
+		assert_nonzero(group_key_message_epoch(message, strlen(message), id));
+
+		message = GROUP_KEY_EPOCH_HEADER "0123456789ABCDEF0123456789ABCDEF\n";
+		assert_nonzero(group_key_message_epoch(message, strlen(message), id));
+
+		assert_true(group_key_is_epoch_id(EPOCH_ID));
+		assert_false(group_key_is_epoch_id(EPOCH_ID "0"));
+		assert_false(group_key_is_epoch_id("../config"));
+	}
+
+	TEST_END();
+}
+
+TEST_DEFINE(group_epoch_parse_test)
+{
+	struct group_epoch epoch;
+	struct strbuf out;
+	struct gpg_key_set members;
+
+	group_epoch_init(&epoch);
+	strbuf_init(&out);
+	gpg_key_set_init(&members);
+
+	// the keys are statically allocated; the set must not release them
+	members.borrowed = 1;
+
+	TEST_START() {
+		assert_zero(group_epoch_parse(&epoch, EPOCH_ID, epoch_data, strlen(epoch_data)));
+		assert_zero(strcmp(EPOCH_ID, epoch.id));
+		assert_eq(2, epoch.members.len);
+		assert_string_eq(BOB_FPR, str_array_get(&epoch.members, 0));
+		assert_string_eq(WRAPPED_KEY, epoch.wrapped_key.buff);
+		assert_zero(epoch.key.len);
+
+		group_epoch_serialize(&epoch, &out);
+		assert_string_eq(epoch_data, out.buff);
+
+		// members are compared regardless of the order of the key set
+		gpg_key_set_add(&members, &alice);
+		assert_false(group_epoch_has_members(&epoch, &members));
+		gpg_key_set_add(&members, &bob);
+		assert_true(group_epoch_has_members(&epoch, &members));
+	}
+
+	gpg_key_set_release(&members);
+	strbuf_release(&out);
+	group_epoch_release(&epoch);
+	TEST_END();
+}
+
+TEST_DEFINE(group_epoch_parse_malformed_test)
+{
+	const char *malformed[] = {
+			"",
+			"git-chat epoch v2\nmember " ALICE_FPR "\n\n" WRAPPED_KEY,
+			"git-chat epoch v1\n\n" WRAPPED_KEY,
+			"git-chat epoch v1\nmember " ALICE_FPR "\n\n",
+			"git-chat epoch v1\nmember " ALICE_FPR "\n" WRAPPED_KEY,
+			"git-chat epoch v1\nmember " ALICE_FPR "\nmember " BOB_FPR "\n\n" WRAPPED_KEY,
+			"git-chat epoch v1\nmember " ALICE_FPR "\nmember " ALICE_FPR "\n\n" WRAPPED_KEY,
+			"git-chat epoch v1\nmember \n\n" WRAPPED_KEY,
+			NULL
+	};
+
+	TEST_START() {
+		for (const char **data = malformed; *data; data++) {
+			struct group_epoch epoch;
+			group_epoch_init(&epoch);
+
+			assert_nonzero(group_epoch_parse(&epoch, EPOCH_ID, *data, strlen(*data)));
+
+			group_epoch_release(&epoch);
+		}
+
+		struct group_epoch epoch;
+		group_epoch_init(&epoch);
+		assert_nonzero(group_epoch_parse(&epoch, "not-an-epoch", epoch_data, strlen(epoch_data)));
+		group_epoch_release(&epoch);
+	}
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "group key should read the epoch from message headers", group_key_message_epoch_test },
+			{ "group epoch should parse and serialize epoch files", group_epoch_parse_test },
+			{ "group epoch should reject malformed epoch files", group_epoch_parse_malformed_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+
+#include "test-lib.h"
+#include "hashmap.h"
+
+struct test_entry {
+	struct hashmap_entry ent;
+	const char *key;
+	int value;
+};
+
+static int test_entry_cmp(const void *entry, const void *entry_or_key,
+		const void *keydata)
+{
+	const struct test_entry *a = entry;
+	const struct test_entry *b = entry_or_key;
+	const char *key = keydata ? (const char *) keydata : b->key;
+
+	return strcmp(a->key, key);
+}
+
+static struct test_entry *test_entry_alloc(const char *key, int value)
+{
+	struct test_entry *entry = (struct test_entry *) malloc(sizeof(struct test_entry));
+	if (!entry)
+		return NULL;
+
+	hashmap_entry_init(entry, strhash(key));
+	entry->key = key;
+	entry->value = value;
+
+	return entry;
+}
+
+static struct test_entry *test_entry_get(struct hashmap *map, const char *key)
+{
+	struct test_entry lookup;
+	hashmap_entry_init(&lookup, strhash(key));
+
+	return hashmap_get(map, &lookup, key);
+}
+
+TEST_DEFINE(hashmap_init_test)
+{
+	struct hashmap map;
+
+	TEST_START() {
+		hashmap_init(&map, test_entry_cmp, 0);
+		assert_nonnull(map.table);
+		assert_zero(map.size);
+		assert_true(map.tablesize > 0);
+
+		hashmap_release(&map, 0);
+		hashmap_init(&map, test_entry_cmp, 1000);
+		assert_true_msg(map.tablesize * 80 / 100 >= 1000,
+				"table too small for initial size (%zu)", map.tablesize);
+	}
+
+	hashmap_release(&map, 0);
+	TEST_END();
+}
+
+TEST_DEFINE(hashmap_put_get_test)
+{
+	struct hashmap map;
+	hashmap_init(&map, test_entry_cmp, 0);
+
+	TEST_START() {
+		hashmap_put(&map, test_entry_alloc("key1", 1));
+		hashmap_put(&map, test_entry_alloc("key2", 2));
+		hashmap_put(&map, test_entry_alloc("key3", 3));
+		assert_eq(3, map.size);
+
+		struct test_entry *entry = test_entry_get(&map, "key2");
+		assert_nonnull(entry);
+		assert_eq(2, entry->value);
+
+		assert_null(test_entry_get(&map, "key4"));
+
+		// replacing an entry should return the old one
+		struct test_entry *old = hashmap_put(&map, test_entry_alloc("key2", 22));
+		assert_nonnull(old);
+		assert_eq(2, old->value);
+		free(old);
+
+		entry = test_entry_get(&map, "key2");
+		assert_nonnull(entry);
+		assert_eq(22, entry->value);
+		assert_eq(3, map.size);
+	}
+
+	hashmap_release(&map, 1);
+	TEST_END();
+}
+
+TEST_DEFINE(hashmap_add_duplicates_test)
+{
+	struct hashmap map;
+	hashmap_init(&map, test_entry_cmp, 0);
+
+	TEST_START() {
+		hashmap_add(&map, test_entry_alloc("dup", 1));
+		hashmap_add(&map, test_entry_alloc("dup", 2));
+		hashmap_add(&map, test_entry_alloc("other", 3));
+		assert_eq(3, map.size);
+
+		int sum = 0, count = 0;
+		struct test_entry *entry = test_entry_get(&map, "dup");
+		while (entry) {
+			sum += entry->value;
+			count++;
+			entry = hashmap_get_next(&map, entry);
+		}
+
+		assert_eq(2, count);
+		assert_eq(3, sum);
+	}
+
+	hashmap_release(&map, 1);
+	TEST_END();
+}
+
+TEST_DEFINE(hashmap_remove_test)
+{
+	struct hashmap map;
+	hashmap_init(&map, test_entry_cmp, 0);
+
+	TEST_START() {
+		hashmap_put(&map, test_entry_alloc("key1", 1));
+		hashmap_put(&map, test_entry_alloc("key2", 2));
+
+		struct test_entry lookup;
+		hashmap_entry_init(&lookup, strhash("key1"));
+		struct test_entry *removed = hashmap_remove(&map, &lookup, "key1");
+		assert_nonnull(removed);
+		assert_eq(1, removed->value);
+		free(removed);
+
+		assert_eq(1, map.size);
+		assert_null(test_entry_get(&map, "key1"));
+		assert_nonnull(test_entry_get(&map, "key2"));
+
+		assert_null(hashmap_remove(&map, &lookup, "key1"));
+	}
+
+	hashmap_release(&map, 1);
+	TEST_END();
+}
+
+TEST_DEFINE(hashmap_rehash_iter_test)
+{
+	struct hashmap map;
+	hashmap_init(&map, test_entry_cmp, 0);
+
+	static char keys[1000][8];
+
+	TEST_START() {
+		for (int i = 0; i < 1000; i++) {
+			snprintf(keys[i], 8, "k%d", i);
+			hashmap_put(&map, test_entry_alloc(keys[i], i));
+		}
+
+		assert_eq(1000, map.size);
+		assert_true(map.tablesize >= 1024);
+
+		for (int i = 0; i < 1000; i++) {
+			struct test_entry *entry = test_entry_get(&map, keys[i]);
+			assert_nonnull_msg(entry, "missing entry for key '%s'", keys[i]);
+			assert_eq(i, entry->value);
+		}
+
+		struct hashmap_iter iter;
+		struct test_entry *entry;
+		long sum = 0, count = 0;
+		hashmap_iter_init(&map, &iter);
+		while ((entry = hashmap_iter_next(&iter))) {
+			sum += entry->value;
+			count++;
+		}
+
+		assert_eq(1000, count);
+		assert_eq(999 * 1000 / 2, sum);
+	}
+
+	hashmap_release(&map, 1);
+	TEST_END();
+}
+
+TEST_DEFINE(hashmap_hash_functions_test)
+{
+	TEST_START() {
+		assert_eq(strhash("abc"), memhash("abc", 3));
+		assert_eq(strihash("ABC"), strihash("abc"));
+		assert_neq(strhash("abc"), strhash("abd"));
+	}
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "hashmap should initialize correctly", hashmap_init_test },
+			{ "hashmap put should insert or replace entries", hashmap_put_get_test },
+			{ "hashmap add should allow duplicate entries", hashmap_add_duplicates_test },
+			{ "hashmap remove should remove entries", hashmap_remove_test },
+			{ "hashmap should rehash and iterate over all entries", hashmap_rehash_iter_test },
+			{ "hash functions should be consistent", hashmap_hash_functions_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,175 @@
+#include <string.h>
+
+#include "test-lib.h"
+#include "cache/key-listing.h"
+
+#define ALICE_FPR "A1B2C3D4E5F60718293A4B5C6D7E8F9012345678"
+#define BOB_FPR "0123456789ABCDEF0123456789ABCDEF01234567"
+
+static const char *listing_data =
+		"git-chat key listing v1\n"
+		"pubring 4096 1700000000 123\n"
+		"secring 0 0 0\n"
+		"key " ALICE_FPR " es 0\n"
+		"uid Alice <alice@example.com>\tAlice\talice@example.com\t\talice@example.com\n"
+		"uid Alice (tab\\there) <a@example.com>\tAlice\ta@example.com\ttab\\there\ta@example.com\n"
+		"key " BOB_FPR " re 1\n";
+
+TEST_DEFINE(key_listing_parse_test)
+{
+	struct key_listing listing;
+	key_listing_init(&listing);
+
+	TEST_START() {
+		assert_zero(key_listing_parse(&listing, listing_data, strlen(listing_data)));
+
+		assert_eq(4096, listing.pubring.size);
+		assert_eq(1700000000, listing.pubring.mtime_sec);
+		assert_eq(123, listing.pubring.mtime_nsec);
+		assert_zero(listing.secring.size);
+		assert_eq(2, listing.len);
+
+		struct key_listing_entry *alice = &listing.keys[0];
+		assert_string_eq(ALICE_FPR, alice->fpr);
+		assert_zero(alice->expires);
+		assert_true(alice->can_encrypt);
+		assert_true(alice->secret);
+		assert_false(alice->revoked);
+		assert_false(alice->expired);
+
+		assert_nonnull(alice->uids);
+		assert_string_eq("Alice", alice->uids->name);
+		assert_string_eq("", alice->uids->comment);
+		assert_nonnull(alice->uids->next);
+		assert_string_eq("tab\there", alice->uids->next->comment);
+		assert_null(alice->uids->next->next);
+
+		// keys whose expiry has passed are expired, whatever their flags
+		struct key_listing_entry *bob = &listing.keys[1];
+		assert_string_eq(BOB_FPR, bob->fpr);
+		assert_true(bob->revoked);
+		assert_true(bob->expired);
+		assert_null(bob->uids);
+	}
+
+	key_listing_release(&listing);
+	TEST_END();
+}
+
+TEST_DEFINE(key_listing_serialize_test)
+{
+	struct key_listing listing, reparsed;
+	struct strbuf out;
+
+	key_listing_init(&listing);
+	key_listing_init(&reparsed);
+	strbuf_init(&out);
+
+	TEST_START() {
+		assert_zero(key_listing_parse(&listing, listing_data, strlen(listing_data)));
+		key_listing_serialize(&listing, &out);
+
+		// bob was expired on load, and is now flagged as such
+		assert_nonnull(strstr(out.buff, "key " BOB_FPR " rxe 1\n"));
+		assert_nonnull(strstr(out.buff, "\ttab\\there\t"));
+
+		assert_zero(key_listing_parse(&reparsed, out.buff, out.len));
+		assert_eq(2, reparsed.len);
+		assert_eq(listing.pubring.mtime_nsec, reparsed.pubring.mtime_nsec);
+		assert_string_eq(listing.keys[0].uids->next->uid, reparsed.keys[0].uids->next->uid);
+	}
+
+	strbuf_release(&out);
+	key_listing_release(&reparsed);
+	key_listing_release(&listing);
+	TEST_END();
+}
+
+static size_t count_matches(struct key_listing *listing, const char *value)
+{
+	size_t count = 0;
+	const struct key_listing_match *match = key_listing_lookup(listing, value);
+	for (; match; match = key_listing_lookup_next(listing, match))
+		count++;
+
+	return count;
+}
+
+TEST_DEFINE(key_listing_lookup_test)
+{
+	struct key_listing listing;
+	key_listing_init(&listing);
+
+	TEST_START() {
+		assert_zero(key_listing_parse(&listing, listing_data, strlen(listing_data)));
+
+		const struct key_listing_match *match = key_listing_lookup(&listing, BOB_FPR);
+		assert_nonnull(match);
+		assert_eq(1, match->pos);
+
+		// both user ids of alice share a name, and each has the same email and address
+		assert_eq(2, count_matches(&listing, "Alice"));
+		assert_eq(2, count_matches(&listing, "a@example.com"));
+		assert_null(key_listing_lookup(&listing, "Carol"));
+
+		// filtering invalidates the index
+		assert_eq(1, key_listing_filter(&listing, key_listing_filter_unusable, NULL));
+		assert_eq(1, listing.len);
+		assert_string_eq(ALICE_FPR, listing.keys[0].fpr);
+		assert_null(key_listing_lookup(&listing, BOB_FPR));
+
+		match = key_listing_lookup(&listing, "alice@example.com");
+		assert_nonnull(match);
+		assert_zero(match->pos);
+
+		assert_eq(1, key_listing_filter(&listing, key_listing_filter_secret, NULL));
+		assert_zero(listing.len);
+		assert_null(key_listing_lookup(&listing, "Alice"));
+	}
+
+	key_listing_release(&listing);
+	TEST_END();
+}
+
+TEST_DEFINE(key_listing_parse_malformed_test)
+{
+	const char *malformed[] = {
+			"",
+			"git-chat key listing v2\npubring 0 0 0\nsecring 0 0 0\n",
+			"git-chat key listing v1\npubring 0 0 0\n",
+			"git-chat key listing v1\npubring 0 0 0\nsecring 0 0 0",
+			"git-chat key listing v1\nsecring 0 0 0\npubring 0 0 0\n",
+			"git-chat key listing v1\npubring 0 0 0\nsecring 0 0 0\nuid a\tb\tc\td\te\n",
+			"git-chat key listing v1\npubring 0 0 0\nsecring 0 0 0\nkey " ALICE_FPR " e\n",
+			"git-chat key listing v1\npubring 0 0 0\nsecring 0 0 0\nkey " ALICE_FPR " e 0\nuid a\tb\tc\n",
+			"git-chat key listing v1\npubring 0 0 0\nsecring 0 0 0\nkey " ALICE_FPR " e 0\nuid a\\\tb\tc\td\te\n",
+			NULL
+	};
+
+	TEST_START() {
+		for (const char **data = malformed; *data; data++) {
+			struct key_listing listing;
+			key_listing_init(&listing);
+
+			assert_nonzero(key_listing_parse(&listing, *data, strlen(*data)));
+
+			key_listing_release(&listing);
+		}
+	}
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "key listing should parse keys, flags and user ids", key_listing_parse_test },
+			{ "key listing should serialize to the same listing", key_listing_serialize_test },
+			{ "key listing lookups should match fingerprints and user id fields", key_listing_lookup_test },
+			{ "key listing should reject malformed content", key_listing_parse_malformed_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
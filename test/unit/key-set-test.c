@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "test-lib.h"
+#include "gnupg/key-set.h"
+#include "gnupg/key-filter.h"
+
+#define ALICE_FPR "A1B2C3D4E5F60718293A4B5C6D7E8F9012345678"
+#define BOB_FPR "0123456789ABCDEF0123456789ABCDEF01234567"
+#define CAROL_FPR "FEDCBA9876543210FEDCBA9876543210FEDCBA98"
+#define ALICE_WORK_FPR "1111111111111111111111111111111111111111"
+
+static struct _gpgme_user_id alice_uid = {
+		.uid = "Alice <alice@example.com>", .name = "Alice",
+		.email = "alice@example.com", .comment = "", .address = "alice@example.com"
+};
+static struct _gpgme_user_id alice_work_uid = {
+		.uid = "Alice <alice@work.example.com>", .name = "Alice",
+		.email = "alice@work.example.com", .comment = "", .address = "alice@work.example.com"
+};
+static struct _gpgme_user_id bob_other_uid = {
+		.uid = "Robert (old) <robert@example.com>", .name = "Robert",
+		.email = "robert@example.com", .comment = "old", .address = "robert@example.com"
+};
+static struct _gpgme_user_id bob_uid = {
+		.next = &bob_other_uid, .uid = "Bob <bob@example.com>", .name = "Bob",
+		.email = "bob@example.com", .comment = "", .address = "bob@example.com"
+};
+static struct _gpgme_user_id carol_uid = {
+		.uid = "Carol <carol@example.com>", .name = "Carol",
+		.email = "carol@example.com", .comment = "", .address = "carol@example.com"
+};
+
+static struct _gpgme_key alice = { ._refs = 1, .uids = &alice_uid, .fpr = ALICE_FPR };
+static struct _gpgme_key bob = { ._refs = 1, .uids = &bob_uid, .fpr = BOB_FPR };
+static struct _gpgme_key carol = { ._refs = 1, .secret = 1, .uids = &carol_uid, .fpr = CAROL_FPR };
+static struct _gpgme_key alice_work = { ._refs = 1, .uids = &alice_work_uid, .fpr = ALICE_WORK_FPR };
+
+/**
+ * Add the test keys to the set. The keys are statically allocated, so take an
+ * extra reference to keep the set from freeing them.
+ * */
+static void add_keys(struct gpg_key_set *set)
+{
+	gpgme_key_t keys[] = { &alice, &bob, &carol, &alice_work };
+
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		gpgme_key_ref(keys[i]);
+		gpg_key_set_add(set, keys[i]);
+	}
+}
+
+static size_t count_matches(struct gpg_key_set *set, enum gpg_key_field field,
+		const char *value)
+{
+	size_t count = 0;
+	const struct gpg_key_set_match *match = gpg_key_set_lookup(set, field, value);
+	for (; match; match = gpg_key_set_lookup_next(set, match))
+		count++;
+
+	return count;
+}
+
+TEST_DEFINE(gpg_key_set_lookup_test)
+{
+	struct gpg_key_set set;
+	gpg_key_set_init(&set);
+	add_keys(&set);
+
+	TEST_START() {
+		const struct gpg_key_set_match *match;
+
+		assert_eq(4, set.len);
+		assert_null(set.keys[set.len]);
+
+		match = gpg_key_set_lookup(&set, GPG_KEY_FPR, BOB_FPR);
+		assert_nonnull(match);
+		assert_eq(1, match->pos);
+		assert_null(gpg_key_set_lookup_next(&set, match));
+
+		// any user id of a key matches
+		match = gpg_key_set_lookup(&set, GPG_KEY_EMAIL, "robert@example.com");
+		assert_nonnull(match);
+		assert_eq(1, match->pos);
+
+		match = gpg_key_set_lookup(&set, GPG_KEY_UID, "Carol <carol@example.com>");
+		assert_nonnull(match);
+		assert_eq(2, match->pos);
+
+		// several keys may share a name
+		assert_eq(2, count_matches(&set, GPG_KEY_NAME, "Alice"));
+		assert_eq(1, count_matches(&set, GPG_KEY_COMMENT, "old"));
+
+		// fields are looked up separately, and exactly
+		assert_null(gpg_key_set_lookup(&set, GPG_KEY_NAME, "alice@example.com"));
+		assert_null(gpg_key_set_lookup(&set, GPG_KEY_NAME, "alice"));
+		assert_null(gpg_key_set_lookup(&set, GPG_KEY_FPR, "0123456789ABCDEF"));
+	}
+
+	gpg_key_set_release(&set);
+	TEST_END();
+}
+
+TEST_DEFINE(gpg_key_set_filter_test)
+{
+	struct gpg_key_set set;
+	gpg_key_set_init(&set);
+	add_keys(&set);
+
+	TEST_START() {
+		const struct gpg_key_set_match *match;
+
+		// index, then filter; lookups must reflect the new positions
+		assert_nonnull(gpg_key_set_lookup(&set, GPG_KEY_FPR, CAROL_FPR));
+		assert_eq(1, gpg_key_set_filter(&set, filter_gpg_secret_keys, NULL));
+		assert_eq(3, set.len);
+		assert_null(set.keys[set.len]);
+		assert_null(gpg_key_set_lookup(&set, GPG_KEY_FPR, CAROL_FPR));
+
+		match = gpg_key_set_lookup(&set, GPG_KEY_FPR, ALICE_WORK_FPR);
+		assert_nonnull(match);
+		assert_eq(2, match->pos);
+
+		unsigned char retain[] = { 0, 1, 1 };
+		assert_eq(1, gpg_key_set_retain(&set, retain));
+		assert_eq(2, set.len);
+		assert_string_eq(BOB_FPR, set.keys[0]->fpr);
+		assert_string_eq(ALICE_WORK_FPR, set.keys[1]->fpr);
+		assert_eq(1, count_matches(&set, GPG_KEY_NAME, "Alice"));
+	}
+
+	gpg_key_set_release(&set);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "gpg key set should find keys by fingerprint and user id fields", gpg_key_set_lookup_test },
+			{ "gpg key set should reindex keys after filtering", gpg_key_set_filter_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "test-lib.h"
+#include "cache/keyring-manifest.h"
+
+static const struct keyring_stamp alice_stamp = { 3120, 1600000000, 250 };
+static const struct keyring_stamp bob_stamp = { 4096, 1600000100, 0 };
+
+static void add_key_files(struct keyring_manifest *manifest)
+{
+	struct str_array fingerprints;
+	str_array_init(&fingerprints);
+
+	str_array_push(&fingerprints, "A1B2C3D4E5F60718293A4B5C6D7E8F9012345678", NULL);
+	keyring_manifest_put(manifest, "alice.gpg", &alice_stamp, &fingerprints);
+
+	str_array_clear(&fingerprints);
+	str_array_push(&fingerprints, "0123456789ABCDEF0123456789ABCDEF01234567",
+			"FEDCBA9876543210FEDCBA9876543210FEDCBA98", NULL);
+	keyring_manifest_put(manifest, "bob and carol.gpg", &bob_stamp, &fingerprints);
+
+	keyring_manifest_put(manifest, "empty.gpg", &bob_stamp, NULL);
+
+	str_array_release(&fingerprints);
+}
+
+TEST_DEFINE(keyring_manifest_serialize_test)
+{
+	struct keyring_manifest manifest, parsed;
+	struct strbuf out;
+
+	keyring_manifest_init(&manifest);
+	keyring_manifest_init(&parsed);
+	strbuf_init(&out);
+
+	TEST_START() {
+		struct keyring_manifest_entry *entry;
+		const char *malformed;
+
+		add_key_files(&manifest);
+		manifest.keyring.size = 1024;
+		manifest.keyring.mtime_sec = 1600000200;
+		manifest.keyring.mtime_nsec = 999999999;
+
+		keyring_manifest_serialize(&manifest, &out);
+		assert_zero(keyring_manifest_parse(&parsed, out.buff, out.len));
+		assert_eq(3, parsed.entries.size);
+		assert_zero(keyring_stamp_cmp(&manifest.keyring, &parsed.keyring));
+
+		entry = keyring_manifest_get(&parsed, "bob and carol.gpg");
+		assert_nonnull(entry);
+		assert_zero(keyring_stamp_cmp(&bob_stamp, &entry->stamp));
+		assert_eq(2, entry->fingerprints.len);
+		assert_string_eq("FEDCBA9876543210FEDCBA9876543210FEDCBA98",
+				str_array_get(&entry->fingerprints, 1));
+
+		entry = keyring_manifest_get(&parsed, "empty.gpg");
+		assert_nonnull(entry);
+		assert_zero(entry->fingerprints.len);
+
+		keyring_manifest_remove(&parsed, "alice.gpg");
+		assert_null(keyring_manifest_get(&parsed, "alice.gpg"));
+		assert_eq(2, parsed.entries.size);
+
+		// malformed manifests are rejected
+		keyring_manifest_release(&parsed);
+		keyring_manifest_init(&parsed);
+		assert_nonzero(keyring_manifest_parse(&parsed, out.buff, out.len - 1));
+
+		keyring_manifest_release(&parsed);
+		keyring_manifest_init(&parsed);
+		malformed = "git-chat keyring manifest v1\nkeyring 1 2\n";
+		assert_nonzero(keyring_manifest_parse(&parsed, malformed, strlen(malformed)));
+
+		keyring_manifest_release(&parsed);
+		keyring_manifest_init(&parsed);
+		malformed = "git-chat keyring manifest v2\nkeyring 1 2 3\n";
+		assert_nonzero(keyring_manifest_parse(&parsed, malformed, strlen(malformed)));
+	}
+
+	strbuf_release(&out);
+	keyring_manifest_release(&parsed);
+	keyring_manifest_release(&manifest);
+	TEST_END();
+}
+
+TEST_DEFINE(keyring_manifest_change_detection_test)
+{
+	struct keyring_manifest manifest;
+
+	keyring_manifest_init(&manifest);
+	add_key_files(&manifest);
+
+	// written after both key files were last modified
+	manifest.written.mtime_sec = 1600000100;
+	manifest.written.mtime_nsec = 1;
+
+	TEST_START() {
+		struct keyring_manifest_entry *alice = keyring_manifest_get(&manifest, "alice.gpg");
+		struct keyring_manifest_entry *bob = keyring_manifest_get(&manifest, "bob and carol.gpg");
+		struct keyring_stamp stamp;
+
+		assert_true(keyring_manifest_entry_is_current(&manifest, alice, &alice_stamp));
+		assert_true(keyring_manifest_entry_is_current(&manifest, bob, &bob_stamp));
+
+		stamp = alice_stamp;
+		stamp.size++;
+		assert_false(keyring_manifest_entry_is_current(&manifest, alice, &stamp));
+
+		stamp = alice_stamp;
+		stamp.mtime_nsec++;
+		assert_false(keyring_manifest_entry_is_current(&manifest, alice, &stamp));
+
+		// modified in the same instant the manifest was written
+		manifest.written.mtime_nsec = 0;
+		assert_false(keyring_manifest_entry_is_current(&manifest, bob, &bob_stamp));
+		assert_true(keyring_manifest_entry_is_current(&manifest, alice, &alice_stamp));
+	}
+
+	keyring_manifest_release(&manifest);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "keyring manifest should survive serialization", keyring_manifest_serialize_test },
+			{ "keyring manifest should detect changed key files", keyring_manifest_change_detection_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "test-lib.h"
+#include "cache/message-count-cache.h"
+
+#define TIP_ID "0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c"
+#define WATERMARK_ID "aaaabbbbccccddddeeeeffff0000111122223333"
+#define WALKED_ID "0123456789abcdef0123456789abcdef01234567"
+
+TEST_DEFINE(message_count_cache_serialize_test)
+{
+	struct message_count_cache cache, parsed;
+	struct git_oid tip, watermark, walked;
+	struct strbuf out;
+
+	message_count_cache_init(&cache);
+	message_count_cache_init(&parsed);
+	strbuf_init(&out);
+
+	git_str_to_oid(&tip, TIP_ID);
+	git_str_to_oid(&watermark, WATERMARK_ID);
+	git_str_to_oid(&walked, WALKED_ID);
+
+	TEST_START() {
+		struct message_count *entry;
+
+		entry = message_count_cache_put(&cache, &tip, 1200, 1250);
+		message_count_cache_keep(&cache, entry);
+		message_count_cache_set_unread(&cache, entry, &watermark, 12);
+
+		entry = message_count_cache_put(&cache, &watermark, 1188, -1);
+		message_count_cache_keep(&cache, entry);
+
+		// entries that aren't kept aren't written
+		message_count_cache_put(&cache, &walked, 4, 5);
+		assert_true(cache.dirty);
+
+		message_count_cache_serialize(&cache, &out);
+		assert_zero(message_count_cache_parse(&parsed, out.buff, out.len));
+		assert_eq(2, parsed.counts.size);
+		assert_null(message_count_cache_get(&parsed, &walked));
+
+		entry = message_count_cache_get(&parsed, &tip);
+		assert_nonnull(entry);
+		assert_eq(1200, entry->count);
+		assert_eq(1250, entry->depth);
+		assert_true(entry->has_unread);
+		assert_eq(12, entry->unread);
+		assert_zero(memcmp(watermark.id, entry->watermark.id, GIT_RAW_OBJECT_ID));
+
+		entry = message_count_cache_get(&parsed, &watermark);
+		assert_nonnull(entry);
+		assert_eq(1188, entry->count);
+		assert_eq(-1, entry->depth);
+		assert_false(entry->has_unread);
+
+		// loaded entries that are kept unchanged don't need to be written again
+		assert_false(parsed.dirty);
+		message_count_cache_set_unread(&parsed, message_count_cache_get(&parsed, &tip), &watermark, 12);
+		assert_false(parsed.dirty);
+		message_count_cache_set_unread(&parsed, message_count_cache_get(&parsed, &tip), &watermark, 13);
+		assert_true(parsed.dirty);
+	}
+
+	strbuf_release(&out);
+	message_count_cache_release(&parsed);
+	message_count_cache_release(&cache);
+	TEST_END();
+}
+
+TEST_DEFINE(message_count_cache_malformed_test)
+{
+	struct message_count_cache cache;
+	const char *malformed[] = {
+			"git-chat message counts v2\n",
+			"git-chat message counts v1\n" TIP_ID " 12\n",
+			"git-chat message counts v1\n" TIP_ID " 12 13",
+			"git-chat message counts v1\n" TIP_ID " -1 13\n",
+			"git-chat message counts v1\n" TIP_ID " 12 13 " WATERMARK_ID "\n",
+			"git-chat message counts v1\n" "0F1E2D3C4B5A69788796A5B4C3D2E1F00F1E2D3C 12 13\n",
+			"git-chat message counts v1\n" TIP_ID " 99999999999 13\n",
+			NULL
+	};
+
+	TEST_START() {
+		for (const char **data = malformed; *data; data++) {
+			message_count_cache_init(&cache);
+			int ret = message_count_cache_parse(&cache, *data, strlen(*data));
+			message_count_cache_release(&cache);
+
+			assert_nonzero_msg(ret, "expected cache to be malformed: '%s'", *data);
+		}
+	}
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "message count cache should survive serialization", message_count_cache_serialize_test },
+			{ "malformed message count caches should be rejected", message_count_cache_malformed_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
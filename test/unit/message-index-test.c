@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "cache/message-index.h"
+#include "run-command.h"
+#include "fs-utils.h"
+
+#define FIXTURE_REPO "message-index-test-repo"
+#define CHANNEL "refs/heads/master"
+#define INDEX_FILE ".git/chat-cache/message-index.refs%2Fheads%2Fmaster"
+#define INDEX_HEADER_SIZE (4 + 4 + 4 + 4 + 4 + GIT_RAW_OBJECT_ID)
+#define INDEX_RECORD_SIZE (GIT_RAW_OBJECT_ID + 8 + 4 + 4)
+#define INDEX_TIME_ENTRY_SIZE (8 + 4)
+#define INDEX_AUTHOR_ENTRY_SIZE (4 + 4 + 4)
+
+static const char *fixture_script =
+		"set -e\n"
+		"rm -rf " FIXTURE_REPO "\n"
+		"git init -q -b master " FIXTURE_REPO "\n"
+		"cd " FIXTURE_REPO "\n"
+		"git config user.name alice\n"
+		"git config user.email alice@example.com\n"
+		"git config commit.gpgsign false\n"
+		"for i in $(seq 1 5); do\n"
+		"  GIT_AUTHOR_DATE=\"@$((1600000000 + i)) +0000\" git commit -q --allow-empty -m \"message $i\"\n"
+		"done\n";
+
+static const char *append_script =
+		"set -e\n"
+		"for i in $(seq 6 8); do\n"
+		"  GIT_AUTHOR_NAME=bob GIT_AUTHOR_DATE=\"@$((1600000000 + i)) +0000\" "
+		"git commit -q --allow-empty -m \"message $i\"\n"
+		"done\n";
+
+/*
+ * Merge a side branch directly on top of the channel tip, and add a message
+ * after the merge. Merges aren't indexed, so the new message is the only new
+ * record, and its parent is the merge.
+ * */
+static const char *merge_script =
+		"set -e\n"
+		"git checkout -q -b side HEAD~2\n"
+		"git commit -q --allow-empty -m 'side message'\n"
+		"git checkout -q master\n"
+		"git merge -q --no-ff -m merge side\n"
+		"GIT_AUTHOR_DATE='@1600000006 +0000' git commit -q --allow-empty -m 'message 6'\n";
+
+static const char *rewrite_script =
+		"set -e\n"
+		"git commit -q --allow-empty --amend -m 'rewritten'\n";
+
+static int get_tip(struct git_oid *oid)
+{
+	struct child_process_def cmd;
+	struct strbuf out;
+	strbuf_init(&out);
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "rev-parse", "HEAD", NULL);
+
+	int ret = capture_command(&cmd, &out);
+	if (!ret && out.len >= GIT_HEX_OBJECT_ID)
+		git_str_to_oid(oid, out.buff);
+
+	child_process_def_release(&cmd);
+	strbuf_release(&out);
+
+	return ret;
+}
+
+TEST_DEFINE(message_index_update_test)
+{
+	struct message_index index;
+	struct message_index_record record;
+	struct strbuf cwd;
+	struct git_oid tip, first;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	index.map = NULL;
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		assert_nonzero(message_index_open(&index, CHANNEL));
+		assert_zero(message_index_update(CHANNEL));
+		assert_zero(message_index_open(&index, CHANNEL));
+		assert_eq(5, index.count);
+
+		message_index_get(&index, 0, &record);
+		assert_true(record.timestamp == 1600000001);
+		assert_string_eq("alice", record.author);
+		assert_eq(strlen("message 1"), record.body_size);
+		first = record.oid;
+
+		assert_zero(get_tip(&tip));
+		message_index_get(&index, 4, &record);
+		assert_zero(memcmp(tip.id, record.oid.id, GIT_RAW_OBJECT_ID));
+		assert_zero(memcmp(tip.id, index.tip.id, GIT_RAW_OBJECT_ID));
+		message_index_close(&index);
+
+		// new messages are appended
+		assert_zero(test_run_fixture_script(append_script));
+		assert_zero(message_index_update(CHANNEL));
+		assert_zero(message_index_open(&index, CHANNEL));
+		assert_eq(8, index.count);
+
+		message_index_get(&index, 0, &record);
+		assert_zero(memcmp(first.id, record.oid.id, GIT_RAW_OBJECT_ID));
+		message_index_get(&index, 5, &record);
+		assert_true(record.timestamp == 1600000006);
+		assert_string_eq("bob", record.author);
+		message_index_get(&index, 4, &record);
+		assert_string_eq("alice", record.author);
+
+		// names are only stored once
+		assert_eq(strlen("alice") + strlen("bob") + 2, index.names_len);
+		message_index_close(&index);
+
+		// rewritten history causes a rebuild
+		assert_zero(test_run_fixture_script(rewrite_script));
+		assert_zero(message_index_update(CHANNEL));
+		assert_zero(message_index_open(&index, CHANNEL));
+		assert_eq(8, index.count);
+
+		assert_zero(get_tip(&tip));
+		message_index_get(&index, 7, &record);
+		assert_zero(memcmp(tip.id, record.oid.id, GIT_RAW_OBJECT_ID));
+	}
+
+	message_index_close(&index);
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+/*
+ * Overwrite four bytes of the index file at `offset` with 0xff.
+ * */
+static int corrupt_index(size_t offset)
+{
+	FILE *file = fopen(INDEX_FILE, "r+b");
+	if (!file)
+		return 1;
+
+	unsigned char garbage[4] = { 0xff, 0xff, 0xff, 0xff };
+	int ret = fseek(file, (long) offset, SEEK_SET) ||
+			fwrite(garbage, sizeof(garbage), 1, file) != 1;
+
+	return fclose(file) || ret;
+}
+
+TEST_DEFINE(message_index_update_merge_test)
+{
+	struct message_index index;
+	struct message_index_record record;
+	struct strbuf cwd;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	index.map = NULL;
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		assert_zero(message_index_update(CHANNEL));
+
+		// mark the first record, so that a rebuild can be told apart
+		assert_zero(corrupt_index(INDEX_HEADER_SIZE + GIT_RAW_OBJECT_ID + 8 + 4));
+
+		assert_zero(test_run_fixture_script(merge_script));
+		assert_zero(message_index_update(CHANNEL));
+		assert_zero(message_index_open(&index, CHANNEL));
+		assert_eq(6, index.count);
+
+		message_index_get(&index, 0, &record);
+		assert_true_msg(record.body_size == UINT32_MAX,
+				"message index was rebuilt rather than extended");
+		message_index_get(&index, 5, &record);
+		assert_true(record.timestamp == 1600000006);
+	}
+
+	message_index_close(&index);
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+TEST_DEFINE(message_index_open_malformed_test)
+{
+	struct message_index index;
+	struct strbuf cwd;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	index.map = NULL;
+
+	// the time index follows the records; postings follow the single author
+	size_t time_pos = INDEX_HEADER_SIZE + 5 * INDEX_RECORD_SIZE + 2 * INDEX_TIME_ENTRY_SIZE + 8;
+	size_t posting = INDEX_HEADER_SIZE + 5 * (INDEX_RECORD_SIZE + INDEX_TIME_ENTRY_SIZE) +
+			INDEX_AUTHOR_ENTRY_SIZE + 3 * 4;
+	size_t offsets[] = { time_pos, posting };
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		for (size_t i = 0; i < sizeof(offsets) / sizeof(*offsets); i++) {
+			assert_zero(message_index_update(CHANNEL));
+			assert_zero(message_index_open(&index, CHANNEL));
+			assert_eq(5, index.count);
+			message_index_close(&index);
+
+			// positions out of bounds are rejected, and the index is rebuilt
+			assert_zero(corrupt_index(offsets[i]));
+			assert_true_msg(message_index_open(&index, CHANNEL) < 0,
+					"out of bounds position at offset %zu was accepted", offsets[i]);
+			assert_zero(message_index_update(CHANNEL));
+			assert_zero(message_index_open(&index, CHANNEL));
+			assert_eq(5, index.count);
+			message_index_close(&index);
+		}
+	}
+
+	message_index_close(&index);
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+TEST_DEFINE(message_index_cursor_test)
+{
+	struct message_index index;
+	struct strbuf cwd, cursor;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	strbuf_init(&cursor);
+	index.map = NULL;
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		assert_zero(message_index_update(CHANNEL));
+		assert_zero(message_index_open(&index, CHANNEL));
+
+		size_t pos = 0;
+		message_index_cursor(&index, 3, &cursor);
+		assert_zero(message_index_resolve_cursor(&index, cursor.buff, &pos));
+		assert_eq(3, pos);
+
+		// cursor referring to another commit
+		cursor.buff[7] = '2';
+		assert_nonzero(message_index_resolve_cursor(&index, cursor.buff, &pos));
+
+		assert_nonzero(message_index_resolve_cursor(&index, "", &pos));
+		assert_nonzero(message_index_resolve_cursor(&index, "zzzzzzzzzzzzzzzzzzzz", &pos));
+		assert_nonzero(message_index_resolve_cursor(&index, "000000ff0123456789ab", &pos));
+	}
+
+	message_index_close(&index);
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cursor);
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+TEST_DEFINE(message_index_filter_test)
+{
+	struct message_index index;
+	struct strbuf cwd;
+	size_t *positions = NULL;
+	size_t len = 0;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	index.map = NULL;
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+		assert_zero(test_run_fixture_script(append_script));
+
+		assert_zero(message_index_update(CHANNEL));
+		assert_zero(message_index_open(&index, CHANNEL));
+		assert_eq(8, index.count);
+
+		// inclusive time range
+		struct message_index_filter filter = {
+				.since = 1600000003, .until = 1600000006,
+				.has_since = 1, .has_until = 1
+		};
+		assert_zero(message_index_filter(&index, &filter, &positions, &len));
+		assert_eq(4, len);
+		for (size_t i = 0; i < len; i++)
+			assert_eq(i + 2, positions[i]);
+		free(positions);
+		positions = NULL;
+
+		// author pattern
+		struct message_index_filter author_filter = { .author = "^b" };
+		assert_zero(message_index_filter(&index, &author_filter, &positions, &len));
+		assert_eq(3, len);
+		assert_eq(5, positions[0]);
+		assert_eq(7, positions[2]);
+		free(positions);
+		positions = NULL;
+
+		// time and author filters intersect
+		struct message_index_filter combined = {
+				.since = 1600000004, .has_since = 1, .author = "alice"
+		};
+		assert_zero(message_index_filter(&index, &combined, &positions, &len));
+		assert_eq(2, len);
+		assert_eq(3, positions[0]);
+		assert_eq(4, positions[1]);
+		free(positions);
+		positions = NULL;
+
+		// no matches
+		struct message_index_filter empty = { .until = 1600000000, .has_until = 1 };
+		assert_zero(message_index_filter(&index, &empty, &positions, &len));
+		assert_zero(len);
+		free(positions);
+		positions = NULL;
+
+		struct message_index_filter invalid = { .author = "(" };
+		assert_nonzero(message_index_filter(&index, &invalid, &positions, &len));
+	}
+
+	free(positions);
+	message_index_close(&index);
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "message_index_update should build and incrementally extend the index", message_index_update_test },
+			{ "message_index_update should extend the index past a merge", message_index_update_merge_test },
+			{ "message_index_open should reject out of bounds positions", message_index_open_malformed_test },
+			{ "message index cursors should resolve to their position", message_index_cursor_test },
+			{ "message_index_filter should find messages by time and author", message_index_filter_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "git/object-coprocess.h"
+#include "run-command.h"
+#include "fs-utils.h"
+
+#define FIXTURE_REPO "object-coprocess-test-repo"
+#define FIXTURE_OUTSIDE "object-coprocess-test-outside"
+#define FIXTURE_MANY_DIR "many-empty-files-under-a-directory-with-a-rather-long-name"
+#define FIXTURE_MANY_LEN 3000
+#define COPROCESS_TEST_PIPE_LEN (64 * 1024)
+
+/*
+ * Build a repository with a small text file, a binary file with null bytes,
+ * a file larger than the coprocess read buffer, and enough files that requests
+ * for all of them don't fit in a pipe.
+ * */
+static const char *fixture_script =
+		"set -e\n"
+		"rm -rf " FIXTURE_REPO " " FIXTURE_OUTSIDE "\n"
+		"mkdir " FIXTURE_OUTSIDE "\n"
+		"git init -q -b master " FIXTURE_REPO "\n"
+		"cd " FIXTURE_REPO "\n"
+		"git config user.name test\n"
+		"git config user.email test@example.com\n"
+		"git config commit.gpgsign false\n"
+		"echo hello > small.txt\n"
+		"printf 'a\\000b\\000\\001\\n' > binary.bin\n"
+		"seq 1 50000 > large.txt\n"
+		"mkdir " FIXTURE_MANY_DIR "\n"
+		"(cd " FIXTURE_MANY_DIR " && seq 1 3000 | xargs touch)\n"
+		"git add .\n"
+		"git commit -q -m first\n";
+
+static int git_cat_file(struct strbuf *out, const char *name)
+{
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	argv_array_push(&cmd.args, "cat-file", "blob", name, NULL);
+
+	int ret = capture_command(&cmd, out);
+	child_process_def_release(&cmd);
+
+	return ret;
+}
+
+TEST_DEFINE(object_coprocess_pipelined_requests_test)
+{
+	struct strbuf cwd, expected;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	strbuf_init(&expected);
+
+	TEST_START() {
+		struct git_object obj;
+		struct git_oid oid;
+
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		object_coprocess_request("HEAD:small.txt", OBJECT_REQUEST_CONTENTS);
+		object_coprocess_request("HEAD:large.txt", OBJECT_REQUEST_CONTENTS);
+		object_coprocess_request("HEAD:does-not-exist", OBJECT_REQUEST_CONTENTS);
+		object_coprocess_request("HEAD", OBJECT_REQUEST_INFO);
+
+		// responses can be taken in any order
+		assert_true(object_coprocess_response("HEAD:does-not-exist", OBJECT_REQUEST_CONTENTS, &oid, &obj) > 0);
+		assert_null(obj.data);
+
+		assert_zero(object_coprocess_response("HEAD", OBJECT_REQUEST_INFO, &oid, &obj));
+		assert_eq(GIT_OBJ_COMMIT, obj.type);
+		assert_null(obj.data);
+		assert_true(obj.len > 0);
+
+		assert_zero(object_coprocess_response("HEAD:large.txt", OBJECT_REQUEST_CONTENTS, &oid, &obj));
+		assert_zero(git_cat_file(&expected, "HEAD:large.txt"));
+		assert_eq(GIT_OBJ_BLOB, obj.type);
+		assert_eq(expected.len, obj.len);
+		assert_zero(memcmp(expected.buff, obj.data, obj.len));
+		git_object_release(&obj);
+
+		assert_zero(object_coprocess_response("HEAD:small.txt", OBJECT_REQUEST_CONTENTS, &oid, &obj));
+		assert_eq(6, obj.len);
+		assert_zero(memcmp("hello\n", obj.data, obj.len));
+		git_object_release(&obj);
+
+		// objects that weren't requested in advance are requested on demand
+		assert_zero(object_coprocess_response("HEAD:binary.bin", OBJECT_REQUEST_CONTENTS, &oid, &obj));
+		assert_eq(6, obj.len);
+		assert_zero(memcmp("a\0b\0\1\n", obj.data, obj.len));
+		git_object_release(&obj);
+
+		assert_zero(object_coprocess_response("HEAD^{tree}", OBJECT_REQUEST_CONTENTS, &oid, &obj));
+		assert_eq(GIT_OBJ_TREE, obj.type);
+		git_object_release(&obj);
+	}
+
+	object_coprocess_stop();
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&expected);
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+TEST_DEFINE(object_coprocess_many_requests_test)
+{
+	struct strbuf cwd, name;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+	strbuf_init(&name);
+
+	TEST_START() {
+		struct git_object obj;
+
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		// more requests and output than fit in the pipes to and from git
+		for (int i = 1; i <= FIXTURE_MANY_LEN; i++) {
+			strbuf_clear(&name);
+			strbuf_attach_fmt(&name, "HEAD:" FIXTURE_MANY_DIR "/%d", i);
+			object_coprocess_request(name.buff, OBJECT_REQUEST_CONTENTS);
+
+			if (i == FIXTURE_MANY_LEN / 2)
+				object_coprocess_request("HEAD:large.txt", OBJECT_REQUEST_CONTENTS);
+		}
+
+		assert_zero(object_coprocess_response("HEAD:large.txt", OBJECT_REQUEST_CONTENTS, NULL, &obj));
+		assert_eq(GIT_OBJ_BLOB, obj.type);
+		assert_true(obj.len > COPROCESS_TEST_PIPE_LEN);
+		git_object_release(&obj);
+
+		for (int i = FIXTURE_MANY_LEN; i >= 1; i--) {
+			strbuf_clear(&name);
+			strbuf_attach_fmt(&name, "HEAD:" FIXTURE_MANY_DIR "/%d", i);
+			assert_zero(object_coprocess_response(name.buff, OBJECT_REQUEST_CONTENTS, NULL, &obj));
+			assert_eq(GIT_OBJ_BLOB, obj.type);
+			assert_eq(0, obj.len);
+			git_object_release(&obj);
+		}
+	}
+
+	object_coprocess_stop();
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&name);
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+TEST_DEFINE(object_coprocess_outside_repository_test)
+{
+	struct strbuf cwd;
+	int changed_dir = 0;
+
+	strbuf_init(&cwd);
+
+	TEST_START() {
+		struct git_object obj;
+
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_OUTSIDE));
+		changed_dir = 1;
+
+		// don't let git find the repository of the build directory
+		setenv("GIT_CEILING_DIRECTORIES", cwd.buff, 1);
+
+		assert_true(object_coprocess_response("HEAD", OBJECT_REQUEST_INFO, NULL, &obj) < 0);
+		assert_true(object_coprocess_response("HEAD", OBJECT_REQUEST_INFO, NULL, &obj) < 0);
+
+		// once stopped, the coprocess can be started again
+		object_coprocess_stop();
+		assert_zero(chdir(cwd.buff));
+		assert_zero(chdir(FIXTURE_REPO));
+
+		assert_zero(object_coprocess_response("HEAD", OBJECT_REQUEST_INFO, NULL, &obj));
+		assert_eq(GIT_OBJ_COMMIT, obj.type);
+	}
+
+	object_coprocess_stop();
+	unsetenv("GIT_CEILING_DIRECTORIES");
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "object coprocess should answer pipelined requests in any order", object_coprocess_pipelined_requests_test },
+			{ "object coprocess should not deadlock when requests and responses overflow the pipes", object_coprocess_many_requests_test },
+			{ "object coprocess should fail outside of a repository, and recover once stopped", object_coprocess_outside_repository_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,492 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "git/object-db.h"
+#include "git/graph-traversal.h"
+#include "git/object-coprocess.h"
+#include "run-command.h"
+#include "fs-utils.h"
+#include "str-array.h"
+
+#define FIXTURE_REPO "object-db-test-repo"
+#define FIXTURE_BLOB_REPO "object-db-test-blob-repo"
+
+/*
+ * Build a repository with packed (deltified) and loose objects, an annotated
+ * tag, packed refs and a merge commit on the first-parent history.
+ * */
+static const char *fixture_script =
+		"set -e\n"
+		"rm -rf " FIXTURE_REPO "\n"
+		"git init -q -b master " FIXTURE_REPO "\n"
+		"cd " FIXTURE_REPO "\n"
+		"git config user.name test\n"
+		"git config user.email test@example.com\n"
+		"git config commit.gpgsign false\n"
+		"for i in $(seq 1 20); do\n"
+		"  seq 1 $((i * 200)) > file.txt\n"
+		"  git add file.txt\n"
+		"  git commit -q -m \"message $i\"\n"
+		"done\n"
+		"git tag -a v1.0 -m 'annotated tag'\n"
+		"git checkout -q -b side HEAD~3\n"
+		"echo side > side.txt\n"
+		"git add side.txt\n"
+		"git commit -q -m side\n"
+		"git checkout -q master\n"
+		"git merge -q --no-ff -m merge side\n"
+		"git gc -q\n"
+		"echo loose > loose.txt\n"
+		"git add loose.txt\n"
+		"git commit -q -m loose\n";
+
+/*
+ * Build a repository with a single message stored as a blob, whose ciphertext
+ * has null bytes.
+ * */
+static const char *blob_fixture_script =
+		"set -e\n"
+		"rm -rf " FIXTURE_BLOB_REPO "\n"
+		"git init -q -b master " FIXTURE_BLOB_REPO "\n"
+		"cd " FIXTURE_BLOB_REPO "\n"
+		"git config user.name test\n"
+		"git config user.email test@example.com\n"
+		"git config commit.gpgsign false\n"
+		"mkdir .git-chat\n"
+		"printf '\\205\\002\\000\\014\\000binary\\000ciphertext\\n' > .git-chat/ciphertext\n"
+		"git add .git-chat/ciphertext\n"
+		"git commit -q -m \"Git-Chat-Ciphertext: $(git hash-object .git-chat/ciphertext)\"\n";
+
+#define BLOB_FIXTURE_CIPHERTEXT "\205\002\000\014\000binary\000ciphertext\n"
+
+static int git_capture(struct strbuf *out, ...)
+{
+	va_list args;
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.git_cmd = 1;
+	cmd.dir = FIXTURE_REPO;
+
+	va_start(args, out);
+	const char *arg;
+	while ((arg = va_arg(args, const char *)))
+		argv_array_push(&cmd.args, arg, NULL);
+	va_end(args);
+
+	int ret = capture_command(&cmd, out);
+	child_process_def_release(&cmd);
+
+	return ret;
+}
+
+static int collect_commit_cb(struct git_commit *commit, void *data)
+{
+	struct str_array *commits = (struct str_array *) data;
+	char hex[GIT_HEX_OBJECT_ID + 1];
+	git_oid_to_str(&commit->commit_id, hex);
+	hex[GIT_HEX_OBJECT_ID] = 0;
+
+	str_array_push(commits, hex, NULL);
+	return 0;
+}
+
+static int collect_commit_view_cb(struct git_commit_view *commit, void *data)
+{
+	struct str_array *commits = (struct str_array *) data;
+	char hex[GIT_HEX_OBJECT_ID + 1];
+	git_oid_to_str(&commit->commit_id, hex);
+	hex[GIT_HEX_OBJECT_ID] = 0;
+
+	str_array_push(commits, hex, NULL);
+	return 0;
+}
+
+static int collect_commit_blob_cb(struct git_commit *commit, void *data)
+{
+	struct strbuf *blob = (struct strbuf *) data;
+	strbuf_attach_bytes(blob, commit->blob.buff, commit->blob.len);
+	return 0;
+}
+
+TEST_DEFINE(object_db_read_all_objects_test)
+{
+	struct object_db odb;
+	struct strbuf objects, expected;
+	struct str_array lines;
+	int odb_initialized = 0;
+
+	strbuf_init(&objects);
+	strbuf_init(&expected);
+	str_array_init(&lines);
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+
+		odb_initialized = 1;
+		assert_zero(object_db_init(&odb, FIXTURE_REPO "/.git"));
+		assert_nonnull_msg(odb.packs, "expected objects to be packed");
+
+		assert_zero(git_capture(&objects, "rev-list", "--objects", "--all", NULL));
+		strbuf_split(&objects, "\n", &lines);
+		assert_true(lines.len > 20);
+
+		for (size_t i = 0; i < lines.len; i++) {
+			const char *line = str_array_get(&lines, i);
+			if (strlen(line) < GIT_HEX_OBJECT_ID)
+				continue;
+
+			char hex[GIT_HEX_OBJECT_ID + 1];
+			memcpy(hex, line, GIT_HEX_OBJECT_ID);
+			hex[GIT_HEX_OBJECT_ID] = 0;
+
+			struct git_oid oid;
+			git_str_to_oid(&oid, hex);
+
+			struct git_object obj;
+			assert_zero_msg(object_db_read(&odb, &oid, &obj), "failed to read object %s", hex);
+
+			strbuf_clear(&expected);
+			int ret = git_capture(&expected, "cat-file", "-p", hex, NULL);
+
+			// trees are pretty-printed by cat-file, so only compare the type
+			int type_ok = obj.type == GIT_OBJ_TREE || obj.type == GIT_OBJ_BLOB ||
+					obj.type == GIT_OBJ_COMMIT || obj.type == GIT_OBJ_TAG;
+			int content_ok = obj.type == GIT_OBJ_TREE ||
+					(obj.len == expected.len && !memcmp(obj.data, expected.buff, obj.len));
+			git_object_release(&obj);
+
+			assert_zero(ret);
+			assert_true_msg(type_ok, "unexpected type for object %s", hex);
+			assert_true_msg(content_ok, "unexpected content for object %s", hex);
+		}
+
+		struct git_oid missing;
+		git_str_to_oid(&missing, "0123456789012345678901234567890123456789");
+		struct git_object obj;
+		assert_eq(1, object_db_read(&odb, &missing, &obj));
+	}
+
+	if (odb_initialized)
+		object_db_release(&odb);
+
+	str_array_release(&lines);
+	strbuf_release(&expected);
+	strbuf_release(&objects);
+	TEST_END();
+}
+
+TEST_DEFINE(object_db_resolve_test)
+{
+	struct object_db odb;
+	struct strbuf expected;
+	int odb_initialized = 0;
+
+	const char *revs[] = { "HEAD", "master", "refs/heads/master", "side", "v1.0", NULL };
+
+	strbuf_init(&expected);
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+
+		odb_initialized = 1;
+		assert_zero(object_db_init(&odb, FIXTURE_REPO "/.git"));
+
+		for (const char **rev = revs; *rev; rev++) {
+			struct strbuf peeled;
+			strbuf_init(&peeled);
+			strbuf_attach_fmt(&peeled, "%s^{commit}", *rev);
+
+			strbuf_clear(&expected);
+			int ret = git_capture(&expected, "rev-parse", peeled.buff, NULL);
+			strbuf_release(&peeled);
+			assert_zero(ret);
+
+			struct git_oid oid;
+			assert_zero_msg(object_db_resolve(&odb, *rev, &oid), "failed to resolve '%s'", *rev);
+
+			char hex[GIT_HEX_OBJECT_ID + 1];
+			git_oid_to_str(&oid, hex);
+			hex[GIT_HEX_OBJECT_ID] = 0;
+			assert_eq_msg(0, strncmp(expected.buff, hex, GIT_HEX_OBJECT_ID),
+					"'%s' resolved to %s but expected %.40s", *rev, hex, expected.buff);
+		}
+
+		struct strbuf symref;
+		strbuf_init(&symref);
+		int symref_ret = object_db_read_symref(&odb, "HEAD", &symref);
+		assert_zero(symref_ret);
+		assert_string_eq("refs/heads/master", symref.buff);
+		strbuf_release(&symref);
+
+		struct git_oid oid;
+		assert_nonzero(object_db_resolve(&odb, "HEAD~1", &oid));
+		assert_nonzero(object_db_resolve(&odb, "does-not-exist", &oid));
+		assert_nonzero(object_db_resolve(&odb, "../config", &oid));
+	}
+
+	if (odb_initialized)
+		object_db_release(&odb);
+
+	strbuf_release(&expected);
+	TEST_END();
+}
+
+/*
+ * Object database initialization should fail for repositories whose format,
+ * extensions or replace refs the native reader doesn't handle.
+ * */
+TEST_DEFINE(object_db_unsupported_repository_test)
+{
+	struct object_db odb;
+
+	const char *scripts[] = {
+			"cd " FIXTURE_REPO "/.git && cp config config.orig && "
+			"printf '[core]\\n\\trepositoryformatversion = 2\\n' >> config",
+			"cd " FIXTURE_REPO "/.git && cp config.orig config && "
+			"printf '[core]\\n\\trepositoryformatversion = 1\\n[extensions]\\n\\tobjectFormat = sha256\\n' >> config",
+			"cd " FIXTURE_REPO "/.git && cp config.orig config && "
+			"printf '[core]\\n\\trepositoryformatversion = 1\\n[extensions]\\n\\trefStorage = reftable\\n' >> config",
+			"cd " FIXTURE_REPO " && cp .git/config.orig .git/config && "
+			"git replace HEAD~1 HEAD~2 && git pack-refs --all && rm -rf .git/refs/replace",
+			NULL
+	};
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+
+		// extensions that don't change the format are fine
+		assert_zero(test_run_fixture_script("cd " FIXTURE_REPO " && "
+				"git config core.repositoryformatversion 1 && "
+				"git config extensions.objectFormat sha1"));
+		assert_zero(object_db_init(&odb, FIXTURE_REPO "/.git"));
+		object_db_release(&odb);
+
+		for (const char **script = scripts; *script; script++) {
+			assert_zero(test_run_fixture_script(*script));
+
+			int ret = object_db_init(&odb, FIXTURE_REPO "/.git");
+			object_db_release(&odb);
+			assert_nonzero_msg(ret, "repository should be unsupported after '%s'", *script);
+		}
+	}
+
+	TEST_END();
+}
+
+TEST_DEFINE(object_db_read_path_test)
+{
+	struct object_db odb;
+	struct strbuf expected;
+	int odb_initialized = 0;
+
+	const char *paths[] = { "file.txt", "side.txt", "loose.txt", NULL };
+
+	strbuf_init(&expected);
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+
+		odb_initialized = 1;
+		assert_zero(object_db_init(&odb, FIXTURE_REPO "/.git"));
+
+		struct git_oid head;
+		assert_zero(object_db_resolve(&odb, "HEAD", &head));
+
+		for (const char **path = paths; *path; path++) {
+			struct strbuf rev;
+			strbuf_init(&rev);
+			strbuf_attach_fmt(&rev, "HEAD:%s", *path);
+
+			strbuf_clear(&expected);
+			int ret = git_capture(&expected, "cat-file", "blob", rev.buff, NULL);
+			strbuf_release(&rev);
+			assert_zero(ret);
+
+			struct git_object obj;
+			assert_zero_msg(object_db_read_path(&odb, &head, *path, &obj),
+					"failed to read '%s'", *path);
+			assert_eq(GIT_OBJ_BLOB, obj.type);
+			assert_eq(expected.len, obj.len);
+			assert_zero(memcmp(expected.buff, obj.data, obj.len));
+			git_object_release(&obj);
+		}
+
+		struct git_object obj;
+		assert_true(object_db_read_path(&odb, &head, "does-not-exist", &obj) > 0);
+		assert_true(object_db_read_path(&odb, &head, "file.txt/nested", &obj) > 0);
+	}
+
+	if (odb_initialized)
+		object_db_release(&odb);
+
+	strbuf_release(&expected);
+	TEST_END();
+}
+
+TEST_DEFINE(traverse_commit_graph_backends_test)
+{
+	struct str_array native, subprocess;
+	struct strbuf cwd;
+	int changed_dir = 0;
+
+	str_array_init(&native);
+	str_array_init(&subprocess);
+	strbuf_init(&cwd);
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "native", 1);
+		assert_zero(traverse_commit_graph(NULL, -1, collect_commit_cb, &native));
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "subprocess", 1);
+		assert_zero(traverse_commit_graph(NULL, -1, collect_commit_cb, &subprocess));
+
+		// 20 commits on master, one loose commit; the merge is skipped
+		assert_eq(21, native.len);
+		assert_eq(subprocess.len, native.len);
+		for (size_t i = 0; i < native.len; i++)
+			assert_string_eq(str_array_get(&subprocess, i), str_array_get(&native, i));
+
+		str_array_clear(&native);
+		str_array_clear(&subprocess);
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "native", 1);
+		assert_zero(traverse_commit_graph("v1.0", -1, collect_commit_cb, &native));
+		setenv("GIT_CHAT_OBJECT_BACKEND", "subprocess", 1);
+		assert_zero(traverse_commit_graph("v1.0", -1, collect_commit_cb, &subprocess));
+
+		assert_eq(1, native.len);
+		assert_eq(1, subprocess.len);
+		assert_string_eq(str_array_get(&subprocess, 0), str_array_get(&native, 0));
+	}
+
+	// the coprocess must not outlive the fixture repository it was started in
+	object_coprocess_stop();
+	unsetenv("GIT_CHAT_OBJECT_BACKEND");
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	str_array_release(&subprocess);
+	str_array_release(&native);
+	TEST_END();
+}
+
+TEST_DEFINE(traverse_commit_graph_range_test)
+{
+	struct str_array native, subprocess;
+	struct strbuf cwd, exclude;
+	int changed_dir = 0;
+
+	str_array_init(&native);
+	str_array_init(&subprocess);
+	strbuf_init(&cwd);
+	strbuf_init(&exclude);
+
+	TEST_START() {
+		assert_zero(test_run_fixture_script(fixture_script));
+		assert_zero(git_capture(&exclude, "rev-parse", "HEAD~5", NULL));
+		strbuf_trim(&exclude);
+
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_REPO));
+		changed_dir = 1;
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "native", 1);
+		assert_zero(traverse_commit_graph_range(exclude.buff, NULL, -1, collect_commit_view_cb, &native));
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "subprocess", 1);
+		assert_zero(traverse_commit_graph_range(exclude.buff, NULL, -1, collect_commit_view_cb, &subprocess));
+
+		// the loose commit and three commits on master; the merge is skipped
+		assert_eq(4, native.len);
+		assert_eq(subprocess.len, native.len);
+		for (size_t i = 0; i < native.len; i++)
+			assert_string_eq(str_array_get(&subprocess, i), str_array_get(&native, i));
+
+		// nothing is newer than the tip
+		str_array_clear(&native);
+		setenv("GIT_CHAT_OBJECT_BACKEND", "native", 1);
+		assert_zero(traverse_commit_graph_range("HEAD", NULL, -1, collect_commit_view_cb, &native));
+		assert_eq(0, native.len);
+	}
+
+	// the coprocess must not outlive the fixture repository it was started in
+	object_coprocess_stop();
+	unsetenv("GIT_CHAT_OBJECT_BACKEND");
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&exclude);
+	strbuf_release(&cwd);
+	str_array_release(&subprocess);
+	str_array_release(&native);
+	TEST_END();
+}
+
+TEST_DEFINE(traverse_commit_graph_binary_blob_test)
+{
+	struct strbuf native, subprocess, cwd;
+	int changed_dir = 0;
+
+	strbuf_init(&native);
+	strbuf_init(&subprocess);
+	strbuf_init(&cwd);
+
+	TEST_START() {
+		const char expected[] = BLOB_FIXTURE_CIPHERTEXT;
+		size_t expected_len = sizeof(expected) - 1;
+
+		assert_zero(test_run_fixture_script(blob_fixture_script));
+		assert_zero(get_cwd(&cwd));
+		assert_zero(chdir(FIXTURE_BLOB_REPO));
+		changed_dir = 1;
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "native", 1);
+		assert_zero(traverse_commit_graph(NULL, -1, collect_commit_blob_cb, &native));
+
+		setenv("GIT_CHAT_OBJECT_BACKEND", "subprocess", 1);
+		assert_zero(traverse_commit_graph(NULL, -1, collect_commit_blob_cb, &subprocess));
+
+		// the ciphertext must survive intact past its null bytes
+		assert_eq(expected_len, native.len);
+		assert_zero(memcmp(expected, native.buff, expected_len));
+		assert_eq(expected_len, subprocess.len);
+		assert_zero(memcmp(expected, subprocess.buff, expected_len));
+	}
+
+	// the coprocess must not outlive the fixture repository it was started in
+	object_coprocess_stop();
+	unsetenv("GIT_CHAT_OBJECT_BACKEND");
+	if (changed_dir && chdir(cwd.buff))
+		perror("chdir");
+
+	strbuf_release(&cwd);
+	strbuf_release(&subprocess);
+	strbuf_release(&native);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "object_db_read should read loose, packed and deltified objects", object_db_read_all_objects_test },
+			{ "object_db_resolve should resolve refs, symrefs and annotated tags", object_db_resolve_test },
+			{ "object_db_read_path should read files from the tree of a commit", object_db_read_path_test },
+			{ "object_db_init should refuse repositories in unsupported formats", object_db_unsupported_repository_test },
+			{ "native and subprocess traversal should yield the same commits", traverse_commit_graph_backends_test },
+			{ "range traversal should stop at the excluded commit", traverse_commit_graph_range_test },
+			{ "binary ciphertext blobs should be read in full by both backends", traverse_commit_graph_binary_blob_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -712,6 +712,38 @@ TEST_DEFINE(parse_config_flat_properties_test)
 	TEST_END();
 }
 
+TEST_DEFINE(parse_config_buffer_test)
+{
+	struct config_data *conf;
+	const char *config_file = "[channel.master]\n"
+			"\tname = master\n"
+			"\tdescription = \"a channel\"\n"
+			"[channel.\"dev\"]\n"
+			"\tname = dev";
+	const char *config_file_invalid = "[channel.master\n";
+
+	TEST_START() {
+		config_data_init(&conf);
+
+		// the last line need not end with a line feed
+		int status = parse_config_buffer(conf, config_file, strlen(config_file));
+		assert_zero_msg(status, "failed to parse config data");
+		assert_string_eq("master", config_data_find(conf, "channel.master.name"));
+		assert_string_eq("a channel", config_data_find(conf, "channel.master.description"));
+		assert_string_eq("dev", config_data_find(conf, "channel.dev.name"));
+
+		config_data_release(&conf);
+		config_data_init(&conf);
+
+		status = parse_config_buffer(conf, config_file_invalid, strlen(config_file_invalid));
+		assert_nonzero_msg(status, "expected config data to fail to parse");
+	}
+
+	config_data_release(&conf);
+
+	TEST_END();
+}
+
 TEST_DEFINE(write_config_empty_config_data_test)
 {
 	struct config_data *conf;
@@ -1095,6 +1127,7 @@ int test_suite(struct test_runner_instance *instance)
 			{ "parse_config: escape sequences in property values should be normalized", parse_config_property_char_escape_prop_values_test },
 			{ "parse_config: sectionless properties should belong to root node", parse_config_property_sectionless_test },
 			{ "parse_config: flattened property names should still parse successfully", parse_config_flat_properties_test },
+			{ "parse_config: config files should parse from memory like from a file descriptor", parse_config_buffer_test },
 
 			{ "write_config: empty config_data should write empty file to fd", write_config_empty_config_data_test },
 			{ "write_config: simple section names with one or more components should have correct format", write_config_simple_section_name_format_test },
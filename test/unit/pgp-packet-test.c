@@ -0,0 +1,295 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "gnupg/pgp-packet.h"
+
+/*
+ * Encrypted to John Doe (57711916B405CB31) and test user (252E2C4FD9B8C454),
+ * using old-format packet headers.
+ */
+static const char *two_recipients_message =
+		"-----BEGIN PGP MESSAGE-----\n"
+		"\n"
+		"hQEMA1dxGRa0BcsxAQgApFIvCBrUpWKlNpqVaq3XI+oN5Nhei7k4+1epgoM+bvMI\n"
+		"wZwPJkhYzemwSoxN4tJGuSJ7JqkBKkHSUBdyBOOKScysj/9pImZVkIul1K24wDOP\n"
+		"rWRQGxYkKsxLWHtayykmGWN+/asFUuJAah0+mbn+qw6vadsEC7FLAkzF5Pkqqhuo\n"
+		"Y8wz6jjtyQNXbF3aIfDnNNz/hCXWXGJotSjA6VYTY9kkZzvd+KC12XU+XGU7i4Yr\n"
+		"EhR9iKPMlgBErSIP390QgtS9Tx/ykLUxEUbQpEBVhJuq3zftBwkG1CYlV1mwxFtC\n"
+		"92WENkcyeJibdib9XCeR064K18shhVpPtKphKXS/gISMAyUuLE/ZuMRUAQP/Z1mV\n"
+		"DeMqdpMzwlzJVWhjU/ZdpdzKZkbnwHAjMd9ViLz4QqDd56e2aIu/ANYz/4mngB9N\n"
+		"8564Oo/kBw1Eafeg2FhJyyxUhxUBjElf0xM/2bF9IWGOpsrK052Wxjm3acb7oTUt\n"
+		"huZky1OM7FTdUvVJG1wVBhPwLmK1RhBxNEbhFxjSQQEnv4LdsZ+Ad/l6refTlYK4\n"
+		"nccTHOB+O1hbOJWgYIU6jj3RcqIkViHwQ15kpSo8W0CuoXfbbaU3XcI3/XG1uaJ9\n"
+		"=ETAt\n"
+		"-----END PGP MESSAGE-----\n";
+
+/*
+ * Encrypted to an anonymous recipient (`gpg --throw-keyids`).
+ */
+static const char *hidden_recipient_message =
+		"-----BEGIN PGP MESSAGE-----\n"
+		"\n"
+		"hQIMAwAAAAAAAAAAAQ//Yi3SIoyikdeBkNmFCX4YLVgidyfiaDjS6RJoCpvAssFK\n"
+		"tASkTPYL6hUeB6s2HmArDy+u6gdXh1B2mfz+0pbyOYwpYqZTvxmjQ3bOcbdBoLvQ\n"
+		"xHRkQ1lpC4lrxFYcEDMKAqNqOqxT6GHv7C9I1KKpdvmMMYrLoo7rjRnyMp8cnjiW\n"
+		"z3dTsE6vSe+Wd+MNR1CHfCw/2R2xABTSpeFG9Pf6mZSeqv33F9OPK8zf/XwWHhVu\n"
+		"STgwp37o3DqMxqgiJG/dEINHY2HzoR5XzWcnAEzcwKtBvmPaXeIG8mwAhFIFA7xx\n"
+		"Tca0nI0sAtBrHsLFkpza8KZY285f4pmpT3SlsNdI2tCMGMoiNCEgc0580VaIWPlM\n"
+		"vyu4MftlbKrGr3q8UpR87JPsKwrD7dTAhVkDH+l8HBCnMqwMcI3tmR0dtmAzs0GJ\n"
+		"0dIAQRn1L8Qt5DwcgHlBgA22mmIFzo2guJRFnnDtTKM164nl69nABO+bql8BcqLO\n"
+		"wodgfPH7yTGr2oCbIsUDCITmjZ+eEPks68uUfUJ7Y+cEaF98FhU4bOFBR5+oXpw2\n"
+		"t+4ZTU92h0//OSfFTMeLuZ5h45UJbuIWKlb3QQoMUK2+WWii8Rani47TS0AnhPZY\n"
+		"8EcvvKCCCfU3lP3/4UIpDLR/f7dPeKjzMxt0VMOw5n+iroUXJZ0i7UMVfIgEnhPS\n"
+		"PgE5ABX/LLt9THP65RMLJpt3SfVdsEkdEcniQwB64ZvbEFBhEDEB0PfvXkLLfEQJ\n"
+		"RotktcwmsFAdwSHtQPFO\n"
+		"=CWP3\n"
+		"-----END PGP MESSAGE-----\n";
+
+/*
+ * Encrypted with a passphrase only (`gpg --symmetric`).
+ */
+static const char *symmetric_message =
+		"-----BEGIN PGP MESSAGE-----\n"
+		"\n"
+		"jA0ECQMCJXYFsLLESNz/0jgBrioONumHrZXCtrXfKAsYlS4M++mqhx9Qq7inEfO0\n"
+		"wXW2e5/Q0ZxOQD91u7izIyaKZoKOurXlag==\n"
+		"=6mrP\n"
+		"-----END PGP MESSAGE-----\n";
+
+TEST_DEFINE(pgp_scan_recipients_test)
+{
+	struct pgp_recipients recipients;
+	pgp_recipients_init(&recipients);
+
+	TEST_START() {
+		enum pgp_scan_result result = pgp_scan_message(two_recipients_message,
+				strlen(two_recipients_message), &recipients);
+		assert_eq(PGP_SCAN_ENCRYPTED, result);
+		assert_false(recipients.wildcard);
+		assert_eq(2, recipients.len);
+		assert_true(recipients.key_ids[0] == UINT64_C(0x57711916B405CB31));
+		assert_true(recipients.key_ids[1] == UINT64_C(0x252E2C4FD9B8C454));
+	}
+
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pgp_scan_armor_headers_test)
+{
+	struct pgp_recipients recipients;
+	struct strbuf message;
+
+	pgp_recipients_init(&recipients);
+	strbuf_init(&message);
+
+	TEST_START() {
+		// leading text and armor headers should be skipped
+		const char *body = strchr(two_recipients_message, '\n') + 2;
+		strbuf_attach_fmt(&message, "some leading text\n"
+				"-----BEGIN PGP MESSAGE-----\n"
+				"Version: GnuPG v2\n"
+				"Comment: test\n"
+				"\n%s", body);
+
+		enum pgp_scan_result result = pgp_scan_message(message.buff, message.len, &recipients);
+		assert_eq(PGP_SCAN_ENCRYPTED, result);
+		assert_eq(2, recipients.len);
+		assert_true(recipients.key_ids[0] == UINT64_C(0x57711916B405CB31));
+	}
+
+	strbuf_release(&message);
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pgp_scan_wildcard_test)
+{
+	struct pgp_recipients recipients;
+	pgp_recipients_init(&recipients);
+
+	TEST_START() {
+		enum pgp_scan_result result = pgp_scan_message(hidden_recipient_message,
+				strlen(hidden_recipient_message), &recipients);
+		assert_eq(PGP_SCAN_ENCRYPTED, result);
+		assert_true(recipients.wildcard);
+		assert_zero(recipients.len);
+
+		pgp_recipients_release(&recipients);
+
+		result = pgp_scan_message(symmetric_message, strlen(symmetric_message), &recipients);
+		assert_eq(PGP_SCAN_ENCRYPTED, result);
+		assert_true(recipients.wildcard);
+	}
+
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pgp_scan_plaintext_test)
+{
+	struct pgp_recipients recipients;
+	pgp_recipients_init(&recipients);
+
+	TEST_START() {
+		const char *plaintext = "hello world\n\nthis is not encrypted\n";
+		assert_eq(PGP_SCAN_PLAINTEXT, pgp_scan_message(plaintext, strlen(plaintext), &recipients));
+		assert_eq(PGP_SCAN_PLAINTEXT, pgp_scan_message("", 0, &recipients));
+		assert_zero(recipients.len);
+	}
+
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pgp_scan_unknown_test)
+{
+	struct pgp_recipients recipients;
+	pgp_recipients_init(&recipients);
+
+	TEST_START() {
+		const char *signed_message = "-----BEGIN PGP SIGNED MESSAGE-----\n"
+				"Hash: SHA512\n\nhi\n";
+		assert_eq(PGP_SCAN_UNKNOWN, pgp_scan_message(signed_message, strlen(signed_message), &recipients));
+
+		const char *garbage = "-----BEGIN PGP MESSAGE-----\n\n!!!!\n-----END PGP MESSAGE-----\n";
+		assert_eq(PGP_SCAN_UNKNOWN, pgp_scan_message(garbage, strlen(garbage), &recipients));
+
+		// truncated in the middle of the first PKESK packet
+		size_t truncated_len = strchr(two_recipients_message, '\n') - two_recipients_message + 20;
+		assert_eq(PGP_SCAN_UNKNOWN, pgp_scan_message(two_recipients_message, truncated_len, &recipients));
+
+		// a compressed data packet, as produced by `gpg --store`
+		const char *compressed = "-----BEGIN PGP MESSAGE-----\n\nowE=\n-----END PGP MESSAGE-----\n";
+		assert_eq(PGP_SCAN_UNKNOWN, pgp_scan_message(compressed, strlen(compressed), &recipients));
+	}
+
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pgp_scan_binary_test)
+{
+	struct pgp_recipients recipients;
+	pgp_recipients_init(&recipients);
+
+	TEST_START() {
+		// a PKESK packet for John Doe (57711916B405CB31), then the start of a SEIPD packet
+		const char binary_message[] = {
+				'\x84', '\x0c', '\x03', '\x57', '\x71', '\x19', '\x16', '\xb4', '\x05',
+				'\xcb', '\x31', '\x01', '\x00', '\x00', '\xd2', '\x02', '\x01', '\x00'
+		};
+
+		enum pgp_scan_result result = pgp_scan_binary_message(binary_message,
+				sizeof(binary_message), &recipients);
+		assert_eq(PGP_SCAN_ENCRYPTED, result);
+		assert_false(recipients.wildcard);
+		assert_eq(1, recipients.len);
+		assert_true(recipients.key_ids[0] == UINT64_C(0x57711916B405CB31));
+
+		// truncated in the middle of the PKESK packet
+		assert_eq(PGP_SCAN_UNKNOWN, pgp_scan_binary_message(binary_message, 6, &recipients));
+
+		// armored messages aren't binary messages
+		assert_eq(PGP_SCAN_UNKNOWN, pgp_scan_binary_message(two_recipients_message,
+				strlen(two_recipients_message), &recipients));
+	}
+
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pgp_key_id_set_can_decrypt_test)
+{
+	struct pgp_recipients recipients;
+	struct pgp_key_id_set set;
+
+	pgp_recipients_init(&recipients);
+	pgp_key_id_set_init(&set);
+
+	TEST_START() {
+		pgp_scan_message(two_recipients_message, strlen(two_recipients_message), &recipients);
+
+		pgp_key_id_set_add(&set, UINT64_C(0xC5E184648F6CEA47));
+		assert_false(pgp_key_id_set_can_decrypt(&set, &recipients));
+
+		pgp_key_id_set_add(&set, UINT64_C(0x252E2C4FD9B8C454));
+		pgp_key_id_set_add(&set, UINT64_C(0x252E2C4FD9B8C454));
+		assert_eq(2, set.len);
+		assert_true(pgp_key_id_set_can_decrypt(&set, &recipients));
+
+		recipients.len = 0;
+		assert_false(pgp_key_id_set_can_decrypt(&set, &recipients));
+		recipients.wildcard = 1;
+		assert_true(pgp_key_id_set_can_decrypt(&set, &recipients));
+	}
+
+	pgp_key_id_set_release(&set);
+	pgp_recipients_release(&recipients);
+
+	TEST_END();
+}
+
+static void read_key_file(struct strbuf *buff, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		FATAL("unable to open '%s'", path);
+
+	strbuf_attach_fd(buff, fd);
+	close(fd);
+}
+
+TEST_DEFINE(pgp_count_public_keys_test)
+{
+	struct strbuf keys;
+	strbuf_init(&keys);
+
+	TEST_START() {
+		read_key_file(&keys, "resources/gpgkeys/jdoe_noexpire.pub.gpg");
+		assert_eq(1, pgp_count_public_keys(keys.buff, keys.len));
+
+		// concatenated key files
+		read_key_file(&keys, "resources/gpgkeys/ajones_noexpire.pub.gpg");
+		read_key_file(&keys, "resources/gpgkeys/test_user.pub.gpg");
+		assert_eq(3, pgp_count_public_keys(keys.buff, keys.len));
+
+		// truncated key blocks aren't understood
+		assert_eq(-1, pgp_count_public_keys(keys.buff, keys.len - 200));
+
+		strbuf_clear(&keys);
+		read_key_file(&keys, "resources/gpgkeys/jdoe_noexpire.gpg");
+		assert_eq(-1, pgp_count_public_keys(keys.buff, keys.len));
+
+		assert_eq(-1, pgp_count_public_keys("not a key", 9));
+	}
+
+	strbuf_release(&keys);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "pgp_scan_message should read recipient key ids", pgp_scan_recipients_test },
+			{ "pgp_scan_message should skip leading text and armor headers", pgp_scan_armor_headers_test },
+			{ "pgp_scan_message should flag anonymous and passphrase recipients", pgp_scan_wildcard_test },
+			{ "pgp_scan_message should recognize plaintext", pgp_scan_plaintext_test },
+			{ "pgp_scan_message should defer unrecognized messages to gpg", pgp_scan_unknown_test },
+			{ "pgp_scan_binary_message should read recipients of binary messages", pgp_scan_binary_test },
+			{ "pgp_key_id_set_can_decrypt should match recipients against the set", pgp_key_id_set_can_decrypt_test },
+			{ "pgp_count_public_keys should count keys in armored key files", pgp_count_public_keys_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "test-lib.h"
+#include "git/commit.h"
+
+#define AUTHOR_NAME "Brandon Richardson"
+
+/**
+ * Pretty-print `message`, either with pretty_print_message(), or through a
+ * pretty_print_stream in chunks of `chunk_len` bytes if non-zero, and read the
+ * output into `output`.
+ * */
+static int pretty_print(struct git_commit *commit, const char *message,
+		size_t chunk_len, struct strbuf *output)
+{
+	int fds[2];
+	if (pipe(fds) < 0)
+		return 1;
+
+	if (!chunk_len) {
+		struct strbuf buff;
+		strbuf_init(&buff);
+		strbuf_attach_str(&buff, message);
+		pretty_print_message(commit, &buff, DECRYPTED, 1, fds[1]);
+		strbuf_release(&buff);
+	} else {
+		struct pretty_print_stream stream;
+		pretty_print_stream_init(&stream, commit, DECRYPTED, 1, fds[1]);
+
+		size_t len = strlen(message);
+		for (size_t pos = 0; pos < len; pos += chunk_len)
+			pretty_print_stream_write(&stream, message + pos,
+					len - pos < chunk_len ? len - pos : chunk_len);
+
+		pretty_print_stream_finish(&stream);
+		pretty_print_stream_release(&stream);
+	}
+
+	close(fds[1]);
+	strbuf_attach_fd(output, fds[0]);
+	close(fds[0]);
+
+	return 0;
+}
+
+TEST_DEFINE(pretty_print_message_format_test)
+{
+	struct git_commit commit;
+	struct strbuf output;
+
+	git_commit_object_init(&commit);
+	strbuf_attach_str(&commit.author.name, AUTHOR_NAME);
+	strbuf_init(&output);
+
+	TEST_START() {
+		assert_zero(pretty_print(&commit, "  first line\n\nsecond line \n\n", 0, &output));
+
+		const char *body = strchr(output.buff, '\n');
+		assert_nonnull(body);
+		assert_string_eq("\n\n\tfirst line\n\t\n\tsecond line\n\n", body);
+		assert_nonnull(strstr(output.buff, "DEC " AUTHOR_NAME "]"));
+	}
+
+	strbuf_release(&output);
+	git_commit_object_release(&commit);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pretty_print_attachment_manifest_test)
+{
+	struct git_commit commit;
+	struct strbuf output;
+
+	git_commit_object_init(&commit);
+	strbuf_attach_str(&commit.author.name, AUTHOR_NAME);
+	strbuf_attach_str(&commit.body, "Git-Chat-Attachment: 3 2097152 build.log\n"
+			"\n-----BEGIN PGP MESSAGE-----\n");
+	strbuf_init(&output);
+
+	TEST_START() {
+		assert_zero(pretty_print(&commit, "see attached", 0, &output));
+
+		const char *body = strchr(output.buff, '\n');
+		assert_nonnull(body);
+		assert_string_eq("\n\n\tsee attached\n\t\n\tattachment 0: build.log (2097152 bytes)\n\n", body);
+	}
+
+	strbuf_release(&output);
+	git_commit_object_release(&commit);
+
+	TEST_END();
+}
+
+TEST_DEFINE(pretty_print_stream_test)
+{
+	struct git_commit commit;
+	struct strbuf expected, actual;
+
+	const char *messages[] = {
+			"hello",
+			"\n\t  leading and trailing whitespace \r\n\n ",
+			"several\nlines\n\n\twith  indentation\n",
+			"   ",
+			"",
+			NULL
+	};
+
+	git_commit_object_init(&commit);
+	strbuf_attach_str(&commit.author.name, AUTHOR_NAME);
+	strbuf_init(&expected);
+	strbuf_init(&actual);
+
+	TEST_START() {
+		for (const char **message = messages; *message; message++) {
+			for (size_t chunk_len = 1; chunk_len <= 8; chunk_len *= 2) {
+				strbuf_clear(&expected);
+				strbuf_clear(&actual);
+
+				assert_zero(pretty_print(&commit, *message, 0, &expected));
+				assert_zero(pretty_print(&commit, *message, chunk_len, &actual));
+
+				const char *actual_output = actual.buff;
+				assert_string_eq(expected.buff, actual_output);
+			}
+		}
+	}
+
+	strbuf_release(&actual);
+	strbuf_release(&expected);
+	git_commit_object_release(&commit);
+
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "pretty_print_message should indent the trimmed message", pretty_print_message_format_test },
+			{ "pretty_print_message should list the attachments of the message", pretty_print_attachment_manifest_test },
+			{ "pretty_print_stream should match pretty_print_message for any chunking", pretty_print_stream_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "test-lib.h"
@@ -131,6 +133,65 @@ TEST_DEFINE(run_command_with_env_test)
 	TEST_END();
 }
 
+TEST_DEFINE(run_command_env_changes_test)
+{
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.executable = "printenv";
+	argv_array_push(&cmd.args, "GIT_CHAT_TEST_VAR", "GIT_CHAT_TEST_CHILD_VAR", NULL);
+	str_array_push(&cmd.env, "GIT_CHAT_TEST_CHILD_VAR=child", NULL);
+
+	struct strbuf output_buf;
+	strbuf_init(&output_buf);
+
+	TEST_START() {
+		assert_zero(setenv("GIT_CHAT_TEST_VAR", "parent", 1));
+		int ret = capture_command(&cmd, &output_buf);
+		assert_eq(0, ret);
+		assert_string_eq("parent\nchild\n", output_buf.buff);
+
+		// changes to the environment after earlier commands must be seen
+		strbuf_clear(&output_buf);
+		assert_zero(setenv("GIT_CHAT_TEST_VAR", "changed", 1));
+		ret = capture_command(&cmd, &output_buf);
+		assert_eq(0, ret);
+		assert_string_eq("changed\nchild\n", output_buf.buff);
+
+		// variables of the child take precedence
+		strbuf_clear(&output_buf);
+		str_array_push(&cmd.env, "GIT_CHAT_TEST_VAR=overridden", NULL);
+		ret = capture_command(&cmd, &output_buf);
+		assert_eq(0, ret);
+		assert_string_eq("overridden\nchild\n", output_buf.buff);
+	}
+
+	unsetenv("GIT_CHAT_TEST_VAR");
+	strbuf_release(&output_buf);
+	child_process_def_release(&cmd);
+	TEST_END();
+}
+
+TEST_DEFINE(capture_command_from_dir_test)
+{
+	struct child_process_def cmd;
+	child_process_def_init(&cmd);
+	cmd.dir = "/";
+	cmd.executable = "pwd";
+
+	struct strbuf output_buf;
+	strbuf_init(&output_buf);
+
+	TEST_START() {
+		int ret = capture_command(&cmd, &output_buf);
+		assert_eq(0, ret);
+		assert_string_eq("/\n", output_buf.buff);
+	}
+
+	strbuf_release(&output_buf);
+	child_process_def_release(&cmd);
+	TEST_END();
+}
+
 TEST_DEFINE(run_command_git_test)
 {
 	struct child_process_def cmd;
@@ -410,6 +471,143 @@ TEST_DEFINE(run_command_chain_processes)
 	TEST_END();
 }
 
+#define PARALLEL_TASKS 8
+
+struct parallel_test_state {
+	size_t started;
+	size_t finished;
+	size_t stop_after;
+	const char *script;
+	int status[PARALLEL_TASKS];
+	struct strbuf out[PARALLEL_TASKS];
+	struct strbuf err[PARALLEL_TASKS];
+};
+
+static void parallel_test_state_init(struct parallel_test_state *state, const char *script)
+{
+	state->started = 0;
+	state->finished = 0;
+	state->stop_after = 0;
+	state->script = script;
+	for (size_t i = 0; i < PARALLEL_TASKS; i++) {
+		state->status[i] = -1;
+		strbuf_init(&state->out[i]);
+		strbuf_init(&state->err[i]);
+	}
+}
+
+static void parallel_test_state_release(struct parallel_test_state *state)
+{
+	for (size_t i = 0; i < PARALLEL_TASKS; i++) {
+		strbuf_release(&state->out[i]);
+		strbuf_release(&state->err[i]);
+	}
+}
+
+static int parallel_test_next_task(struct child_process_def *cmd, void *data, void **task_data)
+{
+	struct parallel_test_state *state = data;
+	if (state->started >= PARALLEL_TASKS)
+		return 0;
+
+	char index[16];
+	snprintf(index, sizeof(index), "%zu", state->started);
+
+	// the task index is given to the script as $0
+	cmd->executable = "sh";
+	argv_array_push(&cmd->args, "-c", state->script, index, NULL);
+	*task_data = &state->status[state->started++];
+
+	return 1;
+}
+
+static int parallel_test_task_finished(int status, struct strbuf *out, struct strbuf *err,
+		void *data, void *task_data)
+{
+	struct parallel_test_state *state = data;
+	size_t index = (int *) task_data - state->status;
+
+	state->status[index] = status;
+	strbuf_attach(&state->out[index], out->buff, out->len);
+	strbuf_attach(&state->err[index], err->buff, err->len);
+
+	return state->stop_after && ++state->finished >= state->stop_after;
+}
+
+TEST_DEFINE(run_processes_parallel_test)
+{
+	struct parallel_test_state state;
+	parallel_test_state_init(&state, "echo out-$0; echo err-$0 >&2; exit $(($0 % 2))");
+
+	TEST_START() {
+		int ret = run_processes_parallel(3, parallel_test_next_task,
+				parallel_test_task_finished, &state);
+		assert_zero(ret);
+		assert_eq(PARALLEL_TASKS, state.started);
+
+		for (size_t i = 0; i < PARALLEL_TASKS; i++) {
+			char buffer[16];
+			const char *expected = buffer;
+
+			assert_eq((int) (i % 2), state.status[i]);
+
+			snprintf(buffer, sizeof(buffer), "out-%zu\n", i);
+			assert_string_eq(expected, state.out[i].buff);
+			snprintf(buffer, sizeof(buffer), "err-%zu\n", i);
+			assert_string_eq(expected, state.err[i].buff);
+		}
+	}
+
+	parallel_test_state_release(&state);
+	TEST_END();
+}
+
+TEST_DEFINE(run_processes_parallel_large_output_test)
+{
+	struct parallel_test_state state;
+
+	// more than fits in a pipe, on both streams at once
+	parallel_test_state_init(&state, "head -c 300000 /dev/zero | tr '\\0' o; "
+			"head -c 300000 /dev/zero | tr '\\0' e >&2");
+
+	TEST_START() {
+		int ret = run_processes_parallel(4, parallel_test_next_task,
+				parallel_test_task_finished, &state);
+		assert_zero(ret);
+
+		for (size_t i = 0; i < PARALLEL_TASKS; i++) {
+			assert_zero(state.status[i]);
+			assert_eq(300000, state.out[i].len);
+			assert_eq(300000, state.err[i].len);
+			assert_eq('o', state.out[i].buff[state.out[i].len - 1]);
+			assert_eq('e', state.err[i].buff[state.err[i].len - 1]);
+		}
+	}
+
+	parallel_test_state_release(&state);
+	TEST_END();
+}
+
+TEST_DEFINE(run_processes_parallel_stop_test)
+{
+	struct parallel_test_state state;
+	parallel_test_state_init(&state, "echo $0");
+	state.stop_after = 2;
+
+	TEST_START() {
+		int ret = run_processes_parallel(1, parallel_test_next_task,
+				parallel_test_task_finished, &state);
+		assert_nonzero(ret);
+		assert_eq(2, state.started);
+		assert_string_eq("0\n", state.out[0].buff);
+		assert_string_eq("1\n", state.out[1].buff);
+		assert_eq(-1, state.status[2]);
+	}
+
+	parallel_test_state_release(&state);
+	TEST_END();
+}
+
 const char *suite_name = SUITE_NAME;
 int test_suite(struct test_runner_instance *instance)
 {
@@ -421,6 +619,8 @@ int test_suite(struct test_runner_instance *instance)
 			{ "Executing a child process by providing a full path to the executable should correctly find the executable to run", run_command_executable_path_to_file_test },
 			{ "Executing a child process by providing an executable that exists on the path should correctly find the executable to run", run_command_executable_on_path_test },
 			{ "Executing a child process with a custom environment should correctly merge the environment with the parent process's environment", run_command_with_env_test },
+			{ "Executing child processes should pick up changes to the parent process's environment", run_command_env_changes_test },
+			{ "Capturing stdout from a child process run from a given directory should run the process in that directory", capture_command_from_dir_test },
 			{ "Executing a git command should correctly invoke the git executable", run_command_git_test },
 			{ "run_command() should return the exit status code of the child process that was run", run_command_child_exit_status_test },
 			{ "Capturing stdout from a child process should correctly build the process output to a string buffer", capture_command_test },
@@ -428,6 +628,9 @@ int test_suite(struct test_runner_instance *instance)
 			{ "Executing a child process with a provisioned stdout fd should correctly use that fd as stdout", run_command_provisioned_out },
 			{ "Executing a child process with a provisioned stderr fd should correctly use that fd as stderr", run_command_provisioned_err },
 			{ "Chaining child processes' streams should correctly pipe data between them", run_command_chain_processes },
+			{ "Running processes in parallel should capture the output and exit status of each process", run_processes_parallel_test },
+			{ "Running processes in parallel should not block on processes that fill their pipes", run_processes_parallel_large_output_test },
+			{ "Running processes in parallel should stop starting tasks once a completion callback asks to", run_processes_parallel_stop_test },
 			{ NULL, NULL }
 	};
 
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-lib.h"
+#include "cache/search-index.h"
+
+static const char *message_oids[] = {
+		"1111111111111111111111111111111111111111",
+		"2222222222222222222222222222222222222222",
+		"3333333333333333333333333333333333333333",
+		"4444444444444444444444444444444444444444",
+};
+
+static const char *messages[] = {
+		"The deploy failed again, see the build log.",
+		"Deployment is scheduled for Friday. Build is green!",
+		"Has anyone seen the failed build? The build log is empty.",
+		"lunch?",
+};
+
+static void add_messages(struct search_index *index)
+{
+	for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+		struct git_oid oid;
+		git_str_to_oid(&oid, message_oids[i]);
+		search_index_add(index, &oid, messages[i], strlen(messages[i]));
+	}
+}
+
+/**
+ * Find the position of the message `n` in the search results, or -1.
+ * */
+static int result_position(const struct search_result *results, size_t len, size_t n)
+{
+	struct git_oid oid;
+	git_str_to_oid(&oid, message_oids[n]);
+
+	for (size_t i = 0; i < len; i++) {
+		if (!memcmp(results[i].oid.id, oid.id, GIT_RAW_OBJECT_ID))
+			return (int) i;
+	}
+
+	return -1;
+}
+
+TEST_DEFINE(search_index_term_query_test)
+{
+	struct search_index index;
+	struct search_result *results = NULL;
+	size_t len = 0;
+
+	search_index_init(&index);
+	add_messages(&index);
+
+	TEST_START() {
+		assert_eq(4, index.docs_len);
+
+		assert_zero(search_index_query(&index, "build", &results, &len));
+		assert_eq(3, len);
+
+		// message 2 mentions the build twice
+		assert_eq(0, result_position(results, len, 2));
+		free(results);
+		results = NULL;
+
+		// terms are case-insensitive, and all clauses must match
+		assert_zero(search_index_query(&index, "BUILD Log", &results, &len));
+		assert_eq(2, len);
+		assert_eq(-1, result_position(results, len, 1));
+		free(results);
+		results = NULL;
+
+		assert_zero(search_index_query(&index, "nothing", &results, &len));
+		assert_zero(len);
+		free(results);
+		results = NULL;
+
+		assert_nonzero(search_index_query(&index, "", &results, &len));
+		assert_nonzero(search_index_query(&index, "  ?! ", &results, &len));
+	}
+
+	free(results);
+	search_index_release(&index);
+	TEST_END();
+}
+
+TEST_DEFINE(search_index_prefix_and_phrase_query_test)
+{
+	struct search_index index;
+	struct search_result *results = NULL;
+	size_t len = 0;
+
+	search_index_init(&index);
+	add_messages(&index);
+
+	TEST_START() {
+		assert_zero(search_index_query(&index, "deploy*", &results, &len));
+		assert_eq(2, len);
+		assert_nonzero(result_position(results, len, 0) >= 0);
+		assert_nonzero(result_position(results, len, 1) >= 0);
+		free(results);
+		results = NULL;
+
+		assert_zero(search_index_query(&index, "\"build log\"", &results, &len));
+		assert_eq(2, len);
+		assert_eq(-1, result_position(results, len, 1));
+		free(results);
+		results = NULL;
+
+		// terms of the phrase must be adjacent and in order
+		assert_zero(search_index_query(&index, "\"log build\"", &results, &len));
+		assert_zero(len);
+		free(results);
+		results = NULL;
+
+		// clauses with several terms are phrases
+		assert_zero(search_index_query(&index, "failed-build", &results, &len));
+		assert_eq(1, len);
+		assert_eq(0, result_position(results, len, 2));
+		free(results);
+		results = NULL;
+
+		assert_nonzero(search_index_query(&index, "\"build log", &results, &len));
+	}
+
+	free(results);
+	search_index_release(&index);
+	TEST_END();
+}
+
+TEST_DEFINE(search_index_serialize_test)
+{
+	struct search_index index, parsed;
+	struct search_result *results = NULL;
+	struct strbuf out, long_message;
+	size_t len = 0;
+
+	search_index_init(&index);
+	search_index_init(&parsed);
+	strbuf_init(&out);
+	strbuf_init(&long_message);
+
+	// positions beyond 127 need multi-byte varints
+	for (int i = 0; i < 300; i++)
+		strbuf_attach_str(&long_message, i == 250 ? "needle " : "hay ");
+
+	TEST_START() {
+		struct git_oid oid;
+		add_messages(&index);
+		git_str_to_oid(&oid, "5555555555555555555555555555555555555555");
+		search_index_add(&index, &oid, long_message.buff, long_message.len);
+
+		// messages are only indexed once
+		search_index_add(&index, &oid, "other", 5);
+		assert_eq(5, index.docs_len);
+		assert_true(search_index_contains(&index, &oid));
+
+		search_index_serialize(&index, &out);
+		assert_eq(strlen(out.buff), out.len);
+
+		assert_zero(search_index_parse(&parsed, out.buff, out.len));
+		assert_eq(5, parsed.docs_len);
+		assert_true(search_index_contains(&parsed, &oid));
+
+		assert_zero(search_index_query(&parsed, "\"hay needle hay\"", &results, &len));
+		assert_eq(1, len);
+		assert_zero(memcmp(oid.id, results[0].oid.id, GIT_RAW_OBJECT_ID));
+		free(results);
+		results = NULL;
+
+		// new messages can be appended to a parsed index
+		git_str_to_oid(&oid, "6666666666666666666666666666666666666666");
+		search_index_add(&parsed, &oid, "build log", 9);
+		assert_zero(search_index_query(&parsed, "\"build log\"", &results, &len));
+		assert_eq(3, len);
+		free(results);
+		results = NULL;
+
+		search_index_release(&parsed);
+		search_index_init(&parsed);
+		assert_nonzero(search_index_parse(&parsed, out.buff, out.len - 2));
+		search_index_release(&parsed);
+		search_index_init(&parsed);
+		assert_nonzero(search_index_parse(&parsed, "git-chat search index v2\n0\n", 27));
+	}
+
+	free(results);
+	strbuf_release(&long_message);
+	strbuf_release(&out);
+	search_index_release(&parsed);
+	search_index_release(&index);
+	TEST_END();
+}
+
+const char *suite_name = SUITE_NAME;
+int test_suite(struct test_runner_instance *instance)
+{
+	struct unit_test tests[] = {
+			{ "search index should rank messages matching every term", search_index_term_query_test },
+			{ "search index should support prefix and phrase queries", search_index_prefix_and_phrase_query_test },
+			{ "search index should survive serialization", search_index_serialize_test },
+			{ NULL, NULL }
+	};
+
+	return execute_tests(instance, tests);
+}
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <unistd.h>
 
 #include "test-lib.h"
@@ -201,6 +202,57 @@ TEST_DEFINE(strbuf_attach_fd_stop_first_null_test) {
 	TEST_END();
 }
 
+TEST_DEFINE(strbuf_attach_bytes_test)
+{
+	struct strbuf buf;
+	strbuf_init(&buf);
+
+	TEST_START() {
+		const char bytes[] = "\x85\x02\0\x0c\0binary\0";
+		size_t len = sizeof(bytes) - 1;
+
+		strbuf_attach_bytes(&buf, bytes, len);
+		assert_eq(len, buf.len);
+		assert_zero(memcmp(bytes, buf.buff, len));
+		assert_true(is_null_terminated(&buf));
+
+		// large appends should grow the buffer
+		for (size_t i = 0; i < 100; i++)
+			strbuf_attach_bytes(&buf, bytes, len);
+		assert_eq(len * 101, buf.len);
+		assert_zero(memcmp(bytes, buf.buff + len * 100, len));
+		assert_true(is_null_terminated(&buf));
+	}
+
+	strbuf_release(&buf);
+	TEST_END();
+}
+
+TEST_DEFINE(strbuf_attach_fd_bytes_test) {
+	struct strbuf buf;
+	strbuf_init(&buf);
+
+	int fd[2];
+
+	TEST_START() {
+		assert_false_msg(pipe(fd) < 0, "pipe allocation failed");
+
+		const char *str = "my string message\0hello world\0hi";
+		size_t str_len = 32;
+		assert_eq_msg(str_len, xwrite(fd[1], str, str_len), "pipe write failed");
+		close(fd[1]);
+
+		strbuf_attach_fd_bytes(&buf, fd[0]);
+		assert_eq(str_len, buf.len);
+		assert_zero(memcmp(str, buf.buff, str_len));
+	}
+
+	strbuf_release(&buf);
+	close(fd[0]);
+
+	TEST_END();
+}
+
 TEST_DEFINE(strbuf_trim_test) {
 	struct strbuf buf;
 	strbuf_init(&buf);
@@ -521,6 +573,8 @@ int test_suite(struct test_runner_instance *instance)
 			{ "attaching a formatted string to strbuf should format the buffer correctly", strbuf_attach_fmt_test },
 			{ "attaching string to a strbuf from a file descriptor should consume data from file descriptor", strbuf_attach_fd_test },
 			{ "attaching string to a strbuf from a file descriptor should consume data up to the first null byte", strbuf_attach_fd_stop_first_null_test },
+			{ "attaching bytes to strbuf should keep null bytes", strbuf_attach_bytes_test },
+			{ "attaching bytes to a strbuf from a file descriptor should consume data past null bytes", strbuf_attach_fd_bytes_test },
 			{ "trimming whitespace from strbuf should trim correct number of characters", strbuf_trim_test },
 			{ "detaching string from strbuf should return correct string", strbuf_detach_test },
 			{ "splitting a strbuf on a simple delimiter should split as expected", strbuf_split_simple_delim_test },